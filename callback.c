@@ -14,7 +14,59 @@ struct callback {
     void *ctx;
 };
 
-struct callback *cbcurr = NULL, *cbhead = NULL, *cbtail = NULL;
+/*
+ * Two classes of queued callback. The normal class is for anything
+ * latency-sensitive; the bulk class is for data-shovelling work
+ * (channel data flushes, scrollback compression) which benefits from
+ * being run several at a time and mustn't delay the normal class.
+ */
+#define CBQ_NORMAL 0
+#define CBQ_BULK 1
+#define NCBQUEUES 2
+
+static struct callback_queue {
+    struct callback *head, *tail;
+} cbqueues[NCBQUEUES];
+
+struct callback *cbcurr = NULL;
+
+/*
+ * Number of bulk-class callbacks we'll run in one call to
+ * run_toplevel_callbacks, when the normal class is empty.
+ */
+#define BULK_CALLBACK_BUDGET 4
+
+/*
+ * Spare callback records kept for reuse, so that a busy connection
+ * queueing and running thousands of callbacks a second doesn't go
+ * to the allocator for each one.
+ */
+static struct callback *cbpool = NULL;
+static int cbpoolsize = 0;
+#define MAXCBPOOL 32
+
+static struct callback *cb_new(void)
+{
+    struct callback *cb;
+
+    if (cbpool) {
+        cb = cbpool;
+        cbpool = cb->next;
+        cbpoolsize--;
+    } else
+        cb = snew(struct callback);
+    return cb;
+}
+
+static void cb_free(struct callback *cb)
+{
+    if (cbpoolsize < MAXCBPOOL) {
+        cb->next = cbpool;
+        cbpool = cb;
+        cbpoolsize++;
+    } else
+        sfree(cb);
+}
 
 toplevel_callback_notify_fn_t notify_frontend = NULL;
 void *frontend = NULL;
@@ -28,33 +80,40 @@ void request_callback_notifications(toplevel_callback_notify_fn_t fn,
 
 void delete_callbacks_for_context(void *ctx)
 {
-    struct callback *newhead, *newtail;
-
-    newhead = newtail = NULL;
-    while (cbhead) {
-        struct callback *cb = cbhead;
-        cbhead = cbhead->next;
-        if (cb->ctx == ctx) {
-            sfree(cb);
-        } else {
-            if (!newhead)
-                newhead = cb;
-            else
-                newtail->next = cb;
-
-            newtail = cb;
+    int i;
+
+    for (i = 0; i < NCBQUEUES; i++) {
+        struct callback_queue *q = &cbqueues[i];
+        struct callback *newhead, *newtail;
+
+        newhead = newtail = NULL;
+        while (q->head) {
+            struct callback *cb = q->head;
+            q->head = q->head->next;
+            if (cb->ctx == ctx) {
+                cb_free(cb);
+            } else {
+                if (!newhead)
+                    newhead = cb;
+                else
+                    newtail->next = cb;
+
+                newtail = cb;
+            }
         }
-    }
 
-    cbhead = newhead;
-    cbtail = newtail;
+        q->head = newhead;
+        q->tail = newtail;
+    }
 }
 
-void queue_toplevel_callback(toplevel_callback_fn_t fn, void *ctx)
+static void queue_callback_in_class(int which, toplevel_callback_fn_t fn,
+                                    void *ctx)
 {
+    struct callback_queue *q = &cbqueues[which];
     struct callback *cb;
 
-    cb = snew(struct callback);
+    cb = cb_new();
     cb->fn = fn;
     cb->ctx = ctx;
 
@@ -69,41 +128,69 @@ void queue_toplevel_callback(toplevel_callback_fn_t fn, void *ctx)
      * a constant stream of needless re-notifications if the last
      * callback keeps re-scheduling itself.
      */
-    if (notify_frontend && !cbhead && !cbcurr)
+    if (notify_frontend && !cbqueues[CBQ_NORMAL].head &&
+        !cbqueues[CBQ_BULK].head && !cbcurr)
         notify_frontend(frontend);
 
-    if (cbtail)
-        cbtail->next = cb;
+    if (q->tail)
+        q->tail->next = cb;
     else
-        cbhead = cb;
-    cbtail = cb;
+        q->head = cb;
+    q->tail = cb;
     cb->next = NULL;
 }
 
-void run_toplevel_callbacks(void)
+void queue_toplevel_callback(toplevel_callback_fn_t fn, void *ctx)
 {
-    if (cbhead) {
-        /*
-         * Transfer the head callback into cbcurr to indicate that
-         * it's being executed. Then operations which transform the
-         * queue, like delete_callbacks_for_context, can proceed as if
-         * it's not there.
-         */
-        cbcurr = cbhead;
-        cbhead = cbhead->next;
-        if (!cbhead)
-            cbtail = NULL;
+    queue_callback_in_class(CBQ_NORMAL, fn, ctx);
+}
 
+void queue_bulk_callback(toplevel_callback_fn_t fn, void *ctx)
+{
+    queue_callback_in_class(CBQ_BULK, fn, ctx);
+}
+
+static void run_one_callback(struct callback_queue *q)
+{
+    /*
+     * Transfer the head callback into cbcurr to indicate that
+     * it's being executed. Then operations which transform the
+     * queue, like delete_callbacks_for_context, can proceed as if
+     * it's not there.
+     */
+    cbcurr = q->head;
+    q->head = q->head->next;
+    if (!q->head)
+        q->tail = NULL;
+
+    /*
+     * Now run the callback, and then clear it out of cbcurr.
+     */
+    cbcurr->fn(cbcurr->ctx);
+    cb_free(cbcurr);
+    cbcurr = NULL;
+}
+
+void run_toplevel_callbacks(void)
+{
+    if (cbqueues[CBQ_NORMAL].head) {
+        run_one_callback(&cbqueues[CBQ_NORMAL]);
+    } else {
         /*
-         * Now run the callback, and then clear it out of cbcurr.
+         * No normal-class work, so run a batch of bulk callbacks.
+         * Stop early if one of them queues something in the normal
+         * class, so that bulk data throughput never delays it by
+         * more than one callback's worth of work.
          */
-        cbcurr->fn(cbcurr->ctx);
-        sfree(cbcurr);
-        cbcurr = NULL;
+        int budget = BULK_CALLBACK_BUDGET;
+        while (budget-- > 0 && cbqueues[CBQ_BULK].head &&
+               !cbqueues[CBQ_NORMAL].head)
+            run_one_callback(&cbqueues[CBQ_BULK]);
     }
 }
 
 int toplevel_callback_pending(void)
 {
-    return cbcurr != NULL || cbhead != NULL;
+    return cbcurr != NULL || cbqueues[CBQ_NORMAL].head != NULL ||
+        cbqueues[CBQ_BULK].head != NULL;
 }
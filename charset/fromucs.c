@@ -72,7 +72,27 @@ int charset_from_unicode(const wchar_t **input, int *inlen,
     state = &localstate;
 
     while (*inlen > 0) {
-	int lenbefore = param.output - output;
+	int lenbefore;
+
+	/*
+	 * As in charset_to_unicode: stateless single-byte charsets
+	 * get runs of representable characters converted in one
+	 * go, leaving only unrepresentable characters and
+	 * buffer-full conditions to the per-character code below.
+	 */
+	if (spec->write == write_sbcs) {
+	    int done = write_sbcs_run(spec, *input, *inlen,
+				      param.output, param.outlen);
+	    if (done > 0) {
+		param.output += done;
+		param.outlen -= done;
+		*input += done;
+		*inlen -= done;
+		continue;
+	    }
+	}
+
+	lenbefore = param.output - output;
 	spec->write(spec, **input, &localstate, charset_emit, &param);
 	if (param.stopped) {
 	    /*
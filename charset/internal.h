@@ -79,6 +79,10 @@ void read_sbcs(charset_spec const *charset, long int input_chr,
 void write_sbcs(charset_spec const *charset, long int input_chr,
 		charset_state *state,
 		void (*emit)(void *ctx, long int output), void *emitctx);
+int read_sbcs_run(charset_spec const *charset, const char *input, int inlen,
+		  wchar_t *output, int outlen);
+int write_sbcs_run(charset_spec const *charset, const wchar_t *input,
+		   int inlen, char *output, int outlen);
 
 /*
  * Placate compiler warning about unused parameters, of which we
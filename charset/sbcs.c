@@ -51,3 +51,69 @@ void write_sbcs(charset_spec const *charset, long int input_chr,
     }
     emit(emitctx, ERROR);
 }
+
+/*
+ * Fast-path versions of the above, which convert a whole run of
+ * characters in one call. SBCSes carry no state and their translation
+ * is a table lookup per character, so there's no need to go through a
+ * function pointer and an emit callback for every single byte of a
+ * long stretch of session data.
+ *
+ * Each function converts as many characters as it can, stopping when
+ * it runs out of input or output or reaches a character it cannot
+ * translate directly (which is then left for the ordinary
+ * per-character function above to deal with), and returns the number
+ * of characters converted.
+ */
+int read_sbcs_run(charset_spec const *charset, const char *input, int inlen,
+		  wchar_t *output, int outlen)
+{
+    const struct sbcs_data *sd = charset->data;
+    unsigned long uc;
+    int n = 0;
+
+    while (n < inlen && n < outlen) {
+	uc = sd->sbcs2ucs[(unsigned char)input[n]];
+	if (uc == ERROR)
+	    break;
+	output[n] = uc;
+	n++;
+    }
+    return n;
+}
+
+int write_sbcs_run(charset_spec const *charset, const wchar_t *input,
+		   int inlen, char *output, int outlen)
+{
+    const struct sbcs_data *sd = charset->data;
+    long int input_chr;
+    int i, j, k, c;
+    int n = 0;
+
+    while (n < inlen && n < outlen) {
+	input_chr = input[n];
+
+	/*
+	 * Binary-search in the ucs2sbcs table, exactly as
+	 * write_sbcs() does.
+	 */
+	i = -1;
+	j = sd->nvalid;
+	c = 0;
+	while (i+1 < j) {
+	    k = (i+j)/2;
+	    c = sd->ucs2sbcs[k];
+	    if (input_chr < sd->sbcs2ucs[c])
+		j = k;
+	    else if (input_chr > sd->sbcs2ucs[c])
+		i = k;
+	    else
+		break;
+	}
+	if (i+1 >= j)
+	    break;		       /* not representable */
+	output[n] = c;
+	n++;
+    }
+    return n;
+}
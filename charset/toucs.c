@@ -68,7 +68,31 @@ int charset_to_unicode(const char **input, int *inlen,
     }
 
     while (*inlen > 0) {
-	int lenbefore = param.output - output;
+	int lenbefore;
+
+	/*
+	 * Single-byte character sets are stateless, so runs of
+	 * directly translatable bytes can be converted by plain
+	 * table lookup without dispatching through the read
+	 * function and the emit callback for every byte. Anything
+	 * the run converter stops at (an undefined byte value,
+	 * which needs the error string substituted, or the end of
+	 * the output buffer) drops through to the general code
+	 * below.
+	 */
+	if (spec->read == read_sbcs) {
+	    int done = read_sbcs_run(spec, *input, *inlen,
+				     param.output, param.outlen);
+	    if (done > 0) {
+		param.output += done;
+		param.outlen -= done;
+		*input += done;
+		*inlen -= done;
+		continue;
+	    }
+	}
+
+	lenbefore = param.output - output;
 	spec->read(spec, (unsigned char)**input, &localstate,
 		   unicode_emit, &param);
 	if (param.stopped) {
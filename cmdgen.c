@@ -13,6 +13,10 @@
 #include <errno.h>
 #include <string.h>
 
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
 #include "putty.h"
 #include "ssh.h"
 
@@ -137,7 +141,7 @@ void showversion(void)
 void usage(int standalone)
 {
     fprintf(standalone ? stderr : stdout,
-	    "Usage: puttygen ( keyfile | -t type [ -b bits ] )\n"
+	    "Usage: puttygen ( keyfile | -t type [ -b bits ] | --batch file )\n"
 	    "                [ -C comment ] [ -P ] [ -q ]\n"
 	    "                [ -o output-keyfile ] [ -O type | -l | -L"
 	    " | -p ]\n");
@@ -180,6 +184,11 @@ void help(void)
 	   "        specify file containing new key passphrase\n"
 	   "  --random-device device\n"
 	   "        specify device to read entropy from (e.g. /dev/urandom)\n"
+	   "  --batch file\n"
+	   "        generate one key per line of file (`type [bits] outfile\n"
+	   "        [comment]'), running generations in parallel\n"
+	   "  --batch-jobs n\n"
+	   "        limit batch mode to n concurrent key generations\n"
 	   );
 }
 
@@ -227,6 +236,443 @@ static char *readpassphrase(const char *filename)
 
 #define DEFAULT_RSADSA_BITS 2048
 
+enum keytype { NOKEYGEN, RSA1, RSA2, DSA, ECDSA, ED25519 };
+
+/*
+ * Parse a key type name, as given to -t or in a batch specification
+ * line. Returns FALSE if the name is unrecognised.
+ */
+static int parse_keytype(const char *p, enum keytype *keytype, int *sshver)
+{
+    if (!strcmp(p, "rsa") || !strcmp(p, "rsa2"))
+	*keytype = RSA2, *sshver = 2;
+    else if (!strcmp(p, "rsa1"))
+	*keytype = RSA1, *sshver = 1;
+    else if (!strcmp(p, "dsa") || !strcmp(p, "dss"))
+	*keytype = DSA, *sshver = 2;
+    else if (!strcmp(p, "ecdsa"))
+	*keytype = ECDSA, *sshver = 2;
+    else if (!strcmp(p, "ed25519"))
+	*keytype = ED25519, *sshver = 2;
+    else
+	return FALSE;
+    return TRUE;
+}
+
+/*
+ * Fill in the per-type default key size if none was specified, and
+ * check that the size makes sense for the type. Returns FALSE on a
+ * hard error; a legal-but-unwise RSA/DSA size just gets a warning.
+ */
+static int keysize_check(enum keytype keytype, int *bitsp)
+{
+    int bits = *bitsp;
+    int ok = TRUE;
+
+    if (bits == -1) {
+        /*
+         * No explicit key size was specified. Default varies
+         * depending on key type.
+         */
+        switch (keytype) {
+          case ECDSA:
+            bits = 384;
+            break;
+          case ED25519:
+            bits = 256;
+            break;
+          default:
+            bits = DEFAULT_RSADSA_BITS;
+            break;
+        }
+    }
+
+    if (keytype == ECDSA && (bits != 256 && bits != 384 && bits != 521)) {
+        fprintf(stderr, "puttygen: invalid bits for ECDSA, choose 256, 384 or 521\n");
+        ok = FALSE;
+    }
+
+    if (keytype == ED25519 && (bits != 256)) {
+        fprintf(stderr, "puttygen: invalid bits for ED25519, choose 256\n");
+        ok = FALSE;
+    }
+
+    if (keytype == RSA2 || keytype == RSA1 || keytype == DSA) {
+        if (bits < 256) {
+            fprintf(stderr, "puttygen: cannot generate %s keys shorter than"
+                    " 256 bits\n", (keytype == DSA ? "DSA" : "RSA"));
+            ok = FALSE;
+        } else if (bits < DEFAULT_RSADSA_BITS) {
+            fprintf(stderr, "puttygen: warning: %s keys shorter than"
+                    " %d bits are probably not secure\n",
+                    (keytype == DSA ? "DSA" : "RSA"), DEFAULT_RSADSA_BITS);
+            /* but this is just a warning, so proceed anyway */
+        }
+    }
+
+    *bitsp = bits;
+    return ok;
+}
+
+/*
+ * Generate a key of the given type and size, filling in either
+ * *ssh2key or *ssh1key as appropriate. The key's comment is set to
+ * the standard type-and-date default; callers wanting a different one
+ * replace it afterwards. Returns FALSE (after printing a message) if
+ * entropy collection failed.
+ */
+static int generate_key(enum keytype keytype, int bits,
+			const char *random_device, progfn_t progressfn,
+			struct ssh2_userkey **ssh2key_out,
+			struct RSAKey **ssh1key_out)
+{
+    char *entropy;
+    char default_comment[80];
+    struct tm tm;
+    struct progress prog;
+    struct ssh2_userkey *ssh2key = NULL;
+    struct RSAKey *ssh1key = NULL;
+
+    prog.phase = -1;
+    prog.current = -1;
+
+    tm = ltime();
+    if (keytype == DSA)
+	strftime(default_comment, 30, "dsa-key-%Y%m%d", &tm);
+    else if (keytype == ECDSA)
+	strftime(default_comment, 30, "ecdsa-key-%Y%m%d", &tm);
+    else if (keytype == ED25519)
+	strftime(default_comment, 30, "ed25519-key-%Y%m%d", &tm);
+    else
+	strftime(default_comment, 30, "rsa-key-%Y%m%d", &tm);
+
+    random_ref();
+    entropy = get_random_data(bits / 8, random_device);
+    if (!entropy) {
+	fprintf(stderr, "puttygen: failed to collect entropy, "
+		"could not generate key\n");
+	return FALSE;
+    }
+    random_add_heavynoise(entropy, bits / 8);
+    smemclr(entropy, bits/8);
+    sfree(entropy);
+
+    if (keytype == DSA) {
+	struct dss_key *dsskey = snew(struct dss_key);
+	dsa_generate(dsskey, bits, progressfn, &prog);
+	ssh2key = snew(struct ssh2_userkey);
+	ssh2key->data = dsskey;
+	ssh2key->alg = &ssh_dss;
+    } else if (keytype == ECDSA) {
+	struct ec_key *ec = snew(struct ec_key);
+	ec_generate(ec, bits, progressfn, &prog);
+	ssh2key = snew(struct ssh2_userkey);
+	ssh2key->data = ec;
+	ssh2key->alg = ec->signalg;
+    } else if (keytype == ED25519) {
+	struct ec_key *ec = snew(struct ec_key);
+	ec_edgenerate(ec, bits, progressfn, &prog);
+	ssh2key = snew(struct ssh2_userkey);
+	ssh2key->data = ec;
+	ssh2key->alg = &ssh_ecdsa_ed25519;
+    } else {
+	struct RSAKey *rsakey = snew(struct RSAKey);
+	rsa_generate(rsakey, bits, progressfn, &prog);
+	rsakey->comment = NULL;
+	if (keytype == RSA1) {
+	    ssh1key = rsakey;
+	} else {
+	    ssh2key = snew(struct ssh2_userkey);
+	    ssh2key->data = rsakey;
+	    ssh2key->alg = &ssh_rsa;
+	}
+    }
+    progressfn(&prog, PROGFN_PROGRESS, INT_MAX, -1);
+
+    if (ssh2key)
+	ssh2key->comment = dupstr(default_comment);
+    if (ssh1key)
+	ssh1key->comment = dupstr(default_comment);
+
+    *ssh2key_out = ssh2key;
+    *ssh1key_out = ssh1key;
+    return TRUE;
+}
+
+/* ----------------------------------------------------------------------
+ * Batch key generation (`puttygen --batch specfile').
+ *
+ * The specification file describes one key per line, in the form
+ *
+ *     type [bits] output-file [comment ...]
+ *
+ * where `type' is anything -t accepts. Blank lines and lines starting
+ * with `#' are ignored. Each key is written in PuTTY private key
+ * format; batch mode never prompts, so keys are saved unencrypted
+ * unless a passphrase was supplied with --new-passphrase.
+ *
+ * The prime searches in sshrsag.c and sshdssg.c are single-threaded,
+ * and the random pool in sshrand.c is a process-wide singleton, so
+ * concurrency comes from fork(): one worker process per key, up to a
+ * limit defaulting to the number of online processors. Workers fork
+ * _before_ touching the random pool, so that each one collects its
+ * own entropy (forking after random_ref would hand every worker
+ * identical pool state and hence related keys), save their key as
+ * soon as it is generated, and exit; the parent only reaps them and
+ * totals up the failures.
+ */
+
+struct batch_spec {
+    enum keytype keytype;
+    int bits;
+    char *outfile;
+    char *comment;		       /* NULL => default comment */
+    struct batch_spec *next;
+};
+
+static void free_batch_specs(struct batch_spec *spec)
+{
+    while (spec) {
+	struct batch_spec *next = spec->next;
+	sfree(spec->outfile);
+	sfree(spec->comment);
+	sfree(spec);
+	spec = next;
+    }
+}
+
+/*
+ * Parse one line of a batch specification file. Returns FALSE (after
+ * printing a message) if the line is malformed; comment and blank
+ * lines succeed with *out set to NULL.
+ */
+static int batch_parse_line(char *line, const char *specfile, int lineno,
+			    struct batch_spec **out)
+{
+    char *p = line, *word;
+    struct batch_spec *spec;
+    int len, sshver;
+
+    *out = NULL;
+
+    len = strlen(line);
+    while (len > 0 && (line[len-1] == ' ' || line[len-1] == '\t' ||
+		       line[len-1] == '\r' || line[len-1] == '\n'))
+	line[--len] = '\0';
+
+    p += strspn(p, " \t");
+    if (!*p || *p == '#')
+	return TRUE;
+
+    word = p;
+    p += strcspn(p, " \t");
+    if (*p)
+	*p++ = '\0';
+
+    spec = snew(struct batch_spec);
+    spec->bits = -1;
+    spec->outfile = spec->comment = NULL;
+    spec->next = NULL;
+
+    if (!parse_keytype(word, &spec->keytype, &sshver)) {
+	fprintf(stderr, "puttygen: %s:%d: unknown key type `%s'\n",
+		specfile, lineno, word);
+	free_batch_specs(spec);
+	return FALSE;
+    }
+
+    /*
+     * The key size is optional; a word consisting entirely of digits
+     * is taken to be one rather than an output file name.
+     */
+    p += strspn(p, " \t");
+    if (*p && strspn(p, "0123456789") == strcspn(p, " \t")) {
+	spec->bits = atoi(p);
+	p += strcspn(p, " \t");
+	p += strspn(p, " \t");
+    }
+
+    if (!*p) {
+	fprintf(stderr, "puttygen: %s:%d: expected an output file name\n",
+		specfile, lineno);
+	free_batch_specs(spec);
+	return FALSE;
+    }
+    word = p;
+    p += strcspn(p, " \t");
+    if (*p)
+	*p++ = '\0';
+    spec->outfile = dupstr(word);
+
+    if (!keysize_check(spec->keytype, &spec->bits)) {
+	fprintf(stderr, "puttygen: %s:%d: bad key size\n", specfile, lineno);
+	free_batch_specs(spec);
+	return FALSE;
+    }
+
+    /*
+     * Anything else on the line is the key comment.
+     */
+    p += strspn(p, " \t");
+    if (*p)
+	spec->comment = dupstr(p);
+
+    *out = spec;
+    return TRUE;
+}
+
+/*
+ * Worker-process body: generate one key from a batch specification
+ * and save it. Returns the worker's exit status.
+ */
+static int batch_generate(struct batch_spec *spec, const char *random_device,
+			  char *passphrase)
+{
+    struct ssh2_userkey *ssh2key;
+    struct RSAKey *ssh1key;
+    Filename *outfilename;
+    int ret;
+
+    if (!generate_key(spec->keytype, spec->bits, random_device,
+		      no_progress, &ssh2key, &ssh1key))
+	return 1;
+
+    if (spec->comment) {
+	if (ssh1key) {
+	    sfree(ssh1key->comment);
+	    ssh1key->comment = dupstr(spec->comment);
+	} else {
+	    sfree(ssh2key->comment);
+	    ssh2key->comment = dupstr(spec->comment);
+	}
+    }
+
+    outfilename = filename_from_str(spec->outfile);
+    if (ssh1key)
+	ret = saversakey(outfilename, ssh1key, passphrase);
+    else
+	ret = ssh2_save_userkey(outfilename, ssh2key, passphrase);
+    if (!ret) {
+	fprintf(stderr, "puttygen: unable to save key to `%s'\n",
+		spec->outfile);
+	return 1;
+    }
+
+    printf("puttygen: wrote `%s'\n", spec->outfile);
+    return 0;
+}
+
+/*
+ * Reap one worker, counting a failure if it didn't exit cleanly with
+ * status zero. Returns FALSE if there was nothing left to reap.
+ */
+static int batch_reap(int *failures)
+{
+    pid_t pid;
+    int status;
+
+    while ((pid = wait(&status)) < 0 && errno == EINTR);
+    if (pid < 0)
+	return FALSE;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	(*failures)++;
+    return TRUE;
+}
+
+static int batch_mode(const char *specfile, int njobs,
+		      const char *random_device, char *passphrase)
+{
+    FILE *fp;
+    char *line;
+    struct batch_spec *head = NULL, **tail = &head, *spec;
+    int lineno = 0, nkeys = 0, running = 0, failures = 0, ok = TRUE;
+    pid_t pid;
+
+    fp = fopen(specfile, "r");
+    if (!fp) {
+	fprintf(stderr, "puttygen: cannot open %s: %s\n",
+		specfile, strerror(errno));
+	return 1;
+    }
+    while ((line = fgetline(fp)) != NULL) {
+	lineno++;
+	if (!batch_parse_line(line, specfile, lineno, &spec))
+	    ok = FALSE;
+	else if (spec) {
+	    *tail = spec;
+	    tail = &spec->next;
+	    nkeys++;
+	}
+	sfree(line);
+    }
+    if (ferror(fp)) {
+	fprintf(stderr, "puttygen: error reading from %s: %s\n",
+		specfile, strerror(errno));
+	ok = FALSE;
+    }
+    fclose(fp);
+    if (!ok) {
+	/* Bad specification: generate nothing at all. */
+	free_batch_specs(head);
+	return 1;
+    }
+
+    if (passphrase && !*passphrase)
+	passphrase = NULL;
+
+    if (njobs <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	njobs = n > 0 ? n : 1;
+#else
+	njobs = 1;
+#endif
+    }
+
+    for (spec = head; spec; spec = spec->next) {
+	while (running >= njobs) {
+	    if (batch_reap(&failures))
+		running--;
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0 && running > 0) {
+	    /* Probably out of processes: finish a key and try again. */
+	    if (batch_reap(&failures))
+		running--;
+	    pid = fork();
+	}
+	if (pid < 0) {
+	    perror("puttygen: fork");
+	    failures++;
+	    break;
+	}
+	if (pid == 0) {
+	    /*
+	     * Worker process. The random pool has not been seeded in
+	     * this process yet, so random_ref inside generate_key
+	     * will collect entropy of our own.
+	     */
+	    exit(batch_generate(spec, random_device, passphrase));
+	}
+	running++;
+    }
+
+    while (running > 0) {
+	if (!batch_reap(&failures))
+	    break;
+	running--;
+    }
+
+    free_batch_specs(head);
+    if (failures) {
+	fprintf(stderr, "puttygen: %d of %d keys failed\n", failures, nkeys);
+	return 1;
+    }
+    return 0;
+}
+
 /* For Unix in particular, but harmless if this main() is reused elsewhere */
 const int buildinfo_gtk_relevant = FALSE;
 
@@ -234,7 +680,7 @@ int main(int argc, char **argv)
 {
     char *infile = NULL;
     Filename *infilename = NULL, *outfilename = NULL;
-    enum { NOKEYGEN, RSA1, RSA2, DSA, ECDSA, ED25519 } keytype = NOKEYGEN;
+    enum keytype keytype = NOKEYGEN;
     char *outfile = NULL, *outfiletmp = NULL;
     enum { PRIVATE, PUBLIC, PUBLICO, FP, OPENSSH_AUTO,
            OPENSSH_NEW, SSHCOM } outtype = PRIVATE;
@@ -254,6 +700,8 @@ int main(int argc, char **argv)
     int load_encrypted;
     progfn_t progressfn = is_interactive() ? progress_update : no_progress;
     const char *random_device = NULL;
+    char *batchfile = NULL;
+    int batchjobs = 0;
 
     /* ------------------------------------------------------------------
      * Parse the command line to figure out what we've been asked to do.
@@ -357,6 +805,32 @@ int main(int argc, char **argv)
 			    } else {
                                 random_device = val;
 			    }
+			} else if (!strcmp(opt, "-batch")) {
+			    if (!val && argc > 1)
+				--argc, val = *++argv;
+			    if (!val) {
+				errs = TRUE;
+				fprintf(stderr, "puttygen: option `-%s'"
+					" expects an argument\n", opt);
+			    } else {
+				batchfile = val;
+			    }
+			} else if (!strcmp(opt, "-batch-jobs")) {
+			    if (!val && argc > 1)
+				--argc, val = *++argv;
+			    if (!val) {
+				errs = TRUE;
+				fprintf(stderr, "puttygen: option `-%s'"
+					" expects an argument\n", opt);
+			    } else {
+				batchjobs = atoi(val);
+				if (batchjobs <= 0) {
+				    errs = TRUE;
+				    fprintf(stderr, "puttygen: option `-%s'"
+					    " expects a positive number\n",
+					    opt);
+				}
+			    }
 			} else {
 			    errs = TRUE;
 			    fprintf(stderr,
@@ -422,17 +896,7 @@ int main(int argc, char **argv)
 		     */
 		    switch (c) {
 		      case 't':
-			if (!strcmp(p, "rsa") || !strcmp(p, "rsa2"))
-			    keytype = RSA2, sshver = 2;
-			else if (!strcmp(p, "rsa1"))
-			    keytype = RSA1, sshver = 1;
-			else if (!strcmp(p, "dsa") || !strcmp(p, "dss"))
-			    keytype = DSA, sshver = 2;
-                        else if (!strcmp(p, "ecdsa"))
-                            keytype = ECDSA, sshver = 2;
-                        else if (!strcmp(p, "ed25519"))
-                            keytype = ED25519, sshver = 2;
-			else {
+			if (!parse_keytype(p, &keytype, &sshver)) {
 			    fprintf(stderr,
 				    "puttygen: unknown key type `%s'\n", p);
 			    errs = TRUE;
@@ -494,46 +958,21 @@ int main(int argc, char **argv)
 	}
     }
 
-    if (bits == -1) {
-        /*
-         * No explicit key size was specified. Default varies
-         * depending on key type.
-         */
-        switch (keytype) {
-          case ECDSA:
-            bits = 384;
-            break;
-          case ED25519:
-            bits = 256;
-            break;
-          default:
-            bits = DEFAULT_RSADSA_BITS;
-            break;
-        }
-    }
-
-    if (keytype == ECDSA && (bits != 256 && bits != 384 && bits != 521)) {
-        fprintf(stderr, "puttygen: invalid bits for ECDSA, choose 256, 384 or 521\n");
-        errs = TRUE;
-    }
-
-    if (keytype == ED25519 && (bits != 256)) {
-        fprintf(stderr, "puttygen: invalid bits for ED25519, choose 256\n");
-        errs = TRUE;
+    /*
+     * Batch mode does a self-contained job: reject attempts to
+     * combine it with the usual single-key operations. (-q,
+     * --random-device and --new-passphrase still apply to it.)
+     */
+    if (batchfile && (infile || keytype != NOKEYGEN || bits != -1 ||
+		      outfile || outtype != PRIVATE || comment ||
+		      change_passphrase || old_passphrase)) {
+	fprintf(stderr, "puttygen: `--batch' cannot be combined with"
+		" single-key options\n");
+	errs = TRUE;
     }
 
-    if (keytype == RSA2 || keytype == RSA1 || keytype == DSA) {
-        if (bits < 256) {
-            fprintf(stderr, "puttygen: cannot generate %s keys shorter than"
-                    " 256 bits\n", (keytype == DSA ? "DSA" : "RSA"));
-            errs = TRUE;
-        } else if (bits < DEFAULT_RSADSA_BITS) {
-            fprintf(stderr, "puttygen: warning: %s keys shorter than"
-                    " %d bits are probably not secure\n",
-                    (keytype == DSA ? "DSA" : "RSA"), DEFAULT_RSADSA_BITS);
-            /* but this is just a warning, so proceed anyway */
-        }
-    }
+    if (!keysize_check(keytype, &bits))
+	errs = TRUE;
 
     if (errs)
 	return 1;
@@ -541,6 +980,13 @@ int main(int argc, char **argv)
     if (nogo)
 	return 0;
 
+    /*
+     * Batch mode never gets as far as the single-key logic below.
+     */
+    if (batchfile)
+	return batch_mode(batchfile, batchjobs, random_device,
+			  new_passphrase);
+
     /*
      * If run with at least one argument _but_ not the required
      * ones, print the usage message and return failure.
@@ -690,75 +1136,9 @@ int main(int argc, char **argv)
      * Either load or generate a key.
      */
     if (keytype != NOKEYGEN) {
-	char *entropy;
-	char default_comment[80];
-	struct tm tm;
-	struct progress prog;
-
-	prog.phase = -1;
-	prog.current = -1;
-
-	tm = ltime();
-	if (keytype == DSA)
-	    strftime(default_comment, 30, "dsa-key-%Y%m%d", &tm);
-        else if (keytype == ECDSA)
-            strftime(default_comment, 30, "ecdsa-key-%Y%m%d", &tm);
-        else if (keytype == ED25519)
-            strftime(default_comment, 30, "ed25519-key-%Y%m%d", &tm);
-	else
-	    strftime(default_comment, 30, "rsa-key-%Y%m%d", &tm);
-
-	random_ref();
-	entropy = get_random_data(bits / 8, random_device);
-	if (!entropy) {
-	    fprintf(stderr, "puttygen: failed to collect entropy, "
-		    "could not generate key\n");
+	if (!generate_key(keytype, bits, random_device, progressfn,
+			  &ssh2key, &ssh1key))
 	    return 1;
-	}
-	random_add_heavynoise(entropy, bits / 8);
-	smemclr(entropy, bits/8);
-	sfree(entropy);
-
-	if (keytype == DSA) {
-	    struct dss_key *dsskey = snew(struct dss_key);
-	    dsa_generate(dsskey, bits, progressfn, &prog);
-	    ssh2key = snew(struct ssh2_userkey);
-	    ssh2key->data = dsskey;
-	    ssh2key->alg = &ssh_dss;
-	    ssh1key = NULL;
-        } else if (keytype == ECDSA) {
-            struct ec_key *ec = snew(struct ec_key);
-            ec_generate(ec, bits, progressfn, &prog);
-            ssh2key = snew(struct ssh2_userkey);
-            ssh2key->data = ec;
-            ssh2key->alg = ec->signalg;
-            ssh1key = NULL;
-        } else if (keytype == ED25519) {
-            struct ec_key *ec = snew(struct ec_key);
-            ec_edgenerate(ec, bits, progressfn, &prog);
-            ssh2key = snew(struct ssh2_userkey);
-            ssh2key->data = ec;
-            ssh2key->alg = &ssh_ecdsa_ed25519;
-            ssh1key = NULL;
-	} else {
-	    struct RSAKey *rsakey = snew(struct RSAKey);
-	    rsa_generate(rsakey, bits, progressfn, &prog);
-	    rsakey->comment = NULL;
-	    if (keytype == RSA1) {
-		ssh1key = rsakey;
-	    } else {
-		ssh2key = snew(struct ssh2_userkey);
-		ssh2key->data = rsakey;
-		ssh2key->alg = &ssh_rsa;
-	    }
-	}
-	progressfn(&prog, PROGFN_PROGRESS, INT_MAX, -1);
-
-	if (ssh2key)
-	    ssh2key->comment = dupstr(default_comment);
-	if (ssh1key)
-	    ssh1key->comment = dupstr(default_comment);
-
     } else {
 	const char *error = NULL;
 	int encrypted;
@@ -1647,6 +2027,60 @@ int main(int argc, char **argv)
 	setup_passphrases(NULL);
 	test(1, "puttygen", "-C", "spurious-new-comment", pubfilename, NULL);
     }
+
+    /*
+     * Batch mode: generate several keys from one specification file,
+     * then put the output through the standard consistency checks.
+     */
+    {
+	FILE *fp;
+
+	fp = fopen("test-batch.spec", "w");
+	assert(fp);
+	fprintf(fp, "# cgtest batch specification\n"
+		"\n"
+		"rsa test-batch-rsa.ppk batch rsa comment\n"
+		"dsa 2048 test-batch-dsa.ppk\n"
+		"rsa1 2048 test-batch-rsa1.ppk\n");
+	fclose(fp);
+
+	setup_passphrases(NULL);
+	test(0, "puttygen", "--batch", "test-batch.spec", NULL);
+
+	/*
+	 * Each generated key should load, fingerprint and list
+	 * without needing a passphrase.
+	 */
+	setup_passphrases(NULL);
+	test(0, "puttygen", "-l", "test-batch-rsa.ppk", NULL);
+	setup_passphrases(NULL);
+	test(0, "puttygen", "-L", "test-batch-rsa.ppk", NULL);
+	setup_passphrases(NULL);
+	test(0, "puttygen", "-C", "changed-comment", "test-batch-rsa.ppk",
+	     NULL);
+	setup_passphrases(NULL);
+	test(0, "puttygen", "-l", "test-batch-dsa.ppk", NULL);
+	setup_passphrases(NULL);
+	test(0, "puttygen", "-l", "test-batch-rsa1.ppk", NULL);
+
+	/*
+	 * Batch mode conflicts with single-key options.
+	 */
+	setup_passphrases(NULL);
+	test(1, "puttygen", "--batch", "test-batch.spec", "-t", "rsa", NULL);
+
+	/*
+	 * A malformed specification must fail before generating
+	 * anything.
+	 */
+	fp = fopen("test-batch.spec", "w");
+	assert(fp);
+	fprintf(fp, "rsa2048 test-batch-bogus.ppk\n");
+	fclose(fp);
+	setup_passphrases(NULL);
+	test(1, "puttygen", "--batch", "test-batch.spec", NULL);
+    }
+
     printf("%d passes, %d fails\n", passes, fails);
     return 0;
 }
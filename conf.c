@@ -65,6 +65,28 @@ struct conf_entry {
 
 struct conf_tag {
     tree234 *tree;
+    /*
+     * Direct-indexed cache of the entries for primary keys with no
+     * subkey, which are the ones looked up on hot paths (e.g. once
+     * per keystroke in ldisc.c). Since those keys are a dense enum,
+     * indexing by the primary key itself is a perfect hash; keys with
+     * int- or string-designated subkeys are still found via the tree.
+     * Also a generation count, bumped on every modification, so that
+     * readers caching values out of a Conf can cheaply detect when
+     * they need to refresh.
+     */
+    struct conf_entry *cache[N_CONFIG_OPTIONS];
+    unsigned generation;
+    /*
+     * Cached serialised form of the whole Conf, and the generation at
+     * which it was built. Duplicate-session spawning and connection
+     * sharing serialise the same unmodified Conf repeatedly, so after
+     * the first build those calls are a length lookup and a memcpy
+     * instead of a full tree walk.
+     */
+    unsigned char *serialised;
+    int serialised_len;
+    unsigned serialised_generation;
 };
 
 /*
@@ -199,8 +221,15 @@ static void free_entry(struct conf_entry *entry)
 Conf *conf_new(void)
 {
     Conf *conf = snew(struct conf_tag);
+    int i;
 
     conf->tree = newtree234(conf_cmp);
+    for (i = 0; i < N_CONFIG_OPTIONS; i++)
+	conf->cache[i] = NULL;
+    conf->generation = 0;
+    conf->serialised = NULL;
+    conf->serialised_len = 0;
+    conf->serialised_generation = 0;
 
     return conf;
 }
@@ -208,15 +237,20 @@ Conf *conf_new(void)
 static void conf_clear(Conf *conf)
 {
     struct conf_entry *entry;
+    int i;
 
     while ((entry = delpos234(conf->tree, 0)) != NULL)
 	free_entry(entry);
+    for (i = 0; i < N_CONFIG_OPTIONS; i++)
+	conf->cache[i] = NULL;
+    conf->generation++;
 }
 
 void conf_free(Conf *conf)
 {
     conf_clear(conf);
     freetree234(conf->tree);
+    sfree(conf->serialised);
     sfree(conf);
 }
 
@@ -229,22 +263,29 @@ static void conf_insert(Conf *conf, struct conf_entry *entry)
 	oldentry = add234(conf->tree, entry);
 	assert(oldentry == entry);
     }
+    if (subkeytypes[entry->key.primary] == TYPE_NONE)
+	conf->cache[entry->key.primary] = entry;
+    conf->generation++;
 }
 
 void conf_copy_into(Conf *newconf, Conf *oldconf)
 {
     struct conf_entry *entry, *entry2;
-    int i;
+    iter234 it;
 
     conf_clear(newconf);
 
-    for (i = 0; (entry = index234(oldconf->tree, i)) != NULL; i++) {
+    for (entry = first234(oldconf->tree, &it); entry != NULL;
+	 entry = next234(&it)) {
 	entry2 = snew(struct conf_entry);
 	copy_key(&entry2->key, &entry->key);
 	copy_value(&entry2->value, &entry->value,
 		   valuetypes[entry->key.primary]);
 	add234(newconf->tree, entry2);
+	if (subkeytypes[entry2->key.primary] == TYPE_NONE)
+	    newconf->cache[entry2->key.primary] = entry2;
     }
+    newconf->generation++;
 }
 
 Conf *conf_copy(Conf *oldconf)
@@ -256,15 +297,18 @@ Conf *conf_copy(Conf *oldconf)
     return newconf;
 }
 
+unsigned conf_generation(Conf *conf)
+{
+    return conf->generation;
+}
+
 int conf_get_int(Conf *conf, int primary)
 {
-    struct key key;
     struct conf_entry *entry;
 
     assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_INT);
-    key.primary = primary;
-    entry = find234(conf->tree, &key, NULL);
+    entry = conf->cache[primary];
     assert(entry);
     return entry->value.u.intval;
 }
@@ -285,13 +329,11 @@ int conf_get_int_int(Conf *conf, int primary, int secondary)
 
 char *conf_get_str(Conf *conf, int primary)
 {
-    struct key key;
     struct conf_entry *entry;
 
     assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_STR);
-    key.primary = primary;
-    entry = find234(conf->tree, &key, NULL);
+    entry = conf->cache[primary];
     assert(entry);
     return entry->value.u.stringval;
 }
@@ -360,26 +402,22 @@ char *conf_get_str_nthstrkey(Conf *conf, int primary, int n)
 
 Filename *conf_get_filename(Conf *conf, int primary)
 {
-    struct key key;
     struct conf_entry *entry;
 
     assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_FILENAME);
-    key.primary = primary;
-    entry = find234(conf->tree, &key, NULL);
+    entry = conf->cache[primary];
     assert(entry);
     return entry->value.u.fileval;
 }
 
 FontSpec *conf_get_fontspec(Conf *conf, int primary)
 {
-    struct key key;
     struct conf_entry *entry;
 
     assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_FONT);
-    key.primary = primary;
-    entry = find234(conf->tree, &key, NULL);
+    entry = conf->cache[primary];
     assert(entry);
     return entry->value.u.fontval;
 }
@@ -444,6 +482,7 @@ void conf_del_str_str(Conf *conf, int primary, const char *secondary)
     if (entry) {
 	del234(conf->tree, entry);
 	free_entry(entry);
+	conf->generation++;
     }
  }
 
@@ -469,13 +508,14 @@ void conf_set_fontspec(Conf *conf, int primary, const FontSpec *value)
     conf_insert(conf, entry);
 }
 
-int conf_serialised_size(Conf *conf)
+static int conf_serialised_size_walk(Conf *conf)
 {
-    int i;
     struct conf_entry *entry;
+    iter234 it;
     int size = 0;
 
-    for (i = 0; (entry = index234(conf->tree, i)) != NULL; i++) {
+    for (entry = first234(conf->tree, &it); entry != NULL;
+	 entry = next234(&it)) {
 	size += 4;   /* primary key */
 	switch (subkeytypes[entry->key.primary]) {
 	  case TYPE_INT:
@@ -506,13 +546,15 @@ int conf_serialised_size(Conf *conf)
     return size;
 }
 
-void conf_serialise(Conf *conf, void *vdata)
+static void conf_serialise_walk(Conf *conf, void *vdata)
 {
     unsigned char *data = (unsigned char *)vdata;
-    int i, len;
+    int len;
     struct conf_entry *entry;
+    iter234 it;
 
-    for (i = 0; (entry = index234(conf->tree, i)) != NULL; i++) {
+    for (entry = first234(conf->tree, &it); entry != NULL;
+	 entry = next234(&it)) {
 	PUT_32BIT_MSB_FIRST(data, entry->key.primary);
 	data += 4;
 
@@ -551,6 +593,34 @@ void conf_serialise(Conf *conf, void *vdata)
     PUT_32BIT_MSB_FIRST(data, 0xFFFFFFFFU);
 }
 
+/*
+ * (Re)build the cached serialised form if the Conf has changed since
+ * it was last built. The generation count, which every modification
+ * path already bumps, is the dirtiness test.
+ */
+static void conf_build_serialised(Conf *conf)
+{
+    if (conf->serialised && conf->serialised_generation == conf->generation)
+	return;
+    sfree(conf->serialised);
+    conf->serialised_len = conf_serialised_size_walk(conf);
+    conf->serialised = snewn(conf->serialised_len, unsigned char);
+    conf_serialise_walk(conf, conf->serialised);
+    conf->serialised_generation = conf->generation;
+}
+
+int conf_serialised_size(Conf *conf)
+{
+    conf_build_serialised(conf);
+    return conf->serialised_len;
+}
+
+void conf_serialise(Conf *conf, void *vdata)
+{
+    conf_build_serialised(conf);
+    memcpy(vdata, conf->serialised, conf->serialised_len);
+}
+
 int conf_deserialise(Conf *conf, void *vdata, int maxsize)
 {
     unsigned char *data = (unsigned char *)vdata;
@@ -4,6 +4,7 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdlib.h>
 
 #include "putty.h"
@@ -604,10 +605,14 @@ static void sshbug_handler(union control *ctrl, void *dlg,
 
 struct sessionsaver_data {
     union control *editbox, *listbox, *loadbutton, *savebutton, *delbutton;
+    union control *searchbox;
     union control *okbutton, *cancelbutton;
     struct sesslist sesslist;
     int midsession;
     char *savedsession;     /* the current contents of ssd->editbox */
+    char *filter;           /* the current contents of ssd->searchbox */
+    int *listmap;           /* listbox index -> sesslist index */
+    int nlisted;            /* number of sessions passing the filter */
 };
 
 static void sessionsaver_data_free(void *ssdv)
@@ -615,9 +620,60 @@ static void sessionsaver_data_free(void *ssdv)
     struct sessionsaver_data *ssd = (struct sessionsaver_data *)ssdv;
     get_sesslist(&ssd->sesslist, FALSE);
     sfree(ssd->savedsession);
+    sfree(ssd->filter);
+    sfree(ssd->listmap);
     sfree(ssd);
 }
 
+/*
+ * Case-insensitive substring match for the saved-session search box.
+ */
+static int sessionsaver_match(const char *name, const char *filter)
+{
+    int i, j;
+    if (!filter || !*filter)
+	return TRUE;
+    for (i = 0; name[i]; i++) {
+	for (j = 0; filter[j]; j++) {
+	    if (tolower((unsigned char)name[i+j]) !=
+		tolower((unsigned char)filter[j]))
+		break;
+	}
+	if (!filter[j])
+	    return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * Rebuild the mapping from listbox rows to sesslist entries,
+ * applying the current search filter. The sesslist itself is already
+ * cached and sorted; this is just an index over it, so retyping the
+ * filter never rescans saved-session storage.
+ */
+static void sessionsaver_refilter(struct sessionsaver_data *ssd)
+{
+    int i;
+    ssd->listmap = sresize(ssd->listmap, ssd->sesslist.nsessions, int);
+    ssd->nlisted = 0;
+    for (i = 0; i < ssd->sesslist.nsessions; i++)
+	if (sessionsaver_match(ssd->sesslist.sessions[i], ssd->filter))
+	    ssd->listmap[ssd->nlisted++] = i;
+}
+
+/*
+ * Translate a listbox row into an index into ssd->sesslist.sessions,
+ * or -1 if the row is out of range.
+ */
+static int sessionsaver_real_index(struct sessionsaver_data *ssd, int i)
+{
+    if (i < 0)
+	return -1;
+    if (!ssd->listmap)
+	return i < ssd->sesslist.nsessions ? i : -1;
+    return i < ssd->nlisted ? ssd->listmap[i] : -1;
+}
+
 /* 
  * Helper function to load the session selected in the list box, if
  * any, as this is done in more than one place below. Returns 0 for
@@ -627,15 +683,16 @@ static int load_selected_session(struct sessionsaver_data *ssd,
 				 void *dlg, Conf *conf, int *maybe_launch)
 {
     int i = dlg_listbox_index(ssd->listbox, dlg);
+    int real = sessionsaver_real_index(ssd, i);
     int isdef;
-    if (i < 0) {
+    if (real < 0) {
 	dlg_beep(dlg);
 	return 0;
     }
-    isdef = !strcmp(ssd->sesslist.sessions[i], "Default Settings");
-    load_settings(ssd->sesslist.sessions[i], conf);
+    isdef = !strcmp(ssd->sesslist.sessions[real], "Default Settings");
+    load_settings(ssd->sesslist.sessions[real], conf);
     sfree(ssd->savedsession);
-    ssd->savedsession = dupstr(isdef ? "" : ssd->sesslist.sessions[i]);
+    ssd->savedsession = dupstr(isdef ? "" : ssd->sesslist.sessions[real]);
     if (maybe_launch)
         *maybe_launch = !isdef;
     dlg_refresh(NULL, dlg);
@@ -655,34 +712,44 @@ static void sessionsaver_handler(union control *ctrl, void *dlg,
     if (event == EVENT_REFRESH) {
 	if (ctrl == ssd->editbox) {
 	    dlg_editbox_set(ctrl, dlg, ssd->savedsession);
+	} else if (ctrl == ssd->searchbox) {
+	    dlg_editbox_set(ctrl, dlg, ssd->filter ? ssd->filter : "");
 	} else if (ctrl == ssd->listbox) {
 	    int i;
+	    sessionsaver_refilter(ssd);
 	    dlg_update_start(ctrl, dlg);
 	    dlg_listbox_clear(ctrl, dlg);
-	    for (i = 0; i < ssd->sesslist.nsessions; i++)
-		dlg_listbox_add(ctrl, dlg, ssd->sesslist.sessions[i]);
+	    for (i = 0; i < ssd->nlisted; i++)
+		dlg_listbox_add(ctrl, dlg,
+				ssd->sesslist.sessions[ssd->listmap[i]]);
 	    dlg_update_done(ctrl, dlg);
 	}
     } else if (event == EVENT_VALCHANGE) {
         int top, bottom, halfway, i;
-	if (ctrl == ssd->editbox) {
+	if (ctrl == ssd->searchbox) {
+	    sfree(ssd->filter);
+	    ssd->filter = dlg_editbox_get(ctrl, dlg);
+	    dlg_refresh(ssd->listbox, dlg);
+	} else if (ctrl == ssd->editbox) {
             sfree(ssd->savedsession);
             ssd->savedsession = dlg_editbox_get(ctrl, dlg);
-	    top = ssd->sesslist.nsessions;
+	    top = ssd->nlisted;
 	    bottom = -1;
 	    while (top-bottom > 1) {
 	        halfway = (top+bottom)/2;
-	        i = strcmp(ssd->savedsession, ssd->sesslist.sessions[halfway]);
+	        i = strcmp(ssd->savedsession,
+			   ssd->sesslist.sessions[ssd->listmap[halfway]]);
 	        if (i <= 0 ) {
 		    top = halfway;
 	        } else {
 		    bottom = halfway;
 	        }
 	    }
-	    if (top == ssd->sesslist.nsessions) {
+	    if (top == ssd->nlisted) {
 	        top -= 1;
 	    }
-	    dlg_listbox_select(ssd->listbox, dlg, top);
+	    if (top >= 0)
+		dlg_listbox_select(ssd->listbox, dlg, top);
 	}
     } else if (event == EVENT_ACTION) {
 	int mbl = FALSE;
@@ -703,7 +770,8 @@ static void sessionsaver_handler(union control *ctrl, void *dlg,
 	} else if (ctrl == ssd->savebutton) {
 	    int isdef = !strcmp(ssd->savedsession, "Default Settings");
 	    if (!ssd->savedsession[0]) {
-		int i = dlg_listbox_index(ssd->listbox, dlg);
+		int i = sessionsaver_real_index(
+		    ssd, dlg_listbox_index(ssd->listbox, dlg));
 		if (i < 0) {
 		    dlg_beep(dlg);
 		    return;
@@ -726,8 +794,9 @@ static void sessionsaver_handler(union control *ctrl, void *dlg,
 	    dlg_refresh(ssd->listbox, dlg);
 	} else if (!ssd->midsession &&
 		   ssd->delbutton && ctrl == ssd->delbutton) {
-	    int i = dlg_listbox_index(ssd->listbox, dlg);
-	    if (i <= 0) {
+	    int i = sessionsaver_real_index(
+		ssd, dlg_listbox_index(ssd->listbox, dlg));
+	    if (i <= 0) {	       /* never delete Default Settings */
 		dlg_beep(dlg);
 	    } else {
 		del_settings(ssd->sesslist.sessions[i]);
@@ -1539,6 +1608,15 @@ void setup_config_box(struct controlbox *b, int midsession,
      * than alongside that edit box. */
     ctrl_columns(s, 1, 100);
     ctrl_columns(s, 2, 75, 25);
+    /*
+     * Incremental search over the saved-session list: typing here
+     * narrows the listbox to matching sessions. Handy once the list
+     * runs to hundreds of entries.
+     */
+    ssd->searchbox = ctrl_editbox(s, "Search", 'r', 100,
+				  HELPCTX(session_saved),
+				  sessionsaver_handler, P(ssd), P(NULL));
+    ssd->searchbox->generic.column = 0;
     ssd->listbox = ctrl_listbox(s, NULL, NO_SHORTCUT,
 				HELPCTX(session_saved),
 				sessionsaver_handler, P(ssd));
@@ -1592,14 +1670,16 @@ void setup_config_box(struct controlbox *b, int midsession,
      * logging can sensibly be available.
      */
     {
-	const char *sshlogname, *sshrawlogname;
+	const char *sshlogname, *sshrawlogname, *sshbinlogname;
 	if ((midsession && protocol == PROT_SSH) ||
 	    (!midsession && backend_from_proto(PROT_SSH))) {
 	    sshlogname = "SSH packets";
 	    sshrawlogname = "SSH packets and raw data";
+	    sshbinlogname = "SSH packets (binary format)";
         } else {
-	    sshlogname = NULL;	       /* this will disable both buttons */
+	    sshlogname = NULL;	       /* this will disable all three */
 	    sshrawlogname = NULL;      /* this will just placate optimisers */
+	    sshbinlogname = NULL;
         }
 	ctrl_radiobuttons(s, "Session logging:", NO_SHORTCUT, 2,
 			  HELPCTX(logging_main),
@@ -1610,6 +1690,7 @@ void setup_config_box(struct controlbox *b, int midsession,
 			  "All session output", 'l', I(LGTYP_DEBUG),
 			  sshlogname, 's', I(LGTYP_PACKETS),
 			  sshrawlogname, 'r', I(LGTYP_SSHRAW),
+			  sshbinlogname, 'b', I(LGTYP_PKTBIN),
 			  NULL);
     }
     ctrl_filesel(s, "Log file name:", 'f',
@@ -1632,6 +1713,17 @@ void setup_config_box(struct controlbox *b, int midsession,
     ctrl_checkbox(s, "Create folders if required", 'q',
 		 HELPCTX(logging_mkdir),
 		 conf_checkbox_handler, I(CONF_logmkdir));
+    ctrl_editbox(s, "Rotate log when it reaches this many MB (0 for never):",
+		 'm', 20,
+		 HELPCTX(logging_rotate),
+		 conf_editbox_handler, I(CONF_logrotate_size), I(-1));
+    ctrl_editbox(s, "Rotate log after this many minutes (0 for never):",
+		 'n', 20,
+		 HELPCTX(logging_rotate),
+		 conf_editbox_handler, I(CONF_logrotate_time), I(-1));
+    ctrl_checkbox(s, "Compress rotated logs", 'z',
+		 HELPCTX(logging_rotate),
+		 conf_checkbox_handler, I(CONF_logrotate_compress));
 
     if ((midsession && protocol == PROT_SSH) ||
 	(!midsession && backend_from_proto(PROT_SSH))) {
@@ -1686,6 +1778,9 @@ void setup_config_box(struct controlbox *b, int midsession,
 		      "Auto", I(AUTO),
 		      "Force on", I(FORCE_ON),
 		      "Force off", I(FORCE_OFF), NULL);
+    ctrl_checkbox(s, "Predict echo of keystrokes on slow links", 'k',
+		  HELPCTX(terminal_localecho),
+		  conf_checkbox_handler,I(CONF_localecho_predict));
 
     s = ctrl_getset(b, "Terminal", "printing", "Remote-controlled printing");
     ctrl_combobox(s, "Printer to send ANSI printer output to:", 'p', 100,
@@ -1851,6 +1946,10 @@ void setup_config_box(struct controlbox *b, int midsession,
 		  HELPCTX(window_erased),
 		  conf_checkbox_handler,
 		  I(CONF_erase_to_scrollback));
+    ctrl_filesel(s, "Snapshot file to preserve scrollback across sessions:",
+		 'v', NULL, TRUE, "Select scrollback snapshot file name",
+		 HELPCTX(window_scrollback),
+		 conf_filesel_handler, I(CONF_scrollback_snapshot));
 
     /*
      * The Window/Appearance panel.
@@ -2352,6 +2451,10 @@ void setup_config_box(struct controlbox *b, int midsession,
 			  HELPCTX(ssh_compress),
 			  conf_checkbox_handler,
 			  I(CONF_compression));
+	    ctrl_editbox(s, "Compression level (1-9)", 'v', 20,
+			 HELPCTX(ssh_compress),
+			 conf_editbox_handler,
+			 I(CONF_compressionlevel), I(-1));
 	}
 
 	if (!midsession) {
@@ -0,0 +1,152 @@
+/*
+ * eventring.c: bounded storage for the GUI Event Log.
+ *
+ * The GUI front ends used to keep every event-log entry for the
+ * lifetime of the session, so a long-running connection with verbose
+ * events would grow without limit and make the Event Log dialog take
+ * noticeable time to open. Instead, entries now live in a fixed-size
+ * ring: once it fills up, each new event discards the oldest one.
+ *
+ * Event message texts repeat a lot (keepalives, rekey announcements
+ * and so on), so the message part of each entry is interned in a
+ * reference-counted tree234 and shared between all ring slots that
+ * carry it; only the timestamp is stored per entry.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "putty.h"
+#include "tree234.h"
+
+#define EVENTRING_SIZE 2048	       /* entries kept per session */
+
+struct interned_msg {
+    int refs;
+    char *text;
+};
+
+struct eventring_entry {
+    char time[24];		       /* "YYYY-MM-DD HH:MM:SS\t" */
+    struct interned_msg *msg;
+};
+
+struct eventring {
+    tree234 *interned;		       /* interned_msg, sorted by text */
+    struct eventring_entry ring[EVENTRING_SIZE];
+    int start;			       /* index of the oldest entry */
+    int count;			       /* number of entries stored */
+    int discarded;		       /* entries dropped off the back */
+    char *scratch;		       /* formatting buffer for _get */
+    int scratchsize;
+};
+
+static int interned_msg_cmp(void *av, void *bv)
+{
+    struct interned_msg *a = (struct interned_msg *)av;
+    struct interned_msg *b = (struct interned_msg *)bv;
+    return strcmp(a->text, b->text);
+}
+
+struct eventring *eventring_new(void)
+{
+    struct eventring *er = snew(struct eventring);
+    er->interned = newtree234(interned_msg_cmp);
+    er->start = er->count = er->discarded = 0;
+    er->scratch = NULL;
+    er->scratchsize = 0;
+    return er;
+}
+
+static struct interned_msg *msg_intern(struct eventring *er, const char *text)
+{
+    struct interned_msg search, *msg;
+
+    search.text = (char *)text;	       /* not modified by the compare */
+    msg = find234(er->interned, &search, NULL);
+    if (!msg) {
+	msg = snew(struct interned_msg);
+	msg->refs = 0;
+	msg->text = dupstr(text);
+	add234(er->interned, msg);
+    }
+    msg->refs++;
+    return msg;
+}
+
+static void msg_unref(struct eventring *er, struct interned_msg *msg)
+{
+    if (--msg->refs == 0) {
+	del234(er->interned, msg);
+	sfree(msg->text);
+	sfree(msg);
+    }
+}
+
+void eventring_free(struct eventring *er)
+{
+    int i;
+
+    for (i = 0; i < er->count; i++)
+	msg_unref(er, er->ring[(er->start + i) % EVENTRING_SIZE].msg);
+    assert(count234(er->interned) == 0);
+    freetree234(er->interned);
+    sfree(er->scratch);
+    sfree(er);
+}
+
+void eventring_add(struct eventring *er, const char *string)
+{
+    struct eventring_entry *e;
+    struct tm tm;
+
+    if (er->count == EVENTRING_SIZE) {
+	msg_unref(er, er->ring[er->start].msg);
+	er->start = (er->start + 1) % EVENTRING_SIZE;
+	er->count--;
+	er->discarded++;
+    }
+
+    e = &er->ring[(er->start + er->count) % EVENTRING_SIZE];
+    tm = ltime();
+    strftime(e->time, sizeof(e->time), "%Y-%m-%d %H:%M:%S\t", &tm);
+    e->msg = msg_intern(er, string);
+    er->count++;
+}
+
+int eventring_count(struct eventring *er)
+{
+    return er->count;
+}
+
+int eventring_discarded(struct eventring *er)
+{
+    return er->discarded;
+}
+
+/*
+ * Fetch entry `index', where 0 is the oldest surviving entry. The
+ * returned string is owned by the ring and remains valid until the
+ * next call to eventring_get or eventring_add, so displays fetching
+ * entries on demand must copy (which the list widgets on both
+ * platforms do anyway).
+ */
+const char *eventring_get(struct eventring *er, int index)
+{
+    struct eventring_entry *e;
+    int need;
+
+    assert(index >= 0 && index < er->count);
+    e = &er->ring[(er->start + index) % EVENTRING_SIZE];
+
+    need = strlen(e->time) + strlen(e->msg->text) + 1;
+    if (need > er->scratchsize) {
+	er->scratchsize = need + 512;
+	er->scratch = sresize(er->scratch, er->scratchsize, char);
+    }
+    strcpy(er->scratch, e->time);
+    strcat(er->scratch, e->msg->text);
+    return er->scratch;
+}
@@ -66,12 +66,19 @@ void do_cursor(Context ctx, int x, int y, wchar_t * text, int len,
     }
     printf("\n");
 }
+#ifdef OPTIMISE_SCROLL
+void do_scroll(Context ctx, int topline, int botline, int lines)
+{
+    printf("SCROLL[%d..%d by %d]\n", topline, botline, lines);
+}
+#endif
 int char_width(Context ctx, int uc) { return 1; }
 void set_title(void *frontend, char *t) { }
 void set_icon(void *frontend, char *t) { }
 void set_sbar(void *frontend, int a, int b, int c) { }
 
 void ldisc_send(void *handle, const char *buf, int len, int interactive) {}
+int ldisc_sendbuffer(void *handle) { return 0; }
 void ldisc_echoedit_update(void *handle) {}
 Context get_ctx(void *frontend) { 
     static char x;
@@ -30,6 +30,36 @@ uint64 uint64_div10(uint64 x, int *remainder)
     return y;
 }
 
+/*
+ * Divide by an arbitrary small integer, which must be nonzero and
+ * less than 2^16. Done by schoolbook long division in 16-bit limbs,
+ * so that each partial dividend fits comfortably in an unsigned long.
+ */
+uint64 uint64_divn(uint64 x, unsigned n, unsigned *remainder)
+{
+    uint64 y;
+    unsigned long limbs[4], d, rem = 0;
+    int i;
+
+    limbs[0] = x.hi >> 16;
+    limbs[1] = x.hi & 0xFFFF;
+    limbs[2] = x.lo >> 16;
+    limbs[3] = x.lo & 0xFFFF;
+
+    for (i = 0; i < 4; i++) {
+	d = (rem << 16) | limbs[i];
+	limbs[i] = d / n;
+	rem = d % n;
+    }
+
+    y.hi = (limbs[0] << 16) | limbs[1];
+    y.lo = (limbs[2] << 16) | limbs[3];
+
+    if (remainder)
+	*remainder = rem;
+    return y;
+}
+
 void uint64_decimal(uint64 x, char *buffer)
 {
     char buf[20];
@@ -10,6 +10,7 @@ typedef struct {
 } uint64;
 
 uint64 uint64_div10(uint64 x, int *remainder);
+uint64 uint64_divn(uint64 x, unsigned n, unsigned *remainder);
 void uint64_decimal(uint64 x, char *buffer);
 uint64 uint64_make(unsigned long hi, unsigned long lo);
 uint64 uint64_add(uint64 x, uint64 y);
@@ -134,6 +134,17 @@ void ldisc_echoedit_update(void *handle)
     frontend_echoedit_update(ldisc->frontend, ECHOING, EDITING);
 }
 
+/*
+ * Report how much data the backend still has buffered for sending,
+ * so that the terminal's paste engine can apply backpressure instead
+ * of queueing an arbitrarily large clipboard all at once.
+ */
+int ldisc_sendbuffer(void *handle)
+{
+    Ldisc ldisc = (Ldisc) handle;
+    return ldisc->back->sendbuffer(ldisc->backhandle);
+}
+
 void ldisc_send(void *handle, const char *buf, int len, int interactive)
 {
     Ldisc ldisc = (Ldisc) handle;
@@ -142,6 +153,11 @@ void ldisc_send(void *handle, const char *buf, int len, int interactive)
     assert(ldisc->term);
     assert(len);
 
+#ifdef INPUT_LATENCY_TRACE
+    if (interactive)
+	term_latency_keystroke(ldisc->term);
+#endif
+
     /*
      * Notify the front end that something was pressed, in case
      * it's depending on finding out (e.g. keypress termination for
@@ -306,7 +322,12 @@ void ldisc_send(void *handle, const char *buf, int len, int interactive)
 	      default:		       /* get to this label from ^V handler */
                 default_case:
 		if (ldisc->buflen >= ldisc->bufsiz) {
-		    ldisc->bufsiz = ldisc->buflen + 256;
+		    /*
+		     * Grow geometrically: a multi-megabyte paste
+		     * arriving here one character at a time must not
+		     * pay a realloc-and-copy every 256 bytes.
+		     */
+		    ldisc->bufsiz = ldisc->bufsiz * 3 / 2 + 256;
 		    ldisc->buf = sresize(ldisc->buf, ldisc->bufsiz, char);
 		}
 		ldisc->buf[ldisc->buflen++] = c;
@@ -327,6 +348,8 @@ void ldisc_send(void *handle, const char *buf, int len, int interactive)
 	if (len > 0) {
 	    if (ECHOING)
 		c_write(ldisc, buf, len);
+	    else if (interactive && ldisc->term)
+		term_input_predict(ldisc->term, buf, len);
 	    if (keyflag && ldisc->protocol == PROT_TELNET && len == 1) {
 		switch (buf[0]) {
 		  case CTRL('M'):
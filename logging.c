@@ -10,21 +10,308 @@
 #include <assert.h>
 
 #include "putty.h"
+#include "ssh.h"		       /* for the zlib compressor */
+
+struct logcompress_job {
+    struct logcompress_job *next;
+    char *srcname, *dstname;
+    FILE *src, *dst;
+    void *comp;
+};
 
 /* log session to file stuff ... */
 struct LogContext {
     FILE *lgfp;
     enum { L_CLOSED, L_OPENING, L_OPEN, L_ERROR } state;
     bufchain queue;
+    bufchain pending;		       /* data awaiting the deferred fwrite */
+    int writer_scheduled;	       /* is logwrite_callback queued? */
+    int flush_wanted;		       /* fflush when pending next drains */
+    long nwritten;		       /* size of the current log file */
+    unsigned long rotate_due;	       /* tick at which the rotate timer set
+					* by the current file opening fires */
+    struct logcompress_job *compress_jobs_head, *compress_jobs_tail;
+    int compressor_scheduled;	       /* is logcompress_callback queued? */
     Filename *currlogfilename;
     void *frontend;
     Conf *conf;
     int logtype;		       /* cached out of conf */
     int logmkdir;          /* cached out of conf */
+    long rotate_size;		       /* cached out of conf, in bytes */
+    int rotate_time;		       /* cached out of conf, in ticks */
+    int rotate_compress;	       /* cached out of conf */
 };
 
+/*
+ * The binary packet log format (LGTYP_PKTBIN). The file starts with
+ * a 16-byte header: the 12 bytes "PuTTY-SSHPKT" followed by a 32-bit
+ * format version number. After that, one record per decrypted SSH
+ * packet, each consisting of a 24-byte record header and the
+ * captured payload. All integers are MSB-first. The record header
+ * fields are:
+ *
+ *   u32 time     seconds since the Unix epoch
+ *   u32 ticks    GETTICKCOUNT at the time of logging, for sub-second
+ *                relative timing (arbitrary epoch, wraps)
+ *   u8  direction  0 = incoming, 1 = outgoing
+ *   u8  type     SSH message type byte
+ *   u16 flags    bit 0: seq field is valid
+ *                bit 1: payload was blanked or truncated
+ *   u32 seq      packet sequence number, if flags bit 0 is set
+ *   u32 len      original payload length
+ *   u32 caplen   number of payload bytes following this header
+ *
+ * Payload bytes marked for omission (e.g. by the omit-session-data
+ * option) are left out of the capture, which is what makes caplen
+ * differ from len; bytes marked for blanking (e.g. passwords) are
+ * captured as zeroes. pktlogdump.c reads this format back.
+ */
+#define PKTBIN_VERSION 1
+
 static Filename *xlatlognam(Filename *s, char *hostname, int port,
                             struct tm *tm);
+static void log_rotate(struct LogContext *ctx);
+
+/*
+ * Write out the data queued in ctx->pending, and perform any flush
+ * that was requested while it was queued.
+ */
+static void logdrain(struct LogContext *ctx)
+{
+    while (bufchain_size(&ctx->pending) > 0 && ctx->state == L_OPEN) {
+	void *data;
+	int len;
+
+	bufchain_prefix(&ctx->pending, &data, &len);
+	if (fwrite(data, 1, len, ctx->lgfp) < (size_t)len) {
+	    bufchain_clear(&ctx->pending);
+	    logfclose(ctx);
+	    ctx->state = L_ERROR;
+	    /* Log state is L_ERROR so this won't cause a loop */
+	    logevent(ctx->frontend,
+		     "Disabled writing session log due to error while writing");
+	    return;
+	}
+	ctx->nwritten += len;
+	bufchain_consume(&ctx->pending, len);
+    }
+    if (ctx->state != L_OPEN)
+	bufchain_clear(&ctx->pending);
+
+    if (ctx->flush_wanted) {
+	ctx->flush_wanted = FALSE;
+	if (ctx->state == L_OPEN)
+	    fflush(ctx->lgfp);
+    }
+
+    /*
+     * Size-based rotation. We're already off the session's I/O
+     * path here (this is only ever called from callbacks and from
+     * closing down), so the rename and reopen can happen inline.
+     */
+    if (ctx->rotate_size && ctx->state == L_OPEN &&
+	ctx->nwritten >= ctx->rotate_size)
+	log_rotate(ctx);
+}
+
+/*
+ * Bulk-class callback which performs the deferred write. Keeping the
+ * actual fwrite (and any requested fflush) off the session's data
+ * path matters most in SSH packet logging mode, where a bulk
+ * transfer would otherwise pay for a file write per hex-dump line in
+ * the middle of shovelling data; instead the dumps go out in large
+ * batches between bursts of network activity.
+ */
+static void logwrite_callback(void *handle)
+{
+    struct LogContext *ctx = (struct LogContext *)handle;
+
+    ctx->writer_scheduled = FALSE;
+    logdrain(ctx);
+}
+
+static void schedule_logwrite(struct LogContext *ctx)
+{
+    if (!ctx->writer_scheduled) {
+	queue_bulk_callback(logwrite_callback, ctx);
+	ctx->writer_scheduled = TRUE;
+    }
+}
+
+/*
+ * Background compression of rotated log files. Each job compresses
+ * one rotated file into a complete zlib (RFC 1950) stream, a chunk
+ * per bulk callback so that a multi-gigabyte file never stalls the
+ * session; the original is deleted once its replacement is safely
+ * on disk. Jobs queue up behind one another in the unlikely event
+ * that a rotation happens while the previous file is still being
+ * compressed.
+ */
+#define LOGCOMPRESS_CHUNK 16384
+
+static void logcompress_callback(void *handle);
+
+static void schedule_logcompress(struct LogContext *ctx)
+{
+    if (!ctx->compressor_scheduled) {
+	queue_bulk_callback(logcompress_callback, ctx);
+	ctx->compressor_scheduled = TRUE;
+    }
+}
+
+/* Takes ownership of rotname. */
+static void logcompress_start(struct LogContext *ctx, char *rotname)
+{
+    struct logcompress_job *job = snew(struct logcompress_job);
+
+    job->next = NULL;
+    job->srcname = rotname;
+    job->dstname = dupcat(rotname, ".zlib", NULL);
+    job->src = job->dst = NULL;
+    job->comp = NULL;
+
+    if (ctx->compress_jobs_tail)
+	ctx->compress_jobs_tail->next = job;
+    else
+	ctx->compress_jobs_head = job;
+    ctx->compress_jobs_tail = job;
+
+    schedule_logcompress(ctx);
+}
+
+static void logcompress_free_job(struct logcompress_job *job)
+{
+    if (job->src)
+	fclose(job->src);
+    if (job->dst)
+	fclose(job->dst);
+    if (job->comp)
+	zlib_compress_cleanup(job->comp);
+    sfree(job->srcname);
+    sfree(job->dstname);
+    sfree(job);
+}
+
+static void logcompress_callback(void *handle)
+{
+    struct LogContext *ctx = (struct LogContext *)handle;
+    struct logcompress_job *job = ctx->compress_jobs_head;
+    unsigned char inbuf[LOGCOMPRESS_CHUNK], *outblock;
+    int inlen, outlen;
+    int finished = FALSE, failed = FALSE;
+    char *event;
+
+    ctx->compressor_scheduled = FALSE;
+    if (!job)
+	return;
+
+    if (!job->src) {
+	job->src = fopen(job->srcname, "rb");
+	job->dst = job->src ? fopen(job->dstname, "wb") : NULL;
+	if (!job->dst)
+	    failed = TRUE;
+	else
+	    job->comp = zlib_compress_init(9);   /* offline; effort is cheap */
+    }
+
+    if (!failed) {
+	inlen = fread(inbuf, 1, sizeof(inbuf), job->src);
+	if (inlen > 0) {
+	    zlib_compress_block(job->comp, inbuf, inlen, &outblock, &outlen);
+	} else {
+	    zlib_compress_finish(job->comp, &outblock, &outlen);
+	    finished = TRUE;
+	}
+	if (fwrite(outblock, 1, outlen, job->dst) < (size_t)outlen)
+	    failed = TRUE;
+	sfree(outblock);
+    }
+
+    if (failed) {
+	/*
+	 * Give up on this job, removing any partial output and
+	 * leaving the uncompressed original in place.
+	 */
+	event = dupprintf("Failed to compress rotated log file %s",
+			  job->srcname);
+	logevent(ctx->frontend, event);
+	sfree(event);
+	if (job->dst) {
+	    fclose(job->dst);
+	    job->dst = NULL;
+	    remove(job->dstname);
+	}
+    } else if (finished) {
+	fclose(job->src);
+	fclose(job->dst);
+	job->src = job->dst = NULL;
+	remove(job->srcname);
+	event = dupprintf("Compressed rotated log file to %s", job->dstname);
+	logevent(ctx->frontend, event);
+	sfree(event);
+    }
+
+    if (failed || finished) {
+	ctx->compress_jobs_head = job->next;
+	if (!ctx->compress_jobs_head)
+	    ctx->compress_jobs_tail = NULL;
+	logcompress_free_job(job);
+    }
+
+    if (ctx->compress_jobs_head)
+	schedule_logcompress(ctx);
+}
+
+/*
+ * Rotate the current log file: close it, rename it out of the way
+ * with a timestamp suffix, optionally queue it for compression, and
+ * reopen. The log file name is re-expanded on reopening, so a name
+ * containing date/time substitutions starts a fresh file under a
+ * fresh name.
+ */
+static void log_rotate(struct LogContext *ctx)
+{
+    char stamp[32], *oldname, *rotname, *event;
+    struct tm tm;
+
+    if (ctx->state != L_OPEN)
+	return;
+
+    oldname = dupstr(filename_to_str(ctx->currlogfilename));
+    logfclose(ctx);		       /* drains pending data first */
+
+    tm = ltime();
+    strftime(stamp, sizeof(stamp), "%Y%m%d%H%M%S", &tm);
+    rotname = dupprintf("%s.%s", oldname, stamp);
+
+    if (rename(oldname, rotname) < 0) {
+	event = dupprintf("Failed to rotate log file %s", oldname);
+	logevent(ctx->frontend, event);
+	sfree(event);
+	sfree(rotname);
+    } else {
+	event = dupprintf("Rotated log file to %s%s", rotname,
+			  ctx->rotate_compress ? " (compressing)" : "");
+	logevent(ctx->frontend, event);
+	sfree(event);
+	if (ctx->rotate_compress) {
+	    logcompress_start(ctx, rotname);   /* takes ownership */
+	} else {
+	    sfree(rotname);
+	}
+    }
+    sfree(oldname);
+
+    logfopen(ctx);
+}
+
+static void log_rotate_timer(void *handle, unsigned long now)
+{
+    struct LogContext *ctx = (struct LogContext *)handle;
+
+    if (ctx->rotate_time && now == ctx->rotate_due && ctx->state == L_OPEN)
+	log_rotate(ctx);
+}
 
 /*
  * Internal wrapper function which must be called for _all_ output
@@ -46,13 +333,8 @@ static void logwrite(struct LogContext *ctx, void *data, int len)
 	bufchain_add(&ctx->queue, data, len);
     } else if (ctx->state == L_OPEN) {
 	assert(ctx->lgfp);
-	if (fwrite(data, 1, len, ctx->lgfp) < (size_t)len) {
-	    logfclose(ctx);
-	    ctx->state = L_ERROR;
-	    /* Log state is L_ERROR so this won't cause a loop */
-	    logevent(ctx->frontend,
-		     "Disabled writing session log due to error while writing");
-	}
+	bufchain_add(&ctx->pending, data, len);
+	schedule_logwrite(ctx);
     }				       /* else L_ERROR, so ignore the write */
 }
 
@@ -74,13 +356,17 @@ static void logprintf(struct LogContext *ctx, const char *fmt, ...)
 }
 
 /*
- * Flush any open log file.
+ * Flush any open log file. The flush happens when the deferred
+ * writer next drains the pending data, so that callers on the data
+ * path (log_packet flushes after every packet) don't stall on it.
  */
 void logflush(void *handle) {
     struct LogContext *ctx = (struct LogContext *)handle;
     if (ctx->logtype > 0)
-	if (ctx->state == L_OPEN)
-	    fflush(ctx->lgfp);
+	if (ctx->state == L_OPEN) {
+	    ctx->flush_wanted = TRUE;
+	    schedule_logwrite(ctx);
+	}
 }
 
 static void logfopen_callback(void *handle, int mode)
@@ -104,6 +390,16 @@ static void logfopen_callback(void *handle, int mode)
   
 	if (ctx->lgfp) {
 	    ctx->state = L_OPEN;
+	    /*
+	     * Count what's already in the file (nonzero in append
+	     * mode), so that size-based rotation sees the true
+	     * size, and start the clock for time-based rotation.
+	     */
+	    fseek(ctx->lgfp, 0L, SEEK_END);
+	    ctx->nwritten = ftell(ctx->lgfp);
+	    if (ctx->rotate_time)
+		ctx->rotate_due = schedule_timer(ctx->rotate_time,
+						 log_rotate_timer, ctx);
         } else {
 	    ctx->state = L_ERROR;
             shout = TRUE;
@@ -111,11 +407,19 @@ static void logfopen_callback(void *handle, int mode)
     }
 
     if (ctx->state == L_OPEN) {
-	/* Write header line into log file. */
-	tm = ltime();
-	strftime(buf, 24, "%Y.%m.%d %H:%M:%S", &tm);
-	logprintf(ctx, "=~=~=~=~=~=~=~=~=~=~=~= PuTTY log %s"
-		  " =~=~=~=~=~=~=~=~=~=~=~=\r\n", buf);
+	if (ctx->logtype == LGTYP_PKTBIN) {
+	    /* Write the binary format's magic and version number. */
+	    unsigned char hdr[16];
+	    memcpy(hdr, "PuTTY-SSHPKT", 12);
+	    PUT_32BIT_MSB_FIRST(hdr + 12, PKTBIN_VERSION);
+	    logwrite(ctx, hdr, sizeof(hdr));
+	} else {
+	    /* Write header line into log file. */
+	    tm = ltime();
+	    strftime(buf, 24, "%Y.%m.%d %H:%M:%S", &tm);
+	    logprintf(ctx, "=~=~=~=~=~=~=~=~=~=~=~= PuTTY log %s"
+		      " =~=~=~=~=~=~=~=~=~=~=~=\r\n", buf);
+	}
     }
 
     event = dupprintf("%s session log (%s mode) to file: %s %s",
@@ -126,6 +430,7 @@ static void logfopen_callback(void *handle, int mode)
 		       ctx->logtype == LGTYP_DEBUG ? "raw" :
 		       ctx->logtype == LGTYP_PACKETS ? "SSH packets" :
 		       ctx->logtype == LGTYP_SSHRAW ? "SSH raw data" :
+		       ctx->logtype == LGTYP_PKTBIN ? "SSH packets, binary" :
 		       "unknown"),
 		      filename_to_str(ctx->currlogfilename),
           mkdir_err ? mkdir_err : "");
@@ -214,6 +519,20 @@ void logfclose(void *handle)
 {
     struct LogContext *ctx = (struct LogContext *)handle;
     if (ctx->lgfp) {
+	/*
+	 * Write out anything the deferred writer hasn't got to yet;
+	 * nothing useful can be done about errors at this point.
+	 */
+	while (bufchain_size(&ctx->pending) > 0) {
+	    void *data;
+	    int len;
+
+	    bufchain_prefix(&ctx->pending, &data, &len);
+	    if (fwrite(data, 1, len, ctx->lgfp) < (size_t)len)
+		break;
+	    bufchain_consume(&ctx->pending, len);
+	}
+	bufchain_clear(&ctx->pending);
 	fclose(ctx->lgfp);
 	ctx->lgfp = NULL;
     }
@@ -258,6 +577,73 @@ void log_eventlog(void *handle, const char *event)
     logflush(ctx);
 }
 
+static void log_packet_binary(struct LogContext *ctx, int direction,
+			      int type, const void *data, int len,
+			      int n_blanks, const struct logblank_t *blanks,
+			      const unsigned long *seq)
+{
+    unsigned char hdr[24], buf[256];
+    int p, b, caplen, nbuf, flags;
+
+    /*
+     * First pass over the blanking list, to work out the captured
+     * length and flags for the record header.
+     */
+    caplen = len;
+    flags = 0;
+    for (b = 0; b < n_blanks; b++) {
+	if (blanks[b].type == PKTLOG_OMIT)
+	    caplen -= blanks[b].len;
+	if (blanks[b].type != PKTLOG_EMIT)
+	    flags |= 2;
+    }
+    if (seq)
+	flags |= 1;
+
+    PUT_32BIT_MSB_FIRST(hdr, (unsigned long)time(NULL));
+    PUT_32BIT_MSB_FIRST(hdr + 4, GETTICKCOUNT_COARSE());
+    hdr[8] = (direction == PKT_INCOMING ? 0 : 1);
+    hdr[9] = (unsigned char)type;
+    PUT_16BIT_MSB_FIRST(hdr + 10, flags);
+    PUT_32BIT_MSB_FIRST(hdr + 12, seq ? *seq : 0);
+    PUT_32BIT_MSB_FIRST(hdr + 16, (unsigned long)len);
+    PUT_32BIT_MSB_FIRST(hdr + 20, (unsigned long)caplen);
+    logwrite(ctx, hdr, sizeof(hdr));
+
+    /*
+     * Now the payload, dropping omitted bytes and zeroing blanked
+     * ones, batched into a local buffer to keep logwrite calls
+     * reasonable.
+     */
+    p = b = nbuf = 0;
+    while (p < len) {
+	int blktype;
+
+	while ((b < n_blanks) &&
+	       (p >= blanks[b].offset + blanks[b].len))
+	    b++;
+	blktype = PKTLOG_EMIT;
+	if ((b < n_blanks) &&
+	    (p >= blanks[b].offset) &&
+	    (p < blanks[b].offset + blanks[b].len))
+	    blktype = blanks[b].type;
+
+	if (blktype != PKTLOG_OMIT) {
+	    buf[nbuf++] = (blktype == PKTLOG_BLANK ? 0 :
+			   ((const unsigned char *)data)[p]);
+	    if (nbuf == sizeof(buf)) {
+		logwrite(ctx, buf, nbuf);
+		nbuf = 0;
+	    }
+	}
+	p++;
+    }
+    if (nbuf)
+	logwrite(ctx, buf, nbuf);
+
+    logflush(ctx);
+}
+
 /*
  * Log an SSH packet.
  * If n_blanks != 0, blank or omit some parts.
@@ -274,6 +660,14 @@ void log_packet(void *handle, int direction, int type,
     int p = 0, b = 0, omitted = 0;
     int output_pos = 0; /* NZ if pending output in dumpdata */
 
+    if (ctx->logtype == LGTYP_PKTBIN) {
+	if (texttype)		       /* binary format logs decrypted
+					* packets only, like LGTYP_PACKETS */
+	    log_packet_binary(ctx, direction, type, data, len,
+			      n_blanks, blanks, seq);
+	return;
+    }
+
     if (!(ctx->logtype == LGTYP_SSHRAW ||
           (ctx->logtype == LGTYP_PACKETS && texttype)))
 	return;
@@ -383,6 +777,14 @@ void log_packet(void *handle, int direction, int type,
     logflush(ctx);
 }
 
+static void log_cache_rotation(struct LogContext *ctx)
+{
+    ctx->rotate_size = conf_get_int(ctx->conf, CONF_logrotate_size) * 1048576L;
+    ctx->rotate_time = conf_get_int(ctx->conf, CONF_logrotate_time) *
+	60 * TICKSPERSEC;
+    ctx->rotate_compress = conf_get_int(ctx->conf, CONF_logrotate_compress);
+}
+
 void *log_init(void *frontend, Conf *conf)
 {
     struct LogContext *ctx = snew(struct LogContext);
@@ -394,6 +796,14 @@ void *log_init(void *frontend, Conf *conf)
     ctx->logmkdir = conf_get_int(ctx->conf, CONF_logmkdir);
     ctx->currlogfilename = NULL;
     bufchain_init(&ctx->queue);
+    bufchain_init(&ctx->pending);
+    ctx->writer_scheduled = FALSE;
+    ctx->flush_wanted = FALSE;
+    ctx->nwritten = 0;
+    ctx->rotate_due = 0;
+    ctx->compress_jobs_head = ctx->compress_jobs_tail = NULL;
+    ctx->compressor_scheduled = FALSE;
+    log_cache_rotation(ctx);
     return ctx;
 }
 
@@ -402,7 +812,21 @@ void log_free(void *handle)
     struct LogContext *ctx = (struct LogContext *)handle;
 
     logfclose(ctx);
+    expire_timer_context(ctx);
+    delete_callbacks_for_context(ctx);
+    while (ctx->compress_jobs_head) {
+	struct logcompress_job *job = ctx->compress_jobs_head;
+	ctx->compress_jobs_head = job->next;
+	/* Abandon the half-written output; the original survives. */
+	if (job->dst) {
+	    fclose(job->dst);
+	    job->dst = NULL;
+	    remove(job->dstname);
+	}
+	logcompress_free_job(job);
+    }
     bufchain_clear(&ctx->queue);
+    bufchain_clear(&ctx->pending);
     if (ctx->currlogfilename)
         filename_free(ctx->currlogfilename);
     conf_free(ctx->conf);
@@ -429,6 +853,7 @@ void log_reconfig(void *handle, Conf *conf)
     ctx->conf = conf_copy(conf);
 
     ctx->logtype = conf_get_int(ctx->conf, CONF_logtype);
+    log_cache_rotation(ctx);
 
     if (reset_logging)
 	logfopen(ctx);
@@ -638,6 +638,7 @@ int base64_decode_atom(const char *atom, unsigned char *out)
  */
 
 #define BUFFER_MIN_GRANULE  512
+#define BUFFER_MAX_SPARE    32768
 
 struct bufchain_granule {
     struct bufchain_granule *next;
@@ -647,6 +648,7 @@ struct bufchain_granule {
 void bufchain_init(bufchain *ch)
 {
     ch->head = ch->tail = NULL;
+    ch->spare = NULL;
     ch->buffersize = 0;
 }
 
@@ -659,6 +661,8 @@ void bufchain_clear(bufchain *ch)
 	sfree(b);
     }
     ch->tail = NULL;
+    sfree(ch->spare);
+    ch->spare = NULL;
     ch->buffersize = 0;
 }
 
@@ -684,13 +688,36 @@ void bufchain_add(bufchain *ch, const void *data, int len)
 	    ch->tail->bufend += copylen;
 	}
 	if (len > 0) {
-	    int grainlen =
-		max(sizeof(struct bufchain_granule) + len, BUFFER_MIN_GRANULE);
 	    struct bufchain_granule *newbuf;
-	    newbuf = smalloc(grainlen);
+	    if (ch->spare) {
+		/*
+		 * Reuse the most recently emptied granule instead of
+		 * going back to the allocator; a chain being filled
+		 * and drained in step, like the SSH receive path
+		 * during a bulk transfer, cycles one granule this
+		 * way indefinitely. If the add is bigger than the
+		 * spare, the outer loop just comes round again for
+		 * the rest.
+		 */
+		newbuf = ch->spare;
+		ch->spare = NULL;
+	    } else {
+		int grainlen =
+		    max(sizeof(struct bufchain_granule) + len,
+			BUFFER_MIN_GRANULE);
+		/*
+		 * Round the size up to a multiple of the minimum
+		 * granule, so that the granules left behind by a
+		 * transfer's slightly varying read sizes are
+		 * interchangeable when recycled.
+		 */
+		grainlen = (grainlen + BUFFER_MIN_GRANULE - 1) &
+		    ~(BUFFER_MIN_GRANULE - 1);
+		newbuf = smalloc(grainlen);
+		newbuf->bufmax = (char *)newbuf + grainlen;
+	    }
 	    newbuf->bufpos = newbuf->bufend =
 		(char *)newbuf + sizeof(struct bufchain_granule);
-	    newbuf->bufmax = (char *)newbuf + grainlen;
 	    newbuf->next = NULL;
 	    if (ch->tail)
 		ch->tail->next = newbuf;
@@ -715,7 +742,10 @@ void bufchain_consume(bufchain *ch, int len)
 	    ch->head = tmp->next;
 	    if (!ch->head)
 		ch->tail = NULL;
-	    sfree(tmp);
+	    if (!ch->spare && tmp->bufmax - (char *)tmp <= BUFFER_MAX_SPARE)
+		ch->spare = tmp;
+	    else
+		sfree(tmp);
 	} else
 	    ch->head->bufpos += remlen;
 	ch->buffersize -= remlen;
@@ -729,6 +759,19 @@ void bufchain_prefix(bufchain *ch, void **data, int *len)
     *data = ch->head->bufpos;
 }
 
+int bufchain_prefix_vec(bufchain *ch, void **datas, int *lens, int nvecs)
+{
+    struct bufchain_granule *tmp;
+    int n = 0;
+
+    for (tmp = ch->head; tmp && n < nvecs; tmp = tmp->next) {
+	datas[n] = tmp->bufpos;
+	lens[n] = tmp->bufend - tmp->bufpos;
+	n++;
+    }
+    return n;
+}
+
 void bufchain_fetch(bufchain *ch, void *data, int len)
 {
     struct bufchain_granule *tmp;
@@ -882,6 +925,228 @@ void safefree(void *ptr)
 #endif
 }
 
+#ifdef MALLOC_ACCOUNTING
+/*
+ * Allocation accounting. Every allocation gains a small header
+ * recording its size and the source file that made it, and a static
+ * table keeps live and high-water byte counts per file, so that when
+ * a long-lived session's memory grows you can see whether the bytes
+ * are in the scrollback, the bufchains or somewhere else without
+ * attaching a profiler. The counters are a couple of arithmetic
+ * operations per allocation plus a mutex round trip - the kex offload
+ * worker allocates bignum temporaries off the main thread, so the
+ * table needs guarding - which is still cheap enough, unlike
+ * MALLOC_LOG, to leave enabled in builds that ship.
+ * malloc_account_report() dumps the
+ * table through a caller-supplied printing function (the SSH specials
+ * menu offers "Write memory statistics to Event Log"), and a
+ * high-water report is written to putty_mem_stats.log at exit.
+ */
+
+union acct_header {
+    struct {
+	const char *site;	       /* NULL if the site table overflowed */
+	size_t size;
+    } h;
+    double align;		       /* force worst-case alignment */
+};
+
+#define ACCT_MAX_SITES 512
+
+static struct acct_site {
+    const char *site;
+    size_t cur, peak;
+    unsigned long blocks, allocs;
+} acct_sites[ACCT_MAX_SITES];
+static int acct_nsites = 0;
+static size_t acct_total_cur = 0, acct_total_peak = 0;
+
+static struct acct_site *acct_find(const char *site)
+{
+    static int last = 0;
+    int i;
+
+    /*
+     * Allocations cluster heavily by site, so checking the site we
+     * matched last time short-circuits most lookups. Sites are
+     * __FILE__ literals, so a pointer compare usually suffices; the
+     * strcmp catches the same file name appearing as distinct
+     * literals in different translation units.
+     */
+    if (last < acct_nsites &&
+	(acct_sites[last].site == site ||
+	 !strcmp(acct_sites[last].site, site)))
+	return &acct_sites[last];
+    for (i = 0; i < acct_nsites; i++) {
+	if (acct_sites[i].site == site ||
+	    !strcmp(acct_sites[i].site, site)) {
+	    last = i;
+	    return &acct_sites[i];
+	}
+    }
+    if (acct_nsites >= ACCT_MAX_SITES)
+	return NULL;		       /* table full: leave it uncounted */
+    i = acct_nsites++;
+    acct_sites[i].site = site;
+    acct_sites[i].cur = acct_sites[i].peak = 0;
+    acct_sites[i].blocks = acct_sites[i].allocs = 0;
+    last = i;
+    return &acct_sites[i];
+}
+
+static void acct_charge(struct acct_site *s, size_t size)
+{
+    s->cur += size;
+    if (s->cur > s->peak)
+	s->peak = s->cur;
+    s->blocks++;
+    s->allocs++;
+    acct_total_cur += size;
+    if (acct_total_cur > acct_total_peak)
+	acct_total_peak = acct_total_cur;
+}
+
+static void acct_uncharge(struct acct_site *s, size_t size)
+{
+    s->cur -= size;
+    s->blocks--;
+    acct_total_cur -= size;
+}
+
+void malloc_account_report(void (*print)(void *ctx, const char *line),
+			   void *ctx)
+{
+    char buf[512];
+    static struct acct_site snap[ACCT_MAX_SITES];
+    int order[ACCT_MAX_SITES];
+    size_t total_cur, total_peak;
+    int i, j, n;
+
+    /*
+     * Snapshot the table under the lock, then format and print from
+     * the copy: the printing function may itself allocate (logevent
+     * does), which would try to retake the mutex.
+     */
+    platform_malloc_acct_mutex_lock();
+    n = acct_nsites;
+    memcpy(snap, acct_sites, n * sizeof(*snap));
+    total_cur = acct_total_cur;
+    total_peak = acct_total_peak;
+    platform_malloc_acct_mutex_unlock();
+
+    /*
+     * Insertion-sort an index array by live byte count, so the
+     * report leads with the heaviest consumers.
+     */
+    for (i = 0; i < n; i++) {
+	for (j = i; j > 0 &&
+	     snap[order[j-1]].cur < snap[i].cur; j--)
+	    order[j] = order[j-1];
+	order[j] = i;
+    }
+
+    sprintf(buf, "Memory statistics: %lu bytes live (peak %lu)",
+	    (unsigned long)total_cur, (unsigned long)total_peak);
+    print(ctx, buf);
+    for (i = 0; i < n; i++) {
+	const struct acct_site *s = &snap[order[i]];
+	if (!s->cur && !s->peak)
+	    continue;
+	sprintf(buf, "Memory statistics: %.200s: %lu bytes live in "
+		"%lu blocks (peak %lu, %lu allocations)", s->site,
+		(unsigned long)s->cur, s->blocks,
+		(unsigned long)s->peak, s->allocs);
+	print(ctx, buf);
+    }
+}
+
+static void acct_print_file(void *ctx, const char *line)
+{
+    fprintf((FILE *)ctx, "%s\n", line);
+}
+
+static void acct_exit_report(void)
+{
+    FILE *sfp = fopen("putty_mem_stats.log", "w");
+    if (sfp) {
+	malloc_account_report(acct_print_file, sfp);
+	fclose(sfp);
+    }
+}
+
+void *accmalloc(const char *site, size_t n, size_t size)
+{
+    union acct_header *hdr;
+    struct acct_site *s;
+    static int registered = FALSE;
+
+    if (n > (INT_MAX - sizeof(union acct_header)) / size)
+	modalfatalbox("Out of memory!");
+    size *= n;
+
+    hdr = (union acct_header *)safemalloc(size + sizeof(*hdr), 1);
+    platform_malloc_acct_mutex_lock();
+    if (!registered) {
+	atexit(acct_exit_report);
+	registered = TRUE;
+    }
+    s = acct_find(site);
+    hdr->h.site = s ? s->site : NULL;
+    hdr->h.size = size;
+    if (s)
+	acct_charge(s, size);
+    platform_malloc_acct_mutex_unlock();
+    return hdr + 1;
+}
+
+void *accrealloc(const char *site, void *ptr, size_t n, size_t size)
+{
+    union acct_header *hdr;
+    struct acct_site *s;
+
+    if (!ptr)
+	return accmalloc(site, n, size);
+
+    if (n > (INT_MAX - sizeof(union acct_header)) / size)
+	modalfatalbox("Out of memory!");
+    size *= n;
+
+    hdr = (union acct_header *)ptr - 1;
+    /* Growth stays charged to the site that made the first allocation. */
+    platform_malloc_acct_mutex_lock();
+    s = hdr->h.site ? acct_find(hdr->h.site) : NULL;
+    if (s)
+	acct_uncharge(s, hdr->h.size);
+    platform_malloc_acct_mutex_unlock();
+    hdr = (union acct_header *)saferealloc(hdr, size + sizeof(*hdr), 1);
+    hdr->h.size = size;
+    if (s) {
+	/* Table entries are never moved or removed, so s is still valid. */
+	platform_malloc_acct_mutex_lock();
+	acct_charge(s, size);
+	platform_malloc_acct_mutex_unlock();
+    }
+    return hdr + 1;
+}
+
+void accfree(void *ptr)
+{
+    union acct_header *hdr;
+    struct acct_site *s;
+
+    if (!ptr)
+	return;
+    hdr = (union acct_header *)ptr - 1;
+    if (hdr->h.site) {
+	platform_malloc_acct_mutex_lock();
+	if ((s = acct_find(hdr->h.site)) != NULL)
+	    acct_uncharge(s, hdr->h.size);
+	platform_malloc_acct_mutex_unlock();
+    }
+    safefree(hdr);
+}
+#endif /* MALLOC_ACCOUNTING */
+
 /* ----------------------------------------------------------------------
  * Debugging routines.
  */
@@ -999,6 +1264,164 @@ void smemclr(void *b, size_t n) {
 }
 #endif
 
+/* ----------------------------------------------------------------------
+ * Secure pool allocator.
+ *
+ * Sensitive data (bignum limbs, SSH packet payloads) turns over at a
+ * very high rate, and calling smemclr on every freed buffer is a
+ * measurable cost on the wire-speed path. Instead, such buffers are
+ * carved out of dedicated pool chunks which are locked against
+ * swapping (where the platform permits) and are never returned to the
+ * general heap. Freed blocks go straight back on a per-size-class
+ * free list _without_ being wiped: since the pool only ever hands
+ * them back out for another sensitive allocation, the data never
+ * escapes the locked pages, which is the property the per-free wipe
+ * existed to ensure. secure_pool_wipe() scrubs every free block in
+ * one batch pass, and is called at natural quiet points such as
+ * connection teardown.
+ *
+ * The free lists are shared between the main thread and whatever
+ * worker thread offload_run() is currently using for a key-exchange
+ * modexp, both of which allocate and free through the pool
+ * concurrently, so every free-list access is bracketed by the
+ * platform mutex hooks. The lock is all but always uncontended, which
+ * is far cheaper than the per-free smemclr this pool exists to avoid.
+ */
+
+union secure_pool_hdr {
+    struct {
+	union secure_pool_hdr *next;   /* free-list link while free */
+	int sizeclass;		       /* class index, or -1 if oversize */
+	size_t size;		       /* exact size, for oversize blocks */
+    } h;
+    struct {			       /* force worst-case alignment */
+	double d;
+	void *p;
+    } align;
+};
+
+#define SECURE_POOL_NCLASSES 10	       /* 32 bytes up to 16K, doubling */
+#define SECURE_POOL_MINSIZE 32
+#define SECURE_POOL_CHUNKSIZE 65536    /* allocation granularity from heap */
+
+static union secure_pool_hdr *secure_pool_freelists[SECURE_POOL_NCLASSES];
+
+static size_t secure_pool_classsize(int sizeclass)
+{
+    return (size_t)SECURE_POOL_MINSIZE << sizeclass;
+}
+
+void *secure_pool_alloc(size_t size)
+{
+    union secure_pool_hdr *blk;
+    int sizeclass;
+
+    for (sizeclass = 0; sizeclass < SECURE_POOL_NCLASSES; sizeclass++)
+	if (size <= secure_pool_classsize(sizeclass))
+	    break;
+
+    if (sizeclass == SECURE_POOL_NCLASSES) {
+	/*
+	 * Too big for the pool; fall back to an ordinary heap block,
+	 * which secure_pool_free will wipe individually.
+	 */
+	blk = (union secure_pool_hdr *)
+	    smalloc(sizeof(union secure_pool_hdr) + size);
+	blk->h.sizeclass = -1;
+	blk->h.size = size;
+	blk->h.next = NULL;
+	return blk + 1;
+    }
+
+    platform_secure_pool_mutex_lock();
+    if (!secure_pool_freelists[sizeclass]) {
+	/*
+	 * Replenish the free list with a fresh chunk, locked into
+	 * physical memory on a best-effort basis. Chunks are never
+	 * given back to the heap, so the lock need never be undone.
+	 */
+	size_t blksize = sizeof(union secure_pool_hdr) +
+	    secure_pool_classsize(sizeclass);
+	int nblks = SECURE_POOL_CHUNKSIZE / blksize, i;
+	char *chunk = smalloc(nblks * blksize);
+
+	platform_secure_pool_lock(chunk, nblks * blksize);
+	for (i = 0; i < nblks; i++) {
+	    blk = (union secure_pool_hdr *)(chunk + i * blksize);
+	    blk->h.sizeclass = sizeclass;
+	    blk->h.next = secure_pool_freelists[sizeclass];
+	    secure_pool_freelists[sizeclass] = blk;
+	}
+    }
+
+    blk = secure_pool_freelists[sizeclass];
+    secure_pool_freelists[sizeclass] = blk->h.next;
+    platform_secure_pool_mutex_unlock();
+    blk->h.next = NULL;
+    return blk + 1;
+}
+
+void secure_pool_free(void *b)
+{
+    union secure_pool_hdr *blk;
+
+    if (!b)
+	return;
+    blk = (union secure_pool_hdr *)b - 1;
+    if (blk->h.sizeclass < 0) {
+	/*
+	 * Oversize blocks live on the general heap, so they must be
+	 * wiped individually before they go back to it.
+	 */
+	smemclr(blk + 1, blk->h.size);
+	sfree(blk);
+	return;
+    }
+    platform_secure_pool_mutex_lock();
+    blk->h.next = secure_pool_freelists[blk->h.sizeclass];
+    secure_pool_freelists[blk->h.sizeclass] = blk;
+    platform_secure_pool_mutex_unlock();
+}
+
+void *secure_pool_realloc(void *b, size_t size)
+{
+    union secure_pool_hdr *blk;
+    size_t oldsize;
+    void *nb;
+
+    if (!b)
+	return secure_pool_alloc(size);
+    blk = (union secure_pool_hdr *)b - 1;
+    if (blk->h.sizeclass >= 0) {
+	oldsize = secure_pool_classsize(blk->h.sizeclass);
+	if (size <= oldsize)
+	    return b;		       /* current block is already enough */
+    } else {
+	oldsize = blk->h.size;
+	if (size <= oldsize)
+	    return b;		       /* shrinking: keep the block (and
+					* its recorded size, so the whole
+					* thing is still wiped on free) */
+    }
+    nb = secure_pool_alloc(size);
+    memcpy(nb, b, oldsize < size ? oldsize : size);
+    secure_pool_free(b);
+    return nb;
+}
+
+void secure_pool_wipe(void)
+{
+    int sizeclass;
+    union secure_pool_hdr *blk;
+
+    platform_secure_pool_mutex_lock();
+    for (sizeclass = 0; sizeclass < SECURE_POOL_NCLASSES; sizeclass++)
+	for (blk = secure_pool_freelists[sizeclass]; blk; blk = blk->h.next)
+	    smemclr(blk + 1, secure_pool_classsize(sizeclass));
+    platform_secure_pool_mutex_unlock();
+}
+
+
 /*
  * Validate a manual host key specification (either entered in the
  * GUI, or via -hostkey). If valid, we return TRUE, and update 'key'
@@ -1248,3 +1671,73 @@ char *buildinfo(const char *newline)
 
     return strbuf_to_str(buf);
 }
+
+/*
+ * Cached coarse tick count (see putty.h). The front ends refresh
+ * this once per event-loop iteration; GETTICKCOUNT_COARSE() reads it
+ * without a syscall.
+ */
+unsigned long tickcount_cache;
+int tickcount_cache_valid = FALSE;
+
+void tickcount_cache_refresh(void)
+{
+    tickcount_cache = GETTICKCOUNT();
+    tickcount_cache_valid = TRUE;
+}
+
+#ifdef SYSCALL_AUDIT
+/*
+ * Syscall audit counters (see putty.h). The reporting clock is
+ * time(NULL) rather than GETTICKCOUNT, partly because one-second
+ * granularity is all the report needs and partly because getticks
+ * itself is one of the audited calls: timing the reports off it would
+ * recurse, and counting the audit machinery's own clock reads would
+ * pollute the numbers it exists to measure.
+ */
+#include <time.h>
+
+static unsigned long sca_counts[SCA_NCATEGORIES];
+static unsigned long long sca_bytes;
+static time_t sca_last_report;
+
+static const char *const sca_names[SCA_NCATEGORIES] = {
+    "wait", "time", "read", "write"
+};
+
+static void syscall_audit_tick(void)
+{
+    time_t now = time(NULL);
+    int i;
+
+    if (sca_last_report == 0) {
+        sca_last_report = now;
+        return;
+    }
+    if (now == sca_last_report)
+        return;
+
+    fprintf(stderr, "syscall-audit:");
+    for (i = 0; i < SCA_NCATEGORIES; i++) {
+        fprintf(stderr, " %s=%lu", sca_names[i], sca_counts[i]);
+        sca_counts[i] = 0;
+    }
+    fprintf(stderr, " bytes=%llu (over %lds)\n",
+            sca_bytes, (long)(now - sca_last_report));
+    sca_bytes = 0;
+    sca_last_report = now;
+}
+
+void syscall_audit_count(int category)
+{
+    assert(category >= 0 && category < SCA_NCATEGORIES);
+    sca_counts[category]++;
+    syscall_audit_tick();
+}
+
+void syscall_audit_data(int bytes)
+{
+    if (bytes > 0)
+        sca_bytes += bytes;
+}
+#endif /* SYSCALL_AUDIT */
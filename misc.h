@@ -68,6 +68,8 @@ int base64_decode_atom(const char *atom, unsigned char *out);
 struct bufchain_granule;
 struct bufchain_tag {
     struct bufchain_granule *head, *tail;
+    struct bufchain_granule *spare;    /* recycled granule, to cut malloc
+					* traffic on busy chains */
     int buffersize;		       /* current amount of buffered data */
 };
 #ifndef BUFCHAIN_TYPEDEF
@@ -80,6 +82,10 @@ void bufchain_clear(bufchain *ch);
 int bufchain_size(bufchain *ch);
 void bufchain_add(bufchain *ch, const void *data, int len);
 void bufchain_prefix(bufchain *ch, void **data, int *len);
+/* Describe up to nvecs leading segments of the bufchain, for
+ * scatter-gather I/O; returns the number of (data,len) pairs filled
+ * in. */
+int bufchain_prefix_vec(bufchain *ch, void **datas, int *lens, int nvecs);
 void bufchain_consume(bufchain *ch, int len);
 void bufchain_fetch(bufchain *ch, void *data, int len);
 
@@ -94,6 +100,26 @@ struct tm ltime(void);
  * the variable is going out of scope. */
 void smemclr(void *b, size_t len);
 
+/* Pool allocator for sensitive data with a high turnover rate (bignum
+ * limbs, SSH packet payloads). Blocks come from dedicated chunks
+ * locked against swapping where possible, and freed blocks are reused
+ * within the pool without per-free wiping; secure_pool_wipe() scrubs
+ * all currently-free blocks in one batch pass, and should be called
+ * at quiet points such as connection teardown. */
+void *secure_pool_alloc(size_t size);
+void *secure_pool_realloc(void *b, size_t size);
+void secure_pool_free(void *b);
+void secure_pool_wipe(void);
+/* Platform hook used by the pool: best-effort lock of a memory range
+ * into physical memory (mlock / VirtualLock); failure is ignored. */
+void platform_secure_pool_lock(void *b, size_t len);
+/* Platform hooks guarding the pool's shared free lists: offloaded
+ * work (see offload_run) allocates and frees bignum limbs on a worker
+ * thread while the main event loop is still handling packet buffers,
+ * so every free-list access takes this mutex. */
+void platform_secure_pool_mutex_lock(void);
+void platform_secure_pool_mutex_unlock(void);
+
 /* Compare two fixed-length chunks of memory for equality, without
  * data-dependent control flow (so an attacker with a very accurate
  * stopwatch can't try to guess where the first mismatching byte was).
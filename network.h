@@ -107,6 +107,25 @@ Socket new_listener(const char *srcaddr, int port, Plug plug,
 SockAddr name_lookup(const char *host, int port, char **canonicalname,
 		     Conf *conf, int addressfamily, void *frontend_for_logging,
                      const char *lookup_reason_for_logging);
+typedef void (*sk_namelookup_done_fn_t)(SockAddr addr, char *canonicalname,
+                                        void *ctx);
+/*
+ * Asynchronous counterpart to name_lookup. Returns a lookup handle if
+ * the resolution is proceeding in the background, in which case the
+ * callback will eventually receive ownership of a SockAddr (which may
+ * contain a lookup error, just as name_lookup's return might) and the
+ * canonical host name. Returns NULL if the answer is available
+ * immediately - because the proxy is doing the DNS for us, or the
+ * platform can't resolve asynchronously - in which case *addr_ret and
+ * *canonicalname are filled in as name_lookup would have and the
+ * callback is never called. A pending lookup can be cancelled with
+ * sk_namelookup_abort.
+ */
+void *name_lookup_async(const char *host, int port, Conf *conf,
+                        int addressfamily, void *frontend_for_logging,
+                        const char *lookup_reason_for_logging,
+                        sk_namelookup_done_fn_t done, void *ctx,
+                        SockAddr *addr_ret, char **canonicalname);
 int proxy_for_destination (SockAddr addr, const char *hostname, int port,
                            Conf *conf);
 
@@ -123,6 +142,17 @@ void sk_init(void);		       /* called once at program startup */
 void sk_cleanup(void);		       /* called just before program exit */
 
 SockAddr sk_namelookup(const char *host, char **canonicalname, int address_family);
+/*
+ * Non-blocking name lookup. Starts the resolution in the background
+ * and returns an opaque handle, or NULL if the platform has no
+ * asynchronous resolver (in which case the caller should fall back to
+ * sk_namelookup). On completion the callback receives ownership of
+ * the resulting SockAddr and canonical name. sk_namelookup_abort
+ * cancels a pending lookup; the callback will then never be called.
+ */
+void *sk_namelookup_start(const char *host, int address_family,
+                          sk_namelookup_done_fn_t done, void *ctx);
+void sk_namelookup_abort(void *handle);
 SockAddr sk_nonamelookup(const char *host);
 void sk_getaddr(SockAddr addr, char *buf, int buflen);
 int sk_addr_needs_port(SockAddr addr);
@@ -9,3 +9,7 @@
 void term_nopaste(Terminal *term)
 {
 }
+
+void term_input_predict(Terminal *term, const char *buf, int len)
+{
+}
@@ -259,6 +259,25 @@ void *pageant_make_keylist2(int *length)
     return ret;
 }
 
+/*
+ * Cached serialised replies to the two identity-list requests.
+ * Every connecting client starts by asking for the key list, and
+ * building it costs two public-blob serialisations per key held; a
+ * client opening many sessions per second pays that on each one.
+ * The key store changes rarely, so we build each list once and
+ * invalidate whenever a key is added or removed.
+ */
+static unsigned char *keylist1_cache = NULL, *keylist2_cache = NULL;
+static int keylist1_cache_len, keylist2_cache_len;
+
+static void keylist_cache_invalidate(void)
+{
+    sfree(keylist1_cache);
+    keylist1_cache = NULL;
+    sfree(keylist2_cache);
+    keylist2_cache = NULL;
+}
+
 static void plog(void *logctx, pageant_logfn_t logfn, const char *fmt, ...)
 #ifdef __GNUC__
 __attribute__ ((format (printf, 3, 4)))
@@ -315,9 +334,11 @@ void *pageant_handle_msg(const void *msg, int msglen, int *outlen,
             plog(logctx, logfn, "request: SSH1_AGENTC_REQUEST_RSA_IDENTITIES");
 
 	    ret[4] = SSH1_AGENT_RSA_IDENTITIES_ANSWER;
-	    keylist = pageant_make_keylist1(&len);
+	    if (!keylist1_cache)
+		keylist1_cache = pageant_make_keylist1(&keylist1_cache_len);
+	    keylist = keylist1_cache;
+	    len = keylist1_cache_len;
 	    if (len + 5 > AGENT_MAX_MSGLEN) {
-		sfree(keylist);
                 fail_reason = "output would exceed max msglen";
 		goto failure;
 	    }
@@ -334,7 +355,6 @@ void *pageant_handle_msg(const void *msg, int msglen, int *outlen,
                     plog(logctx, logfn, "returned key: %s", fingerprint);
                 }
             }
-	    sfree(keylist);
 	}
 	break;
       case SSH2_AGENTC_REQUEST_IDENTITIES:
@@ -348,9 +368,11 @@ void *pageant_handle_msg(const void *msg, int msglen, int *outlen,
             plog(logctx, logfn, "request: SSH2_AGENTC_REQUEST_IDENTITIES");
 
 	    ret[4] = SSH2_AGENT_IDENTITIES_ANSWER;
-	    keylist = pageant_make_keylist2(&len);
+	    if (!keylist2_cache)
+		keylist2_cache = pageant_make_keylist2(&keylist2_cache_len);
+	    keylist = keylist2_cache;
+	    len = keylist2_cache_len;
 	    if (len + 5 > AGENT_MAX_MSGLEN) {
-		sfree(keylist);
                 fail_reason = "output would exceed max msglen";
 		goto failure;
 	    }
@@ -369,8 +391,6 @@ void *pageant_handle_msg(const void *msg, int msglen, int *outlen,
                     sfree(fingerprint);
                 }
             }
-
-	    sfree(keylist);
 	}
 	break;
       case SSH1_AGENTC_RSA_CHALLENGE:
@@ -625,6 +645,7 @@ void *pageant_handle_msg(const void *msg, int msglen, int *outlen,
             }
 
 	    if (add234(rsakeys, key) == key) {
+		keylist_cache_invalidate();
 		keylist_update();
                 PUT_32BIT(ret, 1);
 		ret[4] = SSH_AGENT_SUCCESS;
@@ -718,6 +739,7 @@ void *pageant_handle_msg(const void *msg, int msglen, int *outlen,
             }
 
 	    if (add234(ssh2keys, key) == key) {
+		keylist_cache_invalidate();
 		keylist_update();
                 PUT_32BIT(ret, 1);
 		ret[4] = SSH_AGENT_SUCCESS;
@@ -766,6 +788,7 @@ void *pageant_handle_msg(const void *msg, int msglen, int *outlen,
                 plog(logctx, logfn, "found with comment: %s", key->comment);
 
 		del234(rsakeys, key);
+		keylist_cache_invalidate();
 		keylist_update();
 		freersakey(key);
 		sfree(key);
@@ -819,6 +842,7 @@ void *pageant_handle_msg(const void *msg, int msglen, int *outlen,
             plog(logctx, logfn, "found with comment: %s", key->comment);
 
             del234(ssh2keys, key);
+            keylist_cache_invalidate();
             keylist_update();
             key->alg->freekey(key->data);
             sfree(key);
@@ -843,6 +867,7 @@ void *pageant_handle_msg(const void *msg, int msglen, int *outlen,
 		freersakey(rkey);
 		sfree(rkey);
 	    }
+	    keylist_cache_invalidate();
 	    keylist_update();
 
 	    PUT_32BIT(ret, 1);
@@ -865,6 +890,7 @@ void *pageant_handle_msg(const void *msg, int msglen, int *outlen,
 		skey->alg->freekey(skey->data);
 		sfree(skey);
 	    }
+	    keylist_cache_invalidate();
 	    keylist_update();
 
 	    PUT_32BIT(ret, 1);
@@ -930,12 +956,18 @@ int pageant_count_ssh2_keys(void)
 
 int pageant_add_ssh1_key(struct RSAKey *rkey)
 {
-    return add234(rsakeys, rkey) == rkey;
+    if (add234(rsakeys, rkey) != rkey)
+        return FALSE;
+    keylist_cache_invalidate();
+    return TRUE;
 }
 
 int pageant_add_ssh2_key(struct ssh2_userkey *skey)
 {
-    return add234(ssh2keys, skey) == skey;
+    if (add234(ssh2keys, skey) != skey)
+        return FALSE;
+    keylist_cache_invalidate();
+    return TRUE;
 }
 
 int pageant_delete_ssh1_key(struct RSAKey *rkey)
@@ -944,6 +976,7 @@ int pageant_delete_ssh1_key(struct RSAKey *rkey)
     if (!deleted)
         return FALSE;
     assert(deleted == rkey);
+    keylist_cache_invalidate();
     return TRUE;
 }
 
@@ -953,6 +986,7 @@ int pageant_delete_ssh2_key(struct ssh2_userkey *skey)
     if (!deleted)
         return FALSE;
     assert(deleted == skey);
+    keylist_cache_invalidate();
     return TRUE;
 }
 
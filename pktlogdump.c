@@ -0,0 +1,171 @@
+/*
+ * pktlogdump.c - read back the binary SSH packet log format
+ * produced by logging.c in LGTYP_PKTBIN mode (the -sshbinlog
+ * command-line option).
+ *
+ * Prints one summary line per record; with -d, also hex-dumps each
+ * record's captured payload, in the same layout the text log format
+ * uses. The file and record layouts are documented in logging.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define GET_32BIT_MSB_FIRST(cp) \
+  (((unsigned long)(unsigned char)(cp)[0] << 24) | \
+  ((unsigned long)(unsigned char)(cp)[1] << 16) | \
+  ((unsigned long)(unsigned char)(cp)[2] << 8) | \
+  ((unsigned long)(unsigned char)(cp)[3]))
+
+#define GET_16BIT_MSB_FIRST(cp) \
+  (((unsigned long)(unsigned char)(cp)[0] << 8) | \
+  ((unsigned long)(unsigned char)(cp)[1]))
+
+#define PKTBIN_MAGIC "PuTTY-SSHPKT"
+#define PKTBIN_VERSION 1
+
+static void hexdump(const unsigned char *data, unsigned long len)
+{
+    unsigned long p;
+
+    for (p = 0; p < len; p += 16) {
+	unsigned long i, n = (len - p < 16 ? len - p : 16);
+
+	printf("  %08lx ", p);
+	for (i = 0; i < 16; i++) {
+	    if (i < n)
+		printf(" %02x", data[p + i]);
+	    else
+		printf("   ");
+	}
+	printf("  ");
+	for (i = 0; i < n; i++) {
+	    int c = data[p + i];
+	    putchar(c >= 0x20 && c < 0x7F ? c : '.');
+	}
+	putchar('\n');
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FILE *fp;
+    unsigned char hdr[24];
+    unsigned char *payload = NULL;
+    unsigned long payloadsize = 0;
+    unsigned long recno, prevticks = 0;
+    int dump = 0, haveprev = 0;
+    const char *fname = NULL;
+
+    while (--argc > 0) {
+	char *p = *++argv;
+	if (!strcmp(p, "-d"))
+	    dump = 1;
+	else if (!fname)
+	    fname = p;
+	else {
+	    fprintf(stderr, "pktlogdump: unexpected argument '%s'\n", p);
+	    return 1;
+	}
+    }
+    if (!fname) {
+	fprintf(stderr, "usage: pktlogdump [-d] <logfile>\n");
+	fprintf(stderr, "  reads a log file written in PuTTY's binary SSH"
+		" packet format\n");
+	fprintf(stderr, "  -d    also hex-dump each packet's captured"
+		" payload\n");
+	return 1;
+    }
+
+    fp = fopen(fname, "rb");
+    if (!fp) {
+	perror(fname);
+	return 1;
+    }
+
+    if (fread(hdr, 1, 16, fp) != 16 ||
+	memcmp(hdr, PKTBIN_MAGIC, 12) != 0) {
+	fprintf(stderr, "%s: not a PuTTY binary packet log\n", fname);
+	fclose(fp);
+	return 1;
+    }
+    if (GET_32BIT_MSB_FIRST(hdr + 12) != PKTBIN_VERSION) {
+	fprintf(stderr, "%s: unsupported format version %lu\n", fname,
+		GET_32BIT_MSB_FIRST(hdr + 12));
+	fclose(fp);
+	return 1;
+    }
+
+    for (recno = 0;; recno++) {
+	unsigned long when, ticks, flags, seq, len, caplen;
+	int direction, type;
+	time_t t;
+	struct tm *tm;
+	char timebuf[32];
+	size_t got;
+
+	got = fread(hdr, 1, 24, fp);
+	if (got == 0)
+	    break;		       /* clean EOF */
+	if (got < 24) {
+	    fprintf(stderr, "%s: truncated record header at record %lu\n",
+		    fname, recno);
+	    break;
+	}
+
+	when = GET_32BIT_MSB_FIRST(hdr);
+	ticks = GET_32BIT_MSB_FIRST(hdr + 4);
+	direction = hdr[8];
+	type = hdr[9];
+	flags = GET_16BIT_MSB_FIRST(hdr + 10);
+	seq = GET_32BIT_MSB_FIRST(hdr + 12);
+	len = GET_32BIT_MSB_FIRST(hdr + 16);
+	caplen = GET_32BIT_MSB_FIRST(hdr + 20);
+
+	t = (time_t)when;
+	tm = localtime(&t);
+	if (!tm || !strftime(timebuf, sizeof(timebuf),
+			     "%Y-%m-%d %H:%M:%S", tm))
+	    strcpy(timebuf, "?");
+
+	printf("%s", timebuf);
+	if (haveprev)
+	    printf(" (+%lums)", (ticks - prevticks) & 0xFFFFFFFFUL);
+	prevticks = ticks;
+	haveprev = 1;
+
+	printf(" %s type %d / 0x%02x",
+	       direction == 0 ? "incoming" : "outgoing", type, type);
+	if (flags & 1)
+	    printf(" #0x%lx", seq);
+	printf(" len %lu", len);
+	if (caplen != len)
+	    printf(" (captured %lu)", caplen);
+	if (flags & 2)
+	    printf(" [blanked/truncated]");
+	putchar('\n');
+
+	if (caplen > payloadsize) {
+	    payloadsize = caplen;
+	    payload = realloc(payload, payloadsize);
+	    if (!payload) {
+		fprintf(stderr, "pktlogdump: out of memory\n");
+		fclose(fp);
+		return 1;
+	    }
+	}
+	if (fread(payload, 1, caplen, fp) != caplen) {
+	    fprintf(stderr, "%s: truncated payload at record %lu\n",
+		    fname, recno);
+	    break;
+	}
+	if (dump)
+	    hexdump(payload, caplen);
+    }
+
+    free(payload);
+    fclose(fp);
+    return 0;
+}
@@ -50,6 +50,16 @@ struct PortForwarding {
      */
     void *buffer;
     int buflen;
+    /*
+     * While an asynchronous name lookup for the destination host is
+     * outstanding, 'lookup' is its handle, the socket doesn't exist
+     * yet, and anything the SSH side sends us meanwhile waits in
+     * 'pending_output' / 'pending_eof' until the connection is made.
+     */
+    void *lookup;
+    bufchain pending_output;
+    int pending_eof;
+    Conf *conf;			       /* kept for the deferred connection */
 };
 
 struct PortListener {
@@ -70,13 +80,30 @@ struct PortListener {
     int port;
 };
 
+/*
+ * Keep a small pool of free PortForwarding structures, so that a
+ * listener fielding a storm of short-lived connections isn't doing a
+ * malloc/free round trip per connection.
+ */
+#define PF_POOLSIZE 64
+static struct PortForwarding *pf_pool[PF_POOLSIZE];
+static int pf_poolcount = 0;
+
 static struct PortForwarding *new_portfwd_state(void)
 {
-    struct PortForwarding *pf = snew(struct PortForwarding);
+    struct PortForwarding *pf;
+    if (pf_poolcount > 0)
+	pf = pf_pool[--pf_poolcount];
+    else
+	pf = snew(struct PortForwarding);
     pf->hostname = NULL;
     pf->socksbuf = NULL;
     pf->sockslen = pf->sockssize = 0;
     pf->buffer = NULL;
+    pf->lookup = NULL;
+    bufchain_init(&pf->pending_output);
+    pf->pending_eof = FALSE;
+    pf->conf = NULL;
     return pf;
 }
 
@@ -87,7 +114,11 @@ static void free_portfwd_state(struct PortForwarding *pf)
     sfree(pf->hostname);
     sfree(pf->socksbuf);
     sfree(pf->buffer);
-    sfree(pf);
+    bufchain_clear(&pf->pending_output);
+    if (pf_poolcount < PF_POOLSIZE)
+	pf_pool[pf_poolcount++] = pf;
+    else
+	sfree(pf);
 }
 
 static struct PortListener *new_portlistener_state(void)
@@ -413,6 +444,73 @@ static void pfd_sent(Plug plug, int bufsize)
 	sshfwd_unthrottle(pf->c, bufsize);
 }
 
+/*
+ * Make the actual connection for a server-initiated forwarding, once
+ * the destination address is known. Takes ownership of 'addr' and
+ * 'realhost'. Returns NULL on success, or a dynamically allocated
+ * error message.
+ */
+static char *pfd_open_connection(struct PortForwarding *pf,
+                                 SockAddr addr, char *realhost)
+{
+    const char *err;
+
+    if ((err = sk_addr_error(addr)) != NULL) {
+        char *err_ret = dupstr(err);
+	sk_addr_free(addr);
+        sfree(realhost);
+	return err_ret;
+    }
+
+    pf->s = new_connection(addr, realhost, pf->port,
+                           0, 1, 0, 0, (Plug) pf, pf->conf);
+    sfree(realhost);
+    if ((err = sk_socket_error(pf->s)) != NULL) {
+        char *err_ret = dupstr(err);
+        sk_close(pf->s);
+        pf->s = NULL;
+	return err_ret;
+    }
+
+    return NULL;
+}
+
+/*
+ * Completion callback for the asynchronous destination lookup started
+ * in pfd_connect. By now the channel open has already been confirmed,
+ * so on failure the best we can do is close the channel again.
+ */
+static void pfd_lookup_done(SockAddr addr, char *canonicalname, void *ctx)
+{
+    struct PortForwarding *pf = (struct PortForwarding *) ctx;
+    char *err;
+
+    pf->lookup = NULL;
+    err = pfd_open_connection(pf, addr, canonicalname);
+    if (err) {
+        if (pf->c)
+            sshfwd_unclean_close(pf->c, err);
+        sfree(err);
+        return;
+    }
+
+    /*
+     * Flush anything the SSH side gave us while we were waiting for
+     * the lookup.
+     */
+    while (bufchain_size(&pf->pending_output) > 0) {
+        void *data;
+        int len;
+        bufchain_prefix(&pf->pending_output, &data, &len);
+        sk_write(pf->s, data, len);
+        bufchain_consume(&pf->pending_output, len);
+    }
+    if (pf->pending_eof) {
+        sk_write_eof(pf->s);
+        pf->pending_eof = FALSE;
+    }
+}
+
 /*
  * Called when receiving a PORT OPEN from the server to make a
  * connection to a destination host.
@@ -431,26 +529,11 @@ char *pfd_connect(struct PortForwarding **pf_ret, char *hostname,int port,
 	NULL
     };
 
-    SockAddr addr;
-    const char *err;
-    char *dummy_realhost;
+    SockAddr addr = NULL;
+    char *dummy_realhost = NULL;
+    char *err;
     struct PortForwarding *pf;
 
-    /*
-     * Try to find host.
-     */
-    addr = name_lookup(hostname, port, &dummy_realhost, conf, addressfamily,
-                       NULL, NULL);
-    if ((err = sk_addr_error(addr)) != NULL) {
-        char *err_ret = dupstr(err);
-	sk_addr_free(addr);
-        sfree(dummy_realhost);
-	return err_ret;
-    }
-
-    /*
-     * Open socket.
-     */
     pf = *pf_ret = new_portfwd_state();
     pf->fn = &fn_table;
     pf->throttled = pf->throttle_override = 0;
@@ -458,16 +541,28 @@ char *pfd_connect(struct PortForwarding **pf_ret, char *hostname,int port,
     pf->c = c;
     pf->backhandle = NULL;	       /* we shouldn't need this */
     pf->dynamic = 0;
+    pf->s = NULL;
+    pf->port = port;
+    pf->conf = conf;
 
-    pf->s = new_connection(addr, dummy_realhost, port,
-                           0, 1, 0, 0, (Plug) pf, conf);
-    sfree(dummy_realhost);
-    if ((err = sk_socket_error(pf->s)) != NULL) {
-        char *err_ret = dupstr(err);
-        sk_close(pf->s);
+    /*
+     * Try to find host. Prefer doing the lookup asynchronously, so
+     * that a slow DNS server doesn't stall the whole multiplexed
+     * session while we resolve the destination of one forwarded
+     * connection; the socket is opened from pfd_lookup_done when the
+     * answer comes back.
+     */
+    pf->lookup = name_lookup_async(hostname, port, conf, addressfamily,
+                                   NULL, NULL, pfd_lookup_done, pf,
+                                   &addr, &dummy_realhost);
+    if (pf->lookup)
+        return NULL;
+
+    err = pfd_open_connection(pf, addr, dummy_realhost);
+    if (err) {
 	free_portfwd_state(pf);
         *pf_ret = NULL;
-	return err_ret;
+	return err;
     }
 
     return NULL;
@@ -583,7 +678,12 @@ void pfd_close(struct PortForwarding *pf)
     if (!pf)
 	return;
 
-    sk_close(pf->s);
+    if (pf->lookup) {
+        sk_namelookup_abort(pf->lookup);
+        pf->lookup = NULL;
+    }
+    if (pf->s)
+        sk_close(pf->s);
     free_portfwd_state(pf);
 }
 
@@ -605,7 +705,8 @@ void pfd_unthrottle(struct PortForwarding *pf)
 	return;
 
     pf->throttled = 0;
-    sk_set_frozen(pf->s, pf->throttled || pf->throttle_override);
+    if (pf->s)
+        sk_set_frozen(pf->s, pf->throttled || pf->throttle_override);
 }
 
 void pfd_override_throttle(struct PortForwarding *pf, int enable)
@@ -614,7 +715,8 @@ void pfd_override_throttle(struct PortForwarding *pf, int enable)
 	return;
 
     pf->throttle_override = enable;
-    sk_set_frozen(pf->s, pf->throttled || pf->throttle_override);
+    if (pf->s)
+        sk_set_frozen(pf->s, pf->throttled || pf->throttle_override);
 }
 
 /*
@@ -624,11 +726,26 @@ int pfd_send(struct PortForwarding *pf, char *data, int len)
 {
     if (pf == NULL)
 	return 0;
+    if (!pf->s) {
+        /*
+         * The destination lookup hasn't completed yet; queue the data
+         * until it has. Reporting the queued amount as the backlog
+         * makes the SSH window mechanism throttle the sender for us.
+         */
+        if (pf->lookup)
+            bufchain_add(&pf->pending_output, data, len);
+        return bufchain_size(&pf->pending_output);
+    }
     return sk_write(pf->s, data, len);
 }
 
 void pfd_send_eof(struct PortForwarding *pf)
 {
+    if (!pf->s) {
+        if (pf->lookup)
+            pf->pending_eof = TRUE;
+        return;
+    }
     sk_write_eof(pf->s);
 }
 
@@ -401,6 +401,46 @@ SockAddr name_lookup(const char *host, int port, char **canonicalname,
     }
 }
 
+void *name_lookup_async(const char *host, int port, Conf *conf,
+                        int addressfamily, void *frontend,
+                        const char *reason,
+                        sk_namelookup_done_fn_t done, void *ctx,
+                        SockAddr *addr_ret, char **canonicalname)
+{
+    char *logmsg;
+    void *handle;
+
+    if (conf_get_int(conf, CONF_proxy_type) != PROXY_NONE &&
+	do_proxy_dns(conf) &&
+	proxy_for_destination(NULL, host, port, conf)) {
+
+        if (frontend) {
+            logmsg = dupprintf("Leaving host lookup to proxy of \"%s\""
+                               " (for %s)", host, reason);
+            logevent(frontend, logmsg);
+            sfree(logmsg);
+        }
+
+	*canonicalname = dupstr(host);
+	*addr_ret = sk_nonamelookup(host);
+        return NULL;
+    }
+
+    if (frontend) {
+        logmsg = dns_log_msg(host, addressfamily, reason);
+        logevent(frontend, logmsg);
+        sfree(logmsg);
+    }
+
+    handle = sk_namelookup_start(host, addressfamily, done, ctx);
+    if (handle)
+        return handle;
+
+    /* No asynchronous resolver on this platform: do it the old way. */
+    *addr_ret = sk_namelookup(host, canonicalname, addressfamily);
+    return NULL;
+}
+
 Socket new_connection(SockAddr addr, const char *hostname,
 		      int port, int privport,
 		      int oobinline, int nodelay, int keepalive,
@@ -461,6 +501,7 @@ Socket new_connection(SockAddr addr, const char *hostname,
 
 	ret->sub_socket = NULL;
 	ret->state = PROXY_STATE_NEW;
+	ret->pipelined = FALSE;
 	ret->negotiate = NULL;
 
 	type = conf_get_int(conf, CONF_proxy_type);
@@ -941,6 +982,62 @@ int proxy_socks4_negotiate (Proxy_Socket p, int change)
 }
 
 /* SOCKS version 5 */
+
+/*
+ * Send the SOCKS5 CONNECT request. Factored out of the state machine
+ * so that it can also be sent speculatively, pipelined behind an
+ * earlier stage of the negotiation whose only successful outcome
+ * leads here anyway.
+ */
+static void proxy_socks5_sendconnect(Proxy_Socket p)
+{
+    /* request format:
+     *  version number (1 byte) = 5
+     *  command code (1 byte)
+     *    1 = CONNECT
+     *    2 = BIND
+     *    3 = UDP ASSOCIATE
+     *  reserved (1 byte) = 0x00
+     *  address type (1 byte)
+     *    1 = IPv4
+     *    3 = domainname (first byte has length, no terminating null)
+     *    4 = IPv6
+     *  dest. address (variable)
+     *  dest. port (2 bytes) [network order]
+     */
+
+    char command[512];
+    int len;
+    int type;
+
+    type = sk_addrtype(p->remote_addr);
+    if (type == ADDRTYPE_IPV4) {
+	len = 10;		       /* 4 hdr + 4 addr + 2 trailer */
+	command[3] = 1; /* IPv4 */
+	sk_addrcopy(p->remote_addr, command+4);
+    } else if (type == ADDRTYPE_IPV6) {
+	len = 22;		       /* 4 hdr + 16 addr + 2 trailer */
+	command[3] = 4; /* IPv6 */
+	sk_addrcopy(p->remote_addr, command+4);
+    } else {
+	assert(type == ADDRTYPE_NAME);
+	command[3] = 3;
+	sk_getaddr(p->remote_addr, command+5, 256);
+	command[4] = strlen(command+5);
+	len = 7 + command[4];	       /* 4 hdr, 1 len, N addr, 2 trailer */
+    }
+
+    command[0] = 5; /* version 5 */
+    command[1] = 1; /* CONNECT command */
+    command[2] = 0x00;
+
+    /* port */
+    command[len-2] = (char) (p->remote_port >> 8) & 0xff;
+    command[len-1] = (char) p->remote_port & 0xff;
+
+    sk_write(p->sub_socket, command, len);
+}
+
 int proxy_socks5_negotiate (Proxy_Socket p, int change)
 {
     if (p->state == PROXY_CHANGE_NEW) {
@@ -977,6 +1074,19 @@ int proxy_socks5_negotiate (Proxy_Socket p, int change)
 
 	sk_write(p->sub_socket, command, len);
 
+	if (!(username[0] || password[0])) {
+	    /*
+	     * We offered only "no authentication", so the server's
+	     * only useful answer is to select it. Speculatively
+	     * pipeline the CONNECT request behind the greeting and
+	     * save a round trip; any other answer fails the
+	     * connection exactly as it would have done when we waited
+	     * for the method reply first.
+	     */
+	    proxy_socks5_sendconnect(p);
+	    p->pipelined = TRUE;
+	}
+
 	p->state = 1;
 	return 0;
     }
@@ -1043,7 +1153,11 @@ int proxy_socks5_negotiate (Proxy_Socket p, int change)
 		return 1;
 	    }
 
-	    if (data[1] == 0x00) p->state = 2; /* no authentication needed */
+	    if (data[1] == 0x00) p->state = p->pipelined ? 3 : 2;
+					/* no authentication needed; if the
+					 * CONNECT request went out pipelined
+					 * behind the greeting, go straight
+					 * to awaiting its reply */
 	    else if (data[1] == 0x01) p->state = 4; /* GSSAPI authentication */
 	    else if (data[1] == 0x02) p->state = 5; /* username/password authentication */
 	    else if (data[1] == 0x03) p->state = 6; /* CHAP authentication */
@@ -1087,7 +1201,10 @@ int proxy_socks5_negotiate (Proxy_Socket p, int change)
 	    }
 
 	    bufchain_consume(&p->pending_input_data, 2);
-	    p->state = 2;	       /* now proceed as authenticated */
+	    /* now proceed as authenticated; if the CONNECT request
+	     * was pipelined behind the password, just await its
+	     * reply */
+	    p->state = p->pipelined ? 3 : 2;
 	}
 
 	if (p->state == 8) {
@@ -1098,51 +1215,10 @@ int proxy_socks5_negotiate (Proxy_Socket p, int change)
 
 	if (p->state == 2) {
 
-	    /* request format:
-	     *  version number (1 byte) = 5
-	     *  command code (1 byte)
-	     *    1 = CONNECT
-	     *    2 = BIND
-	     *    3 = UDP ASSOCIATE
-	     *  reserved (1 byte) = 0x00
-	     *  address type (1 byte)
-	     *    1 = IPv4
-	     *    3 = domainname (first byte has length, no terminating null)
-	     *    4 = IPv6
-	     *  dest. address (variable)
-	     *  dest. port (2 bytes) [network order]
-	     */
-
-	    char command[512];
-	    int len;
-	    int type;
-
-	    type = sk_addrtype(p->remote_addr);
-	    if (type == ADDRTYPE_IPV4) {
-		len = 10;	       /* 4 hdr + 4 addr + 2 trailer */
-		command[3] = 1; /* IPv4 */
-		sk_addrcopy(p->remote_addr, command+4);
-	    } else if (type == ADDRTYPE_IPV6) {
-		len = 22;	       /* 4 hdr + 16 addr + 2 trailer */
-		command[3] = 4; /* IPv6 */
-		sk_addrcopy(p->remote_addr, command+4);
-	    } else {
-		assert(type == ADDRTYPE_NAME);
-		command[3] = 3;
-		sk_getaddr(p->remote_addr, command+5, 256);
-		command[4] = strlen(command+5);
-		len = 7 + command[4];  /* 4 hdr, 1 len, N addr, 2 trailer */
-	    }
-
-	    command[0] = 5; /* version 5 */
-	    command[1] = 1; /* CONNECT command */
-	    command[2] = 0x00;
-
-	    /* port */
-	    command[len-2] = (char) (p->remote_port >> 8) & 0xff;
-	    command[len-1] = (char) p->remote_port & 0xff;
-
-	    sk_write(p->sub_socket, command, len);
+	    /* We're authenticated (or no authentication was needed)
+	     * and the CONNECT request hasn't been sent yet; send it
+	     * now. */
+	    proxy_socks5_sendconnect(p);
 
 	    p->state = 3;
 	    return 1;
@@ -1258,6 +1334,14 @@ int proxy_socks5_negotiate (Proxy_Socket p, int change)
 		userpwbuf[ulen+2] = plen;
 		memcpy(userpwbuf+ulen+3, password, plen);
 		sk_write(p->sub_socket, userpwbuf, ulen + plen + 3);
+		/*
+		 * Pipeline the CONNECT request behind the
+		 * subnegotiation: the only reply to it that doesn't
+		 * abort the whole connection is success, so there's
+		 * nothing to gain by waiting for it.
+		 */
+		proxy_socks5_sendconnect(p);
+		p->pipelined = TRUE;
 		p->state = 7;
 	    } else 
 		plug_closing(p->plug, "Proxy error: Server chose "
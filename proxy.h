@@ -44,6 +44,11 @@ struct Socket_proxy_tag {
 		 * we are done with the proxy negotiation? this
 		 * simply caches the value of sk_set_frozen calls.
 		 */
+    int pipelined; /* we have speculatively sent a later stage of the
+		    * negotiation without waiting for the reply to an
+		    * earlier one, so the intermediate send states
+		    * should be skipped when the replies come in.
+		    */
 
 #define PROXY_CHANGE_NEW      -1
 #define PROXY_CHANGE_CLOSING   0
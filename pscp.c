@@ -31,6 +31,7 @@ static int list = 0;
 static int verbose = 0;
 static int recursive = 0;
 static int preserve = 0;
+static int verify = 0;
 static int targetshouldbedirectory = 0;
 static int statistics = 1;
 static int prev_stats_len = 0;
@@ -42,6 +43,11 @@ static int main_cmd_is_sftp = 0;
 static int fallback_cmd_is_sftp = 0;
 static int using_sftp = 0;
 static int uploading = 0;
+static int resume = 0;		       /* -resume: keep a resume journal */
+static int shard_count = 1;	       /* -shard: parallel download procs */
+static int shard_index = 0;
+static int shard_active = 0;	       /* current file split by byte range? */
+static uint64 shard_lo, shard_hi;      /* this shard's range of that file */
 
 static Backend *back;
 static void *backhandle;
@@ -603,10 +609,25 @@ static int is_dots(char *str)
 }
 
 /*
- *  Wait for a response from the other side.
+ * Number of SCP protocol messages we have sent but not yet collected
+ * the status byte for. T, D and E messages are always followed by
+ * another control message, never by raw file data, so their
+ * acknowledgments can safely be collected later: the server answers
+ * every message with exactly one status byte, in order, so the
+ * stream stays in sync, and meanwhile the local directory walk
+ * (stat-heavy on network filesystems) carries on with those round
+ * trips still in flight instead of stalling for each one. The debt
+ * must be paid off before anything whose answer changes what we send
+ * next - in particular a C message, whose acknowledgment is the
+ * permission to send file data.
+ */
+static int deferred_acks = 0;
+
+/*
+ *  Wait for a single response from the other side.
  *  Return 0 if ok, -1 if error.
  */
-static int response(void)
+static int response_one(void)
 {
     char ch, resp, rbuf[2048];
     int p;
@@ -638,6 +659,33 @@ static int response(void)
     }
 }
 
+/*
+ * Wait for the response to the message we just sent, first paying
+ * off any deferred acknowledgments. Errors in the deferred ones have
+ * already been reported and counted by response_one(), so the return
+ * value reflects only the caller's own message.
+ */
+static int response(void)
+{
+    while (deferred_acks > 0) {
+	deferred_acks--;
+	(void) response_one();
+    }
+    return response_one();
+}
+
+/*
+ * Collect any acknowledgments still outstanding, once the whole
+ * transfer is finished and nothing else will call response().
+ */
+static void scp_drain_acks(void)
+{
+    while (deferred_acks > 0) {
+	deferred_acks--;
+	(void) response_one();
+    }
+}
+
 int sftp_recvdata(char *buf, int len)
 {
     return ssh_scp_recv((unsigned char *) buf, len);
@@ -760,6 +808,64 @@ static int scp_has_times;
 static struct fxp_handle *scp_sftp_filehandle;
 static struct fxp_xfer *scp_sftp_xfer;
 static uint64 scp_sftp_fileoffset;
+static unsigned char scp_verify_digest[32];
+static const char *scp_verify_name;    /* non-NULL => digest awaits check */
+
+/*
+ * In verify mode (-verify), source() and sink() stream a SHA-256
+ * over the file data as it passes through them, at no extra I/O
+ * cost. Once a transfer is complete (and, for uploads, all writes
+ * have been acknowledged) and the remote handle is still open, this
+ * asks the server to hash its copy via the check-file-handle
+ * extension and compares. Requires the SFTP protocol and a server
+ * implementing the extension; anything else is reported once.
+ */
+static void scp_verify_hash(void)
+{
+    struct fxp_check_file *cf;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    static int warned = 0;
+
+    req = fxp_check_file_send(scp_sftp_filehandle, "sha256",
+			      shard_active ? shard_lo : uint64_make(0, 0),
+			      shard_active ?
+			      uint64_subtract(shard_hi, shard_lo) :
+			      uint64_make(0, 0), 0);
+    pktin = sftp_wait_for_reply(req);
+    cf = fxp_check_file_recv(pktin, req);
+    if (!cf) {
+	if (!warned) {
+	    tell_user(stderr, "pscp: server cannot hash files, so transfers"
+		      " are NOT verified (%s)", fxp_error());
+	    warned = 1;
+	}
+	scp_verify_name = NULL;
+	return;
+    }
+
+    if (cf->nhashes < 1 || cf->hashlen != 32 ||
+	memcmp(cf->hashes, scp_verify_digest, 32) != 0) {
+	tell_user(stderr, "pscp: %s: remote SHA-256 does not match -"
+		  " transfer corrupt!", scp_verify_name);
+	errs++;
+    } else if (verbose) {
+	tell_user(stderr, "%s: SHA-256 verified", scp_verify_name);
+    }
+    fxp_free_check_file(cf);
+    scp_verify_name = NULL;
+}
+
+static void scp_verify_needs_sftp(void)
+{
+    static int warned = 0;
+    if (!warned) {
+	tell_user(stderr, "pscp: verification needs the SFTP protocol, so"
+		  " transfers are NOT verified (try -sftp)");
+	warned = 1;
+    }
+    scp_verify_name = NULL;
+}
 
 int scp_source_setup(const char *target, int shouldbedir)
 {
@@ -823,7 +929,8 @@ int scp_send_filetimes(unsigned long mtime, unsigned long atime)
 	char buf[80];
 	sprintf(buf, "T%lu 0 %lu 0\n", mtime, atime);
 	back->send(backhandle, buf, strlen(buf));
-	return response();
+	deferred_acks++;	       /* collected with the C response */
+	return 0;
     }
 }
 
@@ -945,6 +1052,8 @@ int scp_send_finish(void)
 	if (!scp_sftp_filehandle) {
 	    return 1;
 	}
+	if (verify && scp_verify_name)
+	    scp_verify_hash();
 	if (scp_has_times) {
 	    attrs.flags = SSH_FILEXFER_ATTR_ACMODTIME;
 	    attrs.atime = scp_sftp_atime;
@@ -963,6 +1072,8 @@ int scp_send_finish(void)
 	scp_has_times = 0;
 	return 0;
     } else {
+	if (verify && scp_verify_name)
+	    scp_verify_needs_sftp();
 	back->send(backhandle, "", 1);
 	return response();
     }
@@ -1036,7 +1147,15 @@ int scp_send_dirname(const char *name, int modes)
 	back->send(backhandle, buf, strlen(buf));
 	back->send(backhandle, name, strlen(name));
 	back->send(backhandle, "\n", 1);
-	return response();
+	/*
+	 * Deferring this acknowledgment means a failed mkdir is only
+	 * reported when the next file's C response is collected, by
+	 * which point we are already enumerating the directory; the
+	 * server rejects each of those files individually, so
+	 * nothing is lost but the promptness of the first message.
+	 */
+	deferred_acks++;
+	return 0;
     }
 }
 
@@ -1047,7 +1166,8 @@ int scp_send_enddir(void)
 	return 0;
     } else {
 	back->send(backhandle, "E\n", 2);
-	return response();
+	deferred_acks++;
+	return 0;
     }
 }
 
@@ -1515,7 +1635,10 @@ int scp_accept_filexfer(void)
 	    errs++;
 	    return 1;
 	}
-	scp_sftp_fileoffset = uint64_make(0, 0);
+	if (shard_active)
+	    scp_sftp_fileoffset = shard_lo;
+	else
+	    scp_sftp_fileoffset = uint64_make(0, 0);
 	scp_sftp_xfer = xfer_download_init(scp_sftp_filehandle,
 					   scp_sftp_fileoffset);
 	sfree(scp_sftp_currentname);
@@ -1601,11 +1724,16 @@ int scp_finish_filerecv(void)
 	}
 	xfer_cleanup(scp_sftp_xfer);
 
+	if (verify && scp_verify_name)
+	    scp_verify_hash();
+
 	req = fxp_close_send(scp_sftp_filehandle);
         pktin = sftp_wait_for_reply(req);
 	fxp_close_recv(pktin, req);
 	return 0;
     } else {
+	if (verify && scp_verify_name)
+	    scp_verify_needs_sftp();
 	back->send(backhandle, "", 1);
 	return response();
     }
@@ -1644,6 +1772,7 @@ static void source(const char *src)
     uint64 i;
     uint64 stat_bytes;
     time_t stat_starttime, stat_lasttime;
+    SHA256_State vstate;
 
     attr = file_type(src);
     if (attr == FILE_TYPE_NONEXISTENT ||
@@ -1711,36 +1840,88 @@ static void source(const char *src)
     stat_starttime = time(NULL);
     stat_lasttime = 0;
 
-#define PSCP_SEND_BLOCK 4096
-    for (i = uint64_make(0,0);
-	 uint64_compare(i,size) < 0;
-	 i = uint64_add32(i,PSCP_SEND_BLOCK)) {
-	char transbuf[PSCP_SEND_BLOCK];
-	int j, k = PSCP_SEND_BLOCK;
-
-	if (uint64_compare(uint64_add32(i, k),size) > 0) /* i + k > size */ 
-	    k = (uint64_subtract(size, i)).lo; 	/* k = size - i; */
-	if ((j = read_from_file(f, transbuf, k)) != k) {
-	    if (statistics)
-		printf("\n");
-	    bump("%s: Read error", src);
+    if (verify)
+	SHA256_Init(&vstate);
+
+    /*
+     * Double-buffered send loop: each chunk is read from disk
+     * _before_ we block waiting for the network to accept the
+     * previous one. Everything handed to scp_send_filedata so far
+     * drains to the network in the background, so while we sit in
+     * read_from_file the kernel is transmitting data already queued;
+     * disk
+     * latency and network latency overlap instead of adding up,
+     * which matters when the local file is on something slow like
+     * NFS. (The receiving direction gets the same overlap for free:
+     * the socket buffer and SSH channel window keep filling while
+     * sink() is blocked in write_to_file.)
+     */
+#define PSCP_SEND_BLOCK 32768
+    {
+	char *transbuf = snewn(2 * PSCP_SEND_BLOCK, char);
+	int whichbuf = 0, pendlen = 0;
+
+	for (i = uint64_make(0,0);
+	     uint64_compare(i,size) < 0;
+	     i = uint64_add32(i,PSCP_SEND_BLOCK)) {
+	    char *buf = transbuf + whichbuf * PSCP_SEND_BLOCK;
+	    int j, k = PSCP_SEND_BLOCK;
+
+	    if (uint64_compare(uint64_add32(i, k),size) > 0) /* i + k > size */
+		k = (uint64_subtract(size, i)).lo; 	/* k = size - i; */
+	    if ((j = read_from_file(f, buf, k)) != k) {
+		if (statistics)
+		    printf("\n");
+		bump("%s: Read error", src);
+	    }
+	    if (verify)
+		SHA256_Bytes(&vstate, buf, k);
+
+	    /*
+	     * Now that the next chunk is safely in memory, hand the
+	     * previous one to the network and wait for it to be
+	     * accepted.
+	     */
+	    if (pendlen) {
+		if (scp_send_filedata(transbuf + (1 - whichbuf) *
+				      PSCP_SEND_BLOCK, pendlen))
+		    bump("%s: Network error occurred", src);
+
+		if (statistics) {
+		    stat_bytes = uint64_add32(stat_bytes, pendlen);
+		    if (time(NULL) != stat_lasttime) {
+			stat_lasttime = time(NULL);
+			print_stats(last, size, stat_bytes,
+				    stat_starttime, stat_lasttime);
+		    }
+		}
+	    }
+	    pendlen = k;
+	    whichbuf ^= 1;
 	}
-	if (scp_send_filedata(transbuf, k))
-	    bump("%s: Network error occurred", src);
 
-	if (statistics) {
-	    stat_bytes = uint64_add32(stat_bytes, k);
-	    if (time(NULL) != stat_lasttime ||
-		(uint64_compare(uint64_add32(i, k), size) == 0)) {
+	if (pendlen) {
+	    if (scp_send_filedata(transbuf + (1 - whichbuf) *
+				  PSCP_SEND_BLOCK, pendlen))
+		bump("%s: Network error occurred", src);
+
+	    if (statistics) {
+		stat_bytes = uint64_add32(stat_bytes, pendlen);
 		stat_lasttime = time(NULL);
 		print_stats(last, size, stat_bytes,
 			    stat_starttime, stat_lasttime);
 	    }
 	}
 
+	sfree(transbuf);
     }
     close_rfile(f);
 
+    if (verify) {
+	SHA256_Final(&vstate, scp_verify_digest);
+	scp_verify_name = last;
+    }
+
     (void) scp_send_finish();
 }
 
@@ -1791,6 +1972,196 @@ static void rsource(const char *src)
 /*
  * Execute the sink part of the SCP protocol.
  */
+/*
+ * This must match XFER_BLOCKSIZE in sftp.c, for the same layer-
+ * crossing reason as the assertion in scp_recv_filedata: shard
+ * boundaries are aligned to it so that the block-sized reads the
+ * xfer manager issues never straddle the end of a shard's range,
+ * and hence never deliver more data than the remaining range asked
+ * for.
+ */
+#define SHARD_BLOCK 32768
+#define SHARD_BLOCK_SHIFT 15
+
+/*
+ * Decide what part this process plays in transferring one file,
+ * when running as one of several shards (-shard). Files big enough
+ * to be worth it are split into one contiguous block-aligned byte
+ * range per shard; smaller files are dealt out whole among the
+ * shards by a hash of their name, which parallelises directory
+ * copies full of small files too. Returns FALSE if this shard
+ * should leave the file entirely alone.
+ */
+static int shard_file_setup(const char *name, uint64 size)
+{
+    uint64 blocks, pershard;
+    unsigned hash;
+    const char *p;
+    int i;
+
+    shard_active = 0;
+    if (shard_count <= 1 || !using_sftp)
+	return TRUE;
+
+    blocks = uint64_shift_right(uint64_add32(size, SHARD_BLOCK - 1),
+				SHARD_BLOCK_SHIFT);
+    if (uint64_compare(blocks, uint64_make(0, 2 * shard_count)) < 0) {
+	hash = 0;
+	for (p = name; *p; p++)
+	    hash = hash * 31 + (unsigned char)*p;
+	return (int)(hash % shard_count) == shard_index;
+    }
+
+    pershard = uint64_shift_left(uint64_divn(uint64_add32(blocks,
+							  shard_count - 1),
+					     shard_count, NULL),
+				 SHARD_BLOCK_SHIFT);
+    shard_lo = uint64_make(0, 0);
+    for (i = 0; i < shard_index; i++)
+	shard_lo = uint64_add(shard_lo, pershard);
+    shard_hi = uint64_add(shard_lo, pershard);
+    if (uint64_compare(shard_lo, size) > 0)
+	shard_lo = size;
+    if (uint64_compare(shard_hi, size) > 0)
+	shard_hi = size;
+    shard_active = 1;
+    return TRUE;
+}
+
+/*
+ * Resume journal (-resume). A sidecar file next to the download
+ * target records, for each shard, the offset up to which that
+ * shard's range has definitely been written to disk. After a crash
+ * or network flap, a rerun reads the journal and restarts every
+ * shard at its exact high-water mark instead of refetching from the
+ * start - which matters particularly for sharded downloads, where
+ * the target file is preallocated to full length up front and so
+ * its size says nothing about how much of it is real data.
+ *
+ * The format is deliberately fixed-width text: a header line
+ * identifying the file size and shard count, then one line per
+ * shard holding a zero-padded 20-digit watermark and a done flag.
+ * Fixed-width lines mean each shard can rewrite its own line in
+ * place without touching the others'.
+ */
+#define JOURNAL_SUFFIX ".pscpresume"
+#define JOURNAL_MAGIC "PSCP-journal: "
+#define JOURNAL_HDRLEN (14 + 20 + 1 + 2 + 1)
+#define JOURNAL_SLOTLEN (20 + 1 + 1 + 1)
+
+static FILE *journal_fp = NULL;
+static char *journal_name = NULL;
+
+static void journal_put_u64(char *buf, uint64 x)
+{
+    char dec[24];
+    int len;
+    uint64_decimal(x, dec);
+    len = strlen(dec);
+    memset(buf, '0', 20 - len);
+    memcpy(buf + 20 - len, dec, len + 1);
+}
+
+static void journal_write_slot(int slot, uint64 watermark, int done)
+{
+    char buf[24];
+    journal_put_u64(buf, watermark);
+    fseek(journal_fp, JOURNAL_HDRLEN + (long)slot * JOURNAL_SLOTLEN,
+	  SEEK_SET);
+    fprintf(journal_fp, "%s %c\n", buf, done ? 'd' : '-');
+    fflush(journal_fp);
+}
+
+static int journal_read_slot(int slot, uint64 *watermark)
+{
+    char buf[JOURNAL_SLOTLEN + 1];
+    fseek(journal_fp, JOURNAL_HDRLEN + (long)slot * JOURNAL_SLOTLEN,
+	  SEEK_SET);
+    if (fread(buf, 1, JOURNAL_SLOTLEN, journal_fp) != JOURNAL_SLOTLEN)
+	return -1;
+    buf[20] = '\0';
+    if (watermark)
+	*watermark = uint64_from_decimal(buf);
+    return buf[21] == 'd';
+}
+
+/*
+ * Open (or create) the journal for one target file and return the
+ * watermark recorded for this shard, or zero if there is none. If an
+ * existing journal doesn't match the current file size and shard
+ * count, it's from some other transfer and is silently replaced.
+ * (Several shards starting a fresh file can race to replace it, but
+ * at that point every watermark is zero anyway.)
+ */
+static uint64 journal_start(const char *fname, uint64 size)
+{
+    char hdr[JOURNAL_HDRLEN + 1], sizebuf[24];
+    uint64 watermark;
+    int i, done;
+
+    if (journal_fp) {		       /* defensive: close leftover */
+	fclose(journal_fp);
+	journal_fp = NULL;
+    }
+    sfree(journal_name);
+    journal_name = dupcat(fname, JOURNAL_SUFFIX, NULL);
+
+    journal_put_u64(sizebuf, size);
+
+    journal_fp = fopen(journal_name, "r+b");
+    if (journal_fp) {
+	if (fread(hdr, 1, JOURNAL_HDRLEN, journal_fp) == JOURNAL_HDRLEN) {
+	    hdr[JOURNAL_HDRLEN] = '\0';
+	    if (strncmp(hdr, JOURNAL_MAGIC, 14) == 0 &&
+		strncmp(hdr + 14, sizebuf, 20) == 0 &&
+		atoi(hdr + 35) == shard_count) {
+		done = journal_read_slot(shard_index, &watermark);
+		if (done >= 0)
+		    return watermark;
+	    }
+	}
+	fclose(journal_fp);	       /* stale or corrupt: replace it */
+    }
+
+    journal_fp = fopen(journal_name, "w+b");
+    if (!journal_fp) {
+	tell_user(stderr, "pscp: cannot create %s: transfer will not be"
+		  " resumable", journal_name);
+	return uint64_make(0, 0);
+    }
+    fprintf(journal_fp, "%s%s %02d\n", JOURNAL_MAGIC, sizebuf, shard_count);
+    for (i = 0; i < shard_count; i++)
+	journal_write_slot(i, uint64_make(0, 0), FALSE);
+    return uint64_make(0, 0);
+}
+
+/*
+ * Called when this shard has finished with the current file, well or
+ * badly. If the transfer completed, the shard's slot is marked done,
+ * and whichever shard finds every slot marked done removes the
+ * journal altogether.
+ */
+static void journal_finish(int complete, uint64 watermark)
+{
+    int i, alldone = TRUE;
+
+    if (!journal_fp)
+	return;
+    if (complete)
+	journal_write_slot(shard_index, watermark, TRUE);
+    for (i = 0; i < shard_count; i++)
+	if (journal_read_slot(i, NULL) != 1) {
+	    alldone = FALSE;
+	    break;
+	}
+    fclose(journal_fp);
+    journal_fp = NULL;
+    if (alldone)
+	remove(journal_name);
+    sfree(journal_name);
+    journal_name = NULL;
+}
+
 static void sink(const char *targ, const char *src)
 {
     char *destfname;
@@ -1803,6 +2174,7 @@ static void sink(const char *targ, const char *src)
     uint64 stat_bytes;
     time_t stat_starttime, stat_lasttime;
     char *stat_name;
+    SHA256_State vstate;
 
     attr = file_type(targ);
     if (attr == FILE_TYPE_DIRECTORY)
@@ -1814,6 +2186,7 @@ static void sink(const char *targ, const char *src)
     scp_sink_init();
     while (1) {
 	struct scp_sink_action act;
+	uint64 xfersize;
 	if (scp_get_sink_action(&act))
 	    return;
 
@@ -1925,7 +2298,41 @@ static void sink(const char *targ, const char *src)
 	    continue;
 	}
 
-	f = open_new_file(destfname, act.permissions);
+	if (!shard_file_setup(destfname, act.size)) {
+	    /*
+	     * The whole file belongs to another shard; in SFTP mode
+	     * we can simply leave it alone, without even opening it
+	     * remotely.
+	     */
+	    sfree(destfname);
+	    continue;
+	}
+
+	if (resume && using_sftp) {
+	    uint64 w;
+	    if (!shard_active) {
+		/*
+		 * Promote an unsharded download to the explicit-range
+		 * machinery, so that the remote open, the local open
+		 * and -verify all pick up the resume offset the same
+		 * way a shard's range start is picked up.
+		 */
+		shard_active = 1;
+		shard_lo = uint64_make(0, 0);
+		shard_hi = act.size;
+	    }
+	    w = journal_start(destfname, act.size);
+	    if (uint64_compare(w, shard_lo) > 0)
+		shard_lo = w;
+	    if (uint64_compare(shard_lo, shard_hi) > 0)
+		shard_lo = shard_hi;
+	}
+
+	if (shard_active)
+	    f = open_wfile_shard(destfname, act.permissions,
+				 act.size, shard_lo);
+	else
+	    f = open_new_file(destfname, act.permissions);
 	if (f == NULL) {
 	    run_err("%s: Cannot create file", destfname);
             sfree(destfname);
@@ -1943,22 +2350,39 @@ static void sink(const char *targ, const char *src)
 	stat_lasttime = 0;
 	stat_name = stripslashes(destfname, 1);
 
+	if (verify)
+	    SHA256_Init(&vstate);
+
+	if (shard_active)
+	    xfersize = uint64_subtract(shard_hi, shard_lo);
+	else
+	    xfersize = act.size;
+
 	received = uint64_make(0, 0);
-	while (uint64_compare(received,act.size) < 0) {
+	while (uint64_compare(received,xfersize) < 0) {
 	    char transbuf[32768];
 	    uint64 blksize;
 	    int read;
 	    blksize = uint64_make(0, 32768);
-	    if (uint64_compare(blksize,uint64_subtract(act.size,received)) > 0)
-	      blksize = uint64_subtract(act.size,received);
+	    if (uint64_compare(blksize,uint64_subtract(xfersize,received)) > 0)
+	      blksize = uint64_subtract(xfersize,received);
 	    read = scp_recv_filedata(transbuf, (int)blksize.lo);
 	    if (read <= 0)
 		bump("Lost connection");
+	    if (verify)
+		SHA256_Bytes(&vstate, transbuf, read);
 	    if (wrerror) {
                 received = uint64_add32(received, read);
 		continue;
             }
-	    if (write_to_file(f, transbuf, read) != (int)read) {
+	    if (write_to_file(f, transbuf, read) == (int)read) {
+		if (journal_fp)
+		    journal_write_slot(shard_index,
+				       uint64_add(shard_lo,
+						  uint64_add32(received,
+							       read)),
+				       FALSE);
+	    } else {
 		wrerror = 1;
 		/* FIXME: in sftp we can actually abort the transfer */
 		if (statistics)
@@ -1971,9 +2395,9 @@ static void sink(const char *targ, const char *src)
 	    if (statistics) {
 		stat_bytes = uint64_add32(stat_bytes,read);
 		if (time(NULL) > stat_lasttime ||
-		    uint64_compare(uint64_add32(received, read), act.size) == 0) {
+		    uint64_compare(uint64_add32(received, read), xfersize) == 0) {
 		    stat_lasttime = time(NULL);
-		    print_stats(stat_name, act.size, stat_bytes,
+		    print_stats(stat_name, xfersize, stat_bytes,
 				stat_starttime, stat_lasttime);
 		}
 	    }
@@ -1985,11 +2409,18 @@ static void sink(const char *targ, const char *src)
 
 	close_wfile(f);
 	if (wrerror) {
+	    journal_finish(FALSE, uint64_make(0, 0));
 	    run_err("%s: Write error", destfname);
             sfree(destfname);
 	    continue;
 	}
+	if (verify && !wrerror &&
+	    !(shard_active && uint64_compare(xfersize, uint64_make(0, 0)) == 0)) {
+	    SHA256_Final(&vstate, scp_verify_digest);
+	    scp_verify_name = stat_name;
+	}
 	(void) scp_finish_filerecv();
+	journal_finish(TRUE, shard_hi);
 	sfree(destfname);
 	sfree(act.buf);
     }
@@ -2088,6 +2519,9 @@ static void toremote(int argc, char *argv[])
 	    finish_wildcard_matching(wc);
 	}
     }
+
+    if (!using_sftp)
+	scp_drain_acks();
 }
 
 /*
@@ -2245,8 +2679,15 @@ static void usage(void)
     printf("  -unsafe   allow server-side wildcards (DANGEROUS)\n");
     printf("  -sftp     force use of SFTP protocol\n");
     printf("  -scp      force use of SCP protocol\n");
+    printf("  -verify   check transfers against a server-side SHA-256\n");
+    printf("            (needs SFTP and the check-file extension)\n");
+    printf("  -shard n  download over n parallel SSH connections,\n");
+    printf("            splitting large files by byte range (needs SFTP)\n");
+    printf("  -resume   keep a journal beside each downloaded file, and\n");
+    printf("            restart interrupted downloads where they left off\n");
     printf("  -sshlog file\n");
     printf("  -sshrawlog file\n");
+    printf("  -sshbinlog file\n");
     printf("            log protocol details to a file\n");
 #if 0
     /*
@@ -2327,6 +2768,8 @@ int psftp_main(int argc, char *argv[])
 	    recursive = 1;
 	} else if (strcmp(argv[i], "-p") == 0) {
 	    preserve = 1;
+	} else if (strcmp(argv[i], "-verify") == 0) {
+	    verify = 1;
 	} else if (strcmp(argv[i], "-q") == 0) {
 	    statistics = 0;
 	} else if (strcmp(argv[i], "-h") == 0 ||
@@ -2346,6 +2789,14 @@ int psftp_main(int argc, char *argv[])
 	    try_scp = 0; try_sftp = 1;
 	} else if (strcmp(argv[i], "-scp") == 0) {
 	    try_scp = 1; try_sftp = 0;
+	} else if (strcmp(argv[i], "-resume") == 0) {
+	    resume = 1;
+	} else if (strcmp(argv[i], "-shard") == 0) {
+	    if (i + 1 == argc)
+		cmdline_error("-shard requires an argument");
+	    shard_count = atoi(argv[++i]);
+	    if (shard_count < 1 || shard_count > 64)
+		cmdline_error("-shard argument must be between 1 and 64");
 	} else if (strcmp(argv[i], "--") == 0) {
 	    i++;
 	    break;
@@ -2357,6 +2808,34 @@ int psftp_main(int argc, char *argv[])
     argv += i;
     back = NULL;
 
+    if (shard_count > 1) {
+	if (list || argc < 2 || colon(argv[argc - 1]) != NULL) {
+	    tell_user(stderr, "pscp: -shard only applies to downloads;"
+		      " ignoring it");
+	    shard_count = 1;
+	} else {
+	    /*
+	     * Byte-range sharding needs random access to the remote
+	     * file, so insist on the SFTP protocol.
+	     */
+	    try_scp = 0; try_sftp = 1;
+	    shard_index = shard_processes(shard_count);
+	    if (shard_index < 0) {
+		tell_user(stderr, "pscp: -shard is not supported on this"
+			  " platform; using one connection");
+		shard_count = 1;
+		shard_index = 0;
+	    } else if (shard_index > 0) {
+		statistics = 0;	       /* one progress display is plenty */
+	    }
+	}
+    }
+
+    if (resume && !list && argc >= 2 && colon(argv[argc - 1]) == NULL) {
+	/* Resuming needs random access to the remote file, too. */
+	try_scp = 0; try_sftp = 1;
+    }
+
     if (list) {
 	if (argc != 1)
 	    usage();
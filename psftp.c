@@ -42,21 +42,32 @@ int sent_eof = FALSE;
 /* ----------------------------------------------------------------------
  * Manage sending requests and waiting for replies.
  */
+static int async_handle_reply(struct sftp_request *rreq,
+			      struct sftp_packet *pktin);
+
 struct sftp_packet *sftp_wait_for_reply(struct sftp_request *req)
 {
     struct sftp_packet *pktin;
     struct sftp_request *rreq;
 
     sftp_register(req);
-    pktin = sftp_recv();
-    if (pktin == NULL)
-        connection_fatal(NULL, "did not receive SFTP response packet "
-                         "from server");
-    rreq = sftp_find_request(pktin);
-    if (rreq != req)
-        connection_fatal(NULL, "unable to understand SFTP response packet "
-                         "from server: %s", fxp_error());
-    return pktin;
+    while (1) {
+	pktin = sftp_recv();
+	if (pktin == NULL)
+	    connection_fatal(NULL, "did not receive SFTP response packet "
+			     "from server");
+	rreq = sftp_find_request(pktin);
+	if (rreq == req)
+	    return pktin;
+	/*
+	 * Not ours: perhaps a reply to one of the operations
+	 * dispatched asynchronously in batch mode, which the server
+	 * may answer in any order relative to this request.
+	 */
+	if (!async_handle_reply(rreq, pktin))
+	    connection_fatal(NULL, "unable to understand SFTP response "
+			     "packet from server: %s", fxp_error());
+    }
 }
 
 /* ----------------------------------------------------------------------
@@ -169,6 +180,277 @@ char *canonify(const char *name)
     }
 }
 
+/* ----------------------------------------------------------------------
+ * Cache of remote file attributes, keyed by canonified path.
+ *
+ * Directory listings hand us the attributes of every entry for free,
+ * so remembering them lets later stat-heavy operations (such as a
+ * recursive get, which stats each file before opening it) skip a
+ * round trip per file. Entries are dropped whenever we change the
+ * file ourselves; like any cache, it can't see changes other clients
+ * make on the server behind our back.
+ */
+
+struct statcache_entry {
+    char *path;
+    struct fxp_attrs attrs;
+};
+
+static tree234 *statcache = NULL;
+
+static int statcache_cmp(void *av, void *bv)
+{
+    struct statcache_entry *a = (struct statcache_entry *)av;
+    struct statcache_entry *b = (struct statcache_entry *)bv;
+    return strcmp(a->path, b->path);
+}
+
+static int statcache_find(void *av, void *bv)
+{
+    char *a = (char *)av;
+    struct statcache_entry *b = (struct statcache_entry *)bv;
+    return strcmp(a, b->path);
+}
+
+#define STATCACHE_MAX 65536	       /* entries kept before dumping it all */
+
+static void statcache_add(const char *path, const struct fxp_attrs *attrs)
+{
+    struct statcache_entry *sce;
+
+    if (!statcache)
+	statcache = newtree234(statcache_cmp);
+
+    if (count234(statcache) >= STATCACHE_MAX) {
+	/* Crude overflow policy: dump the lot and start again. */
+	while ((sce = delpos234(statcache, 0)) != NULL) {
+	    sfree(sce->path);
+	    sfree(sce);
+	}
+    }
+
+    sce = find234(statcache, (void *)path, statcache_find);
+    if (!sce) {
+	sce = snew(struct statcache_entry);
+	sce->path = dupstr(path);
+	add234(statcache, sce);
+    }
+    sce->attrs = *attrs;
+}
+
+/*
+ * Cache an entry from a READDIR listing. Directory listings report
+ * symlinks as themselves where FXP_STAT follows them, so those (and
+ * entries of unknown type) must not masquerade as stat results.
+ */
+static void statcache_add_listed(const char *dir, const char *filename,
+				 const struct fxp_attrs *attrs)
+{
+    char *path;
+    const char *slash;
+
+    if (!(attrs->flags & SSH_FILEXFER_ATTR_PERMISSIONS) ||
+	(attrs->permissions & 0170000) == 0120000)
+	return;
+
+    slash = (dir[0] && dir[strlen(dir)-1] == '/') ? "" : "/";
+    path = dupcat(dir, slash, filename, NULL);
+    statcache_add(path, attrs);
+    sfree(path);
+}
+
+static void statcache_remove(const char *path)
+{
+    struct statcache_entry *sce;
+
+    if (!statcache)
+	return;
+    sce = find234(statcache, (void *)path, statcache_find);
+    if (sce) {
+	del234(statcache, sce);
+	sfree(sce->path);
+	sfree(sce);
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Asynchronous dispatch of simple operations in batch mode.
+ *
+ * Deployment-style batch files tend to contain long runs of
+ * independent rm, rmdir and mkdir commands, each of which is a
+ * single SFTP request, and each of which was costing a full round
+ * trip. In batch mode we keep a window of such operations in flight
+ * at once through the ordinary sftp_register request table, and only
+ * wait for answers when something actually depends on them: a new
+ * operation whose path overlaps an outstanding one, a full window,
+ * or any other kind of command (which acts as a barrier). The server
+ * may answer in any order; sftp_wait_for_reply hands us strays.
+ */
+
+#define ASYNC_MAX 64
+
+enum { ASYNC_RM, ASYNC_RMDIR, ASYNC_MKDIR };
+static const char *const async_verb[] = { "rm", "rmdir", "mkdir" };
+
+static struct async_op {
+    struct sftp_request *req;
+    char *path;
+    int kind;
+} async_win[ASYNC_MAX];
+static int async_nops = 0;
+static int async_enabled = FALSE;      /* set only while in batch mode */
+static int async_failed = FALSE;       /* any failure since last barrier */
+
+/*
+ * Process one reply belonging to the async window, wherever it was
+ * received. Returns FALSE if the request isn't one of ours.
+ */
+static int async_handle_reply(struct sftp_request *rreq,
+			      struct sftp_packet *pktin)
+{
+    int i, result;
+    struct async_op *op;
+
+    for (i = 0; i < async_nops; i++)
+	if (async_win[i].req == rreq)
+	    break;
+    if (i == async_nops)
+	return FALSE;
+    op = &async_win[i];
+
+    switch (op->kind) {
+      case ASYNC_RM:
+	result = fxp_remove_recv(pktin, rreq);
+	break;
+      case ASYNC_RMDIR:
+	result = fxp_rmdir_recv(pktin, rreq);
+	break;
+      default /* ASYNC_MKDIR */:
+	result = fxp_mkdir_recv(pktin, rreq);
+	break;
+    }
+
+    if (!result) {
+	printf("%s %s: %s\n", async_verb[op->kind], op->path, fxp_error());
+	async_failed = TRUE;
+    } else {
+	if (op->kind != ASYNC_MKDIR)
+	    statcache_remove(op->path);
+	printf("%s %s: OK\n", async_verb[op->kind], op->path);
+    }
+
+    sfree(op->path);
+    async_win[i] = async_win[--async_nops];
+    return TRUE;
+}
+
+/*
+ * Wait for one outstanding async operation, any one, to complete.
+ */
+static void async_reap_one(void)
+{
+    struct sftp_packet *pktin;
+    struct sftp_request *rreq;
+
+    pktin = sftp_recv();
+    if (pktin == NULL)
+	connection_fatal(NULL, "did not receive SFTP response packet "
+			 "from server");
+    rreq = sftp_find_request(pktin);
+    if (!async_handle_reply(rreq, pktin))
+	connection_fatal(NULL, "unable to understand SFTP response "
+			 "packet from server: %s", fxp_error());
+}
+
+/*
+ * Barrier: wait for everything outstanding. Returns FALSE if any
+ * operation since the last barrier failed.
+ */
+static int async_drain(void)
+{
+    int ok;
+    while (async_nops > 0)
+	async_reap_one();
+    ok = !async_failed;
+    async_failed = FALSE;
+    return ok;
+}
+
+/*
+ * Two canonified paths are order-dependent if they are the same, or
+ * if one names a directory containing the other (mkdir a must finish
+ * before mkdir a/b starts; rmdir a/b before rmdir a).
+ */
+static int async_paths_conflict(const char *a, const char *b)
+{
+    size_t la = strlen(a), lb = strlen(b);
+    if (la > lb) {
+	const char *tp = a; a = b; b = tp;
+	la = lb;
+    }
+    return strncmp(a, b, la) == 0 && (b[la] == '\0' || b[la] == '/');
+}
+
+/*
+ * Dispatch one operation into the window, first waiting out anything
+ * it depends on. Takes ownership of nothing; copies the path.
+ */
+static int async_dispatch(int kind, const char *path)
+{
+    struct async_op *op;
+    int i;
+
+    while (1) {
+	for (i = 0; i < async_nops; i++)
+	    if (async_paths_conflict(path, async_win[i].path))
+		break;
+	if (i == async_nops && async_nops < ASYNC_MAX)
+	    break;
+	async_reap_one();
+    }
+
+    op = &async_win[async_nops++];
+    op->kind = kind;
+    op->path = dupstr(path);
+    switch (kind) {
+      case ASYNC_RM:
+	op->req = fxp_remove_send(path);
+	break;
+      case ASYNC_RMDIR:
+	op->req = fxp_rmdir_send(path);
+	break;
+      default /* ASYNC_MKDIR */:
+	op->req = fxp_mkdir_send(path);
+	break;
+    }
+    sftp_register(op->req);
+    return 1;			       /* failures surface at the barrier */
+}
+
+/*
+ * Stat a (canonified) remote path, consulting the cache first.
+ */
+static int psftp_stat(const char *path, struct fxp_attrs *attrs)
+{
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    struct statcache_entry *sce;
+    int result;
+
+    if (statcache &&
+	(sce = find234(statcache, (void *)path, statcache_find)) != NULL) {
+	*attrs = sce->attrs;
+	return 1;
+    }
+
+    req = fxp_stat_send(path);
+    pktin = sftp_wait_for_reply(req);
+    result = fxp_stat_recv(pktin, req, attrs);
+    if (result)
+	statcache_add(path, attrs);
+    return result;
+}
+
 /*
  * qsort comparison routine for fxp_name structures. Sorts by real
  * file name.
@@ -195,6 +477,458 @@ static void not_connected(void)
     printf("psftp: not connected to a host; use \"open host.name\"\n");
 }
 
+/* ----------------------------------------------------------------------
+ * Concurrent transfer of batches of small files.
+ *
+ * Recursive copies of directory trees full of small files are
+ * dominated by the round trips paid per file: open, transfer, close,
+ * each of which the ordinary code waits out in turn. These helpers
+ * keep several files' request chains in flight at once over the one
+ * SFTP channel, using the same sftp_register / sftp_find_request
+ * machinery that pipelines reads within a single large file. Only
+ * runs of ordinary files small enough to move in about one request
+ * take this path; everything else goes through sftp_get_file and
+ * sftp_put_file one at a time as before.
+ */
+
+#define PARA_NFILES 16		       /* number of files in flight at once */
+#define PARA_MAXSIZE 32768	       /* max data per read/write request */
+
+struct parafile {
+    int state;			       /* PARA_ST_* */
+    char *fname, *outfname;
+    struct fxp_handle *fh;
+    WFile *wfile;		       /* local file, downloads */
+    RFile *rfile;		       /* local file, uploads */
+    long permissions;
+    unsigned long done;		       /* bytes transferred so far */
+    char buffer[PARA_MAXSIZE];
+};
+
+enum {
+    PARA_ST_OPEN,		       /* awaiting FXP_OPEN reply */
+    PARA_ST_DATA,		       /* awaiting FXP_READ or FXP_WRITE reply */
+    PARA_ST_CLOSE		       /* awaiting FXP_CLOSE reply */
+};
+
+static void para_finish(struct parafile *pf)
+{
+    if (pf->wfile)
+	close_wfile(pf->wfile);
+    if (pf->rfile)
+	close_rfile(pf->rfile);
+    sfree(pf->fname);
+    sfree(pf->outfname);
+    sfree(pf);
+}
+
+/*
+ * Identify entries in a remote directory listing that are worth
+ * batching: ordinary files whose size we know to fit in a single
+ * read request.
+ */
+static int sftp_get_is_small(struct fxp_name *name)
+{
+    return (name->attrs.flags & SSH_FILEXFER_ATTR_SIZE) &&
+	(name->attrs.flags & SSH_FILEXFER_ATTR_PERMISSIONS) &&
+	!(name->attrs.permissions & 0040000) &&
+	name->attrs.size.hi == 0 && name->attrs.size.lo <= PARA_MAXSIZE;
+}
+
+/*
+ * Download a batch of small files concurrently. On error we print a
+ * message, finish draining the requests already in flight (we can't
+ * abandon them, or their replies would confuse the next synchronous
+ * request), and return 0.
+ */
+static int sftp_get_small_files(char *dirname, char *outdirname,
+				struct fxp_name **names, int nnames)
+{
+    struct parafile *pf;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    int next = 0, inflight = 0, err = 0;
+
+    while (next < nnames || inflight > 0) {
+	/*
+	 * Start the next few files' request chains, until we have
+	 * PARA_NFILES in flight.
+	 */
+	while (!err && inflight < PARA_NFILES && next < nnames) {
+	    pf = snew(struct parafile);
+	    pf->state = PARA_ST_OPEN;
+	    pf->fname = dupcat(dirname, "/", names[next]->filename, NULL);
+	    pf->outfname = dir_file_cat(outdirname, names[next]->filename);
+	    pf->fh = NULL;
+	    pf->wfile = NULL;
+	    pf->rfile = NULL;
+	    pf->permissions = GET_PERMISSIONS(names[next]->attrs);
+	    pf->done = 0;
+	    printf("remote:%s => local:%s\n", pf->fname, pf->outfname);
+	    sftp_register(req = fxp_open_send(pf->fname, SSH_FXF_READ, NULL));
+	    fxp_set_userdata(req, pf);
+	    next++;
+	    inflight++;
+	}
+
+	if (inflight == 0)
+	    break;
+
+	pktin = sftp_recv();
+	if (pktin == NULL)
+	    connection_fatal(NULL, "did not receive SFTP response packet "
+			     "from server");
+	req = sftp_find_request(pktin);
+	if (req == NULL)
+	    connection_fatal(NULL, "unable to understand SFTP response packet "
+			     "from server: %s", fxp_error());
+	pf = (struct parafile *)fxp_get_userdata(req);
+
+	switch (pf->state) {
+	  case PARA_ST_OPEN:
+	    pf->fh = fxp_open_recv(pktin, req);
+	    if (!pf->fh) {
+		printf("%s: open for read: %s\n", pf->fname, fxp_error());
+		err = 1;
+		inflight--;
+		para_finish(pf);
+		break;
+	    }
+	    if (!err) {
+		pf->wfile = open_new_file(pf->outfname, pf->permissions);
+		if (!pf->wfile) {
+		    printf("local: unable to open %s\n", pf->outfname);
+		    err = 1;
+		}
+	    }
+	    if (!err) {
+		pf->state = PARA_ST_DATA;
+		sftp_register(req = fxp_read_send(pf->fh, uint64_make(0, 0),
+						  PARA_MAXSIZE));
+	    } else {
+		/* We still have to close the remote handle. */
+		pf->state = PARA_ST_CLOSE;
+		sftp_register(req = fxp_close_send(pf->fh));
+	    }
+	    fxp_set_userdata(req, pf);
+	    break;
+	  case PARA_ST_DATA: {
+	    int retlen = fxp_read_recv(pktin, req, pf->buffer, PARA_MAXSIZE);
+	    if (retlen < 0 && fxp_error_type() == SSH_FX_EOF)
+		retlen = 0;
+	    if (retlen < 0) {
+		printf("error while reading: %s\n", fxp_error());
+		err = 1;
+	    } else if (!err && retlen > 0) {
+		int wpos = 0, wlen;
+		while (wpos < retlen) {
+		    wlen = write_to_file(pf->wfile, pf->buffer + wpos,
+					 retlen - wpos);
+		    if (wlen <= 0) {
+			printf("error while writing local file\n");
+			err = 1;
+			break;
+		    }
+		    wpos += wlen;
+		}
+		pf->done += retlen;
+	    }
+	    if (!err && retlen > 0) {
+		/* Short reads are legal mid-file, so keep reading
+		 * until the server says EOF explicitly. */
+		pf->state = PARA_ST_DATA;
+		sftp_register(req = fxp_read_send(pf->fh,
+						  uint64_make(0, pf->done),
+						  PARA_MAXSIZE));
+	    } else {
+		pf->state = PARA_ST_CLOSE;
+		sftp_register(req = fxp_close_send(pf->fh));
+	    }
+	    fxp_set_userdata(req, pf);
+	    break;
+	  }
+	  case PARA_ST_CLOSE:
+	    fxp_close_recv(pktin, req);
+	    inflight--;
+	    para_finish(pf);
+	    break;
+	}
+    }
+
+    return !err;
+}
+
+/*
+ * Upload a batch of files concurrently. We can't tell the small
+ * files apart until we open them, so this takes any run of ordinary
+ * local files; ones that turn out to be too big are skipped and
+ * flagged in `deferred' (indexed to match `names'), for the caller
+ * to send through the ordinary deeply-pipelined path afterwards.
+ */
+static int sftp_put_small_files(char *dirname, char *outdirname,
+				char **names, int nnames, int *deferred)
+{
+    struct parafile *pf;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    struct fxp_attrs attrs;
+    int next = 0, inflight = 0, err = 0;
+
+    while (next < nnames || inflight > 0) {
+	while (!err && inflight < PARA_NFILES && next < nnames) {
+	    char *nextfname;
+	    RFile *file;
+	    uint64 size;
+	    long permissions;
+
+	    deferred[next] = 0;
+	    nextfname = dir_file_cat(dirname, names[next]);
+	    file = open_existing_file(nextfname, &size, NULL, NULL,
+				      &permissions);
+	    if (!file) {
+		printf("local: unable to open %s\n", nextfname);
+		sfree(nextfname);
+		err = 1;
+		break;
+	    }
+	    if (size.hi != 0 || size.lo > PARA_MAXSIZE) {
+		close_rfile(file);
+		sfree(nextfname);
+		deferred[next++] = 1;
+		continue;
+	    }
+	    pf = snew(struct parafile);
+	    pf->state = PARA_ST_OPEN;
+	    pf->fname = nextfname;
+	    pf->outfname = dupcat(outdirname, "/", names[next], NULL);
+	    pf->fh = NULL;
+	    pf->wfile = NULL;
+	    pf->rfile = file;
+	    pf->permissions = permissions;
+	    pf->done = 0;
+	    attrs.flags = 0;
+	    PUT_PERMISSIONS(attrs, permissions);
+	    printf("local:%s => remote:%s\n", pf->fname, pf->outfname);
+	    sftp_register(req = fxp_open_send(pf->outfname,
+					      SSH_FXF_WRITE | SSH_FXF_CREAT |
+					      SSH_FXF_TRUNC, &attrs));
+	    fxp_set_userdata(req, pf);
+	    next++;
+	    inflight++;
+	}
+
+	if (inflight == 0)
+	    break;
+
+	pktin = sftp_recv();
+	if (pktin == NULL)
+	    connection_fatal(NULL, "did not receive SFTP response packet "
+			     "from server");
+	req = sftp_find_request(pktin);
+	if (req == NULL)
+	    connection_fatal(NULL, "unable to understand SFTP response packet "
+			     "from server: %s", fxp_error());
+	pf = (struct parafile *)fxp_get_userdata(req);
+
+	switch (pf->state) {
+	  case PARA_ST_OPEN:
+	  case PARA_ST_DATA: {
+	    int len;
+
+	    if (pf->state == PARA_ST_OPEN) {
+		pf->fh = fxp_open_recv(pktin, req);
+		if (!pf->fh) {
+		    printf("%s: open for write: %s\n",
+			   pf->outfname, fxp_error());
+		    err = 1;
+		    inflight--;
+		    para_finish(pf);
+		    break;
+		}
+		statcache_remove(pf->outfname);
+	    } else {
+		if (!fxp_write_recv(pktin, req)) {
+		    printf("%s: write: %s\n", pf->outfname, fxp_error());
+		    err = 1;
+		}
+	    }
+	    len = err ? 0 : read_from_file(pf->rfile, pf->buffer,
+					   PARA_MAXSIZE);
+	    if (len < 0) {
+		printf("error while reading local file\n");
+		err = 1;
+		len = 0;
+	    }
+	    if (len > 0) {
+		pf->state = PARA_ST_DATA;
+		sftp_register(req = fxp_write_send(pf->fh, pf->buffer,
+						   uint64_make(0, pf->done),
+						   len));
+		pf->done += len;
+	    } else {
+		pf->state = PARA_ST_CLOSE;
+		sftp_register(req = fxp_close_send(pf->fh));
+	    }
+	    fxp_set_userdata(req, pf);
+	    break;
+	  }
+	  case PARA_ST_CLOSE:
+	    fxp_close_recv(pktin, req);
+	    inflight--;
+	    para_finish(pf);
+	    break;
+	}
+    }
+
+    return !err;
+}
+
+/* ----------------------------------------------------------------------
+ * Delta verification for restarted downloads.
+ *
+ * A plain reget assumes that the part of the file we already have
+ * still matches the server's copy, and just appends from our current
+ * length. If the server implements the "check-file-handle" extension
+ * we can do better: compare block hashes of the region we already
+ * hold and re-fetch just the blocks that differ, so an artifact that
+ * was rebuilt in place on the server ends up correct without
+ * transferring the unchanged bulk of it again. Servers without the
+ * extension simply get the old behaviour.
+ */
+
+#define DELTA_BLOCK 32768	       /* bytes hashed per block */
+#define DELTA_SPAN 1024		       /* blocks covered per request */
+
+/*
+ * Fetch one block from the server and write it over the local copy.
+ * Returns 0 on failure.
+ */
+static int sftp_reget_fetch_block(struct fxp_handle *fh, WFile *file,
+				  uint64 offset, int len)
+{
+    char *buffer = snewn(DELTA_BLOCK, char);
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    int got = 0, wpos, wlen, ret = 1;
+
+    while (got < len) {
+	int retlen;
+
+	req = fxp_read_send(fh, uint64_add32(offset, got), len - got);
+	pktin = sftp_wait_for_reply(req);
+	retlen = fxp_read_recv(pktin, req, buffer + got, len - got);
+	if (retlen <= 0) {
+	    ret = 0;
+	    goto cleanup;
+	}
+	got += retlen;
+    }
+
+    if (seek_file(file, offset, FROM_START) < 0) {
+	ret = 0;
+	goto cleanup;
+    }
+    wpos = 0;
+    while (wpos < len) {
+	wlen = write_to_file(file, buffer + wpos, len - wpos);
+	if (wlen <= 0) {
+	    ret = 0;
+	    goto cleanup;
+	}
+	wpos += wlen;
+    }
+
+  cleanup:
+    sfree(buffer);
+    return ret;
+}
+
+/*
+ * Verify the first `length' bytes of the local file against the
+ * server's copy, re-fetching changed blocks. Any failure (most
+ * commonly the server not supporting the extension) just means we
+ * stop verifying and the caller appends as before.
+ */
+static void sftp_reget_delta(struct fxp_handle *fh, WFile *file,
+			     char *outfname, uint64 length)
+{
+    RFile *lf;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    uint64 pos;
+    char *buffer;
+    int refetched = 0, failed = 0;
+
+    lf = open_existing_file(outfname, NULL, NULL, NULL, NULL);
+    if (!lf)
+	return;
+
+    buffer = snewn(DELTA_BLOCK, char);
+
+    for (pos = uint64_make(0, 0);
+	 !failed && uint64_compare(pos, length) < 0;) {
+	struct fxp_check_file *cf;
+	uint64 spanlen;
+	int nblocks, b;
+
+	spanlen = uint64_subtract(length, pos);
+	if (uint64_compare(spanlen,
+			   uint64_make(0, DELTA_SPAN * DELTA_BLOCK)) > 0)
+	    spanlen = uint64_make(0, DELTA_SPAN * DELTA_BLOCK);
+
+	req = fxp_check_file_send(fh, "md5,sha1,sha256", pos, spanlen,
+				  DELTA_BLOCK);
+	pktin = sftp_wait_for_reply(req);
+	cf = fxp_check_file_recv(pktin, req);
+	if (!cf)
+	    break;		       /* server can't do it; plain append */
+
+	nblocks = (spanlen.lo + DELTA_BLOCK - 1) / DELTA_BLOCK;
+	if (nblocks > cf->nhashes)
+	    nblocks = cf->nhashes;
+
+	for (b = 0; b < nblocks; b++) {
+	    unsigned char digest[32];
+	    uint64 blkoff = uint64_add32(pos, (unsigned long)b * DELTA_BLOCK);
+	    int blklen = DELTA_BLOCK;
+
+	    if ((unsigned long)(b + 1) * DELTA_BLOCK > spanlen.lo)
+		blklen = spanlen.lo - (unsigned long)b * DELTA_BLOCK;
+
+	    if (read_from_file(lf, buffer, blklen) != blklen) {
+		failed = 1;
+		break;
+	    }
+	    if (!strcmp(cf->algorithm, "md5"))
+		MD5Simple(buffer, blklen, digest);
+	    else if (!strcmp(cf->algorithm, "sha1"))
+		SHA_Simple(buffer, blklen, digest);
+	    else
+		SHA256_Simple(buffer, blklen, digest);
+
+	    if (memcmp(digest, cf->hashes + b * cf->hashlen, cf->hashlen)) {
+		if (!sftp_reget_fetch_block(fh, file, blkoff, blklen)) {
+		    printf("reget: error re-fetching changed block: %s\n",
+			   fxp_error());
+		    failed = 1;
+		    break;
+		}
+		refetched++;
+	    }
+	}
+
+	pos = uint64_add(pos, spanlen);
+	fxp_free_check_file(cf);
+    }
+
+    if (refetched)
+	printf("reget: re-fetched %d changed block%s\n",
+	       refetched, refetched == 1 ? "" : "s");
+
+    sfree(buffer);
+    close_rfile(lf);
+}
+
 /* ----------------------------------------------------------------------
  * The meat of the `get' and `put' commands.
  */
@@ -217,9 +951,7 @@ int sftp_get_file(char *fname, char *outfname, int recurse, int restart)
     if (recurse) {
 	int result;
 
-        req = fxp_stat_send(fname);
-        pktin = sftp_wait_for_reply(req);
-	result = fxp_stat_recv(pktin, req, &attrs);
+	result = psftp_stat(fname, &attrs);
 
 	if (result &&
 	    (attrs.flags & SSH_FILEXFER_ATTR_PERMISSIONS) &&
@@ -291,6 +1023,9 @@ int sftp_get_file(char *fname, char *outfname, int recurse, int restart)
 				   "supplied filename '%s'\n",
 				   names->names[i].filename);
 			} else {
+			    statcache_add_listed(fname,
+						 names->names[i].filename,
+						 &names->names[i].attrs);
 			    ournames[nnames++] =
 				fxp_dup_name(&names->names[i]);
 			}
@@ -345,7 +1080,30 @@ int sftp_get_file(char *fname, char *outfname, int recurse, int restart)
 	    for (; i < nnames; i++) {
 		char *nextfname, *nextoutfname;
 		int ret;
-		
+
+		/*
+		 * Batch up runs of small ordinary files and transfer
+		 * them concurrently; see sftp_get_small_files.
+		 */
+		if (!restart && sftp_get_is_small(ournames[i])) {
+		    int j = i;
+		    while (j < nnames && sftp_get_is_small(ournames[j]))
+			j++;
+		    if (j - i > 1) {
+			ret = sftp_get_small_files(fname, outfname,
+						   ournames + i, j - i);
+			if (!ret) {
+			    for (i = 0; i < nnames; i++) {
+				fxp_free_name(ournames[i]);
+			    }
+			    sfree(ournames);
+			    return 0;
+			}
+			i = j - 1;
+			continue;
+		    }
+		}
+
 		nextfname = dupcat(fname, "/", ournames[i]->filename, NULL);
                 nextoutfname = dir_file_cat(outfname, ournames[i]->filename);
 		ret = sftp_get_file(nextfname, nextoutfname, recurse, restart);
@@ -373,9 +1131,7 @@ int sftp_get_file(char *fname, char *outfname, int recurse, int restart)
 	}
     }
 
-    req = fxp_stat_send(fname);
-    pktin = sftp_wait_for_reply(req);
-    if (!fxp_stat_recv(pktin, req, &attrs))
+    if (!psftp_stat(fname, &attrs))
         attrs.flags = 0;
 
     req = fxp_open_send(fname, SSH_FXF_READ, NULL);
@@ -419,6 +1175,15 @@ int sftp_get_file(char *fname, char *outfname, int recurse, int restart)
 	offset = get_file_posn(file);
 	uint64_decimal(offset, decbuf);
 	printf("reget: restarting at file position %s\n", decbuf);
+
+	/*
+	 * If the server can hash file blocks for us, verify the data
+	 * we already have instead of trusting it blindly, and
+	 * re-fetch any blocks that have changed on the server.
+	 */
+	sftp_reget_delta(fh, file, outfname, offset);
+	if (seek_file(file, offset, FROM_START) < 0)
+	    seek_file(file, uint64_make(0, 0), FROM_END);
     } else {
 	offset = uint64_make(0, 0);
     }
@@ -511,9 +1276,7 @@ int sftp_put_file(char *fname, char *outfname, int recurse, int restart)
 	 * First, attempt to create the destination directory,
 	 * unless it already exists.
 	 */
-	req = fxp_stat_send(outfname);
-        pktin = sftp_wait_for_reply(req);
-	result = fxp_stat_recv(pktin, req, &attrs);
+	result = psftp_stat(outfname, &attrs);
 	if (!result ||
 	    !(attrs.flags & SSH_FILEXFER_ATTR_PERMISSIONS) ||
 	    !(attrs.permissions & 0040000)) {
@@ -570,9 +1333,7 @@ int sftp_put_file(char *fname, char *outfname, int recurse, int restart)
             while (i < nnames) {
                 char *nextoutfname;
                 nextoutfname = dupcat(outfname, "/", ournames[i], NULL);
-                req = fxp_stat_send(nextoutfname);
-                pktin = sftp_wait_for_reply(req);
-                result = fxp_stat_recv(pktin, req, &attrs);
+                result = psftp_stat(nextoutfname, &attrs);
                 sfree(nextoutfname);
                 if (!result)
                     break;
@@ -592,6 +1353,51 @@ int sftp_put_file(char *fname, char *outfname, int recurse, int restart)
 	    char *nextfname, *nextoutfname;
 	    int ret;
 
+	    /*
+	     * Batch up runs of ordinary files and transfer the small
+	     * ones concurrently; see sftp_put_small_files. Files too
+	     * big for that path come back flagged in `deferred' and
+	     * go through sftp_put_file below.
+	     */
+	    if (!restart) {
+		int j = i;
+		while (j < nnames) {
+		    int type;
+		    nextfname = dir_file_cat(fname, ournames[j]);
+		    type = file_type(nextfname);
+		    sfree(nextfname);
+		    if (type != FILE_TYPE_FILE)
+			break;
+		    j++;
+		}
+		if (j - i > 1) {
+		    int k, *deferred = snewn(j - i, int);
+		    ret = sftp_put_small_files(fname, outfname, ournames + i,
+					       j - i, deferred);
+		    for (k = 0; ret && k < j - i; k++) {
+			if (deferred[k]) {
+			    nextfname = dir_file_cat(fname, ournames[i + k]);
+			    nextoutfname = dupcat(outfname, "/",
+						  ournames[i + k], NULL);
+			    ret = sftp_put_file(nextfname, nextoutfname,
+						recurse, restart);
+			    sfree(nextoutfname);
+			    sfree(nextfname);
+			}
+		    }
+		    sfree(deferred);
+		    if (!ret) {
+			for (i = 0; i < nnames; i++) {
+			    sfree(ournames[i]);
+			}
+			sfree(ournames);
+			return 0;
+		    }
+		    i = j - 1;
+		    continue;
+		}
+	    }
+
             nextfname = dir_file_cat(fname, ournames[i]);
 	    nextoutfname = dupcat(outfname, "/", ournames[i], NULL);
 	    ret = sftp_put_file(nextfname, nextoutfname, recurse, restart);
@@ -641,6 +1447,8 @@ int sftp_put_file(char *fname, char *outfname, int recurse, int restart)
 	return 0;
     }
 
+    statcache_remove(outfname);
+
     if (restart) {
 	char decbuf[30];
 	struct fxp_attrs attrs;
@@ -1054,24 +1862,47 @@ int sftp_cmd_ls(struct sftp_command *cmd)
 	sfree(unwcdir);
 	return 0;
     } else {
+	int inflight = 0, eof = 0;
+
 	nnames = namesize = 0;
 	ournames = NULL;
 
-	while (1) {
+	/*
+	 * Pipeline the READDIR requests: each one only returns a
+	 * batch of a few hundred names at most, so serialising them
+	 * makes listing a huge directory cost a round trip per
+	 * batch. Keeping several in flight doesn't change the set of
+	 * names returned, only how fast we get them; requests still
+	 * outstanding when we see EOF just come back as EOF too.
+	 */
+#define LS_PIPELINE 8
+	while (!eof || inflight > 0) {
+	    while (!eof && inflight < LS_PIPELINE) {
+		sftp_register(req = fxp_readdir_send(dirh));
+		inflight++;
+	    }
 
-	    req = fxp_readdir_send(dirh);
-            pktin = sftp_wait_for_reply(req);
+	    pktin = sftp_recv();
+	    if (pktin == NULL)
+		connection_fatal(NULL, "did not receive SFTP response packet "
+				 "from server");
+	    req = sftp_find_request(pktin);
+	    if (req == NULL)
+		connection_fatal(NULL, "unable to understand SFTP response "
+				 "packet from server: %s", fxp_error());
+	    inflight--;
 	    names = fxp_readdir_recv(pktin, req);
 
 	    if (names == NULL) {
-		if (fxp_error_type() == SSH_FX_EOF)
-		    break;
-		printf("Reading directory %s: %s\n", dir, fxp_error());
-		break;
+		if (fxp_error_type() != SSH_FX_EOF && !eof)
+		    printf("Reading directory %s: %s\n", dir, fxp_error());
+		eof = 1;
+		continue;
 	    }
 	    if (names->nnames == 0) {
 		fxp_free_names(names);
-		break;
+		eof = 1;
+		continue;
 	    }
 
 	    if (nnames + names->nnames >= namesize) {
@@ -1079,9 +1910,12 @@ int sftp_cmd_ls(struct sftp_command *cmd)
 		ournames = sresize(ournames, namesize, struct fxp_name *);
 	    }
 
-	    for (i = 0; i < names->nnames; i++)
+	    for (i = 0; i < names->nnames; i++) {
+		statcache_add_listed(cdir, names->names[i].filename,
+				     &names->names[i].attrs);
 		if (!wildcard || wc_match(wildcard, names->names[i].filename))
 		    ournames[nnames++] = fxp_dup_name(&names->names[i]);
+	    }
 
 	    fxp_free_names(names);
 	}
@@ -1423,6 +2257,12 @@ int sftp_cmd_mkdir(struct sftp_command *cmd)
 	    return 0;
 	}
 
+	if (async_enabled) {
+	    ret &= async_dispatch(ASYNC_MKDIR, dir);
+	    sfree(dir);
+	    continue;
+	}
+
 	req = fxp_mkdir_send(dir);
         pktin = sftp_wait_for_reply(req);
 	result = fxp_mkdir_recv(pktin, req);
@@ -1445,6 +2285,9 @@ static int sftp_action_rmdir(void *vctx, char *dir)
     struct sftp_request *req;
     int result;
 
+    if (async_enabled)
+	return async_dispatch(ASYNC_RMDIR, dir);
+
     req = fxp_rmdir_send(dir);
     pktin = sftp_wait_for_reply(req);
     result = fxp_rmdir_recv(pktin, req);
@@ -1454,6 +2297,7 @@ static int sftp_action_rmdir(void *vctx, char *dir)
 	return 0;
     }
 
+    statcache_remove(dir);
     printf("rmdir %s: OK\n", dir);
 
     return 1;
@@ -1486,6 +2330,9 @@ static int sftp_action_rm(void *vctx, char *fname)
     struct sftp_request *req;
     int result;
 
+    if (async_enabled)
+	return async_dispatch(ASYNC_RM, fname);
+
     req = fxp_remove_send(fname);
     pktin = sftp_wait_for_reply(req);
     result = fxp_remove_recv(pktin, req);
@@ -1495,6 +2342,7 @@ static int sftp_action_rm(void *vctx, char *fname)
 	return 0;
     }
 
+    statcache_remove(fname);
     printf("rm %s: OK\n", fname);
 
     return 1;
@@ -1523,14 +2371,10 @@ int sftp_cmd_rm(struct sftp_command *cmd)
 
 static int check_is_dir(char *dstfname)
 {
-    struct sftp_packet *pktin;
-    struct sftp_request *req;
     struct fxp_attrs attrs;
     int result;
 
-    req = fxp_stat_send(dstfname);
-    pktin = sftp_wait_for_reply(req);
-    result = fxp_stat_recv(pktin, req, &attrs);
+    result = psftp_stat(dstfname, &attrs);
 
     if (result &&
 	(attrs.flags & SSH_FILEXFER_ATTR_PERMISSIONS) &&
@@ -1584,6 +2428,8 @@ static int sftp_action_mv(void *vctx, char *srcfname)
 	printf("mv %s %s: %s\n", srcfname, finalfname, error);
 	ret = 0;
     } else {
+	statcache_remove(srcfname);
+	statcache_remove(finalfname);
 	printf("%s -> %s\n", srcfname, finalfname);
 	ret = 1;
     }
@@ -1637,6 +2483,240 @@ int sftp_cmd_mv(struct sftp_command *cmd)
     return ret;
 }
 
+/*
+ * Server-side copy: bridge a pipelined read from one remote file
+ * straight into a pipelined write to another, so the file data never
+ * touches the client's disk. Each read reply is turned into a write
+ * request at the same offset as soon as it arrives, which keeps both
+ * pipelines full at once; the client only ever holds CP_PIPELINE
+ * blocks' worth of data in memory.
+ */
+#define CP_BLOCK 32768
+#define CP_PIPELINE 16
+
+struct cp_block {
+    int iswrite;		       /* FALSE = read request, TRUE = write */
+    uint64 offset;
+    int reqlen;
+    char buffer[CP_BLOCK];
+};
+
+static int sftp_copy_remote(char *srcfname, char *dstfname)
+{
+    struct fxp_handle *sh, *dh;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    struct fxp_attrs attrs;
+    struct cp_block *cb;
+    uint64 offset;
+    int nreads, nwrites, eof, err;
+
+    /*
+     * Give the new file the same permissions as the old one, if we
+     * can find out what they are.
+     */
+    if (psftp_stat(srcfname, &attrs))
+	attrs.flags &= SSH_FILEXFER_ATTR_PERMISSIONS;
+    else
+	attrs.flags = 0;
+
+    req = fxp_open_send(srcfname, SSH_FXF_READ, NULL);
+    pktin = sftp_wait_for_reply(req);
+    sh = fxp_open_recv(pktin, req);
+    if (!sh) {
+	printf("%s: open for read: %s\n", srcfname, fxp_error());
+	return 0;
+    }
+
+    req = fxp_open_send(dstfname,
+			SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC,
+			&attrs);
+    pktin = sftp_wait_for_reply(req);
+    dh = fxp_open_recv(pktin, req);
+    if (!dh) {
+	printf("%s: open for write: %s\n", dstfname, fxp_error());
+	req = fxp_close_send(sh);
+	pktin = sftp_wait_for_reply(req);
+	fxp_close_recv(pktin, req);
+	return 0;
+    }
+    statcache_remove(dstfname);
+
+    offset = uint64_make(0, 0);
+    nreads = nwrites = 0;
+    eof = err = 0;
+
+    while (1) {
+	/*
+	 * Keep the read pipeline topped up, unless errors or EOF
+	 * mean we shouldn't issue any more reads.
+	 */
+	while (!eof && !err && nreads + nwrites < CP_PIPELINE) {
+	    cb = snew(struct cp_block);
+	    cb->iswrite = FALSE;
+	    cb->offset = offset;
+	    cb->reqlen = CP_BLOCK;
+	    sftp_register(req = fxp_read_send(sh, cb->offset, cb->reqlen));
+	    fxp_set_userdata(req, cb);
+	    offset = uint64_add32(offset, CP_BLOCK);
+	    nreads++;
+	}
+
+	if (nreads + nwrites == 0)
+	    break;
+
+	pktin = sftp_recv();
+	if (pktin == NULL)
+	    connection_fatal(NULL, "did not receive SFTP response packet "
+			     "from server");
+	req = sftp_find_request(pktin);
+	if (req == NULL)
+	    connection_fatal(NULL, "unable to understand SFTP response packet "
+			     "from server: %s", fxp_error());
+	cb = (struct cp_block *)fxp_get_userdata(req);
+
+	if (!cb->iswrite) {
+	    int retlen = fxp_read_recv(pktin, req, cb->buffer, cb->reqlen);
+	    nreads--;
+	    if (retlen < 0 && fxp_error_type() == SSH_FX_EOF)
+		retlen = 0;
+	    if (retlen < 0) {
+		if (!err)
+		    printf("error while reading %s: %s\n",
+			   srcfname, fxp_error());
+		err = 1;
+		sfree(cb);
+	    } else if (retlen == 0) {
+		eof = 1;
+		sfree(cb);
+	    } else {
+		/*
+		 * A short read is legal in mid-file, so if we got one
+		 * we must request the remainder of this block
+		 * separately to avoid leaving a hole in the copy.
+		 */
+		if (retlen < cb->reqlen && !err) {
+		    struct cp_block *cb2 = snew(struct cp_block);
+		    cb2->iswrite = FALSE;
+		    cb2->offset = uint64_add32(cb->offset, retlen);
+		    cb2->reqlen = cb->reqlen - retlen;
+		    sftp_register(req = fxp_read_send(sh, cb2->offset,
+						      cb2->reqlen));
+		    fxp_set_userdata(req, cb2);
+		    nreads++;
+		}
+		if (!err) {
+		    cb->iswrite = TRUE;
+		    sftp_register(req = fxp_write_send(dh, cb->buffer,
+						       cb->offset, retlen));
+		    fxp_set_userdata(req, cb);
+		    nwrites++;
+		} else {
+		    sfree(cb);
+		}
+	    }
+	} else {
+	    nwrites--;
+	    if (!fxp_write_recv(pktin, req)) {
+		if (!err)
+		    printf("error while writing %s: %s\n",
+			   dstfname, fxp_error());
+		err = 1;
+	    }
+	    sfree(cb);
+	}
+    }
+
+    req = fxp_close_send(sh);
+    pktin = sftp_wait_for_reply(req);
+    fxp_close_recv(pktin, req);
+
+    req = fxp_close_send(dh);
+    pktin = sftp_wait_for_reply(req);
+    fxp_close_recv(pktin, req);
+
+    if (!err)
+	printf("%s => %s\n", srcfname, dstfname);
+    return !err;
+}
+
+static int sftp_action_cp(void *vctx, char *srcfname)
+{
+    struct sftp_context_mv *ctx = (struct sftp_context_mv *)vctx;
+    char *finalfname, *newcanon = NULL;
+    int ret;
+
+    if (ctx->dest_is_dir) {
+	char *p;
+	char *newname;
+
+	p = srcfname + strlen(srcfname);
+	while (p > srcfname && p[-1] != '/') p--;
+	newname = dupcat(ctx->dstfname, "/", p, NULL);
+	newcanon = canonify(newname);
+	if (!newcanon) {
+	    printf("%s: canonify: %s\n", newname, fxp_error());
+	    sfree(newname);
+	    return 0;
+	}
+	sfree(newname);
+
+	finalfname = newcanon;
+    } else {
+	finalfname = ctx->dstfname;
+    }
+
+    ret = sftp_copy_remote(srcfname, finalfname);
+
+    sfree(newcanon);
+    return ret;
+}
+
+int sftp_cmd_cp(struct sftp_command *cmd)
+{
+    struct sftp_context_mv actx, *ctx = &actx;
+    int i, ret;
+
+    if (back == NULL) {
+	not_connected();
+	return 0;
+    }
+
+    if (cmd->nwords < 3) {
+	printf("cp: expects two filenames\n");
+	return 0;
+    }
+
+    ctx->dstfname = canonify(cmd->words[cmd->nwords-1]);
+    if (!ctx->dstfname) {
+	printf("%s: canonify: %s\n", ctx->dstfname, fxp_error());
+	return 0;
+    }
+
+    /*
+     * If there's more than one source argument, or one source
+     * argument which is a wildcard, we _require_ that the
+     * destination is a directory.
+     */
+    ctx->dest_is_dir = check_is_dir(ctx->dstfname);
+    if ((cmd->nwords > 3 || is_wildcard(cmd->words[1])) && !ctx->dest_is_dir) {
+	printf("cp: multiple or wildcard arguments require the destination"
+	       " to be a directory\n");
+	sfree(ctx->dstfname);
+	return 0;
+    }
+
+    /*
+     * Now iterate over the source arguments.
+     */
+    ret = 1;
+    for (i = 1; i < cmd->nwords-1; i++)
+	ret &= wildcard_iterate(cmd->words[i], sftp_action_cp, ctx);
+
+    sfree(ctx->dstfname);
+    return ret;
+}
+
 struct sftp_context_chmod {
     unsigned attrs_clr, attrs_xor;
 };
@@ -1650,9 +2730,7 @@ static int sftp_action_chmod(void *vctx, char *fname)
     unsigned oldperms, newperms;
     struct sftp_context_chmod *ctx = (struct sftp_context_chmod *)vctx;
 
-    req = fxp_stat_send(fname);
-    pktin = sftp_wait_for_reply(req);
-    result = fxp_stat_recv(pktin, req, &attrs);
+    result = psftp_stat(fname, &attrs);
 
     if (!result || !(attrs.flags & SSH_FILEXFER_ATTR_PERMISSIONS)) {
 	printf("get attrs for %s: %s\n", fname,
@@ -1678,6 +2756,7 @@ static int sftp_action_chmod(void *vctx, char *fname)
 	return 0;
     }
 
+    statcache_remove(fname);
     printf("%s: %04o -> %04o\n", fname, oldperms, newperms);
 
     return 1;
@@ -1966,6 +3045,17 @@ static struct sftp_cmd_lookup {
 	    "  session, to the same server or to a different one.\n",
 	    sftp_cmd_close
     },
+    {
+	"cp", TRUE, "copy file(s) on the remote server",
+	    " <source> [ <source>... ] <destination>\n"
+	    "  Copies <source>(s) on the server to <destination>, also on\n"
+	    "  the server. The file data is relayed directly between the\n"
+	    "  two remote files, without being stored on the local machine.\n"
+	    "  If <destination> specifies an existing directory, then <source>\n"
+	    "  may be a wildcard, and multiple <source>s may be given; all\n"
+	    "  source files are copied into <destination>.\n",
+	    sftp_cmd_cp
+    },
     {
 	"del", TRUE, "delete files on the remote server",
 	    " <filename-or-wildcard> [ <filename-or-wildcard>... ]\n"
@@ -2410,11 +3500,25 @@ int do_sftp(int mode, int modeflags, char *batchfile)
 	    return 1;
         }
 	ret = 0;
+	async_enabled = TRUE;
         while (1) {
 	    struct sftp_command *cmd;
 	    cmd = sftp_getcmd(fp, mode, modeflags);
 	    if (!cmd)
 		break;
+	    /*
+	     * Any command other than the asynchronously dispatched
+	     * ones is a barrier: everything in flight must finish
+	     * (and report) before it runs, and its failures count
+	     * like a failed command.
+	     */
+	    if (cmd->obey != sftp_cmd_rm && cmd->obey != sftp_cmd_rmdir &&
+		cmd->obey != sftp_cmd_mkdir && cmd->obey != sftp_cmd_null &&
+		!async_drain()) {
+		ret = 0;
+		if (!(modeflags & 2))
+		    break;
+	    }
 	    ret = cmd->obey(cmd);
 	    if (ret < 0)
 		break;
@@ -2423,6 +3527,9 @@ int do_sftp(int mode, int modeflags, char *batchfile)
 		    break;
 	    }
         }
+	if (!async_drain())
+	    ret = 0;
+	async_enabled = FALSE;
 	fclose(fp);
 	/*
 	 * In batch mode, and if exit on command failure is enabled,
@@ -2650,6 +3757,7 @@ static void usage(void)
     printf("            use 'command' as local proxy\n");
     printf("  -sshlog file\n");
     printf("  -sshrawlog file\n");
+    printf("  -sshbinlog file\n");
     printf("            log protocol details to a file\n");
     cleanup_exit(1);
 }
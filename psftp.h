@@ -73,6 +73,16 @@ void gui_send_errcount(int list, int errs);
 void gui_send_char(int is_stderr, int c);
 void gui_enable(const char *arg);
 
+/*
+ * Used by PSCP's -shard mode. Splits into one process per shard:
+ * each child returns its shard index (0 to count-1) and goes on to
+ * make its own SSH connection, while the parent waits for them all
+ * and exits nonzero if any child did. Returns -1 on platforms
+ * without a suitable primitive, in which case the caller falls back
+ * to a single connection.
+ */
+int shard_processes(int count);
+
 /*
  * It's likely that a given platform's implementation of file
  * transfer utilities is going to want to do things with them that
@@ -102,6 +112,12 @@ int read_from_file(RFile *f, void *buffer, int length);
 /* Closes and frees the RFile */
 void close_rfile(RFile *f);
 WFile *open_new_file(const char *name, long perms);
+/* As open_new_file, but for one shard of a sharded PSCP download:
+ * opens without truncating (other shards may already have written
+ * their parts), sets the file length to `size', and positions at
+ * `offset' ready for this shard's range. */
+WFile *open_wfile_shard(const char *name, long perms, uint64 size,
+			uint64 offset);
 /* Returns <0 on error, 0 on eof, or number of bytes written, as usual */
 int write_to_file(WFile *f, void *buffer, int length);
 void set_file_times(WFile *f, unsigned long mtime, unsigned long atime);
@@ -167,6 +167,7 @@ struct unicode_data {
 #define LGTYP_DEBUG 2		       /* logmode: all chars of traffic */
 #define LGTYP_PACKETS 3		       /* logmode: SSH data packets */
 #define LGTYP_SSHRAW 4		       /* logmode: SSH raw data */
+#define LGTYP_PKTBIN 5		       /* logmode: SSH packets, binary format */
 
 typedef enum {
     /* Actual special commands. Originally Telnet, but some codes have
@@ -176,6 +177,11 @@ typedef enum {
     TS_EOL,
     /* Special command for SSH. */
     TS_REKEY,
+    /* Write a snapshot of the session statistics to the Event Log. */
+    TS_STATS,
+    /* Write the allocation-accounting counters to the Event Log.
+     * Only offered in MALLOC_ACCOUNTING builds. */
+    TS_MEMSTATS,
     /* POSIX-style signals. (not Telnet) */
     TS_SIGABRT, TS_SIGALRM, TS_SIGFPE,  TS_SIGHUP,  TS_SIGILL,
     TS_SIGINT,  TS_SIGKILL, TS_SIGPIPE, TS_SIGQUIT, TS_SIGSEGV,
@@ -759,6 +765,7 @@ void cleanup_exit(int);
     X(STR, NONE, remote_cmd2) /* fallback if remote_cmd fails; never loaded or saved */ \
     X(INT, NONE, nopty) \
     X(INT, NONE, compression) \
+    X(INT, NONE, compressionlevel) /* 1-9; effort spent on outgoing zlib */ \
     X(INT, INT, ssh_kexlist) \
     X(INT, INT, ssh_hklist) \
     X(INT, NONE, ssh_rekey_time) /* in minutes */ \
@@ -836,12 +843,14 @@ void cleanup_exit(int);
     X(INT, NONE, alt_space) /* is it special? */ \
     X(INT, NONE, alt_only) /* is it special? */ \
     X(INT, NONE, localecho) \
+    X(INT, NONE, localecho_predict) /* speculative echo of keystrokes */ \
     X(INT, NONE, localedit) \
     X(INT, NONE, alwaysontop) \
     X(INT, NONE, fullscreenonaltenter) \
     X(INT, NONE, scroll_on_key) \
     X(INT, NONE, scroll_on_disp) \
     X(INT, NONE, erase_to_scrollback) \
+    X(INT, NONE, refresh_rate) /* max window updates per second; 0=default */ \
     X(INT, NONE, compose_key) \
     X(INT, NONE, ctrlaltkeys) \
     X(INT, NONE, osx_option_meta) \
@@ -849,6 +858,7 @@ void cleanup_exit(int);
     X(STR, NONE, wintitle) /* initial window title */ \
     /* Terminal options */ \
     X(INT, NONE, savelines) \
+    X(FILENAME, NONE, scrollback_snapshot) \
     X(INT, NONE, dec_om) \
     X(INT, NONE, wrap_mode) \
     X(INT, NONE, lfhascr) \
@@ -876,6 +886,9 @@ void cleanup_exit(int);
     X(INT, NONE, logxfovr) \
     X(INT, NONE, logflush) \
     X(INT, NONE, logmkdir) \
+    X(INT, NONE, logrotate_size) \
+    X(INT, NONE, logrotate_time) \
+    X(INT, NONE, logrotate_compress) \
     X(INT, NONE, logomitpass) \
     X(INT, NONE, logomitdata) \
     X(INT, NONE, hide_mouseptr) \
@@ -985,6 +998,8 @@ Conf *conf_new(void);		       /* create an empty configuration */
 void conf_free(Conf *conf);
 Conf *conf_copy(Conf *oldconf);
 void conf_copy_into(Conf *dest, Conf *src);
+/* Modification count, so readers caching values can detect changes. */
+unsigned conf_generation(Conf *conf);
 /* Mandatory accessor functions: enforce by assertion that keys exist. */
 int conf_get_int(Conf *conf, int key);
 int conf_get_int_int(Conf *conf, int key, int subkey);
@@ -1031,8 +1046,16 @@ FontSpec *fontspec_deserialise(void *data, int maxsize, int *used);
 
 /*
  * Exports from noise.c.
+ *
+ * noise_get_heavy collects the cheap, high-quality one-off entropy
+ * sources (the OS random number generator and the saved random
+ * seed); it returns TRUE if the OS RNG was available.
+ * noise_get_background collects the slower environmental sources
+ * (process listings, directory scans and the like), which sshrand.c
+ * defers until after startup when the OS RNG has been seen to work.
  */
-void noise_get_heavy(void (*func) (void *, int));
+int noise_get_heavy(void (*func) (void *, int));
+void noise_get_background(void (*func) (void *, int));
 void noise_get_light(void (*func) (void *, int));
 void noise_regular(void);
 void noise_ultralight(unsigned long data);
@@ -1083,6 +1106,8 @@ void term_size(Terminal *, int, int, int);
 void term_paint(Terminal *, Context, int, int, int, int, int);
 void term_scroll(Terminal *, int, int);
 void term_scroll_to_selection(Terminal *, int);
+int term_search(Terminal *, const char *needle, int start, int backwards);
+char *term_url_at(Terminal *, int x, int y, int *startx, int *endx);
 void term_pwron(Terminal *, int);
 void term_clrsb(Terminal *);
 void term_mouse(Terminal *, Mouse_Button, Mouse_Button, Mouse_Action,
@@ -1091,6 +1116,7 @@ void term_key(Terminal *, Key_Sym, wchar_t *, size_t, unsigned int,
 	      unsigned int);
 void term_lost_clipboard_ownership(Terminal *, int clipboard);
 void term_update(Terminal *);
+void term_set_visible(Terminal *, int);
 void term_invalidate(Terminal *);
 void term_blink(Terminal *, int set_cursor);
 void term_do_paste(Terminal *, const wchar_t *, int);
@@ -1100,9 +1126,14 @@ void term_copyall(Terminal *, const int *, int);
 void term_reconfig(Terminal *, Conf *);
 void term_request_copy(Terminal *, const int *clipboards, int n_clipboards);
 void term_request_paste(Terminal *, int clipboard);
-void term_seen_key_event(Terminal *); 
+void term_seen_key_event(Terminal *);
+void term_input_predict(Terminal *, const char *, int);
 int term_data(Terminal *, int is_stderr, const char *data, int len);
 int term_data_untrusted(Terminal *, const char *data, int len);
+void term_log_stats(Terminal *);
+#ifdef INPUT_LATENCY_TRACE
+void term_latency_keystroke(Terminal *);
+#endif
 void term_provide_resize_fn(Terminal *term,
 			    void (*resize_fn)(void *, int, int),
 			    void *resize_ctx);
@@ -1138,6 +1169,18 @@ void log_packet(void *logctx, int direction, int type,
 		const unsigned long *sequence,
                 unsigned downstream_id, const char *additional_log_text);
 
+/*
+ * Exports from eventring.c: a bounded ring of timestamped Event Log
+ * entries, shared by the GUI front ends' Event Log dialogs.
+ */
+struct eventring;
+struct eventring *eventring_new(void);
+void eventring_free(struct eventring *er);
+void eventring_add(struct eventring *er, const char *string);
+int eventring_count(struct eventring *er);
+int eventring_discarded(struct eventring *er);
+const char *eventring_get(struct eventring *er, int index);
+
 /*
  * Exports from testback.c
  */
@@ -1175,6 +1218,7 @@ void *ldisc_create(Conf *, Terminal *, Backend *, void *, void *);
 void ldisc_configure(void *, Conf *);
 void ldisc_free(void *);
 void ldisc_send(void *handle, const char *buf, int len, int interactive);
+int ldisc_sendbuffer(void *handle);
 void ldisc_echoedit_update(void *handle);
 
 /*
@@ -1374,6 +1418,22 @@ printer_job *printer_start_job(char *printer);
 void printer_job_data(printer_job *, void *, int);
 void printer_finish_job(printer_job *);
 
+/*
+ * Exports from the platform scrollback spill modules (uxsbfile.c,
+ * winsbfile.c): an anonymous temporary file with a growable memory
+ * mapping, used by terminal.c to spill compressed scrollback lines
+ * out of the heap. The file is deleted on close (and never visible
+ * under a predictable name), so a crash can't leave session contents
+ * lying around.
+ */
+typedef struct sbfile_tag sbfile;
+sbfile *sbfile_new(void);	       /* returns NULL on failure */
+unsigned char *sbfile_map(sbfile *, size_t size); /* grow the file to 'size'
+					* and (re)map it; on failure returns
+					* NULL with any previous mapping
+					* still valid */
+void sbfile_free(sbfile *);	       /* unmap, close and delete */
+
 /*
  * Exports from cmdline.c (and also cmdline_error(), which is
  * defined differently in various places and required _by_
@@ -1566,6 +1626,47 @@ int run_timers(unsigned long now, unsigned long *next);
 void timer_change_notify(unsigned long next);
 unsigned long timing_last_clock(void);
 
+/*
+ * Cached coarse tick count (implementation in misc.c). GETTICKCOUNT
+ * costs a clock syscall per use, and under load the busy paths -
+ * run_timers firing decisions, log-file timestamps, terminal blink
+ * and activity stamps - each read it many times per event-loop pass.
+ * Each front end's event loop calls tickcount_cache_refresh() once
+ * per iteration, just after its central wait returns, and those
+ * consumers read the cached value through GETTICKCOUNT_COARSE()
+ * instead; a tick count at most one loop iteration stale is fine for
+ * all of them. Arming a timer still uses GETTICKCOUNT directly, so
+ * expiry times don't inherit the staleness. Before the first refresh
+ * (or in tools with no event loop at all) the macro falls back to
+ * the real clock.
+ */
+extern unsigned long tickcount_cache;
+extern int tickcount_cache_valid;
+void tickcount_cache_refresh(void);
+#define GETTICKCOUNT_COARSE() \
+    (tickcount_cache_valid ? tickcount_cache : GETTICKCOUNT())
+
+/*
+ * Syscall audit counters, available in diagnostic builds made with
+ * -DSYSCALL_AUDIT (implementation in misc.c). The event-loop and
+ * network code count each system call they issue into one of a small
+ * set of categories, and once a second the totals are dumped to
+ * stderr alongside the number of data bytes moved, so that a change
+ * which quietly multiplies the syscall-per-byte ratio shows up in a
+ * side-by-side run rather than only in production strace output.
+ */
+#ifdef SYSCALL_AUDIT
+enum {
+    SCA_WAIT,			       /* select / epoll_wait */
+    SCA_TIME,			       /* gettimeofday / clock_gettime */
+    SCA_READ,			       /* read / recv */
+    SCA_WRITE,			       /* write / send */
+    SCA_NCATEGORIES
+};
+void syscall_audit_count(int category);
+void syscall_audit_data(int bytes);
+#endif
+
 /*
  * Exports from callback.c.
  *
@@ -1589,6 +1690,12 @@ unsigned long timing_last_clock(void);
  */
 typedef void (*toplevel_callback_fn_t)(void *ctx);
 void queue_toplevel_callback(toplevel_callback_fn_t fn, void *ctx);
+/*
+ * Variant of queue_toplevel_callback for bulk data-shovelling work:
+ * these callbacks run in batches, but only when no ordinary callback
+ * is waiting, so they can't delay latency-sensitive ones.
+ */
+void queue_bulk_callback(toplevel_callback_fn_t fn, void *ctx);
 void run_toplevel_callbacks(void);
 int toplevel_callback_pending(void);
 void delete_callbacks_for_context(void *ctx);
@@ -1597,6 +1704,25 @@ typedef void (*toplevel_callback_notify_fn_t)(void *frontend);
 void request_callback_notifications(toplevel_callback_notify_fn_t notify,
                                     void *frontend);
 
+/*
+ * CPU-offload functions, provided per-platform (uxoffload.c,
+ * winoffload.c). offload_run() arranges for work(ctx) to run on a
+ * worker thread, keeping the main event loop live meanwhile; when it
+ * finishes, done(ctx) is delivered back on the main thread via
+ * queue_toplevel_callback. Only one piece of offloaded work may be
+ * outstanding at a time. If the platform can't do this (or thread
+ * creation fails), offload_run falls back to doing the work
+ * synchronously before returning, so callers must cope with 'done'
+ * having been queued by the time it returns. offload_wait() blocks
+ * until any outstanding work function has finished running, for
+ * callers about to free data the work function might be using; the
+ * 'done' callback will still arrive in due course.
+ */
+typedef void (*offload_fn_t)(void *ctx);
+int offload_available(void);
+void offload_run(offload_fn_t work, toplevel_callback_fn_t done, void *ctx);
+void offload_wait(void);
+
 /*
  * Define no-op macros for the jump list functions, on platforms that
  * don't support them. (This is a bit of a hack, and it'd be nicer to
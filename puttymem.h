@@ -9,15 +9,39 @@
 #include <string.h>		       /* for memcpy() */
 
 
+/* #define MALLOC_ACCOUNTING  to keep live and high-water byte counts
+ * per allocating source file, dumpable at run time (see misc.c). Cheap
+ * enough to leave enabled in diagnostic fleet builds, unlike
+ * MALLOC_LOG which writes a line per allocation. */
+#ifdef MALLOC_ACCOUNTING
+#define smalloc(z) accmalloc(__FILE__,z,1)
+#define snmalloc(z,s) accmalloc(__FILE__,z,s)
+#define srealloc(y,z) accrealloc(__FILE__,y,z,1)
+#define snrealloc(y,z,s) accrealloc(__FILE__,y,z,s)
+#define sfree(z) accfree(z)
+void *accmalloc(const char *site, size_t, size_t);
+void *accrealloc(const char *site, void *, size_t, size_t);
+void accfree(void *);
+void malloc_account_report(void (*print)(void *ctx, const char *line),
+			   void *ctx);
+/*
+ * Platform hooks guarding the accounting site table, which is shared
+ * with the kex offload worker thread. Distinct from the secure pool's
+ * mutex: secure_pool_alloc calls smalloc while holding that one.
+ */
+void platform_malloc_acct_mutex_lock(void);
+void platform_malloc_acct_mutex_unlock(void);
+#endif
+
 /* #define MALLOC_LOG  do this if you suspect putty of leaking memory */
-#ifdef MALLOC_LOG
+#if defined(MALLOC_LOG) && !defined(MALLOC_ACCOUNTING)
 #define smalloc(z) (mlog(__FILE__,__LINE__), safemalloc(z,1))
 #define snmalloc(z,s) (mlog(__FILE__,__LINE__), safemalloc(z,s))
 #define srealloc(y,z) (mlog(__FILE__,__LINE__), saferealloc(y,z,1))
 #define snrealloc(y,z,s) (mlog(__FILE__,__LINE__), saferealloc(y,z,s))
 #define sfree(z) (mlog(__FILE__,__LINE__), safefree(z))
 void mlog(char *, int);
-#else
+#elif !defined(MALLOC_ACCOUNTING)
 #define smalloc(z) safemalloc(z,1)
 #define snmalloc safemalloc
 #define srealloc(y,z) saferealloc(y,z,1)
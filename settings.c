@@ -520,6 +520,9 @@ void save_open_settings(void *sesskey, Conf *conf)
     write_setting_i(sesskey, "LogFileClash", conf_get_int(conf, CONF_logxfovr));
     write_setting_i(sesskey, "LogFlush", conf_get_int(conf, CONF_logflush));
     write_setting_i(sesskey, "LogMkdir", conf_get_int(conf, CONF_logmkdir));
+    write_setting_i(sesskey, "LogRotateSizeMB", conf_get_int(conf, CONF_logrotate_size));
+    write_setting_i(sesskey, "LogRotateMinutes", conf_get_int(conf, CONF_logrotate_time));
+    write_setting_i(sesskey, "LogRotateCompress", conf_get_int(conf, CONF_logrotate_compress));
     write_setting_i(sesskey, "SSHLogOmitPasswords", conf_get_int(conf, CONF_logomitpass));
     write_setting_i(sesskey, "SSHLogOmitData", conf_get_int(conf, CONF_logomitdata));
     p = "raw";
@@ -562,6 +565,7 @@ void save_open_settings(void *sesskey, Conf *conf)
     write_setting_s(sesskey, "LocalUserName", conf_get_str(conf, CONF_localusername));
     write_setting_i(sesskey, "NoPTY", conf_get_int(conf, CONF_nopty));
     write_setting_i(sesskey, "Compression", conf_get_int(conf, CONF_compression));
+    write_setting_i(sesskey, "CompressionLevel", conf_get_int(conf, CONF_compressionlevel));
     write_setting_i(sesskey, "TryAgent", conf_get_int(conf, CONF_tryagent));
     write_setting_i(sesskey, "AgentFwd", conf_get_int(conf, CONF_agentfwd));
     write_setting_i(sesskey, "GssapiFwd", conf_get_int(conf, CONF_gssapifwd));
@@ -616,6 +620,7 @@ void save_open_settings(void *sesskey, Conf *conf)
     write_setting_i(sesskey, "TelnetKey", conf_get_int(conf, CONF_telnet_keyboard));
     write_setting_i(sesskey, "TelnetRet", conf_get_int(conf, CONF_telnet_newline));
     write_setting_i(sesskey, "LocalEcho", conf_get_int(conf, CONF_localecho));
+    write_setting_i(sesskey, "LocalEchoPredict", conf_get_int(conf, CONF_localecho_predict));
     write_setting_i(sesskey, "LocalEdit", conf_get_int(conf, CONF_localedit));
     write_setting_s(sesskey, "Answerback", conf_get_str(conf, CONF_answerback));
     write_setting_i(sesskey, "AlwaysOnTop", conf_get_int(conf, CONF_alwaysontop));
@@ -641,6 +646,7 @@ void save_open_settings(void *sesskey, Conf *conf)
 #endif
 		    );
     write_setting_i(sesskey, "ScrollbackLines", conf_get_int(conf, CONF_savelines));
+    write_setting_filename(sesskey, "ScrollbackSnapshotFile", conf_get_filename(conf, CONF_scrollback_snapshot));
     write_setting_i(sesskey, "DECOriginMode", conf_get_int(conf, CONF_dec_om));
     write_setting_i(sesskey, "AutoWrapMode", conf_get_int(conf, CONF_wrap_mode));
     write_setting_i(sesskey, "LFImpliesCR", conf_get_int(conf, CONF_lfhascr));
@@ -704,6 +710,7 @@ void save_open_settings(void *sesskey, Conf *conf)
     write_setting_i(sesskey, "ScrollBarFullScreen", conf_get_int(conf, CONF_scrollbar_in_fullscreen));
     write_setting_i(sesskey, "ScrollOnKey", conf_get_int(conf, CONF_scroll_on_key));
     write_setting_i(sesskey, "ScrollOnDisp", conf_get_int(conf, CONF_scroll_on_disp));
+    write_setting_i(sesskey, "RefreshRate", conf_get_int(conf, CONF_refresh_rate));
     write_setting_i(sesskey, "EraseToScrollback", conf_get_int(conf, CONF_erase_to_scrollback));
     write_setting_i(sesskey, "LockSize", conf_get_int(conf, CONF_resize_action));
     write_setting_i(sesskey, "BCE", conf_get_int(conf, CONF_bce));
@@ -791,6 +798,9 @@ void load_open_settings(void *sesskey, Conf *conf)
     gppi(sesskey, "LogFileClash", LGXF_ASK, conf, CONF_logxfovr);
     gppi(sesskey, "LogFlush", 1, conf, CONF_logflush);
     gppi(sesskey, "LogMkdir", 1, conf, CONF_logmkdir);
+    gppi(sesskey, "LogRotateSizeMB", 0, conf, CONF_logrotate_size);
+    gppi(sesskey, "LogRotateMinutes", 0, conf, CONF_logrotate_time);
+    gppi(sesskey, "LogRotateCompress", 0, conf, CONF_logrotate_compress);
     gppi(sesskey, "SSHLogOmitPasswords", 1, conf, CONF_logomitpass);
     gppi(sesskey, "SSHLogOmitData", 0, conf, CONF_logomitdata);
 
@@ -912,6 +922,7 @@ void load_open_settings(void *sesskey, Conf *conf)
     gpps(sesskey, "LocalUserName", "", conf, CONF_localusername);
     gppi(sesskey, "NoPTY", 0, conf, CONF_nopty);
     gppi(sesskey, "Compression", 0, conf, CONF_compression);
+    gppi(sesskey, "CompressionLevel", 6, conf, CONF_compressionlevel);
     gppi(sesskey, "TryAgent", 1, conf, CONF_tryagent);
     gppi(sesskey, "AgentFwd", 0, conf, CONF_agentfwd);
     gppi(sesskey, "ChangeUsername", 0, conf, CONF_change_username);
@@ -1025,6 +1036,7 @@ void load_open_settings(void *sesskey, Conf *conf)
     gppi(sesskey, "TelnetKey", 0, conf, CONF_telnet_keyboard);
     gppi(sesskey, "TelnetRet", 1, conf, CONF_telnet_newline);
     gppi(sesskey, "LocalEcho", AUTO, conf, CONF_localecho);
+    gppi(sesskey, "LocalEchoPredict", 0, conf, CONF_localecho_predict);
     gppi(sesskey, "LocalEdit", AUTO, conf, CONF_localedit);
     gpps(sesskey, "Answerback", "PuTTY", conf, CONF_answerback);
     gppi(sesskey, "AlwaysOnTop", 0, conf, CONF_alwaysontop);
@@ -1061,6 +1073,7 @@ void load_open_settings(void *sesskey, Conf *conf)
 #endif
 		 );
     gppi(sesskey, "ScrollbackLines", 2000, conf, CONF_savelines);
+    gppfile(sesskey, "ScrollbackSnapshotFile", conf, CONF_scrollback_snapshot);
     gppi(sesskey, "DECOriginMode", 0, conf, CONF_dec_om);
     gppi(sesskey, "AutoWrapMode", 1, conf, CONF_wrap_mode);
     gppi(sesskey, "LFImpliesCR", 0, conf, CONF_lfhascr);
@@ -1152,6 +1165,7 @@ void load_open_settings(void *sesskey, Conf *conf)
     gppi(sesskey, "ScrollBarFullScreen", 0, conf, CONF_scrollbar_in_fullscreen);
     gppi(sesskey, "ScrollOnKey", 0, conf, CONF_scroll_on_key);
     gppi(sesskey, "ScrollOnDisp", 1, conf, CONF_scroll_on_disp);
+    gppi(sesskey, "RefreshRate", 0, conf, CONF_refresh_rate);
     gppi(sesskey, "EraseToScrollback", 1, conf, CONF_erase_to_scrollback);
     gppi(sesskey, "LockSize", 0, conf, CONF_resize_action);
     gppi(sesskey, "BCE", 1, conf, CONF_bce);
@@ -8,6 +8,7 @@
 #include <assert.h>
 #include <limits.h>
 
+#include "putty.h"		       /* for GETTICKCOUNT */
 #include "misc.h"
 #include "int64.h"
 #include "tree234.h"
@@ -28,6 +29,32 @@ static void fxp_internal_error(const char *msg);
 /* ----------------------------------------------------------------------
  * SFTP packet construction functions.
  */
+
+/*
+ * Keep a short freelist of packet structures. A bulk transfer
+ * allocates and frees a packet per request, all of much the same
+ * size, so reusing the grown data buffers saves a steady stream of
+ * malloc and realloc traffic. Outsized buffers (bigger than any
+ * transfer packet we generate) are genuinely freed rather than
+ * hoarded.
+ */
+#define PKT_POOLSIZE 8
+#define PKT_POOLMAXLEN 66000
+
+static struct sftp_packet *pkt_pool[PKT_POOLSIZE];
+static int pkt_poolcount = 0;
+
+static struct sftp_packet *sftp_pkt_new(void)
+{
+    struct sftp_packet *pkt;
+    if (pkt_poolcount > 0)
+	return pkt_pool[--pkt_poolcount];
+    pkt = snew(struct sftp_packet);
+    pkt->data = NULL;
+    pkt->maxlen = 0;
+    return pkt;
+}
+
 static void sftp_pkt_ensure(struct sftp_packet *pkt, int length)
 {
     if ((int)pkt->maxlen < length) {
@@ -56,11 +83,9 @@ static void sftp_pkt_adduint32(struct sftp_packet *pkt,
 static struct sftp_packet *sftp_pkt_init(int pkt_type)
 {
     struct sftp_packet *pkt;
-    pkt = snew(struct sftp_packet);
-    pkt->data = NULL;
+    pkt = sftp_pkt_new();
     pkt->savedpos = -1;
     pkt->length = 0;
-    pkt->maxlen = 0;
     sftp_pkt_adduint32(pkt, 0); /* length field will be filled in later */
     sftp_pkt_addbyte(pkt, (unsigned char) pkt_type);
     return pkt;
@@ -206,6 +231,10 @@ static int sftp_pkt_getattrs(struct sftp_packet *pkt, struct fxp_attrs *ret)
 }
 static void sftp_pkt_free(struct sftp_packet *pkt)
 {
+    if (pkt_poolcount < PKT_POOLSIZE && pkt->maxlen <= PKT_POOLMAXLEN) {
+	pkt_pool[pkt_poolcount++] = pkt;
+	return;
+    }
     if (pkt->data)
 	sfree(pkt->data);
     sfree(pkt);
@@ -222,6 +251,25 @@ int sftp_send(struct sftp_packet *pkt)
     sftp_pkt_free(pkt);
     return ret;
 }
+
+/*
+ * Send a packet whose final field is a large block of caller-
+ * supplied data. The header and the data go to the channel as two
+ * consecutive writes, so the data need never be copied into the
+ * packet buffer at all; for a bulk upload that removes a memcpy of
+ * every byte transferred. The caller is responsible for having
+ * already added the data's framing (typically a string length) to
+ * the packet.
+ */
+static int sftp_send_trailing(struct sftp_packet *pkt,
+			      char *data, int len)
+{
+    int ret;
+    PUT_32BIT(pkt->data, pkt->length - 4 + len);
+    ret = sftp_senddata(pkt->data, pkt->length) && sftp_senddata(data, len);
+    sftp_pkt_free(pkt);
+    return ret;
+}
 struct sftp_packet *sftp_recv(void)
 {
     struct sftp_packet *pkt;
@@ -231,10 +279,13 @@ struct sftp_packet *sftp_recv(void)
     if (!sftp_recvdata(x, 4))
 	return NULL;
 
-    pkt = snew(struct sftp_packet);
+    pkt = sftp_pkt_new();
     pkt->savedpos = 0;
-    pkt->length = pkt->maxlen = GET_32BIT(x);
-    pkt->data = snewn(pkt->length, char);
+    pkt->length = GET_32BIT(x);
+    if (pkt->maxlen < pkt->length) {
+	pkt->maxlen = pkt->length;
+	pkt->data = sresize(pkt->data, pkt->maxlen, char);
+    }
 
     if (!sftp_recvdata(pkt->data, pkt->length)) {
 	sftp_pkt_free(pkt);
@@ -342,6 +393,12 @@ void sftp_cleanup_request(void)
 	freetree234(sftp_requests);
 	sftp_requests = NULL;
     }
+    while (pkt_poolcount > 0) {
+	struct sftp_packet *pkt = pkt_pool[--pkt_poolcount];
+	if (pkt->data)
+	    sfree(pkt->data);
+	sfree(pkt);
+    }
 }
 
 void sftp_register(struct sftp_request *req)
@@ -896,6 +953,89 @@ int fxp_fsetstat_recv(struct sftp_packet *pktin, struct sftp_request *req)
     return 1;
 }
 
+/*
+ * Ask the server for hashes of successive blocks of an open file,
+ * via the "check-file-handle" extension request. `hashlist' is a
+ * comma-separated list of hash algorithm names in our order of
+ * preference; the server picks the first one it knows and says so in
+ * the reply. Servers that don't implement the extension at all will
+ * send back a status of SSH_FX_OP_UNSUPPORTED (or just a generic
+ * failure), so callers must be ready to fall back.
+ */
+struct sftp_request *fxp_check_file_send(struct fxp_handle *handle,
+					 const char *hashlist,
+					 uint64 offset, uint64 length,
+					 int blocksize)
+{
+    struct sftp_request *req = sftp_alloc_request();
+    struct sftp_packet *pktout;
+
+    pktout = sftp_pkt_init(SSH_FXP_EXTENDED);
+    sftp_pkt_adduint32(pktout, req->id);
+    sftp_pkt_addstring(pktout, "check-file-handle");
+    sftp_pkt_addstring_start(pktout);
+    sftp_pkt_addstring_data(pktout, handle->hstring, handle->hlen);
+    sftp_pkt_addstring(pktout, hashlist);
+    sftp_pkt_adduint64(pktout, offset);
+    sftp_pkt_adduint64(pktout, length);
+    sftp_pkt_adduint32(pktout, blocksize);
+    sftp_send(pktout);
+
+    return req;
+}
+
+struct fxp_check_file *fxp_check_file_recv(struct sftp_packet *pktin,
+					   struct sftp_request *req)
+{
+    sfree(req);
+
+    if (pktin->type == SSH_FXP_EXTENDED_REPLY) {
+	struct fxp_check_file *cf;
+	char *algo;
+	int len, hashlen;
+
+	if (!sftp_pkt_getstring(pktin, &algo, &len)) {
+	    fxp_internal_error("malformed reply to check-file-handle\n");
+	    sftp_pkt_free(pktin);
+	    return NULL;
+	}
+	if (len == 3 && !memcmp(algo, "md5", 3))
+	    hashlen = 16;
+	else if (len == 4 && !memcmp(algo, "sha1", 4))
+	    hashlen = 20;
+	else if (len == 6 && !memcmp(algo, "sha256", 6))
+	    hashlen = 32;
+	else {
+	    fxp_internal_error("check-file-handle used an unknown hash\n");
+	    sftp_pkt_free(pktin);
+	    return NULL;
+	}
+	cf = snew(struct fxp_check_file);
+	cf->algorithm = mkstr(algo, len);
+	cf->hashlen = hashlen;
+	/*
+	 * The rest of the packet is simply the concatenated hashes.
+	 */
+	cf->nhashes = (pktin->length - pktin->savedpos) / hashlen;
+	cf->hashes = snewn(cf->nhashes * hashlen, unsigned char);
+	memcpy(cf->hashes, pktin->data + pktin->savedpos,
+	       cf->nhashes * hashlen);
+	sftp_pkt_free(pktin);
+	return cf;
+    } else {
+	fxp_got_status(pktin);
+	sftp_pkt_free(pktin);
+	return NULL;
+    }
+}
+
+void fxp_free_check_file(struct fxp_check_file *cf)
+{
+    sfree(cf->algorithm);
+    sfree(cf->hashes);
+    sfree(cf);
+}
+
 /*
  * Read from a file. Returns the number of bytes read, or -1 on an
  * error, or possibly 0 if EOF. (I'm not entirely sure whether it
@@ -1045,9 +1185,8 @@ struct sftp_request *fxp_write_send(struct fxp_handle *handle,
     sftp_pkt_addstring_start(pktout);
     sftp_pkt_addstring_data(pktout, handle->hstring, handle->hlen);
     sftp_pkt_adduint64(pktout, offset);
-    sftp_pkt_addstring_start(pktout);
-    sftp_pkt_addstring_data(pktout, buffer, len);
-    sftp_send(pktout);
+    sftp_pkt_adduint32(pktout, len);
+    sftp_send_trailing(pktout, buffer, len);
 
     return req;
 }
@@ -1120,12 +1259,35 @@ struct req {
     char *buffer;
     int len, retlen, complete;
     uint64 offset;
+    unsigned long tickat;
     struct req *next, *prev;
 };
 
+/*
+ * Each download read request asks for this many bytes. We don't
+ * adapt this value: many servers will return less data than we
+ * asked for if we exceed their preferred read size, and the short-
+ * read logic in xfer_download_gotpkt would misinterpret that as a
+ * sign of EOF. Instead we adapt the _number_ of requests in flight.
+ */
+#define XFER_BLOCKSIZE 32768
+
+/*
+ * Initial and maximum limits on the total data covered by
+ * outstanding requests. The initial value is enough to keep a
+ * moderate-latency link busy; xfer_download_gotpkt grows the limit
+ * towards the maximum while the round-trip measurements suggest the
+ * pipeline, rather than the network or the SSH channel window, is
+ * the bottleneck.
+ */
+#define XFER_WINDOW_INIT 1048576
+#define XFER_WINDOW_MAX (16*1048576)
+
 struct fxp_xfer {
     uint64 offset, furthestdata, filesize;
     int req_totalsize, req_maxsize, eof, err;
+    unsigned long minrtt;
+    int minrtt_valid;
     struct fxp_handle *fh;
     struct req *head, *tail;
 };
@@ -1138,7 +1300,9 @@ static struct fxp_xfer *xfer_init(struct fxp_handle *fh, uint64 offset)
     xfer->offset = offset;
     xfer->head = xfer->tail = NULL;
     xfer->req_totalsize = 0;
-    xfer->req_maxsize = 1048576;
+    xfer->req_maxsize = XFER_WINDOW_INIT;
+    xfer->minrtt = 0;
+    xfer->minrtt_valid = FALSE;
     xfer->err = 0;
     xfer->filesize = uint64_make(ULONG_MAX, ULONG_MAX);
     xfer->furthestdata = uint64_make(0, 0);
@@ -1178,8 +1342,9 @@ void xfer_download_queue(struct fxp_xfer *xfer)
 	xfer->tail = rr;
 	rr->next = NULL;
 
-	rr->len = 32768;
+	rr->len = XFER_BLOCKSIZE;
 	rr->buffer = snewn(rr->len, char);
+	rr->tickat = GETTICKCOUNT();
 	sftp_register(req = fxp_read_send(xfer->fh, rr->offset, rr->len));
 	fxp_set_userdata(req, rr);
 
@@ -1240,6 +1405,33 @@ int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 
     rr->complete = 1;
 
+    /*
+     * Adapt the pipeline depth. If this request spent no longer in
+     * flight than the best round trip we've seen, the network can't
+     * have held it up, so the depth of the request pipeline is
+     * what's limiting throughput: permit one more request's worth
+     * of data in flight. (N outstanding requests means N qualifying
+     * replies per round trip, so an under-sized window doubles once
+     * per round trip. Once the pipeline covers the bandwidth-delay
+     * product, or the SSH channel window runs out, replies start
+     * queueing and the measured round trips rise, which shuts off
+     * further growth.)
+     */
+    if (rr->retlen > 0) {
+	unsigned long rtt = GETTICKCOUNT() - rr->tickat;
+	if (!xfer->minrtt_valid || rtt < xfer->minrtt) {
+	    xfer->minrtt = rtt;
+	    xfer->minrtt_valid = TRUE;
+	}
+	if (rtt <= xfer->minrtt + xfer->minrtt / 4 &&
+	    xfer->req_maxsize < XFER_WINDOW_MAX)
+	    xfer->req_maxsize += XFER_BLOCKSIZE;
+#ifdef DEBUG_DOWNLOAD
+	printf("rtt %lu (min %lu), window now %d\n",
+	       rtt, xfer->minrtt, xfer->req_maxsize);
+#endif
+    }
+
     /*
      * Special case: if we have received fewer bytes than we
      * actually read, we should do something. For the moment I'll
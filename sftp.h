@@ -199,6 +199,26 @@ struct sftp_request *fxp_fsetstat_send(struct fxp_handle *handle,
 				       struct fxp_attrs attrs);
 int fxp_fsetstat_recv(struct sftp_packet *pktin, struct sftp_request *req);
 
+/*
+ * Ask the server for hashes of successive blocks of an open file,
+ * via the "check-file-handle" extension request. Not all servers
+ * support it: expect an error (typically SSH_FX_OP_UNSUPPORTED) from
+ * ones that don't, and be prepared to fall back.
+ */
+struct fxp_check_file {
+    char *algorithm;		       /* hash algorithm the server chose */
+    int hashlen;		       /* bytes per hash */
+    int nhashes;
+    unsigned char *hashes;	       /* nhashes * hashlen bytes */
+};
+struct sftp_request *fxp_check_file_send(struct fxp_handle *handle,
+					 const char *hashlist,
+					 uint64 offset, uint64 length,
+					 int blocksize);
+struct fxp_check_file *fxp_check_file_recv(struct sftp_packet *pktin,
+					   struct sftp_request *req);
+void fxp_free_check_file(struct fxp_check_file *cf);
+
 /*
  * Read from a file.
  */
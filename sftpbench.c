@@ -0,0 +1,476 @@
+/*
+ * sftpbench.c: standalone benchmark harness for the transfer engine
+ * in sftp.c.
+ *
+ * Links against the real sftp.c, but provides sftp_senddata and
+ * sftp_recvdata itself, backed by a fake in-process SFTP server
+ * sitting behind a simple network model (configurable round-trip
+ * latency and link bandwidth, tracked on a virtual clock). This lets
+ * us measure what the xfer_download / xfer_upload pipeline would
+ * achieve on a given link, without any real server or network in the
+ * way: if a change to the windowing logic stops the pipeline keeping
+ * the link full, the goodput figure printed here drops.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "putty.h"
+#include "misc.h"
+#include "int64.h"
+#include "sftp.h"
+
+void modalfatalbox(const char *p, ...)
+{
+    va_list ap;
+    fprintf(stderr, "FATAL ERROR: ");
+    va_start(ap, p);
+    vfprintf(stderr, p, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+/* For Unix in particular, but harmless if this main() is reused elsewhere */
+const int buildinfo_gtk_relevant = FALSE;
+
+/* ----------------------------------------------------------------------
+ * Network model. All times are in virtual milliseconds; the clock
+ * only advances when the client blocks in sftp_recvdata. Each
+ * direction of the link is a serial pipe of the given bandwidth, and
+ * each packet spends half the round-trip latency in flight after its
+ * last byte has been transmitted.
+ */
+
+static double latency_ms = 100.0;      /* round trip */
+static double bw_bytes_per_ms = 12500.0;       /* 100 Mbit/s */
+static unsigned long filesize = 64UL * 1024 * 1024;
+
+static double now_ms, up_busy_ms, down_busy_ms;
+
+/* Statistics. */
+static int inflight, max_inflight;
+static double inflight_integral, last_sample_ms;
+static unsigned long payload_bytes;
+
+static void sample_inflight(double t)
+{
+    if (t > last_sample_ms) {
+	inflight_integral += inflight * (t - last_sample_ms);
+	last_sample_ms = t;
+    }
+}
+
+static void stats_reset(void)
+{
+    now_ms = up_busy_ms = down_busy_ms = 0;
+    inflight = max_inflight = 0;
+    inflight_integral = last_sample_ms = 0;
+    payload_bytes = 0;
+}
+
+/* ----------------------------------------------------------------------
+ * The fake server. Requests arrive via sftp_senddata; replies are
+ * queued with a delivery time computed from the network model, and
+ * handed back in order by sftp_recvdata.
+ */
+
+struct benchreply {
+    struct benchreply *next;
+    double due;			       /* when its last byte reaches us */
+    int len, pos;
+    int counted;		       /* reply to a READ or WRITE? */
+    unsigned char *data;
+};
+
+static struct benchreply *replyhead = NULL, *replytail = NULL;
+
+static void enqueue_reply(unsigned char *data, int len,
+			  double reqdone, int counted)
+{
+    struct benchreply *br = snew(struct benchreply);
+    double start;
+
+    /*
+     * The request's last byte reaches the server at reqdone plus
+     * half the round trip; the reply then queues for the downlink.
+     */
+    start = reqdone + latency_ms / 2;
+    if (start < down_busy_ms)
+	start = down_busy_ms;
+    down_busy_ms = start + len / bw_bytes_per_ms;
+
+    br->next = NULL;
+    br->due = down_busy_ms + latency_ms / 2;
+    br->len = len;
+    br->pos = 0;
+    br->counted = counted;
+    br->data = data;
+    if (replytail)
+	replytail->next = br;
+    else
+	replyhead = br;
+    replytail = br;
+}
+
+static unsigned char *reply_start(int type, unsigned long reqid, int bodylen,
+				  int *totallen)
+{
+    unsigned char *p;
+
+    *totallen = 4 + 1 + 4 + bodylen;
+    p = snewn(*totallen, unsigned char);
+    PUT_32BIT(p, *totallen - 4);
+    p[4] = type;
+    PUT_32BIT(p + 5, reqid);
+    return p;
+}
+
+static void reply_status(unsigned long reqid, int code,
+			 double reqdone, int counted)
+{
+    unsigned char *p;
+    int len;
+
+    p = reply_start(SSH_FXP_STATUS, reqid, 12, &len);
+    PUT_32BIT(p + 9, code);
+    PUT_32BIT(p + 13, 0);	       /* empty message */
+    PUT_32BIT(p + 17, 0);	       /* empty language tag */
+    enqueue_reply(p, len, reqdone, counted);
+}
+
+static void handle_request(unsigned char *p, int plen, double reqdone)
+{
+    int type = p[4];
+    unsigned long reqid = 0;
+    unsigned char *body = p + 5;
+
+    if (type != SSH_FXP_INIT) {
+	reqid = GET_32BIT(body);
+	body += 4;
+    }
+
+    switch (type) {
+      case SSH_FXP_INIT: {
+	unsigned char *r;
+	int len;
+	/* VERSION has no request id; the version field sits where
+	 * the id would. */
+	r = reply_start(SSH_FXP_VERSION, 3, 0, &len);
+	enqueue_reply(r, len, reqdone, FALSE);
+	break;
+      }
+      case SSH_FXP_OPEN: {
+	unsigned char *r;
+	int len;
+	r = reply_start(SSH_FXP_HANDLE, reqid, 5, &len);
+	PUT_32BIT(r + 9, 1);
+	r[13] = 'h';
+	enqueue_reply(r, len, reqdone, FALSE);
+	break;
+      }
+      case SSH_FXP_READ: {
+	unsigned long hlen, offhi, offlo, rlen, avail;
+	hlen = GET_32BIT(body);
+	offhi = GET_32BIT(body + 4 + hlen);
+	offlo = GET_32BIT(body + 8 + hlen);
+	rlen = GET_32BIT(body + 12 + hlen);
+	sample_inflight(now_ms);
+	if (++inflight > max_inflight)
+	    max_inflight = inflight;
+	if (offhi != 0 || offlo >= filesize) {
+	    reply_status(reqid, SSH_FX_EOF, reqdone, TRUE);
+	} else {
+	    unsigned char *r;
+	    int len;
+	    avail = filesize - offlo;
+	    if (avail > rlen)
+		avail = rlen;
+	    r = reply_start(SSH_FXP_DATA, reqid, 4 + avail, &len);
+	    PUT_32BIT(r + 9, avail);
+	    memset(r + 13, 0, avail);
+	    enqueue_reply(r, len, reqdone, TRUE);
+	}
+	break;
+      }
+      case SSH_FXP_WRITE: {
+	unsigned long hlen, dlen;
+	hlen = GET_32BIT(body);
+	dlen = GET_32BIT(body + 12 + hlen);
+	sample_inflight(now_ms);
+	if (++inflight > max_inflight)
+	    max_inflight = inflight;
+	payload_bytes += dlen;
+	reply_status(reqid, SSH_FX_OK, reqdone, TRUE);
+	break;
+      }
+      case SSH_FXP_CLOSE:
+	reply_status(reqid, SSH_FX_OK, reqdone, FALSE);
+	break;
+      default:
+	reply_status(reqid, SSH_FX_OP_UNSUPPORTED, reqdone, FALSE);
+	break;
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * The transport interface sftp.c expects.
+ */
+
+static unsigned char *reqbuf = NULL;
+static int reqbuflen = 0, reqbufsize = 0;
+
+int sftp_senddata(char *buf, int len)
+{
+    double reqdone;
+    unsigned long plen;
+
+    if (reqbuflen + len > reqbufsize) {
+	reqbufsize = (reqbuflen + len) * 5 / 4 + 1024;
+	reqbuf = sresize(reqbuf, reqbufsize, unsigned char);
+    }
+    memcpy(reqbuf + reqbuflen, buf, len);
+    reqbuflen += len;
+
+    /*
+     * Charge the uplink for these bytes; requests complete
+     * transmission back to back.
+     */
+    if (up_busy_ms < now_ms)
+	up_busy_ms = now_ms;
+    up_busy_ms += len / bw_bytes_per_ms;
+    reqdone = up_busy_ms;
+
+    while (reqbuflen >= 4 &&
+	   reqbuflen >= 4 + (int)(plen = GET_32BIT(reqbuf))) {
+	handle_request(reqbuf, plen + 4, reqdone);
+	memmove(reqbuf, reqbuf + plen + 4, reqbuflen - (plen + 4));
+	reqbuflen -= plen + 4;
+    }
+
+    return 1;
+}
+
+int sftp_sendbuffer(void)
+{
+    return 0;			       /* sends complete instantly */
+}
+
+int sftp_recvdata(char *buf, int len)
+{
+    while (len > 0) {
+	struct benchreply *br = replyhead;
+	int got;
+
+	if (!br)
+	    return 0;		       /* protocol stall: no reply due */
+
+	if (br->pos == 0 && now_ms < br->due) {
+	    sample_inflight(br->due);
+	    now_ms = br->due;
+	    if (br->counted)
+		inflight--;
+	}
+
+	got = br->len - br->pos;
+	if (got > len)
+	    got = len;
+	memcpy(buf, br->data + br->pos, got);
+	br->pos += got;
+	buf += got;
+	len -= got;
+
+	if (br->pos == br->len) {
+	    replyhead = br->next;
+	    if (!replyhead)
+		replytail = NULL;
+	    sfree(br->data);
+	    sfree(br);
+	}
+    }
+    return 1;
+}
+
+/* ----------------------------------------------------------------------
+ * The benchmarks themselves: drive the same loops psftp.c uses.
+ */
+
+static struct sftp_packet *sftp_wait_for_reply(struct sftp_request *req)
+{
+    struct sftp_packet *pktin;
+    struct sftp_request *rreq;
+
+    sftp_register(req);
+    pktin = sftp_recv();
+    if (pktin == NULL)
+	modalfatalbox("did not receive SFTP response packet from server");
+    rreq = sftp_find_request(pktin);
+    if (rreq != req)
+	modalfatalbox("unable to understand SFTP response packet "
+		      "from server: %s", fxp_error());
+    return pktin;
+}
+
+static struct fxp_handle *bench_open(int flags)
+{
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    struct fxp_handle *fh;
+
+    if (!fxp_init()) {
+	fprintf(stderr, "fxp_init: %s\n", fxp_error());
+	exit(1);
+    }
+    req = fxp_open_send("benchfile", flags, NULL);
+    pktin = sftp_wait_for_reply(req);
+    fh = fxp_open_recv(pktin, req);
+    if (!fh) {
+	fprintf(stderr, "open: %s\n", fxp_error());
+	exit(1);
+    }
+    return fh;
+}
+
+static void bench_close(struct fxp_handle *fh)
+{
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+
+    req = fxp_close_send(fh);
+    pktin = sftp_wait_for_reply(req);
+    fxp_close_recv(pktin, req);
+}
+
+static void bench_report(const char *what, unsigned long bytes)
+{
+    double secs = now_ms / 1000.0;
+
+    printf("%s: %lu bytes in %.2f virtual seconds, %.2f Mbit/s goodput\n",
+	   what, bytes, secs, bytes * 8.0 / (now_ms * 1000.0));
+    printf("%*s  max %d requests in flight, time-weighted mean %.1f\n",
+	   (int)strlen(what), "", max_inflight,
+	   now_ms > 0 ? inflight_integral / now_ms : 0.0);
+}
+
+static void bench_download(void)
+{
+    struct fxp_handle *fh;
+    struct fxp_xfer *xfer;
+    struct sftp_packet *pktin;
+    unsigned long received = 0;
+    int ret;
+
+    stats_reset();
+    fh = bench_open(SSH_FXF_READ);
+
+    xfer = xfer_download_init(fh, uint64_make(0, 0));
+    while (!xfer_done(xfer)) {
+	void *vbuf;
+	int len;
+
+	xfer_download_queue(xfer);
+	pktin = sftp_recv();
+	ret = xfer_download_gotpkt(xfer, pktin);
+	if (ret <= 0) {
+	    fprintf(stderr, "download: %s\n", fxp_error());
+	    if (ret == INT_MIN)
+		sfree(pktin);
+	    exit(1);
+	}
+	while (xfer_download_data(xfer, &vbuf, &len)) {
+	    received += len;
+	    sfree(vbuf);
+	}
+    }
+    xfer_cleanup(xfer);
+    bench_close(fh);
+
+    bench_report("download", received);
+}
+
+static void bench_upload(void)
+{
+    struct fxp_handle *fh;
+    struct fxp_xfer *xfer;
+    struct sftp_packet *pktin;
+    unsigned long remaining = filesize;
+    static char buffer[32768];
+    int ret, eof = 0;
+
+    stats_reset();
+    fh = bench_open(SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC);
+
+    xfer = xfer_upload_init(fh, uint64_make(0, 0));
+    while (!eof || !xfer_done(xfer)) {
+	int len;
+
+	while (xfer_upload_ready(xfer) && !eof) {
+	    len = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+	    if (len == 0) {
+		eof = 1;
+	    } else {
+		xfer_upload_data(xfer, buffer, len);
+		remaining -= len;
+	    }
+	}
+
+	if (!xfer_done(xfer)) {
+	    pktin = sftp_recv();
+	    ret = xfer_upload_gotpkt(xfer, pktin);
+	    if (ret <= 0) {
+		fprintf(stderr, "upload: %s\n", fxp_error());
+		if (ret == INT_MIN)
+		    sfree(pktin);
+		exit(1);
+	    }
+	}
+    }
+    xfer_cleanup(xfer);
+    bench_close(fh);
+
+    bench_report("upload", payload_bytes);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+	    "usage: sftpbench [ -l latency-ms ] [ -b bandwidth-Mbit/s ]\n"
+	    "                 [ -s size-MB ] [ -d | -u ]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int do_download = TRUE, do_upload = TRUE;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "-l") && i + 1 < argc)
+	    latency_ms = atof(argv[++i]);
+	else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+	    bw_bytes_per_ms = atof(argv[++i]) * 125.0;
+	else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+	    filesize = strtoul(argv[++i], NULL, 0) * 1024 * 1024;
+	else if (!strcmp(argv[i], "-d"))
+	    do_upload = FALSE;
+	else if (!strcmp(argv[i], "-u"))
+	    do_download = FALSE;
+	else
+	    usage();
+    }
+    if (latency_ms < 0 || bw_bytes_per_ms <= 0 || filesize == 0)
+	usage();
+
+    printf("link: %.0f ms RTT, %.0f Mbit/s, file size %lu bytes\n",
+	   latency_ms, bw_bytes_per_ms / 125.0, filesize);
+
+    if (do_download)
+	bench_download();
+    if (do_upload)
+	bench_upload();
+
+    return 0;
+}
@@ -8,6 +8,8 @@
 #include <assert.h>
 #include <limits.h>
 #include <signal.h>
+#include <ctype.h>
+#include <time.h>
 
 #include "putty.h"
 #include "pageant.h" /* for AGENT_MAX_MSGLEN */
@@ -367,6 +369,7 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
 			     struct Packet *pktin);
 static void ssh_channel_init(struct ssh_channel *c);
 static struct ssh_channel *ssh_channel_msg(Ssh ssh, struct Packet *pktin);
+static void ssh_channel_uncache(struct ssh_channel *c);
 static void ssh_channel_got_eof(struct ssh_channel *c);
 static void ssh2_channel_check_close(struct ssh_channel *c);
 static void ssh_channel_close_local(struct ssh_channel *c, char const *reason);
@@ -435,6 +438,10 @@ const static struct ssh_mac *const buggymacs[] = {
     &ssh_hmac_sha1_buggy, &ssh_hmac_sha1_96_buggy, &ssh_hmac_md5
 };
 
+static void *ssh_comp_none_compress_init(int level)
+{
+    return NULL;
+}
 static void *ssh_comp_none_init(void)
 {
     return NULL;
@@ -453,7 +460,7 @@ static int ssh_comp_none_disable(void *handle)
 }
 const static struct ssh_compress ssh_comp_none = {
     "none", NULL,
-    ssh_comp_none_init, ssh_comp_none_cleanup, ssh_comp_none_block,
+    ssh_comp_none_compress_init, ssh_comp_none_cleanup, ssh_comp_none_block,
     ssh_comp_none_init, ssh_comp_none_cleanup, ssh_comp_none_block,
     ssh_comp_none_disable, NULL
 };
@@ -570,12 +577,27 @@ struct ssh_channel {
 	     */
 	    struct outstanding_channel_request *chanreq_head, *chanreq_tail;
 	    enum { THROTTLED, UNTHROTTLING, UNTHROTTLED } throttle_state;
+	    /*
+	     * Set when outgoing data has been added to outbuffer but
+	     * the flush is deferred to a toplevel callback, so that
+	     * a burst of small writes coalesces into fewer packets.
+	     */
+	    int defer_send;
 	} v2;
     } v;
     union {
 	struct ssh_agent_channel {
             bufchain inbuffer;
-            agent_pending_query *pending;
+            /*
+             * FIFO of requests currently in flight to the real agent,
+             * oldest first. Responses are sent on strictly in request
+             * order, from the head of the queue, so later requests
+             * whose replies arrive first wait their turn.
+             */
+            struct agentf_request *req_head, *req_tail;
+            int num_outstanding;
+            int rejected;	       /* overlong request seen: close the
+                                        * connection once the queue drains */
 	} a;
 	struct ssh_x11_channel {
 	    struct X11Connection *xconn;
@@ -711,10 +733,14 @@ static void ssh2_protocol_setup(Ssh ssh);
 static void ssh2_bare_connection_protocol_setup(Ssh ssh);
 static void ssh_size(void *handle, int width, int height);
 static void ssh_special(void *handle, Telnet_Special);
-static int ssh2_try_send(struct ssh_channel *c);
+static int ssh2_try_send(struct ssh_channel *c, int limit);
+static struct Packet *ssh2_mkpkt_channel_data(struct ssh_channel *c,
+					      const void *data, int len);
 static int ssh_send_channel_data(struct ssh_channel *c,
 				 const char *buf, int len);
+static void ssh2_flush_deferred_chandata(void *ctx);
 static void ssh_throttle_all(Ssh ssh, int enable, int bufsize);
+static void ssh_log_setup_phase(Ssh ssh, const char *phase);
 static void ssh2_set_window(struct ssh_channel *c, int newwin);
 static int ssh_sendbuffer(void *handle);
 static int ssh_do_close(Ssh ssh, int notify_exit);
@@ -736,8 +762,10 @@ struct rdpkt1_state_tag {
 };
 
 struct rdpkt2_state_tag {
-    long len, pad, payload, packetlen, maclen;
+    long len, pad, payload, packetlen, maclen, to_read;
+    unsigned char *p;
     int i;
+    int chunk;
     int cipherblk;
     unsigned long incoming_sequence;
     struct Packet *pktin;
@@ -745,8 +773,10 @@ struct rdpkt2_state_tag {
 
 struct rdpkt2_bare_state_tag {
     char length[4];
-    long packetlen;
+    long packetlen, to_read;
+    unsigned char *p;
     int i;
+    int chunk;
     unsigned long incoming_sequence;
     struct Packet *pktin;
 };
@@ -765,6 +795,7 @@ struct ssh_tag {
 
     char *v_c, *v_s;
     void *exhash;
+    ssh_hash_ctx exhash_ctx;	       /* storage pointed to by exhash */
 
     Socket s;
 
@@ -811,6 +842,10 @@ struct ssh_tag {
     int term_width, term_height;
 
     tree234 *channels;		       /* indexed by local id */
+    struct ssh_channel *channel_cache; /* last channel found by
+					* ssh_channel_msg, since bulk
+					* transfers hit the same one
+					* thousands of times in a row */
     struct ssh_channel *mainchan;      /* primary session channel */
     int ncmode;			       /* is primary channel direct-tcpip? */
     int exitcode;
@@ -955,6 +990,46 @@ struct ssh_tag {
     unsigned long next_rekey, last_rekey;
     const char *deferred_rekey_reason;
 
+    /*
+     * Cumulative session statistics, dumped to the Event Log by the
+     * TS_STATS special. Unlike incoming_data_size and friends, these
+     * are never reset while the session lasts.
+     */
+    unsigned long stat_bytes_in, stat_bytes_out;
+    unsigned long stat_pkts_in, stat_pkts_out;
+    unsigned long stat_winstalls;      /* sends stalled on a full channel window */
+    unsigned long stat_kexes;	       /* completed key exchanges */
+    clock_t stat_rdpkt_clocks;	       /* CPU time reading and decrypting packets */
+    clock_t stat_dispatch_clocks;      /* CPU time dispatching them */
+
+    /*
+     * Base timestamp for the session-setup phase log messages, and a
+     * flag so that only the initial key exchange (not later rekeys)
+     * produces one.
+     */
+    unsigned long session_start;
+    int setup_kex_logged;
+
+    /*
+     * Diffie-Hellman keypair precomputed shortly before a timed
+     * rekey falls due, so that the modular exponentiation is already
+     * done when the key exchange starts.
+     */
+    void *precomp_kex_ctx;
+    Bignum precomp_kex_e;
+    const struct ssh_kex *precomp_kex_alg;
+    int precomp_kex_nbits;
+    struct ssh2_kex_offload *kex_offload; /* in-flight offloaded kex step */
+    int kex_nbits;		       /* nbits used in the last kex */
+    unsigned long next_kex_precomp;
+
+    /* A toplevel callback to flush deferred channel data is queued. */
+    int chandata_flush_scheduled;
+    /* Rotation point for the round-robin over channels with
+     * deferred data, so the same channel isn't served first every
+     * time. */
+    int chandata_rr_start;
+
     /*
      * Fully qualified host name, which we need if doing GSSAPI.
      */
@@ -1226,17 +1301,62 @@ static void c_write_str(Ssh ssh, const char *buf)
     c_write(ssh, buf, strlen(buf));
 }
 
+/*
+ * Keep a small pool of packet structures, so that the usual rapid
+ * cycle of allocating a packet, processing it and freeing it again
+ * doesn't go through the allocator every time. Buffers above a size
+ * threshold are not kept, so a single outsized packet can't pin down
+ * a lot of memory for ever. (PuTTY is single-threaded, so a static
+ * pool is safe here.)
+ */
+#define PKT_POOL_SIZE 16
+#define PKT_POOL_MAXDATA 16384
+
+/*
+ * Round a packet buffer size up to a power of two, so that recycled
+ * buffers converge on a few standard sizes instead of being
+ * reallocated for every slightly different packet length.
+ */
+static long ssh_pkt_bufsize(long size)
+{
+    long bufsize = 256;
+    while (bufsize < size && bufsize < (long)OUR_V2_PACKETLIMIT)
+	bufsize <<= 1;
+    if (bufsize < size)
+	bufsize = size;
+    return bufsize;
+}
+
+static struct Packet *pkt_pool[PKT_POOL_SIZE];
+static int pkt_pool_len = 0;
+
 static void ssh_free_packet(struct Packet *pkt)
 {
-    sfree(pkt->data);
+    if (pkt_pool_len < PKT_POOL_SIZE) {
+	if (pkt->maxlen > PKT_POOL_MAXDATA) {
+	    secure_pool_free(pkt->data);
+	    pkt->data = NULL;
+	    pkt->maxlen = 0;
+	}
+	pkt_pool[pkt_pool_len++] = pkt;
+	return;
+    }
+    secure_pool_free(pkt->data);
     sfree(pkt);
 }
 static struct Packet *ssh_new_packet(void)
 {
-    struct Packet *pkt = snew(struct Packet);
+    struct Packet *pkt;
+
+    if (pkt_pool_len > 0) {
+	pkt = pkt_pool[--pkt_pool_len];
+    } else {
+	pkt = snew(struct Packet);
+	pkt->data = NULL;
+	pkt->maxlen = 0;
+    }
 
-    pkt->body = pkt->data = NULL;
-    pkt->maxlen = 0;
+    pkt->body = NULL;
 
     return pkt;
 }
@@ -1386,8 +1506,11 @@ static struct Packet *ssh1_rdpkt(Ssh ssh, const unsigned char **data,
         crStop(NULL);
     }
 
-    st->pktin->maxlen = st->biglen;
-    st->pktin->data = snewn(st->biglen + APIEXTRA, unsigned char);
+    if (st->pktin->maxlen < st->biglen) {
+	st->pktin->maxlen = ssh_pkt_bufsize(st->biglen);
+	st->pktin->data = secure_pool_realloc(st->pktin->data,
+					      st->pktin->maxlen + APIEXTRA);
+    }
 
     st->to_read = st->biglen;
     st->p = st->pktin->data;
@@ -1436,10 +1559,9 @@ static struct Packet *ssh1_rdpkt(Ssh ssh, const unsigned char **data,
 	}
 
 	if (st->pktin->maxlen < st->pad + decomplen) {
-	    st->pktin->maxlen = st->pad + decomplen;
-	    st->pktin->data = sresize(st->pktin->data,
-				      st->pktin->maxlen + APIEXTRA,
-				      unsigned char);
+	    st->pktin->maxlen = ssh_pkt_bufsize(st->pad + decomplen);
+	    st->pktin->data = secure_pool_realloc(st->pktin->data,
+					      st->pktin->maxlen + APIEXTRA);
 	    st->pktin->body = st->pktin->data + st->pad + 1;
 	}
 
@@ -1652,8 +1774,11 @@ static struct Packet *ssh2_rdpkt(Ssh ssh, const unsigned char **data,
 	 */
 
 	/* May as well allocate the whole lot now. */
-	st->pktin->data = snewn(OUR_V2_PACKETLIMIT + st->maclen + APIEXTRA,
-				unsigned char);
+	if (st->pktin->maxlen < OUR_V2_PACKETLIMIT + st->maclen) {
+	    st->pktin->maxlen = OUR_V2_PACKETLIMIT + st->maclen;
+	    st->pktin->data = secure_pool_realloc(st->pktin->data,
+					      st->pktin->maxlen + APIEXTRA);
+	}
 
 	/* Read an amount corresponding to the MAC. */
 	for (st->i = 0; st->i < st->maclen; st->i++) {
@@ -1700,11 +1825,14 @@ static struct Packet *ssh2_rdpkt(Ssh ssh, const unsigned char **data,
 	    }	    
 	}
 	st->pktin->maxlen = st->packetlen + st->maclen;
-	st->pktin->data = sresize(st->pktin->data,
-				  st->pktin->maxlen + APIEXTRA,
-				  unsigned char);
+	st->pktin->data = secure_pool_realloc(st->pktin->data,
+					      st->pktin->maxlen + APIEXTRA);
     } else if (ssh->scmac && ssh->scmac_etm) {
-	st->pktin->data = snewn(4 + APIEXTRA, unsigned char);
+	if (st->pktin->maxlen < 4) {
+	    st->pktin->maxlen = ssh_pkt_bufsize(4);
+	    st->pktin->data = secure_pool_realloc(st->pktin->data,
+					      st->pktin->maxlen + APIEXTRA);
+	}
 
         /*
          * OpenSSH encrypt-then-MAC mode: the packet length is
@@ -1746,19 +1874,29 @@ static struct Packet *ssh2_rdpkt(Ssh ssh, const unsigned char **data,
 	/*
 	 * Allocate memory for the rest of the packet.
 	 */
-	st->pktin->maxlen = st->packetlen + st->maclen;
-	st->pktin->data = sresize(st->pktin->data,
-				  st->pktin->maxlen + APIEXTRA,
-				  unsigned char);
+	if (st->pktin->maxlen < st->packetlen + st->maclen) {
+	    st->pktin->maxlen = ssh_pkt_bufsize(st->packetlen + st->maclen);
+	    st->pktin->data = secure_pool_realloc(st->pktin->data,
+					      st->pktin->maxlen + APIEXTRA);
+	}
 
 	/*
-	 * Read the remainder of the packet.
+	 * Read the remainder of the packet, in the largest chunks the
+	 * incoming buffer will let us take it in.
 	 */
-	for (st->i = 4; st->i < st->packetlen + st->maclen; st->i++) {
+	st->to_read = st->packetlen + st->maclen - 4;
+	st->p = st->pktin->data + 4;
+	while (st->to_read > 0) {
+	    st->chunk = st->to_read;
 	    while ((*datalen) == 0)
 		crReturn(NULL);
-	    st->pktin->data[st->i] = *(*data)++;
-	    (*datalen)--;
+	    if (st->chunk > (*datalen))
+		st->chunk = (*datalen);
+	    memcpy(st->p, *data, st->chunk);
+	    *data += st->chunk;
+	    *datalen -= st->chunk;
+	    st->p += st->chunk;
+	    st->to_read -= st->chunk;
 	}
 
 	/*
@@ -1778,7 +1916,11 @@ static struct Packet *ssh2_rdpkt(Ssh ssh, const unsigned char **data,
 				   st->pktin->data + 4,
 				   st->packetlen - 4);
     } else {
-	st->pktin->data = snewn(st->cipherblk + APIEXTRA, unsigned char);
+	if (st->pktin->maxlen < st->cipherblk) {
+	    st->pktin->maxlen = ssh_pkt_bufsize(st->cipherblk);
+	    st->pktin->data = secure_pool_realloc(st->pktin->data,
+					      st->pktin->maxlen + APIEXTRA);
+	}
 
 	/*
 	 * Acquire and decrypt the first block of the packet. This will
@@ -1819,36 +1961,69 @@ static struct Packet *ssh2_rdpkt(Ssh ssh, const unsigned char **data,
 	/*
 	 * Allocate memory for the rest of the packet.
 	 */
-	st->pktin->maxlen = st->packetlen + st->maclen;
-	st->pktin->data = sresize(st->pktin->data,
-				  st->pktin->maxlen + APIEXTRA,
-				  unsigned char);
+	if (st->pktin->maxlen < st->packetlen + st->maclen) {
+	    st->pktin->maxlen = ssh_pkt_bufsize(st->packetlen + st->maclen);
+	    st->pktin->data = secure_pool_realloc(st->pktin->data,
+					      st->pktin->maxlen + APIEXTRA);
+	}
 
 	/*
-	 * Read and decrypt the remainder of the packet.
+	 * Read the remainder of the packet, in the largest chunks the
+	 * incoming buffer will let us take it in, then decrypt it.
 	 */
-	for (st->i = st->cipherblk; st->i < st->packetlen + st->maclen;
-	     st->i++) {
+	st->to_read = st->packetlen + st->maclen - st->cipherblk;
+	st->p = st->pktin->data + st->cipherblk;
+	while (st->to_read > 0) {
+	    st->chunk = st->to_read;
 	    while ((*datalen) == 0)
 		crReturn(NULL);
-	    st->pktin->data[st->i] = *(*data)++;
-	    (*datalen)--;
+	    if (st->chunk > (*datalen))
+		st->chunk = (*datalen);
+	    memcpy(st->p, *data, st->chunk);
+	    *data += st->chunk;
+	    *datalen -= st->chunk;
+	    st->p += st->chunk;
+	    st->to_read -= st->chunk;
 	}
-	/* Decrypt everything _except_ the MAC. */
-	if (ssh->sccipher)
+	/*
+	 * Decrypt everything _except_ the MAC, feeding each slice to the
+	 * MAC as soon as it's decrypted. Working in cache-sized slices
+	 * means the MAC reads each piece of plaintext back while it's
+	 * still in the data cache, instead of the decrypt and MAC passes
+	 * each traversing the whole packet separately.
+	 */
+	if (ssh->scmac) {
+	    unsigned char seq[4];
+	    long done, slice;
+
+	    ssh->scmac->start(ssh->sc_mac_ctx);
+	    PUT_32BIT(seq, st->incoming_sequence);
+	    ssh->scmac->bytes(ssh->sc_mac_ctx, seq, 4);
+	    ssh->scmac->bytes(ssh->sc_mac_ctx, st->pktin->data, st->cipherblk);
+	    for (done = st->cipherblk; done < st->packetlen; done += slice) {
+		slice = st->packetlen - done;
+		if (slice > 4096)
+		    slice = 4096;
+		if (ssh->sccipher)
+		    ssh->sccipher->decrypt(ssh->sc_cipher_ctx,
+					   st->pktin->data + done, slice);
+		ssh->scmac->bytes(ssh->sc_mac_ctx, st->pktin->data + done,
+				  slice);
+	    }
+
+	    /*
+	     * Check the MAC.
+	     */
+	    if (!ssh->scmac->verresult(ssh->sc_mac_ctx,
+				       st->pktin->data + st->packetlen)) {
+		bombout(("Incorrect MAC received on packet"));
+		ssh_free_packet(st->pktin);
+		crStop(NULL);
+	    }
+	} else if (ssh->sccipher) {
 	    ssh->sccipher->decrypt(ssh->sc_cipher_ctx,
 				   st->pktin->data + st->cipherblk,
 				   st->packetlen - st->cipherblk);
-
-	/*
-	 * Check the MAC.
-	 */
-	if (ssh->scmac
-	    && !ssh->scmac->verify(ssh->sc_mac_ctx, st->pktin->data,
-				   st->len + 4, st->incoming_sequence)) {
-	    bombout(("Incorrect MAC received on packet"));
-	    ssh_free_packet(st->pktin);
-	    crStop(NULL);
 	}
     }
     /* Get and sanity-check the amount of random padding. */
@@ -1882,10 +2057,9 @@ static struct Packet *ssh2_rdpkt(Ssh ssh, const unsigned char **data,
 				    st->pktin->data + 5, st->pktin->length - 5,
 				    &newpayload, &newlen)) {
 	    if (st->pktin->maxlen < newlen + 5) {
-		st->pktin->maxlen = newlen + 5;
-		st->pktin->data = sresize(st->pktin->data,
-					  st->pktin->maxlen + APIEXTRA,
-					  unsigned char);
+		st->pktin->maxlen = ssh_pkt_bufsize(newlen + 5);
+		st->pktin->data = secure_pool_realloc(st->pktin->data,
+					      st->pktin->maxlen + APIEXTRA);
 	    }
 	    st->pktin->length = 5 + newlen;
 	    memcpy(st->pktin->data + 5, newpayload, newlen);
@@ -1944,20 +2118,33 @@ static struct Packet *ssh2_bare_connection_rdpkt(Ssh ssh,
     }
 
     st->pktin = ssh_new_packet();
-    st->pktin->data = snewn(st->packetlen, unsigned char);
+    if (st->pktin->maxlen < st->packetlen) {
+        st->pktin->maxlen = ssh_pkt_bufsize(st->packetlen);
+        st->pktin->data = secure_pool_realloc(st->pktin->data,
+                                              st->pktin->maxlen);
+    }
 
     st->pktin->encrypted_len = st->packetlen;
 
     st->pktin->sequence = st->incoming_sequence++;
 
     /*
-     * Read the remainder of the packet.
+     * Read the remainder of the packet, in the largest chunks the
+     * incoming buffer will let us take it in.
      */
-    for (st->i = 0; st->i < st->packetlen; st->i++) {
+    st->to_read = st->packetlen;
+    st->p = st->pktin->data;
+    while (st->to_read > 0) {
+        st->chunk = st->to_read;
         while ((*datalen) == 0)
             crReturn(NULL);
-        st->pktin->data[st->i] = *(*data)++;
-        (*datalen)--;
+        if (st->chunk > (*datalen))
+            st->chunk = (*datalen);
+        memcpy(st->p, *data, st->chunk);
+        *data += st->chunk;
+        *datalen -= st->chunk;
+        st->p += st->chunk;
+        st->to_read -= st->chunk;
     }
 
     /*
@@ -1994,6 +2181,8 @@ static int s_wrpkt_prepare(Ssh ssh, struct Packet *pkt, int *offset_p)
 #endif
     int len;
 
+    ssh->stat_pkts_out++;
+
     if (ssh->logctx)
         ssh1_log_outgoing_packet(ssh, pkt);
 
@@ -2037,6 +2226,7 @@ static int s_write(Ssh ssh, void *data, int len)
 		   0, NULL, NULL, 0, NULL);
     if (!ssh->s)
         return 0;
+    ssh->stat_bytes_out += len;
     return sk_write(ssh->s, (char *)data, len);
 }
 
@@ -2180,8 +2370,9 @@ static void ssh_pkt_ensure(struct Packet *pkt, int length)
     if (pkt->maxlen < length) {
 	unsigned char *body = pkt->body;
 	int offset = body ? body - pkt->data : 0;
-	pkt->maxlen = length + 256;
-	pkt->data = sresize(pkt->data, pkt->maxlen + APIEXTRA, unsigned char);
+	pkt->maxlen = ssh_pkt_bufsize(length);
+	pkt->data = secure_pool_realloc(pkt->data,
+					      pkt->maxlen + APIEXTRA);
 	if (body) pkt->body = pkt->data + offset;
     }
 }
@@ -2385,6 +2576,7 @@ static int ssh2_pkt_construct(Ssh ssh, struct Packet *pkt)
     }
 
     ssh->v2_outgoing_sequence++;       /* whether or not we MACed */
+    ssh->stat_pkts_out++;
     pkt->encrypted_len = pkt->length + padding;
 
     /* Ready-to-send packet starts at pkt->data. We return length. */
@@ -3160,6 +3352,7 @@ static int do_ssh_init(Ssh ssh, unsigned char c)
     s->vstring[s->vslen] = 0;
     s->vstring[strcspn(s->vstring, "\015\012")] = '\0';/* remove EOL chars */
     logeventf(ssh, "Server version: %s", s->vstring);
+    ssh_log_setup_phase(ssh, "remote version banner received");
     ssh_detect_bugs(ssh, s->vstring);
 
     /*
@@ -3303,6 +3496,7 @@ static int do_ssh_connection_init(Ssh ssh, unsigned char c)
     s->vstring[s->vslen] = 0;
     s->vstring[strcspn(s->vstring, "\015\012")] = '\0';/* remove EOL chars */
     logeventf(ssh, "Server version: %s", s->vstring);
+    ssh_log_setup_phase(ssh, "remote version banner received");
     ssh_detect_bugs(ssh, s->vstring);
 
     /*
@@ -3346,14 +3540,74 @@ static int do_ssh_connection_init(Ssh ssh, unsigned char c)
     crFinish(0);
 }
 
+#ifdef SSH_PKT_PROFILE
+/*
+ * Optional packet-path profiling, compiled in with -DSSH_PKT_PROFILE.
+ * Accumulates ANSI clock() time spent assembling and decrypting
+ * incoming packets and dispatching each message type, and writes a
+ * summary to the Event Log every SSH_PKT_PROFILE_INTERVAL packets and
+ * when the session is freed. Intended for quantifying packet-path
+ * regressions between releases without an external profiler; not for
+ * production builds, since it costs two clock() calls per packet.
+ */
+#include <time.h>
+
+#define SSH_PKT_PROFILE_INTERVAL 100000
+
+static struct {
+    unsigned long pkts;
+    clock_t rdpkt_clocks, dispatch_clocks;
+    unsigned long type_count[256];
+    clock_t type_clocks[256];
+} pkt_prof;
+
+static void ssh_pkt_profile_dump(Ssh ssh)
+{
+    int i;
+
+    logeventf(ssh, "pkt-profile: %lu packets; read+decrypt+MAC %.3fs; "
+	      "dispatch %.3fs", pkt_prof.pkts,
+	      (double)pkt_prof.rdpkt_clocks / CLOCKS_PER_SEC,
+	      (double)pkt_prof.dispatch_clocks / CLOCKS_PER_SEC);
+    for (i = 0; i < 256; i++) {
+	if (pkt_prof.type_count[i])
+	    logeventf(ssh, "pkt-profile: type %d (%s): %lu packets, %.3fs",
+		      i, ssh_pkt_type(ssh, i), pkt_prof.type_count[i],
+		      (double)pkt_prof.type_clocks[i] / CLOCKS_PER_SEC);
+    }
+}
+#endif /* SSH_PKT_PROFILE */
+
 static void ssh_process_incoming_data(Ssh ssh,
 				      const unsigned char **data, int *datalen)
 {
     struct Packet *pktin;
+    clock_t t0 = clock(), t1;
 
     pktin = ssh->s_rdpkt(ssh, data, datalen);
+    t1 = clock();
+    ssh->stat_rdpkt_clocks += t1 - t0;
+#ifdef SSH_PKT_PROFILE
+    pkt_prof.rdpkt_clocks += t1 - t0;
+#endif
     if (pktin) {
+	ssh->stat_pkts_in++;
 	ssh->protocol(ssh, NULL, 0, pktin);
+	{
+	    clock_t t2 = clock();
+#ifdef SSH_PKT_PROFILE
+	    int type = pktin->type & 0xFF;
+#endif
+
+	    ssh->stat_dispatch_clocks += t2 - t1;
+#ifdef SSH_PKT_PROFILE
+	    pkt_prof.dispatch_clocks += t2 - t1;
+	    pkt_prof.type_count[type]++;
+	    pkt_prof.type_clocks[type] += t2 - t1;
+	    if (++pkt_prof.pkts % SSH_PKT_PROFILE_INTERVAL == 0)
+		ssh_pkt_profile_dump(ssh);
+#endif
+	}
 	ssh_free_packet(pktin);
     }
 }
@@ -3394,6 +3648,8 @@ static void ssh_set_frozen(Ssh ssh, int frozen)
 
 static void ssh_gotdata(Ssh ssh, const unsigned char *data, int datalen)
 {
+    ssh->stat_bytes_in += datalen;
+
     /* Log raw data, if we're in that mode. */
     if (ssh->logctx)
 	log_packet(ssh->logctx, PKT_INCOMING, -1, NULL, data, datalen,
@@ -3474,6 +3730,7 @@ static int ssh_do_close(Ssh ssh, int notify_exit)
     if (ssh->channels) {
 	while (NULL != (c = index234(ssh->channels, 0))) {
 	    ssh_channel_close_local(c, NULL);
+	    ssh_channel_uncache(c);
 	    del234(ssh->channels, c); /* moving next one to index 0 */
 	    if (ssh->version == 2)
 		bufchain_clear(&c->v.v2.outbuffer);
@@ -3549,6 +3806,7 @@ void ssh_connshare_log(Ssh ssh, int event, const char *logtext,
     } else if (event == SHARE_DOWNSTREAM) {
         /* In this case, 'logtext' is a local endpoint address */
         logeventf(ssh, "Using existing shared connection at %s", logtext);
+        ssh_log_setup_phase(ssh, "attached to existing shared connection");
         /* Also we should mention this in the console window to avoid
          * confusing users as to why this window doesn't behave the
          * usual way. */
@@ -3600,10 +3858,18 @@ static void ssh_sent(Plug plug, int bufsize)
     Ssh ssh = (Ssh) plug;
     /*
      * If the send backlog on the SSH socket itself clears, we
-     * should unthrottle the whole world if it was throttled.
+     * should unthrottle the whole world if it was throttled. Also
+     * give the channel-data scheduler another go, in case it parked
+     * some channels' output when the backlog filled.
      */
-    if (bufsize < SSH_MAX_BACKLOG)
+    if (bufsize < SSH_MAX_BACKLOG) {
 	ssh_throttle_all(ssh, 0, bufsize);
+	if (ssh->version == 2 && ssh->channels &&
+	    !ssh->chandata_flush_scheduled) {
+	    ssh->chandata_flush_scheduled = TRUE;
+	    queue_bulk_callback(ssh2_flush_deferred_chandata, ssh);
+	}
+    }
 }
 
 static void ssh_hostport_setup(const char *host, int port, Conf *conf,
@@ -3664,6 +3930,16 @@ static int ssh_test_for_upstream(const char *host, int port, Conf *conf)
  * Also places the canonical host name into `realhost'. It must be
  * freed by the caller.
  */
+/*
+ * Log how far into session setup we've got and how long it took to
+ * get there, for diagnosing slow session opens.
+ */
+static void ssh_log_setup_phase(Ssh ssh, const char *phase)
+{
+    logeventf(ssh, "Session setup: %s after %lu ms", phase,
+	      GETTICKCOUNT() - ssh->session_start);
+}
+
 static const char *connect_to_host(Ssh ssh, const char *host, int port,
 				   char **realhost, int nodelay, int keepalive)
 {
@@ -3683,6 +3959,9 @@ static const char *connect_to_host(Ssh ssh, const char *host, int port,
     ssh_hostport_setup(host, port, ssh->conf,
                        &ssh->savedhost, &ssh->savedport, &loghost);
 
+    ssh->session_start = GETTICKCOUNT();
+    ssh->setup_kex_logged = FALSE;
+
     ssh->fn = &fn_table;               /* make 'ssh' usable as a Plug */
 
     /*
@@ -3733,6 +4012,7 @@ static const char *connect_to_host(Ssh ssh, const char *host, int port,
             notify_remote_exit(ssh->frontend);
             return err;
         }
+        ssh_log_setup_phase(ssh, "network connection initiated");
     }
 
     /*
@@ -3852,11 +4132,27 @@ static void ssh_dialog_callback(void *sshv, int ret)
     ssh_process_queued_incoming_data(ssh);
 }
 
+/*
+ * Maximum number of agent requests we'll have in flight to the real
+ * agent at once per forwarding channel. A client pipelining requests
+ * (e.g. a git fetch trying many subkeys) gets them overlapped rather
+ * than one round trip each; the cap stops a hostile client queueing
+ * unbounded work in the agent.
+ */
+#define AGENTF_MAX_OUTSTANDING 16
+
+struct agentf_request {
+    struct ssh_channel *c;
+    agent_pending_query *pending;      /* NULL once the reply is in */
+    void *reply;
+    int replylen;
+    int done;
+    struct agentf_request *next;
+};
+
 static void ssh_agentf_got_response(struct ssh_channel *c,
                                     void *reply, int replylen)
 {
-    c->u.a.pending = NULL;
-
     assert(!(c->closes & CLOSES_SENT_EOF));
 
     if (!reply) {
@@ -3869,6 +4165,51 @@ static void ssh_agentf_got_response(struct ssh_channel *c,
     ssh_send_channel_data(c, reply, replylen);
 }
 
+/*
+ * Send on every response that's ready at the head of the request
+ * queue, in request order. A reply that has arrived for a later
+ * request stays queued until everything before it has been answered.
+ */
+static void ssh_agentf_flush_responses(struct ssh_channel *c)
+{
+    struct agentf_request *req;
+
+    while ((req = c->u.a.req_head) != NULL && req->done) {
+        c->u.a.req_head = req->next;
+        if (!c->u.a.req_head)
+            c->u.a.req_tail = NULL;
+        c->u.a.num_outstanding--;
+
+        ssh_agentf_got_response(c, req->reply, req->replylen);
+        sfree(req->reply);
+        sfree(req);
+    }
+
+    if (c->u.a.rejected && !c->u.a.req_head &&
+        !(c->closes & CLOSES_SENT_EOF))
+        sshfwd_write_eof(c);
+}
+
+/*
+ * Throw away the request queue, e.g. because the channel is being
+ * closed, cancelling anything still in flight to the real agent.
+ */
+static void ssh_agentf_cleanup(struct ssh_channel *c)
+{
+    struct agentf_request *req, *next;
+
+    for (req = c->u.a.req_head; req; req = next) {
+        next = req->next;
+        if (req->pending)
+            agent_cancel_query(req->pending);
+        sfree(req->reply);
+        sfree(req);
+    }
+    c->u.a.req_head = c->u.a.req_tail = NULL;
+    c->u.a.num_outstanding = 0;
+    bufchain_clear(&c->u.a.inbuffer);
+}
+
 static void ssh_agentf_callback(void *cv, void *reply, int replylen);
 
 static void ssh_agentf_try_forward(struct ssh_channel *c)
@@ -3878,13 +4219,7 @@ static void ssh_agentf_try_forward(struct ssh_channel *c)
     unsigned char msglen[4];
     void *reply;
     int replylen;
-
-    /*
-     * Don't try to parallelise agent requests. Wait for each one to
-     * return before attempting the next.
-     */
-    if (c->u.a.pending)
-        return;
+    struct agentf_request *req;
 
     /*
      * If the outgoing side of the channel connection is currently
@@ -3899,16 +4234,17 @@ static void ssh_agentf_try_forward(struct ssh_channel *c)
         (c->ssh->version == 2 && c->v.v2.remwindow == 0))
         return;
 
-    if (c->closes & CLOSES_SENT_EOF) {
+    if ((c->closes & CLOSES_SENT_EOF) || c->u.a.rejected) {
         /*
-         * If we've already sent outgoing EOF, there's nothing we can
-         * do with incoming data except consume it and throw it away.
+         * If we've already sent outgoing EOF, or decided to once the
+         * request queue drains, there's nothing we can do with
+         * incoming data except consume it and throw it away.
          */
         bufchain_clear(&c->u.a.inbuffer);
         return;
     }
 
-    while (1) {
+    while (c->u.a.num_outstanding < AGENTF_MAX_OUTSTANDING) {
         /*
          * Try to extract a complete message from the input buffer.
          */
@@ -3926,10 +4262,27 @@ static void ssh_agentf_try_forward(struct ssh_channel *c)
              * of the incoming message, and also close the connection
              * for good measure (which avoids us having to faff about
              * with carefully ignoring just the right number of bytes
-             * from the overlong message).
+             * from the overlong message). The failure response, and
+             * the EOF, still have to take their turn behind any
+             * requests already in flight.
              */
-            ssh_agentf_got_response(c, NULL, 0);
-            sshfwd_write_eof(c);
+            req = snew(struct agentf_request);
+            req->c = c;
+            req->pending = NULL;
+            req->reply = NULL;
+            req->replylen = 0;
+            req->done = TRUE;
+            req->next = NULL;
+            if (c->u.a.req_tail)
+                c->u.a.req_tail->next = req;
+            else
+                c->u.a.req_head = req;
+            c->u.a.req_tail = req;
+            c->u.a.num_outstanding++;
+
+            c->u.a.rejected = TRUE;
+            bufchain_clear(&c->u.a.inbuffer);
+            ssh_agentf_flush_responses(c);
             return;
         }
 
@@ -3941,47 +4294,75 @@ static void ssh_agentf_try_forward(struct ssh_channel *c)
         message = snewn(messagelen, unsigned char);
         bufchain_fetch(&c->u.a.inbuffer, message, messagelen);
         bufchain_consume(&c->u.a.inbuffer, messagelen);
-        c->u.a.pending = agent_query(
-            message, messagelen, &reply, &replylen, ssh_agentf_callback, c);
-        sfree(message);
 
-        if (c->u.a.pending)
-            return;   /* agent_query promised to reply in due course */
+        req = snew(struct agentf_request);
+        req->c = c;
+        req->reply = NULL;
+        req->replylen = 0;
+        req->done = FALSE;
+        req->next = NULL;
+        if (c->u.a.req_tail)
+            c->u.a.req_tail->next = req;
+        else
+            c->u.a.req_head = req;
+        c->u.a.req_tail = req;
+        c->u.a.num_outstanding++;
 
-        /*
-         * If the agent gave us an answer immediately, pass it
-         * straight on and go round this loop again.
-         */
-        ssh_agentf_got_response(c, reply, replylen);
-        sfree(reply);
+        req->pending = agent_query(
+            message, messagelen, &reply, &replylen, ssh_agentf_callback, req);
+        sfree(message);
+
+        if (!req->pending) {
+            /*
+             * The agent answered immediately. The response can't
+             * necessarily be sent on yet - an earlier request may
+             * still be in flight - so file it in the queue and let
+             * the flush below send whatever is ready, in order.
+             */
+            req->reply = reply;
+            req->replylen = replylen;
+            req->done = TRUE;
+        }
     }
 
+    ssh_agentf_flush_responses(c);
+
     /*
-     * If we get here (i.e. we left the above while loop via 'break'
-     * rather than 'return'), that means we've determined that the
-     * input buffer for the agent forwarding connection doesn't
-     * contain a complete request.
+     * If we get here, either the input buffer doesn't contain another
+     * complete request or we've got as many in flight as we're
+     * prepared to run at once.
      *
-     * So if there's potentially more data to come, we can return now,
+     * If there's potentially more data to come, we can return now,
      * and wait for the remote client to send it. But if the remote
      * has sent EOF, it would be a mistake to do that, because we'd be
      * waiting a long time. So this is the moment to check for EOF,
-     * and respond appropriately.
+     * and respond appropriately - though only once every outstanding
+     * request has been answered, so that no response gets cut off.
      */
-    if (c->closes & CLOSES_RCVD_EOF)
+    if ((c->closes & CLOSES_RCVD_EOF) && !c->u.a.req_head)
         sshfwd_write_eof(c);
 }
 
 static void ssh_agentf_callback(void *cv, void *reply, int replylen)
 {
-    struct ssh_channel *c = (struct ssh_channel *)cv;
+    struct agentf_request *req = (struct agentf_request *)cv;
+    struct ssh_channel *c = req->c;
 
-    ssh_agentf_got_response(c, reply, replylen);
-    sfree(reply);
+    req->pending = NULL;
+    req->reply = reply;
+    req->replylen = replylen;
+    req->done = TRUE;
 
     /*
-     * Now try to extract and send further messages from the channel's
-     * input-side buffer.
+     * Send on whatever responses are now ready, in request order:
+     * this reply may have overtaken one for an earlier request that's
+     * still in flight, in which case it waits its turn in the queue.
+     */
+    ssh_agentf_flush_responses(c);
+
+    /*
+     * Now try to extract and forward further messages from the
+     * channel's input-side buffer.
      */
     ssh_agentf_try_forward(c);
 }
@@ -4348,6 +4729,7 @@ static int do_ssh1_login(Ssh ssh, const unsigned char *in, int inlen,
     ssh->v1_cipher_ctx = ssh->cipher->make_context();
     ssh->cipher->sesskey(ssh->v1_cipher_ctx, ssh->session_key);
     logeventf(ssh, "Initialised %s encryption", ssh->cipher->text_name);
+    ssh->stat_kexes++;
 
     ssh->crcda_ctx = crcda_make_context();
     logevent("Installing CRC compensation attack detector");
@@ -5282,6 +5664,7 @@ static void ssh_setup_portfwd(Ssh ssh, Conf *conf)
 {
     struct ssh_portfwd *epf;
     int i;
+    int nfwdreqs = 0;
     char *key, *val;
 
     if (!ssh->portfwds) {
@@ -5471,7 +5854,8 @@ static void ssh_setup_portfwd(Ssh ssh, Conf *conf)
 			ssh2_pkt_addstring(pktout, "localhost");
 		    }
 		    ssh2_pkt_adduint32(pktout, epf->sport);
-		    ssh2_pkt_send(ssh, pktout);
+		    ssh2_pkt_defer(ssh, pktout);
+		    nfwdreqs++;
 		}
 
 		del234(ssh->rportfwds, rpf);
@@ -5589,7 +5973,8 @@ static void ssh_setup_portfwd(Ssh ssh, Conf *conf)
 			ssh2_pkt_addbool(pktout, 1);/* want reply */
 			ssh2_pkt_addstring(pktout, pf->shost);
 			ssh2_pkt_adduint32(pktout, pf->sport);
-			ssh2_pkt_send(ssh, pktout);
+			ssh2_pkt_defer(ssh, pktout);
+			nfwdreqs++;
 
 			ssh_queue_handler(ssh, SSH2_MSG_REQUEST_SUCCESS,
 					  SSH2_MSG_REQUEST_FAILURE,
@@ -5600,6 +5985,16 @@ static void ssh_setup_portfwd(Ssh ssh, Conf *conf)
 	    sfree(sportdesc);
 	    sfree(dportdesc);
 	}
+
+    /*
+     * The SSH-2 cancel-tcpip-forward and tcpip-forward requests above
+     * were all deferred rather than sent individually, so that a long
+     * list of forwardings goes to the network as a single write.
+     * Their replies are matched up asynchronously by the queued
+     * handlers, so the whole batch costs one round trip.
+     */
+    if (nfwdreqs)
+	ssh_pkt_defersend(ssh);
 }
 
 static void ssh1_smsg_stdout_stderr_data(Ssh ssh, struct Packet *pktin)
@@ -5668,7 +6063,9 @@ static void ssh1_smsg_agent_open(Ssh ssh, struct Packet *pktin)
 	c->remoteid = remoteid;
 	c->halfopen = FALSE;
 	c->type = CHAN_AGENT;	/* identify channel type */
-	c->u.a.pending = NULL;
+	c->u.a.req_head = c->u.a.req_tail = NULL;
+	c->u.a.num_outstanding = 0;
+	c->u.a.rejected = FALSE;
         bufchain_init(&c->u.a.inbuffer);
 	send_packet(ssh, SSH1_MSG_CHANNEL_OPEN_CONFIRMATION,
 		    PKT_INT, c->remoteid, PKT_INT, c->localid,
@@ -5759,6 +6156,7 @@ static void ssh1_msg_channel_open_failure(Ssh ssh, struct Packet *pktin)
     if (c && c->type == CHAN_SOCKDATA) {
 	logevent("Forwarded connection refused by server");
 	pfd_close(c->u.pfd.pf);
+	ssh_channel_uncache(c);
 	del234(ssh->channels, c);
 	sfree(c);
     }
@@ -5815,13 +6213,13 @@ static int ssh_agent_channel_data(struct ssh_channel *c, char *data,
 
     /*
      * We exert back-pressure on an agent forwarding client if and
-     * only if we're waiting for the response to an asynchronous agent
-     * request. This prevents the client running out of window while
-     * receiving the _first_ message, but means that if any message
-     * takes time to process, the client will be discouraged from
-     * sending an endless stream of further ones after it.
+     * only if at least one agent request is still outstanding. This
+     * prevents the client running out of window while receiving the
+     * _first_ message, but means that if the agent takes time to
+     * process things, the client will be discouraged from sending an
+     * endless stream of further requests after it.
      */
-    return (c->u.a.pending ? bufchain_size(&c->u.a.inbuffer) : 0);
+    return (c->u.a.req_head ? bufchain_size(&c->u.a.inbuffer) : 0);
 }
 
 static int ssh_channel_data(struct ssh_channel *c, int is_stderr,
@@ -6023,7 +6421,9 @@ static void do_ssh1_connection(Ssh ssh, const unsigned char *in, int inlen,
     }
 
     if (conf_get_int(ssh->conf, CONF_compression)) {
-	send_packet(ssh, SSH1_CMSG_REQUEST_COMPRESSION, PKT_INT, 6, PKT_END);
+	send_packet(ssh, SSH1_CMSG_REQUEST_COMPRESSION,
+		    PKT_INT, conf_get_int(ssh->conf, CONF_compressionlevel),
+		    PKT_END);
 	do {
 	    crReturnV;
 	} while (!pktin);
@@ -6036,7 +6436,8 @@ static void do_ssh1_connection(Ssh ssh, const unsigned char *in, int inlen,
 	}
 	logevent("Started compression");
 	ssh->v1_compressing = TRUE;
-	ssh->cs_comp_ctx = zlib_compress_init();
+	ssh->cs_comp_ctx =
+	    zlib_compress_init(conf_get_int(ssh->conf, CONF_compressionlevel));
 	logevent("Initialised zlib (RFC1950) compression");
 	ssh->sc_comp_ctx = zlib_decompress_init();
 	logevent("Initialised zlib (RFC1950) decompression");
@@ -6074,6 +6475,7 @@ static void do_ssh1_connection(Ssh ssh, const unsigned char *in, int inlen,
 	ldisc_echoedit_update(ssh->ldisc);  /* cause ldisc to notice changes */
     ssh->send_ok = 1;
     ssh->channels = newtree234(ssh_channelcmp);
+    ssh->channel_cache = NULL;
     while (1) {
 
 	/*
@@ -6238,41 +6640,43 @@ static unsigned char *ssh2_mkkey(Ssh ssh, Bignum K, unsigned char *H,
     const struct ssh_hash *h = ssh->kex->hash;
     int keylen_padded;
     unsigned char *key;
-    void *s, *s2;
+    ssh_hash_ctx s, s2;
 
     if (keylen == 0)
         return NULL;
 
+    assert(h->ctxsize <= sizeof(s));
+
     /* Round up to the next multiple of hash length. */
     keylen_padded = ((keylen + h->hlen - 1) / h->hlen) * h->hlen;
 
     key = snewn(keylen_padded, unsigned char);
 
     /* First hlen bytes. */
-    s = h->init();
+    h->init_ctx(&s);
     if (!(ssh->remote_bugs & BUG_SSH2_DERIVEKEY))
-	hash_mpint(h, s, K);
-    h->bytes(s, H, h->hlen);
-    h->bytes(s, &chr, 1);
-    h->bytes(s, ssh->v2_session_id, ssh->v2_session_id_len);
-    h->final(s, key);
+	hash_mpint(h, &s, K);
+    h->bytes(&s, H, h->hlen);
+    h->bytes(&s, &chr, 1);
+    h->bytes(&s, ssh->v2_session_id, ssh->v2_session_id_len);
+    h->final_ctx(&s, key);
 
     /* Subsequent blocks of hlen bytes. */
     if (keylen_padded > h->hlen) {
         int offset;
 
-        s = h->init();
+        h->init_ctx(&s);
         if (!(ssh->remote_bugs & BUG_SSH2_DERIVEKEY))
-            hash_mpint(h, s, K);
-        h->bytes(s, H, h->hlen);
+            hash_mpint(h, &s, K);
+        h->bytes(&s, H, h->hlen);
 
         for (offset = h->hlen; offset < keylen_padded; offset += h->hlen) {
-            h->bytes(s, key + offset - h->hlen, h->hlen);
-            s2 = h->copy(s);
-            h->final(s2, key + offset);
+            h->bytes(&s, key + offset - h->hlen, h->hlen);
+            memcpy(&s2, &s, h->ctxsize);
+            h->final_ctx(&s2, key + offset);
         }
 
-        h->free(s);
+        smemclr(&s, sizeof(s));
     }
 
     /* Now clear any extra bytes of key material beyond the length
@@ -6333,6 +6737,157 @@ static struct kexinit_algorithm *ssh2_kexinit_addalg(struct kexinit_algorithm
     return NULL;
 }
 
+/*
+ * Throw away any precomputed Diffie-Hellman keypair.
+ */
+static void ssh2_free_precomputed_kex(Ssh ssh)
+{
+    if (ssh->precomp_kex_ctx) {
+	dh_cleanup(ssh->precomp_kex_ctx);
+	ssh->precomp_kex_ctx = NULL;
+    }
+    if (ssh->precomp_kex_e) {
+	freebn(ssh->precomp_kex_e);
+	ssh->precomp_kex_e = NULL;
+    }
+    ssh->precomp_kex_alg = NULL;
+}
+
+/*
+ * Precompute our Diffie-Hellman keypair shortly before a timed rekey
+ * is due. A rekey renegotiates with the same preferences against the
+ * same server, so it almost always settles on the same method as
+ * last time; if that's a fixed-group Diffie-Hellman method, we can
+ * generate our keypair for it ahead of time, moving one of the two
+ * expensive modular exponentiations out of the window during which
+ * outgoing packets queue up behind the key exchange. If the guess
+ * turns out wrong, the keypair is simply thrown away.
+ */
+static void ssh2_precompute_kex(Ssh ssh)
+{
+    if (ssh->precomp_kex_ctx || !ssh->kex ||
+	ssh->kex->main_type != KEXTYPE_DH || dh_is_gex(ssh->kex) ||
+	ssh->kex_nbits <= 0)
+	return;
+
+    ssh->precomp_kex_alg = ssh->kex;
+    ssh->precomp_kex_nbits = ssh->kex_nbits;
+    ssh->precomp_kex_ctx = dh_setup_group(ssh->kex);
+    ssh->precomp_kex_e = dh_create_e(ssh->precomp_kex_ctx,
+				     ssh->kex_nbits * 2);
+}
+
+/*
+ * Offloading of the CPU-heavy key exchange steps to a worker thread,
+ * via the platform offload_run() interface, so that the main event
+ * loop (and hence any shared-connection downstreams) stays live while
+ * a large modular exponentiation runs. The do_ssh2_transport
+ * coroutine starts a job, returns to the event loop, and is re-entered
+ * by the completion callback in the same way ssh_dialog_callback
+ * re-enters it after an asynchronous user prompt.
+ */
+struct ssh2_kex_offload {
+    Ssh ssh;			       /* NULL if the owner has been freed */
+    void *dh_ctx;
+    Bignum in, out;
+    int delivered;		       /* completion callback has run
+					* (only touched on the main thread) */
+};
+
+/*
+ * Only the pure-math halves of the DH steps may run on the worker:
+ * the random pool has no locking and is mutated by noise sources on
+ * the main thread throughout (every socket read, for a start), so
+ * the secret exponent must be drawn via dh_gen_x() on the main
+ * thread before the job is dispatched.
+ */
+static void ssh2_kex_offload_compute_e(void *vjob)
+{
+    struct ssh2_kex_offload *job = (struct ssh2_kex_offload *)vjob;
+
+    job->out = dh_compute_e(job->dh_ctx);
+}
+
+static void ssh2_kex_offload_find_K(void *vjob)
+{
+    struct ssh2_kex_offload *job = (struct ssh2_kex_offload *)vjob;
+
+    job->out = dh_find_K(job->dh_ctx, job->in);
+}
+
+static void ssh2_kex_offload_callback(void *vjob)
+{
+    struct ssh2_kex_offload *job = (struct ssh2_kex_offload *)vjob;
+    Ssh ssh = job->ssh;
+
+    if (!ssh || ssh->state == SSH_STATE_CLOSED) {
+	/* The connection was abandoned while we were computing. */
+	if (ssh)
+	    ssh->kex_offload = NULL;
+	if (job->out)
+	    freebn(job->out);
+	sfree(job);
+	return;
+    }
+
+    job->delivered = TRUE;
+    do_ssh2_transport(ssh, NULL, -1, NULL);
+
+    /*
+     * This may have unfrozen the SSH connection, so do a
+     * queued-data run.
+     */
+    ssh_process_queued_incoming_data(ssh);
+}
+
+static void ssh2_kex_offload_start(Ssh ssh, offload_fn_t work,
+				   void *dh_ctx, Bignum in)
+{
+    struct ssh2_kex_offload *job = snew(struct ssh2_kex_offload);
+
+    job->ssh = ssh;
+    job->dh_ctx = dh_ctx;
+    job->in = in;
+    job->out = NULL;
+    job->delivered = FALSE;
+    ssh->kex_offload = job;
+    ssh_set_frozen(ssh, 1);
+    offload_run(work, ssh2_kex_offload_callback, job);
+}
+
+/* Collect the result of an offloaded kex step, once its completion
+ * callback has re-entered the transport coroutine. */
+static Bignum ssh2_kex_offload_collect(Ssh ssh)
+{
+    Bignum ret = ssh->kex_offload->out;
+
+    sfree(ssh->kex_offload);
+    ssh->kex_offload = NULL;
+    ssh_set_frozen(ssh, 0);
+    return ret;
+}
+
+/*
+ * How long before a timed rekey we do the precomputation.
+ */
+#define REKEY_PRECOMP_LEAD (30 * TICKSPERSEC)
+
+static void ssh2_schedule_rekey_timers(Ssh ssh)
+{
+    int rekey_time = conf_get_int(ssh->conf, CONF_ssh_rekey_time);
+
+    /* Any keypair precomputed for the rekey just finished is stale. */
+    ssh2_free_precomputed_kex(ssh);
+
+    if (rekey_time != 0) {
+	unsigned long ticks = rekey_time * 60 * TICKSPERSEC;
+	ssh->next_rekey = schedule_timer(ticks, ssh2_timer, ssh);
+	if (ticks > 2 * REKEY_PRECOMP_LEAD)
+	    ssh->next_kex_precomp =
+		schedule_timer(ticks - REKEY_PRECOMP_LEAD, ssh2_timer, ssh);
+    }
+}
+
 /*
  * Handle the SSH-2 transport layer.
  */
@@ -6387,6 +6942,8 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
         int dlgret;
 	int guessok;
 	int ignorepkt;
+	int guess_sent, our_guessok;
+	char *srv_first_kex, *srv_first_hk;
 	struct kexinit_algorithm kexlists[NKEXLIST][MAXKEXLIST];
     };
     crState(do_ssh2_transport_state);
@@ -6403,6 +6960,7 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
     s->got_session_id = s->activated_authconn = FALSE;
     s->userauth_succeeded = FALSE;
     s->pending_compression = FALSE;
+    s->srv_first_kex = s->srv_first_hk = NULL;
 
     /*
      * Be prepared to work around the buggy MAC problem.
@@ -6679,8 +7237,34 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
 	ssh2_pkt_addstring_start(s->pktout);
 	/* List server->client languages. Empty list. */
 	ssh2_pkt_addstring_start(s->pktout);
-	/* First KEX packet does _not_ follow, because we're not that brave. */
-	ssh2_pkt_addbool(s->pktout, FALSE);
+	/*
+	 * Our first KEX packet follows only when this server's
+	 * previous KEXINIT led with the same kex and host key
+	 * algorithms ours now does, so the negotiation is certain to
+	 * pick them and a guessed ECDH packet saves a round trip. A
+	 * server that has changed its mind since ignores the guessed
+	 * packet and we fall back to the usual exchange.
+	 */
+	s->guess_sent = FALSE;
+	if (!s->got_session_id) {
+	    char *learned = read_learned_kex(ssh->savedhost, ssh->savedport);
+	    if (learned) {
+		struct kexinit_algorithm *gkex = &s->kexlists[KEXLIST_KEX][0];
+		struct kexinit_algorithm *ghk =
+		    &s->kexlists[KEXLIST_HOSTKEY][0];
+		char *comma = strchr(learned, ',');
+		if (comma && gkex->name && ghk->name &&
+		    gkex->u.kex.kex->main_type == KEXTYPE_ECDH &&
+		    !gkex->u.kex.warn && !ghk->u.hk.warn) {
+		    *comma = '\0';
+		    if (!strcmp(learned, gkex->name) &&
+			!strcmp(comma + 1, ghk->name))
+			s->guess_sent = TRUE;
+		}
+		sfree(learned);
+	    }
+	}
+	ssh2_pkt_addbool(s->pktout, s->guess_sent);
 	/* Reserved. */
 	ssh2_pkt_adduint32(s->pktout, 0);
     }
@@ -6691,6 +7275,36 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
 
     ssh2_pkt_send_noqueue(ssh, s->pktout);
 
+    if (s->guess_sent) {
+	/*
+	 * Send the guessed first key exchange packet: an ECDH INIT
+	 * for the kex at the head of our list, without waiting to
+	 * see the server's KEXINIT.
+	 */
+	char *publicPoint;
+	int publicPointLength;
+
+	ssh->pkt_kctx = SSH2_PKTCTX_ECDHKEX;
+	s->eckey = ssh_ecdhkex_newkey(s->kexlists[KEXLIST_KEX][0].u.kex.kex);
+	if (!s->eckey) {
+	    bombout(("Unable to generate key for ECDH"));
+	    crStopV;
+	}
+	publicPoint = ssh_ecdhkex_getpublic(s->eckey, &publicPointLength);
+	if (!publicPoint) {
+	    ssh_ecdhkex_freekey(s->eckey);
+	    bombout(("Unable to encode public key for ECDH"));
+	    crStopV;
+	}
+	logeventf(ssh, "Sending guessed key exchange packet for %s",
+		  s->kexlists[KEXLIST_KEX][0].name);
+	s->pktout = ssh2_pkt_init(SSH2_MSG_KEX_ECDH_INIT);
+	ssh2_pkt_addstring_start(s->pktout);
+	ssh2_pkt_addstring_data(s->pktout, publicPoint, publicPointLength);
+	sfree(publicPoint);
+	ssh2_pkt_send_noqueue(ssh, s->pktout);
+    }
+
     if (!pktin)
 	crWaitUntilV(pktin);
 
@@ -6720,6 +7334,7 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
 	pktin->savedpos += 16;	        /* skip garbage cookie */
 
 	s->guessok = FALSE;
+	s->our_guessok = TRUE;
 	for (i = 0; i < NKEXLIST; i++) {
 	    ssh_pkt_getstring(pktin, &str, &len);
 	    if (!str) {
@@ -6727,6 +7342,21 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
 		crStopV;
 	    }
 
+	    if (!s->got_session_id &&
+		(i == KEXLIST_KEX || i == KEXLIST_HOSTKEY)) {
+		/* Remember the server's first preference, to inform
+		 * the next connection's guess. */
+		char *c = memchr(str, ',', len);
+		int flen = c ? c - str : len;
+		if (i == KEXLIST_KEX) {
+		    sfree(s->srv_first_kex);
+		    s->srv_first_kex = dupprintf("%.*s", flen, str);
+		} else {
+		    sfree(s->srv_first_hk);
+		    s->srv_first_hk = dupprintf("%.*s", flen, str);
+		}
+	    }
+
             /* If we've already selected a cipher which requires a
              * particular MAC, then just select that, and don't even
              * bother looking through the server's KEXINIT string for
@@ -6750,10 +7380,14 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
 		if (in_commasep_string(alg->name, str, len)) {
 		    /* We've found a matching algorithm. */
 		    if (i == KEXLIST_KEX || i == KEXLIST_HOSTKEY) {
-			/* Check if we might need to ignore first kex pkt */
+			/* Check if we might need to ignore first kex pkt,
+			 * and likewise whether the server will honour or
+			 * discard any guess we sent ourselves. */
 			if (j != 0 ||
-			    !first_in_commasep_string(alg->name, str, len))
+			    !first_in_commasep_string(alg->name, str, len)) {
 			    s->guessok = FALSE;
+			    s->our_guessok = FALSE;
+			}
 		    }
 		    if (i == KEXLIST_KEX) {
 			ssh->kex = alg->u.kex.kex;
@@ -6825,7 +7459,22 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
 	ssh_pkt_getstring(pktin, &str, &len);  /* server->client language */
 	s->ignorepkt = ssh2_pkt_getbool(pktin) && !s->guessok;
 
-	ssh->exhash = ssh->kex->hash->init();
+	if (s->guess_sent && !s->our_guessok) {
+	    /*
+	     * The server will discard the key exchange packet we
+	     * guessed; throw away the key we generated for it and
+	     * carry on with the exchange it actually negotiated.
+	     */
+	    logevent("Guessed key exchange packet was wrong; "
+		     "continuing normally");
+	    ssh_ecdhkex_freekey(s->eckey);
+	    s->eckey = NULL;
+	    s->guess_sent = FALSE;
+	}
+
+	assert(ssh->kex->hash->ctxsize <= sizeof(ssh->exhash_ctx));
+	ssh->exhash = &ssh->exhash_ctx;
+	ssh->kex->hash->init_ctx(ssh->exhash);
 	hash_string(ssh->kex->hash, ssh->exhash, ssh->v_c, strlen(ssh->v_c));
 	hash_string(ssh->kex->hash, ssh->exhash, ssh->v_s, strlen(ssh->v_s));
 	hash_string(ssh->kex->hash, ssh->exhash,
@@ -6998,6 +7647,10 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
         if (s->nbits > ssh->kex->hash->hlen * 8)
             s->nbits = ssh->kex->hash->hlen * 8;
 
+        /* Remembered so the next timed rekey can precompute its DH
+         * keypair before the exchange starts. */
+        ssh->kex_nbits = s->nbits;
+
         /*
          * If we're doing Diffie-Hellman group exchange, start by
          * requesting a group.
@@ -7037,11 +7690,25 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
                 crStopV;
             }
             ssh->kex_ctx = dh_setup_gex(s->p, s->g);
+            ssh2_free_precomputed_kex(ssh);
+            s->e = NULL;
             s->kex_init_value = SSH2_MSG_KEX_DH_GEX_INIT;
             s->kex_reply_value = SSH2_MSG_KEX_DH_GEX_REPLY;
         } else {
             ssh->pkt_kctx = SSH2_PKTCTX_DHGROUP;
-            ssh->kex_ctx = dh_setup_group(ssh->kex);
+            if (ssh->precomp_kex_ctx && ssh->precomp_kex_alg == ssh->kex &&
+                ssh->precomp_kex_nbits == s->nbits) {
+                /* Adopt the keypair made before this rekey fell due. */
+                ssh->kex_ctx = ssh->precomp_kex_ctx;
+                s->e = ssh->precomp_kex_e;
+                ssh->precomp_kex_ctx = NULL;
+                ssh->precomp_kex_e = NULL;
+                ssh->precomp_kex_alg = NULL;
+            } else {
+                ssh2_free_precomputed_kex(ssh);
+                ssh->kex_ctx = dh_setup_group(ssh->kex);
+                s->e = NULL;
+            }
             s->kex_init_value = SSH2_MSG_KEXDH_INIT;
             s->kex_reply_value = SSH2_MSG_KEXDH_REPLY;
             logeventf(ssh, "Using Diffie-Hellman with standard group \"%s\"",
@@ -7051,10 +7718,33 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
         logeventf(ssh, "Doing Diffie-Hellman key exchange with hash %s",
                   ssh->kex->hash->text_name);
         /*
-         * Now generate and send e for Diffie-Hellman.
+         * Now generate and send e for Diffie-Hellman, unless it was
+         * precomputed before this rekey fell due.
          */
         set_busy_status(ssh->frontend, BUSY_CPU); /* this can take a while */
-        s->e = dh_create_e(ssh->kex_ctx, s->nbits * 2);
+        if (!s->e) {
+            if (offload_available()) {
+                /*
+                 * Draw the secret exponent here, where touching the
+                 * (unlocked) random pool is safe; the worker only does
+                 * the modular exponentiation.
+                 */
+                dh_gen_x(ssh->kex_ctx, s->nbits * 2);
+                ssh2_kex_offload_start(ssh, ssh2_kex_offload_compute_e,
+                                       ssh->kex_ctx, NULL);
+                do {
+                    crReturnV;
+                    if (pktin) {
+                        bombout(("Unexpected data from server while"
+                                 " computing Diffie-Hellman value"));
+                        crStopV;
+                    }
+                } while (!ssh->kex_offload->delivered);
+                s->e = ssh2_kex_offload_collect(ssh);
+            } else {
+                s->e = dh_create_e(ssh->kex_ctx, s->nbits * 2);
+            }
+        }
         s->pktout = ssh2_pkt_init(s->kex_init_value);
         ssh2_pkt_addmp(s->pktout, s->e);
         ssh2_pkt_send_noqueue(ssh, s->pktout);
@@ -7091,7 +7781,21 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
                 crStopV;
             }
         }
-        s->K = dh_find_K(ssh->kex_ctx, s->f);
+        if (offload_available()) {
+            ssh2_kex_offload_start(ssh, ssh2_kex_offload_find_K,
+                                   ssh->kex_ctx, s->f);
+            do {
+                crReturnV;
+                if (pktin) {
+                    bombout(("Unexpected data from server while"
+                             " computing Diffie-Hellman value"));
+                    crStopV;
+                }
+            } while (!ssh->kex_offload->delivered);
+            s->K = ssh2_kex_offload_collect(ssh);
+        } else {
+            s->K = dh_find_K(ssh->kex_ctx, s->f);
+        }
 
         /* We assume everything from now on will be quick, and it might
          * involve user interaction. */
@@ -7123,28 +7827,34 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
                   ssh->kex->hash->text_name);
         ssh->pkt_kctx = SSH2_PKTCTX_ECDHKEX;
 
-        s->eckey = ssh_ecdhkex_newkey(ssh->kex);
-        if (!s->eckey) {
-            bombout(("Unable to generate key for ECDH"));
-            crStopV;
-        }
-
-        {
-            char *publicPoint;
-            int publicPointLength;
-            publicPoint = ssh_ecdhkex_getpublic(s->eckey, &publicPointLength);
-            if (!publicPoint) {
-                ssh_ecdhkex_freekey(s->eckey);
-                bombout(("Unable to encode public key for ECDH"));
+        if (!s->guess_sent) {
+            s->eckey = ssh_ecdhkex_newkey(ssh->kex);
+            if (!s->eckey) {
+                bombout(("Unable to generate key for ECDH"));
                 crStopV;
             }
-            s->pktout = ssh2_pkt_init(SSH2_MSG_KEX_ECDH_INIT);
-            ssh2_pkt_addstring_start(s->pktout);
-            ssh2_pkt_addstring_data(s->pktout, publicPoint, publicPointLength);
-            sfree(publicPoint);
-        }
 
-        ssh2_pkt_send_noqueue(ssh, s->pktout);
+            {
+                char *publicPoint;
+                int publicPointLength;
+                publicPoint = ssh_ecdhkex_getpublic(s->eckey,
+                                                    &publicPointLength);
+                if (!publicPoint) {
+                    ssh_ecdhkex_freekey(s->eckey);
+                    bombout(("Unable to encode public key for ECDH"));
+                    crStopV;
+                }
+                s->pktout = ssh2_pkt_init(SSH2_MSG_KEX_ECDH_INIT);
+                ssh2_pkt_addstring_start(s->pktout);
+                ssh2_pkt_addstring_data(s->pktout, publicPoint,
+                                        publicPointLength);
+                sfree(publicPoint);
+            }
+
+            ssh2_pkt_send_noqueue(ssh, s->pktout);
+        }
+        /* else our key was generated, and KEX_ECDH_INIT sent, along
+         * with the KEXINIT whose guess the server has now accepted */
 
         crWaitUntilV(pktin);
         if (pktin->type != SSH2_MSG_KEX_ECDH_REPLY) {
@@ -7317,7 +8027,7 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
 
     hash_mpint(ssh->kex->hash, ssh->exhash, s->K);
     assert(ssh->kex->hash->hlen <= sizeof(s->exchange_hash));
-    ssh->kex->hash->final(ssh->exhash, s->exchange_hash);
+    ssh->kex->hash->final_ctx(ssh->exhash, s->exchange_hash);
 
     ssh->kex_ctx = NULL;
 
@@ -7467,6 +8177,22 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
 	ssh->v2_session_id_len = ssh->kex->hash->hlen;
 	assert(ssh->v2_session_id_len <= sizeof(ssh->v2_session_id));
 	s->got_session_id = TRUE;
+
+	/*
+	 * Now the server has proved its identity, record its leading
+	 * KEXINIT preferences to inform the next connection's guess.
+	 */
+	if (s->srv_first_kex && s->srv_first_hk) {
+	    char *algs = dupcat(s->srv_first_kex, ",", s->srv_first_hk, NULL);
+	    char *prev = read_learned_kex(ssh->savedhost, ssh->savedport);
+	    if (!prev || strcmp(prev, algs))
+		store_learned_kex(ssh->savedhost, ssh->savedport, algs);
+	    sfree(prev);
+	    sfree(algs);
+	    sfree(s->srv_first_kex);
+	    sfree(s->srv_first_hk);
+	    s->srv_first_kex = s->srv_first_hk = NULL;
+	}
     }
 
     /*
@@ -7495,7 +8221,9 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
     if (ssh->cs_comp_ctx)
 	ssh->cscomp->compress_cleanup(ssh->cs_comp_ctx);
     ssh->cscomp = s->cscomp_tobe;
-    ssh->cs_comp_ctx = ssh->cscomp->compress_init();
+    ssh->cs_comp_ctx =
+	ssh->cscomp->compress_init(conf_get_int(ssh->conf,
+						CONF_compressionlevel));
 
     /*
      * Set IVs on client-to-server keys. Here we use the exchange
@@ -7645,10 +8373,13 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
      * Otherwise, schedule a timer for our next rekey.
      */
     ssh->kex_in_progress = FALSE;
+    ssh->stat_kexes++;
     ssh->last_rekey = GETTICKCOUNT();
-    if (conf_get_int(ssh->conf, CONF_ssh_rekey_time) != 0)
-	ssh->next_rekey = schedule_timer(conf_get_int(ssh->conf, CONF_ssh_rekey_time)*60*TICKSPERSEC,
-					 ssh2_timer, ssh);
+    ssh2_schedule_rekey_timers(ssh);
+    if (!ssh->setup_kex_logged) {
+	ssh_log_setup_phase(ssh, "initial key exchange completed");
+	ssh->setup_kex_logged = TRUE;
+    }
 
     /*
      * Now we're encrypting. Begin returning 1 to the protocol main
@@ -7722,11 +8453,7 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
              * hit the event log _too_ often. */
             ssh->outgoing_data_size = 0;
             ssh->incoming_data_size = 0;
-            if (conf_get_int(ssh->conf, CONF_ssh_rekey_time) != 0) {
-                ssh->next_rekey =
-                    schedule_timer(conf_get_int(ssh->conf, CONF_ssh_rekey_time)*60*TICKSPERSEC,
-                                   ssh2_timer, ssh);
-            }
+            ssh2_schedule_rekey_timers(ssh);
             goto wait_for_rekey;       /* this is still utterly horrid */
         } else {
             logeventf(ssh, "Initiating key re-exchange (%s)", (char *)in);
@@ -7741,12 +8468,65 @@ static void do_ssh2_transport(Ssh ssh, const void *vin, int inlen,
  * Send data on an SSH channel.  In SSH-2, this involves buffering it
  * first.
  */
+/*
+ * Minimum write size for which ssh_send_channel_data() will bypass
+ * the channel's outgoing bufchain and construct CHANNEL_DATA packets
+ * directly from the caller's buffer. Writes below this are left to
+ * the deferred-coalescing path, so that interactive traffic still
+ * batches into as few packets as possible.
+ */
+#define CHANDATA_DIRECT_MIN 4096
+
 static int ssh_send_channel_data(struct ssh_channel *c, const char *buf,
 				   int len)
 {
     if (c->ssh->version == 2) {
+	/*
+	 * Bulk fast path: when nothing is already queued on this
+	 * channel and the remote window is open, cut out the
+	 * intermediate bufchain copy and build CHANNEL_DATA packets
+	 * straight from the caller's buffer. This is the case a
+	 * port-forwarding relay hits on every socket read during a
+	 * bulk transfer, where each read fills a maximum-size packet
+	 * anyway and gains nothing from coalescing. Fairness isn't a
+	 * worry here: with the outbuffer empty we send at most one
+	 * socket read's worth, comparable to the round-robin quantum
+	 * the deferred flush would have granted.
+	 */
+	while (len >= CHANDATA_DIRECT_MIN &&
+	       bufchain_size(&c->v.v2.outbuffer) == 0 &&
+	       c->v.v2.remwindow > 0 && c->ssh->s &&
+	       !(c->closes & CLOSES_SENT_EOF)) {
+	    int thislen = len;
+	    if ((unsigned)thislen > c->v.v2.remwindow)
+		thislen = c->v.v2.remwindow;
+	    if ((unsigned)thislen > c->v.v2.remmaxpkt)
+		thislen = c->v.v2.remmaxpkt;
+	    if (thislen <= 0)	       /* peer advertised a silly maxpkt */
+		break;
+	    ssh2_pkt_send(c->ssh, ssh2_mkpkt_channel_data(c, buf, thislen));
+	    c->v.v2.remwindow -= thislen;
+	    buf += thislen;
+	    len -= thislen;
+	}
+	if (len == 0)
+	    return 0;
+
 	bufchain_add(&c->v.v2.outbuffer, buf, len);
-	return ssh2_try_send(c);
+	/*
+	 * Defer the flush to a toplevel callback, so that a burst of
+	 * small writes arriving within one pass of the event loop
+	 * (e.g. a paste fed through the line discipline a character
+	 * at a time) coalesces into as few CHANNEL_DATA packets as
+	 * the peer's maximum packet size allows, instead of costing
+	 * one padded and MACed packet per write.
+	 */
+	c->v.v2.defer_send = TRUE;
+	if (!c->ssh->chandata_flush_scheduled) {
+	    c->ssh->chandata_flush_scheduled = TRUE;
+	    queue_bulk_callback(ssh2_flush_deferred_chandata, c->ssh);
+	}
+	return bufchain_size(&c->v.v2.outbuffer);
     } else {
 	send_packet(c->ssh, SSH1_MSG_CHANNEL_DATA,
 		    PKT_INT, c->remoteid,
@@ -7765,15 +8545,50 @@ static int ssh_send_channel_data(struct ssh_channel *c, const char *buf,
 }
 
 /*
- * Attempt to send data on an SSH-2 channel.
+ * Construct an SSH-2 CHANNEL_DATA packet in one go. This is the
+ * packet the bulk-data path constructs at high rates, so unlike the
+ * general ssh2_pkt_init()/adddata() route we work out the full size
+ * up front and lay the fields straight into the buffer, leaving room
+ * for the padding and MAC that ssh2_pkt_construct() will append so
+ * that no further reallocation happens downstream.
+ */
+static struct Packet *ssh2_mkpkt_channel_data(struct ssh_channel *c,
+					      const void *data, int len)
+{
+    struct Packet *pkt = ssh_new_packet();
+
+    pkt->length = 0;
+    pkt->forcepad = 0;
+    pkt->type = SSH2_MSG_CHANNEL_DATA;
+    pkt->downstream_id = 0;
+    pkt->additional_log_text = NULL;
+
+    /* 5 byte header, type byte, channel id, string length, payload,
+     * plus the maximum padding and MAC the wire format can add. */
+    ssh_pkt_ensure(pkt, 5 + 1 + 4 + 4 + len + 255 + 64);
+    pkt->data[5] = SSH2_MSG_CHANNEL_DATA;
+    PUT_32BIT(pkt->data + 6, c->remoteid);
+    PUT_32BIT(pkt->data + 10, len);
+    memcpy(pkt->data + 14, data, len);
+    pkt->length = 14 + len;
+    pkt->body = pkt->data + 6;
+
+    return pkt;
+}
+
+/*
+ * Attempt to send data on an SSH-2 channel. `limit' caps the number
+ * of payload bytes sent in this call (the fairness scheduler uses it
+ * to give each channel a bounded turn); negative means no cap.
  */
-static int ssh2_try_send(struct ssh_channel *c)
+static int ssh2_try_send(struct ssh_channel *c, int limit)
 {
     Ssh ssh = c->ssh;
     struct Packet *pktout;
     int ret;
 
-    while (c->v.v2.remwindow > 0 && bufchain_size(&c->v.v2.outbuffer) > 0) {
+    while (c->v.v2.remwindow > 0 && bufchain_size(&c->v.v2.outbuffer) > 0 &&
+	   limit != 0) {
 	int len;
 	void *data;
 	bufchain_prefix(&c->v.v2.outbuffer, &data, &len);
@@ -7781,22 +8596,27 @@ static int ssh2_try_send(struct ssh_channel *c)
 	    len = c->v.v2.remwindow;
 	if ((unsigned)len > c->v.v2.remmaxpkt)
 	    len = c->v.v2.remmaxpkt;
-	pktout = ssh2_pkt_init(SSH2_MSG_CHANNEL_DATA);
-	ssh2_pkt_adduint32(pktout, c->remoteid);
-	ssh2_pkt_addstring_start(pktout);
-	ssh2_pkt_addstring_data(pktout, data, len);
+	if (limit > 0 && len > limit)
+	    len = limit;
+	pktout = ssh2_mkpkt_channel_data(c, data, len);
 	ssh2_pkt_send(ssh, pktout);
         if (!ssh->s)   /* a network error might have closed the socket */
             break;
 	bufchain_consume(&c->v.v2.outbuffer, len);
 	c->v.v2.remwindow -= len;
+	if (limit > 0)
+	    limit -= len;
     }
 
     /*
      * After having sent as much data as we can, return the amount
-     * still buffered.
+     * still buffered. If we're left holding data purely because the
+     * remote window is empty, note the stall in the session
+     * statistics.
      */
     ret = bufchain_size(&c->v.v2.outbuffer);
+    if (ret > 0 && c->v.v2.remwindow == 0)
+	ssh->stat_winstalls++;
 
     /*
      * And if there's no data pending but we need to send an EOF, send
@@ -7808,12 +8628,13 @@ static int ssh2_try_send(struct ssh_channel *c)
     return ret;
 }
 
-static void ssh2_try_send_and_unthrottle(Ssh ssh, struct ssh_channel *c)
+static void ssh2_try_send_and_unthrottle(Ssh ssh, struct ssh_channel *c,
+					 int limit)
 {
     int bufsize;
     if (c->closes & CLOSES_SENT_EOF)
 	return;                   /* don't send on channels we've EOFed */
-    bufsize = ssh2_try_send(c);
+    bufsize = ssh2_try_send(c, limit);
     if (bufsize == 0) {
 	switch (c->type) {
 	  case CHAN_MAINSESSION:
@@ -7835,6 +8656,59 @@ static void ssh2_try_send_and_unthrottle(Ssh ssh, struct ssh_channel *c)
     }
 }
 
+/*
+ * Toplevel callback that flushes any channel data whose sending was
+ * deferred by ssh_send_channel_data(). Runs once per burst, however
+ * many writes were made in the meantime.
+ *
+ * Channels take turns in round-robin order, CHANDATA_QUANTUM bytes
+ * per turn, so a bulk transfer can't drain its entire window into
+ * the socket ahead of an interactive channel's few bytes. We keep
+ * cycling until everything sendable has gone or the socket's own
+ * backlog fills up; in the latter case the still-flagged channels
+ * get another go when ssh_sent() sees the backlog clear.
+ */
+#define CHANDATA_QUANTUM 16384
+
+static void ssh2_flush_deferred_chandata(void *ctx)
+{
+    Ssh ssh = (Ssh)ctx;
+    struct ssh_channel *c;
+    int i, nchans, before, progress, pending;
+
+    ssh->chandata_flush_scheduled = FALSE;
+
+    if (ssh->state == SSH_STATE_CLOSED || !ssh->channels)
+	return;
+
+    do {
+	progress = pending = FALSE;
+	nchans = count234(ssh->channels);
+	if (nchans == 0)
+	    break;
+	ssh->chandata_rr_start %= nchans;
+	for (i = 0; i < nchans; i++) {
+	    c = index234(ssh->channels,
+			 (i + ssh->chandata_rr_start) % nchans);
+	    if (c->type == CHAN_SHARING || c->halfopen ||
+		!c->v.v2.defer_send)
+		continue;
+	    before = bufchain_size(&c->v.v2.outbuffer);
+	    ssh2_try_send_and_unthrottle(ssh, c, CHANDATA_QUANTUM);
+	    if (ssh->state == SSH_STATE_CLOSED || !ssh->channels)
+		return;	       /* sending can abort the connection */
+	    if (bufchain_size(&c->v.v2.outbuffer) < before)
+		progress = TRUE;
+	    if (bufchain_size(&c->v.v2.outbuffer) > 0 &&
+		c->v.v2.remwindow > 0)
+		pending = TRUE;	       /* keep defer_send for next turn */
+	    else
+		c->v.v2.defer_send = FALSE;
+	}
+	ssh->chandata_rr_start++;
+    } while (progress && pending && !ssh->throttled_all);
+}
+
 static int ssh_is_simple(Ssh ssh)
 {
     /*
@@ -7863,6 +8737,7 @@ static void ssh_channel_init(struct ssh_channel *c)
 	    ssh_is_simple(ssh) ? OUR_V2_BIGWIN : OUR_V2_WINSIZE;
 	c->v.v2.chanreq_head = NULL;
 	c->v.v2.throttle_state = UNTHROTTLED;
+	c->v.v2.defer_send = FALSE;
 	bufchain_init(&c->v.v2.outbuffer);
     }
     add234(ssh->channels, c);
@@ -8034,6 +8909,39 @@ static void ssh2_set_window(struct ssh_channel *c, int newwin)
     }
 }
 
+/*
+ * Per-message-type descriptors for the validity checks in
+ * ssh_channel_msg, precomputed once at startup so that the per-packet
+ * work is a single table load rather than a chain of comparisons.
+ */
+#define CHANMSG_HALFOPEN_OK 1	       /* legal on a half-open channel */
+
+static unsigned char ssh_chanmsg_desc[2][256];
+static int ssh_chanmsg_desc_ready = FALSE;
+
+static void ssh_chanmsg_desc_init(void)
+{
+    ssh_chanmsg_desc[0][SSH1_MSG_CHANNEL_OPEN_CONFIRMATION] |=
+	CHANMSG_HALFOPEN_OK;
+    ssh_chanmsg_desc[0][SSH1_MSG_CHANNEL_OPEN_FAILURE] |=
+	CHANMSG_HALFOPEN_OK;
+    ssh_chanmsg_desc[1][SSH2_MSG_CHANNEL_OPEN_CONFIRMATION] |=
+	CHANMSG_HALFOPEN_OK;
+    ssh_chanmsg_desc[1][SSH2_MSG_CHANNEL_OPEN_FAILURE] |=
+	CHANMSG_HALFOPEN_OK;
+    ssh_chanmsg_desc_ready = TRUE;
+}
+
+/*
+ * Forget any cached lookup result referring to a channel which is
+ * about to be removed from the channels tree and freed.
+ */
+static void ssh_channel_uncache(struct ssh_channel *c)
+{
+    if (c->ssh->channel_cache == c)
+	c->ssh->channel_cache = NULL;
+}
+
 /*
  * Find the channel associated with a message.  If there's no channel,
  * or it's not properly open, make a noise about it and return NULL.
@@ -8046,14 +8954,21 @@ static struct ssh_channel *ssh_channel_msg(Ssh ssh, struct Packet *pktin)
     struct ssh_channel *c;
     int halfopen_ok;
 
+    if (!ssh_chanmsg_desc_ready)
+	ssh_chanmsg_desc_init();
+
     /* Is this message OK on a half-open connection? */
-    if (ssh->version == 1)
-	halfopen_ok = (pktin->type == SSH1_MSG_CHANNEL_OPEN_CONFIRMATION ||
-		       pktin->type == SSH1_MSG_CHANNEL_OPEN_FAILURE);
-    else
-	halfopen_ok = (pktin->type == SSH2_MSG_CHANNEL_OPEN_CONFIRMATION ||
-		       pktin->type == SSH2_MSG_CHANNEL_OPEN_FAILURE);
-    c = find234(ssh->channels, &localid, ssh_channelfind);
+    halfopen_ok = (ssh_chanmsg_desc[ssh->version == 1 ? 0 : 1][pktin->type] &
+		   CHANMSG_HALFOPEN_OK);
+    /*
+     * Consult the one-entry lookup cache before searching the
+     * channels tree: during a bulk transfer virtually every message
+     * is for the same channel as the last one.
+     */
+    c = ssh->channel_cache;
+    if (!c || c->localid != localid)
+	c = ssh->channel_cache =
+	    find234(ssh->channels, &localid, ssh_channelfind);
     if (!c || (c->type != CHAN_SHARING && (c->halfopen != halfopen_ok))) {
 	char *buf = dupprintf("Received %s for %s channel %u",
 			      ssh_pkt_type(ssh, pktin->type),
@@ -8128,7 +9043,16 @@ static void ssh2_msg_channel_window_adjust(Ssh ssh, struct Packet *pktin)
 	return;
     if (!(c->closes & CLOSES_SENT_EOF)) {
 	c->v.v2.remwindow += ssh_pkt_getuint32(pktin);
-	ssh2_try_send_and_unthrottle(ssh, c);
+	/*
+	 * Send the newly permitted data via the fairness scheduler,
+	 * so that a bulk channel's refilled window doesn't let it
+	 * barge ahead of other channels' pending output.
+	 */
+	c->v.v2.defer_send = TRUE;
+	if (!ssh->chandata_flush_scheduled) {
+	    ssh->chandata_flush_scheduled = TRUE;
+	    queue_bulk_callback(ssh2_flush_deferred_chandata, ssh);
+	}
     }
 }
 
@@ -8155,11 +9079,20 @@ static void ssh2_msg_channel_data(Ssh ssh, struct Packet *pktin)
 	/*
 	 * If it looks like the remote end hit the end of its window,
 	 * and we didn't want it to do that, think about using a
-	 * larger window.
+	 * larger window. We double the window each time this happens
+	 * rather than adding a fixed increment, so that it converges on
+	 * the link's bandwidth-delay product within a few round trips
+	 * even on long fat pipes; the winadj mechanism above stops us
+	 * overshooting, since we only grow while the server is genuinely
+	 * running into the acknowledged window.
 	 */
 	if (c->v.v2.remlocwin <= 0 && c->v.v2.throttle_state == UNTHROTTLED &&
-	    c->v.v2.locmaxwin < 0x40000000)
-	    c->v.v2.locmaxwin += OUR_V2_WINSIZE;
+	    c->v.v2.locmaxwin < 0x40000000) {
+	    if (c->v.v2.locmaxwin > 0x40000000 / 2)
+		c->v.v2.locmaxwin = 0x40000000;
+	    else
+		c->v.v2.locmaxwin *= 2;
+	}
 	/*
 	 * If we are not buffering too much data,
 	 * enlarge the window again at the remote side.
@@ -8169,12 +9102,26 @@ static void ssh2_msg_channel_data(Ssh ssh, struct Packet *pktin)
 	 */
 	if (bufsize < c->v.v2.locmaxwin)
 	    ssh2_set_window(c, c->v.v2.locmaxwin - bufsize);
+	else if (c->v.v2.locmaxwin / 2 >= OUR_V2_WINSIZE)
+	    /*
+	     * Conversely, if the consumer is sitting on a whole window's
+	     * worth of data, shrink the window we'll re-offer once it
+	     * drains, so a slow consumer isn't repeatedly handed a
+	     * bandwidth-sized backlog.
+	     */
+	    c->v.v2.locmaxwin /= 2;
 	/*
-	 * If we're either buffering way too much data, or if we're
-	 * buffering anything at all and we're in "simple" mode,
-	 * throttle the whole channel.
+	 * In "simple" mode there's only one data channel, so the
+	 * cheapest flow control is to stop reading the socket until the
+	 * consumer catches up. In multiplexed use we instead rely on the
+	 * channel window: we've stopped widening it above, so a
+	 * conformant server can send at most the window it already
+	 * holds, and the other channels keep flowing. If the server
+	 * overruns the window by a long way regardless, fall back to
+	 * freezing the connection rather than buffering without bound.
 	 */
-	if ((bufsize > c->v.v2.locmaxwin || (ssh_is_simple(ssh) && bufsize>0))
+	if (((ssh_is_simple(ssh) && bufsize > 0) ||
+	     bufsize / 2 > c->v.v2.locmaxwin)
             && !c->throttling_conn) {
 	    c->throttling_conn = 1;
 	    ssh_throttle_conn(ssh, +1);
@@ -8252,9 +9199,7 @@ static void ssh_channel_close_local(struct ssh_channel *c, char const *reason)
         msg = "Forwarded X11 connection terminated";
         break;
       case CHAN_AGENT:
-        if (c->u.a.pending)
-            agent_cancel_query(c->u.a.pending);
-        bufchain_clear(&c->u.a.inbuffer);
+        ssh_agentf_cleanup(c);
 	msg = "Agent-forwarding connection closed";
         break;
       case CHAN_SOCKDATA:
@@ -8278,6 +9223,7 @@ static void ssh_channel_destroy(struct ssh_channel *c)
 
     ssh_channel_close_local(c, NULL);
 
+    ssh_channel_uncache(c);
     del234(ssh->channels, c);
     if (ssh->version == 2) {
         bufchain_clear(&c->v.v2.outbuffer);
@@ -8565,6 +9511,7 @@ static void ssh2_msg_channel_open_failure(Ssh ssh, struct Packet *pktin)
         assert(!"Funny channel type in ssh2_msg_channel_open_failure");
     }
 
+    ssh_channel_uncache(c);
     del234(ssh->channels, c);
     sfree(c);
 }
@@ -8915,7 +9862,9 @@ static void ssh2_msg_channel_open(Ssh ssh, struct Packet *pktin)
 	else {
 	    c->type = CHAN_AGENT;	/* identify channel type */
             bufchain_init(&c->u.a.inbuffer);
-            c->u.a.pending = NULL;
+            c->u.a.req_head = c->u.a.req_tail = NULL;
+            c->u.a.num_outstanding = 0;
+            c->u.a.rejected = FALSE;
 	}
     } else {
 	error = "Unsupported channel type requested";
@@ -9208,6 +10157,90 @@ static void ssh2_setup_env(struct ssh_channel *c, struct Packet *pktin,
     crFinishFreeV;
 }
 
+/*
+ * Case-insensitive search for a string within a length-delimited
+ * buffer (agent key comments are counted strings, not NUL-
+ * terminated). Used to spot which Pageant keys mention the target
+ * host name in their comments.
+ */
+static int ssh2_comment_mentions_host(const char *comment, int commentlen,
+                                      const char *host)
+{
+    int hostlen = strlen(host);
+    int i, j;
+
+    if (hostlen == 0)
+        return FALSE;
+    for (i = 0; i + hostlen <= commentlen; i++) {
+        for (j = 0; j < hostlen; j++)
+            if (tolower((unsigned char)comment[i+j]) !=
+                tolower((unsigned char)host[j]))
+                break;
+        if (j == hostlen)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * Construct a signed SSH-2 "publickey" USERAUTH_REQUEST from a fully
+ * loaded private key, ready for sending. Shared between the ordinary
+ * offer-then-sign path and the fast path that sends a signed request
+ * straight away for a key this host is known to have accepted before.
+ */
+static struct Packet *ssh2_userauth_pubkey_request(Ssh ssh,
+						   struct ssh2_userkey *key)
+{
+    struct Packet *pktout;
+    unsigned char *pkblob, *sigblob, *sigdata;
+    int pkblob_len, sigblob_len, sigdata_len;
+    int p;
+
+    pktout = ssh2_pkt_init(SSH2_MSG_USERAUTH_REQUEST);
+    ssh2_pkt_addstring(pktout, ssh->username);
+    ssh2_pkt_addstring(pktout, "ssh-connection");
+					    /* service requested */
+    ssh2_pkt_addstring(pktout, "publickey");
+					    /* method */
+    ssh2_pkt_addbool(pktout, TRUE);
+					    /* signature follows */
+    ssh2_pkt_addstring(pktout, key->alg->name);
+    pkblob = key->alg->public_blob(key->data, &pkblob_len);
+    ssh2_pkt_addstring_start(pktout);
+    ssh2_pkt_addstring_data(pktout, (char *)pkblob, pkblob_len);
+
+    /*
+     * The data to be signed is:
+     *
+     *   string  session-id
+     *
+     * followed by everything so far placed in the outgoing packet.
+     */
+    sigdata_len = pktout->length - 5 + 4 + ssh->v2_session_id_len;
+    if (ssh->remote_bugs & BUG_SSH2_PK_SESSIONID)
+	sigdata_len -= 4;
+    sigdata = snewn(sigdata_len, unsigned char);
+    p = 0;
+    if (!(ssh->remote_bugs & BUG_SSH2_PK_SESSIONID)) {
+	PUT_32BIT(sigdata+p, ssh->v2_session_id_len);
+	p += 4;
+    }
+    memcpy(sigdata+p, ssh->v2_session_id, ssh->v2_session_id_len);
+    p += ssh->v2_session_id_len;
+    memcpy(sigdata+p, pktout->data + 5, pktout->length - 5);
+    p += pktout->length - 5;
+    assert(p == sigdata_len);
+    sigblob = key->alg->sign(key->data, (char *)sigdata,
+			     sigdata_len, &sigblob_len);
+    ssh2_add_sigblob(ssh, pktout, pkblob, pkblob_len,
+		     sigblob, sigblob_len);
+    sfree(pkblob);
+    sfree(sigblob);
+    sfree(sigdata);
+
+    return pktout;
+}
+
 /*
  * Handle the SSH-2 userauth and connection layers.
  */
@@ -9231,6 +10264,7 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
 	enum {
 	    AUTH_TYPE_NONE,
 		AUTH_TYPE_PUBLICKEY,
+		AUTH_TYPE_PUBLICKEY_CACHED,
 		AUTH_TYPE_PUBLICKEY_OFFER_LOUD,
 		AUTH_TYPE_PUBLICKEY_OFFER_QUIET,
 		AUTH_TYPE_PASSWORD,
@@ -9257,8 +10291,14 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
 	int privatekey_available, privatekey_encrypted;
 	char *publickey_algorithm;
 	char *publickey_comment;
+	char *auth_pk_cached;	       /* fingerprint this host accepted
+					* in a previous session, or NULL */
+	char *auth_pk_fp;	       /* fingerprint of configured key */
+	char *auth_pk_sent_fp;	       /* fingerprint in last signed request */
+	int auth_pk_from_cache;
 	unsigned char agent_request[5], *agent_response, *agentp;
 	int agent_responselen;
+	unsigned char **agent_keyorder;
 	unsigned char *pkblob_in_agent;
 	int keyi, nkeys;
 	char *pkblob, *alg, *commentp;
@@ -9350,8 +10390,23 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
      * Misc one-time setup for authentication.
      */
     s->publickey_blob = NULL;
+    s->auth_pk_cached = s->auth_pk_fp = s->auth_pk_sent_fp = NULL;
     if (!s->we_are_in) {
 
+	/*
+	 * Find out whether a previous session recorded which public
+	 * key this host accepted, so that we can send a signed
+	 * request for that key straight away instead of offering it
+	 * and waiting to be invited. (An empty entry is how a stale
+	 * record is invalidated; treat it as no record at all.)
+	 */
+	s->auth_pk_cached = read_accepted_pubkey(ssh->savedhost,
+						 ssh->savedport);
+	if (s->auth_pk_cached && !*s->auth_pk_cached) {
+	    sfree(s->auth_pk_cached);
+	    s->auth_pk_cached = NULL;
+	}
+
 	/*
 	 * Load the public half of any configured public key file
 	 * for later use.
@@ -9377,6 +10432,9 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
                         logeventf(ssh, "Key file contains public key only");
 		    s->privatekey_encrypted =
 			ssh2_userkey_encrypted(s->keyfile, NULL);
+		    s->auth_pk_fp =
+			ssh2_fingerprint_blob(s->publickey_blob,
+					      s->publickey_bloblen);
 		} else {
 		    char *msgbuf;
 		    logeventf(ssh, "Unable to load key (%s)", 
@@ -9408,6 +10466,7 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
 	 */
 	s->nkeys = 0;
 	s->agent_response = NULL;
+	s->agent_keyorder = NULL;
 	s->pkblob_in_agent = NULL;
 	if (conf_get_int(ssh->conf, CONF_tryagent) && agent_exists()) {
 
@@ -9507,6 +10566,57 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
 			s->nkeys = 0;
 		    }
 		}
+
+		/*
+		 * When no specific key is configured, we get to choose
+		 * the order in which to offer the agent's keys, and
+		 * each refused offer costs a server round trip. So put
+		 * a key this host is recorded as having accepted in a
+		 * previous session at the very front, then keys whose
+		 * comments mention the target host, on the theory that
+		 * users name keys after the places they're used.
+		 */
+		if (!s->publickey_blob && s->nkeys > 1) {
+		    unsigned char *q, *keystart;
+		    int pass, norder, bloblen, commentlen, rank;
+
+		    s->agent_keyorder = snewn(s->nkeys, unsigned char *);
+		    norder = 0;
+		    for (pass = 0; pass < 3 && norder < s->nkeys; pass++) {
+			q = s->agent_response + 5 + 4;
+			for (keyi = 0; keyi < s->nkeys; keyi++) {
+			    keystart = q;
+			    bloblen = toint(GET_32BIT(q));
+			    q += 4 + bloblen;
+			    commentlen = toint(GET_32BIT(q));
+			    q += 4;
+			    rank = 2;
+			    if (s->auth_pk_cached) {
+				char *fp = ssh2_fingerprint_blob(keystart + 4,
+								 bloblen);
+				if (!strcmp(fp, s->auth_pk_cached))
+				    rank = 0;
+				sfree(fp);
+			    }
+			    if (rank != 0 &&
+				ssh2_comment_mentions_host(
+				    (char *)q, commentlen, ssh->savedhost))
+				rank = 1;
+			    q += commentlen;
+			    if (rank == pass) {
+				if (pass == 0)
+				    logeventf(ssh, "Pageant key #%d was "
+					      "accepted by this host before; "
+					      "trying it first", keyi);
+				else if (pass == 1)
+				    logeventf(ssh, "Pageant key #%d comment "
+					      "mentions '%s'; trying it first",
+					      keyi, ssh->savedhost);
+				s->agent_keyorder[norder++] = keystart;
+			    }
+			}
+		    }
+		}
 	    } else {
                 logevent("Failed to get reply from Pageant");
 	    }
@@ -9585,18 +10695,60 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
 	s->got_username = TRUE;
 
 	/*
-	 * Send an authentication request using method "none": (a)
-	 * just in case it succeeds, and (b) so that we know what
-	 * authentication methods we can usefully try next.
+	 * If this host accepted our configured public key last time,
+	 * and the key needs no passphrase, skip the exploratory
+	 * "none" request and the public-key offer entirely: sign and
+	 * send the real authentication request straight away,
+	 * collapsing the usual three round trips into one. If the
+	 * server has changed its mind, its refusal carries the same
+	 * list of available methods the "none" request would have
+	 * fetched, so all we've lost is one packet.
 	 */
-	ssh->pkt_actx = SSH2_PKTCTX_NOAUTH;
+	s->auth_pk_from_cache = FALSE;
+	if (s->auth_pk_cached && s->auth_pk_fp &&
+	    !strcmp(s->auth_pk_cached, s->auth_pk_fp) &&
+	    s->privatekey_available && !s->privatekey_encrypted) {
+	    struct ssh2_userkey *key;  /* not live over crReturn */
+	    const char *error;	       /* not live over crReturn */
 
-	s->pktout = ssh2_pkt_init(SSH2_MSG_USERAUTH_REQUEST);
-	ssh2_pkt_addstring(s->pktout, ssh->username);
-	ssh2_pkt_addstring(s->pktout, "ssh-connection");/* service requested */
-	ssh2_pkt_addstring(s->pktout, "none");    /* method */
-	ssh2_pkt_send(ssh, s->pktout);
-	s->type = AUTH_TYPE_NONE;
+	    s->keyfile = conf_get_filename(ssh->conf, CONF_keyfile);
+	    key = ssh2_load_userkey(s->keyfile, NULL, &error);
+	    if (key && key != SSH2_WRONG_PASSPHRASE) {
+		logevent("Host previously accepted our public key; "
+			 "sending signed request without an offer");
+		ssh->pkt_actx = SSH2_PKTCTX_PUBLICKEY;
+		s->pktout = ssh2_userauth_pubkey_request(ssh, key);
+		ssh2_pkt_send(ssh, s->pktout);
+		logevent("Sent public key signature");
+		s->type = AUTH_TYPE_PUBLICKEY_CACHED;
+		sfree(s->auth_pk_sent_fp);
+		s->auth_pk_sent_fp = dupstr(s->auth_pk_fp);
+		key->alg->freekey(key->data);
+		sfree(key->comment);
+		sfree(key);
+		s->auth_pk_from_cache = TRUE;
+	    } else {
+		logeventf(ssh, "Unable to load key for cached "
+			  "authentication attempt (%s)", error);
+	    }
+	}
+
+	if (!s->auth_pk_from_cache) {
+	    /*
+	     * Send an authentication request using method "none": (a)
+	     * just in case it succeeds, and (b) so that we know what
+	     * authentication methods we can usefully try next.
+	     */
+	    ssh->pkt_actx = SSH2_PKTCTX_NOAUTH;
+
+	    s->pktout = ssh2_pkt_init(SSH2_MSG_USERAUTH_REQUEST);
+	    ssh2_pkt_addstring(s->pktout, ssh->username);
+	    ssh2_pkt_addstring(s->pktout, "ssh-connection");
+						    /* service requested */
+	    ssh2_pkt_addstring(s->pktout, "none");    /* method */
+	    ssh2_pkt_send(ssh, s->pktout);
+	    s->type = AUTH_TYPE_NONE;
+	}
 	s->gotit = FALSE;
 	s->we_are_in = FALSE;
 
@@ -9649,6 +10801,21 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
 	    }
 	    if (pktin->type == SSH2_MSG_USERAUTH_SUCCESS) {
 		logevent("Access granted");
+		ssh_log_setup_phase(ssh, "authentication completed");
+		if ((s->type == AUTH_TYPE_PUBLICKEY ||
+		     s->type == AUTH_TYPE_PUBLICKEY_CACHED) &&
+		    s->auth_pk_sent_fp &&
+		    (!s->auth_pk_cached ||
+		     strcmp(s->auth_pk_cached, s->auth_pk_sent_fp))) {
+		    /*
+		     * Remember which key worked, so that the next
+		     * connection to this host can send a signed
+		     * request for it without the preliminary round
+		     * trips.
+		     */
+		    store_accepted_pubkey(ssh->savedhost, ssh->savedport,
+					  s->auth_pk_sent_fp);
+		}
 		s->we_are_in = s->userauth_success = TRUE;
 		break;
 	    }
@@ -9707,6 +10874,19 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
                                     " despite accepting key!\r\n");
                         logevent("Server refused public-key signature"
                                  " despite accepting key!");
+                    } else if (s->type == AUTH_TYPE_PUBLICKEY_CACHED) {
+                        /*
+                         * The key this host accepted in a previous
+                         * session is no longer good. Forget it and
+                         * fall back to offering keys the usual way;
+                         * the refusal has already told us which
+                         * methods remain available.
+                         */
+                        logevent("Server refused previously accepted key");
+                        store_accepted_pubkey(ssh->savedhost, ssh->savedport,
+                                              "");
+                        sfree(s->auth_pk_cached);
+                        s->auth_pk_cached = NULL;
 		    } else if (s->type==AUTH_TYPE_KEYBOARD_INTERACTIVE_QUIET) {
                         /* quiet, so no c_write */
                         logevent("Server refused keyboard-interactive authentication");
@@ -9771,6 +10951,8 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
 		logeventf(ssh, "Trying Pageant key #%d", s->keyi);
 
 		/* Unpack key from agent response */
+		if (s->agent_keyorder)
+		    s->agentp = s->agent_keyorder[s->keyi];
 		s->pklen = toint(GET_32BIT(s->agentp));
 		s->agentp += 4;
 		s->pkblob = (char *)s->agentp;
@@ -9783,23 +10965,43 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
 		s->agentp += s->commentlen;
 		/* s->agentp now points at next key, if any */
 
-		/* See if server will accept it */
-		s->pktout = ssh2_pkt_init(SSH2_MSG_USERAUTH_REQUEST);
-		ssh2_pkt_addstring(s->pktout, ssh->username);
-		ssh2_pkt_addstring(s->pktout, "ssh-connection");
-						    /* service requested */
-		ssh2_pkt_addstring(s->pktout, "publickey");
-						    /* method */
-		ssh2_pkt_addbool(s->pktout, FALSE); /* no signature included */
-		ssh2_pkt_addstring_start(s->pktout);
-		ssh2_pkt_addstring_data(s->pktout, s->alg, s->alglen);
-		ssh2_pkt_addstring_start(s->pktout);
-		ssh2_pkt_addstring_data(s->pktout, s->pkblob, s->pklen);
-		ssh2_pkt_send(ssh, s->pktout);
-		s->type = AUTH_TYPE_PUBLICKEY_OFFER_QUIET;
+		/*
+		 * If this host accepted this very key in a previous
+		 * session, skip the offer round trip and go straight
+		 * to asking the agent for a signature.
+		 */
+		s->auth_pk_from_cache = FALSE;
+		if (s->auth_pk_cached) {
+		    char *fp = ssh2_fingerprint_blob(s->pkblob, s->pklen);
+		    s->auth_pk_from_cache = !strcmp(fp, s->auth_pk_cached);
+		    sfree(fp);
+		}
 
-		crWaitUntilV(pktin);
-		if (pktin->type != SSH2_MSG_USERAUTH_PK_OK) {
+		if (!s->auth_pk_from_cache) {
+		    /* See if server will accept it */
+		    s->pktout = ssh2_pkt_init(SSH2_MSG_USERAUTH_REQUEST);
+		    ssh2_pkt_addstring(s->pktout, ssh->username);
+		    ssh2_pkt_addstring(s->pktout, "ssh-connection");
+							/* service requested */
+		    ssh2_pkt_addstring(s->pktout, "publickey");
+							/* method */
+		    ssh2_pkt_addbool(s->pktout, FALSE);
+							/* no signature included */
+		    ssh2_pkt_addstring_start(s->pktout);
+		    ssh2_pkt_addstring_data(s->pktout, s->alg, s->alglen);
+		    ssh2_pkt_addstring_start(s->pktout);
+		    ssh2_pkt_addstring_data(s->pktout, s->pkblob, s->pklen);
+		    ssh2_pkt_send(ssh, s->pktout);
+		    s->type = AUTH_TYPE_PUBLICKEY_OFFER_QUIET;
+
+		    crWaitUntilV(pktin);
+		} else {
+		    logevent("Host previously accepted this key; "
+			     "skipping the offer round trip");
+		}
+
+		if (!s->auth_pk_from_cache &&
+		    pktin->type != SSH2_MSG_USERAUTH_PK_OK) {
 
 		    /* Offer of key refused. */
 		    s->gotit = TRUE;
@@ -9891,7 +11093,12 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
 					     s->ret + 9,
 					     GET_32BIT(s->ret + 5));
 			    ssh2_pkt_send(ssh, s->pktout);
-			    s->type = AUTH_TYPE_PUBLICKEY;
+			    s->type = s->auth_pk_from_cache ?
+				AUTH_TYPE_PUBLICKEY_CACHED :
+				AUTH_TYPE_PUBLICKEY;
+			    sfree(s->auth_pk_sent_fp);
+			    s->auth_pk_sent_fp =
+				ssh2_fingerprint_blob(s->pkblob, s->pklen);
 			} else {
 			    /* FIXME: less drastic response */
 			    bombout(("Pageant failed to answer challenge"));
@@ -9924,31 +11131,42 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
 		 * Try the public key supplied in the configuration.
 		 *
 		 * First, offer the public blob to see if the server is
-		 * willing to accept it.
+		 * willing to accept it - unless this host is recorded
+		 * as having accepted this very key in a previous
+		 * session, in which case skip straight to the signed
+		 * request.
 		 */
-		s->pktout = ssh2_pkt_init(SSH2_MSG_USERAUTH_REQUEST);
-		ssh2_pkt_addstring(s->pktout, ssh->username);
-		ssh2_pkt_addstring(s->pktout, "ssh-connection");
-						/* service requested */
-		ssh2_pkt_addstring(s->pktout, "publickey");	/* method */
-		ssh2_pkt_addbool(s->pktout, FALSE);
-						/* no signature included */
-		ssh2_pkt_addstring(s->pktout, s->publickey_algorithm);
-		ssh2_pkt_addstring_start(s->pktout);
-		ssh2_pkt_addstring_data(s->pktout,
-					(char *)s->publickey_blob,
-					s->publickey_bloblen);
-		ssh2_pkt_send(ssh, s->pktout);
-		logevent("Offered public key");
+		s->auth_pk_from_cache = (s->auth_pk_cached && s->auth_pk_fp &&
+					 !strcmp(s->auth_pk_cached,
+						 s->auth_pk_fp));
+		if (!s->auth_pk_from_cache) {
+		    s->pktout = ssh2_pkt_init(SSH2_MSG_USERAUTH_REQUEST);
+		    ssh2_pkt_addstring(s->pktout, ssh->username);
+		    ssh2_pkt_addstring(s->pktout, "ssh-connection");
+						    /* service requested */
+		    ssh2_pkt_addstring(s->pktout, "publickey"); /* method */
+		    ssh2_pkt_addbool(s->pktout, FALSE);
+						    /* no signature included */
+		    ssh2_pkt_addstring(s->pktout, s->publickey_algorithm);
+		    ssh2_pkt_addstring_start(s->pktout);
+		    ssh2_pkt_addstring_data(s->pktout,
+					    (char *)s->publickey_blob,
+					    s->publickey_bloblen);
+		    ssh2_pkt_send(ssh, s->pktout);
+		    logevent("Offered public key");
 
-		crWaitUntilV(pktin);
-		if (pktin->type != SSH2_MSG_USERAUTH_PK_OK) {
-		    /* Key refused. Give up. */
-		    s->gotit = TRUE; /* reconsider message next loop */
-		    s->type = AUTH_TYPE_PUBLICKEY_OFFER_LOUD;
-		    continue; /* process this new message */
+		    crWaitUntilV(pktin);
+		    if (pktin->type != SSH2_MSG_USERAUTH_PK_OK) {
+			/* Key refused. Give up. */
+			s->gotit = TRUE; /* reconsider message next loop */
+			s->type = AUTH_TYPE_PUBLICKEY_OFFER_LOUD;
+			continue; /* process this new message */
+		    }
+		    logevent("Offer of public key accepted");
+		} else {
+		    logevent("Host previously accepted this public key; "
+			     "skipping the offer round trip");
 		}
-		logevent("Offer of public key accepted");
 
 		/*
 		 * Actually attempt a serious authentication using
@@ -10025,66 +11243,19 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
 		}
 
 		if (key) {
-		    unsigned char *pkblob, *sigblob, *sigdata;
-		    int pkblob_len, sigblob_len, sigdata_len;
-		    int p;
-
 		    /*
 		     * We have loaded the private key and the server
-		     * has announced that it's willing to accept it.
+		     * has announced that it's willing to accept it
+		     * (either just now or in a previous session).
 		     * Hallelujah. Generate a signature and send it.
 		     */
-		    s->pktout = ssh2_pkt_init(SSH2_MSG_USERAUTH_REQUEST);
-		    ssh2_pkt_addstring(s->pktout, ssh->username);
-		    ssh2_pkt_addstring(s->pktout, "ssh-connection");
-						    /* service requested */
-		    ssh2_pkt_addstring(s->pktout, "publickey");
-						    /* method */
-		    ssh2_pkt_addbool(s->pktout, TRUE);
-						    /* signature follows */
-		    ssh2_pkt_addstring(s->pktout, key->alg->name);
-		    pkblob = key->alg->public_blob(key->data,
-						   &pkblob_len);
-		    ssh2_pkt_addstring_start(s->pktout);
-		    ssh2_pkt_addstring_data(s->pktout, (char *)pkblob,
-					    pkblob_len);
-
-		    /*
-		     * The data to be signed is:
-		     *
-		     *   string  session-id
-		     *
-		     * followed by everything so far placed in the
-		     * outgoing packet.
-		     */
-		    sigdata_len = s->pktout->length - 5 + 4 +
-			ssh->v2_session_id_len;
-		    if (ssh->remote_bugs & BUG_SSH2_PK_SESSIONID)
-			sigdata_len -= 4;
-		    sigdata = snewn(sigdata_len, unsigned char);
-		    p = 0;
-		    if (!(ssh->remote_bugs & BUG_SSH2_PK_SESSIONID)) {
-			PUT_32BIT(sigdata+p, ssh->v2_session_id_len);
-			p += 4;
-		    }
-		    memcpy(sigdata+p, ssh->v2_session_id,
-			   ssh->v2_session_id_len);
-		    p += ssh->v2_session_id_len;
-		    memcpy(sigdata+p, s->pktout->data + 5,
-			   s->pktout->length - 5);
-		    p += s->pktout->length - 5;
-		    assert(p == sigdata_len);
-		    sigblob = key->alg->sign(key->data, (char *)sigdata,
-					     sigdata_len, &sigblob_len);
-		    ssh2_add_sigblob(ssh, s->pktout, pkblob, pkblob_len,
-				     sigblob, sigblob_len);
-		    sfree(pkblob);
-		    sfree(sigblob);
-		    sfree(sigdata);
-
+		    s->pktout = ssh2_userauth_pubkey_request(ssh, key);
 		    ssh2_pkt_send(ssh, s->pktout);
                     logevent("Sent public key signature");
-		    s->type = AUTH_TYPE_PUBLICKEY;
+		    s->type = s->auth_pk_from_cache ?
+			AUTH_TYPE_PUBLICKEY_CACHED : AUTH_TYPE_PUBLICKEY;
+		    sfree(s->auth_pk_sent_fp);
+		    s->auth_pk_sent_fp = dupstr(s->auth_pk_fp);
 		    key->alg->freekey(key->data);
                     sfree(key->comment);
                     sfree(key);
@@ -10693,6 +11864,10 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
     }
     if (s->agent_response)
 	sfree(s->agent_response);
+    sfree(s->agent_keyorder);
+    sfree(s->auth_pk_cached);
+    sfree(s->auth_pk_fp);
+    sfree(s->auth_pk_sent_fp);
 
     if (s->userauth_success && !ssh->bare_connection) {
 	/*
@@ -10709,6 +11884,7 @@ static void do_ssh2_authconn(Ssh ssh, const unsigned char *in, int inlen,
     }
 
     ssh->channels = newtree234(ssh_channelcmp);
+    ssh->channel_cache = NULL;
 
     /*
      * Set up handlers for some connection protocol messages, so we
@@ -11139,6 +12315,11 @@ static void ssh2_timer(void *ctx, unsigned long now)
     if (ssh->state == SSH_STATE_CLOSED)
 	return;
 
+    if (!ssh->kex_in_progress && !ssh->bare_connection &&
+        conf_get_int(ssh->conf, CONF_ssh_rekey_time) != 0 &&
+	now == ssh->next_kex_precomp)
+	ssh2_precompute_kex(ssh);
+
     if (!ssh->kex_in_progress && !ssh->bare_connection &&
         conf_get_int(ssh->conf, CONF_ssh_rekey_time) != 0 &&
 	now == ssh->next_rekey) {
@@ -11263,6 +12444,15 @@ static const char *ssh_init(void *frontend_handle, void **backend_handle,
     ssh->queueing = FALSE;
     ssh->qhead = ssh->qtail = NULL;
     ssh->deferred_rekey_reason = NULL;
+    ssh->precomp_kex_ctx = NULL;
+    ssh->precomp_kex_e = NULL;
+    ssh->precomp_kex_alg = NULL;
+    ssh->precomp_kex_nbits = 0;
+    ssh->kex_offload = NULL;
+    ssh->kex_nbits = 0;
+    ssh->next_kex_precomp = 0;
+    ssh->chandata_flush_scheduled = FALSE;
+    ssh->chandata_rr_start = 0;
     bufchain_init(&ssh->queued_incoming_data);
     ssh->frozen = FALSE;
     ssh->username = NULL;
@@ -11289,6 +12479,7 @@ static const char *ssh_init(void *frontend_handle, void **backend_handle,
     ssh->term_height = conf_get_int(ssh->conf, CONF_height);
 
     ssh->channels = NULL;
+    ssh->channel_cache = NULL;
     ssh->rportfwds = NULL;
     ssh->portfwds = NULL;
 
@@ -11307,6 +12498,10 @@ static const char *ssh_init(void *frontend_handle, void **backend_handle,
 
     ssh->incoming_data_size = ssh->outgoing_data_size =
 	ssh->deferred_data_size = 0L;
+    ssh->stat_bytes_in = ssh->stat_bytes_out = 0L;
+    ssh->stat_pkts_in = ssh->stat_pkts_out = 0L;
+    ssh->stat_winstalls = ssh->stat_kexes = 0L;
+    ssh->stat_rdpkt_clocks = ssh->stat_dispatch_clocks = 0;
     ssh->max_data_size = parse_blocksize(conf_get_str(ssh->conf,
 						      CONF_ssh_rekey_data));
     ssh->kex_in_progress = FALSE;
@@ -11342,6 +12537,11 @@ static void ssh_free(void *handle)
     struct X11FakeAuth *auth;
     int need_random_unref;
 
+#ifdef SSH_PKT_PROFILE
+    if (pkt_prof.pkts)
+	ssh_pkt_profile_dump(ssh);
+#endif
+
     if (ssh->v1_cipher_ctx)
 	ssh->cipher->free_context(ssh->v1_cipher_ctx);
     if (ssh->cs_cipher_ctx)
@@ -11364,8 +12564,20 @@ static void ssh_free(void *handle)
 	else
 	    zlib_decompress_cleanup(ssh->sc_comp_ctx);
     }
+    if (ssh->kex_offload) {
+	/*
+	 * An offloaded kex computation is still in flight; wait for
+	 * the work function to finish with the DH context before we
+	 * free it. The completion callback will then find job->ssh
+	 * NULL and clean the job itself up.
+	 */
+	offload_wait();
+	ssh->kex_offload->ssh = NULL;
+	ssh->kex_offload = NULL;
+    }
     if (ssh->kex_ctx)
 	dh_cleanup(ssh->kex_ctx);
+    ssh2_free_precomputed_kex(ssh);
     sfree(ssh->savedhost);
 
     while (ssh->queuelen-- > 0)
@@ -11397,6 +12609,7 @@ static void ssh_free(void *handle)
 	}
 	freetree234(ssh->channels);
 	ssh->channels = NULL;
+	ssh->channel_cache = NULL;
     }
 
     if (ssh->connshare)
@@ -11444,8 +12657,15 @@ static void ssh_free(void *handle)
 	ssh_gss_cleanup(ssh->gsslibs);
 #endif
     need_random_unref = ssh->need_random_unref;
+    delete_callbacks_for_context(ssh);
     sfree(ssh);
 
+    /*
+     * With the connection gone this is a quiet moment, so batch-wipe
+     * all the sensitive buffers the secure pool has accumulated.
+     */
+    secure_pool_wipe();
+
     if (need_random_unref)
         random_unref();
 }
@@ -11610,6 +12830,41 @@ static void ssh_size(void *handle, int width, int height)
  * Return a list of the special codes that make sense in this
  * protocol.
  */
+/*
+ * Write a snapshot of the cumulative session statistics to the Event
+ * Log, in response to the TS_STATS special. The aim is to make it
+ * possible to tell from a live session whether sluggishness is down
+ * to the network, the crypto, or the far end sitting on a full
+ * channel window, without attaching a profiler.
+ */
+static void ssh_log_stats(Ssh ssh)
+{
+    logeventf(ssh, "Session statistics: %lu bytes in (%lu packets), "
+	      "%lu bytes out (%lu packets)",
+	      ssh->stat_bytes_in, ssh->stat_pkts_in,
+	      ssh->stat_bytes_out, ssh->stat_pkts_out);
+    logeventf(ssh, "Session statistics: %lu key exchange%s completed; "
+	      "send stalled on a full channel window %lu time%s",
+	      ssh->stat_kexes, ssh->stat_kexes == 1 ? "" : "s",
+	      ssh->stat_winstalls, ssh->stat_winstalls == 1 ? "" : "s");
+    logeventf(ssh, "Session statistics: %.3f s of processor time spent "
+	      "reading and decrypting packets, %.3f s dispatching them",
+	      (double)ssh->stat_rdpkt_clocks / CLOCKS_PER_SEC,
+	      (double)ssh->stat_dispatch_clocks / CLOCKS_PER_SEC);
+}
+
+#ifdef MALLOC_ACCOUNTING
+/*
+ * Printing callback for malloc_account_report(), in response to the
+ * TS_MEMSTATS special: each line of the report goes to the Event Log.
+ */
+static void ssh_log_memstats_line(void *ctx, const char *line)
+{
+    Ssh ssh = (Ssh) ctx;
+    logevent(line);
+}
+#endif
+
 static const struct telnet_special *ssh_get_specials(void *handle)
 {
     static const struct telnet_special ssh1_ignore_special[] = {
@@ -11698,6 +12953,22 @@ static const struct telnet_special *ssh_get_specials(void *handle)
         }
     } /* else we're not ready yet */
 
+    if (ssh->version) {
+	static const struct telnet_special stats_special[] = {
+	    {NULL, TS_SEP},
+	    {"Write session statistics to Event Log", TS_STATS},
+	};
+#ifdef MALLOC_ACCOUNTING
+	static const struct telnet_special memstats_special[] = {
+	    {"Write memory statistics to Event Log", TS_MEMSTATS},
+	};
+#endif
+	ADD_SPECIALS(stats_special);
+#ifdef MALLOC_ACCOUNTING
+	ADD_SPECIALS(memstats_special);
+#endif
+    }
+
     if (nspecials)
 	ADD_SPECIALS(specials_end);
 
@@ -11756,6 +13027,12 @@ static void ssh_special(void *handle, Telnet_Special code)
             ssh->version == 2) {
 	    do_ssh2_transport(ssh, "at user request", -1, NULL);
 	}
+    } else if (code == TS_STATS) {
+	ssh_log_stats(ssh);
+#ifdef MALLOC_ACCOUNTING
+    } else if (code == TS_MEMSTATS) {
+	malloc_account_report(ssh_log_memstats_line, ssh);
+#endif
     } else if (code >= TS_LOCALSTART) {
         ssh->hostkey = hostkey_algs[code - TS_LOCALSTART].alg;
         ssh->cross_certifying = TRUE;
@@ -145,6 +145,12 @@ struct ec_curve {
     const char *name, *textname;
     unsigned int fieldBits;
     Bignum p;
+    /* Optional fast reduction modulo p, for primes with special
+     * structure (the NIST Solinas primes); NULL means reduce
+     * generically with bigmod. fieldMul similarly replaces modmul
+     * with a fused multiply-and-reduce when non-NULL. */
+    Bignum (*fieldMod)(Bignum);
+    Bignum (*fieldMul)(Bignum, Bignum);
     union {
         struct ec_wcurve w;
         struct ec_mcurve m;
@@ -298,6 +304,33 @@ void SHA384_Init(SHA384_State * s);
 void SHA384_Final(SHA384_State * s, unsigned char *output);
 void SHA384_Simple(const void *p, int len, unsigned char *output);
 
+/*
+ * A union big enough for the state of any hash exposed through
+ * struct ssh_hash below, so that callers can declare one of these on
+ * the stack and use the init_ctx/final_ctx interface without heap
+ * allocation.
+ */
+typedef union ssh_hash_ctx {
+    SHA_State sha1;
+    SHA256_State sha256;
+    SHA512_State sha512;
+} ssh_hash_ctx;
+
+/*
+ * Unified runtime CPU feature detection (sshcpu.c), used by the
+ * crypto modules to decide between their portable C code and a
+ * hardware-accelerated path. The flags name capabilities rather than
+ * instruction sets, so each module can ask the same question on any
+ * architecture: on x86 SSH_CPU_HWAES means AES-NI (plus the SSE4.1
+ * the AES-NI code also uses), on Arm it means the ARMv8 AES crypto
+ * extension, and so on.
+ */
+#define SSH_CPU_HWAES     0x0001       /* AES-NI / ARMv8 AES */
+#define SSH_CPU_HWSHA1    0x0002       /* x86 SHA exts / ARMv8 SHA1 */
+#define SSH_CPU_HWSHA256  0x0004       /* x86 SHA exts / ARMv8 SHA2 */
+#define SSH_CPU_VECTOR    0x0008       /* SSE2 / NEON */
+int ssh_cpu_has(int features);	       /* true iff all 'features' present */
+
 struct ssh_mac;
 struct ssh_cipher {
     void *(*make_context)(void);
@@ -371,9 +404,22 @@ struct ssh_hash {
     void (*bytes)(void *, const void *, int);
     void (*final)(void *, unsigned char *); /* also frees context */
     void (*free)(void *);
+    /*
+     * Variants of init and final operating on caller-provided
+     * storage of 'ctxsize' bytes, for hot paths (kex hashing, key
+     * derivation) that want to avoid the allocator entirely. A
+     * context set up this way can be duplicated with an ordinary
+     * memcpy of ctxsize bytes; final_ctx wipes the storage but, of
+     * course, does not free it. 'simple' hashes a single buffer in
+     * one call with no context management at all.
+     */
+    int ctxsize;
+    void (*init_ctx)(void *);
+    void (*final_ctx)(void *, unsigned char *);
+    void (*simple)(const void *, int, unsigned char *);
     int hlen; /* output length in bytes */
     const char *text_name;
-};   
+};
 
 struct ssh_kex {
     const char *name, *groupname;
@@ -425,7 +471,7 @@ struct ssh_compress {
     /* For zlib@openssh.com: if non-NULL, this name will be considered once
      * userauth has completed successfully. */
     const char *delayed_name;
-    void *(*compress_init) (void);
+    void *(*compress_init) (int level);
     void (*compress_cleanup) (void *);
     int (*compress) (void *, unsigned char *block, int len,
 		     unsigned char **outblock, int *outlen);
@@ -554,6 +600,19 @@ struct X11Display {
     int localauthproto;
     unsigned char *localauthdata;
     int localauthdatalen;
+
+    /* Where the local auth details were read from, and the file's
+     * modification time when we read it, so that a long-lived session
+     * can spot the file changing and re-read it. */
+    char *authfilename;
+    unsigned long authfile_mtime;
+
+    /* A spare pre-opened connection to the display, so that each new
+     * forwarded X client needn't pay the connect latency, and the
+     * plug that babysits it while it waits in the pool. */
+    const struct plug_function_table *sparefn;
+    Socket sparesock;
+    int spare_dead;
 };
 struct X11FakeAuth {
     /* Auth details we invented for a virtual display on the SSH server. */
@@ -638,6 +697,10 @@ void bn_restore_invariant(Bignum b);
 Bignum bignum_from_long(unsigned long n);
 void freebn(Bignum b);
 Bignum modpow(Bignum base, Bignum exp, Bignum mod);
+typedef struct MontyContext MontyContext;
+MontyContext *monty_new(Bignum mod);   /* mod must be odd */
+void monty_free(MontyContext *mc);
+Bignum monty_modpow(MontyContext *mc, Bignum base, Bignum exp);
 Bignum modmul(Bignum a, Bignum b, Bignum mod);
 Bignum modsub(const Bignum a, const Bignum b, const Bignum n);
 void decbn(Bignum n);
@@ -662,6 +725,10 @@ Bignum bigmul(Bignum a, Bignum b);
 Bignum bigmuladd(Bignum a, Bignum b, Bignum addend);
 Bignum bigdiv(Bignum a, Bignum b);
 Bignum bigmod(Bignum a, Bignum b);
+Bignum bignum_nistp256_mod(Bignum x);
+Bignum bignum_nistp384_mod(Bignum x);
+Bignum bignum_nistp256_mulmod(Bignum a, Bignum b);
+Bignum bignum_nistp384_mulmod(Bignum a, Bignum b);
 Bignum modinv(Bignum number, Bignum modulus);
 Bignum bignum_bitmask(Bignum number);
 Bignum bignum_rshift(Bignum number, int shift);
@@ -678,6 +745,8 @@ int dh_is_gex(const struct ssh_kex *kex);
 void *dh_setup_group(const struct ssh_kex *kex);
 void *dh_setup_gex(Bignum pval, Bignum gval);
 void dh_cleanup(void *);
+void dh_gen_x(void *, int nbits);
+Bignum dh_compute_e(void *);
 Bignum dh_create_e(void *, int nbits);
 const char *dh_validate_f(void *handle, Bignum f);
 Bignum dh_find_K(void *, Bignum f);
@@ -825,10 +894,11 @@ void invent_firstbits(unsigned *one, unsigned *two);
 /*
  * zlib compression.
  */
-void *zlib_compress_init(void);
+void *zlib_compress_init(int level);
 void zlib_compress_cleanup(void *);
 void *zlib_decompress_init(void);
 void zlib_decompress_cleanup(void *);
+void zlib_compress_finish(void *, unsigned char **outblock, int *outlen);
 int zlib_compress_block(void *, unsigned char *block, int len,
 			unsigned char **outblock, int *outlen);
 int zlib_decompress_block(void *, unsigned char *block, int len,
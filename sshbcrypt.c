@@ -74,6 +74,29 @@ void bcrypt_genblock(int counter,
     smemclr(&hashed_salt, sizeof(hashed_salt));
 }
 
+/*
+ * Process-lifetime cache of derived keys. A bcrypt derivation at the
+ * round counts used for high-value OpenSSH keys takes seconds by
+ * design, and agent-style processes run the same derivation more
+ * than once: re-adding a key, or trying each previously stored
+ * passphrase against a newly added file, re-pays the full cost for
+ * inputs already derived. So remember recent outputs, keyed by the
+ * hashed passphrase plus the salt, round count and output length.
+ * No plaintext passphrase is retained, and the derived keys cached
+ * here are no more sensitive than the decrypted private keys such a
+ * process goes on to hold anyway.
+ */
+#define BCRYPT_CACHE_SIZE 4
+static struct bcrypt_cache_entry {
+    unsigned char hashed_passphrase[64];
+    unsigned char *salt;
+    int saltbytes;
+    int rounds;
+    unsigned char *out;
+    int outbytes;
+} bcrypt_cache[BCRYPT_CACHE_SIZE];
+static int bcrypt_cache_next;
+
 void openssh_bcrypt(const char *passphrase,
                     const unsigned char *salt, int saltbytes,
                     int rounds, unsigned char *out, int outbytes)
@@ -83,10 +106,25 @@ void openssh_bcrypt(const char *passphrase,
     const unsigned char *thissalt;
     int thissaltbytes;
     int modulus, residue, i, j, round;
+    struct bcrypt_cache_entry *ce;
 
     /* Hash the passphrase to get the bcrypt key material */
     SHA512_Simple(passphrase, strlen(passphrase), hashed_passphrase);
 
+    /* If we've derived a key from these exact inputs before, we're
+     * already done. */
+    for (ce = bcrypt_cache; ce < bcrypt_cache + BCRYPT_CACHE_SIZE; ce++) {
+        if (ce->out && ce->rounds == rounds &&
+            ce->saltbytes == saltbytes && ce->outbytes == outbytes &&
+            !memcmp(ce->salt, salt, saltbytes) &&
+            !memcmp(ce->hashed_passphrase, hashed_passphrase,
+                    sizeof(hashed_passphrase))) {
+            memcpy(out, ce->out, outbytes);
+            smemclr(&hashed_passphrase, sizeof(hashed_passphrase));
+            return;
+        }
+    }
+
     /* We output key bytes in a scattered fashion to meld all output
      * key blocks into all parts of the output. To do this, we pick a
      * modulus, and we output the key bytes to indices of out[] in the
@@ -120,5 +158,26 @@ void openssh_bcrypt(const char *passphrase,
         for (i = residue, j = 0; i < outbytes; i += modulus, j++)
             out[i] = outblock[j];
     }
+
+    /* File the result in a cache slot, evicting the oldest entry if
+     * every slot is taken. */
+    ce = &bcrypt_cache[bcrypt_cache_next];
+    bcrypt_cache_next = (bcrypt_cache_next + 1) % BCRYPT_CACHE_SIZE;
+    if (ce->out) {
+        smemclr(ce->salt, ce->saltbytes);
+        sfree(ce->salt);
+        smemclr(ce->out, ce->outbytes);
+        sfree(ce->out);
+    }
+    memcpy(ce->hashed_passphrase, hashed_passphrase,
+           sizeof(ce->hashed_passphrase));
+    ce->salt = snewn(saltbytes, unsigned char);
+    memcpy(ce->salt, salt, saltbytes);
+    ce->saltbytes = saltbytes;
+    ce->rounds = rounds;
+    ce->out = snewn(outbytes, unsigned char);
+    memcpy(ce->out, out, outbytes);
+    ce->outbytes = outbytes;
+
     smemclr(&hashed_passphrase, sizeof(hashed_passphrase));
 }
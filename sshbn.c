@@ -44,7 +44,7 @@ static Bignum newbn(int length)
 
     assert(length >= 0 && length < INT_MAX / BIGNUM_INT_BITS);
 
-    b = snewn(length + 1, BignumInt);
+    b = secure_pool_alloc((length + 1) * sizeof(*b));
     memset(b, 0, (length + 1) * sizeof(*b));
     b[0] = length;
     return b;
@@ -58,7 +58,7 @@ void bn_restore_invariant(Bignum b)
 
 Bignum copybn(Bignum orig)
 {
-    Bignum b = snewn(orig[0] + 1, BignumInt);
+    Bignum b = secure_pool_alloc((orig[0] + 1) * sizeof(*b));
     if (!b)
 	abort();		       /* FIXME */
     memcpy(b, orig, (orig[0] + 1) * sizeof(*b));
@@ -68,10 +68,11 @@ Bignum copybn(Bignum orig)
 void freebn(Bignum b)
 {
     /*
-     * Burn the evidence, just in case.
+     * No need to burn the evidence here: the block goes back into
+     * the secure pool's locked pages, and is scrubbed in batch by
+     * secure_pool_wipe at the next quiet point.
      */
-    smemclr(b, sizeof(b[0]) * (b[0] + 1));
-    sfree(b);
+    secure_pool_free(b);
 }
 
 Bignum bn_power_2(int n)
@@ -498,6 +499,64 @@ static void monty_reduce(BignumInt *x, const BignumInt *n,
         internal_sub(x+len, n, x+len, len);
 }
 
+/*
+ * Compute the multiplicative inverse of n mod r, where n is odd and r
+ * = 2^(len * BIGNUM_INT_BITS) is the Montgomery base, by Hensel
+ * lifting: given v with vn == 1 mod 2^k, the refinement v(2-vn) is
+ * correct mod 2^{2k}, so we can start from a single-word inverse and
+ * double our precision with one truncated multiplication per step.
+ * This is far cheaper than the general extended-Euclid modinv(),
+ * whose time is better spent elsewhere.
+ *
+ * 'minv' and 'n' are big-endian arrays of 'len' BignumInts. 'tmp' is
+ * an array of BignumInt used as scratch space, of length at least
+ * 2*len + mul_compute_scratch(len).
+ */
+static void monty_invert(BignumInt *minv, const BignumInt *n,
+                         BignumInt *tmp, int len)
+{
+    int i, plen, bits;
+    BignumInt w = n[len - 1], v = w;
+    BignumCarry carry;
+
+    /*
+     * Newton iteration at single-word precision. Any odd w is its own
+     * inverse mod 8, so starting from v = w each step below triples,
+     * er, doubles the number of correct low-order bits.
+     */
+    for (bits = 3; bits < BIGNUM_INT_BITS; bits *= 2)
+        v *= 2 - w * v;
+
+    for (i = 0; i < len; i++)
+        minv[i] = 0;
+    minv[len - 1] = v;
+
+    /*
+     * Now lift to full precision a word at a time, doubling the
+     * number of valid low-order words of minv in each pass.
+     */
+    plen = 1;
+    while (plen < len) {
+        plen = (2*plen < len ? 2*plen : len);
+
+        /* tmp := n * minv mod 2^(plen words) */
+        internal_mul_low(n + len - plen, minv + len - plen,
+                         tmp, plen, tmp + 2*len);
+
+        /* tmp := 2 - tmp, i.e. ~tmp + 3 */
+        carry = 1;
+        for (i = plen - 1; i >= 0; i--)
+            BignumADC(tmp[i], carry, ~tmp[i],
+                      (BignumInt)(i == plen - 1 ? 2 : 0), carry);
+
+        /* minv := minv * tmp mod 2^(plen words) */
+        internal_mul_low(minv + len - plen, tmp,
+                         tmp + len, plen, tmp + 2*len);
+        for (i = 0; i < plen; i++)
+            minv[len - plen + i] = tmp[len + i];
+    }
+}
+
 static void internal_add_shifted(BignumInt *number,
 				 BignumInt n, int shift)
 {
@@ -940,10 +999,10 @@ static void internal_mod(BignumInt *a, int alen,
  */
 Bignum modpow_simple(Bignum base_in, Bignum exp, Bignum mod)
 {
-    BignumInt *a, *b, *n, *m, *scratch;
+    BignumInt *a, *b, *n, *m, *scratch, *workspace;
     BignumInt recip;
     int rshift;
-    int mlen, scratchlen, i, j;
+    int mlen, scratchlen, wslen, i, j;
     Bignum base, result;
 
     /*
@@ -958,31 +1017,41 @@ Bignum modpow_simple(Bignum base_in, Bignum exp, Bignum mod)
      */
     base = bigmod(base_in, mod);
 
-    /* Allocate m of size mlen, copy mod to m */
-    /* We use big endian internally */
+    /*
+     * All the working storage for the whole operation comes from one
+     * allocation, carved up below and wiped just once at the end, in
+     * the same style as bigmuladd(). Allocating and wiping each array
+     * separately costs a surprising amount over the hundreds of
+     * multiplications in a key exchange or signature.
+     */
     mlen = mod[0];
-    m = snewn(mlen, BignumInt);
+    scratchlen = mul_compute_scratch(mlen);
+    wslen = 6 * mlen + scratchlen;
+    workspace = secure_pool_alloc(wslen * sizeof(*workspace));
+
+    /* m is of size mlen; copy mod into it */
+    /* We use big endian internally */
+    m = workspace;
     for (j = 0; j < mlen; j++)
 	m[j] = mod[mod[0] - j];
 
-    /* Allocate n of size mlen, copy base to n */
-    n = snewn(mlen, BignumInt);
+    /* n is of size mlen; copy base into it */
+    n = workspace + mlen;
     i = mlen - base[0];
     for (j = 0; j < i; j++)
 	n[j] = 0;
     for (j = 0; j < (int)base[0]; j++)
 	n[i + j] = base[base[0] - j];
 
-    /* Allocate a and b of size 2*mlen. Set a = 1 */
-    a = snewn(2 * mlen, BignumInt);
-    b = snewn(2 * mlen, BignumInt);
+    /* a and b are of size 2*mlen. Set a = 1 */
+    a = workspace + 2 * mlen;
+    b = workspace + 4 * mlen;
     for (i = 0; i < 2 * mlen; i++)
 	a[i] = 0;
     a[2 * mlen - 1] = 1;
 
     /* Scratch space for multiplies */
-    scratchlen = mul_compute_scratch(mlen);
-    scratch = snewn(scratchlen, BignumInt);
+    scratch = workspace + 6 * mlen;
 
     /* Skip leading zero bits of exp. */
     i = 0;
@@ -1034,17 +1103,8 @@ Bignum modpow_simple(Bignum base_in, Bignum exp, Bignum mod)
     while (result[0] > 1 && result[result[0]] == 0)
 	result[0]--;
 
-    /* Free temporary arrays */
-    smemclr(a, 2 * mlen * sizeof(*a));
-    sfree(a);
-    smemclr(scratch, scratchlen * sizeof(*scratch));
-    sfree(scratch);
-    smemclr(b, 2 * mlen * sizeof(*b));
-    sfree(b);
-    smemclr(m, mlen * sizeof(*m));
-    sfree(m);
-    smemclr(n, mlen * sizeof(*n));
-    sfree(n);
+    /* Wipe and free the workspace in one go */
+    secure_pool_free(workspace);
 
     freebn(base);
 
@@ -1052,89 +1112,117 @@ Bignum modpow_simple(Bignum base_in, Bignum exp, Bignum mod)
 }
 
 /*
- * Compute (base ^ exp) % mod. Uses the Montgomery multiplication
- * technique where possible, falling back to modpow_simple otherwise.
+ * Reusable Montgomery context, for callers that want to perform
+ * several modular exponentiations to the same (odd) modulus: the
+ * prime-testing loop in sshprime.c runs a succession of Miller-Rabin
+ * witnesses against one candidate, and re-deriving r mod n and the
+ * inverse of n mod r for every witness is pure waste. monty_new()
+ * does that derivation once; monty_modpow() is then the same
+ * computation as the main body of modpow() below.
  */
-Bignum modpow(Bignum base_in, Bignum exp, Bignum mod)
+struct MontyContext {
+    int len;                   /* words in the modulus */
+    Bignum mod;                /* the modulus itself */
+    Bignum r;                  /* the Montgomery base 2^(len*BIGNUM_INT_BITS) */
+    Bignum rn;                 /* r mod n, i.e. Montgomerified 1 */
+    BignumInt *n;              /* modulus as a big-endian word array */
+    BignumInt *mninv;          /* inverse of -n mod r, for monty_reduce */
+    int scratchlen;
+};
+
+MontyContext *monty_new(Bignum mod)
 {
-    BignumInt *a, *b, *x, *n, *mninv, *scratch;
-    int len, scratchlen, i, j;
-    Bignum base, base2, r, rn, inv, result;
+    MontyContext *mc = snew(MontyContext);
+    BignumInt *scratch, *x;
+    int len, j;
 
     /*
-     * The most significant word of mod needs to be non-zero. It
-     * should already be, but let's make sure.
+     * The most significant word of mod needs to be non-zero, and mod
+     * must be odd, or the power of two we use as r isn't invertible
+     * mod n at all.
      */
     assert(mod[mod[0]] != 0);
+    assert(mod[1] & 1);
+
+    len = mod[0];
+    mc->len = len;
+    mc->mod = copybn(mod);
+    mc->r = bn_power_2(BIGNUM_INT_BITS * len);
+    mc->rn = bigmod(mc->r, mod);
+    mc->scratchlen = 3*len + mul_compute_scratch(len);
+
+    mc->n = secure_pool_alloc(2 * len * sizeof(BignumInt));
+    mc->mninv = mc->n + len;
+    for (j = 0; j < len; j++)
+	mc->n[len - 1 - j] = mod[j + 1];
 
     /*
-     * mod had better be odd, or we can't do Montgomery multiplication
-     * using a power of two at all.
+     * Compute the inverse of n mod r. (In fact we want the inverse
+     * of _minus_ n mod r, so negate it afterwards.)
      */
-    if (!(mod[1] & 1))
-        return modpow_simple(base_in, exp, mod);
+    scratch = secure_pool_alloc((mc->scratchlen + len) * sizeof(BignumInt));
+    x = scratch + mc->scratchlen;
+    monty_invert(mc->mninv, mc->n, scratch, len);
+    for (j = 0; j < len; j++)
+        x[j] = 0;
+    internal_sub(x, mc->mninv, mc->mninv, len);
+    secure_pool_free(scratch);
+
+    return mc;
+}
+
+void monty_free(MontyContext *mc)
+{
+    freebn(mc->mod);
+    freebn(mc->r);
+    freebn(mc->rn);
+    secure_pool_free(mc->n);
+    sfree(mc);
+}
+
+Bignum monty_modpow(MontyContext *mc, Bignum base_in, Bignum exp)
+{
+    BignumInt *a, *b, *x, *scratch, *workspace;
+    int len = mc->len, wslen, i, j;
+    Bignum base, base2, result;
 
     /*
      * Make sure the base is smaller than the modulus, by reducing
      * it modulo the modulus if not.
      */
-    base = bigmod(base_in, mod);
-
-    /*
-     * Compute the inverse of n mod r, for monty_reduce. (In fact we
-     * want the inverse of _minus_ n mod r, but we'll sort that out
-     * below.)
-     */
-    len = mod[0];
-    r = bn_power_2(BIGNUM_INT_BITS * len);
-    inv = modinv(mod, r);
-    assert(inv); /* cannot fail, since mod is odd and r is a power of 2 */
+    base = bigmod(base_in, mc->mod);
 
     /*
      * Multiply the base by r mod n, to get it into Montgomery
      * representation.
      */
-    base2 = modmul(base, r, mod);
+    base2 = modmul(base, mc->r, mc->mod);
     freebn(base);
     base = base2;
 
-    rn = bigmod(r, mod);               /* r mod n, i.e. Montgomerified 1 */
-
-    freebn(r);                         /* won't need this any more */
+    /*
+     * All the working arrays for the whole operation, allocated in
+     * one go and wiped just once at the end, in the same style as
+     * bigmuladd(); see the comment in modpow_simple().
+     */
+    wslen = 5 * len + mc->scratchlen;
+    workspace = secure_pool_alloc(wslen * sizeof(*workspace));
+    x = workspace;
+    a = workspace + len;
+    b = workspace + 3 * len;
+    scratch = workspace + 5 * len;
 
     /*
      * Set up internal arrays of the right lengths, in big-endian
-     * format, containing the base, the modulus, and the modulus's
-     * inverse.
+     * format, containing the Montgomerified base and 1.
      */
-    n = snewn(len, BignumInt);
-    for (j = 0; j < len; j++)
-	n[len - 1 - j] = mod[j + 1];
-
-    mninv = snewn(len, BignumInt);
-    for (j = 0; j < len; j++)
-	mninv[len - 1 - j] = (j < (int)inv[0] ? inv[j + 1] : 0);
-    freebn(inv);         /* we don't need this copy of it any more */
-    /* Now negate mninv mod r, so it's the inverse of -n rather than +n. */
-    x = snewn(len, BignumInt);
-    for (j = 0; j < len; j++)
-        x[j] = 0;
-    internal_sub(x, mninv, mninv, len);
-
-    /* x = snewn(len, BignumInt); */ /* already done above */
     for (j = 0; j < len; j++)
 	x[len - 1 - j] = (j < (int)base[0] ? base[j + 1] : 0);
     freebn(base);        /* we don't need this copy of it any more */
-
-    a = snewn(2*len, BignumInt);
-    b = snewn(2*len, BignumInt);
+    for (j = 0; j < 2*len; j++)
+	a[j] = 0;
     for (j = 0; j < len; j++)
-	a[2*len - 1 - j] = (j < (int)rn[0] ? rn[j + 1] : 0);
-    freebn(rn);
-
-    /* Scratch space for multiplies */
-    scratchlen = 3*len + mul_compute_scratch(len);
-    scratch = snewn(scratchlen, BignumInt);
+	a[2*len - 1 - j] = (j < (int)mc->rn[0] ? mc->rn[j + 1] : 0);
 
     /* Skip leading zero bits of exp. */
     i = 0;
@@ -1151,10 +1239,10 @@ Bignum modpow(Bignum base_in, Bignum exp, Bignum mod)
     while (i < (int)exp[0]) {
 	while (j >= 0) {
 	    internal_mul(a + len, a + len, b, len, scratch);
-            monty_reduce(b, n, mninv, scratch, len);
+            monty_reduce(b, mc->n, mc->mninv, scratch, len);
 	    if ((exp[exp[0] - i] & ((BignumInt)1 << j)) != 0) {
                 internal_mul(b + len, x, a, len,  scratch);
-                monty_reduce(a, n, mninv, scratch, len);
+                monty_reduce(a, mc->n, mc->mninv, scratch, len);
 	    } else {
 		BignumInt *t;
 		t = a;
@@ -1171,29 +1259,46 @@ Bignum modpow(Bignum base_in, Bignum exp, Bignum mod)
      * Final monty_reduce to get back from the adjusted Montgomery
      * representation.
      */
-    monty_reduce(a, n, mninv, scratch, len);
+    monty_reduce(a, mc->n, mc->mninv, scratch, len);
 
     /* Copy result to buffer */
-    result = newbn(mod[0]);
+    result = newbn(len);
     for (i = 0; i < len; i++)
 	result[result[0] - i] = a[i + len];
     while (result[0] > 1 && result[result[0]] == 0)
 	result[0]--;
 
-    /* Free temporary arrays */
-    smemclr(scratch, scratchlen * sizeof(*scratch));
-    sfree(scratch);
-    smemclr(a, 2 * len * sizeof(*a));
-    sfree(a);
-    smemclr(b, 2 * len * sizeof(*b));
-    sfree(b);
-    smemclr(mninv, len * sizeof(*mninv));
-    sfree(mninv);
-    smemclr(n, len * sizeof(*n));
-    sfree(n);
-    smemclr(x, len * sizeof(*x));
-    sfree(x);
+    /* Wipe and free the workspace in one go */
+    secure_pool_free(workspace);
+
+    return result;
+}
+
+/*
+ * Compute (base ^ exp) % mod. Uses the Montgomery multiplication
+ * technique where possible, falling back to modpow_simple otherwise.
+ */
+Bignum modpow(Bignum base_in, Bignum exp, Bignum mod)
+{
+    MontyContext *mc;
+    Bignum result;
+
+    /*
+     * The most significant word of mod needs to be non-zero. It
+     * should already be, but let's make sure.
+     */
+    assert(mod[mod[0]] != 0);
+
+    /*
+     * mod had better be odd, or we can't do Montgomery multiplication
+     * using a power of two at all.
+     */
+    if (!(mod[1] & 1))
+        return modpow_simple(base_in, exp, mod);
 
+    mc = monty_new(mod);
+    result = monty_modpow(mc, base_in, exp);
+    monty_free(mc);
     return result;
 }
 
@@ -1204,9 +1309,9 @@ Bignum modpow(Bignum base_in, Bignum exp, Bignum mod)
  */
 Bignum modmul(Bignum p, Bignum q, Bignum mod)
 {
-    BignumInt *a, *n, *m, *o, *scratch;
+    BignumInt *a, *n, *m, *o, *scratch, *workspace;
     BignumInt recip;
-    int rshift, scratchlen;
+    int rshift, scratchlen, wslen;
     int pqlen, mlen, rlen, i, j;
     Bignum result;
 
@@ -1216,13 +1321,7 @@ Bignum modmul(Bignum p, Bignum q, Bignum mod)
      */
     assert(mod[mod[0]] != 0);
 
-    /* Allocate m of size mlen, copy mod to m */
-    /* We use big endian internally */
     mlen = mod[0];
-    m = snewn(mlen, BignumInt);
-    for (j = 0; j < mlen; j++)
-	m[j] = mod[mod[0] - j];
-
     pqlen = (p[0] > q[0] ? p[0] : q[0]);
 
     /*
@@ -1232,28 +1331,42 @@ Bignum modmul(Bignum p, Bignum q, Bignum mod)
     if (2*pqlen <= mlen)
         pqlen = mlen/2 + 1;
 
-    /* Allocate n of size pqlen, copy p to n */
-    n = snewn(pqlen, BignumInt);
+    /*
+     * One allocation for all the working arrays, wiped once at the
+     * end, in the same style as bigmuladd(); see the comment in
+     * modpow_simple().
+     */
+    scratchlen = mul_compute_scratch(pqlen);
+    wslen = mlen + 4 * pqlen + scratchlen;
+    workspace = secure_pool_alloc(wslen * sizeof(*workspace));
+
+    /* m is of size mlen; copy mod into it */
+    /* We use big endian internally */
+    m = workspace;
+    for (j = 0; j < mlen; j++)
+	m[j] = mod[mod[0] - j];
+
+    /* n is of size pqlen; copy p into it */
+    n = workspace + mlen;
     i = pqlen - p[0];
     for (j = 0; j < i; j++)
 	n[j] = 0;
     for (j = 0; j < (int)p[0]; j++)
 	n[i + j] = p[p[0] - j];
 
-    /* Allocate o of size pqlen, copy q to o */
-    o = snewn(pqlen, BignumInt);
+    /* o is of size pqlen; copy q into it */
+    o = workspace + mlen + pqlen;
     i = pqlen - q[0];
     for (j = 0; j < i; j++)
 	o[j] = 0;
     for (j = 0; j < (int)q[0]; j++)
 	o[i + j] = q[q[0] - j];
 
-    /* Allocate a of size 2*pqlen for result */
-    a = snewn(2 * pqlen, BignumInt);
+    /* a is of size 2*pqlen, for the result */
+    a = workspace + mlen + 2 * pqlen;
 
     /* Scratch space for multiplies */
-    scratchlen = mul_compute_scratch(pqlen);
-    scratch = snewn(scratchlen, BignumInt);
+    scratch = workspace + mlen + 4 * pqlen;
 
     /* Compute reciprocal of the top full word of the modulus */
     {
@@ -1279,17 +1392,8 @@ Bignum modmul(Bignum p, Bignum q, Bignum mod)
     while (result[0] > 1 && result[result[0]] == 0)
 	result[0]--;
 
-    /* Free temporary arrays */
-    smemclr(scratch, scratchlen * sizeof(*scratch));
-    sfree(scratch);
-    smemclr(a, 2 * pqlen * sizeof(*a));
-    sfree(a);
-    smemclr(m, mlen * sizeof(*m));
-    sfree(m);
-    smemclr(n, pqlen * sizeof(*n));
-    sfree(n);
-    smemclr(o, pqlen * sizeof(*o));
-    sfree(o);
+    /* Wipe and free the workspace in one go */
+    secure_pool_free(workspace);
 
     return result;
 }
@@ -1346,7 +1450,7 @@ static void bigdivmod(Bignum p, Bignum mod, Bignum result, Bignum quotient)
     /* Allocate m of size mlen, copy mod to m */
     /* We use big endian internally */
     mlen = mod[0];
-    m = snewn(mlen, BignumInt);
+    m = secure_pool_alloc(mlen * sizeof(*m));
     for (j = 0; j < mlen; j++)
 	m[j] = mod[mod[0] - j];
 
@@ -1356,7 +1460,7 @@ static void bigdivmod(Bignum p, Bignum mod, Bignum result, Bignum quotient)
 	plen = mlen + 1;
 
     /* Allocate n of size plen, copy p to n */
-    n = snewn(plen, BignumInt);
+    n = secure_pool_alloc(plen * sizeof(*n));
     for (j = 0; j < plen; j++)
 	n[j] = 0;
     for (j = 1; j <= (int)p[0]; j++)
@@ -1386,10 +1490,8 @@ static void bigdivmod(Bignum p, Bignum mod, Bignum result, Bignum quotient)
     }
 
     /* Free temporary arrays */
-    smemclr(m, mlen * sizeof(*m));
-    sfree(m);
-    smemclr(n, plen * sizeof(*n));
-    sfree(n);
+    secure_pool_free(m);
+    secure_pool_free(n);
 }
 
 /*
@@ -1732,7 +1834,7 @@ Bignum bigmuladd(Bignum a, Bignum b, Bignum addend)
     /* mlen space for a, mlen space for b, 2*mlen for result,
      * plus scratch space for multiplication */
     wslen = mlen * 4 + mul_compute_scratch(mlen);
-    workspace = snewn(wslen, BignumInt);
+    workspace = secure_pool_alloc(wslen * sizeof(*workspace));
     for (i = 0; i < mlen; i++) {
 	workspace[0 * mlen + i] = (mlen - i <= (int)a[0] ? a[mlen - i] : 0);
 	workspace[1 * mlen + i] = (mlen - i <= (int)b[0] ? b[mlen - i] : 0);
@@ -1767,8 +1869,7 @@ Bignum bigmuladd(Bignum a, Bignum b, Bignum addend)
     }
     ret[0] = maxspot;
 
-    smemclr(workspace, wslen * sizeof(*workspace));
-    sfree(workspace);
+    secure_pool_free(workspace);
     return ret;
 }
 
@@ -1982,6 +2083,414 @@ Bignum bigmod(Bignum a, Bignum b)
     return r;
 }
 
+/*
+ * Fast modular reduction for the NIST elliptic-curve primes P-256 and
+ * P-384. These primes were chosen by NIST as sums and differences of
+ * a few powers of 2^32, so that reducing a double-width product needs
+ * only a handful of additions and subtractions of values assembled
+ * from the product's 32-bit words (Solinas reduction; the word
+ * shuffles below are the standard tables from FIPS 186), instead of
+ * the full word-by-word trial division that bigdivmod() performs.
+ * The elliptic-curve code calls these through the fieldMod hook in
+ * struct ec_curve every time it multiplies two field elements, so
+ * they're worth having despite the curve-specific magic.
+ *
+ * We work in 32-bit column units whatever the BignumInt size, using
+ * only unsigned long arithmetic with explicit carry and borrow
+ * propagation, so this is as portable as the rest of the file.
+ */
+
+#define SOLINAS_WORD_MASK 0xFFFFFFFFUL
+
+static unsigned long bn_solinas_word(Bignum x, int i)
+{
+#if BIGNUM_INT_BITS == 64
+    if ((BignumInt)(i >> 1) >= x[0])
+        return 0;
+    return (unsigned long)((x[1 + (i >> 1)] >> ((i & 1) << 5)) &
+                           SOLINAS_WORD_MASK);
+#elif BIGNUM_INT_BITS == 32
+    if ((BignumInt)i >= x[0])
+        return 0;
+    return (unsigned long)x[1 + i];
+#else /* BIGNUM_INT_BITS == 16 */
+    unsigned long r = 0;
+    if ((BignumInt)(2*i) < x[0])
+        r = x[1 + 2*i];
+    if ((BignumInt)(2*i + 1) < x[0])
+        r |= (unsigned long)x[2 + 2*i] << 16;
+    return r;
+#endif
+}
+
+static void bn_solinas_add(unsigned long *r, const unsigned long *s,
+                           int nwords, int *top)
+{
+    unsigned long carry = 0;
+    int i;
+
+    for (i = 0; i < nwords; i++) {
+#if ULONG_MAX > 0xFFFFFFFFUL
+        unsigned long t = r[i] + s[i] + carry;
+        carry = t >> 32;
+        r[i] = t & SOLINAS_WORD_MASK;
+#else
+        unsigned long t = (r[i] + s[i] + carry) & SOLINAS_WORD_MASK;
+        carry = (t < r[i] || (carry && t == r[i])) ? 1 : 0;
+        r[i] = t;
+#endif
+    }
+    *top += carry;
+}
+
+static void bn_solinas_sub(unsigned long *r, const unsigned long *s,
+                           int nwords, int *top)
+{
+    unsigned long borrow = 0;
+    int i;
+
+    for (i = 0; i < nwords; i++) {
+#if ULONG_MAX > 0xFFFFFFFFUL
+        unsigned long t = r[i] - s[i] - borrow;
+        borrow = (t >> 32) & 1;
+        r[i] = t & SOLINAS_WORD_MASK;
+#else
+        unsigned long t = (r[i] - s[i] - borrow) & SOLINAS_WORD_MASK;
+        borrow = (r[i] < s[i] || (borrow && r[i] == s[i])) ? 1 : 0;
+        r[i] = t;
+#endif
+    }
+    *top -= borrow;
+}
+
+static int bn_solinas_ge(const unsigned long *r, const unsigned long *s,
+                         int nwords)
+{
+    int i;
+
+    for (i = nwords - 1; i >= 0; i--) {
+        if (r[i] != s[i])
+            return r[i] > s[i];
+    }
+    return 1;                          /* equal counts as >= */
+}
+
+/*
+ * Common final stage: fold the signed overflow word back in by
+ * adding or subtracting the prime, make one last conditional
+ * subtraction to get below it, and package the answer as a Bignum.
+ * The overflow is bounded by the handful of terms above, so these
+ * loops run at most a few times.
+ */
+static Bignum bn_solinas_finish(unsigned long *r, const unsigned long *p,
+                                int nwords, int top)
+{
+    Bignum result;
+    int i;
+
+    while (top < 0)
+        bn_solinas_add(r, p, nwords, &top);
+    while (top > 0)
+        bn_solinas_sub(r, p, nwords, &top);
+    while (bn_solinas_ge(r, p, nwords))
+        bn_solinas_sub(r, p, nwords, &top);
+
+#if BIGNUM_INT_BITS == 64
+    result = newbn(nwords >> 1);
+    for (i = 0; i < (nwords >> 1); i++)
+        result[1 + i] = ((BignumInt)r[2*i] |
+                         (BignumInt)r[2*i + 1] << 32);
+#elif BIGNUM_INT_BITS == 32
+    result = newbn(nwords);
+    for (i = 0; i < nwords; i++)
+        result[1 + i] = r[i];
+#else /* BIGNUM_INT_BITS == 16 */
+    result = newbn(nwords * 2);
+    for (i = 0; i < nwords; i++) {
+        result[1 + 2*i] = r[i] & 0xFFFF;
+        result[2 + 2*i] = (r[i] >> 16) & 0xFFFF;
+    }
+#endif
+    while (result[0] > 1 && result[result[0]] == 0)
+        result[0]--;
+
+    smemclr(r, nwords * sizeof(*r));
+    return result;
+}
+
+/*
+ * Fallback for inputs too wide for the word tables: reduce by the
+ * prime the slow way.
+ */
+static Bignum bn_solinas_fallback(Bignum x, const unsigned long *p,
+                                  int nwords)
+{
+    unsigned char bytes[48];
+    Bignum prime, result;
+    int i;
+
+    for (i = 0; i < nwords; i++) {
+        bytes[4*(nwords-1-i)] = (p[i] >> 24) & 0xFF;
+        bytes[4*(nwords-1-i) + 1] = (p[i] >> 16) & 0xFF;
+        bytes[4*(nwords-1-i) + 2] = (p[i] >> 8) & 0xFF;
+        bytes[4*(nwords-1-i) + 3] = p[i] & 0xFF;
+    }
+    prime = bignum_from_bytes(bytes, nwords*4);
+    result = bigmod(x, prime);
+    freebn(prime);
+    return result;
+}
+
+static const unsigned long nistp256_words[8] = {
+    0xFFFFFFFFUL, 0xFFFFFFFFUL, 0xFFFFFFFFUL, 0x00000000UL,
+    0x00000000UL, 0x00000000UL, 0x00000001UL, 0xFFFFFFFFUL
+};
+
+static Bignum bn_nistp256_reduce(const unsigned long *c)
+{
+    unsigned long r[8], s[8];
+    int i, top = 0;
+
+    /* t = (c7,...,c0) */
+    for (i = 0; i < 8; i++)
+        r[i] = c[i];
+
+    /* 2 * (c15,c14,c13,c12,c11,0,0,0) */
+    s[0] = 0;     s[1] = 0;     s[2] = 0;     s[3] = c[11];
+    s[4] = c[12]; s[5] = c[13]; s[6] = c[14]; s[7] = c[15];
+    bn_solinas_add(r, s, 8, &top);
+    bn_solinas_add(r, s, 8, &top);
+
+    /* 2 * (0,c15,c14,c13,c12,0,0,0) */
+    s[0] = 0;     s[1] = 0;     s[2] = 0;     s[3] = c[12];
+    s[4] = c[13]; s[5] = c[14]; s[6] = c[15]; s[7] = 0;
+    bn_solinas_add(r, s, 8, &top);
+    bn_solinas_add(r, s, 8, &top);
+
+    /* (c15,c14,0,0,0,c10,c9,c8) */
+    s[0] = c[8];  s[1] = c[9];  s[2] = c[10]; s[3] = 0;
+    s[4] = 0;     s[5] = 0;     s[6] = c[14]; s[7] = c[15];
+    bn_solinas_add(r, s, 8, &top);
+
+    /* (c8,c13,c15,c14,c13,c11,c10,c9) */
+    s[0] = c[9];  s[1] = c[10]; s[2] = c[11]; s[3] = c[13];
+    s[4] = c[14]; s[5] = c[15]; s[6] = c[13]; s[7] = c[8];
+    bn_solinas_add(r, s, 8, &top);
+
+    /* minus (c10,c8,0,0,0,c13,c12,c11) */
+    s[0] = c[11]; s[1] = c[12]; s[2] = c[13]; s[3] = 0;
+    s[4] = 0;     s[5] = 0;     s[6] = c[8];  s[7] = c[10];
+    bn_solinas_sub(r, s, 8, &top);
+
+    /* minus (c11,c9,0,0,c15,c14,c13,c12) */
+    s[0] = c[12]; s[1] = c[13]; s[2] = c[14]; s[3] = c[15];
+    s[4] = 0;     s[5] = 0;     s[6] = c[9];  s[7] = c[11];
+    bn_solinas_sub(r, s, 8, &top);
+
+    /* minus (c12,0,c10,c9,c8,c15,c14,c13) */
+    s[0] = c[13]; s[1] = c[14]; s[2] = c[15]; s[3] = c[8];
+    s[4] = c[9];  s[5] = c[10]; s[6] = 0;     s[7] = c[12];
+    bn_solinas_sub(r, s, 8, &top);
+
+    /* minus (c13,0,c11,c10,c9,0,c15,c14) */
+    s[0] = c[14]; s[1] = c[15]; s[2] = 0;     s[3] = c[9];
+    s[4] = c[10]; s[5] = c[11]; s[6] = 0;     s[7] = c[13];
+    bn_solinas_sub(r, s, 8, &top);
+
+    {
+        Bignum ret = bn_solinas_finish(r, nistp256_words, 8, top);
+        smemclr(s, sizeof(s));
+        return ret;
+    }
+}
+
+Bignum bignum_nistp256_mod(Bignum x)
+{
+    unsigned long c[16];
+    Bignum ret;
+    int i;
+
+    if (bignum_bitcount(x) > 512)
+        return bn_solinas_fallback(x, nistp256_words, 8);
+
+    for (i = 0; i < 16; i++)
+        c[i] = bn_solinas_word(x, i);
+    ret = bn_nistp256_reduce(c);
+    smemclr(c, sizeof(c));
+    return ret;
+}
+
+static const unsigned long nistp384_words[12] = {
+    0xFFFFFFFFUL, 0x00000000UL, 0x00000000UL, 0xFFFFFFFFUL,
+    0xFFFFFFFEUL, 0xFFFFFFFFUL, 0xFFFFFFFFUL, 0xFFFFFFFFUL,
+    0xFFFFFFFFUL, 0xFFFFFFFFUL, 0xFFFFFFFFUL, 0xFFFFFFFFUL
+};
+
+static Bignum bn_nistp384_reduce(const unsigned long *c)
+{
+    unsigned long r[12], s[12];
+    int i, top = 0;
+
+    /* t = (c11,...,c0) */
+    for (i = 0; i < 12; i++)
+        r[i] = c[i];
+
+    /* 2 * (0,0,0,0,0,c23,c22,c21,0,0,0,0) */
+    for (i = 0; i < 12; i++)
+        s[i] = 0;
+    s[4] = c[21]; s[5] = c[22]; s[6] = c[23];
+    bn_solinas_add(r, s, 12, &top);
+    bn_solinas_add(r, s, 12, &top);
+
+    /* (c23,...,c12) */
+    for (i = 0; i < 12; i++)
+        s[i] = c[12 + i];
+    bn_solinas_add(r, s, 12, &top);
+
+    /* (c20,...,c12,c23,c22,c21) */
+    s[0] = c[21]; s[1] = c[22]; s[2] = c[23];
+    for (i = 3; i < 12; i++)
+        s[i] = c[9 + i];
+    bn_solinas_add(r, s, 12, &top);
+
+    /* (c19,...,c12,c20,0,c23,0) */
+    s[0] = 0; s[1] = c[23]; s[2] = 0; s[3] = c[20];
+    for (i = 4; i < 12; i++)
+        s[i] = c[8 + i];
+    bn_solinas_add(r, s, 12, &top);
+
+    /* (0,0,0,0,c23,c22,c21,c20,0,0,0,0) */
+    for (i = 0; i < 12; i++)
+        s[i] = 0;
+    s[4] = c[20]; s[5] = c[21]; s[6] = c[22]; s[7] = c[23];
+    bn_solinas_add(r, s, 12, &top);
+
+    /* (0,0,0,0,0,0,c23,c22,c21,0,0,c20) */
+    for (i = 0; i < 12; i++)
+        s[i] = 0;
+    s[0] = c[20]; s[3] = c[21]; s[4] = c[22]; s[5] = c[23];
+    bn_solinas_add(r, s, 12, &top);
+
+    /* minus (c22,...,c12,c23) */
+    s[0] = c[23];
+    for (i = 1; i < 12; i++)
+        s[i] = c[11 + i];
+    bn_solinas_sub(r, s, 12, &top);
+
+    /* minus (0,0,0,0,0,0,0,c23,c22,c21,c20,0) */
+    for (i = 0; i < 12; i++)
+        s[i] = 0;
+    s[1] = c[20]; s[2] = c[21]; s[3] = c[22]; s[4] = c[23];
+    bn_solinas_sub(r, s, 12, &top);
+
+    /* minus (0,0,0,0,0,0,0,c23,c23,0,0,0) */
+    for (i = 0; i < 12; i++)
+        s[i] = 0;
+    s[3] = c[23]; s[4] = c[23];
+    bn_solinas_sub(r, s, 12, &top);
+
+    {
+        Bignum ret = bn_solinas_finish(r, nistp384_words, 12, top);
+        smemclr(s, sizeof(s));
+        return ret;
+    }
+}
+
+Bignum bignum_nistp384_mod(Bignum x)
+{
+    unsigned long c[24];
+    Bignum ret;
+    int i;
+
+    if (bignum_bitcount(x) > 768)
+        return bn_solinas_fallback(x, nistp384_words, 12);
+
+    for (i = 0; i < 24; i++)
+        c[i] = bn_solinas_word(x, i);
+    ret = bn_nistp384_reduce(c);
+    smemclr(c, sizeof(c));
+    return ret;
+}
+
+/*
+ * Extract the i'th 32-bit word (counting from the least significant
+ * end) of a product left in internal_mul's big-endian workspace
+ * layout.
+ */
+static unsigned long bn_solinas_beword(const BignumInt *w, int nlimbs, int i)
+{
+#if BIGNUM_INT_BITS == 64
+    return (unsigned long)((w[nlimbs - 1 - (i >> 1)] >> ((i & 1) << 5)) &
+                           SOLINAS_WORD_MASK);
+#elif BIGNUM_INT_BITS == 32
+    return (unsigned long)w[nlimbs - 1 - i];
+#else /* BIGNUM_INT_BITS == 16 */
+    return ((unsigned long)w[nlimbs - 1 - 2*i] |
+            (unsigned long)w[nlimbs - 2 - 2*i] << 16);
+#endif
+}
+
+/*
+ * Multiply two reduced field elements and reduce the product, feeding
+ * internal_mul's output straight into the word tables above. This
+ * avoids materialising the double-width product as a Bignum of its
+ * own, which matters because the elliptic-curve code does almost
+ * nothing but this operation.
+ */
+static Bignum bn_solinas_mulmod(Bignum a, Bignum b, int bits,
+                                Bignum (*reduce)(const unsigned long *),
+                                const unsigned long *p, int nwords)
+{
+    BignumInt *workspace, *aw, *bw, *prod, *scratch;
+    unsigned long c[24];
+    int mlen = bits / BIGNUM_INT_BITS;
+    int wslen, scratchlen, i;
+    Bignum ret;
+
+    if ((int)bignum_bitcount(a) > bits || (int)bignum_bitcount(b) > bits) {
+        Bignum prodbn = bigmul(a, b);
+        ret = bn_solinas_fallback(prodbn, p, nwords);
+        freebn(prodbn);
+        return ret;
+    }
+
+    scratchlen = mul_compute_scratch(mlen);
+    wslen = 4 * mlen + scratchlen;
+    workspace = secure_pool_alloc(wslen * sizeof(*workspace));
+    aw = workspace;                    /* mlen */
+    bw = workspace + mlen;             /* mlen */
+    prod = workspace + 2 * mlen;       /* 2*mlen */
+    scratch = workspace + 4 * mlen;    /* scratchlen */
+
+    /* Copy the operands in big-endian limb order, zero-padded. */
+    for (i = 0; i < mlen; i++) {
+        aw[i] = (mlen - i <= (int)a[0] ? a[mlen - i] : 0);
+        bw[i] = (mlen - i <= (int)b[0] ? b[mlen - i] : 0);
+    }
+
+    internal_mul(aw, bw, prod, mlen, scratch);
+
+    for (i = 0; i < 2 * nwords; i++)
+        c[i] = bn_solinas_beword(prod, 2 * mlen, i);
+    ret = reduce(c);
+
+    smemclr(c, sizeof(c));
+    secure_pool_free(workspace);
+    return ret;
+}
+
+Bignum bignum_nistp256_mulmod(Bignum a, Bignum b)
+{
+    return bn_solinas_mulmod(a, b, 256, bn_nistp256_reduce,
+                             nistp256_words, 8);
+}
+
+Bignum bignum_nistp384_mulmod(Bignum a, Bignum b)
+{
+    return bn_solinas_mulmod(a, b, 384, bn_nistp384_reduce,
+                             nistp384_words, 12);
+}
+
 /*
  * Greatest common divisor.
  */
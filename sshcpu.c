@@ -0,0 +1,115 @@
+/*
+ * sshcpu.c: unified runtime CPU feature detection for the crypto
+ * modules (sshaes.c, sshsha.c, sshsh256.c, sshccp.c).
+ *
+ * Each module used to carry its own CPUID probe; collecting them here
+ * means the answers are computed once and cached, and gives the Arm
+ * ports somewhere natural to plug in their equivalents (hwcaps on
+ * Linux, IsProcessorFeaturePresent on Windows) without every crypto
+ * file growing a per-platform maze of its own.
+ *
+ * The feature bits are defined in ssh.h; they name capabilities, not
+ * instruction sets, so a caller asks the same question regardless of
+ * architecture.
+ */
+
+#include "ssh.h"
+
+#if defined(__i386) || defined(__x86_64__) || \
+    defined(_M_IX86) || defined(_M_X64)
+
+#if defined(__clang__) || defined(__GNUC__)
+#include <cpuid.h>
+#define SSHCPU_CPUID(leaf, regs) \
+    __cpuid(leaf, regs[0], regs[1], regs[2], regs[3])
+#define SSHCPU_CPUID_COUNT(leaf, sub, regs) \
+    __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3])
+#else
+#include <intrin.h>
+#define SSHCPU_CPUID(leaf, regs) __cpuid((int *)regs, leaf)
+#define SSHCPU_CPUID_COUNT(leaf, sub, regs) __cpuidex((int *)regs, leaf, sub)
+#endif
+
+static int ssh_cpu_detect(void)
+{
+    unsigned int regs[4];
+    int features = 0;
+    int sse41;
+
+    SSHCPU_CPUID(1, regs);
+    if (regs[3] & (1 << 26))	       /* SSE2 */
+	features |= SSH_CPU_VECTOR;
+    sse41 = (regs[2] & (1 << 19)) != 0;
+    if (sse41 && (regs[2] & (1 << 25)))	/* AES-NI */
+	features |= SSH_CPU_HWAES;
+    if (sse41) {
+	SSHCPU_CPUID_COUNT(7, 0, regs);
+	if (regs[1] & (1 << 29))       /* SHA extensions */
+	    features |= SSH_CPU_HWSHA1 | SSH_CPU_HWSHA256;
+    }
+    return features;
+}
+
+#elif defined(__aarch64__) && defined(__linux__)
+
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+
+static int ssh_cpu_detect(void)
+{
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    int features = 0;
+
+#ifdef HWCAP_ASIMD
+    if (hwcap & HWCAP_ASIMD)
+	features |= SSH_CPU_VECTOR;
+#endif
+#ifdef HWCAP_AES
+    if (hwcap & HWCAP_AES)
+	features |= SSH_CPU_HWAES;
+#endif
+#ifdef HWCAP_SHA1
+    if (hwcap & HWCAP_SHA1)
+	features |= SSH_CPU_HWSHA1;
+#endif
+#ifdef HWCAP_SHA2
+    if (hwcap & HWCAP_SHA2)
+	features |= SSH_CPU_HWSHA256;
+#endif
+    return features;
+}
+
+#elif defined(_M_ARM64) || (defined(_WIN32) && defined(__aarch64__))
+
+#include <windows.h>
+
+static int ssh_cpu_detect(void)
+{
+    int features = SSH_CPU_VECTOR;     /* NEON is architectural on ARMv8 */
+
+#ifdef PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE
+    if (IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE))
+	features |= SSH_CPU_HWAES | SSH_CPU_HWSHA1 | SSH_CPU_HWSHA256;
+#endif
+    return features;
+}
+
+#else
+
+static int ssh_cpu_detect(void)
+{
+    return 0;			       /* unknown architecture: plain C only */
+}
+
+#endif
+
+int ssh_cpu_has(int features)
+{
+    static int checked = FALSE, detected;
+
+    if (!checked) {
+	detected = ssh_cpu_detect();
+	checked = TRUE;
+    }
+    return (detected & features) == features;
+}
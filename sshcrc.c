@@ -212,9 +212,55 @@ int main(void)
 }
 #endif
 
+/*
+ * Supplementary tables for the slice-by-8 method used on long
+ * buffers: crc32_table8[n][i] is the effect on the CRC word of the
+ * byte i followed by n+1 zero bytes, so that eight input bytes can
+ * be folded into the CRC with eight independent table lookups
+ * instead of an eight-long dependency chain of single-byte steps.
+ * Rather than another seven pages of constants, these are derived
+ * from the primary table on first use.
+ */
+static unsigned long crc32_table8[7][256];
+static int crc32_table8_ready = 0;
+
+static void crc32_init8(void)
+{
+    int i, n;
+
+    for (i = 0; i < 256; i++) {
+	unsigned long crcword = crc32_table[i];
+	for (n = 0; n < 7; n++) {
+	    crcword = (crcword >> 8) ^ crc32_table[crcword & 0xFFL];
+	    crc32_table8[n][i] = crcword;
+	}
+    }
+    crc32_table8_ready = 1;
+}
+
 unsigned long crc32_update(unsigned long crcword, const void *buf, size_t len)
 {
     const unsigned char *p = (const unsigned char *) buf;
+
+    if (len >= 8) {
+	if (!crc32_table8_ready)
+	    crc32_init8();
+
+	while (len >= 8) {
+	    crcword =
+		crc32_table8[6][p[0] ^ (crcword & 0xFFL)] ^
+		crc32_table8[5][p[1] ^ ((crcword >> 8) & 0xFFL)] ^
+		crc32_table8[4][p[2] ^ ((crcword >> 16) & 0xFFL)] ^
+		crc32_table8[3][p[3] ^ ((crcword >> 24) & 0xFFL)] ^
+		crc32_table8[2][p[4]] ^
+		crc32_table8[1][p[5]] ^
+		crc32_table8[0][p[6]] ^
+		crc32_table[p[7]];
+	    p += 8;
+	    len -= 8;
+	}
+    }
+
     while (len--) {
 	unsigned long newbyte = *p++;
 	newbyte ^= crcword & 0xFFL;
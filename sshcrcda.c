@@ -36,8 +36,6 @@ typedef unsigned short uint16;
 #define HASH_MINSIZE	(8 * 1024)
 #define HASH_ENTRYSIZE	(sizeof(uint16))
 #define HASH_FACTOR(x)	((x)*3/2)
-#define HASH_UNUSEDCHAR	(0xff)
-#define HASH_UNUSED	(0xffff)
 #define HASH_IV     	(0xfffe)
 
 #define HASH_MINBLOCKS	(7*SSH_BLOCKSIZE)
@@ -52,14 +50,18 @@ uchar ZERO[4] = { 0, 0, 0, 0 };
 
 struct crcda_ctx {
     uint16 *h;
+    uint32 *gen;		       /* entry i is in use iff gen[i] == gencur */
     uint32 n;
+    uint32 gencur;
 };
 
 void *crcda_make_context(void)
 {
     struct crcda_ctx *ret = snew(struct crcda_ctx);
     ret->h = NULL;
+    ret->gen = NULL;
     ret->n = HASH_MINSIZE / HASH_ENTRYSIZE;
+    ret->gencur = 0;
     return ret;
 }
 
@@ -69,6 +71,8 @@ void crcda_free_context(void *handle)
     if (ctx) {
 	sfree(ctx->h);
 	ctx->h = NULL;
+	sfree(ctx->gen);
+	ctx->gen = NULL;
 	sfree(ctx);
     }
 }
@@ -115,14 +119,12 @@ int detect_attack(void *handle, uchar *buf, uint32 len, uchar *IV)
     for (l = ctx->n; l < HASH_FACTOR(len / SSH_BLOCKSIZE); l = l << 2)
         ;
 
-    if (ctx->h == NULL) {
+    if (ctx->h == NULL || l > ctx->n) {
         ctx->n = l;
-        ctx->h = snewn(ctx->n, uint16);
-    } else {
-        if (l > ctx->n) {
-            ctx->n = l;
-            ctx->h = sresize(ctx->h, ctx->n, uint16);
-        }
+        ctx->h = sresize(ctx->h, ctx->n, uint16);
+        ctx->gen = sresize(ctx->gen, ctx->n, uint32);
+        memset(ctx->gen, 0, ctx->n * sizeof(uint32));
+        ctx->gencur = 0;
     }
 
     if (len <= HASH_MINBLOCKS) {
@@ -144,13 +146,27 @@ int detect_attack(void *handle, uchar *buf, uint32 len, uchar *IV)
         }
         return 0;                      /* ok */
     }
-    memset(ctx->h, HASH_UNUSEDCHAR, ctx->n * HASH_ENTRYSIZE);
+    /*
+     * Start a new generation for this packet. Entries left over from
+     * previous packets become invalid without us having to clear the
+     * whole table, whose size is governed by the largest packet seen
+     * so far rather than by this one.
+     */
+    if (++ctx->gencur == 0) {
+        /* The generation counter wrapped: clear the tags so that
+         * stale ones can't collide with the restarted count. */
+        memset(ctx->gen, 0, ctx->n * sizeof(uint32));
+        ctx->gencur = 1;
+    }
 
-    if (IV)
-        ctx->h[HASH(IV) & (ctx->n - 1)] = HASH_IV;
+    if (IV) {
+        i = HASH(IV) & (ctx->n - 1);
+        ctx->h[i] = HASH_IV;
+        ctx->gen[i] = ctx->gencur;
+    }
 
     for (c = buf, j = 0; c < (buf + len); c += SSH_BLOCKSIZE, j++) {
-        for (i = HASH(c) & (ctx->n - 1); ctx->h[i] != HASH_UNUSED;
+        for (i = HASH(c) & (ctx->n - 1); ctx->gen[i] == ctx->gencur;
              i = (i + 1) & (ctx->n - 1)) {
             if (ctx->h[i] == HASH_IV) {
                 if (!CMP(c, IV)) {
@@ -167,6 +183,7 @@ int detect_attack(void *handle, uchar *buf, uint32 len, uchar *IV)
             }
         }
         ctx->h[i] = j;
+        ctx->gen[i] = ctx->gencur;
     }
     return 0;                          /* ok */
 }
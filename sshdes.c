@@ -520,6 +520,44 @@ static const word32 SPboxes[8][64] = {
     bitswap(R, L, 16, 0x0000FFFF), \
     bitswap(R, L,  4, 0x0F0F0F0F))
 
+/* The sixteen rounds of a single DES keying stage, in both key
+ * orders, on the register pair (L, R). */
+#define SIXTEEN_ROUNDS_FWD(sched) ( \
+    L ^= f(R, (sched)->k0246[0], (sched)->k1357[0]), \
+    R ^= f(L, (sched)->k0246[1], (sched)->k1357[1]), \
+    L ^= f(R, (sched)->k0246[2], (sched)->k1357[2]), \
+    R ^= f(L, (sched)->k0246[3], (sched)->k1357[3]), \
+    L ^= f(R, (sched)->k0246[4], (sched)->k1357[4]), \
+    R ^= f(L, (sched)->k0246[5], (sched)->k1357[5]), \
+    L ^= f(R, (sched)->k0246[6], (sched)->k1357[6]), \
+    R ^= f(L, (sched)->k0246[7], (sched)->k1357[7]), \
+    L ^= f(R, (sched)->k0246[8], (sched)->k1357[8]), \
+    R ^= f(L, (sched)->k0246[9], (sched)->k1357[9]), \
+    L ^= f(R, (sched)->k0246[10], (sched)->k1357[10]), \
+    R ^= f(L, (sched)->k0246[11], (sched)->k1357[11]), \
+    L ^= f(R, (sched)->k0246[12], (sched)->k1357[12]), \
+    R ^= f(L, (sched)->k0246[13], (sched)->k1357[13]), \
+    L ^= f(R, (sched)->k0246[14], (sched)->k1357[14]), \
+    R ^= f(L, (sched)->k0246[15], (sched)->k1357[15]))
+
+#define SIXTEEN_ROUNDS_REV(sched) ( \
+    L ^= f(R, (sched)->k0246[15], (sched)->k1357[15]), \
+    R ^= f(L, (sched)->k0246[14], (sched)->k1357[14]), \
+    L ^= f(R, (sched)->k0246[13], (sched)->k1357[13]), \
+    R ^= f(L, (sched)->k0246[12], (sched)->k1357[12]), \
+    L ^= f(R, (sched)->k0246[11], (sched)->k1357[11]), \
+    R ^= f(L, (sched)->k0246[10], (sched)->k1357[10]), \
+    L ^= f(R, (sched)->k0246[9], (sched)->k1357[9]), \
+    R ^= f(L, (sched)->k0246[8], (sched)->k1357[8]), \
+    L ^= f(R, (sched)->k0246[7], (sched)->k1357[7]), \
+    R ^= f(L, (sched)->k0246[6], (sched)->k1357[6]), \
+    L ^= f(R, (sched)->k0246[5], (sched)->k1357[5]), \
+    R ^= f(L, (sched)->k0246[4], (sched)->k1357[4]), \
+    L ^= f(R, (sched)->k0246[3], (sched)->k1357[3]), \
+    R ^= f(L, (sched)->k0246[2], (sched)->k1357[2]), \
+    L ^= f(R, (sched)->k0246[1], (sched)->k1357[1]), \
+    R ^= f(L, (sched)->k0246[0], (sched)->k1357[0]))
+
 static void des_encipher(word32 * output, word32 L, word32 R,
 			 DESContext * sched)
 {
@@ -530,22 +568,7 @@ static void des_encipher(word32 * output, word32 L, word32 R,
     L = rotl(L, 1);
     R = rotl(R, 1);
 
-    L ^= f(R, sched->k0246[0], sched->k1357[0]);
-    R ^= f(L, sched->k0246[1], sched->k1357[1]);
-    L ^= f(R, sched->k0246[2], sched->k1357[2]);
-    R ^= f(L, sched->k0246[3], sched->k1357[3]);
-    L ^= f(R, sched->k0246[4], sched->k1357[4]);
-    R ^= f(L, sched->k0246[5], sched->k1357[5]);
-    L ^= f(R, sched->k0246[6], sched->k1357[6]);
-    R ^= f(L, sched->k0246[7], sched->k1357[7]);
-    L ^= f(R, sched->k0246[8], sched->k1357[8]);
-    R ^= f(L, sched->k0246[9], sched->k1357[9]);
-    L ^= f(R, sched->k0246[10], sched->k1357[10]);
-    R ^= f(L, sched->k0246[11], sched->k1357[11]);
-    L ^= f(R, sched->k0246[12], sched->k1357[12]);
-    R ^= f(L, sched->k0246[13], sched->k1357[13]);
-    L ^= f(R, sched->k0246[14], sched->k1357[14]);
-    R ^= f(L, sched->k0246[15], sched->k1357[15]);
+    SIXTEEN_ROUNDS_FWD(sched);
 
     L = rotl(L, 31);
     R = rotl(R, 31);
@@ -570,22 +593,76 @@ static void des_decipher(word32 * output, word32 L, word32 R,
     L = rotl(L, 1);
     R = rotl(R, 1);
 
-    L ^= f(R, sched->k0246[15], sched->k1357[15]);
-    R ^= f(L, sched->k0246[14], sched->k1357[14]);
-    L ^= f(R, sched->k0246[13], sched->k1357[13]);
-    R ^= f(L, sched->k0246[12], sched->k1357[12]);
-    L ^= f(R, sched->k0246[11], sched->k1357[11]);
-    R ^= f(L, sched->k0246[10], sched->k1357[10]);
-    L ^= f(R, sched->k0246[9], sched->k1357[9]);
-    R ^= f(L, sched->k0246[8], sched->k1357[8]);
-    L ^= f(R, sched->k0246[7], sched->k1357[7]);
-    R ^= f(L, sched->k0246[6], sched->k1357[6]);
-    L ^= f(R, sched->k0246[5], sched->k1357[5]);
-    R ^= f(L, sched->k0246[4], sched->k1357[4]);
-    L ^= f(R, sched->k0246[3], sched->k1357[3]);
-    R ^= f(L, sched->k0246[2], sched->k1357[2]);
-    L ^= f(R, sched->k0246[1], sched->k1357[1]);
-    R ^= f(L, sched->k0246[0], sched->k1357[0]);
+    SIXTEEN_ROUNDS_REV(sched);
+
+    L = rotl(L, 31);
+    R = rotl(R, 31);
+
+    swap = L;
+    L = R;
+    R = swap;
+
+    FP(L, R);
+
+    output[0] = L;
+    output[1] = R;
+}
+
+/*
+ * Fused three-key enciphering for the EDE paths below. Feeding one
+ * des_encipher/des_decipher's output straight into the next performs
+ * a final permutation and rotation which the next stage's initial
+ * permutation and rotation immediately undo, so composing the three
+ * stages into one function does the IP/FP pair and the rotations
+ * just once per block and keeps the block in registers throughout.
+ * All that survives of each stage boundary is the L/R interchange,
+ * which appears here as the explicit swaps between round batches.
+ */
+
+static void des_encipher3(word32 * output, word32 L, word32 R,
+			  DESContext * scheds)
+{
+    word32 swap, s0246, s1357;
+
+    IP(L, R);
+
+    L = rotl(L, 1);
+    R = rotl(R, 1);
+
+    SIXTEEN_ROUNDS_FWD(&scheds[0]);
+    swap = L; L = R; R = swap;
+    SIXTEEN_ROUNDS_REV(&scheds[1]);
+    swap = L; L = R; R = swap;
+    SIXTEEN_ROUNDS_FWD(&scheds[2]);
+
+    L = rotl(L, 31);
+    R = rotl(R, 31);
+
+    swap = L;
+    L = R;
+    R = swap;
+
+    FP(L, R);
+
+    output[0] = L;
+    output[1] = R;
+}
+
+static void des_decipher3(word32 * output, word32 L, word32 R,
+			  DESContext * scheds)
+{
+    word32 swap, s0246, s1357;
+
+    IP(L, R);
+
+    L = rotl(L, 1);
+    R = rotl(R, 1);
+
+    SIXTEEN_ROUNDS_REV(&scheds[2]);
+    swap = L; L = R; R = swap;
+    SIXTEEN_ROUNDS_FWD(&scheds[1]);
+    swap = L; L = R; R = swap;
+    SIXTEEN_ROUNDS_REV(&scheds[0]);
 
     L = rotl(L, 31);
     R = rotl(R, 31);
@@ -671,9 +748,7 @@ static void des_cbc3_encrypt(unsigned char *blk,
     for (i = 0; i < len; i += 8) {
 	iv0 ^= GET_32BIT_MSB_FIRST(blk);
 	iv1 ^= GET_32BIT_MSB_FIRST(blk + 4);
-	des_encipher(out, iv0, iv1, &scheds[0]);
-	des_decipher(out, out[0], out[1], &scheds[1]);
-	des_encipher(out, out[0], out[1], &scheds[2]);
+	des_encipher3(out, iv0, iv1, scheds);
 	iv0 = out[0];
 	iv1 = out[1];
 	PUT_32BIT_MSB_FIRST(blk, iv0);
@@ -705,9 +780,7 @@ static void des_cbc3_decrypt(unsigned char *blk,
     for (i = 0; i < len; i += 8) {
 	xL = GET_32BIT_MSB_FIRST(blk);
 	xR = GET_32BIT_MSB_FIRST(blk + 4);
-	des_decipher(out, xL, xR, &scheds[2]);
-	des_encipher(out, out[0], out[1], &scheds[1]);
-	des_decipher(out, out[0], out[1], &scheds[0]);
+	des_decipher3(out, xL, xR, scheds);
 	iv0 ^= out[0];
 	iv1 ^= out[1];
 	PUT_32BIT_MSB_FIRST(blk, iv0);
@@ -731,9 +804,7 @@ static void des_sdctr3(unsigned char *blk,
     iv0 = scheds->iv0;
     iv1 = scheds->iv1;
     for (i = 0; i < len; i += 8) {
-	des_encipher(b, iv0, iv1, &scheds[0]);
-	des_decipher(b, b[0], b[1], &scheds[1]);
-	des_encipher(b, b[0], b[1], &scheds[2]);
+	des_encipher3(b, iv0, iv1, scheds);
 	tmp = GET_32BIT_MSB_FIRST(blk);
 	PUT_32BIT_MSB_FIRST(blk, tmp ^ b[0]);
 	blk += 4;
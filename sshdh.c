@@ -138,6 +138,20 @@ int dh_is_gex(const struct ssh_kex *kex)
     return extra->pdata == NULL;
 }
 
+/*
+ * Process-wide cache of the derived parameters for the standard
+ * groups. The groups themselves are static data, and every context
+ * set up for one of them needs the same p and g bignums plus the q
+ * and qmask values dh_init() derives from them; sessions that rekey
+ * repeatedly, or processes that open many short-lived connections,
+ * shouldn't re-derive all that per key exchange. Contexts still own
+ * plain copies of the cached values, so dh_cleanup() is unaffected.
+ */
+static struct dh_group_cache {
+    const struct ssh_kex *kex;
+    Bignum p, g, q, qmask;
+} dh_group_cache[4];
+
 /*
  * Initialise DH for a standard group.
  */
@@ -145,9 +159,35 @@ void *dh_setup_group(const struct ssh_kex *kex)
 {
     const struct dh_extra *extra = (const struct dh_extra *)kex->extra;
     struct dh_ctx *ctx = snew(struct dh_ctx);
-    ctx->p = bignum_from_bytes(extra->pdata, extra->plen);
-    ctx->g = bignum_from_bytes(extra->gdata, extra->glen);
-    dh_init(ctx);
+    struct dh_group_cache *gc;
+
+    for (gc = dh_group_cache;
+         gc < dh_group_cache + lenof(dh_group_cache); gc++) {
+        if (gc->kex == kex)
+            break;
+        if (!gc->kex) {
+            gc->p = bignum_from_bytes(extra->pdata, extra->plen);
+            gc->g = bignum_from_bytes(extra->gdata, extra->glen);
+            gc->q = bignum_rshift(gc->p, 1);
+            gc->qmask = bignum_bitmask(gc->q);
+            gc->kex = kex;
+            break;
+        }
+    }
+
+    if (gc < dh_group_cache + lenof(dh_group_cache)) {
+        ctx->p = copybn(gc->p);
+        ctx->g = copybn(gc->g);
+        ctx->q = copybn(gc->q);
+        ctx->qmask = copybn(gc->qmask);
+        ctx->x = ctx->e = NULL;
+    } else {
+        /* Cache full (shouldn't happen: there are fewer standard
+         * groups than cache slots). Fall back to deriving directly. */
+        ctx->p = bignum_from_bytes(extra->pdata, extra->plen);
+        ctx->g = bignum_from_bytes(extra->gdata, extra->glen);
+        dh_init(ctx);
+    }
     return ctx;
 }
 
@@ -192,8 +232,15 @@ void dh_cleanup(void *handle)
  * "On Diffie-Hellman Key Agreement with Short Exponents".
  * Advances in Cryptology: Proceedings of Eurocrypt '96
  * Springer-Verlag, May 1996.
+ *
+ * The stage is split into two callable parts: dh_gen_x() draws the
+ * secret exponent from the random pool, which has no locking and so
+ * may only be touched on the main thread, while dh_compute_e() is
+ * pure arithmetic and is safe to run on an offload worker thread.
+ * dh_create_e() combines the two for callers doing the whole thing
+ * in one place.
  */
-Bignum dh_create_e(void *handle, int nbits)
+void dh_gen_x(void *handle, int nbits)
 {
     struct dh_ctx *ctx = (struct dh_ctx *)handle;
     int i;
@@ -233,15 +280,26 @@ Bignum dh_create_e(void *handle, int nbits)
     } while (bignum_cmp(ctx->x, One) <= 0 || bignum_cmp(ctx->x, ctx->q) >= 0);
 
     sfree(buf);
+}
+
+Bignum dh_compute_e(void *handle)
+{
+    struct dh_ctx *ctx = (struct dh_ctx *)handle;
 
     /*
-     * Done. Now compute e = g^x mod p.
+     * Compute e = g^x mod p.
      */
     ctx->e = modpow(ctx->g, ctx->x, ctx->p);
 
     return ctx->e;
 }
 
+Bignum dh_create_e(void *handle, int nbits)
+{
+    dh_gen_x(handle, nbits);
+    return dh_compute_e(handle);
+}
+
 /*
  * DH stage 2-epsilon: given a number f, validate it to ensure it's in
  * range. (RFC 4253 section 8: "Values of 'e' or 'f' that are not in
@@ -54,6 +54,8 @@ static void initialise_wcurve(struct ec_curve *curve, int bits,
 
     curve->fieldBits = bits;
     curve->p = bignum_from_bytes(p, length);
+    curve->fieldMod = NULL;
+    curve->fieldMul = NULL;
 
     /* Curve co-efficients */
     curve->w.a = bignum_from_bytes(a, length);
@@ -79,6 +81,8 @@ static void initialise_mcurve(struct ec_curve *curve, int bits,
 
     curve->fieldBits = bits;
     curve->p = bignum_from_bytes(p, length);
+    curve->fieldMod = NULL;
+    curve->fieldMul = NULL;
 
     /* Curve co-efficients */
     curve->m.a = bignum_from_bytes(a, length);
@@ -104,6 +108,8 @@ static void initialise_ecurve(struct ec_curve *curve, int bits,
 
     curve->fieldBits = bits;
     curve->p = bignum_from_bytes(p, length);
+    curve->fieldMod = NULL;
+    curve->fieldMul = NULL;
 
     /* Curve co-efficients */
     curve->e.l = bignum_from_bytes(l, length);
@@ -162,6 +168,8 @@ static struct ec_curve *ec_p256(void)
 
         initialise_wcurve(&curve, 256, p, a, b, n, Gx, Gy);
         curve.textname = curve.name = "nistp256";
+        curve.fieldMod = bignum_nistp256_mod;
+        curve.fieldMul = bignum_nistp256_mulmod;
 
         /* Now initialised, no need to do it again */
         initialised = 1;
@@ -228,6 +236,8 @@ static struct ec_curve *ec_p384(void)
 
         initialise_wcurve(&curve, 384, p, a, b, n, Gx, Gy);
         curve.textname = curve.name = "nistp384";
+        curve.fieldMod = bignum_nistp384_mod;
+        curve.fieldMul = bignum_nistp384_mulmod;
 
         /* Now initialised, no need to do it again */
         initialised = 1;
@@ -439,19 +449,34 @@ static int ec_aminus3(const struct ec_curve *curve)
  * Elliptic curve field maths
  */
 
+static Bignum ecf_mod(const Bignum a, const struct ec_curve *curve)
+{
+    if (curve->fieldMod)
+        return curve->fieldMod(a);
+    return bigmod(a, curve->p);
+}
+
+static Bignum ecf_mul(const Bignum a, const Bignum b,
+                      const struct ec_curve *curve)
+{
+    if (curve->fieldMul)
+        return curve->fieldMul(a, b);
+    return modmul(a, b, curve->p);
+}
+
 static Bignum ecf_add(const Bignum a, const Bignum b,
                       const struct ec_curve *curve)
 {
     Bignum a1, b1, ab, ret;
 
-    a1 = bigmod(a, curve->p);
-    b1 = bigmod(b, curve->p);
+    a1 = ecf_mod(a, curve);
+    b1 = ecf_mod(b, curve);
 
     ab = bigadd(a1, b1);
     freebn(a1);
     freebn(b1);
 
-    ret = bigmod(ab, curve->p);
+    ret = ecf_mod(ab, curve);
     freebn(ab);
 
     return ret;
@@ -459,7 +484,7 @@ static Bignum ecf_add(const Bignum a, const Bignum b,
 
 static Bignum ecf_square(const Bignum a, const struct ec_curve *curve)
 {
-    return modmul(a, a, curve->p);
+    return ecf_mul(a, a, curve);
 }
 
 static Bignum ecf_treble(const Bignum a, const struct ec_curve *curve)
@@ -550,8 +575,8 @@ static int ec_point_verify(const struct ec_point *a)
 
         y2 = ecf_square(a->y, a->curve);
         x2 = ecf_square(a->x, a->curve);
-        tmp = modmul(a->curve->e.d, x2, a->curve->p);
-        tmp2 = modmul(tmp, y2, a->curve->p);
+        tmp = ecf_mul(a->curve->e.d, x2, a->curve);
+        tmp2 = ecf_mul(tmp, y2, a->curve);
         freebn(tmp);
         tmp = modsub(y2, x2, a->curve->p);
         freebn(y2);
@@ -570,20 +595,20 @@ static int ec_point_verify(const struct ec_point *a)
 
         Bignum Three = bignum_from_long(3);
 
-        lhs = modmul(a->y, a->y, a->curve->p);
+        lhs = ecf_mul(a->y, a->y, a->curve);
 
         /* This uses montgomery multiplication to optimise */
         x3 = modpow(a->x, Three, a->curve->p);
         freebn(Three);
-        ax = modmul(a->curve->w.a, a->x, a->curve->p);
+        ax = ecf_mul(a->curve->w.a, a->x, a->curve);
         x3ax = bigadd(x3, ax);
         freebn(x3); x3 = NULL;
         freebn(ax); ax = NULL;
-        x3axm = bigmod(x3ax, a->curve->p);
+        x3axm = ecf_mod(x3ax, a->curve);
         freebn(x3ax); x3ax = NULL;
         x3axb = bigadd(x3axm, a->curve->w.b);
         freebn(x3axm); x3axm = NULL;
-        rhs = bigmod(x3axb, a->curve->p);
+        rhs = ecf_mod(x3axb, a->curve);
         freebn(x3axb);
 
         ret = bignum_cmp(lhs, rhs) ? 0 : 1;
@@ -633,10 +658,10 @@ static int ecp_normalise(struct ec_point *a)
             freebn(Z2);
             return 0;
         }
-        tx = modmul(a->x, Z2inv, a->curve->p);
+        tx = ecf_mul(a->x, Z2inv, a->curve);
         freebn(Z2inv);
 
-        Z3 = modmul(Z2, a->z, a->curve->p);
+        Z3 = ecf_mul(Z2, a->z, a->curve);
         freebn(Z2);
         Z3inv = modinv(Z3, a->curve->p);
         freebn(Z3);
@@ -644,7 +669,7 @@ static int ecp_normalise(struct ec_point *a)
             freebn(tx);
             return 0;
         }
-        ty = modmul(a->y, Z3inv, a->curve->p);
+        ty = ecf_mul(a->y, Z3inv, a->curve);
         freebn(Z3inv);
 
         freebn(a->x);
@@ -671,7 +696,7 @@ static int ecp_normalise(struct ec_point *a)
         if (!tmp) {
             return 0;
         }
-        tmp2 = modmul(a->x, tmp, a->curve->p);
+        tmp2 = ecf_mul(a->x, tmp, a->curve);
         freebn(tmp);
 
         freebn(a->z);
@@ -702,7 +727,7 @@ static struct ec_point *ecp_doublew(const struct ec_point *a, const int aminus3)
         Bignum Y2, XY2, _2XY2;
 
         Y2 = ecf_square(a->y, a->curve);
-        XY2 = modmul(a->x, Y2, a->curve->p);
+        XY2 = ecf_mul(a->x, Y2, a->curve);
         freebn(Y2);
 
         _2XY2 = ecf_double(XY2, a->curve);
@@ -726,7 +751,7 @@ static struct ec_point *ecp_doublew(const struct ec_point *a, const int aminus3)
         XmZ2 = modsub(a->x, Z2, a->curve->p);
         freebn(Z2);
 
-        second = modmul(XpZ2, XmZ2, a->curve->p);
+        second = ecf_mul(XpZ2, XmZ2, a->curve);
         freebn(XpZ2);
         freebn(XmZ2);
 
@@ -744,11 +769,11 @@ static struct ec_point *ecp_doublew(const struct ec_point *a, const int aminus3)
             Z2 = ecf_square(a->z, a->curve);
             Z4 = ecf_square(Z2, a->curve);
             freebn(Z2);
-            aZ4 = modmul(a->curve->w.a, Z4, a->curve->p);
+            aZ4 = ecf_mul(a->curve->w.a, Z4, a->curve);
             freebn(Z4);
         }
 
-        X2 = modmul(a->x, a->x, a->curve->p);
+        X2 = ecf_mul(a->x, a->x, a->curve);
         _3X2 = ecf_treble(X2, a->curve);
         freebn(X2);
         M = ecf_add(_3X2, aZ4, a->curve);
@@ -773,14 +798,14 @@ static struct ec_point *ecp_doublew(const struct ec_point *a, const int aminus3)
 
         SX = modsub(S, outx, a->curve->p);
         freebn(S);
-        MSX = modmul(M, SX, a->curve->p);
+        MSX = ecf_mul(M, SX, a->curve);
         freebn(SX);
         freebn(M);
         Y2 = ecf_square(a->y, a->curve);
         Y4 = ecf_square(Y2, a->curve);
         freebn(Y2);
         Eight = bignum_from_long(8);
-        _8Y4 = modmul(Eight, Y4, a->curve->p);
+        _8Y4 = ecf_mul(Eight, Y4, a->curve);
         freebn(Eight);
         freebn(Y4);
         outy = modsub(MSX, _8Y4, a->curve->p);
@@ -795,7 +820,7 @@ static struct ec_point *ecp_doublew(const struct ec_point *a, const int aminus3)
         if (a->z == NULL) {
             YZ = copybn(a->y);
         } else {
-            YZ = modmul(a->y, a->z, a->curve->p);
+            YZ = ecf_mul(a->y, a->z, a->curve);
         }
 
         outz = ecf_double(YZ, a->curve);
@@ -828,7 +853,7 @@ static struct ec_point *ecp_doublem(const struct ec_point *a)
     }
 
     /* outx = (x + z)^2 * (x - z)^2 */
-    outx = modmul(xpz, xmz, a->curve->p);
+    outx = ecf_mul(xpz, xmz, a->curve);
 
     /* outz = 4xz * ((x - z)^2 + ((A + 2) / 4)*4xz) */
     {
@@ -840,7 +865,7 @@ static struct ec_point *ecp_doublem(const struct ec_point *a)
 
         _4xz = modsub(xpz, xmz, a->curve->p);
         freebn(xpz);
-        tmp = modmul(tmp2, _4xz, a->curve->p);
+        tmp = ecf_mul(tmp2, _4xz, a->curve);
         freebn(tmp2);
 
         tmp2 = bignum_from_long(4);
@@ -853,14 +878,14 @@ static struct ec_point *ecp_doublem(const struct ec_point *a)
             freebn(xmz);
             return NULL;
         }
-        tmp2 = modmul(tmp, tmp3, a->curve->p);
+        tmp2 = ecf_mul(tmp, tmp3, a->curve);
         freebn(tmp);
         freebn(tmp3);
 
         tmp = ecf_add(xmz, tmp2, a->curve);
         freebn(xmz);
         freebn(tmp2);
-        outz = modmul(_4xz, tmp, a->curve->p);
+        outz = ecf_mul(_4xz, tmp, a->curve);
         freebn(_4xz);
         freebn(tmp);
     }
@@ -907,10 +932,10 @@ static struct ec_point *ecp_addw(const struct ec_point *a,
         Bignum Z2, Z3;
 
         Z2 = ecf_square(b->z, a->curve);
-        U1 = modmul(a->x, Z2, a->curve->p);
-        Z3 = modmul(Z2, b->z, a->curve->p);
+        U1 = ecf_mul(a->x, Z2, a->curve);
+        Z3 = ecf_mul(Z2, b->z, a->curve);
         freebn(Z2);
-        S1 = modmul(a->y, Z3, a->curve->p);
+        S1 = ecf_mul(a->y, Z3, a->curve);
         freebn(Z3);
     } else {
         U1 = copybn(a->x);
@@ -923,10 +948,10 @@ static struct ec_point *ecp_addw(const struct ec_point *a,
         Bignum Z2, Z3;
 
         Z2 = ecf_square(a->z, b->curve);
-        U2 = modmul(b->x, Z2, b->curve->p);
-        Z3 = modmul(Z2, a->z, b->curve->p);
+        U2 = ecf_mul(b->x, Z2, b->curve);
+        Z3 = ecf_mul(Z2, a->z, b->curve);
         freebn(Z2);
-        S2 = modmul(b->y, Z3, b->curve->p);
+        S2 = ecf_mul(b->y, Z3, b->curve);
         freebn(Z3);
     } else {
         U2 = copybn(b->x);
@@ -969,9 +994,9 @@ static struct ec_point *ecp_addw(const struct ec_point *a,
             Bignum R2, H2, _2UH2, first;
 
             H2 = ecf_square(H, a->curve);
-            UH2 = modmul(U1, H2, a->curve->p);
+            UH2 = ecf_mul(U1, H2, a->curve);
             freebn(U1);
-            H3 = modmul(H2, H, a->curve->p);
+            H3 = ecf_mul(H2, H, a->curve);
             freebn(H2);
             R2 = ecf_square(R, a->curve);
             _2UH2 = ecf_double(UH2, a->curve);
@@ -988,10 +1013,10 @@ static struct ec_point *ecp_addw(const struct ec_point *a,
 
             UH2mX = modsub(UH2, outx, a->curve->p);
             freebn(UH2);
-            RUH2mX = modmul(R, UH2mX, a->curve->p);
+            RUH2mX = ecf_mul(R, UH2mX, a->curve);
             freebn(UH2mX);
             freebn(R);
-            SH3 = modmul(S1, H3, a->curve->p);
+            SH3 = ecf_mul(S1, H3, a->curve);
             freebn(S1);
             freebn(H3);
 
@@ -1004,15 +1029,15 @@ static struct ec_point *ecp_addw(const struct ec_point *a,
         if (a->z && b->z) {
             Bignum ZZ;
 
-            ZZ = modmul(a->z, b->z, a->curve->p);
-            outz = modmul(H, ZZ, a->curve->p);
+            ZZ = ecf_mul(a->z, b->z, a->curve);
+            outz = ecf_mul(H, ZZ, a->curve);
             freebn(H);
             freebn(ZZ);
         } else if (a->z) {
-            outz = modmul(H, a->z, a->curve->p);
+            outz = ecf_mul(H, a->z, a->curve);
             freebn(H);
         } else if (b->z) {
-            outz = modmul(H, b->z, a->curve->p);
+            outz = ecf_mul(H, b->z, a->curve);
             freebn(H);
         } else {
             outz = H;
@@ -1046,14 +1071,14 @@ static struct ec_point *ecp_addm(const struct ec_point *a,
         /* (Xa + Za) * (Xb - Zb) */
         tmp = ecf_add(a->x, az, a->curve);
         tmp2 = modsub(b->x, bz, a->curve->p);
-        tmp3 = modmul(tmp, tmp2, a->curve->p);
+        tmp3 = ecf_mul(tmp, tmp2, a->curve);
         freebn(tmp);
         freebn(tmp2);
 
         /* (Xa - Za) * (Xb + Zb) */
         tmp = modsub(a->x, az, a->curve->p);
         tmp2 = ecf_add(b->x, bz, a->curve);
-        tmp4 = modmul(tmp, tmp2, a->curve->p);
+        tmp4 = ecf_mul(tmp, tmp2, a->curve);
         freebn(tmp);
         freebn(tmp2);
 
@@ -1066,7 +1091,7 @@ static struct ec_point *ecp_addm(const struct ec_point *a,
         freebn(tmp4);
         tmp2 = ecf_square(tmp, a->curve);
         freebn(tmp);
-        outz = modmul(base->x, tmp2, a->curve->p);
+        outz = ecf_mul(base->x, tmp2, a->curve);
         freebn(tmp2);
     }
 
@@ -1083,14 +1108,14 @@ static struct ec_point *ecp_adde(const struct ec_point *a,
     {
         Bignum tmp, tmp2, tmp3, tmp4;
 
-        tmp = modmul(a->x, b->y, a->curve->p);
-        tmp2 = modmul(b->x, a->y, a->curve->p);
+        tmp = ecf_mul(a->x, b->y, a->curve);
+        tmp2 = ecf_mul(b->x, a->y, a->curve);
         tmp3 = ecf_add(tmp, tmp2, a->curve);
 
-        tmp4 = modmul(tmp, tmp2, a->curve->p);
+        tmp4 = ecf_mul(tmp, tmp2, a->curve);
         freebn(tmp);
         freebn(tmp2);
-        dmul = modmul(a->curve->e.d, tmp4, a->curve->p);
+        dmul = ecf_mul(a->curve->e.d, tmp4, a->curve);
         freebn(tmp4);
 
         tmp = ecf_add(One, dmul, a->curve);
@@ -1103,7 +1128,7 @@ static struct ec_point *ecp_adde(const struct ec_point *a,
             return NULL;
         }
 
-        outx = modmul(tmp3, tmp2, a->curve->p);
+        outx = ecf_mul(tmp3, tmp2, a->curve);
         freebn(tmp3);
         freebn(tmp2);
     }
@@ -1124,13 +1149,13 @@ static struct ec_point *ecp_adde(const struct ec_point *a,
             return NULL;
         }
 
-        tmp = modmul(a->y, b->y, a->curve->p);
-        tmp3 = modmul(a->x, b->x, a->curve->p);
+        tmp = ecf_mul(a->y, b->y, a->curve);
+        tmp3 = ecf_mul(a->x, b->x, a->curve);
         tmp4 = ecf_add(tmp, tmp3, a->curve);
         freebn(tmp);
         freebn(tmp3);
 
-        outy = modmul(tmp4, tmp2, a->curve->p);
+        outy = ecf_mul(tmp4, tmp2, a->curve);
         freebn(tmp4);
         freebn(tmp2);
     }
@@ -1192,9 +1217,18 @@ static struct ec_point *ecp_mul_(const struct ec_point *a, const Bignum b, int a
     return ret;
 }
 
+static struct ec_point *ecp_mul_fixed(const struct ec_point *g,
+                                      const Bignum n, int aminus3);
+
 static struct ec_point *ecp_mulw(const struct ec_point *a, const Bignum b)
 {
-    struct ec_point *ret = ecp_mul_(a, b, ec_aminus3(a->curve));
+    int aminus3 = ec_aminus3(a->curve);
+    struct ec_point *ret = NULL;
+
+    if (a == &a->curve->w.G)
+        ret = ecp_mul_fixed(a, b, aminus3);
+    if (!ret)
+        ret = ecp_mul_(a, b, aminus3);
 
     if (!ecp_normalise(ret)) {
         ec_point_free(ret);
@@ -1209,6 +1243,12 @@ static struct ec_point *ecp_mule(const struct ec_point *a, const Bignum b)
     int i;
     struct ec_point *ret;
 
+    if (a == &a->curve->e.B) {
+        ret = ecp_mul_fixed(a, b, 0);
+        if (ret)
+            return ret;
+    }
+
     ret = ec_point_new(a->curve, NULL, NULL, NULL, 1);
 
     for (i = bignum_bitcount(b); i >= 0 && ret; --i)
@@ -1278,6 +1318,104 @@ static struct ec_point *ecp_mulm(const struct ec_point *p, const Bignum n)
     return P1;
 }
 
+/*
+ * Fixed-base optimisation for multiplications by a curve's standard
+ * generator, which is what ECDH keypair generation, EdDSA/ECDSA
+ * signing and the fixed-base half of signature verification all do.
+ * The curve structures are static singletons, so we can recognise the
+ * generator by its address and keep a lazily built per-curve table of
+ * its first few multiples, then consume the scalar several bits at a
+ * time. That saves about half the point additions relative to the
+ * plain double-and-add ladders above, which matters particularly on
+ * Edwards curves where every addition performs modular inversions.
+ *
+ * (Montgomery curves are excluded: their x-only ladder cannot combine
+ * arbitrary precomputed multiples, and is efficient as it stands.)
+ */
+#define FIXED_BASE_WBITS 4
+#define FIXED_BASE_TSIZE ((1 << FIXED_BASE_WBITS) - 1)
+#define FIXED_BASE_NCURVES 8
+
+static struct ecp_fixed_base {
+    const struct ec_curve *curve;
+    struct ec_point *mult[FIXED_BASE_TSIZE];   /* mult[i] = (i+1)*G */
+} fixed_bases[FIXED_BASE_NCURVES];
+
+static struct ecp_fixed_base *ecp_fixed_base_for(const struct ec_point *g,
+                                                 int aminus3)
+{
+    struct ecp_fixed_base *fb;
+    int i;
+
+    for (fb = fixed_bases; fb < fixed_bases + FIXED_BASE_NCURVES; fb++) {
+        if (fb->curve == g->curve)
+            return fb;
+        if (!fb->curve)
+            break;
+    }
+    if (fb == fixed_bases + FIXED_BASE_NCURVES)
+        return NULL;                   /* cache full (shouldn't happen) */
+
+    /*
+     * Build the table of small multiples of g, normalising each one
+     * so that later additions see affine inputs.
+     */
+    fb->mult[0] = ec_point_copy(g);
+    for (i = 1; i < FIXED_BASE_TSIZE; i++) {
+        fb->mult[i] = ecp_add(fb->mult[i-1], g, aminus3);
+        if (!fb->mult[i] || !ecp_normalise(fb->mult[i])) {
+            do {
+                if (fb->mult[i])
+                    ec_point_free(fb->mult[i]);
+            } while (i-- > 0);
+            return NULL;
+        }
+    }
+    fb->curve = g->curve;
+    return fb;
+}
+
+static struct ec_point *ecp_mul_fixed(const struct ec_point *g,
+                                      const Bignum n, int aminus3)
+{
+    struct ecp_fixed_base *fb = ecp_fixed_base_for(g, aminus3);
+    struct ec_point *ret;
+    int bits, i, j;
+
+    if (!fb)
+        return NULL;
+
+    ret = ec_point_new(g->curve, NULL, NULL, NULL, 1);
+
+    /* Round the scalar length up to a whole number of windows;
+     * bignum_bit returns 0 beyond the top of the number. */
+    bits = bignum_bitcount(n);
+    bits += (FIXED_BASE_WBITS - 1) - (bits + FIXED_BASE_WBITS - 1) % FIXED_BASE_WBITS;
+
+    for (i = bits - FIXED_BASE_WBITS; i >= 0 && ret; i -= FIXED_BASE_WBITS) {
+        int window = 0;
+
+        if (i != bits - FIXED_BASE_WBITS) {
+            for (j = 0; j < FIXED_BASE_WBITS && ret; j++) {
+                struct ec_point *tmp = ecp_double(ret, aminus3);
+                ec_point_free(ret);
+                ret = tmp;
+            }
+        }
+
+        for (j = FIXED_BASE_WBITS - 1; j >= 0; j--)
+            window = (window << 1) | bignum_bit(n, i + j);
+
+        if (ret && window) {
+            struct ec_point *tmp = ecp_add(ret, fb->mult[window-1], aminus3);
+            ec_point_free(ret);
+            ret = tmp;
+        }
+    }
+
+    return ret;
+}
+
 /* Not static because it is used by sshecdsag.c to generate a new key */
 struct ec_point *ecp_mul(const struct ec_point *a, const Bignum b)
 {
@@ -1302,7 +1440,9 @@ static struct ec_point *ecp_summul(const Bignum a, const Bignum b,
 
     aminus3 = ec_aminus3(point->curve);
 
-    aG = ecp_mul_(&point->curve->w.G, a, aminus3);
+    aG = ecp_mul_fixed(&point->curve->w.G, a, aminus3);
+    if (!aG)
+        aG = ecp_mul_(&point->curve->w.G, a, aminus3);
     if (!aG) return NULL;
     bP = ecp_mul_(point, b, aminus3);
     if (!bP) {
@@ -1332,7 +1472,7 @@ static Bignum *ecp_edx(const struct ec_curve *curve, const Bignum y)
         Bignum tmp, tmp2, tmp3;
 
         tmp = ecf_square(y, curve);
-        tmp2 = modmul(curve->e.d, tmp, curve->p);
+        tmp2 = ecf_mul(curve->e.d, tmp, curve);
         tmp3 = ecf_add(tmp2, One, curve);
         freebn(tmp2);
         tmp2 = modinv(tmp3, curve->p);
@@ -1344,7 +1484,7 @@ static Bignum *ecp_edx(const struct ec_curve *curve, const Bignum y)
 
         tmp3 = modsub(tmp, One, curve->p);
         freebn(tmp);
-        xx = modmul(tmp3, tmp2, curve->p);
+        xx = ecf_mul(tmp3, tmp2, curve);
         freebn(tmp3);
         freebn(tmp2);
     }
@@ -1381,7 +1521,7 @@ static Bignum *ecp_edx(const struct ec_curve *curve, const Bignum y)
             freebn(tmp);
             freebn(tmp2);
 
-            tmp = modmul(x, tmp3, curve->p);
+            tmp = ecf_mul(x, tmp3, curve);
             freebn(x);
             freebn(tmp3);
             x = tmp;
@@ -827,6 +827,18 @@ static const unsigned short primes[] = {
 
 #define NPRIMES (sizeof(primes) / sizeof(*primes))
 
+/*
+ * For candidates below 2^64 we don't need random witnesses at all:
+ * it's known (Sorenson and Webster, and earlier work it builds on)
+ * that the first twelve primes form a deterministic witness set for
+ * everything in that range, so running exactly these witnesses gives
+ * a proof of primality rather than a probabilistic argument, usually
+ * in fewer rounds than the table of check counts below would ask for.
+ */
+static const unsigned long mr_small_witnesses[] = {
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37,
+};
+
 /*
  * Generate a prime. We can deal with various extra properties of
  * the prime:
@@ -850,7 +862,9 @@ static const unsigned short primes[] = {
 Bignum primegen(int bits, int modulus, int residue, Bignum factor,
 		int phase, progfn_t pfn, void *pfnparam, unsigned firstbits)
 {
-    int i, k, v, byte, bitsleft, check, checks, fbsize;
+    int i, k, v, byte, bitsleft, check, checks, candchecks, fbsize;
+    int deterministic;
+    MontyContext *mc;
     unsigned long delta;
     unsigned long moduli[NPRIMES + 1];
     unsigned long residues[NPRIMES + 1];
@@ -918,35 +932,10 @@ Bignum primegen(int bits, int modulus, int residue, Bignum factor,
 	multipliers[NPRIMES] = bignum_mod_short(factor, modulus);
     else
 	multipliers[NPRIMES] = 1;
-    delta = 0;
-    while (1) {
-	for (i = 0; i < (sizeof(moduli) / sizeof(*moduli)); i++)
-	    if (!((residues[i] + delta * multipliers[i]) % moduli[i]))
-		break;
-	if (i < (sizeof(moduli) / sizeof(*moduli))) {	/* we broke */
-	    delta += 2;
-	    if (delta > 65536) {
-		freebn(p);
-		goto STARTOVER;
-	    }
-	    continue;
-	}
-	break;
-    }
-    q = p;
-    if (factor) {
-	Bignum tmp;
-	tmp = bignum_from_long(delta);
-	p = bigmuladd(tmp, factor, q);
-	freebn(tmp);
-    } else {
-	p = bignum_add_long(q, delta);
-    }
-    freebn(q);
-
     /*
-     * Now apply the Miller-Rabin primality test a few times. First
-     * work out how many checks are needed.
+     * Work out how many Miller-Rabin checks will be needed for each
+     * candidate. This depends only on the target size, not on the
+     * candidate itself.
      */
     checks = 27;
     if (bits >= 150)
@@ -973,87 +962,169 @@ Bignum primegen(int bits, int modulus, int residue, Bignum factor,
 	checks = 2;
 
     /*
-     * Next, write p-1 as q*2^k.
-     */
-    for (k = 0; bignum_bit(p, k) == !k; k++)
-	continue;	/* find first 1 bit in p-1 */
-    q = bignum_rshift(p, k);
-    /* And store p-1 itself, which we'll need. */
-    pm1 = copybn(p);
-    decbn(pm1);
-
-    /*
-     * Now, for each check ...
+     * Now do the expensive part. We keep the random starting point
+     * whose residues we just derived, and run through successive
+     * candidates from it: when Miller-Rabin rejects one, we resume
+     * the incremental sieve at the next delta, rather than throwing
+     * everything away and re-deriving all those residues for a
+     * completely fresh random number. The bulk of the candidates a
+     * key generation tries are rejected, so not paying the sieve
+     * setup again for each of them is a substantial saving.
      */
-    for (check = 0; check < checks; check++) {
-	Bignum w;
+    delta = 0;
+    while (1) {
+	Bignum c;
 
 	/*
-	 * Invent a random number between 1 and p-1 inclusive.
+	 * Advance delta to the next candidate that survives trial
+	 * division by everything in the sieve.
 	 */
 	while (1) {
-	    w = bn_power_2(bits - 1);
-	    for (i = 0; i < bits; i++) {
-		if (bitsleft <= 0)
-		    bitsleft = 8, byte = random_byte();
-		v = byte & 1;
-		byte >>= 1;
-		bitsleft--;
-		bignum_set_bit(w, i, v);
-	    }
-	    bn_restore_invariant(w);
-	    if (bignum_cmp(w, p) >= 0 || bignum_cmp(w, Zero) == 0) {
-		freebn(w);
-		continue;
+	    for (i = 0; i < (sizeof(moduli) / sizeof(*moduli)); i++)
+		if (!((residues[i] + delta * multipliers[i]) % moduli[i]))
+		    break;
+	    if (i == (sizeof(moduli) / sizeof(*moduli)))
+		break;
+	    delta += 2;
+	    if (delta > 65536) {
+		freebn(p);
+		goto STARTOVER;
 	    }
-	    break;
 	}
 
-	pfn(pfnparam, PROGFN_PROGRESS, phase, ++progress);
+	/*
+	 * Form the actual candidate c from the starting point and
+	 * delta.
+	 */
+	if (factor) {
+	    Bignum tmp;
+	    tmp = bignum_from_long(delta);
+	    c = bigmuladd(tmp, factor, p);
+	    freebn(tmp);
+	} else {
+	    c = bignum_add_long(p, delta);
+	}
+
+	/*
+	 * Write c-1 as q*2^k.
+	 */
+	for (k = 0; bignum_bit(c, k) == !k; k++)
+	    continue;	/* find first 1 bit in c-1 */
+	q = bignum_rshift(c, k);
+	/* And store c-1 itself, which we'll need. */
+	pm1 = copybn(c);
+	decbn(pm1);
 
 	/*
-	 * Compute w^q mod p.
+	 * The same Montgomery setup serves every witness we run
+	 * against this candidate, so derive it just once. (c is odd
+	 * by construction, so the context is always available.)
 	 */
-	wqp = modpow(w, q, p);
-	freebn(w);
+	mc = monty_new(c);
 
 	/*
-	 * See if this is 1, or if it is -1, or if it becomes -1
-	 * when squared at most k-1 times.
+	 * For candidates small enough that the deterministic witness
+	 * set applies, run exactly that set; otherwise run the usual
+	 * number of random witnesses.
 	 */
-	if (bignum_cmp(wqp, One) == 0 || bignum_cmp(wqp, pm1) == 0) {
-	    freebn(wqp);
-	    continue;
-	}
-	for (i = 0; i < k - 1; i++) {
-	    wqp2 = modmul(wqp, wqp, p);
+	deterministic = bignum_bitcount(c) <= 64;
+	candchecks = deterministic ? lenof(mr_small_witnesses) : checks;
+
+	/*
+	 * Now, for each check ...
+	 */
+	for (check = 0; check < candchecks; check++) {
+	    Bignum w;
+
+	    if (deterministic) {
+		w = bignum_from_long(mr_small_witnesses[check]);
+		if (bignum_cmp(w, pm1) >= 0) {
+		    /* witness >= c-1 tells us nothing; skip it */
+		    freebn(w);
+		    continue;
+		}
+	    } else {
+		/*
+		 * Invent a random number between 1 and c-1 inclusive.
+		 */
+		while (1) {
+		    w = bn_power_2(bits - 1);
+		    for (i = 0; i < bits; i++) {
+			if (bitsleft <= 0)
+			    bitsleft = 8, byte = random_byte();
+			v = byte & 1;
+			byte >>= 1;
+			bitsleft--;
+			bignum_set_bit(w, i, v);
+		    }
+		    bn_restore_invariant(w);
+		    if (bignum_cmp(w, c) >= 0 || bignum_cmp(w, Zero) == 0) {
+			freebn(w);
+			continue;
+		    }
+		    break;
+		}
+	    }
+
+	    pfn(pfnparam, PROGFN_PROGRESS, phase, ++progress);
+
+	    /*
+	     * Compute w^q mod c.
+	     */
+	    wqp = monty_modpow(mc, w, q);
+	    freebn(w);
+
+	    /*
+	     * See if this is 1, or if it is -1, or if it becomes -1
+	     * when squared at most k-1 times.
+	     */
+	    if (bignum_cmp(wqp, One) == 0 || bignum_cmp(wqp, pm1) == 0) {
+		freebn(wqp);
+		continue;
+	    }
+	    for (i = 0; i < k - 1; i++) {
+		wqp2 = modmul(wqp, wqp, c);
+		freebn(wqp);
+		wqp = wqp2;
+		if (bignum_cmp(wqp, pm1) == 0)
+		    break;
+	    }
+	    if (i < k - 1) {
+		freebn(wqp);
+		continue;
+	    }
+
+	    /*
+	     * It didn't. Therefore, w is a witness for the
+	     * compositeness of c.
+	     */
 	    freebn(wqp);
-	    wqp = wqp2;
-	    if (bignum_cmp(wqp, pm1) == 0)
-		break;
+	    break;
 	}
-	if (i < k - 1) {
-	    freebn(wqp);
-	    continue;
+
+	monty_free(mc);
+	freebn(q);
+	freebn(pm1);
+
+	if (check == candchecks) {
+	    /*
+	     * We have a prime!
+	     */
+	    freebn(p);
+	    return c;
 	}
 
 	/*
-	 * It didn't. Therefore, w is a witness for the
-	 * compositeness of p.
+	 * Composite. Move on to the next candidate from the same
+	 * starting point.
 	 */
-	freebn(wqp);
-	freebn(p);
-	freebn(pm1);
-	freebn(q);
-	goto STARTOVER;
+	freebn(c);
+	delta += 2;
+	if (delta > 65536) {
+	    freebn(p);
+	    goto STARTOVER;
+	}
     }
-
-    /*
-     * We have a prime!
-     */
-    freebn(q);
-    freebn(pm1);
-    return p;
 }
 
 /*
@@ -512,18 +512,66 @@ int saversakey(const Filename *filename, struct RSAKey *key, char *passphrase)
  * an HMAC (this was generated for unencrypted keys).
  */
 
-static int read_header(FILE * fp, char *header)
+/*
+ * PPK files are read by slurping the whole file into memory in one
+ * go and parsing from a cursor over that buffer, rather than pulling
+ * characters out of stdio one at a time; processes that load many
+ * keys at startup open enough of these for the difference to show.
+ * The buffer is wiped before being freed, since it will typically
+ * contain private key material (if only in encrypted form).
+ */
+struct keyreader {
+    char *data;			       /* the whole file */
+    int datalen;
+    const char *p, *end;	       /* parsing cursor */
+};
+
+static int keyreader_load(struct keyreader *kr, FILE *fp)
+{
+    int size, got;
+
+    size = 1024;
+    kr->data = snewn(size, char);
+    kr->datalen = 0;
+    while ((got = fread(kr->data + kr->datalen, 1,
+			size - kr->datalen, fp)) > 0) {
+	kr->datalen += got;
+	if (kr->datalen == size) {
+	    size = size * 3 / 2;
+	    kr->data = sresize(kr->data, size, char);
+	}
+    }
+    if (ferror(fp)) {
+	smemclr(kr->data, kr->datalen);
+	sfree(kr->data);
+	kr->data = NULL;
+	return 0;
+    }
+    kr->p = kr->data;
+    kr->end = kr->data + kr->datalen;
+    return 1;
+}
+
+static void keyreader_free(struct keyreader *kr)
+{
+    if (kr->data) {
+	smemclr(kr->data, kr->datalen);
+	sfree(kr->data);
+	kr->data = NULL;
+    }
+}
+
+static int read_header(struct keyreader *kr, char *header)
 {
     int len = 39;
-    int c;
+    char c;
 
-    while (1) {
-	c = fgetc(fp);
-	if (c == '\n' || c == '\r' || c == EOF)
+    while (kr->p < kr->end) {
+	c = *kr->p++;
+	if (c == '\n' || c == '\r')
 	    return 0;		       /* failure */
 	if (c == ':') {
-	    c = fgetc(fp);
-	    if (c != ' ')
+	    if (kr->p >= kr->end || *kr->p++ != ' ')
 		return 0;
 	    *header = '\0';
 	    return 1;		       /* success! */
@@ -536,69 +584,107 @@ static int read_header(FILE * fp, char *header)
     return 0;			       /* failure */
 }
 
-static char *read_body(FILE * fp)
+/*
+ * Find the extent of the current line, advance the cursor past its
+ * terminator (either kind of line ending, one or two characters),
+ * and return the line's length. The line itself stays where it is in
+ * the file buffer, so callers that only want to look at it need not
+ * copy it.
+ */
+static int read_line(struct keyreader *kr, const char **line)
 {
-    char *text;
+    const char *start = kr->p;
     int len;
-    int size;
-    int c;
 
-    size = 128;
-    text = snewn(size, char);
-    len = 0;
+    while (kr->p < kr->end && *kr->p != '\r' && *kr->p != '\n')
+	kr->p++;
+    *line = start;
+    len = kr->p - start;
+    if (kr->p < kr->end) {
+	char c = *kr->p++;
+	if (kr->p < kr->end && *kr->p != c &&
+	    (*kr->p == '\r' || *kr->p == '\n'))
+	    kr->p++;
+    }
+    return len;
+}
+
+static char *read_body(struct keyreader *kr)
+{
+    const char *line;
+    int len;
+    char *text;
+
+    len = read_line(kr, &line);
+    text = snewn(len + 1, char);
+    memcpy(text, line, len);
     text[len] = '\0';
+    return text;
+}
 
-    while (1) {
-	c = fgetc(fp);
-	if (c == '\r' || c == '\n' || c == EOF) {
-	    if (c != EOF) {
-		c = fgetc(fp);
-		if (c != '\r' && c != '\n')
-		    ungetc(c, fp);
-	    }
-	    return text;
-	}
-	if (len + 1 >= size) {
-	    size += 128;
-	    text = sresize(text, size, char);
-	}
-	text[len++] = c;
-	text[len] = '\0';
-    }
+/*
+ * Reverse base64 mapping, for decoding whole 4-character groups at a
+ * time below. Built on first use; 0xFF marks characters with no
+ * 6-bit value (including '=', which is left to base64_decode_atom()
+ * so that padding is handled in exactly one place).
+ */
+static unsigned char base64_revtable[256];
+static int base64_revtable_ready = FALSE;
+
+static void base64_revtable_init(void)
+{
+    static const char base64_chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    int i;
+
+    memset(base64_revtable, 0xFF, sizeof(base64_revtable));
+    for (i = 0; i < 64; i++)
+	base64_revtable[(unsigned char)base64_chars[i]] = i;
+    base64_revtable_ready = TRUE;
 }
 
-static unsigned char *read_blob(FILE * fp, int nlines, int *bloblen)
+static unsigned char *read_blob(struct keyreader *kr, int nlines, int *bloblen)
 {
     unsigned char *blob;
-    char *line;
+    const char *line;
     int linelen, len;
     int i, j, k;
 
+    if (!base64_revtable_ready)
+	base64_revtable_init();
+
     /* We expect at most 64 base64 characters, ie 48 real bytes, per line. */
     blob = snewn(48 * nlines, unsigned char);
     len = 0;
     for (i = 0; i < nlines; i++) {
-	line = read_body(fp);
-	if (!line) {
-	    sfree(blob);
-	    return NULL;
-	}
-	linelen = strlen(line);
+	linelen = read_line(kr, &line);
 	if (linelen % 4 != 0 || linelen > 64) {
 	    sfree(blob);
-	    sfree(line);
 	    return NULL;
 	}
 	for (j = 0; j < linelen; j += 4) {
-	    k = base64_decode_atom(line + j, blob + len);
-	    if (!k) {
-		sfree(line);
-		sfree(blob);
-		return NULL;
+	    unsigned t0 = base64_revtable[(unsigned char)line[j]];
+	    unsigned t1 = base64_revtable[(unsigned char)line[j+1]];
+	    unsigned t2 = base64_revtable[(unsigned char)line[j+2]];
+	    unsigned t3 = base64_revtable[(unsigned char)line[j+3]];
+	    if ((t0 | t1 | t2 | t3) < 64) {
+		/* The common case: four ordinary characters, making
+		 * three output bytes. */
+		unsigned word = (t0 << 18) | (t1 << 12) | (t2 << 6) | t3;
+		blob[len++] = word >> 16;
+		blob[len++] = word >> 8;
+		blob[len++] = word;
+	    } else {
+		/* Padding, or an invalid character; let the careful
+		 * one-atom decoder deal with it. */
+		k = base64_decode_atom(line + j, blob + len);
+		if (!k) {
+		    sfree(blob);
+		    return NULL;
+		}
+		len += k;
 	    }
-	    len += k;
 	}
-	sfree(line);
     }
     *bloblen = len;
     return blob;
@@ -648,19 +734,27 @@ struct ssh2_userkey *ssh2_load_userkey(const Filename *filename,
     int i, is_mac, old_fmt;
     int passlen = passphrase ? strlen(passphrase) : 0;
     const char *error = NULL;
+    struct keyreader kr;
 
     ret = NULL;			       /* return NULL for most errors */
     encryption = comment = mac = NULL;
     public_blob = private_blob = NULL;
+    kr.data = NULL;
 
     fp = f_open(filename, "rb", FALSE);
     if (!fp) {
 	error = "can't open file";
 	goto error;
     }
+    if (!keyreader_load(&kr, fp)) {
+	error = "can't read file";
+	goto error;
+    }
+    fclose(fp);
+    fp = NULL;
 
     /* Read the first header line which contains the key type. */
-    if (!read_header(fp, header))
+    if (!read_header(&kr, header))
 	goto error;
     if (0 == strcmp(header, "PuTTY-User-Key-File-2")) {
 	old_fmt = 0;
@@ -678,7 +772,7 @@ struct ssh2_userkey *ssh2_load_userkey(const Filename *filename,
 	goto error;
     }
     error = "file format error";
-    if ((b = read_body(fp)) == NULL)
+    if ((b = read_body(&kr)) == NULL)
 	goto error;
     /* Select key algorithm structure. */
     alg = find_pubkey_alg(b);
@@ -689,9 +783,9 @@ struct ssh2_userkey *ssh2_load_userkey(const Filename *filename,
     sfree(b);
 
     /* Read the Encryption header line. */
-    if (!read_header(fp, header) || 0 != strcmp(header, "Encryption"))
+    if (!read_header(&kr, header) || 0 != strcmp(header, "Encryption"))
 	goto error;
-    if ((encryption = read_body(fp)) == NULL)
+    if ((encryption = read_body(&kr)) == NULL)
 	goto error;
     if (!strcmp(encryption, "aes256-cbc")) {
 	cipher = 1;
@@ -704,47 +798,46 @@ struct ssh2_userkey *ssh2_load_userkey(const Filename *filename,
     }
 
     /* Read the Comment header line. */
-    if (!read_header(fp, header) || 0 != strcmp(header, "Comment"))
+    if (!read_header(&kr, header) || 0 != strcmp(header, "Comment"))
 	goto error;
-    if ((comment = read_body(fp)) == NULL)
+    if ((comment = read_body(&kr)) == NULL)
 	goto error;
 
     /* Read the Public-Lines header line and the public blob. */
-    if (!read_header(fp, header) || 0 != strcmp(header, "Public-Lines"))
+    if (!read_header(&kr, header) || 0 != strcmp(header, "Public-Lines"))
 	goto error;
-    if ((b = read_body(fp)) == NULL)
+    if ((b = read_body(&kr)) == NULL)
 	goto error;
     i = atoi(b);
     sfree(b);
-    if ((public_blob = read_blob(fp, i, &public_blob_len)) == NULL)
+    if ((public_blob = read_blob(&kr, i, &public_blob_len)) == NULL)
 	goto error;
 
     /* Read the Private-Lines header line and the Private blob. */
-    if (!read_header(fp, header) || 0 != strcmp(header, "Private-Lines"))
+    if (!read_header(&kr, header) || 0 != strcmp(header, "Private-Lines"))
 	goto error;
-    if ((b = read_body(fp)) == NULL)
+    if ((b = read_body(&kr)) == NULL)
 	goto error;
     i = atoi(b);
     sfree(b);
-    if ((private_blob = read_blob(fp, i, &private_blob_len)) == NULL)
+    if ((private_blob = read_blob(&kr, i, &private_blob_len)) == NULL)
 	goto error;
 
     /* Read the Private-MAC or Private-Hash header line. */
-    if (!read_header(fp, header))
+    if (!read_header(&kr, header))
 	goto error;
     if (0 == strcmp(header, "Private-MAC")) {
-	if ((mac = read_body(fp)) == NULL)
+	if ((mac = read_body(&kr)) == NULL)
 	    goto error;
 	is_mac = 1;
     } else if (0 == strcmp(header, "Private-Hash") && old_fmt) {
-	if ((mac = read_body(fp)) == NULL)
+	if ((mac = read_body(&kr)) == NULL)
 	    goto error;
 	is_mac = 0;
     } else
 	goto error;
 
-    fclose(fp);
-    fp = NULL;
+    keyreader_free(&kr);
 
     /*
      * Decrypt the private blob.
@@ -877,6 +970,7 @@ struct ssh2_userkey *ssh2_load_userkey(const Filename *filename,
   error:
     if (fp)
 	fclose(fp);
+    keyreader_free(&kr);
     if (comment)
 	sfree(comment);
     if (encryption)
@@ -1116,8 +1210,10 @@ unsigned char *ssh2_userkey_loadpub(const Filename *filename, char **algorithm,
     int type, i;
     const char *error = NULL;
     char *comment = NULL;
+    struct keyreader kr;
 
     public_blob = NULL;
+    kr.data = NULL;
 
     fp = f_open(filename, "rb", FALSE);
     if (!fp) {
@@ -1143,8 +1239,15 @@ unsigned char *ssh2_userkey_loadpub(const Filename *filename, char **algorithm,
         goto error;
     }
 
+    if (!keyreader_load(&kr, fp)) {
+	error = "can't read file";
+	goto error;
+    }
+    fclose(fp);
+    fp = NULL;
+
     /* Read the first header line which contains the key type. */
-    if (!read_header(fp, header)
+    if (!read_header(&kr, header)
 	|| (0 != strcmp(header, "PuTTY-User-Key-File-2") &&
 	    0 != strcmp(header, "PuTTY-User-Key-File-1"))) {
         if (0 == strncmp(header, "PuTTY-User-Key-File-", 20))
@@ -1154,7 +1257,7 @@ unsigned char *ssh2_userkey_loadpub(const Filename *filename, char **algorithm,
 	goto error;
     }
     error = "file format error";
-    if ((b = read_body(fp)) == NULL)
+    if ((b = read_body(&kr)) == NULL)
 	goto error;
     /* Select key algorithm structure. */
     alg = find_pubkey_alg(b);
@@ -1164,16 +1267,16 @@ unsigned char *ssh2_userkey_loadpub(const Filename *filename, char **algorithm,
     }
 
     /* Read the Encryption header line. */
-    if (!read_header(fp, header) || 0 != strcmp(header, "Encryption"))
+    if (!read_header(&kr, header) || 0 != strcmp(header, "Encryption"))
 	goto error;
-    if ((b = read_body(fp)) == NULL)
+    if ((b = read_body(&kr)) == NULL)
 	goto error;
     sfree(b);			       /* we don't care */
 
     /* Read the Comment header line. */
-    if (!read_header(fp, header) || 0 != strcmp(header, "Comment"))
+    if (!read_header(&kr, header) || 0 != strcmp(header, "Comment"))
 	goto error;
-    if ((comment = read_body(fp)) == NULL)
+    if ((comment = read_body(&kr)) == NULL)
 	goto error;
 
     if (commentptr)
@@ -1182,16 +1285,16 @@ unsigned char *ssh2_userkey_loadpub(const Filename *filename, char **algorithm,
 	sfree(comment);
 
     /* Read the Public-Lines header line and the public blob. */
-    if (!read_header(fp, header) || 0 != strcmp(header, "Public-Lines"))
+    if (!read_header(&kr, header) || 0 != strcmp(header, "Public-Lines"))
 	goto error;
-    if ((b = read_body(fp)) == NULL)
+    if ((b = read_body(&kr)) == NULL)
 	goto error;
     i = atoi(b);
     sfree(b);
-    if ((public_blob = read_blob(fp, i, &public_blob_len)) == NULL)
+    if ((public_blob = read_blob(&kr, i, &public_blob_len)) == NULL)
 	goto error;
 
-    fclose(fp);
+    keyreader_free(&kr);
     if (pub_blob_len)
 	*pub_blob_len = public_blob_len;
     if (algorithm)
@@ -1204,6 +1307,7 @@ unsigned char *ssh2_userkey_loadpub(const Filename *filename, char **algorithm,
   error:
     if (fp)
 	fclose(fp);
+    keyreader_free(&kr);
     if (public_blob)
 	sfree(public_blob);
     if (errorstr)
@@ -1220,6 +1324,7 @@ int ssh2_userkey_encrypted(const Filename *filename, char **commentptr)
     FILE *fp;
     char header[40], *b, *comment;
     int ret;
+    struct keyreader kr;
 
     if (commentptr)
 	*commentptr = NULL;
@@ -1227,35 +1332,40 @@ int ssh2_userkey_encrypted(const Filename *filename, char **commentptr)
     fp = f_open(filename, "rb", FALSE);
     if (!fp)
 	return 0;
-    if (!read_header(fp, header)
+    if (!keyreader_load(&kr, fp)) {
+	fclose(fp);
+	return 0;
+    }
+    fclose(fp);
+    if (!read_header(&kr, header)
 	|| (0 != strcmp(header, "PuTTY-User-Key-File-2") &&
 	    0 != strcmp(header, "PuTTY-User-Key-File-1"))) {
-	fclose(fp);
+	keyreader_free(&kr);
 	return 0;
     }
-    if ((b = read_body(fp)) == NULL) {
-	fclose(fp);
+    if ((b = read_body(&kr)) == NULL) {
+	keyreader_free(&kr);
 	return 0;
     }
     sfree(b);			       /* we don't care about key type here */
     /* Read the Encryption header line. */
-    if (!read_header(fp, header) || 0 != strcmp(header, "Encryption")) {
-	fclose(fp);
+    if (!read_header(&kr, header) || 0 != strcmp(header, "Encryption")) {
+	keyreader_free(&kr);
 	return 0;
     }
-    if ((b = read_body(fp)) == NULL) {
-	fclose(fp);
+    if ((b = read_body(&kr)) == NULL) {
+	keyreader_free(&kr);
 	return 0;
     }
 
     /* Read the Comment header line. */
-    if (!read_header(fp, header) || 0 != strcmp(header, "Comment")) {
-	fclose(fp);
+    if (!read_header(&kr, header) || 0 != strcmp(header, "Comment")) {
+	keyreader_free(&kr);
 	sfree(b);
 	return 1;
     }
-    if ((comment = read_body(fp)) == NULL) {
-	fclose(fp);
+    if ((comment = read_body(&kr)) == NULL) {
+	keyreader_free(&kr);
 	sfree(b);
 	return 1;
     }
@@ -1265,7 +1375,7 @@ int ssh2_userkey_encrypted(const Filename *filename, char **commentptr)
     else
         sfree(comment);
 
-    fclose(fp);
+    keyreader_free(&kr);
     if (!strcmp(b, "aes256-cbc"))
 	ret = 1;
     else
@@ -9,7 +9,8 @@
 /* Collect environmental noise every 5 minutes */
 #define NOISE_REGULAR_INTERVAL (5*60*TICKSPERSEC)
 
-void noise_get_heavy(void (*func) (void *, int));
+int noise_get_heavy(void (*func) (void *, int));
+void noise_get_background(void (*func) (void *, int));
 void noise_get_light(void (*func) (void *, int));
 
 /*
@@ -32,6 +33,7 @@ void noise_get_light(void (*func) (void *, int));
 #define HASHINPUT 64		       /* 64 bytes SHA input */
 #define HASHSIZE 20		       /* 160 bits SHA output */
 #define POOLSIZE 1200		       /* size of random pool */
+#define NOISEBUF 512		       /* size of noise accumulation buffer */
 
 struct RandPool {
     unsigned char pool[POOLSIZE];
@@ -39,7 +41,7 @@ struct RandPool {
 
     unsigned char incoming[HASHSIZE];
 
-    unsigned char incomingb[HASHINPUT];
+    unsigned char incomingb[NOISEBUF];
     int incomingpos;
 
     int stir_pending;
@@ -108,7 +110,9 @@ static void random_stir(void)
     }
 #endif
 
-    SHATransform((word32 *) pool.incoming, (word32 *) pool.incomingb);
+    for (i = 0; i < NOISEBUF; i += HASHINPUT)
+	SHATransform((word32 *) pool.incoming,
+		     (word32 *) (pool.incomingb + i));
     pool.incomingpos = 0;
 
     /*
@@ -223,22 +227,29 @@ static void random_stir(void)
 void random_add_noise(void *noise, int length)
 {
     unsigned char *p = noise;
-    int i;
+    int i, j;
 
     if (!random_active)
 	return;
 
     /*
-     * This function processes HASHINPUT bytes into only HASHSIZE
+     * This function processes NOISEBUF bytes into only HASHSIZE
      * bytes, so _if_ we were getting incredibly high entropy
      * sources then we would be throwing away valuable stuff.
+     *
+     * Small noise events just accumulate in incomingb; the hashing
+     * and pool mixing happen once per NOISEBUF bytes collected, so
+     * that the frequent ultralight events from the network code
+     * cost no more than a memcpy each.
      */
-    while (length >= (HASHINPUT - pool.incomingpos)) {
+    while (length >= (NOISEBUF - pool.incomingpos)) {
 	memcpy(pool.incomingb + pool.incomingpos, p,
-	       HASHINPUT - pool.incomingpos);
-	p += HASHINPUT - pool.incomingpos;
-	length -= HASHINPUT - pool.incomingpos;
-	SHATransform((word32 *) pool.incoming, (word32 *) pool.incomingb);
+	       NOISEBUF - pool.incomingpos);
+	p += NOISEBUF - pool.incomingpos;
+	length -= NOISEBUF - pool.incomingpos;
+	for (j = 0; j < NOISEBUF; j += HASHINPUT)
+	    SHATransform((word32 *) pool.incoming,
+			 (word32 *) (pool.incomingb + j));
 	for (i = 0; i < HASHSIZE; i++) {
 	    pool.pool[pool.poolpos++] ^= pool.incoming[i];
 	    if (pool.poolpos >= POOLSIZE)
@@ -298,13 +309,36 @@ static void random_timer(void *ctx, unsigned long now)
     }
 }
 
+/*
+ * Deferred collection of the slow environmental entropy sources, run
+ * as a toplevel callback shortly after startup so that (for
+ * instance) plink can start connecting without first waiting for a
+ * process listing to complete. Only scheduled when the OS RNG
+ * contributed to the pool, so the pool is already well seeded by the
+ * time anyone draws bytes from it; if the OS RNG was missing, the
+ * environmental sources are our primary entropy and random_ref
+ * collects them synchronously instead.
+ */
+static void random_collect_background(void *ctx)
+{
+    if (random_active > 0) {
+	noise_get_background(random_add_heavynoise_bitbybit);
+	random_stir();
+    }
+}
+
 void random_ref(void)
 {
     if (!random_active) {
 	memset(&pool, 0, sizeof(pool));    /* just to start with */
 
-	noise_get_heavy(random_add_heavynoise_bitbybit);
-	random_stir();
+	if (noise_get_heavy(random_add_heavynoise_bitbybit)) {
+	    random_stir();
+	    queue_toplevel_callback(random_collect_background, NULL);
+	} else {
+	    noise_get_background(random_add_heavynoise_bitbybit);
+	    random_stir();
+	}
 
 	next_noise_collection =
 	    schedule_timer(NOISE_REGULAR_INTERVAL, random_timer, &pool);
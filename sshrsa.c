@@ -114,27 +114,14 @@ static void sha512_mpint(SHA512_State * s, Bignum b)
 }
 
 /*
- * Compute (base ^ exp) % mod, provided mod == p * q, with p,q
- * distinct primes, and iqmp is the multiplicative inverse of q mod p.
- * Uses Chinese Remainder Theorem to speed computation up over the
- * obvious implementation of a single big modpow.
+ * The inner half of crt_modpow() below, for callers which have
+ * already reduced the exponent mod phi(p) and phi(q) (and perhaps
+ * cached the reductions, as rsa_privkey_op() does).
  */
-Bignum crt_modpow(Bignum base, Bignum exp, Bignum mod,
-                  Bignum p, Bignum q, Bignum iqmp)
+static Bignum crt_modpow_reduced(Bignum base, Bignum pexp, Bignum qexp,
+                                 Bignum mod, Bignum p, Bignum q, Bignum iqmp)
 {
-    Bignum pm1, qm1, pexp, qexp, presult, qresult, diff, multiplier, ret0, ret;
-
-    /*
-     * Reduce the exponent mod phi(p) and phi(q), to save time when
-     * exponentiating mod p and mod q respectively. Of course, since p
-     * and q are prime, phi(p) == p-1 and similarly for q.
-     */
-    pm1 = copybn(p);
-    decbn(pm1);
-    qm1 = copybn(q);
-    decbn(qm1);
-    pexp = bigmod(exp, pm1);
-    qexp = bigmod(exp, qm1);
+    Bignum presult, qresult, diff, multiplier, ret0, ret;
 
     /*
      * Do the two modpows.
@@ -173,10 +160,6 @@ Bignum crt_modpow(Bignum base, Bignum exp, Bignum mod,
     /*
      * Free all the intermediate results before returning.
      */
-    freebn(pm1);
-    freebn(qm1);
-    freebn(pexp);
-    freebn(qexp);
     freebn(presult);
     freebn(qresult);
     freebn(diff);
@@ -186,6 +169,79 @@ Bignum crt_modpow(Bignum base, Bignum exp, Bignum mod,
     return ret;
 }
 
+/*
+ * Compute (base ^ exp) % mod, provided mod == p * q, with p,q
+ * distinct primes, and iqmp is the multiplicative inverse of q mod p.
+ * Uses Chinese Remainder Theorem to speed computation up over the
+ * obvious implementation of a single big modpow.
+ */
+Bignum crt_modpow(Bignum base, Bignum exp, Bignum mod,
+                  Bignum p, Bignum q, Bignum iqmp)
+{
+    Bignum pm1, qm1, pexp, qexp, ret;
+
+    /*
+     * Reduce the exponent mod phi(p) and phi(q), to save time when
+     * exponentiating mod p and mod q respectively. Of course, since p
+     * and q are prime, phi(p) == p-1 and similarly for q.
+     */
+    pm1 = copybn(p);
+    decbn(pm1);
+    qm1 = copybn(q);
+    decbn(qm1);
+    pexp = bigmod(exp, pm1);
+    qexp = bigmod(exp, qm1);
+
+    ret = crt_modpow_reduced(base, pexp, qexp, mod, p, q, iqmp);
+
+    freebn(pm1);
+    freebn(qm1);
+    freebn(pexp);
+    freebn(qexp);
+
+    return ret;
+}
+
+/*
+ * Process-wide cache of the per-key values rsa_privkey_op() would
+ * otherwise recompute on every private-key operation: the private
+ * exponent reduced mod phi(p) and phi(q), and the current blinding
+ * pair (y, y^-d). Deriving a fresh blinding pair costs a modular
+ * inversion plus a public-exponent CRT modpow per signature, which
+ * is a visible fraction of the total for processes that sign
+ * repeatedly with the same key (Pageant, cgtest); instead we derive
+ * the pair once per key and then evolve it by squaring both halves
+ * mod n after each use, which preserves the defining relation
+ * (y^2)^-d == (y^-d)^2 and keeps successive blinding values
+ * unpredictable to anyone who doesn't know the key. Entries are
+ * matched by modulus and private exponent, so a stale entry for a
+ * freed key can never be applied to a different one; when the cache
+ * is full the oldest entry is evicted.
+ */
+#define RSA_PRIVKEY_CACHE_SIZE 4
+static struct rsa_privkey_cache {
+    Bignum modulus, private_exponent;  /* which key this entry is for */
+    Bignum p;                          /* guards against p,q order swaps */
+    Bignum pexp, qexp;                 /* d mod (p-1), d mod (q-1) */
+    Bignum blind, unblind;             /* y and y^-d */
+} rsa_privkey_cache[RSA_PRIVKEY_CACHE_SIZE];
+static int rsa_privkey_cache_next;
+
+static struct rsa_privkey_cache *rsa_privkey_cache_find(struct RSAKey *key)
+{
+    struct rsa_privkey_cache *pc;
+
+    for (pc = rsa_privkey_cache;
+         pc < rsa_privkey_cache + lenof(rsa_privkey_cache); pc++) {
+        if (pc->modulus &&
+            bignum_cmp(pc->modulus, key->modulus) == 0 &&
+            bignum_cmp(pc->private_exponent, key->private_exponent) == 0 &&
+            bignum_cmp(pc->p, key->p) == 0)
+            return pc;
+    }
+    return NULL;
+}
+
 /*
  * This function is a wrapper on modpow(). It has the same effect as
  * modpow(), but employs RSA blinding to protect against timing
@@ -196,13 +252,22 @@ static Bignum rsa_privkey_op(Bignum input, struct RSAKey *key)
 {
     Bignum random, random_encrypted, random_inverse;
     Bignum input_blinded, ret_blinded;
-    Bignum ret;
+    Bignum ret, tmp;
+    struct rsa_privkey_cache *pc;
 
     SHA512_State ss;
     unsigned char digest512[64];
     int digestused = lenof(digest512);
     int hashseq = 0;
 
+    /*
+     * If we've signed with this key before, the cached blinding pair
+     * and reduced exponents let us skip straight to the main modpow.
+     */
+    pc = rsa_privkey_cache_find(key);
+    if (pc)
+        goto have_cache;
+
     /*
      * Start by inventing a random number chosen uniformly from the
      * range 2..modulus-1. (We do this by preparing a random number
@@ -304,16 +369,62 @@ static Bignum rsa_privkey_op(Bignum input, struct RSAKey *key)
      */
     random_encrypted = crt_modpow(random, key->exponent,
                                   key->modulus, key->p, key->q, key->iqmp);
-    input_blinded = modmul(input, random_encrypted, key->modulus);
-    ret_blinded = crt_modpow(input_blinded, key->private_exponent,
-                             key->modulus, key->p, key->q, key->iqmp);
-    ret = modmul(ret_blinded, random_inverse, key->modulus);
+    freebn(random);
+
+    /*
+     * File the new blinding pair, plus the reduced private exponent,
+     * in a cache slot for subsequent operations with this key. The
+     * cache takes ownership of the pair; evict the oldest entry if
+     * every slot is taken.
+     */
+    pc = &rsa_privkey_cache[rsa_privkey_cache_next];
+    rsa_privkey_cache_next = (rsa_privkey_cache_next + 1) %
+        lenof(rsa_privkey_cache);
+    if (pc->modulus) {
+        freebn(pc->modulus);
+        freebn(pc->private_exponent);
+        freebn(pc->p);
+        freebn(pc->pexp);
+        freebn(pc->qexp);
+        freebn(pc->blind);
+        freebn(pc->unblind);
+    }
+    pc->modulus = copybn(key->modulus);
+    pc->private_exponent = copybn(key->private_exponent);
+    pc->p = copybn(key->p);
+    {
+        Bignum pm1, qm1;
+        pm1 = copybn(key->p);
+        decbn(pm1);
+        qm1 = copybn(key->q);
+        decbn(qm1);
+        pc->pexp = bigmod(key->private_exponent, pm1);
+        pc->qexp = bigmod(key->private_exponent, qm1);
+        freebn(pm1);
+        freebn(qm1);
+    }
+    pc->blind = random_encrypted;
+    pc->unblind = random_inverse;
+
+  have_cache:
+    input_blinded = modmul(input, pc->blind, key->modulus);
+    ret_blinded = crt_modpow_reduced(input_blinded, pc->pexp, pc->qexp,
+                                     key->modulus, key->p, key->q, key->iqmp);
+    ret = modmul(ret_blinded, pc->unblind, key->modulus);
+
+    /*
+     * Square both halves of the blinding pair ready for the next
+     * operation, so no two operations use the same blinding value.
+     */
+    tmp = modmul(pc->blind, pc->blind, key->modulus);
+    freebn(pc->blind);
+    pc->blind = tmp;
+    tmp = modmul(pc->unblind, pc->unblind, key->modulus);
+    freebn(pc->unblind);
+    pc->unblind = tmp;
 
     freebn(ret_blinded);
     freebn(input_blinded);
-    freebn(random_inverse);
-    freebn(random_encrypted);
-    freebn(random);
 
     return ret;
 }
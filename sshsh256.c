@@ -19,6 +19,63 @@
 #define smallsigma0(x) ( ror((x),7) ^ ror((x),18) ^ shr((x),3) )
 #define smallsigma1(x) ( ror((x),17) ^ ror((x),19) ^ shr((x),10) )
 
+/*
+ * Hardware-accelerated implementation using the x86 SHA extensions,
+ * with runtime dispatch, following the pattern of the AES-NI support
+ * in sshaes.c. Implementation at the bottom of this file.
+ */
+#ifdef _FORCE_SHA_NI
+#   define COMPILER_SUPPORTS_SHA_NI
+#elif defined(__clang__)
+#   if (__clang_major__ > 3 || (__clang_major__ == 3 && __clang_minor__ >= 8)) && (defined(__x86_64__) || defined(__i386))
+#       define COMPILER_SUPPORTS_SHA_NI
+#   endif
+#elif defined(__GNUC__)
+#    if (__GNUC__ >= 5) && (defined(__x86_64__) || defined(__i386))
+#       define COMPILER_SUPPORTS_SHA_NI
+#    endif
+#elif defined (_MSC_VER)
+#   if (defined(_M_X64) || defined(_M_IX86)) && _MSC_FULL_VER >= 190024210
+#      define COMPILER_SUPPORTS_SHA_NI
+#   endif
+#endif
+
+#ifdef _FORCE_SOFTWARE_SHA
+#   undef COMPILER_SUPPORTS_SHA_NI
+#endif
+
+#ifdef COMPILER_SUPPORTS_SHA_NI
+static int supports_sha_ni(void);
+static void SHA256_ni_block(SHA256_State *s, const uint32 *block);
+#endif
+
+/*
+ * Equivalent hardware path using the ARMv8-A SHA2 crypto extension,
+ * with runtime dispatch via sshcpu.c. Implementation at the bottom of
+ * this file, below the x86 one.
+ */
+#ifdef _FORCE_ARM_SHA256
+#   define COMPILER_SUPPORTS_ARM_SHA256
+#elif defined(__aarch64__)
+#   if defined(__clang__)
+#       if __clang_major__ >= 7
+#           define COMPILER_SUPPORTS_ARM_SHA256
+#       endif
+#   elif defined(__GNUC__)
+#       if __GNUC__ >= 6
+#           define COMPILER_SUPPORTS_ARM_SHA256
+#       endif
+#   endif
+#endif
+
+#ifdef _FORCE_SOFTWARE_SHA
+#   undef COMPILER_SUPPORTS_ARM_SHA256
+#endif
+
+#ifdef COMPILER_SUPPORTS_ARM_SHA256
+static void SHA256_ce_block(SHA256_State *s, const uint32 *block);
+#endif
+
 void SHA256_Core_Init(SHA256_State *s) {
     s->h[0] = 0x6a09e667;
     s->h[1] = 0xbb67ae85;
@@ -31,6 +88,19 @@ void SHA256_Core_Init(SHA256_State *s) {
 }
 
 void SHA256_Block(SHA256_State *s, uint32 *block) {
+#ifdef COMPILER_SUPPORTS_SHA_NI
+    if (supports_sha_ni()) {
+        SHA256_ni_block(s, block);
+        return;
+    }
+#endif
+#ifdef COMPILER_SUPPORTS_ARM_SHA256
+    if (ssh_cpu_has(SSH_CPU_HWSHA256)) {
+        SHA256_ce_block(s, block);
+        return;
+    }
+#endif
+  {
     uint32 w[80];
     uint32 a,b,c,d,e,f,g,h;
     static const int k[] = {
@@ -83,6 +153,7 @@ void SHA256_Block(SHA256_State *s, uint32 *block) {
 
     s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
     s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
+  }
 }
 
 /* ----------------------------------------------------------------------
@@ -233,8 +304,22 @@ static void sha256_final(void *handle, unsigned char *output)
     sha256_free(s);
 }
 
+static void sha256_init_ctx(void *handle)
+{
+    SHA256_Init((SHA256_State *)handle);
+}
+
+static void sha256_final_ctx(void *handle, unsigned char *output)
+{
+    SHA256_State *s = handle;
+
+    SHA256_Final(s, output);
+    smemclr(s, sizeof(*s));
+}
+
 const struct ssh_hash ssh_sha256 = {
     sha256_init, sha256_copy, sha256_bytes, sha256_final, sha256_free,
+    sizeof(SHA256_State), sha256_init_ctx, sha256_final_ctx, SHA256_Simple,
     32, "SHA-256"
 };
 
@@ -349,6 +434,239 @@ const struct ssh_mac ssh_hmac_sha256 = {
     "HMAC-SHA-256"
 };
 
+/* ----------------------------------------------------------------------
+ * Hardware-accelerated implementation of the SHA-256 core using the
+ * x86 SHA extensions. The callers above hand us blocks which have
+ * already been gathered big-endian into host words, so unlike the
+ * usual formulation we need no PSHUFB byte swap on the message loads.
+ */
+
+#ifdef COMPILER_SUPPORTS_SHA_NI
+
+/*
+ * Set target architecture for Clang and GCC
+ */
+#if !defined(__clang__) && defined(__GNUC__)
+#    pragma GCC target("sha")
+#    pragma GCC target("sse4.1")
+#endif
+
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 5))
+#    define SHA_FUNC_ISA __attribute__ ((target("sse4.1,sha")))
+#else
+#    define SHA_FUNC_ISA
+#endif
+
+#include <immintrin.h>
+
+/*
+ * Determinator of CPU type, via the unified detection module in
+ * sshcpu.c (which checks for both the SHA extensions and the SSE4.1
+ * this implementation also uses).
+ */
+static int supports_sha_ni(void)
+{
+    return ssh_cpu_has(SSH_CPU_HWSHA256);
+}
+
+SHA_FUNC_ISA
+static void SHA256_ni_block(SHA256_State *s, const uint32 *block)
+{
+    __m128i state0, state1, abef_save, cdgh_save;
+    __m128i msg, tmp, msg0, msg1, msg2, msg3;
+
+    /*
+     * Rearrange the chaining variables (a,b,c,d) (e,f,g,h) into the
+     * (a,b,e,f) (c,d,g,h) order the SHA256RNDS2 instruction wants.
+     */
+    tmp = _mm_loadu_si128((const __m128i *)&s->h[0]);
+    state1 = _mm_loadu_si128((const __m128i *)&s->h[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);          /* CDAB */
+    state1 = _mm_shuffle_epi32(state1, 0x1B);    /* EFGH */
+    state0 = _mm_alignr_epi8(tmp, state1, 8);    /* ABEF */
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0); /* CDGH */
+
+    abef_save = state0;
+    cdgh_save = state1;
+
+    /* Rounds 0-3 */
+    msg0 = _mm_loadu_si128((const __m128i *)&block[0]);
+    msg = _mm_add_epi32(msg0,
+        _mm_set_epi64x(0xE9B5DBA5B5C0FBCFULL, 0x71374491428A2F98ULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+    /* Rounds 4-7 */
+    msg1 = _mm_loadu_si128((const __m128i *)&block[4]);
+    msg = _mm_add_epi32(msg1,
+        _mm_set_epi64x(0xAB1C5ED5923F82A4ULL, 0x59F111F13956C25BULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+
+    /* Rounds 8-11 */
+    msg2 = _mm_loadu_si128((const __m128i *)&block[8]);
+    msg = _mm_add_epi32(msg2,
+        _mm_set_epi64x(0x550C7DC3243185BEULL, 0x12835B01D807AA98ULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+
+    /* Rounds 12-15 */
+    msg3 = _mm_loadu_si128((const __m128i *)&block[12]);
+    msg = _mm_add_epi32(msg3,
+        _mm_set_epi64x(0xC19BF1749BDC06A7ULL, 0x80DEB1FE72BE5D74ULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    tmp = _mm_alignr_epi8(msg3, msg2, 4);
+    msg0 = _mm_add_epi32(msg0, tmp);
+    msg0 = _mm_sha256msg2_epu32(msg0, msg3);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    msg2 = _mm_sha256msg1_epu32(msg2, msg3);
+
+    /* Rounds 16-19 */
+    msg = _mm_add_epi32(msg0,
+        _mm_set_epi64x(0x240CA1CC0FC19DC6ULL, 0xEFBE4786E49B69C1ULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    tmp = _mm_alignr_epi8(msg0, msg3, 4);
+    msg1 = _mm_add_epi32(msg1, tmp);
+    msg1 = _mm_sha256msg2_epu32(msg1, msg0);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    msg3 = _mm_sha256msg1_epu32(msg3, msg0);
+
+    /* Rounds 20-23 */
+    msg = _mm_add_epi32(msg1,
+        _mm_set_epi64x(0x76F988DA5CB0A9DCULL, 0x4A7484AA2DE92C6FULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    tmp = _mm_alignr_epi8(msg1, msg0, 4);
+    msg2 = _mm_add_epi32(msg2, tmp);
+    msg2 = _mm_sha256msg2_epu32(msg2, msg1);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+
+    /* Rounds 24-27 */
+    msg = _mm_add_epi32(msg2,
+        _mm_set_epi64x(0xBF597FC7B00327C8ULL, 0xA831C66D983E5152ULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    tmp = _mm_alignr_epi8(msg2, msg1, 4);
+    msg3 = _mm_add_epi32(msg3, tmp);
+    msg3 = _mm_sha256msg2_epu32(msg3, msg2);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+
+    /* Rounds 28-31 */
+    msg = _mm_add_epi32(msg3,
+        _mm_set_epi64x(0x1429296706CA6351ULL, 0xD5A79147C6E00BF3ULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    tmp = _mm_alignr_epi8(msg3, msg2, 4);
+    msg0 = _mm_add_epi32(msg0, tmp);
+    msg0 = _mm_sha256msg2_epu32(msg0, msg3);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    msg2 = _mm_sha256msg1_epu32(msg2, msg3);
+
+    /* Rounds 32-35 */
+    msg = _mm_add_epi32(msg0,
+        _mm_set_epi64x(0x53380D134D2C6DFCULL, 0x2E1B213827B70A85ULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    tmp = _mm_alignr_epi8(msg0, msg3, 4);
+    msg1 = _mm_add_epi32(msg1, tmp);
+    msg1 = _mm_sha256msg2_epu32(msg1, msg0);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    msg3 = _mm_sha256msg1_epu32(msg3, msg0);
+
+    /* Rounds 36-39 */
+    msg = _mm_add_epi32(msg1,
+        _mm_set_epi64x(0x92722C8581C2C92EULL, 0x766A0ABB650A7354ULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    tmp = _mm_alignr_epi8(msg1, msg0, 4);
+    msg2 = _mm_add_epi32(msg2, tmp);
+    msg2 = _mm_sha256msg2_epu32(msg2, msg1);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+
+    /* Rounds 40-43 */
+    msg = _mm_add_epi32(msg2,
+        _mm_set_epi64x(0xC76C51A3C24B8B70ULL, 0xA81A664BA2BFE8A1ULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    tmp = _mm_alignr_epi8(msg2, msg1, 4);
+    msg3 = _mm_add_epi32(msg3, tmp);
+    msg3 = _mm_sha256msg2_epu32(msg3, msg2);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+
+    /* Rounds 44-47 */
+    msg = _mm_add_epi32(msg3,
+        _mm_set_epi64x(0x106AA070F40E3585ULL, 0xD6990624D192E819ULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    tmp = _mm_alignr_epi8(msg3, msg2, 4);
+    msg0 = _mm_add_epi32(msg0, tmp);
+    msg0 = _mm_sha256msg2_epu32(msg0, msg3);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    msg2 = _mm_sha256msg1_epu32(msg2, msg3);
+
+    /* Rounds 48-51 */
+    msg = _mm_add_epi32(msg0,
+        _mm_set_epi64x(0x34B0BCB52748774CULL, 0x1E376C0819A4C116ULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    tmp = _mm_alignr_epi8(msg0, msg3, 4);
+    msg1 = _mm_add_epi32(msg1, tmp);
+    msg1 = _mm_sha256msg2_epu32(msg1, msg0);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    msg3 = _mm_sha256msg1_epu32(msg3, msg0);
+
+    /* Rounds 52-55 */
+    msg = _mm_add_epi32(msg1,
+        _mm_set_epi64x(0x682E6FF35B9CCA4FULL, 0x4ED8AA4A391C0CB3ULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    tmp = _mm_alignr_epi8(msg1, msg0, 4);
+    msg2 = _mm_add_epi32(msg2, tmp);
+    msg2 = _mm_sha256msg2_epu32(msg2, msg1);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+    /* Rounds 56-59 */
+    msg = _mm_add_epi32(msg2,
+        _mm_set_epi64x(0x8CC7020884C87814ULL, 0x78A5636F748F82EEULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    tmp = _mm_alignr_epi8(msg2, msg1, 4);
+    msg3 = _mm_add_epi32(msg3, tmp);
+    msg3 = _mm_sha256msg2_epu32(msg3, msg2);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+    /* Rounds 60-63 */
+    msg = _mm_add_epi32(msg3,
+        _mm_set_epi64x(0xC67178F2BEF9A3F7ULL, 0xA4506CEB90BEFFFAULL));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+
+    /* Rearrange back into (a,b,c,d) (e,f,g,h) order and store */
+    tmp = _mm_shuffle_epi32(state0, 0x1B);       /* FEBA */
+    state1 = _mm_shuffle_epi32(state1, 0xB1);    /* DCHG */
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0); /* DCBA */
+    state1 = _mm_alignr_epi8(state1, tmp, 8);    /* HGFE */
+    _mm_storeu_si128((__m128i *)&s->h[0], state0);
+    _mm_storeu_si128((__m128i *)&s->h[4], state1);
+}
+
+#endif /* COMPILER_SUPPORTS_SHA_NI */
+
 #ifdef TEST
 
 #include <stdio.h>
@@ -398,3 +716,69 @@ int main(void) {
 }
 
 #endif
+
+/*
+ * Implementation of the SHA-256 transform using the ARMv8-A SHA2
+ * crypto extensions. Unlike the x86 instructions above, SHA256H and
+ * SHA256H2 work directly on the (a,b,c,d) and (e,f,g,h) halves of the
+ * state, so no shuffling of the chaining variables is needed; and the
+ * caller has already gathered the block into host-order words, so
+ * neither is any byte reversal.
+ */
+#ifdef COMPILER_SUPPORTS_ARM_SHA256
+
+#include <arm_neon.h>
+
+static const uint32_t sha256_ce_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+__attribute__ ((target("+crypto")))
+static void SHA256_ce_block(SHA256_State *s, const uint32 *block)
+{
+    uint32x4_t abcd, efgh, abcd_save, efgh_save, wk, tmp;
+    uint32x4_t msg[4];
+    int i;
+
+    abcd = vld1q_u32((const uint32_t *)&s->h[0]);
+    efgh = vld1q_u32((const uint32_t *)&s->h[4]);
+    abcd_save = abcd;
+    efgh_save = efgh;
+
+    for (i = 0; i < 4; i++)
+	msg[i] = vld1q_u32((const uint32_t *)block + 4 * i);
+
+    for (i = 0; i < 16; i++) {
+	wk = vaddq_u32(msg[i & 3], vld1q_u32(sha256_ce_k + 4 * i));
+	if (i < 12)		       /* extend the message schedule */
+	    msg[i & 3] = vsha256su1q_u32(
+		vsha256su0q_u32(msg[i & 3], msg[(i + 1) & 3]),
+		msg[(i + 2) & 3], msg[(i + 3) & 3]);
+	tmp = abcd;
+	abcd = vsha256hq_u32(abcd, efgh, wk);
+	efgh = vsha256h2q_u32(efgh, tmp, wk);
+    }
+
+    abcd = vaddq_u32(abcd, abcd_save);
+    efgh = vaddq_u32(efgh, efgh_save);
+
+    vst1q_u32((uint32_t *)&s->h[0], abcd);
+    vst1q_u32((uint32_t *)&s->h[4], efgh);
+}
+
+#endif /* COMPILER_SUPPORTS_ARM_SHA256 */
@@ -364,8 +364,22 @@ static void sha512_final(void *handle, unsigned char *output)
     sha512_free(s);
 }
 
+static void sha512_init_ctx(void *handle)
+{
+    SHA512_Init((SHA512_State *)handle);
+}
+
+static void sha512_final_ctx(void *handle, unsigned char *output)
+{
+    SHA512_State *s = handle;
+
+    SHA512_Final(s, output);
+    smemclr(s, sizeof(*s));
+}
+
 const struct ssh_hash ssh_sha512 = {
     sha512_init, sha512_copy, sha512_bytes, sha512_final, sha512_free,
+    sizeof(SHA512_State), sha512_init_ctx, sha512_final_ctx, SHA512_Simple,
     64, "SHA-512"
 };
 
@@ -387,8 +401,22 @@ static void sha384_final(void *handle, unsigned char *output)
     sfree(s);
 }
 
+static void sha384_init_ctx(void *handle)
+{
+    SHA384_Init((SHA384_State *)handle);
+}
+
+static void sha384_final_ctx(void *handle, unsigned char *output)
+{
+    SHA512_State *s = handle;
+
+    SHA384_Final(s, output);
+    smemclr(s, sizeof(*s));
+}
+
 const struct ssh_hash ssh_sha384 = {
     sha384_init, sha512_copy, sha512_bytes, sha384_final, sha512_free,
+    sizeof(SHA512_State), sha384_init_ctx, sha384_final_ctx, SHA384_Simple,
     48, "SHA-384"
 };
 
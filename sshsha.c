@@ -13,6 +13,34 @@
 
 #define rol(x,y) ( ((x) << (y)) | (((uint32)x) >> (32-y)) )
 
+/*
+ * Hardware-accelerated transform using the ARMv8-A SHA1 crypto
+ * extension, with runtime dispatch via sshcpu.c, following the
+ * pattern of the hardware paths in sshaes.c and sshsh256.c.
+ * Implementation at the bottom of this file.
+ */
+#ifdef _FORCE_ARM_SHA1
+#   define COMPILER_SUPPORTS_ARM_SHA1
+#elif defined(__aarch64__)
+#   if defined(__clang__)
+#       if __clang_major__ >= 7
+#           define COMPILER_SUPPORTS_ARM_SHA1
+#       endif
+#   elif defined(__GNUC__)
+#       if __GNUC__ >= 6
+#           define COMPILER_SUPPORTS_ARM_SHA1
+#       endif
+#   endif
+#endif
+
+#ifdef _FORCE_SOFTWARE_SHA
+#   undef COMPILER_SUPPORTS_ARM_SHA1
+#endif
+
+#ifdef COMPILER_SUPPORTS_ARM_SHA1
+static void SHATransform_ce(word32 *digest, const word32 *block);
+#endif
+
 static void SHA_Core_Init(uint32 h[5])
 {
     h[0] = 0x67452301;
@@ -43,6 +71,13 @@ void SHATransform(word32 * digest, word32 * block)
     }
 #endif
 
+#ifdef COMPILER_SUPPORTS_ARM_SHA1
+    if (ssh_cpu_has(SSH_CPU_HWSHA1)) {
+        SHATransform_ce(digest, block);
+        return;
+    }
+#endif
+
     for (t = 0; t < 16; t++)
 	w[t] = block[t];
 
@@ -263,8 +298,23 @@ static void sha1_final(void *handle, unsigned char *output)
     sha1_free(s);
 }
 
+static void sha1_init_ctx(void *handle)
+{
+    SHA_Init((SHA_State *)handle);
+}
+
+static void sha1_final_ctx(void *handle, unsigned char *output)
+{
+    SHA_State *s = handle;
+
+    SHA_Final(s, output);
+    smemclr(s, sizeof(*s));
+}
+
 const struct ssh_hash ssh_sha1 = {
-    sha1_init, sha1_copy, sha1_bytes, sha1_final, sha1_free, 20, "SHA-1"
+    sha1_init, sha1_copy, sha1_bytes, sha1_final, sha1_free,
+    sizeof(SHA_State), sha1_init_ctx, sha1_final_ctx, SHA_Simple,
+    20, "SHA-1"
 };
 
 /* ----------------------------------------------------------------------
@@ -453,3 +503,172 @@ const struct ssh_mac ssh_hmac_sha1_96_buggy = {
     12, 16,
     "bug-compatible HMAC-SHA1-96"
 };
+
+/*
+ * Implementation of the SHA1 transform using the ARMv8-A crypto
+ * extensions. The incoming block has already been gathered into
+ * host-order words by the caller, so no byte reversal is needed
+ * before loading it into vector registers.
+ */
+#ifdef COMPILER_SUPPORTS_ARM_SHA1
+
+#include <arm_neon.h>
+
+__attribute__ ((target("+crypto")))
+static void SHATransform_ce(word32 *digest, const word32 *block)
+{
+    uint32x4_t abcd, abcd_save, tmp0, tmp1;
+    uint32x4_t msg0, msg1, msg2, msg3;
+    uint32_t e0, e0_save, e1;
+
+    abcd = vld1q_u32((const uint32_t *)digest);
+    e0 = digest[4];
+    abcd_save = abcd;
+    e0_save = e0;
+
+    msg0 = vld1q_u32((const uint32_t *)block + 0);
+    msg1 = vld1q_u32((const uint32_t *)block + 4);
+    msg2 = vld1q_u32((const uint32_t *)block + 8);
+    msg3 = vld1q_u32((const uint32_t *)block + 12);
+
+    tmp0 = vaddq_u32(msg0, vdupq_n_u32(0x5A827999));
+    tmp1 = vaddq_u32(msg1, vdupq_n_u32(0x5A827999));
+
+    /* Rounds 0-3 */
+    e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1cq_u32(abcd, e0, tmp0);
+    tmp0 = vaddq_u32(msg2, vdupq_n_u32(0x5A827999));
+    msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+
+    /* Rounds 4-7 */
+    e0 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1cq_u32(abcd, e1, tmp1);
+    tmp1 = vaddq_u32(msg3, vdupq_n_u32(0x5A827999));
+    msg0 = vsha1su1q_u32(msg0, msg3);
+    msg1 = vsha1su0q_u32(msg1, msg2, msg3);
+
+    /* Rounds 8-11 */
+    e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1cq_u32(abcd, e0, tmp0);
+    tmp0 = vaddq_u32(msg0, vdupq_n_u32(0x5A827999));
+    msg1 = vsha1su1q_u32(msg1, msg0);
+    msg2 = vsha1su0q_u32(msg2, msg3, msg0);
+
+    /* Rounds 12-15 */
+    e0 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1cq_u32(abcd, e1, tmp1);
+    tmp1 = vaddq_u32(msg1, vdupq_n_u32(0x6ED9EBA1));
+    msg2 = vsha1su1q_u32(msg2, msg1);
+    msg3 = vsha1su0q_u32(msg3, msg0, msg1);
+
+    /* Rounds 16-19 */
+    e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1cq_u32(abcd, e0, tmp0);
+    tmp0 = vaddq_u32(msg2, vdupq_n_u32(0x6ED9EBA1));
+    msg3 = vsha1su1q_u32(msg3, msg2);
+    msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+
+    /* Rounds 20-23 */
+    e0 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1pq_u32(abcd, e1, tmp1);
+    tmp1 = vaddq_u32(msg3, vdupq_n_u32(0x6ED9EBA1));
+    msg0 = vsha1su1q_u32(msg0, msg3);
+    msg1 = vsha1su0q_u32(msg1, msg2, msg3);
+
+    /* Rounds 24-27 */
+    e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1pq_u32(abcd, e0, tmp0);
+    tmp0 = vaddq_u32(msg0, vdupq_n_u32(0x6ED9EBA1));
+    msg1 = vsha1su1q_u32(msg1, msg0);
+    msg2 = vsha1su0q_u32(msg2, msg3, msg0);
+
+    /* Rounds 28-31 */
+    e0 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1pq_u32(abcd, e1, tmp1);
+    tmp1 = vaddq_u32(msg1, vdupq_n_u32(0x6ED9EBA1));
+    msg2 = vsha1su1q_u32(msg2, msg1);
+    msg3 = vsha1su0q_u32(msg3, msg0, msg1);
+
+    /* Rounds 32-35 */
+    e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1pq_u32(abcd, e0, tmp0);
+    tmp0 = vaddq_u32(msg2, vdupq_n_u32(0x8F1BBCDC));
+    msg3 = vsha1su1q_u32(msg3, msg2);
+    msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+
+    /* Rounds 36-39 */
+    e0 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1pq_u32(abcd, e1, tmp1);
+    tmp1 = vaddq_u32(msg3, vdupq_n_u32(0x8F1BBCDC));
+    msg0 = vsha1su1q_u32(msg0, msg3);
+    msg1 = vsha1su0q_u32(msg1, msg2, msg3);
+
+    /* Rounds 40-43 */
+    e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1mq_u32(abcd, e0, tmp0);
+    tmp0 = vaddq_u32(msg0, vdupq_n_u32(0x8F1BBCDC));
+    msg1 = vsha1su1q_u32(msg1, msg0);
+    msg2 = vsha1su0q_u32(msg2, msg3, msg0);
+
+    /* Rounds 44-47 */
+    e0 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1mq_u32(abcd, e1, tmp1);
+    tmp1 = vaddq_u32(msg1, vdupq_n_u32(0x8F1BBCDC));
+    msg2 = vsha1su1q_u32(msg2, msg1);
+    msg3 = vsha1su0q_u32(msg3, msg0, msg1);
+
+    /* Rounds 48-51 */
+    e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1mq_u32(abcd, e0, tmp0);
+    tmp0 = vaddq_u32(msg2, vdupq_n_u32(0x8F1BBCDC));
+    msg3 = vsha1su1q_u32(msg3, msg2);
+    msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+
+    /* Rounds 52-55 */
+    e0 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1mq_u32(abcd, e1, tmp1);
+    tmp1 = vaddq_u32(msg3, vdupq_n_u32(0xCA62C1D6));
+    msg0 = vsha1su1q_u32(msg0, msg3);
+    msg1 = vsha1su0q_u32(msg1, msg2, msg3);
+
+    /* Rounds 56-59 */
+    e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1mq_u32(abcd, e0, tmp0);
+    tmp0 = vaddq_u32(msg0, vdupq_n_u32(0xCA62C1D6));
+    msg1 = vsha1su1q_u32(msg1, msg0);
+    msg2 = vsha1su0q_u32(msg2, msg3, msg0);
+
+    /* Rounds 60-63 */
+    e0 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1pq_u32(abcd, e1, tmp1);
+    tmp1 = vaddq_u32(msg1, vdupq_n_u32(0xCA62C1D6));
+    msg2 = vsha1su1q_u32(msg2, msg1);
+    msg3 = vsha1su0q_u32(msg3, msg0, msg1);
+
+    /* Rounds 64-67 */
+    e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1pq_u32(abcd, e0, tmp0);
+    tmp0 = vaddq_u32(msg2, vdupq_n_u32(0xCA62C1D6));
+    msg3 = vsha1su1q_u32(msg3, msg2);
+
+    /* Rounds 68-71 */
+    e0 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1pq_u32(abcd, e1, tmp1);
+    tmp1 = vaddq_u32(msg3, vdupq_n_u32(0xCA62C1D6));
+
+    /* Rounds 72-75 */
+    e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1pq_u32(abcd, e0, tmp0);
+
+    /* Rounds 76-79 */
+    e0 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    abcd = vsha1pq_u32(abcd, e1, tmp1);
+
+    abcd = vaddq_u32(abcd, abcd_save);
+    e0 += e0_save;
+
+    vst1q_u32((uint32_t *)digest, abcd);
+    digest[4] = e0;
+}
+
+#endif /* COMPILER_SUPPORTS_ARM_SHA1 */
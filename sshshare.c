@@ -1783,6 +1783,23 @@ static void share_got_pkt_from_downstream(struct ssh_sharing_connstate *cs,
         len--;                                                  \
         (c) = (unsigned char)*data++;                           \
     } while (0)
+/* Accumulate data into cs->recvbuf until cs->recvlen reaches targetlen,
+ * copying a whole block at a time rather than going via crGetChar for
+ * every byte. Used for the packet framing loops, where bulk data from a
+ * downstream would otherwise cost a coroutine-resume check per byte. */
+#define crGetBlock(targetlen) do                                \
+    {                                                           \
+        while (len == 0) {                                      \
+            *crLine =__LINE__; return; case __LINE__:;          \
+        }                                                       \
+        blklen = (targetlen) - cs->recvlen;                     \
+        if (blklen > len)                                       \
+            blklen = len;                                       \
+        memcpy(cs->recvbuf + cs->recvlen, data, blklen);        \
+        cs->recvlen += blklen;                                  \
+        data += blklen;                                         \
+        len -= blklen;                                          \
+    } while (cs->recvlen < (targetlen))
 
 static void share_receive(Plug plug, int urgent, char *data, int len)
 {
@@ -1790,6 +1807,7 @@ static void share_receive(Plug plug, int urgent, char *data, int len)
     static const char expected_verstring_prefix[] =
         "SSHCONNECTION@putty.projects.tartarus.org-2.0-";
     unsigned char c;
+    int blklen;
 
     crBegin(cs->crLine);
 
@@ -1834,10 +1852,7 @@ static void share_receive(Plug plug, int urgent, char *data, int len)
      */
     while (1) {
         cs->recvlen = 0;
-        while (cs->recvlen < 4) {
-            crGetChar(c);
-            cs->recvbuf[cs->recvlen++] = c;
-        }
+        crGetBlock(4);
         cs->curr_packetlen = toint(GET_32BIT(cs->recvbuf) + 4);
         if (cs->curr_packetlen < 5 ||
             cs->curr_packetlen > sizeof(cs->recvbuf)) {
@@ -1847,10 +1862,7 @@ static void share_receive(Plug plug, int urgent, char *data, int len)
             sfree(buf);
             goto dead;
         }
-        while (cs->recvlen < cs->curr_packetlen) {
-            crGetChar(c);
-            cs->recvbuf[cs->recvlen++] = c;
-        }
+        crGetBlock(cs->curr_packetlen);
 
         share_got_pkt_from_downstream(cs, cs->recvbuf[4],
                                       cs->recvbuf + 5, cs->recvlen - 5);
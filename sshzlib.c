@@ -133,6 +133,8 @@ struct LZ77InternalContext {
     struct HashEntry hashtab[HASHMAX];
     unsigned char pending[HASHCHARS];
     int npending;
+    int maxmatch;		       /* hash chain entries to consider */
+    int lazy;			       /* defer matches by one position? */
 };
 
 static int lz77_hash(unsigned char *data)
@@ -159,6 +161,9 @@ static int lz77_init(struct LZ77Context *ctx)
 
     st->npending = 0;
 
+    st->maxmatch = MAXMATCH;
+    st->lazy = TRUE;
+
     return 1;
 }
 
@@ -197,12 +202,45 @@ static void lz77_advance(struct LZ77InternalContext *st,
 
 #define CHARAT(k) ( (k)<0 ? st->data[(st->winpos+k)&(WINSIZE-1)] : data[k] )
 
+/*
+ * Find the length of the match at distance `distance' behind the
+ * current position, given that the first HASHCHARS characters are
+ * already known to match. While the copy source still lies inside
+ * the history window we have to fetch it through the circular
+ * buffer one byte at a time; once it has caught up into the current
+ * input (i - distance >= 0), both sides are plain linear memory, so
+ * we can compare a word at a time.
+ */
+static int lz77_matchlen(struct LZ77InternalContext *st,
+			 const unsigned char *data, int len, int distance)
+{
+    int i = HASHCHARS;
+
+    while (i < len && i - distance < 0) {
+	if (data[i] != st->data[(st->winpos + i - distance) & (WINSIZE - 1)])
+	    return i;
+	i++;
+    }
+
+    while (i + (int)sizeof(unsigned long) <= len) {
+	unsigned long a, b;
+	memcpy(&a, data + i, sizeof(a));
+	memcpy(&b, data + i - distance, sizeof(b));
+	if (a != b)
+	    break;
+	i += sizeof(unsigned long);
+    }
+    while (i < len && data[i] == data[i - distance])
+	i++;
+    return i;
+}
+
 static void lz77_compress(struct LZ77Context *ctx,
 			  unsigned char *data, int len, int compress)
 {
     struct LZ77InternalContext *st = ctx->ictx;
-    int i, distance, off, nmatch, matchlen, advance;
-    struct Match defermatch, matches[MAXMATCH];
+    int i, distance, off, nmatch, matchlen, advance, nconsidered;
+    struct Match defermatch, thismatch;
     int deferchr;
 
     assert(st->npending <= HASHCHARS);
@@ -245,10 +283,22 @@ static void lz77_compress(struct LZ77Context *ctx,
 	    int hash = lz77_hash(data);
 
 	    /*
-	     * Look the hash up in the corresponding hash chain and see
-	     * what we can find.
+	     * Walk the corresponding hash chain looking for the
+	     * longest match. We consider at most st->maxmatch chain
+	     * entries that genuinely start with our three characters,
+	     * as the previous version of this code did; but rather
+	     * than following all of them down in lockstep a byte at a
+	     * time, we extend each candidate individually, after
+	     * first checking the one byte that would let it beat the
+	     * best length so far, which screens out most candidates
+	     * in a single compare. Equal lengths go to the earliest
+	     * candidate found - the chain is newest-first, so that's
+	     * the shortest distance, the same choice the lockstep
+	     * version made.
 	     */
 	    nmatch = 0;
+	    nconsidered = 0;
+	    thismatch.distance = thismatch.len = 0;
 	    for (off = st->hashtab[hash].first;
 		 off != INVALID; off = st->win[off].next) {
 		/* distance = 1       if off == st->winpos-1 */
@@ -258,10 +308,25 @@ static void lz77_compress(struct LZ77Context *ctx,
 		for (i = 0; i < HASHCHARS; i++)
 		    if (CHARAT(i) != CHARAT(i - distance))
 			break;
-		if (i == HASHCHARS) {
-		    matches[nmatch].distance = distance;
-		    matches[nmatch].len = 3;
-		    if (++nmatch >= MAXMATCH)
+		if (i < HASHCHARS)
+		    continue;
+		if (++nconsidered > st->maxmatch)
+		    break;
+		/*
+		 * To beat the best length so far, this candidate
+		 * would have to match at index thismatch.len as well.
+		 */
+		if (thismatch.len >= HASHCHARS &&
+		    (thismatch.len >= len ||
+		     CHARAT(thismatch.len) !=
+		     CHARAT(thismatch.len - distance)))
+		    continue;
+		matchlen = lz77_matchlen(st, data, len, distance);
+		if (matchlen > thismatch.len) {
+		    thismatch.len = matchlen;
+		    thismatch.distance = distance;
+		    nmatch = 1;
+		    if (matchlen >= len)   /* can't do any better */
 			break;
 		}
 	    }
@@ -271,38 +336,15 @@ static void lz77_compress(struct LZ77Context *ctx,
 
 	if (nmatch > 0) {
 	    /*
-	     * We've now filled up matches[] with nmatch potential
-	     * matches. Follow them down to find the longest. (We
-	     * assume here that it's always worth favouring a
-	     * longer match over a shorter one.)
+	     * We've found a best match. See if we want to defer it or
+	     * throw it away.
 	     */
-	    matchlen = HASHCHARS;
-	    while (matchlen < len) {
-		int j;
-		for (i = j = 0; i < nmatch; i++) {
-		    if (CHARAT(matchlen) ==
-			CHARAT(matchlen - matches[i].distance)) {
-			matches[j++] = matches[i];
-		    }
-		}
-		if (j == 0)
-		    break;
-		matchlen++;
-		nmatch = j;
-	    }
-
-	    /*
-	     * We've now got all the longest matches. We favour the
-	     * shorter distances, which means we go with matches[0].
-	     * So see if we want to defer it or throw it away.
-	     */
-	    matches[0].len = matchlen;
 	    if (defermatch.len > 0) {
-		if (matches[0].len > defermatch.len + 1) {
+		if (thismatch.len > defermatch.len + 1) {
 		    /* We have a better match. Emit the deferred char,
 		     * and defer this match. */
 		    ctx->literal(ctx, (unsigned char) deferchr);
-		    defermatch = matches[0];
+		    defermatch = thismatch;
 		    deferchr = data[0];
 		    advance = 1;
 		} else {
@@ -311,11 +353,16 @@ static void lz77_compress(struct LZ77Context *ctx,
 		    advance = defermatch.len - 1;
 		    defermatch.len = 0;
 		}
-	    } else {
+	    } else if (st->lazy) {
 		/* There was no deferred match. Defer this one. */
-		defermatch = matches[0];
+		defermatch = thismatch;
 		deferchr = data[0];
 		advance = 1;
+	    } else {
+		/* Lazy matching disabled at this compression level:
+		 * just emit the match straight away. */
+		ctx->match(ctx, thismatch.distance, thismatch.len);
+		advance = thismatch.len;
 	    }
 	} else {
 	    /*
@@ -371,8 +418,34 @@ struct Outbuf {
     int noutbits;
     int firstblock;
     int comp_disabled;
+    unsigned long adler;	       /* checksum of all input so far */
 };
 
+/*
+ * Adler-32 checksum, as defined in RFC 1950. The SSH packet
+ * protocol never terminates its zlib streams so never sends this,
+ * but zlib_compress_finish() needs it to close off a stream
+ * written to a file.
+ */
+static unsigned long adler32_update(unsigned long adler,
+				    const unsigned char *data, int len)
+{
+    unsigned long s1 = adler & 0xFFFF, s2 = (adler >> 16) & 0xFFFF;
+    int i;
+
+    for (i = 0; i < len; i++) {
+	s1 += data[i];
+	s2 += s1;
+	if ((i & 0xFFF) == 0xFFF) {
+	    s1 %= 65521;
+	    s2 %= 65521;
+	}
+    }
+    s1 %= 65521;
+    s2 %= 65521;
+    return (s2 << 16) | s1;
+}
+
 static void outbits(struct Outbuf *out, unsigned long bits, int nbits)
 {
     assert(out->noutbits + nbits <= 32);
@@ -380,7 +453,10 @@ static void outbits(struct Outbuf *out, unsigned long bits, int nbits)
     out->noutbits += nbits;
     while (out->noutbits >= 8) {
 	if (out->outlen >= out->outsize) {
-	    out->outsize = out->outlen + 64;
+	    /* Grow geometrically: for a large block, repeated
+	     * constant-sized growth turns the whole compression pass
+	     * quadratic in the amount of output. */
+	    out->outsize = out->outsize * 3 / 2 + 64;
 	    out->outbuf = sresize(out->outbuf, out->outsize, unsigned char);
 	}
 	out->outbuf[out->outlen++] = (unsigned char) (out->outbits & 0xFF);
@@ -607,12 +683,37 @@ static void zlib_match(struct LZ77Context *ectx, int distance, int len)
     }
 }
 
-void *zlib_compress_init(void)
+void *zlib_compress_init(int level)
 {
     struct Outbuf *out;
     struct LZ77Context *ectx = snew(struct LZ77Context);
+    struct LZ77InternalContext *st;
+    /*
+     * How the compression level maps on to the knobs the match
+     * finder actually has: how far down a hash chain we're prepared
+     * to search, and whether we use lazy matching. Level 6, the
+     * default, is the behaviour this module has always had; the only
+     * effect of the level is how hard we work looking for matches,
+     * so the output is a valid Deflate stream whatever the setting.
+     */
+    static const struct {
+	int maxmatch, lazy;
+    } levels[10] = {
+	{4, FALSE},		       /* 0 is clamped to 1 */
+	{4, FALSE}, {8, FALSE}, {16, FALSE},
+	{8, TRUE}, {16, TRUE}, {32, TRUE},
+	{64, TRUE}, {128, TRUE}, {256, TRUE},
+    };
+
+    if (level < 1)
+	level = 1;
+    if (level > 9)
+	level = 9;
 
     lz77_init(ectx);
+    st = ectx->ictx;
+    st->maxmatch = levels[level].maxmatch;
+    st->lazy = levels[level].lazy;
     ectx->literal = zlib_literal;
     ectx->match = zlib_match;
 
@@ -620,6 +721,7 @@ void *zlib_compress_init(void)
     out->outbits = out->noutbits = 0;
     out->firstblock = 1;
     out->comp_disabled = FALSE;
+    out->adler = 1;
     ectx->userdata = out;
 
     return ectx;
@@ -685,6 +787,8 @@ int zlib_compress_block(void *handle, unsigned char *block, int len,
     out->outbuf = NULL;
     out->outlen = out->outsize = 0;
 
+    out->adler = adler32_update(out->adler, block, len);
+
     /*
      * If this is the first block, output the Zlib (RFC1950) header
      * bytes 78 9C. (Deflate compression, 32K window size, default
@@ -796,6 +900,54 @@ int zlib_compress_block(void *handle, unsigned char *block, int len,
     return 1;
 }
 
+/*
+ * Terminate a zlib stream properly, so that the output forms a
+ * complete RFC 1950 stream. The SSH packet protocol never does
+ * this (its streams last for the whole connection), but when the
+ * compressor is used to write a file - compressing a rotated
+ * session log - the file is unreadable by standard tools without
+ * a final block and the Adler-32 trailer. After this call the
+ * compressor is finished with and should only be passed to
+ * zlib_compress_cleanup.
+ */
+void zlib_compress_finish(void *handle, unsigned char **outblock, int *outlen)
+{
+    struct LZ77Context *ectx = (struct LZ77Context *)handle;
+    struct Outbuf *out = (struct Outbuf *) ectx->userdata;
+
+    out->outbuf = NULL;
+    out->outlen = out->outsize = 0;
+
+    if (out->firstblock) {
+	outbits(out, 0x9C78, 16);      /* header for a trivial stream */
+	out->firstblock = 0;
+    } else {
+	outbits(out, 0, 7);	       /* close the open static block */
+    }
+
+    /*
+     * An empty uncompressed block with BFINAL set: a one bit, two
+     * zero bits, padding to a byte boundary, then the zero length
+     * and its complement.
+     */
+    outbits(out, 1, 3);
+    if (out->noutbits)
+	outbits(out, 0, 8 - out->noutbits);
+    outbits(out, 0, 16);
+    outbits(out, 0xFFFF, 16);
+
+    /*
+     * The checksum of the entire uncompressed data, MSB first.
+     */
+    outbits(out, (out->adler >> 24) & 0xFF, 8);
+    outbits(out, (out->adler >> 16) & 0xFF, 8);
+    outbits(out, (out->adler >> 8) & 0xFF, 8);
+    outbits(out, out->adler & 0xFF, 8);
+
+    *outblock = out->outbuf;
+    *outlen = out->outlen;
+}
+
 /* ----------------------------------------------------------------------
  * Zlib decompression. Of course, even though our compressor always
  * uses static trees, our _decompressor_ has to be capable of
@@ -1036,17 +1188,76 @@ static int zlib_huflookup(unsigned long *bitsp, int *nbitsp,
     }
 }
 
+static void zlib_emit_ensure(struct zlib_decompress_ctx *dctx, int n)
+{
+    if (dctx->outlen + n > dctx->outsize) {
+	dctx->outsize = dctx->outsize * 3 / 2 + n;
+	dctx->outblk = sresize(dctx->outblk, dctx->outsize, unsigned char);
+    }
+}
+
 static void zlib_emit_char(struct zlib_decompress_ctx *dctx, int c)
 {
     dctx->window[dctx->winpos] = c;
     dctx->winpos = (dctx->winpos + 1) & (WINSIZE - 1);
-    if (dctx->outlen >= dctx->outsize) {
-	dctx->outsize = dctx->outlen + 512;
-	dctx->outblk = sresize(dctx->outblk, dctx->outsize, unsigned char);
-    }
+    zlib_emit_ensure(dctx, 1);
     dctx->outblk[dctx->outlen++] = c;
 }
 
+/*
+ * Emit a whole run of bytes at once: one capacity check and a bulk
+ * copy into the output block, plus at most a few memcpys to fold it
+ * into the circular window.
+ */
+static void zlib_emit_block(struct zlib_decompress_ctx *dctx,
+			    const unsigned char *data, int len)
+{
+    zlib_emit_ensure(dctx, len);
+    memcpy(dctx->outblk + dctx->outlen, data, len);
+    dctx->outlen += len;
+
+    while (len > 0) {
+	int chunk = WINSIZE - dctx->winpos;
+	if (chunk > len)
+	    chunk = len;
+	memcpy(dctx->window + dctx->winpos, data, chunk);
+	dctx->winpos = (dctx->winpos + chunk) & (WINSIZE - 1);
+	data += chunk;
+	len -= chunk;
+    }
+}
+
+/*
+ * Emit a match: copy `len' bytes from `dist' bytes behind the
+ * current window position. Copying proceeds in chunks of up to
+ * `dist' bytes, so that a match which overlaps its own output (len >
+ * dist, a repeating run) still reads each byte after it has been
+ * written; within a chunk the source is always strictly older data.
+ * The window update copies back out of the output block, which never
+ * overlaps the window.
+ */
+static void zlib_emit_match(struct zlib_decompress_ctx *dctx,
+			    int dist, int len)
+{
+    zlib_emit_ensure(dctx, len);
+    while (len > 0) {
+	int srcpos = (dctx->winpos - dist) & (WINSIZE - 1);
+	int chunk = len;
+	if (chunk > dist)
+	    chunk = dist;
+	if (chunk > WINSIZE - srcpos)
+	    chunk = WINSIZE - srcpos;  /* source wraps the window edge */
+	if (chunk > WINSIZE - dctx->winpos)
+	    chunk = WINSIZE - dctx->winpos;   /* so does the destination */
+	memcpy(dctx->outblk + dctx->outlen, dctx->window + srcpos, chunk);
+	memcpy(dctx->window + dctx->winpos,
+	       dctx->outblk + dctx->outlen, chunk);
+	dctx->outlen += chunk;
+	dctx->winpos = (dctx->winpos + chunk) & (WINSIZE - 1);
+	len -= chunk;
+    }
+}
+
 #define EATBITS(n) ( dctx->nbits -= (n), dctx->bits >>= (n) )
 
 int zlib_decompress_block(void *handle, unsigned char *block, int len,
@@ -1245,9 +1456,7 @@ int zlib_decompress_block(void *handle, unsigned char *block, int len,
 	    dist = rec->min + (dctx->bits & ((1 << rec->extrabits) - 1));
 	    EATBITS(rec->extrabits);
 	    dctx->state = INBLK;
-	    while (dctx->len--)
-		zlib_emit_char(dctx, dctx->window[(dctx->winpos - dist) &
-						  (WINSIZE - 1)]);
+	    zlib_emit_match(dctx, dist, dctx->len);
 	    break;
 	  case UNCOMP_LEN:
 	    /*
@@ -1279,9 +1488,23 @@ int zlib_decompress_block(void *handle, unsigned char *block, int len,
 	  case UNCOMP_DATA:
 	    if (dctx->nbits < 8)
 		goto finished;
-	    zlib_emit_char(dctx, dctx->bits & 0xFF);
-	    EATBITS(8);
-	    if (--dctx->uncomplen == 0)
+	    /*
+	     * Drain whole bytes out of the bit buffer, then copy as
+	     * much as possible of the block straight from the input.
+	     */
+	    while (dctx->nbits >= 8 && dctx->uncomplen > 0) {
+		zlib_emit_char(dctx, dctx->bits & 0xFF);
+		EATBITS(8);
+		dctx->uncomplen--;
+	    }
+	    if (dctx->uncomplen > 0 && len > 0) {
+		int chunk = len < dctx->uncomplen ? len : dctx->uncomplen;
+		zlib_emit_block(dctx, block, chunk);
+		block += chunk;
+		len -= chunk;
+		dctx->uncomplen -= chunk;
+	    }
+	    if (dctx->uncomplen == 0)
 		dctx->state = OUTSIDEBLK;	/* end of uncompressed block */
 	    break;
 	}
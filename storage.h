@@ -22,6 +22,12 @@
  * sequence the settings should have been written to the PuTTY
  * persistent storage area.
  *
+ * The whole sequence is a write transaction: implementations are
+ * expected to collect the values and commit them to persistent
+ * storage in one batch in close_settings_w(), as atomically as the
+ * platform allows, so that an interrupted save doesn't leave a
+ * half-written session behind.
+ *
  * A given key will be written at most once while saving a session.
  * Keys may be up to 255 characters long.  String values have no length
  * limit.
@@ -89,6 +95,30 @@ int verify_host_key(const char *hostname, int port,
 void store_host_key(const char *hostname, int port,
 		    const char *keytype, const char *key);
 
+/*
+ * Remember which algorithms a server put first in its KEXINIT, so
+ * that the next connection to it can risk a guessed first key
+ * exchange packet. read_learned_kex returns a dynamically allocated
+ * string as previously passed to store_learned_kex, or NULL if
+ * nothing is stored for the host.
+ */
+char *read_learned_kex(const char *hostname, int port);
+void store_learned_kex(const char *hostname, int port, const char *algs);
+
+/*
+ * Remember the fingerprint of the last public key a server accepted
+ * for authentication, so that the next connection to it can send a
+ * signed publickey request straight away instead of offering the key
+ * and waiting to be invited. Like the learned-kex cache this is a
+ * latency hint, not a security record: a stale entry just costs one
+ * refused authentication attempt. read_accepted_pubkey returns a
+ * dynamically allocated string as previously passed to
+ * store_accepted_pubkey, or NULL if nothing is stored for the host.
+ */
+char *read_accepted_pubkey(const char *hostname, int port);
+void store_accepted_pubkey(const char *hostname, int port,
+                           const char *fingerprint);
+
 /* ----------------------------------------------------------------------
  * Functions to access PuTTY's random number seed file.
  */
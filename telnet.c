@@ -544,8 +544,40 @@ static void do_telnet_read(Telnet telnet, char *buf, int len)
     outbuf[outbuflen++] = (c); \
 } while (0)
 
-    while (len--) {
-	int c = (unsigned char) *buf++;
+    while (len > 0) {
+	int c;
+
+	if (telnet->state == TOP_LEVEL && !telnet->in_synch) {
+	    /*
+	     * Fast path: scan ahead for the next byte the state
+	     * machine actually cares about - IAC, or CR when we have
+	     * to watch for the CR NUL encoding - and pass the whole
+	     * clean span through in one go, rather than running every
+	     * byte of a high-volume console log through the switch
+	     * below individually.
+	     */
+	    char *p = memchr(buf, IAC, len);
+	    int span = p ? p - buf : len;
+	    if (telnet->opt_states[o_they_bin.index] != ACTIVE) {
+		char *q = memchr(buf, CR, span);
+		if (q)
+		    span = q - buf;
+	    }
+	    if (span > 0) {
+		if (outbuflen + span > outbufsize) {
+		    outbufsize = outbuflen + span + 256;
+		    outbuf = sresize(outbuf, outbufsize, char);
+		}
+		memcpy(outbuf + outbuflen, buf, span);
+		outbuflen += span;
+		buf += span;
+		len -= span;
+		continue;
+	    }
+	}
+
+	c = (unsigned char) *buf++;
+	len--;
 
 	switch (telnet->state) {
 	  case TOP_LEVEL:
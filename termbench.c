@@ -0,0 +1,526 @@
+/*
+ * termbench.c: headless benchmark harness for the terminal
+ * emulator, built on the same null-frontend Terminal that
+ * fuzzterm.c instantiates. Synthetic workloads modelled on the
+ * sessions people actually complain about - a giant cat, vim-style
+ * scrolling with syntax colours, an htop-style full-colour screen
+ * refresh, raw cursor-motion spam - are fed through term_data() in
+ * network-sized chunks, with the deferred scrollback-compression
+ * callbacks run between chunks just as the event loop would.
+ *
+ * Results are printed one per line as "name value unit", in the
+ * same format as cryptobench, so that a script can diff the numbers
+ * between two builds: MB/s for every workload, microseconds per
+ * escape sequence for the sequence-heavy ones, and full-screen
+ * repaints per second. Each benchmark self-calibrates to run for
+ * about half a second.
+ */
+
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PUTTY_DO_GLOBALS
+#include "putty.h"
+#include "terminal.h"
+
+#define BENCH_ROWS 40
+#define BENCH_COLS 120
+
+/* For Unix in particular, but harmless if this main() is reused elsewhere */
+const int buildinfo_gtk_relevant = FALSE;
+
+/*
+ * Time a single operation by repeating it until at least half a
+ * second of CPU time has gone by, then report the rate; same
+ * scaffold as cryptobench.c.
+ */
+#define BENCH_SECONDS 0.5
+
+static double bench_rate(void (*op)(void *ctx, int iters), void *ctx)
+{
+    clock_t start, elapsed;
+    long total = 0;
+    int batch = 1;
+
+    /* Warm up, and let one-off lazy initialisations happen outside
+     * the timed region. */
+    op(ctx, 1);
+
+    start = clock();
+    do {
+	op(ctx, batch);
+	total += batch;
+	elapsed = clock() - start;
+	if (batch < 1 << 20)
+	    batch *= 2;
+    } while (elapsed < (clock_t)(BENCH_SECONDS * CLOCKS_PER_SEC));
+
+    return total / ((double)elapsed / CLOCKS_PER_SEC);
+}
+
+static void report(const char *name, double value, const char *unit)
+{
+    printf("%s %.6g %s\n", name, value, unit);
+}
+
+/* ----------------------------------------------------------------------
+ * Workload construction: each builder appends one 'frame' of output
+ * to a growing buffer, and is repeated until the buffer holds a
+ * reasonable amount of data to cycle over.
+ */
+
+struct workbuf {
+    char *data;
+    int len, size;
+};
+
+static void wb_add(struct workbuf *wb, const char *data, int len)
+{
+    if (wb->len + len > wb->size) {
+	wb->size = (wb->len + len) * 3 / 2 + 4096;
+	wb->data = sresize(wb->data, wb->size, char);
+    }
+    memcpy(wb->data + wb->len, data, len);
+    wb->len += len;
+}
+
+static void wb_addf(struct workbuf *wb, const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    wb_add(wb, buf, len);
+}
+
+/* A giant cat: plain ASCII text lines, no escapes beyond CRLF. */
+static void frame_cat(struct workbuf *wb, int frame)
+{
+    int i;
+    for (i = 0; i < BENCH_ROWS; i++)
+	wb_addf(wb, "%5d  the quick brown fox jumps over the lazy dog;"
+		" pack my box with five dozen liquor jugs\r\n",
+		frame * BENCH_ROWS + i);
+}
+
+/* The same in UTF-8, to cost the multibyte decode path. */
+static void frame_cat_utf8(struct workbuf *wb, int frame)
+{
+    int i;
+    for (i = 0; i < BENCH_ROWS; i++)
+	wb_addf(wb, "%5d  \303\251l\303\250ve na\303\257ve r\303\251sum"
+		"\303\251 \342\200\224 \316\261\316\262\316\263\316\264 "
+		"\342\226\266 \321\202\320\265\321\201\321\202 \303\274ber"
+		" stra\303\237e\r\n", frame * BENCH_ROWS + i);
+}
+
+/*
+ * Vim-style scrolling: a fixed scroll region, each new line pushed
+ * in at the bottom and drawn as a handful of differently-coloured
+ * syntax fragments, with a status line repainted in inverse video.
+ */
+static void frame_vim(struct workbuf *wb, int frame)
+{
+    int i;
+
+    wb_addf(wb, "\033[1;%dr", BENCH_ROWS - 1);
+    for (i = 0; i < BENCH_ROWS; i++) {
+	wb_addf(wb, "\033[%d;1H\n", BENCH_ROWS - 1);
+	wb_addf(wb, "\033[34mstatic\033[0m \033[32mint\033[0m "
+		"frame_%d_%d(\033[36mvoid\033[0m *ctx) "
+		"{ \033[31mreturn\033[0m %d; } "
+		"\033[33m/* scrolled in */\033[0m",
+		frame, i, i);
+    }
+    wb_addf(wb, "\033[%d;1H\033[7m %d lines scrolled \033[0m\033[r",
+	    BENCH_ROWS, (frame + 1) * BENCH_ROWS);
+}
+
+/*
+ * htop-style refresh: home the cursor and repaint the whole screen
+ * every frame, in short runs of 256-colour foreground/background
+ * changes with an erase-to-end-of-line per row.
+ */
+static void frame_htop(struct workbuf *wb, int frame)
+{
+    int i, j;
+
+    wb_add(wb, "\033[H", 3);
+    for (i = 0; i < BENCH_ROWS; i++) {
+	for (j = 0; j < BENCH_COLS / 12; j++)
+	    wb_addf(wb, "\033[38;5;%dm\033[48;5;%dm %8.8s ",
+		    (frame + i + j) % 256, (i * 7 + j) % 16,
+		    "34.5 1:23");
+	wb_add(wb, "\033[0m\033[K\r\n", 9);
+    }
+}
+
+/*
+ * Truecolour editor theme: the same shape as the htop workload, but
+ * every run sets a 24-bit foreground and background the way modern
+ * vim colour schemes do, exercising the truecolour comparisons in
+ * the display diff.
+ */
+static void frame_truecolour(struct workbuf *wb, int frame)
+{
+    int i, j;
+
+    wb_add(wb, "\033[H", 3);
+    for (i = 0; i < BENCH_ROWS; i++) {
+	for (j = 0; j < BENCH_COLS / 12; j++)
+	    wb_addf(wb, "\033[38;2;%d;%d;%dm\033[48;2;%d;%d;%dm %8.8s ",
+		    (frame + i) % 256, (j * 37) % 256, (i * 11 + j) % 256,
+		    (i * 5) % 64, (j * 3) % 64, (frame * 7) % 64,
+		    "word(arg)");
+	wb_add(wb, "\033[0m\033[K\r\n", 9);
+    }
+}
+
+/*
+ * Alternate-screen flipping: what every invocation of a full-screen
+ * TUI costs on entry and exit - switch to the alternate screen with
+ * xterm's 1049 mode (which erases it), draw a modest dialog, and
+ * switch back.
+ */
+static void frame_altscreen(struct workbuf *wb, int frame)
+{
+    int i;
+
+    wb_add(wb, "\033[?1049h", 8);
+    for (i = 0; i < BENCH_ROWS / 4; i++)
+	wb_addf(wb, "\033[%d;10H\033[7m menu item %d of frame %d \033[0m",
+		4 + i, i, frame);
+    wb_add(wb, "\033[?1049l", 8);
+}
+
+/* Raw cursor-motion spam: absolute positioning, one glyph each. */
+static void frame_cup(struct workbuf *wb, int frame)
+{
+    int i;
+    unsigned r = frame * 2654435761u + 1;
+
+    for (i = 0; i < BENCH_ROWS * 4; i++) {
+	r = r * 1103515245 + 12345;
+	wb_addf(wb, "\033[%d;%dH*",
+		1 + (int)((r >> 16) % BENCH_ROWS),
+		1 + (int)((r >> 4) % BENCH_COLS));
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Driving the terminal.
+ */
+
+#define CHUNK 4096		       /* a plausible network read size */
+#define TARGET_BUFLEN (512*1024)
+
+struct term_job {
+    Terminal *term;
+    struct workbuf wb;
+    int nseq;			       /* escape sequences per buffer pass */
+};
+
+static void term_op(void *vctx, int iters)
+{
+    struct term_job *job = (struct term_job *)vctx;
+
+    while (iters-- > 0) {
+	int pos = 0;
+	while (pos < job->wb.len) {
+	    int n = job->wb.len - pos;
+	    if (n > CHUNK)
+		n = CHUNK;
+	    term_data(job->term, 0, job->wb.data + pos, n);
+	    pos += n;
+	    /*
+	     * Let the deferred scrollback compression run, as the
+	     * event loop would between network reads; otherwise the
+	     * pending queue grows without bound and we'd be
+	     * benchmarking an unrealistic state.
+	     */
+	    while (toplevel_callback_pending())
+		run_toplevel_callbacks();
+	}
+    }
+}
+
+static void bench_workload(Terminal *term, const char *name,
+			   void (*framefn)(struct workbuf *, int))
+{
+    struct term_job job;
+    double rate;
+    int i, frame = 0;
+    char label[64];
+
+    job.term = term;
+    job.wb.data = NULL;
+    job.wb.len = job.wb.size = 0;
+    while (job.wb.len < TARGET_BUFLEN)
+	framefn(&job.wb, frame++);
+
+    job.nseq = 0;
+    for (i = 0; i < job.wb.len; i++)
+	if (job.wb.data[i] == '\033')
+	    job.nseq++;
+
+    rate = bench_rate(term_op, &job);
+
+    sprintf(label, "term-%s", name);
+    report(label, rate * job.wb.len / 1e6, "MB/s");
+    if (job.nseq) {
+	sprintf(label, "term-%s", name);
+	report(label, 1e6 / (rate * job.nseq), "us/seq");
+    }
+
+    sfree(job.wb.data);
+}
+
+/*
+ * Full-screen repaint cost: invalidate the display state and repaint
+ * from the current screen contents, as an exposure would.
+ */
+static void paint_op(void *vctx, int iters)
+{
+    Terminal *term = (Terminal *)vctx;
+
+    while (iters-- > 0) {
+	term_invalidate(term);
+	term_update(term);
+    }
+}
+
+/*
+ * Search cost over a large scrollback: a needle that appears nowhere,
+ * so every held line must be screened. With the trigram signatures
+ * this should stay in the milliseconds even at 200k lines.
+ */
+static void search_op(void *vctx, int iters)
+{
+    Terminal *term = (Terminal *)vctx;
+    volatile int sink;
+
+    while (iters-- > 0)
+	sink = term_search(term, "zyxwqv", 0, FALSE);
+    (void)sink;
+}
+
+#define SEARCH_LINES 200000
+
+static void bench_search(Terminal *term)
+{
+    struct workbuf wb;
+    int frame = 0;
+    double rate;
+
+    term_size(term, BENCH_ROWS, BENCH_COLS, SEARCH_LINES);
+
+    wb.data = NULL;
+    wb.len = wb.size = 0;
+    while (wb.len < TARGET_BUFLEN)
+	frame_cat(&wb, frame++);
+
+    while (term->sbspill.count + term->scrollback.count +
+	   term->sbpending_count < SEARCH_LINES) {
+	int pos = 0;
+	while (pos < wb.len) {
+	    int n = wb.len - pos;
+	    if (n > CHUNK)
+		n = CHUNK;
+	    term_data(term, 0, wb.data + pos, n);
+	    pos += n;
+	    while (toplevel_callback_pending())
+		run_toplevel_callbacks();
+	}
+    }
+    sfree(wb.data);
+
+    rate = bench_rate(search_op, term);
+    report("term-search-200k", 1e3 / rate, "ms/search");
+}
+
+int main(int argc, char **argv)
+{
+    Terminal *term;
+    Conf *conf;
+    struct unicode_data ucsdata;
+
+    conf = conf_new();
+    do_defaults(NULL, conf);
+    conf_set_str(conf, CONF_line_codepage, "UTF-8");
+    init_ucs(&ucsdata, conf_get_str(conf, CONF_line_codepage),
+	     conf_get_int(conf, CONF_utf8_override),
+	     CS_UTF8, conf_get_int(conf, CONF_vtmode));
+
+    term = term_init(conf, &ucsdata, NULL);
+    term_size(term, BENCH_ROWS, BENCH_COLS, 1000);
+    term->ldisc = NULL;
+
+    bench_workload(term, "cat", frame_cat);
+    bench_workload(term, "cat-utf8", frame_cat_utf8);
+    bench_workload(term, "vim-scroll", frame_vim);
+    bench_workload(term, "htop-colour", frame_htop);
+    bench_workload(term, "vim-truecolour", frame_truecolour);
+    bench_workload(term, "alt-screen", frame_altscreen);
+    bench_workload(term, "cursor-motion", frame_cup);
+
+    report("term-paint-full", bench_rate(paint_op, term), "frames/sec");
+
+    bench_search(term);
+
+    term_free(term);
+    conf_free(conf);
+    return 0;
+}
+
+/* ----------------------------------------------------------------------
+ * Null frontend, as in fuzzterm.c.
+ */
+
+int from_backend(void *frontend, int is_stderr, const char *data, int len)
+{ return 0; }
+
+void request_resize(void *frontend, int x, int y) { }
+void do_text(Context ctx, int x, int y, wchar_t * text, int len,
+	     unsigned long attr, int lattr, truecolour tc) { }
+void do_cursor(Context ctx, int x, int y, wchar_t * text, int len,
+	     unsigned long attr, int lattr, truecolour tc) { }
+#ifdef OPTIMISE_SCROLL
+void do_scroll(Context ctx, int topline, int botline, int lines) { }
+#endif
+int char_width(Context ctx, int uc) { return 1; }
+void set_title(void *frontend, char *t) { }
+void set_icon(void *frontend, char *t) { }
+void set_sbar(void *frontend, int a, int b, int c) { }
+
+void ldisc_send(void *handle, const char *buf, int len, int interactive) {}
+int ldisc_sendbuffer(void *handle) { return 0; }
+void ldisc_echoedit_update(void *handle) {}
+Context get_ctx(void *frontend)
+{
+    static char x;
+
+    return &x;
+}
+void free_ctx(Context ctx) { }
+void palette_set(void *frontend, int a, int b, int c, int d) { }
+void palette_reset(void *frontend) { }
+int palette_get(void *frontend, int n, int *r, int *g, int *b) {return FALSE;}
+void write_clip(void *frontend, int clipboard,
+                wchar_t *a, int *b, truecolour *c, int d, int e) { }
+void set_raw_mouse_mode(void *frontend, int m) { }
+void frontend_request_paste(void *frontend, int clipboard) { }
+void do_beep(void *frontend, int a) { }
+void sys_cursor(void *frontend, int x, int y) { }
+void modalfatalbox(const char *fmt, ...)
+{
+    va_list ap;
+    fprintf(stderr, "FATAL ERROR: ");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(1);
+}
+void nonfatal(const char *fmt, ...) { }
+
+void set_iconic(void *frontend, int iconic) { }
+void move_window(void *frontend, int x, int y) { }
+void set_zorder(void *frontend, int top) { }
+void refresh_window(void *frontend) { }
+void set_zoomed(void *frontend, int zoomed) { }
+int is_iconic(void *frontend) { return 0; }
+void get_window_pos(void *frontend, int *x, int *y) { *x = 0; *y = 0; }
+void get_window_pixels(void *frontend, int *x, int *y) { *x = 0; *y = 0; }
+char *get_window_title(void *frontend, int icon) { return "termbench"; }
+int frontend_is_utf8(void *frontend) { return TRUE; }
+
+/* needed by timing.c */
+void timer_change_notify(unsigned long next) { }
+
+/* needed by config.c and sercfg.c */
+
+void dlg_radiobutton_set(union control *ctrl, void *dlg, int whichbutton) { }
+int dlg_radiobutton_get(union control *ctrl, void *dlg) { return 0; }
+void dlg_checkbox_set(union control *ctrl, void *dlg, int checked) { }
+int dlg_checkbox_get(union control *ctrl, void *dlg) { return 0; }
+void dlg_editbox_set(union control *ctrl, void *dlg, char const *text) { }
+char *dlg_editbox_get(union control *ctrl, void *dlg) { return dupstr("moo"); }
+void dlg_listbox_clear(union control *ctrl, void *dlg) { }
+void dlg_listbox_del(union control *ctrl, void *dlg, int index) { }
+void dlg_listbox_add(union control *ctrl, void *dlg, char const *text) { }
+void dlg_listbox_addwithid(union control *ctrl, void *dlg,
+			   char const *text, int id) { }
+int dlg_listbox_getid(union control *ctrl, void *dlg, int index) { return 0; }
+int dlg_listbox_index(union control *ctrl, void *dlg) { return -1; }
+int dlg_listbox_issel(union control *ctrl, void *dlg, int index) { return 0; }
+void dlg_listbox_select(union control *ctrl, void *dlg, int index) { }
+void dlg_text_set(union control *ctrl, void *dlg, char const *text) { }
+void dlg_filesel_set(union control *ctrl, void *dlg, Filename *fn) { }
+Filename *dlg_filesel_get(union control *ctrl, void *dlg) { return NULL; }
+void dlg_fontsel_set(union control *ctrl, void *dlg, FontSpec *fn) { }
+FontSpec *dlg_fontsel_get(union control *ctrl, void *dlg) { return NULL; }
+void dlg_update_start(union control *ctrl, void *dlg) { }
+void dlg_update_done(union control *ctrl, void *dlg) { }
+void dlg_set_focus(union control *ctrl, void *dlg) { }
+void dlg_label_change(union control *ctrl, void *dlg, char const *text) { }
+union control *dlg_last_focused(union control *ctrl, void *dlg) { return NULL; }
+void dlg_beep(void *dlg) { }
+void dlg_error_msg(void *dlg, const char *msg) { }
+void dlg_end(void *dlg, int value) { }
+void dlg_coloursel_start(union control *ctrl, void *dlg,
+			 int r, int g, int b) { }
+int dlg_coloursel_results(union control *ctrl, void *dlg,
+			  int *r, int *g, int *b) { return 0; }
+void dlg_refresh(union control *ctrl, void *dlg) { }
+
+/* miscellany */
+void logevent(void *frontend, const char *msg) { }
+int askappend(void *frontend, Filename *filename,
+	      void (*callback)(void *ctx, int result), void *ctx) { return 0; }
+
+const char *const appname = "termbench";
+const int ngsslibs = 0;
+const char *const gsslibnames[0] = { };
+const struct keyvalwhere gsslibkeywords[0] = { };
+
+/*
+ * Default settings that are specific to Unix plink.
+ */
+char *platform_default_s(const char *name)
+{
+    if (!strcmp(name, "TermType"))
+	return dupstr("xterm");
+    if (!strcmp(name, "SerialLine"))
+	return dupstr("/dev/ttyS0");
+    return NULL;
+}
+
+int platform_default_i(const char *name, int def)
+{
+    return def;
+}
+
+FontSpec *platform_default_fontspec(const char *name)
+{
+    return fontspec_new("");
+}
+
+Filename *platform_default_filename(const char *name)
+{
+    if (!strcmp(name, "LogFileName"))
+	return filename_from_str("putty.log");
+    else
+	return filename_from_str("");
+}
+
+char *x_get_default(const char *key)
+{
+    return NULL;		       /* this is a stub */
+}
@@ -52,6 +52,7 @@
 #define TBLINK_DELAY    ((TICKSPERSEC*9+19)/20)/* ticks between text blinks*/
 #define CBLINK_DELAY    (CURSORBLINK) /* ticks between cursor blinks */
 #define VBELL_DELAY     (VBELL_TIMEOUT) /* visual bell timeout in ticks */
+#define IDLE_COMPACT_DELAY (TICKSPERSEC*300) /* idle ticks before compaction */
 
 #define compatibility(x) \
     if ( ((CL_##x)&term->compatibility_level) == 0 ) { 	\
@@ -102,12 +103,18 @@ static void unlineptr(termline *);
 static void check_line_size(Terminal *, termline *);
 static void do_paint(Terminal *, Context, int);
 static void erase_lots(Terminal *, int, int, int);
+#ifdef INPUT_LATENCY_TRACE
+static void term_latency_report(Terminal *);
+static void term_latency_sample(Terminal *);
+#endif
 static int find_last_nonempty_line(Terminal *, tree234 *);
 static void swap_screen(Terminal *, int, int, int);
 static void update_sbar(Terminal *);
 static void deselect(Terminal *);
 static void term_print_finish(Terminal *);
 static void scroll(Terminal *, int, int, int, int);
+static unsigned char *compressline(Terminal *, termline *, int *lenp);
+static termline *decompressline(unsigned char *data, int *bytes_used);
 static void parse_optionalrgb(optionalrgb *out, unsigned *values);
 #ifdef OPTIMISE_SCROLL
 static void scroll_display(Terminal *, int, int, int);
@@ -126,6 +133,9 @@ static termline *newline(Terminal *term, int cols, int bce)
     line->lattr = LATTR_NORM;
     line->temporary = FALSE;
     line->cc_free = 0;
+    line->urls = NULL;
+    line->nurls = 0;
+    line->url_dirty = TRUE;
 
     return line;
 }
@@ -133,6 +143,7 @@ static termline *newline(Terminal *term, int cols, int bce)
 static void freeline(termline *line)
 {
     if (line) {
+	sfree(line->urls);
 	sfree(line->chars);
 	sfree(line);
     }
@@ -275,6 +286,18 @@ static void clear_cc(termline *line, int col)
 #endif
 }
 
+/*
+ * Compare two truecolour fields for equality. The truecolour_equal
+ * macro in putty.h compares the eight fields one at a time; here in
+ * the display diff loops that comparison runs once per cell, so we
+ * rely on the structure being eight padding-free unsigned chars and
+ * let the compiler turn the memcmp into a single word compare.
+ */
+static int truecolours_equal(truecolour a, truecolour b)
+{
+    return !memcmp(&a, &b, sizeof(truecolour));
+}
+
 /*
  * Compare two character cells for equality. Special case required
  * in do_paint() where we override what we expect the chr and attr
@@ -284,11 +307,15 @@ static int termchars_equal_override(termchar *a, termchar *b,
 				    unsigned long bchr, unsigned long battr)
 {
     /* FULL-TERMCHAR */
-    if (!truecolour_equal(a->truecolour, b->truecolour))
-	return FALSE;
-    if (a->chr != bchr)
+    /*
+     * Fold the chr test and the masked attr test into a single
+     * XOR-merged compare, so that the overwhelmingly common case of
+     * an unchanged cell takes one branch here plus the word-sized
+     * truecolour compare below, rather than three separate tests.
+     */
+    if ((a->chr ^ bchr) | ((a->attr ^ battr) & ~(unsigned long)DATTR_MASK))
 	return FALSE;
-    if ((a->attr &~ DATTR_MASK) != (battr &~ DATTR_MASK))
+    if (!truecolours_equal(a->truecolour, b->truecolour))
 	return FALSE;
     while (a->cc_next || b->cc_next) {
 	if (!a->cc_next || !b->cc_next)
@@ -373,9 +400,883 @@ static int get(struct buf *b)
 {
     return b->data[b->len++];
 }
+
+/*
+ * Arena allocator for compressed scrollback lines. Once stored, a
+ * compressed line is never modified, and lines are discarded in bulk
+ * (oldest-first as the scrollback fills up, or all at once when it's
+ * cleared), so instead of a malloc per line we carve lines out of a
+ * chain of fixed-size blocks hung off the Terminal. Each allocation
+ * is prefixed with a pointer back to its block; a block keeps a count
+ * of lines not yet evicted and is freed wholesale when that count
+ * reaches zero. Scrolling a whole screenful therefore costs at most
+ * one block allocation rather than one allocator round trip per line.
+ */
+#define SBARENA_BLKSIZE 16384
+#define SBARENA_HDR sizeof(struct sbarena_block *)
+
+struct sbarena_block {
+    struct sbarena_block *next, *prev;
+    int size;			       /* usable bytes in data[] */
+    int used;			       /* bytes allocated from data[] */
+    int live;			       /* lines not yet evicted */
+    unsigned char data[1];	       /* 'size' bytes in reality */
+};
+
+static unsigned char *sballoc(Terminal *term, const unsigned char *data,
+			      int len)
+{
+    struct sbarena_block *blk = term->sb_arena;
+    int size = SBARENA_HDR + len;
+    unsigned char *p;
+
+    /* Keep each line's block back-pointer at a pointer-aligned offset. */
+    size = (size + SBARENA_HDR - 1) & ~(int)(SBARENA_HDR - 1);
+
+    if (!blk || blk->used + size > blk->size) {
+	/* Oversized lines get a block to themselves. */
+	int blksize = size > SBARENA_BLKSIZE ? size : SBARENA_BLKSIZE;
+	if (blk && blk->live == 0) {
+	    /* The current block is empty but too small; replace it. */
+	    term->sb_arena = blk->next;
+	    if (blk->next)
+		blk->next->prev = NULL;
+	    sfree(blk);
+	}
+	blk = (struct sbarena_block *)
+	    smalloc(offsetof(struct sbarena_block, data) + blksize);
+	blk->next = term->sb_arena;
+	blk->prev = NULL;
+	if (blk->next)
+	    blk->next->prev = blk;
+	blk->size = blksize;
+	blk->used = 0;
+	blk->live = 0;
+	term->sb_arena = blk;
+    }
+
+    p = blk->data + blk->used;
+    memcpy(p, &blk, SBARENA_HDR);
+    memcpy(p + SBARENA_HDR, data, len);
+    blk->used += size;
+    blk->live++;
+    return p + SBARENA_HDR;
+}
+
+static void sbfree(Terminal *term, unsigned char *cline)
+{
+    struct sbarena_block *blk;
+
+    if (!cline)
+	return;
+    memcpy(&blk, cline - SBARENA_HDR, SBARENA_HDR);
+    assert(blk->live > 0);
+    if (--blk->live == 0) {
+	if (blk == term->sb_arena) {
+	    /* Still the block we're allocating from; just rewind it. */
+	    blk->used = 0;
+	} else {
+	    if (blk->prev)
+		blk->prev->next = blk->next;
+	    if (blk->next)
+		blk->next->prev = blk->prev;
+	    sfree(blk);
+	}
+    }
+}
+
+/*
+ * Scrollback search index. Alongside each compressed line we keep a
+ * word-sized trigram signature of its lowercased text: every three
+ * consecutive non-blank character cells set one bit, derived from a
+ * hash of the trigram. term_search() computes the same signature for
+ * the needle, and can then reject most scrollback lines on a single
+ * AND instead of decompressing them, which is what keeps searching a
+ * deep scrollback interactive. A line whose signature lacks any of
+ * the needle's bits cannot contain the needle; the reverse isn't
+ * true, so surviving lines are decompressed and searched exactly.
+ */
+#define TSEARCH_SIGBITS (8 * sizeof(unsigned long))
+
+struct sigstate {
+    unsigned long sig;
+    unsigned a, b;		       /* previous two characters, or 0 */
+};
+
+/*
+ * Reduce a character cell to the lowercased text character used for
+ * both searching and signature-building. Cells holding ASCII in a
+ * non-Unicode character set are unwrapped to the underlying byte;
+ * controls and other non-text cells all become a plain space.
+ */
+static unsigned termsearch_norm(unsigned long c)
+{
+    if (DIRECT_CHAR(c) || DIRECT_FONT(c))
+	c &= 0xFF;
+    if (c >= 'A' && c <= 'Z')
+	c += 'a' - 'A';
+    if (c < 0x20 || c > 0x10FFFFUL)
+	c = ' ';
+    return (unsigned)c;
+}
+
+static void termsearch_feed(struct sigstate *st, unsigned c)
+{
+    if (c <= ' ') {
+	/* Blanks break trigrams; this keeps the padding at the end
+	 * of every line from setting the same bits in every
+	 * signature and destroying their selectivity. */
+	st->a = st->b = 0;
+	return;
+    }
+    if (st->a) {
+	unsigned h = (st->a * 131u + st->b) * 131u + c;
+	st->sig |= 1UL << (h % TSEARCH_SIGBITS);
+    }
+    st->a = st->b;
+    st->b = c;
+}
+
+static unsigned long termsearch_sig(termline *line)
+{
+    struct sigstate st;
+    int i;
+
+    st.sig = 0;
+    st.a = st.b = 0;
+    for (i = 0; i < line->cols; i++)
+	termsearch_feed(&st, termsearch_norm(line->chars[i].chr));
+    return st.sig;
+}
+
+/*
+ * The scrollback store itself: a power-of-two-sized circular array of
+ * pointers to compressed lines. The scrollback is only ever appended
+ * to at the new end and evicted from either end, so a ring gives us
+ * O(1) for every operation where a tree234 cost O(log n) plus a node
+ * allocation per line. (The alt-screen save area stays in a tree234,
+ * since that holds live termlines and needs mid-sequence insertion.)
+ */
+static void sbring_init(struct scrollback_ring *ring)
+{
+    ring->lines = NULL;
+    ring->sigs = NULL;
+    ring->lens = NULL;
+    ring->head = ring->count = ring->size = 0;
+    ring->bytes = 0;
+}
+
+static unsigned char *sbring_index(Terminal *term, int index)
+{
+    if (index < 0 || index >= term->scrollback.count)
+	return NULL;
+    return term->scrollback.lines[(term->scrollback.head + index) &
+				  (term->scrollback.size - 1)];
+}
+
+static void sbring_push(Terminal *term, unsigned char *cline, int len,
+			unsigned long sig)
+{
+    struct scrollback_ring *ring = &term->scrollback;
+    int idx;
+
+    if (ring->count == ring->size) {
+	int newsize = ring->size ? ring->size * 2 : 1024;
+	unsigned char **newlines = snewn(newsize, unsigned char *);
+	unsigned long *newsigs = snewn(newsize, unsigned long);
+	int *newlens = snewn(newsize, int);
+	int i;
+	for (i = 0; i < ring->count; i++) {
+	    int oldidx = (ring->head + i) & (ring->size - 1);
+	    newlines[i] = ring->lines[oldidx];
+	    newsigs[i] = ring->sigs[oldidx];
+	    newlens[i] = ring->lens[oldidx];
+	}
+	sfree(ring->lines);
+	sfree(ring->sigs);
+	sfree(ring->lens);
+	ring->lines = newlines;
+	ring->sigs = newsigs;
+	ring->lens = newlens;
+	ring->size = newsize;
+	ring->head = 0;
+    }
+    idx = (ring->head + ring->count++) & (ring->size - 1);
+    ring->lines[idx] = cline;
+    ring->sigs[idx] = sig;
+    ring->lens[idx] = len;
+    ring->bytes += len;
+}
+
+static unsigned char *sbring_pop_oldest(Terminal *term)
+{
+    struct scrollback_ring *ring = &term->scrollback;
+    unsigned char *cline;
+
+    if (ring->count == 0)
+	return NULL;
+    cline = ring->lines[ring->head];
+    ring->bytes -= ring->lens[ring->head];
+    ring->head = (ring->head + 1) & (ring->size - 1);
+    ring->count--;
+    return cline;
+}
+
+static unsigned char *sbring_pop_newest(Terminal *term)
+{
+    struct scrollback_ring *ring = &term->scrollback;
+    int idx;
+
+    if (ring->count == 0)
+	return NULL;
+    idx = (ring->head + --ring->count) & (ring->size - 1);
+    ring->bytes -= ring->lens[idx];
+    return ring->lines[idx];
+}
+
+/*
+ * The on-disk spill tier below the heap ring. Once the ring holds
+ * more than SB_SPILL_HEAP_BYTES of compressed data, its oldest lines
+ * are copied into an anonymous memory-mapped file (sbfile_new() et
+ * al) and evicted from the heap; only a per-line offset and search
+ * signature remain in memory, a couple of dozen bytes per line
+ * instead of a compressed line each. lineptr() decompresses straight
+ * out of the mapping, so a deep scrollback costs page cache rather
+ * than resident heap and CONF_savelines can be set enormous without
+ * multi-gigabyte processes. If the file can't be created or grown
+ * (no usable temp directory, disk full), the spill marks itself
+ * broken and everything stays in the heap as before.
+ *
+ * Within the mapping, line data is appended at 'end' and the oldest
+ * lines are dropped by advancing 'start'; when the dead prefix grows
+ * to half the file, the live region is slid back to the front rather
+ * than letting the file grow without bound.
+ */
+#define SB_SPILL_HEAP_BYTES (4*1024*1024)
+#define SB_SPILL_MINMAP (256*1024)
+
+static void sbspill_init(struct scrollback_spill *sp)
+{
+    sp->file = NULL;
+    sp->data = NULL;
+    sp->mapsize = 0;
+    sp->start = sp->end = 0;
+    sp->offsets = NULL;
+    sp->sigs = NULL;
+    sp->head = sp->count = sp->size = 0;
+    sp->broken = FALSE;
+}
+
+static unsigned char *sbspill_line(Terminal *term, int index)
+{
+    struct scrollback_spill *sp = &term->sbspill;
+
+    if (index < 0 || index >= sp->count)
+	return NULL;
+    return sp->data + sp->offsets[(sp->head + index) & (sp->size - 1)];
+}
+
+static int sbspill_append(Terminal *term, const unsigned char *data, int len,
+			  unsigned long sig)
+{
+    struct scrollback_spill *sp = &term->sbspill;
+    int idx;
+
+    if (sp->broken)
+	return FALSE;
+    if (!sp->file) {
+	sp->file = sbfile_new();
+	if (!sp->file) {
+	    sp->broken = TRUE;
+	    return FALSE;
+	}
+    }
+
+    /* Compact the dead prefix away once it dominates the mapping. */
+    if (sp->start > 0 && sp->start >= sp->mapsize / 2) {
+	int i;
+	memmove(sp->data, sp->data + sp->start, sp->end - sp->start);
+	for (i = 0; i < sp->count; i++)
+	    sp->offsets[(sp->head + i) & (sp->size - 1)] -= sp->start;
+	sp->end -= sp->start;
+	sp->start = 0;
+    }
+
+    if (sp->end + len > sp->mapsize) {
+	size_t newsize = sp->mapsize ? sp->mapsize * 2 : SB_SPILL_MINMAP;
+	unsigned char *map;
+	while (sp->end + len > newsize)
+	    newsize *= 2;
+	map = sbfile_map(sp->file, newsize);
+	if (!map) {
+	    sp->broken = TRUE;
+	    return FALSE;
+	}
+	sp->data = map;
+	sp->mapsize = newsize;
+    }
+
+    if (sp->count == sp->size) {
+	int newsize = sp->size ? sp->size * 2 : 1024;
+	size_t *newoffsets = snewn(newsize, size_t);
+	unsigned long *newsigs = snewn(newsize, unsigned long);
+	int i;
+	for (i = 0; i < sp->count; i++) {
+	    int oldidx = (sp->head + i) & (sp->size - 1);
+	    newoffsets[i] = sp->offsets[oldidx];
+	    newsigs[i] = sp->sigs[oldidx];
+	}
+	sfree(sp->offsets);
+	sfree(sp->sigs);
+	sp->offsets = newoffsets;
+	sp->sigs = newsigs;
+	sp->size = newsize;
+	sp->head = 0;
+    }
+    idx = (sp->head + sp->count++) & (sp->size - 1);
+    sp->offsets[idx] = sp->end;
+    sp->sigs[idx] = sig;
+    memcpy(sp->data + sp->end, data, len);
+    sp->end += len;
+    return TRUE;
+}
+
+static void sbspill_pop_oldest(Terminal *term)
+{
+    struct scrollback_spill *sp = &term->sbspill;
+
+    assert(sp->count > 0);
+    sp->head = (sp->head + 1) & (sp->size - 1);
+    if (--sp->count > 0)
+	sp->start = sp->offsets[sp->head];
+    else
+	sp->start = sp->end = 0;
+}
+
+static void sbspill_pop_newest(Terminal *term)
+{
+    struct scrollback_spill *sp = &term->sbspill;
+    int idx;
+
+    assert(sp->count > 0);
+    idx = (sp->head + --sp->count) & (sp->size - 1);
+    sp->end = sp->offsets[idx];
+    if (sp->count == 0)
+	sp->start = sp->end = 0;
+}
+
+static void sbspill_clear(Terminal *term)
+{
+    struct scrollback_spill *sp = &term->sbspill;
+
+    if (sp->file)
+	sbfile_free(sp->file);
+    sfree(sp->offsets);
+    sfree(sp->sigs);
+    sbspill_init(sp);
+}
+
+/*
+ * Move the oldest ring lines out to the spill file until the ring is
+ * back inside its heap budget. The compressed length of each ring
+ * line was recorded at push time, so this is a straight copy with no
+ * re-parsing; if a spill fails, the line simply stays in the heap.
+ */
+static void sbspill_trim(Terminal *term)
+{
+    struct scrollback_ring *ring = &term->scrollback;
+
+    while (!term->sbspill.broken && ring->bytes > SB_SPILL_HEAP_BYTES &&
+	   ring->count > 0) {
+	unsigned char *cline = ring->lines[ring->head];
+	if (!sbspill_append(term, cline, ring->lens[ring->head],
+			    ring->sigs[ring->head]))
+	    break;
+	sbfree(term, sbring_pop_oldest(term));
+    }
+}
+
+/*
+ * Session snapshots: if the user has configured a snapshot file,
+ * term_free() serialises the scrollback to it and term_init() reads
+ * it back, so that closing a window doesn't lose the history.
+ *
+ * The file is a 24-byte header (magic, format version, signature
+ * width, scrollback and screen line counts), then every line oldest
+ * first as a 32-bit length, a 64-bit search signature and the
+ * line's bytes in exactly the compressed form compressline()
+ * produced - lines already
+ * compressed in the ring or the spill tier are streamed out as-is,
+ * so saving a six-figure scrollback is one sequential pass with no
+ * recompression. A 32-bit checksum trailer lets the restore side
+ * reject truncated or corrupted files before any of their contents
+ * reach decompressline(), which trusts its input. All integers are
+ * little-endian.
+ */
+#define SNAP_VERSION 1
+#define SNAP_HDRSIZE 24
+#define SNAP_MAX_LINELEN 0x100000
+static const char snap_magic[8] = "PuTTYsnp";
+
+static void snap_write(FILE *fp, unsigned long *sum, const void *data,
+		       size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i;
+    for (i = 0; i < len; i++)
+	*sum = *sum * 33 + p[i];
+    fwrite(data, 1, len, fp);
+}
+
+static void snap_write_u32(FILE *fp, unsigned long *sum, unsigned long n)
+{
+    unsigned char buf[4];
+    buf[0] = (unsigned char)(n);
+    buf[1] = (unsigned char)(n >> 8);
+    buf[2] = (unsigned char)(n >> 16);
+    buf[3] = (unsigned char)(n >> 24);
+    snap_write(fp, sum, buf, 4);
+}
+
+static void snap_write_u64(FILE *fp, unsigned long *sum, unsigned long n)
+{
+    snap_write_u32(fp, sum, n & 0xFFFFFFFFUL);
+    snap_write_u32(fp, sum, sizeof(n) > 4 ? n >> 16 >> 16 : 0);
+}
+
+static unsigned long snap_read_u32(const unsigned char *p)
+{
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+	((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static unsigned long snap_read_u64(const unsigned char *p)
+{
+    unsigned long n = snap_read_u32(p);
+    if (sizeof(n) > 4)
+	n |= snap_read_u32(p + 4) << 16 << 16;
+    return n;
+}
+
+static void term_save_snapshot(Terminal *term)
+{
+    Filename *fn = conf_get_filename(term->conf, CONF_scrollback_snapshot);
+    FILE *fp;
+    unsigned long sum = 5381, dummy = 0;
+    int i, nsb, nscreen;
+
+    if (!fn || filename_is_null(fn))
+	return;
+    fp = f_open(fn, "wb", TRUE);
+    if (!fp)
+	return;
+
+    nsb = term->sbspill.count + term->scrollback.count +
+	term->sbpending_count;
+    nscreen = term->screen ? find_last_nonempty_line(term, term->screen) + 1
+	: 0;
+
+    snap_write(fp, &dummy, snap_magic, 8);
+    snap_write_u32(fp, &dummy, SNAP_VERSION);
+    snap_write_u32(fp, &dummy, TSEARCH_SIGBITS);
+    snap_write_u32(fp, &dummy, nsb);
+    snap_write_u32(fp, &dummy, nscreen);
+
+    for (i = 0; i < term->sbspill.count; i++) {
+	struct scrollback_spill *sp = &term->sbspill;
+	size_t off = sp->offsets[(sp->head + i) & (sp->size - 1)];
+	size_t next = (i + 1 < sp->count ?
+		       sp->offsets[(sp->head + i + 1) & (sp->size - 1)] :
+		       sp->end);
+	snap_write_u32(fp, &sum, next - off);
+	snap_write_u64(fp, &sum, sp->sigs[(sp->head + i) & (sp->size - 1)]);
+	snap_write(fp, &sum, sp->data + off, next - off);
+    }
+    for (i = 0; i < term->scrollback.count; i++) {
+	struct scrollback_ring *ring = &term->scrollback;
+	int idx = (ring->head + i) & (ring->size - 1);
+	snap_write_u32(fp, &sum, ring->lens[idx]);
+	snap_write_u64(fp, &sum, ring->sigs[idx]);
+	snap_write(fp, &sum, ring->lines[idx], ring->lens[idx]);
+    }
+    for (i = 0; i < term->sbpending_count; i++) {
+	termline *line = term->sbpending[term->sbpending_head + i];
+	int clen;
+	unsigned char *cline = compressline(term, line, &clen);
+	snap_write_u32(fp, &sum, clen);
+	snap_write_u64(fp, &sum, termsearch_sig(line));
+	snap_write(fp, &sum, cline, clen);
+	sbfree(term, cline);
+    }
+    for (i = 0; i < nscreen; i++) {
+	termline *line = index234(term->screen, i);
+	int clen;
+	unsigned char *cline;
+	if (!line)
+	    break;
+	cline = compressline(term, line, &clen);
+	snap_write_u32(fp, &sum, clen);
+	snap_write_u64(fp, &sum, termsearch_sig(line));
+	snap_write(fp, &sum, cline, clen);
+	sbfree(term, cline);
+    }
+
+    snap_write_u32(fp, &dummy, sum);
+    fclose(fp);
+}
+
+static void term_restore_snapshot(Terminal *term)
+{
+    Filename *fn = conf_get_filename(term->conf, CONF_scrollback_snapshot);
+    FILE *fp;
+    unsigned char *data;
+    long size;
+    unsigned long sum = 5381, total, sigbits;
+    size_t pos;
+    int i, skip, savelines;
+
+    if (!fn || filename_is_null(fn))
+	return;
+    fp = f_open(fn, "rb", FALSE);
+    if (!fp)
+	return;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    if (size < SNAP_HDRSIZE + 4) {
+	fclose(fp);
+	return;
+    }
+    data = snewn(size, unsigned char);
+    if (fread(data, 1, size, fp) != (size_t)size) {
+	sfree(data);
+	fclose(fp);
+	return;
+    }
+    fclose(fp);
+
+    if (memcmp(data, snap_magic, 8) != 0 ||
+	snap_read_u32(data + 8) != SNAP_VERSION) {
+	sfree(data);
+	return;
+    }
+    sigbits = snap_read_u32(data + 12);
+    total = snap_read_u32(data + 16) + snap_read_u32(data + 20);
+
+    /*
+     * Structural pass: check the line framing covers exactly the
+     * space between header and trailer, and the checksum matches,
+     * before any of this data is believed.
+     */
+    for (i = 0, pos = SNAP_HDRSIZE; i < total; i++) {
+	unsigned long len;
+	if (pos + 12 > (size_t)size - 4)
+	    break;
+	len = snap_read_u32(data + pos);
+	if (len == 0 || len > SNAP_MAX_LINELEN ||
+	    pos + 12 + len > (size_t)size - 4)
+	    break;
+	pos += 12 + len;
+    }
+    if (i < total || pos != (size_t)size - 4) {
+	sfree(data);
+	return;
+    }
+    for (pos = SNAP_HDRSIZE; pos < (size_t)size - 4; pos++)
+	sum = sum * 33 + data[pos];
+    if ((sum & 0xFFFFFFFFUL) != snap_read_u32(data + size - 4)) {
+	sfree(data);
+	return;
+    }
+
+    /*
+     * Now push the lines into the (empty) scrollback ring, newest
+     * `savelines' of them; anything the ring can't afford to keep in
+     * the heap will be spilled back out to disk by sbspill_trim().
+     */
+    savelines = conf_get_int(term->conf, CONF_savelines);
+    skip = total > (unsigned long)savelines ? total - savelines : 0;
+    for (i = 0, pos = SNAP_HDRSIZE; i < total; i++) {
+	unsigned long len = snap_read_u32(data + pos);
+	unsigned long sig = snap_read_u64(data + pos + 4);
+	if (i >= skip) {
+	    if (sigbits != TSEARCH_SIGBITS) {
+		/*
+		 * Snapshot from a build with a different signature
+		 * width (e.g. moved between 32- and 64-bit builds):
+		 * the stored signatures are useless, so recompute
+		 * them, which costs one decompression per line.
+		 */
+		termline *line = decompressline(data + pos + 12, NULL);
+		sig = termsearch_sig(line);
+		freeline(line);
+	    }
+	    sbring_push(term, sballoc(term, data + pos + 12, len), len, sig);
+	}
+	pos += 12 + len;
+    }
+    sbspill_trim(term);
+    sfree(data);
+}
+
+/*
+ * Deferred scrollback compression. Lines evicted off the top of the
+ * screen during fast output are parked on a pending queue and
+ * compressed from a toplevel callback, so compressline() stays off
+ * the network-to-screen path. The queue is drained in bounded slices
+ * so the callback itself can't cause a latency spike; readers
+ * (lineptr) treat pending lines as the newest part of the
+ * scrollback. Compressed-out line objects are recycled through a
+ * small free list so scroll() doesn't have to allocate a fresh
+ * bottom line per eviction.
+ */
+#define SBCOMPRESS_PER_CALLBACK 64
+#define SB_FREELINE_MAX 64
+
+static void sbpending_push(Terminal *term, termline *line)
+{
+    if (term->sbpending_head + term->sbpending_count >=
+	term->sbpending_size) {
+	if (term->sbpending_head > 0) {
+	    memmove(term->sbpending,
+		    term->sbpending + term->sbpending_head,
+		    term->sbpending_count * sizeof(termline *));
+	    term->sbpending_head = 0;
+	}
+	if (term->sbpending_count >= term->sbpending_size) {
+	    term->sbpending_size = term->sbpending_count * 3 / 2 + 32;
+	    term->sbpending = sresize(term->sbpending, term->sbpending_size,
+				      termline *);
+	}
+    }
+    term->sbpending[term->sbpending_head + term->sbpending_count++] = line;
+}
+
+static termline *sbpending_pop_oldest(Terminal *term)
+{
+    if (term->sbpending_count == 0)
+	return NULL;
+    term->sbpending_count--;
+    return term->sbpending[term->sbpending_head++];
+}
+
+static termline *sbpending_pop_newest(Terminal *term)
+{
+    if (term->sbpending_count == 0)
+	return NULL;
+    return term->sbpending[term->sbpending_head + --term->sbpending_count];
+}
+
+static void sbfreeline_put(Terminal *term, termline *line)
+{
+    if (term->sbfreelines_count >= SB_FREELINE_MAX) {
+	freeline(line);
+	return;
+    }
+    if (term->sbfreelines_count >= term->sbfreelines_size) {
+	term->sbfreelines_size = term->sbfreelines_count * 3 / 2 + 8;
+	term->sbfreelines = sresize(term->sbfreelines,
+				    term->sbfreelines_size, termline *);
+    }
+    term->sbfreelines[term->sbfreelines_count++] = line;
+}
+
+static void sbcompress_callback(void *ctx)
+{
+    Terminal *term = (Terminal *)ctx;
+    termline *line;
+    int n = 0;
+
+    term->sbcompress_scheduled = FALSE;
+    while (term->sbpending_count > 0 && n++ < SBCOMPRESS_PER_CALLBACK) {
+	int clen;
+	unsigned char *cline;
+	line = sbpending_pop_oldest(term);
+	cline = compressline(term, line, &clen);
+	sbring_push(term, cline, clen, termsearch_sig(line));
+	sbfreeline_put(term, line);
+    }
+    sbspill_trim(term);
+    if (term->sbpending_count > 0 && !term->sbcompress_scheduled) {
+	term->sbcompress_scheduled = TRUE;
+	queue_bulk_callback(sbcompress_callback, term);
+    }
+}
+
+/*
+ * Clickable-URL detection. Rather than pattern-matching the whole
+ * screen on every repaint, detection runs incrementally: every line
+ * the emulator is about to modify gets flagged (in scrlineptr() and
+ * resizeline()), and a bulk callback re-scans just the flagged lines,
+ * storing the resulting column ranges on the termline itself. A
+ * hover or click is then answered by term_url_at() from the stored
+ * ranges, at most re-scanning the one line it lands on, and
+ * do_paint() is not involved at all.
+ */
+#define URLSCAN_PER_CALLBACK 64
+
+static const char *const urlscan_schemes[] = {
+    "https://", "http://", "ftp://"
+};
+
+/*
+ * The characters accepted as part of a URL once a scheme has
+ * matched: RFC 3986's unreserved, reserved and percent characters.
+ */
+static int urlscan_is_urlchar(unsigned c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+	(c >= '0' && c <= '9'))
+	return TRUE;
+    return c >= 0x21 && c < 0x7F &&
+	strchr("-._~:/?#[]@!$&'()*+,;=%", (char)c) != NULL;
+}
+
+/*
+ * Reduce a character cell to the ASCII character used for URL
+ * matching, or 0 for anything that can't be part of a URL. Unlike
+ * the search normalisation above, case is preserved, since URL paths
+ * are case-significant.
+ */
+static unsigned urlscan_char(unsigned long c)
+{
+    if (DIRECT_CHAR(c) || DIRECT_FONT(c))
+	c &= 0xFF;
+    return c < 0x80 ? (unsigned)c : 0;
+}
+
+static void urlscan_line(termline *line)
+{
+    int i;
+
+    line->nurls = 0;
+    line->url_dirty = FALSE;
+
+    for (i = 0; i < line->cols; i++) {
+	unsigned c0 = urlscan_char(line->chars[i].chr);
+	int s, j, k;
+
+	/*
+	 * Every scheme we know starts with 'h' or 'f', which is rare
+	 * enough in ordinary output to reject nearly every cell here
+	 * and keep the full scan off the hot path.
+	 */
+	if (c0 != 'h' && c0 != 'H' && c0 != 'f' && c0 != 'F')
+	    continue;
+
+	for (s = 0; s < (int)lenof(urlscan_schemes); s++) {
+	    const char *scheme = urlscan_schemes[s];
+	    for (j = 0; scheme[j]; j++) {
+		unsigned c = i + j < line->cols ?
+		    urlscan_char(line->chars[i + j].chr) : 0;
+		if (c >= 'A' && c <= 'Z')
+		    c += 'a' - 'A';
+		if (c != (unsigned char)scheme[j])
+		    break;
+	    }
+	    if (!scheme[j])
+		break;
+	}
+	if (s == (int)lenof(urlscan_schemes))
+	    continue;
+
+	j = i + strlen(urlscan_schemes[s]);
+	k = j;
+	while (k < line->cols &&
+	       urlscan_is_urlchar(urlscan_char(line->chars[k].chr)))
+	    k++;
+
+	/*
+	 * Trim trailing punctuation: a URL at the end of a sentence
+	 * doesn't usually include its full stop. A trailing ')' is
+	 * kept if it closes a '(' inside the URL, as in the
+	 * parenthesised section links wikis generate.
+	 */
+	while (k > j) {
+	    unsigned c = urlscan_char(line->chars[k - 1].chr);
+	    if (c == ')') {
+		int depth = 0, m;
+		for (m = i; m < k - 1; m++) {
+		    unsigned cm = urlscan_char(line->chars[m].chr);
+		    if (cm == '(')
+			depth++;
+		    else if (cm == ')' && depth > 0)
+			depth--;
+		}
+		if (depth > 0)
+		    break;
+	    } else if (!strchr(".,;:!?'", (char)c))
+		break;
+	    k--;
+	}
+
+	if (k > j) {		       /* insist on something after the scheme */
+	    line->urls = sresize(line->urls, line->nurls + 1, struct urlrange);
+	    line->urls[line->nurls].start = i;
+	    line->urls[line->nurls].end = k;
+	    line->nurls++;
+	}
+	i = k - 1;		       /* loop increment advances past the URL */
+    }
+}
+
+static void urlscan_callback(void *ctx)
+{
+    Terminal *term = (Terminal *)ctx;
+    int i, n = 0, more = FALSE;
+
+    term->urlscan_scheduled = FALSE;
+    for (i = 0; i < term->rows; i++) {
+	termline *line = index234(term->screen, i);
+	if (line && line->url_dirty) {
+	    if (n >= URLSCAN_PER_CALLBACK) {
+		more = TRUE;
+		break;
+	    }
+	    urlscan_line(line);
+	    n++;
+	}
+    }
+    if (more && !term->urlscan_scheduled) {
+	term->urlscan_scheduled = TRUE;
+	queue_bulk_callback(urlscan_callback, term);
+    }
+}
+
+static void term_schedule_urlscan(Terminal *term)
+{
+    if (!term->urlscan_scheduled) {
+	term->urlscan_scheduled = TRUE;
+	queue_bulk_callback(urlscan_callback, term);
+    }
+}
+
+/*
+ * Cheap per-field equality tests used to extend runs in makerle()
+ * without re-invoking the literal encoder for every candidate cell.
+ * These are valid because, within an established run, each encoding
+ * is a pure function of the field value (the chr encoding's state is
+ * idempotent across repeated identical characters), so field equality
+ * implies encoded-byte equality. The cc fragment has no such
+ * predicate and keeps the encode-and-compare path.
+ */
+static int runeq_chr(const termchar *a, const termchar *b)
+{
+    return a->chr == b->chr;
+}
+static int runeq_attr(const termchar *a, const termchar *b)
+{
+    return a->attr == b->attr;
+}
+static int runeq_truecolour(const termchar *a, const termchar *b)
+{
+    return truecolours_equal(a->truecolour, b->truecolour);
+}
+
 static void makerle(struct buf *b, termline *ldata,
 		    void (*makeliteral)(struct buf *b, termchar *c,
-					unsigned long *state))
+					unsigned long *state),
+		    int (*runeq)(const termchar *a, const termchar *b))
 {
     int hdrpos, hdrsize, n, prevlen, prevpos, thislen, thispos, prev2;
     termchar *c = ldata->chars;
@@ -441,16 +1342,29 @@ static void makerle(struct buf *b, termline *ldata,
 		runlen = prev2 ? 3 : 2;
 
 		while (n > 0 && runlen < 129) {
-		    int tmppos, tmplen;
-		    tmppos = b->len;
-		    oldstate = state;
-		    makeliteral(b, c, &state);
-		    tmplen = b->len - tmppos;
-		    b->len = tmppos;
-		    if (tmplen != thislen ||
-			memcmp(b->data + runpos+1, b->data + tmppos, tmplen)) {
-			state = oldstate;
-			break;	       /* run over */
+		    if (runeq) {
+			/*
+			 * Fast path: decide whether the run continues
+			 * by comparing termchar fields directly. This
+			 * turns the inner loop into one word compare
+			 * per cell, which the compiler can unroll and
+			 * vectorise, instead of an encoder call plus
+			 * memcmp per cell.
+			 */
+			if (!runeq(c - 1, c))
+			    break;	       /* run over */
+		    } else {
+			int tmppos, tmplen;
+			tmppos = b->len;
+			oldstate = state;
+			makeliteral(b, c, &state);
+			tmplen = b->len - tmppos;
+			b->len = tmppos;
+			if (tmplen != thislen ||
+			    memcmp(b->data + runpos+1, b->data + tmppos, tmplen)) {
+			    state = oldstate;
+			    break;	       /* run over */
+			}
 		    }
 		    n--, c++, runlen++;
 		}
@@ -657,9 +1571,19 @@ static void makeliteral_cc(struct buf *b, termchar *c, unsigned long *state)
 
 static termline *decompressline(unsigned char *data, int *bytes_used);
 
-static unsigned char *compressline(termline *ldata)
+static unsigned char *compressline(Terminal *term, termline *ldata,
+				   int *lenp)
 {
-    struct buf buffer = { NULL, 0, 0 }, *b = &buffer;
+    struct buf buffer, *b = &buffer;
+
+    /*
+     * Reuse the terminal's persistent scratch buffer, so that
+     * compressing line after line of fast-scrolling output doesn't
+     * have to grow a fresh buffer from nothing each time.
+     */
+    buffer.data = term->compbuf;
+    buffer.size = term->compbuf_size;
+    buffer.len = 0;
 
     /*
      * First, store the column count, 7 bits at a time, least
@@ -700,10 +1624,10 @@ static unsigned char *compressline(termline *ldata)
      * 
      * The format of the `literals' varies between the fragments.
      */
-    makerle(b, ldata, makeliteral_chr);
-    makerle(b, ldata, makeliteral_attr);
-    makerle(b, ldata, makeliteral_truecolour);
-    makerle(b, ldata, makeliteral_cc);
+    makerle(b, ldata, makeliteral_chr, runeq_chr);
+    makerle(b, ldata, makeliteral_attr, runeq_attr);
+    makerle(b, ldata, makeliteral_truecolour, runeq_truecolour);
+    makerle(b, ldata, makeliteral_cc, NULL);
 
     /*
      * Diagnostics: ensure that the compressed data really does
@@ -744,9 +1668,14 @@ static unsigned char *compressline(termline *ldata)
 #endif /* TERM_CC_DIAGS */
 
     /*
-     * Trim the allocated memory so we don't waste any, and return.
+     * Hand the scratch buffer back to the terminal for next time, and
+     * return a copy of the compressed data carved out of the arena.
      */
-    return sresize(b->data, b->len, unsigned char);
+    term->compbuf = b->data;
+    term->compbuf_size = b->size;
+    if (lenp)
+	*lenp = b->len;
+    return sballoc(term, b->data, b->len);
 }
 
 static void readrle(struct buf *b, termline *ldata,
@@ -916,6 +1845,9 @@ static termline *decompressline(unsigned char *data, int *bytes_used)
     ldata->cols = ldata->size = ncols;
     ldata->temporary = TRUE;
     ldata->cc_free = 0;
+    ldata->urls = NULL;
+    ldata->nurls = 0;
+    ldata->url_dirty = TRUE;
 
     /*
      * We must set all the cc pointers in ldata->chars to 0 right
@@ -1025,6 +1957,8 @@ static void resizeline(Terminal *term, termline *line, int cols)
 	for (i = oldcols; i < cols; i++)
 	    line->chars[i] = term->basic_erase_char;
 
+	line->url_dirty = TRUE;
+
 #ifdef TERM_CC_DIAGS
 	cc_check(line);
 #endif
@@ -1036,7 +1970,8 @@ static void resizeline(Terminal *term, termline *line, int cols)
  */
 static int sblines(Terminal *term)
 {
-    int sblines = count234(term->scrollback);
+    int sblines = term->sbspill.count + term->scrollback.count +
+	term->sbpending_count;
     if (term->erase_to_scrollback &&
 	term->alt_which && term->alt_screen) {
 	    sblines += term->alt_sblines;
@@ -1052,52 +1987,76 @@ static int sblines(Terminal *term)
 static termline *lineptr(Terminal *term, int y, int lineno, int screen)
 {
     termline *line;
-    tree234 *whichtree;
-    int treeindex;
 
     if (y >= 0) {
-	whichtree = term->screen;
-	treeindex = y;
+	line = index234(term->screen, y);
     } else {
 	int altlines = 0;
+	int slot = y & (LINECACHE_SIZE - 1);
 
 	assert(!screen);
 
+	if (term->linecache_line[slot] && term->linecache_y[slot] == y)
+	    return term->linecache_line[slot];
+
 	if (term->erase_to_scrollback &&
 	    term->alt_which && term->alt_screen) {
 	    altlines = term->alt_sblines;
 	}
 	if (y < -altlines) {
-	    whichtree = term->scrollback;
-	    treeindex = y + altlines + count234(term->scrollback);
+	    int sbidx = y + altlines + term->sbspill.count +
+		term->scrollback.count + term->sbpending_count;
+	    if (sbidx < term->sbspill.count) {
+		/* A line spilled out to the on-disk tier. */
+		unsigned char *cdata = sbspill_line(term, sbidx);
+		line = cdata ? decompressline(cdata, NULL) : NULL;
+	    } else if (sbidx >= term->sbspill.count + term->scrollback.count &&
+		       sbidx < term->sbspill.count + term->scrollback.count +
+		       term->sbpending_count) {
+		/* A line still awaiting deferred compression. */
+		line = term->sbpending[term->sbpending_head + sbidx -
+				       term->sbspill.count -
+				       term->scrollback.count];
+	    } else {
+		unsigned char *cline =
+		    sbring_index(term, sbidx - term->sbspill.count);
+		line = cline ? decompressline(cline, NULL) : NULL;
+	    }
 	} else {
-	    whichtree = term->alt_screen;
-	    treeindex = y + term->alt_sblines;
-	    /* treeindex = y + count234(term->alt_screen); */
+	    line = index234(term->alt_screen, y + term->alt_sblines);
+	}
+
+	/*
+	 * If we had to decompress the line, pin the result in the
+	 * line cache (by clearing its 'temporary' flag, so the
+	 * callers' unlineptr() leaves it alone) and reuse it until
+	 * the cache is flushed. Lines that didn't need decompressing
+	 * - alt-screen lines, and scrollback lines still on the
+	 * pending queue - are passed straight through.
+	 */
+	if (line && line->temporary) {
+	    line->temporary = FALSE;
+	    if (term->linecache_line[slot])
+		freeline(term->linecache_line[slot]);
+	    term->linecache_line[slot] = line;
+	    term->linecache_y[slot] = y;
 	}
-    }
-    if (whichtree == term->scrollback) {
-	unsigned char *cline = index234(whichtree, treeindex);
-	line = decompressline(cline, NULL);
-    } else {
-	line = index234(whichtree, treeindex);
     }
 
     /* We assume that we don't screw up and retrieve something out of range. */
     if (line == NULL) {
 	modalfatalbox("line==NULL in terminal.c\n"
                       "lineno=%d y=%d w=%d h=%d\n"
-                      "count(scrollback=%p)=%d\n"
+                      "count(scrollback)=%d count(spill)=%d\n"
                       "count(screen=%p)=%d\n"
-                      "count(alt=%p)=%d alt_sblines=%d\n"
-                      "whichtree=%p treeindex=%d\n\n"
+                      "count(alt=%p)=%d alt_sblines=%d\n\n"
                       "Please contact <putty@projects.tartarus.org> "
                       "and pass on the above information.",
                       lineno, y, term->cols, term->rows,
-                      term->scrollback, count234(term->scrollback),
+                      term->scrollback.count, term->sbspill.count,
                       term->screen, count234(term->screen),
                       term->alt_screen, count234(term->alt_screen),
-                      term->alt_sblines, whichtree, treeindex);
+                      term->alt_sblines);
     }
     assert(line != NULL);
 
@@ -1121,6 +2080,14 @@ static termline *lineptr(Terminal *term, int y, int lineno, int screen)
     if (term->cols > line->cols)
         resizeline(term, line, term->cols);
 
+    /*
+     * scrlineptr() is the route by which the emulator gets at a line
+     * it intends to modify, so this is the one choke point at which
+     * lines can be flagged for the incremental URL re-scan.
+     */
+    if (screen)
+	line->url_dirty = TRUE;
+
     return line;
 }
 
@@ -1143,14 +2110,170 @@ static void check_line_size(Terminal *term, termline *line)
         resizeline(term, line, term->cols);
 }
 
+/*
+ * Empty the cache of decompressed scrollback lines that lineptr()
+ * maintains. The cache is keyed by the lines' scrollback coordinates,
+ * which shift whenever anything enters or leaves the scrollback, so
+ * it is flushed at the end of term_out() and on screen swap, resize
+ * and clear; the cached copies could only go stale through one of
+ * those. Idle compaction also flushes it, since the whole point of
+ * compacting is to give back exactly this sort of memory.
+ */
+static void line_cache_flush(Terminal *term)
+{
+    int i;
+
+    for (i = 0; i < LINECACHE_SIZE; i++) {
+	if (term->linecache_line[i]) {
+	    freeline(term->linecache_line[i]);
+	    term->linecache_line[i] = NULL;
+	}
+    }
+}
+
 static void term_schedule_tblink(Terminal *term);
 static void term_schedule_cblink(Terminal *term);
+static void term_timer(void *ctx, unsigned long now);
+
+/*
+ * Idle-session memory compaction. A window left idle overnight still
+ * holds its full display state, saved alternate screen and
+ * recycled-line cache, which adds up across a fleet of sessions.
+ * Once the terminal has seen no activity for IDLE_COMPACT_DELAY
+ * ticks, we compress the saved alt screen with the scrollback
+ * compressor, free the display-state lines and drop the recycled
+ * scrollback lines. Every entry point that can look inside those
+ * structures calls term_idle_wake() first, which rebuilds them
+ * marked all-invalid (forcing a full repaint, exactly as a resize
+ * does), so the compaction is invisible apart from the footprint.
+ */
+static void term_idle_compact(Terminal *term)
+{
+    int i;
+
+    if (term->idle_compacted)
+	return;
+
+    line_cache_flush(term);
+
+    /*
+     * Compress the saved alternate screen, provided we're not
+     * currently displaying it. Nothing looks inside alt_screen
+     * while alt_which is zero, so it can sit as compressed data
+     * until term_idle_wake() inflates it again.
+     */
+    if (!term->alt_which && term->alt_screen) {
+	termline *line;
+	int n = count234(term->alt_screen);
+
+	term->alt_compressed = snewn(n, unsigned char *);
+	term->alt_compressed_count = n;
+	for (i = 0; i < n; i++) {
+	    line = index234(term->alt_screen, i);
+	    term->alt_compressed[i] = compressline(term, line, NULL);
+	}
+	while ((line = delpos234(term->alt_screen, 0)) != NULL)
+	    freeline(line);
+    }
+
+    /*
+     * Flush the display-state lines. The array of row pointers
+     * stays, so term_free() still works if the session dies while
+     * compacted.
+     */
+    if (term->disptext) {
+	for (i = 0; i < term->rows; i++) {
+	    freeline(term->disptext[i]);
+	    term->disptext[i] = NULL;
+	}
+    }
+
+    /*
+     * And drop the recycled scrollback line cache; it only exists
+     * to save allocations during fast output, which by definition
+     * isn't happening.
+     */
+    while (term->sbfreelines_count > 0)
+	freeline(term->sbfreelines[--term->sbfreelines_count]);
+
+    term->idle_compacted = TRUE;
+}
+
+/*
+ * Note terminal activity, (re)arming the idle-compaction timer; and
+ * if the terminal is currently compacted, rebuild everything. Called
+ * from every entry point that leads to the display state or the
+ * saved alt screen, _before_ the caller looks at either.
+ */
+static void term_idle_wake(Terminal *term)
+{
+    int i, j;
+
+    term->last_activity = GETTICKCOUNT_COARSE();
+    if (!term->idle_compact_pending) {
+	term->idle_compact_pending = TRUE;
+	term->next_idle_compact = schedule_timer(IDLE_COMPACT_DELAY,
+						 term_timer, term);
+    }
+
+    if (!term->idle_compacted)
+	return;
+
+    /* Reinflate the saved alternate screen. */
+    if (term->alt_compressed) {
+	for (i = 0; i < term->alt_compressed_count; i++) {
+	    termline *line = decompressline(term->alt_compressed[i], NULL);
+	    line->temporary = FALSE;   /* reconstituted line is now real */
+	    sbfree(term, term->alt_compressed[i]);
+	    addpos234(term->alt_screen, line, i);
+	}
+	sfree(term->alt_compressed);
+	term->alt_compressed = NULL;
+	term->alt_compressed_count = 0;
+    }
+
+    /*
+     * Rebuild the display state, marked invalid throughout so the
+     * next paint redraws everything from the real screen contents.
+     */
+    if (term->disptext) {
+	for (i = 0; i < term->rows; i++) {
+	    termline *dline = newline(term, term->cols, FALSE);
+	    for (j = 0; j < term->cols; j++)
+		dline->chars[j].attr = ATTR_INVALID;
+	    term->disptext[i] = dline;
+	}
+    }
+    if (term->disprowhash) {
+	for (i = 0; i < term->rows; i++)
+	    term->disprowhash[i] = 0;
+    }
+    term->disp_epoch = 0;
+    term->dispcursx = term->dispcursy = -1;
+
+    term->idle_compacted = FALSE;
+}
 
 static void term_timer(void *ctx, unsigned long now)
 {
     Terminal *term = (Terminal *)ctx;
     int update = FALSE;
 
+    if (term->idle_compact_pending && now == term->next_idle_compact) {
+	unsigned long ticks = now - term->last_activity;
+
+	term->idle_compact_pending = FALSE;
+	if (ticks < IDLE_COMPACT_DELAY) {
+	    /* There's been activity since this timer was armed;
+	     * come back when a full idle period has elapsed. */
+	    term->idle_compact_pending = TRUE;
+	    term->next_idle_compact =
+		schedule_timer(IDLE_COMPACT_DELAY - ticks, term_timer, term);
+	} else {
+	    term_idle_compact(term);
+	}
+    }
+
     if (term->tblink_pending && now == term->next_tblink) {
 	term->tblinker = !term->tblinker;
 	term->tblink_pending = FALSE;
@@ -1177,9 +2300,26 @@ static void term_timer(void *ctx, unsigned long now)
 
 static void term_schedule_update(Terminal *term)
 {
+    /*
+     * Throughput-bound output is repainted at most once every
+     * term->update_delay ticks; but if the user has typed since the
+     * last update, we drop back to the short UPDATE_DELAY so that
+     * keystroke echo doesn't lag behind a low configured frame rate.
+     */
+    long delay = term->key_update_pending ? UPDATE_DELAY :
+	term->update_delay;
+
     if (!term->window_update_pending) {
 	term->window_update_pending = TRUE;
-	term->next_update = schedule_timer(UPDATE_DELAY, term_timer, term);
+	term->next_update = schedule_timer(delay, term_timer, term);
+    } else if (delay == UPDATE_DELAY &&
+	       term->update_delay != UPDATE_DELAY) {
+	/*
+	 * An update is already scheduled on the slow cadence; pull it
+	 * forward for the echo. The old timer will still fire, but
+	 * will no longer match next_update and so will be ignored.
+	 */
+	term->next_update = schedule_timer(delay, term_timer, term);
     }
 }
 
@@ -1244,7 +2384,7 @@ static void term_schedule_vbell(Terminal *term, int already_started,
     long ticks_already_gone;
 
     if (already_started)
-	ticks_already_gone = GETTICKCOUNT() - startpoint;
+	ticks_already_gone = GETTICKCOUNT_COARSE() - startpoint;
     else
 	ticks_already_gone = 0;
 
@@ -1342,7 +2482,46 @@ void term_update(Terminal *term)
 {
     Context ctx;
 
+    term_idle_wake(term);
+
     term->window_update_pending = FALSE;
+    term->key_update_pending = FALSE;
+
+    /*
+     * Credit any BELs coalesced during the frame just ending to the
+     * newest queue entry, so that overload detection still sees the
+     * true bell volume.
+     */
+    if (term->bell_frame_count > 1 && term->beeptail) {
+	term->beeptail->count += term->bell_frame_count - 1;
+	term->nbeeps += term->bell_frame_count - 1;
+    }
+    term->bell_frame_count = 0;
+
+    /*
+     * Apply any coalesced title and icon change, newest value only.
+     * This happens even while minimised, since the title labels the
+     * taskbar entry.
+     */
+    if (term->pending_icon) {
+	set_icon(term->frontend, term->pending_icon);
+	sfree(term->pending_icon);
+	term->pending_icon = NULL;
+    }
+    if (term->pending_title) {
+	set_title(term->frontend, term->pending_title);
+	sfree(term->pending_title);
+	term->pending_title = NULL;
+    }
+
+    /*
+     * While the window is hidden there's nobody to paint for: keep
+     * maintaining the model and the scrollback, but skip the display
+     * diff entirely. term_set_visible() arranges the full repaint
+     * when the window comes back.
+     */
+    if (!term->win_visible)
+	return;
 
     ctx = get_ctx(term->frontend);
     if (ctx) {
@@ -1361,12 +2540,43 @@ void term_update(Terminal *term)
     }
 }
 
+/*
+ * Called from the front end when the window is minimised or
+ * restored. While hidden, term_update() does no display work; on
+ * re-expose everything is invalidated, because scrolls that happened
+ * in the meantime moved the display model without the front end
+ * moving any pixels.
+ */
+void term_set_visible(Terminal *term, int visible)
+{
+    if (!term->win_visible == !visible)
+	return;
+    term->win_visible = visible;
+    if (visible) {
+#ifdef OPTIMISE_SCROLL
+	/*
+	 * Queued scrolls would move pixels that were never drawn;
+	 * drop them in favour of the full invalidation.
+	 */
+	while (term->scrollhead) {
+	    struct scrollregion *sr = term->scrollhead;
+	    term->scrollhead = sr->next;
+	    sfree(sr);
+	}
+	term->scrolltail = NULL;
+#endif /* OPTIMISE_SCROLL */
+	term_invalidate(term);
+    }
+}
+
 /*
  * Called from front end when a keypress occurs, to trigger
  * anything magical that needs to happen in that situation.
  */
 void term_seen_key_event(Terminal *term)
 {
+    term_idle_wake(term);
+
     /*
      * On any keypress, clear the bell overload mechanism
      * completely, on the grounds that large numbers of
@@ -1382,6 +2592,16 @@ void term_seen_key_event(Terminal *term)
     }
     term->beeptail = NULL;
     term->nbeeps = 0;
+    term->bell_frame_count = 0;
+
+    /*
+     * Make sure the next window update isn't held back by a reduced
+     * configured frame rate, so the echo of this keystroke appears
+     * promptly.
+     */
+    term->key_update_pending = TRUE;
+    if (term->window_update_pending)
+	term->next_update = schedule_timer(UPDATE_DELAY, term_timer, term);
 
     /*
      * Reset the scrollback on keypress, if we're doing that.
@@ -1441,6 +2661,7 @@ void term_copy_stuff_from_conf(Terminal *term)
     term->erase_to_scrollback = conf_get_int(term->conf, CONF_erase_to_scrollback);
     term->funky_type = conf_get_int(term->conf, CONF_funky_type);
     term->lfhascr = conf_get_int(term->conf, CONF_lfhascr);
+    term->localecho_predict = conf_get_int(term->conf, CONF_localecho_predict);
     term->logflush = conf_get_int(term->conf, CONF_logflush);
     term->logtype = conf_get_int(term->conf, CONF_logtype);
     term->mouse_override = conf_get_int(term->conf, CONF_mouse_override);
@@ -1459,7 +2680,21 @@ void term_copy_stuff_from_conf(Terminal *term)
     term->remote_qtitle_action = conf_get_int(term->conf, CONF_remote_qtitle_action);
     term->rxvt_homeend = conf_get_int(term->conf, CONF_rxvt_homeend);
     term->scroll_on_disp = conf_get_int(term->conf, CONF_scroll_on_disp);
+    {
+	/*
+	 * Translate the configured maximum refresh rate into a timer
+	 * interval. 0 (the default) keeps the historical behaviour of
+	 * one update at most every UPDATE_DELAY ticks.
+	 */
+	int fps = conf_get_int(term->conf, CONF_refresh_rate);
+	term->update_delay = fps > 0 ? (TICKSPERSEC + fps - 1) / fps
+	    : UPDATE_DELAY;
+	if (term->update_delay < UPDATE_DELAY)
+	    term->update_delay = UPDATE_DELAY;
+    }
     term->scroll_on_key = conf_get_int(term->conf, CONF_scroll_on_key);
+    sfree(term->printer);
+    term->printer = dupstr(conf_get_str(term->conf, CONF_printer));
     term->xterm_256_colour = conf_get_int(term->conf, CONF_xterm_256_colour);
     term->true_colour = conf_get_int(term->conf, CONF_true_colour);
 
@@ -1495,6 +2730,8 @@ void term_copy_stuff_from_conf(Terminal *term)
  */
 void term_reconfig(Terminal *term, Conf *conf)
 {
+    term_idle_wake(term);
+
     /*
      * Before adopting the new config, check all those terminal
      * settings which control power-on defaults; and if they've
@@ -1589,10 +2826,18 @@ void term_clrsb(Terminal *term)
     term->disptop = 0;
 
     /*
-     * Clear the actual scrollback.
+     * Clear the actual scrollback, including the on-disk spill tier,
+     * whose backing file is deleted outright.
      */
-    while ((line = delpos234(term->scrollback, 0)) != NULL) {
-	sfree(line);            /* this is compressed data, not a termline */
+    line_cache_flush(term);
+    sbspill_clear(term);
+    while ((line = sbring_pop_oldest(term)) != NULL) {
+	sbfree(term, line);     /* this is compressed data, not a termline */
+    }
+    {
+	termline *pline;
+	while ((pline = sbpending_pop_oldest(term)) != NULL)
+	    freeline(pline);
     }
 
     /*
@@ -1630,6 +2875,7 @@ Terminal *term_init(Conf *myconf, struct unicode_data *ucsdata,
 		    void *frontend)
 {
     Terminal *term;
+    int i;
 
     /*
      * Allocate a new Terminal structure and initialise the fields
@@ -1645,10 +2891,29 @@ Terminal *term_init(Conf *myconf, struct unicode_data *ucsdata,
     term->cblink_pending = term->tblink_pending = FALSE;
     term->paste_buffer = NULL;
     term->paste_len = 0;
+    term->paste_bracketed = FALSE;
+    term->n_predictions = 0;
+    term->predict_confirmed = FALSE;
+    term->n_predict_pending = 0;
+    term->stat_bytes = 0L;
+    term->stat_clocks = 0;
+#ifdef INPUT_LATENCY_TRACE
+    term->lat_key_pending = FALSE;
+    term->lat_echo_seen = FALSE;
+    term->lat_key_time = 0L;
+    term->lat_samples = 0L;
+    memset(term->lat_buckets, 0, sizeof(term->lat_buckets));
+#endif
+    term->idle_compact_pending = FALSE;
+    term->idle_compacted = FALSE;
+    term->last_activity = GETTICKCOUNT();
+    term->alt_compressed = NULL;
+    term->alt_compressed_count = 0;
     bufchain_init(&term->inbuf);
     bufchain_init(&term->printer_buf);
     term->printing = term->only_printing = FALSE;
     term->print_job = NULL;
+    term->printer = NULL;
     term->vt52_mode = FALSE;
     term->cr_lf_return = FALSE;
     term->seen_disp_event = FALSE;
@@ -1656,6 +2921,8 @@ Terminal *term_init(Conf *myconf, struct unicode_data *ucsdata,
     term->reset_132 = FALSE;
     term->cblinker = term->tblinker = 0;
     term->has_focus = 1;
+    term->win_visible = TRUE;
+    term->pending_title = term->pending_icon = NULL;
     term->repeat_off = FALSE;
     term->termstate = TOPLEVEL;
     term->selstate = NO_SELECTION;
@@ -1663,11 +2930,30 @@ Terminal *term_init(Conf *myconf, struct unicode_data *ucsdata,
 
     term_copy_stuff_from_conf(term);
 
-    term->screen = term->alt_screen = term->scrollback = NULL;
+    term->screen = term->alt_screen = NULL;
+    sbring_init(&term->scrollback);
+    sbspill_init(&term->sbspill);
+    term->sbpending = NULL;
+    term->sbpending_head = term->sbpending_count = term->sbpending_size = 0;
+    term->sbfreelines = NULL;
+    term->sbfreelines_count = term->sbfreelines_size = 0;
+    term->sbcompress_scheduled = FALSE;
+    term->urlscan_scheduled = FALSE;
+    term->replybuf = NULL;
+    term->replybuf_len = term->replybuf_size = 0;
+    for (i = 0; i < LINECACHE_SIZE; i++) {
+	term->linecache_line[i] = NULL;
+	term->linecache_y[i] = 0;
+    }
+    term->sb_arena = NULL;
+    term->compbuf = NULL;
+    term->compbuf_size = 0;
     term->tempsblines = 0;
     term->alt_sblines = 0;
     term->disptop = 0;
     term->disptext = NULL;
+    term->disprowhash = NULL;
+    term->disp_epoch = 0;
     term->dispcursx = term->dispcursy = -1;
     term->tabs = NULL;
     deselect(term);
@@ -1680,6 +2966,7 @@ Terminal *term_init(Conf *myconf, struct unicode_data *ucsdata,
     term->nbeeps = 0;
     term->lastbeep = FALSE;
     term->beep_overloaded = FALSE;
+    term->bell_frame_count = 0;
     term->attr_mask = 0xffffffff;
     term->resize_fn = NULL;
     term->resize_ctx = NULL;
@@ -1691,6 +2978,7 @@ Terminal *term_init(Conf *myconf, struct unicode_data *ucsdata,
     term->wcFromTo_size = 0;
 
     term->window_update_pending = FALSE;
+    term->key_update_pending = FALSE;
 
     term->bidi_cache_size = 0;
     term->pre_bidi_cache = term->post_bidi_cache = NULL;
@@ -1713,6 +3001,12 @@ Terminal *term_init(Conf *myconf, struct unicode_data *ucsdata,
     term->n_mouse_select_clipboards = 1;
     term->mouse_paste_clipboard = CLIP_NULL;
 
+    /*
+     * If a previous session left a scrollback snapshot behind,
+     * repopulate the scrollback from it before the window opens.
+     */
+    term_restore_snapshot(term);
+
     return term;
 }
 
@@ -1722,9 +3016,43 @@ void term_free(Terminal *term)
     struct beeptime *beep;
     int i;
 
-    while ((line = delpos234(term->scrollback, 0)) != NULL)
-	sfree(line);		       /* compressed data, not a termline */
-    freetree234(term->scrollback);
+    /* Serialise the scrollback before anything is torn down. */
+    term_save_snapshot(term);
+
+#ifdef INPUT_LATENCY_TRACE
+    if (term->lat_samples)
+	term_latency_report(term);
+#endif
+
+    {
+	unsigned char *cline;
+	termline *pline;
+	line_cache_flush(term);
+	sbspill_clear(term);
+	while ((cline = sbring_pop_oldest(term)) != NULL)
+	    sbfree(term, cline);   /* compressed data, not a termline */
+	sfree(term->scrollback.lines);
+	sfree(term->scrollback.sigs);
+	sfree(term->scrollback.lens);
+	while ((pline = sbpending_pop_oldest(term)) != NULL)
+	    freeline(pline);
+	sfree(term->sbpending);
+	while (term->sbfreelines_count > 0)
+	    freeline(term->sbfreelines[--term->sbfreelines_count]);
+	sfree(term->sbfreelines);
+	delete_callbacks_for_context(term);
+    }
+    if (term->alt_compressed) {
+	for (i = 0; i < term->alt_compressed_count; i++)
+	    sbfree(term, term->alt_compressed[i]);
+	sfree(term->alt_compressed);
+    }
+    while (term->sb_arena) {
+	struct sbarena_block *blk = term->sb_arena;
+	term->sb_arena = blk->next;
+	sfree(blk);
+    }
+    sfree(term->compbuf);
     while ((line = delpos234(term->screen, 0)) != NULL)
 	freeline(line);
     freetree234(term->screen);
@@ -1736,6 +3064,7 @@ void term_free(Terminal *term)
 	    freeline(term->disptext[i]);
     }
     sfree(term->disptext);
+    sfree(term->disprowhash);
     while (term->beephead) {
 	beep = term->beephead;
 	term->beephead = beep->next;
@@ -1745,11 +3074,15 @@ void term_free(Terminal *term)
     if(term->print_job)
 	printer_finish_job(term->print_job);
     bufchain_clear(&term->printer_buf);
+    sfree(term->pending_title);
+    sfree(term->pending_icon);
     sfree(term->paste_buffer);
     sfree(term->ltemp);
     sfree(term->wcFrom);
     sfree(term->wcTo);
     sfree(term->answerback);
+    sfree(term->replybuf);
+    sfree(term->printer);
 
     for (i = 0; i < term->bidi_cache_size; i++) {
 	sfree(term->pre_bidi_cache[i].chars);
@@ -1774,12 +3107,13 @@ void term_free(Terminal *term)
  */
 void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
 {
-    tree234 *newalt;
-    termline **newdisp, *line;
+    termline *line;
     int i, j, oldrows = term->rows;
     int sblen;
     int save_alt_which = term->alt_which;
 
+    term_idle_wake(term);
+
     if (newrows == term->rows && newcols == term->cols &&
 	newsavelines == term->savelines)
 	return;			       /* nothing to do */
@@ -1790,13 +3124,14 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
     if (newcols < 1) newcols = 1;
 
     deselect(term);
+    line_cache_flush(term);
     swap_screen(term, 0, FALSE, FALSE);
+    term->n_predictions = 0;	       /* overlay coordinates are stale */
 
     term->alt_t = term->marg_t = 0;
     term->alt_b = term->marg_b = newrows - 1;
 
     if (term->rows == -1) {
-	term->scrollback = newtree234(NULL);
 	term->screen = newtree234(NULL);
 	term->tempsblines = 0;
 	term->rows = 0;
@@ -1821,17 +3156,29 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
      *    amount of scrollback we actually have, we must throw some
      *    away.
      */
-    sblen = count234(term->scrollback);
+    sblen = term->sbspill.count + term->scrollback.count +
+	term->sbpending_count;
     /* Do this loop to expand the screen if newrows > rows */
     assert(term->rows == count234(term->screen));
     while (term->rows < newrows) {
 	if (term->tempsblines > 0) {
-	    unsigned char *cline;
 	    /* Insert a line from the scrollback at the top of the screen. */
 	    assert(sblen >= term->tempsblines);
-	    cline = delpos234(term->scrollback, --sblen);
-	    line = decompressline(cline, NULL);
-	    sfree(cline);
+	    if (term->sbpending_count > 0) {
+		/* Newest line hasn't been compressed yet; use it as is. */
+		line = sbpending_pop_newest(term);
+	    } else if (term->scrollback.count > 0) {
+		unsigned char *cline = sbring_pop_newest(term);
+		line = decompressline(cline, NULL);
+		sbfree(term, cline);
+	    } else {
+		/* Everything left has been spilled to disk. */
+		unsigned char *cdata =
+		    sbspill_line(term, term->sbspill.count - 1);
+		line = decompressline(cdata, NULL);
+		sbspill_pop_newest(term);
+	    }
+	    sblen--;
 	    line->temporary = FALSE;   /* reconstituted line is now real */
 	    term->tempsblines -= 1;
 	    addpos234(term->screen, line, 0);
@@ -1854,8 +3201,12 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
             freeline(line);
 	} else {
 	    /* push top row to scrollback */
+	    int clen;
+	    unsigned char *cline;
 	    line = delpos234(term->screen, 0);
-	    addpos234(term->scrollback, compressline(line), sblen++);
+	    cline = compressline(term, line, &clen);
+	    sbring_push(term, cline, clen, termsearch_sig(line));
+	    sblen++;
 	    freeline(line);
 	    term->tempsblines += 1;
 	    term->curs.y -= 1;
@@ -1870,43 +3221,73 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
 
     /* Delete any excess lines from the scrollback. */
     while (sblen > newsavelines) {
-	line = delpos234(term->scrollback, 0);
-	sfree(line);
+	if (term->sbspill.count > 0)
+	    sbspill_pop_oldest(term);
+	else if (term->scrollback.count > 0)
+	    sbfree(term, sbring_pop_oldest(term));
+	else
+	    freeline(sbpending_pop_oldest(term));
 	sblen--;
     }
     if (sblen < term->tempsblines)
 	term->tempsblines = sblen;
-    assert(count234(term->scrollback) <= newsavelines);
-    assert(count234(term->scrollback) >= term->tempsblines);
+    assert(term->sbspill.count + term->scrollback.count +
+	   term->sbpending_count <= newsavelines);
+    assert(term->sbspill.count + term->scrollback.count +
+	   term->sbpending_count >= term->tempsblines);
+    sbspill_trim(term);
     term->disptop = 0;
 
-    /* Make a new displayed text buffer. */
-    newdisp = snewn(newrows, termline *);
+    /*
+     * Resize the displayed-text buffer in place, reusing as many of
+     * its lines as possible. During an interactive window-resize
+     * drag this function runs once per motion event, so rebuilding
+     * the buffer wholesale was needless allocator churn; every cell
+     * is invalidated either way, since a full repaint follows.
+     */
+    if (oldrows < 0)
+	oldrows = 0;
+    for (i = newrows; i < oldrows; i++)
+	freeline(term->disptext[i]);
+    term->disptext = sresize(term->disptext, newrows, termline *);
     for (i = 0; i < newrows; i++) {
-	newdisp[i] = newline(term, newcols, FALSE);
+	termline *dline;
+	if (i < oldrows) {
+	    dline = term->disptext[i];
+	    resizeline(term, dline, newcols);
+	    dline->lattr = LATTR_NORM;
+	} else {
+	    dline = newline(term, newcols, FALSE);
+	    term->disptext[i] = dline;
+	}
 	for (j = 0; j < newcols; j++)
-	    newdisp[i]->chars[j].attr = ATTR_INVALID;
-    }
-    if (term->disptext) {
-	for (i = 0; i < oldrows; i++)
-	    freeline(term->disptext[i]);
+	    dline->chars[j].attr = ATTR_INVALID;
     }
-    sfree(term->disptext);
-    term->disptext = newdisp;
+    term->disprowhash = sresize(term->disprowhash, newrows, unsigned long);
+    for (i = 0; i < newrows; i++)
+	term->disprowhash[i] = 0;
+    term->disp_epoch = 0;
     term->dispcursx = term->dispcursy = -1;
 
-    /* Make a new alternate screen. */
-    newalt = newtree234(NULL);
-    for (i = 0; i < newrows; i++) {
-	line = newline(term, newcols, TRUE);
-	addpos234(newalt, line, i);
-    }
-    if (term->alt_screen) {
-	while (NULL != (line = delpos234(term->alt_screen, 0)))
-	    freeline(line);
-	freetree234(term->alt_screen);
+    /*
+     * Make the alternate screen the right size, again reusing its
+     * existing lines. Its contents are discarded on resize, exactly
+     * as they were when it was rebuilt from scratch.
+     */
+    if (!term->alt_screen)
+	term->alt_screen = newtree234(NULL);
+    while (count234(term->alt_screen) > newrows)
+	freeline(delpos234(term->alt_screen, newrows));
+    for (i = 0; i < count234(term->alt_screen); i++) {
+	line = index234(term->alt_screen, i);
+	resizeline(term, line, newcols);
+	line->lattr = LATTR_NORM;
+	for (j = 0; j < newcols; j++)
+	    copy_termchar(line, j, &term->erase_char);
     }
-    term->alt_screen = newalt;
+    while (count234(term->alt_screen) < newrows)
+	addpos234(term->alt_screen, newline(term, newcols, TRUE),
+		  count234(term->alt_screen));
     term->alt_sblines = 0;
 
     term->tabs = sresize(term->tabs, newcols, unsigned char);
@@ -2008,6 +3389,10 @@ static void swap_screen(Terminal *term, int which, int reset, int keep_cur_pos)
     if (which != term->alt_which) {
 	term->alt_which = which;
 
+	/* Toggling alt_which changes alt_sblines, which shifts the
+	 * scrollback coordinates the line cache is keyed by. */
+	line_cache_flush(term);
+
 	ttr = term->alt_screen;
 	term->alt_screen = term->screen;
 	term->screen = ttr;
@@ -2115,10 +3500,32 @@ static void check_selection(Terminal *term, pos from, pos to)
  * for backward.) `sb' is TRUE if the scrolling is permitted to
  * affect the scrollback buffer.
  */
+/*
+ * Reset a recycled scroll line to blank cells. The general case has
+ * to go through copy_termchar per cell so that combining-character
+ * lists are returned to the line's free list; but a line that has
+ * never had cc storage allocated (size == cols) can't have any, and
+ * gets a straight fill, which is the common case during fast
+ * scrolling.
+ */
+static void blankline(Terminal *term, termline *line, termchar *erase_char)
+{
+    int i;
+
+    if (line->size > line->cols) {
+	for (i = 0; i < line->cols; i++)
+	    copy_termchar(line, i, erase_char);
+    } else {
+	for (i = 0; i < line->cols; i++)
+	    line->chars[i] = *erase_char;
+    }
+    line->lattr = LATTR_NORM;
+}
+
 static void scroll(Terminal *term, int topline, int botline, int lines, int sb)
 {
     termline *line;
-    int i, seltop, scrollwinsize;
+    int seltop, scrollwinsize;
 #ifdef OPTIMISE_SCROLL
     int olddisptop, shift;
 #endif /* OPTIMISE_SCROLL */
@@ -2140,9 +3547,7 @@ static void scroll(Terminal *term, int topline, int botline, int lines, int sb)
 	while (lines-- > 0) {
 	    line = delpos234(term->screen, botline);
             resizeline(term, line, term->cols);
-	    for (i = 0; i < term->cols; i++)
-		copy_termchar(line, i, &term->erase_char);
-	    line->lattr = LATTR_NORM;
+	    blankline(term, line, &term->erase_char);
 	    addpos234(term->screen, line, topline);
 
 	    if (term->selstart.y >= topline && term->selstart.y <= botline) {
@@ -2169,24 +3574,39 @@ static void scroll(Terminal *term, int topline, int botline, int lines, int sb)
 	    cc_check(line);
 #endif
 	    if (sb && term->savelines > 0) {
-		int sblen = count234(term->scrollback);
+		int sblen = term->sbspill.count + term->scrollback.count +
+		    term->sbpending_count;
 		/*
 		 * We must add this line to the scrollback. We'll
 		 * remove a line from the top of the scrollback if
 		 * the scrollback is full.
 		 */
 		if (sblen == term->savelines) {
-		    unsigned char *cline;
-
-		    sblen--;
-		    cline = delpos234(term->scrollback, 0);
-		    sfree(cline);
+		    if (term->sbspill.count > 0)
+			sbspill_pop_oldest(term);
+		    else if (term->scrollback.count > 0)
+			sbfree(term, sbring_pop_oldest(term));
+		    else
+			freeline(sbpending_pop_oldest(term));
 		} else
 		    term->tempsblines += 1;
 
-		addpos234(term->scrollback, compressline(line), sblen);
+		/*
+		 * Park the evicted line on the pending queue rather
+		 * than compressing it here on the output path; the
+		 * callback will catch up with it shortly.
+		 */
+		sbpending_push(term, line);
+		if (!term->sbcompress_scheduled) {
+		    term->sbcompress_scheduled = TRUE;
+		    queue_bulk_callback(sbcompress_callback, term);
+		}
 
-		/* now `line' itself can be reused as the bottom line */
+		/* and take a recycled (or fresh) line for the bottom */
+		if (term->sbfreelines_count > 0)
+		    line = term->sbfreelines[--term->sbfreelines_count];
+		else
+		    line = newline(term, term->cols, FALSE);
 
 		/*
 		 * If the user is currently looking at part of the
@@ -2206,9 +3626,7 @@ static void scroll(Terminal *term, int topline, int botline, int lines, int sb)
 		    term->disptop--;
 	    }
             resizeline(term, line, term->cols);
-	    for (i = 0; i < term->cols; i++)
-		copy_termchar(line, i, &term->erase_char);
-	    line->lattr = LATTR_NORM;
+	    blankline(term, line, &term->erase_char);
 	    addpos234(term->screen, line, botline);
 
 	    /*
@@ -2294,14 +3712,35 @@ static void save_scroll(Terminal *term, int topline, int botline, int lines)
 static void scroll_display(Terminal *term, int topline, int botline, int lines)
 {
     int distance, nlines, i, j;
+    termline **held;
 
     distance = lines > 0 ? lines : -lines;
     nlines = botline - topline + 1 - distance;
-    if (lines > 0) {
-	for (i = 0; i < nlines; i++)
+
+    if (nlines <= 0) {
+	/*
+	 * The scroll moved everything out of the region; there's
+	 * nothing to reuse, so just invalidate the lot.
+	 */
+	for (i = topline; i <= botline; i++)
 	    for (j = 0; j < term->cols; j++)
-		copy_termchar(term->disptext[i], j,
-			      term->disptext[i+distance]->chars+j);
+		term->disptext[i]->chars[j].attr |= ATTR_INVALID;
+    } else if (lines > 0) {
+	/*
+	 * Shift the display model by rotating the disptext row
+	 * pointers, rather than copying every cell of every moved
+	 * row: the termlines displaced off one end of the region
+	 * come back in at the other end and are marked invalid
+	 * there, so only the rows the scroll exposes cost anything
+	 * per-cell.
+	 */
+	held = snewn(distance, termline *);
+	for (i = 0; i < distance; i++)
+	    held[i] = term->disptext[i];
+	memmove(term->disptext, term->disptext + distance,
+		nlines * sizeof(termline *));
+	for (i = 0; i < distance; i++)
+	    term->disptext[nlines+i] = held[i];
 	if (term->dispcursy >= 0 &&
 	    term->dispcursy >= topline + distance &&
 	    term->dispcursy < topline + distance + nlines)
@@ -2309,11 +3748,15 @@ static void scroll_display(Terminal *term, int topline, int botline, int lines)
 	for (i = 0; i < distance; i++)
 	    for (j = 0; j < term->cols; j++)
 		term->disptext[nlines+i]->chars[j].attr |= ATTR_INVALID;
+	sfree(held);
     } else {
-	for (i = nlines; i-- ;)
-	    for (j = 0; j < term->cols; j++)
-		copy_termchar(term->disptext[i+distance], j,
-			      term->disptext[i]->chars+j);
+	held = snewn(distance, termline *);
+	for (i = 0; i < distance; i++)
+	    held[i] = term->disptext[nlines+i];
+	memmove(term->disptext + distance, term->disptext,
+		nlines * sizeof(termline *));
+	for (i = 0; i < distance; i++)
+	    term->disptext[i] = held[i];
 	if (term->dispcursy >= 0 &&
 	    term->dispcursy >= topline &&
 	    term->dispcursy < topline + nlines)
@@ -2321,7 +3764,13 @@ static void scroll_display(Terminal *term, int topline, int botline, int lines)
 	for (i = 0; i < distance; i++)
 	    for (j = 0; j < term->cols; j++)
 		term->disptext[i]->chars[j].attr |= ATTR_INVALID;
+	sfree(held);
     }
+    /* The row-to-line mapping has shifted, so the per-row paint
+     * hashes are no longer meaningful. */
+    if (term->disprowhash)
+	for (i = topline; i <= botline; i++)
+	    term->disprowhash[i] = 0;
     save_scroll(term, topline, botline, lines);
 }
 #endif /* OPTIMISE_SCROLL */
@@ -2470,8 +3919,13 @@ static void erase_lots(Terminal *term,
 	check_boundary(term, term->curs.x, term->curs.y);
     check_selection(term, start, end);
 
-    /* Clear screen also forces a full window redraw, just in case. */
-    if (start.y == 0 && start.x == 0 && end.y == term->rows)
+    /* Clear screen also forces a full window redraw, just in case.
+     * Except on the alternate screen: clearing that is part of every
+     * full-screen application's startup (xterm mode 1049 erases on
+     * entry), and the subsequent repaint can diff against the still
+     * accurate disptext instead of redrawing every cell. */
+    if (start.y == 0 && start.x == 0 && end.y == term->rows &&
+	!term->alt_which)
 	term_invalidate(term);
 
     /* Lines scrolled away shouldn't be brought back on if the terminal
@@ -2494,6 +3948,22 @@ static void erase_lots(Terminal *term,
 	termline *ldata = scrlineptr(start.y);
 	while (poslt(start, end)) {
             check_line_size(term, ldata);
+	    if (start.x == 0 && end.y > start.y) {
+		/*
+		 * We're erasing this entire line, so do it wholesale:
+		 * one erase_char store per cell, rather than a
+		 * copy_termchar call each. This is the path every
+		 * full-screen application hits when it enters the
+		 * alternate screen.
+		 */
+		int j;
+		for (j = 0; j < term->cols; j++) {
+		    if (ldata->chars[j].cc_next)
+			clear_cc(ldata, j);
+		    ldata->chars[j] = term->erase_char;
+		}
+		start.x = term->cols;  /* fall through to the lattr slot */
+	    }
 	    if (start.x == term->cols) {
 		if (!erase_lattr)
 		    ldata->lattr &= ~(LATTR_WRAPPED | LATTR_WRAPPED2);
@@ -2632,7 +4102,7 @@ static void toggle_mode(Terminal *term, int mode, int query, int state)
 		term_schedule_vbell(term, TRUE, term->rvbell_startpoint);
 	    } else if (!term->rvideo && state) {
 		/* This is an ON, so we notice the time and save it. */
-		term->rvbell_startpoint = GETTICKCOUNT();
+		term->rvbell_startpoint = GETTICKCOUNT_COARSE();
 	    }
 	    term->rvideo = state;
 	    seen_disp_event(term);
@@ -2727,6 +4197,39 @@ static void toggle_mode(Terminal *term, int mode, int query, int state)
 /*
  * Process an OSC sequence: set window title or icon name.
  */
+/*
+ * Query responses (DA, DSR, window reports and so on) are not handed
+ * to the line discipline one at a time: they accumulate here and are
+ * flushed in a single ldisc_send at the end of the term_out() run
+ * that provoked them. TUI applications that poll with bursts of
+ * queries - cursor-position DSR in particular - thus get all their
+ * answers in one write to the channel, instead of one per response.
+ */
+#define REPLYBUF_LIMIT 4096	       /* flush early beyond this */
+
+static void term_reply_flush(Terminal *term)
+{
+    if (term->replybuf_len) {
+	if (term->ldisc)
+	    ldisc_send(term->ldisc, term->replybuf, term->replybuf_len, 0);
+	term->replybuf_len = 0;
+    }
+}
+
+static void term_reply(Terminal *term, const char *data, int len)
+{
+    if (!term->ldisc)
+	return;
+    if (term->replybuf_len + len > term->replybuf_size) {
+	term->replybuf_size = (term->replybuf_len + len) * 5 / 4 + 256;
+	term->replybuf = sresize(term->replybuf, term->replybuf_size, char);
+    }
+    memcpy(term->replybuf + term->replybuf_len, data, len);
+    term->replybuf_len += len;
+    if (term->replybuf_len >= REPLYBUF_LIMIT)
+	term_reply_flush(term);
+}
+
 static void do_osc(Terminal *term)
 {
     if (term->osc_w) {
@@ -2738,29 +4241,41 @@ static void do_osc(Terminal *term)
 	switch (term->esc_args[0]) {
 	  case 0:
 	  case 1:
-	    if (!term->no_remote_wintitle)
-		set_icon(term->frontend, term->osc_string);
+	    if (!term->no_remote_wintitle) {
+		/*
+		 * Don't call set_icon() here and now: status-lines
+		 * in the title can arrive many times a second, and
+		 * on Windows SetWindowText processes messages
+		 * synchronously. Stash the newest value and let
+		 * term_update() apply it, batched like the painting.
+		 */
+		sfree(term->pending_icon);
+		term->pending_icon = dupstr(term->osc_string);
+		term_schedule_update(term);
+	    }
 	    if (term->esc_args[0] == 1)
 		break;
 	    /* fall through: parameter 0 means set both */
 	  case 2:
 	  case 21:
-	    if (!term->no_remote_wintitle)
-		set_title(term->frontend, term->osc_string);
+	    if (!term->no_remote_wintitle) {
+		sfree(term->pending_title);
+		term->pending_title = dupstr(term->osc_string);
+		term_schedule_update(term);
+	    }
 	    break;
           case 4:
             if (term->ldisc && !strcmp(term->osc_string, "?")) {
                 int r, g, b;
                 if (palette_get(term->frontend, toint(term->esc_args[1]),
                                 &r, &g, &b)) {
-                    char *reply_buf = dupprintf(
-                        "\033]4;%u;rgb:%04x/%04x/%04x\007",
-                        term->esc_args[1],
-                        (unsigned)r * 0x0101,
-                        (unsigned)g * 0x0101,
-                        (unsigned)b * 0x0101);
-                    ldisc_send(term->ldisc, reply_buf, strlen(reply_buf), 0);
-                    sfree(reply_buf);
+                    char reply_buf[64];
+                    sprintf(reply_buf, "\033]4;%u;rgb:%04x/%04x/%04x\007",
+                            term->esc_args[1],
+                            (unsigned)r * 0x0101,
+                            (unsigned)g * 0x0101,
+                            (unsigned)b * 0x0101);
+                    term_reply(term, reply_buf, strlen(reply_buf));
                 }
             }
             break;
@@ -2820,15 +4335,157 @@ static void term_print_finish(Terminal *term)
  * in-memory display. There's a big state machine in here to
  * process escape sequences...
  */
+/*
+ * Speculative local echo ("prediction"): when enabled, printable
+ * keystrokes are shown at the cursor position immediately,
+ * underlined to mark them as tentative, without waiting for the
+ * server to echo them back on a slow link. The predictions are a
+ * pure display overlay applied in do_paint() - the screen contents
+ * are never modified - and the whole overlay is discarded as soon as
+ * any real output arrives from the server, which both confirms
+ * correct guesses (the server's echo repaints the same glyphs in the
+ * same cells) and cleanly reverts wrong ones.
+ *
+ * Nothing is displayed, though, until the remote echo has been
+ * confirmed: the first keystrokes of each burst are merely remembered
+ * in predict_pending[], and only once the server has been observed
+ * echoing them back do later keystrokes go up on screen. Server
+ * output that doesn't match the remembered keystrokes - a password
+ * prompt's silence ending in a newline, say - drops the confirmation
+ * again, so input typed at a no-echo prompt (sudo, su and the like)
+ * is never shown.
+ */
+static void term_predict_invalidate(Terminal *term)
+{
+    int row = term->prediction_row - term->disptop;
+    if (row >= 0 && row < term->rows) {
+	int j;
+	for (j = 0; j < term->cols; j++)
+	    term->disptext[row]->chars[j].attr |= ATTR_INVALID;
+	if (term->disprowhash)
+	    term->disprowhash[row] = 0;
+    }
+    term_schedule_update(term);
+}
+
+static void term_predictions_clear(Terminal *term)
+{
+    if (term->n_predictions) {
+	term->n_predictions = 0;
+	term_predict_invalidate(term);
+    }
+}
+
+void term_input_predict(Terminal *term, const char *buf, int len)
+{
+    int i, changed = FALSE;
+
+    if (!term->localecho_predict)
+	return;
+
+    for (i = 0; i < len; i++) {
+	unsigned char c = buf[i];
+	if (c >= 0x20 && c < 0x7F) {
+	    /*
+	     * Every printable keystroke is remembered so that the
+	     * server's echo of it can be recognised when it arrives.
+	     */
+	    if (term->n_predict_pending < TERM_MAX_PREDICTIONS)
+		term->predict_pending[term->n_predict_pending++] = c;
+	    if (!term->predict_confirmed)
+		continue;	       /* remember it, but don't show it */
+	    if (term->n_predictions == 0) {
+		term->prediction_row = term->curs.y;
+		term->prediction_col = term->curs.x;
+	    }
+	    if (term->n_predictions < TERM_MAX_PREDICTIONS &&
+		term->prediction_col + term->n_predictions < term->cols) {
+		term->predictions[term->n_predictions++] = c;
+		changed = TRUE;
+	    }
+	} else if (c == '\010' || c == '\177') {
+	    if (term->n_predict_pending)
+		term->n_predict_pending--;
+	    if (term->n_predictions) {
+		term->n_predictions--;
+		changed = TRUE;
+	    }
+	} else {
+	    /*
+	     * A control character or escape sequence whose effect we
+	     * can't guess: stop predicting and wait for the server.
+	     */
+	    term->n_predict_pending = 0;
+	    if (term->n_predictions) {
+		term->n_predictions = 0;
+		changed = TRUE;
+	    }
+	}
+    }
+    if (changed)
+	term_predict_invalidate(term);
+}
+
 static void term_out(Terminal *term)
 {
     unsigned long c;
     int unget;
     unsigned char localbuf[256], *chars;
     int nchars = 0;
+    int ctrl_clean;
 
     unget = -1;
 
+    /*
+     * True if no printable ASCII byte is remapped to a control
+     * character via unitab_ctrl, which is the usual case; the bulk
+     * fast path below can then classify input a word at a time
+     * instead of consulting the table per byte.
+     */
+    ctrl_clean = TRUE;
+    for (c = 0x20; c < 0x7F; c++)
+	if (term->ucsdata->unitab_ctrl[c] != 0xFF) {
+	    ctrl_clean = FALSE;
+	    break;
+	}
+
+    /*
+     * Real output from the server supersedes any speculative local
+     * echo we were displaying. It also settles the confirmation
+     * state: if the output starts by echoing back the keystrokes we
+     * remembered, the remote end is echoing and later keystrokes in
+     * this burst may be displayed; anything else means it isn't, and
+     * the next burst must earn confirmation afresh.
+     */
+    if (bufchain_size(&term->inbuf) > 0) {
+	if (term->n_predict_pending) {
+	    void *vdata;
+	    const char *data;
+	    int len, n;
+
+	    bufchain_prefix(&term->inbuf, &vdata, &len);
+	    data = (const char *)vdata;
+	    n = 0;
+	    while (n < len && n < term->n_predict_pending &&
+		   data[n] == term->predict_pending[n])
+		n++;
+	    if (n > 0 && (n == len || n == term->n_predict_pending)) {
+		/* Everything comparable matched: that's our echo. */
+		term->predict_confirmed = TRUE;
+		memmove(term->predict_pending, term->predict_pending + n,
+			term->n_predict_pending - n);
+		term->n_predict_pending -= n;
+	    } else {
+		term->predict_confirmed = FALSE;
+		term->n_predict_pending = 0;
+	    }
+	} else {
+	    term->predict_confirmed = FALSE;
+	}
+	if (term->n_predictions)
+	    term_predictions_clear(term);
+    }
+
     chars = NULL;		       /* placate compiler warnings */
     while (nchars > 0 || unget != -1 || bufchain_size(&term->inbuf) > 0) {
 	if (unget == -1) {
@@ -2842,6 +4499,83 @@ static void term_out(Terminal *term)
 		chars = localbuf;
 		assert(chars != NULL);
 	    }
+	    /*
+	     * Fast path for bulk output: if we're in the ordinary
+	     * top-level state with no unusual modes in effect, then a
+	     * run of plain printable ASCII translates to one
+	     * width-one CSET_ASCII cell per byte, and we can blit the
+	     * whole run into the current line in one go rather than
+	     * taking each byte through the full state machine. We
+	     * stop the run short of the last column so that the
+	     * wrapping logic below retains sole charge of the
+	     * right-hand edge.
+	     */
+	    if (term->termstate == TOPLEVEL && !term->printing &&
+		term->curs.x < term->cols - 1 && !term->wrapnext &&
+		!term->insert && term->selstate == NO_SELECTION &&
+		(in_utf(term) ? term->utf_state == 0 :
+		 (!term->sco_acs &&
+		  term->cset_attr[term->cset] == CSET_ASCII))) {
+		int n = 0, limit = term->cols - 1 - term->curs.x;
+		if (limit > nchars)
+		    limit = nchars;
+		/*
+		 * Classify the input a word at a time: a word whose
+		 * bytes are all in [0x20,0x7E] can only extend the
+		 * printable run, so the per-byte loop below need only
+		 * handle the word that ends it. (The standard
+		 * SWAR borrow trick: a byte below 0x20 leaves its own
+		 * top bit set after the subtraction even if a borrow
+		 * propagates into its neighbour, and any byte at or
+		 * above 0x80 fails the first mask outright.)
+		 */
+		if (ctrl_clean) {
+#define REP4(b) (0x01010101U * (b))
+		    while (n + 4 <= limit) {
+			unsigned int v;
+			memcpy(&v, chars + n, sizeof(v));
+			if ((v & REP4(0x80)) != 0 ||
+			    ((v - REP4(0x20)) & REP4(0x80)) != 0 ||
+			    ((((v ^ REP4(0x7F)) - REP4(0x01)) &
+			      ~(v ^ REP4(0x7F)) & REP4(0x80)) != 0))
+			    break;
+			n += 4;
+		    }
+#undef REP4
+		}
+		while (n < limit && chars[n] >= 0x20 && chars[n] < 0x7F &&
+		       term->ucsdata->unitab_ctrl[chars[n]] == 0xFF)
+		    n++;
+		if (n > 1) {
+		    termline *cline = scrlineptr(term->curs.y);
+		    int i;
+
+		    check_boundary(term, term->curs.x, term->curs.y);
+		    check_boundary(term, term->curs.x + n, term->curs.y);
+
+		    for (i = 0; i < n; i++) {
+			if (term->logctx) {
+			    if (term->logtype == LGTYP_DEBUG)
+				logtraffic(term->logctx, chars[i],
+					   LGTYP_DEBUG);
+			    logtraffic(term->logctx, chars[i], LGTYP_ASCII);
+			}
+			/* FULL-TERMCHAR */
+			clear_cc(cline, term->curs.x + i);
+			cline->chars[term->curs.x + i].chr =
+			    chars[i] | CSET_ASCII;
+			cline->chars[term->curs.x + i].attr = term->curr_attr;
+			cline->chars[term->curs.x + i].truecolour =
+			    term->curr_truecolour;
+		    }
+		    term->curs.x += n;
+		    chars += n;
+		    nchars -= n;
+		    seen_disp_event(term);
+		    continue;
+		}
+	    }
+
 	    c = *chars++;
 	    nchars--;
 
@@ -3070,11 +4804,27 @@ static void term_out(Terminal *term)
 		    struct beeptime *newbeep;
 		    unsigned long ticks;
 
-		    ticks = GETTICKCOUNT();
+		    /*
+		     * Coalesce bell storms: the first BEL in each
+		     * paint frame gets the full treatment below, and
+		     * the rest just bump a counter, which
+		     * term_update folds into the overload
+		     * bookkeeping when the frame is painted. A
+		     * catted binary containing millions of BELs thus
+		     * costs one beep and one queue entry per frame
+		     * instead of a malloc and a do_beep each.
+		     */
+		    if (term->bell_frame_count++ > 0) {
+			seen_disp_event(term);
+			break;
+		    }
+
+		    ticks = GETTICKCOUNT_COARSE();
 
 		    if (!term->beep_overloaded) {
 			newbeep = snew(struct beeptime);
 			newbeep->ticks = ticks;
+			newbeep->count = 1;
 			newbeep->next = NULL;
 			if (!term->beephead)
 			    term->beephead = newbeep;
@@ -3092,10 +4842,10 @@ static void term_out(Terminal *term)
 			   term->beephead->ticks < ticks - term->bellovl_t) {
 			struct beeptime *tmp = term->beephead;
 			term->beephead = tmp->next;
-			sfree(tmp);
 			if (!term->beephead)
 			    term->beeptail = NULL;
-			term->nbeeps--;
+			term->nbeeps -= tmp->count;
+			sfree(tmp);
 		    }
 
 		    if (term->bellovl && term->beep_overloaded &&
@@ -3396,6 +5146,59 @@ static void term_out(Terminal *term)
 		    term->esc_nargs = 1;
 		    term->esc_args[0] = ARG_DEFAULT;
 		    term->esc_query = FALSE;
+		    /*
+		     * Fast path for the sequences TUI redraws emit by
+		     * the million (SGR, cursor motion, EL, ED): if the
+		     * whole parameter string is already sitting in the
+		     * lookahead buffer, parse it in one tight scan
+		     * instead of round-tripping every digit through
+		     * the state machine. Only plain digits and
+		     * semicolons are eaten here, and only when the
+		     * final byte is one we recognise; the final byte
+		     * itself is left in the buffer, so dispatch still
+		     * happens through the ordinary SEEN_CSI switch and
+		     * anything unusual (private markers, intermediate
+		     * bytes, overlong argument lists, a sequence split
+		     * across network packets) falls back to the
+		     * general path untouched.
+		     */
+		    if (unget == -1 && nchars > 0 && !term->printing &&
+			!(term->logtype == LGTYP_DEBUG && term->logctx)) {
+			int k, na = 1;
+
+			for (k = 0; k < nchars; k++) {
+			    unsigned char b = chars[k];
+			    if (b >= '0' && b <= '9')
+				continue;
+			    if (b == ';' && ++na <= ARGS_MAX)
+				continue;
+			    break;
+			}
+			if (k > 0 && k < nchars && na <= ARGS_MAX &&
+			    chars[k] >= '@' && chars[k] < 0x7F &&
+			    strchr("mHfKJABCDGd", (char)chars[k])) {
+			    int i;
+			    for (i = 0; i < k; i++) {
+				unsigned char b = chars[i];
+				unsigned *ap =
+				    &term->esc_args[term->esc_nargs - 1];
+				if (b == ';') {
+				    term->esc_args[term->esc_nargs++] =
+					ARG_DEFAULT;
+				} else {
+				    if (*ap == ARG_DEFAULT)
+					*ap = 0;
+				    if (*ap <= UINT_MAX / 10 &&
+					*ap * 10 <= UINT_MAX - b - '0')
+					*ap = 10 * *ap + (b - '0');
+				    else
+					*ap = UINT_MAX;
+				}
+			    }
+			    chars += k;
+			    nchars -= k;
+			}
+		    }
 		    break;
 		  case ']':		/* OSC: xterm escape sequences */
 		    /* Compatibility is nasty here, xterm, linux, decterm yuk! */
@@ -3452,8 +5255,8 @@ static void term_out(Terminal *term)
 		  case 'Z':	       /* DECID: terminal type query */
 		    compatibility(VT100);
 		    if (term->ldisc && term->id_string[0])
-			ldisc_send(term->ldisc, term->id_string,
-				   strlen(term->id_string), 0);
+			term_reply(term, term->id_string,
+				   strlen(term->id_string));
 		    break;
 		  case 'c':	       /* RIS: restore power-on settings */
 		    compatibility(VT100);
@@ -3637,7 +5440,7 @@ static void term_out(Terminal *term)
 			/* this reports xterm version 136 so that VIM can
 			   use the drag messages from the mouse reporting */
 			if (term->ldisc)
-			    ldisc_send(term->ldisc, "\033[>0;136;0c", 11, 0);
+			    term_reply(term, "\033[>0;136;0c", 11);
 			break;
 		      case 'a':		/* HPR: move right N cols */
 			compatibility(ANSI);
@@ -3759,8 +5562,8 @@ static void term_out(Terminal *term)
 			compatibility(VT100);
 			/* This is the response for a VT102 */
 			if (term->ldisc && term->id_string[0])
-			    ldisc_send(term->ldisc, term->id_string,
- 				       strlen(term->id_string), 0);
+			    term_reply(term, term->id_string,
+				       strlen(term->id_string));
 			break;
 		      case 'n':       /* DSR: cursor position query */
 			if (term->ldisc) {
@@ -3768,9 +5571,9 @@ static void term_out(Terminal *term)
 				char buf[32];
 				sprintf(buf, "\033[%d;%dR", term->curs.y + 1,
 					term->curs.x + 1);
-				ldisc_send(term->ldisc, buf, strlen(buf), 0);
+				term_reply(term, buf, strlen(buf));
 			    } else if (term->esc_args[0] == 5) {
-				ldisc_send(term->ldisc, "\033[0n", 4, 0);
+				term_reply(term, "\033[0n", 4);
 			    }
 			}
 			break;
@@ -3788,15 +5591,13 @@ static void term_out(Terminal *term)
 		      case ANSI_QUE('i'):
 			compatibility(VT100);
 			{
-			    char *printer;
 			    if (term->esc_nargs != 1) break;
-			    if (term->esc_args[0] == 5 && 
-				(printer = conf_get_str(term->conf,
-							CONF_printer))[0]) {
+			    if (term->esc_args[0] == 5 &&
+				term->printer[0]) {
 				term->printing = TRUE;
 				term->only_printing = !term->esc_query;
 				term->print_state = 0;
-				term_print_setup(term, printer);
+				term_print_setup(term, term->printer);
 			    } else if (term->esc_args[0] == 4 &&
 				       term->printing) {
 				term_print_finish(term);
@@ -4156,9 +5957,9 @@ static void term_out(Terminal *term)
 				break;
 			      case 11:
 				if (term->ldisc)
-				    ldisc_send(term->ldisc,
+				    term_reply(term,
 					       is_iconic(term->frontend) ?
-					       "\033[2t" : "\033[1t", 4, 0);
+					       "\033[2t" : "\033[1t", 4);
 				break;
 			      case 13:
 				if (term->ldisc) {
@@ -4166,21 +5967,21 @@ static void term_out(Terminal *term)
 				    len = sprintf(buf, "\033[3;%u;%ut",
                                                   (unsigned)x,
                                                   (unsigned)y);
-				    ldisc_send(term->ldisc, buf, len, 0);
+				    term_reply(term, buf, len);
 				}
 				break;
 			      case 14:
 				if (term->ldisc) {
 				    get_window_pixels(term->frontend, &x, &y);
 				    len = sprintf(buf, "\033[4;%d;%dt", y, x);
-				    ldisc_send(term->ldisc, buf, len, 0);
+				    term_reply(term, buf, len);
 				}
 				break;
 			      case 18:
 				if (term->ldisc) {
 				    len = sprintf(buf, "\033[8;%d;%dt",
 						  term->rows, term->cols);
-				    ldisc_send(term->ldisc, buf, len, 0);
+				    term_reply(term, buf, len);
 				}
 				break;
 			      case 19:
@@ -4208,10 +6009,10 @@ static void term_out(Terminal *term)
 				    else
 					p = EMPTY_WINDOW_TITLE;
 				    len = strlen(p);
-				    ldisc_send(term->ldisc, "\033]L", 3, 0);
+				    term_reply(term, "\033]L", 3);
                                     if (len > 0)
-                                        ldisc_send(term->ldisc, p, len, 0);
-				    ldisc_send(term->ldisc, "\033\\", 2, 0);
+                                        term_reply(term, p, len);
+				    term_reply(term, "\033\\", 2);
 				}
 				break;
 			      case 21:
@@ -4222,10 +6023,10 @@ static void term_out(Terminal *term)
 				    else
 					p = EMPTY_WINDOW_TITLE;
 				    len = strlen(p);
-				    ldisc_send(term->ldisc, "\033]l", 3, 0);
+				    term_reply(term, "\033]l", 3);
                                     if (len > 0)
-                                        ldisc_send(term->ldisc, p, len, 0);
-				    ldisc_send(term->ldisc, "\033\\", 2, 0);
+                                        term_reply(term, p, len);
+				    term_reply(term, "\033\\", 2);
 				}
 				break;
 			    }
@@ -4311,7 +6112,7 @@ static void term_out(Terminal *term)
 			    if (i == 0 || i == 1) {
 				strcpy(buf, "\033[2;1;1;112;112;1;0x");
 				buf[2] += i;
-				ldisc_send(term->ldisc, buf, 20, 0);
+				term_reply(term, buf, 20);
 			    }
 			}
 			break;
@@ -4726,7 +6527,7 @@ static void term_out(Terminal *term)
 		    break;
 		  case 'Z':
 		    if (term->ldisc)
-			ldisc_send(term->ldisc, "\033/Z", 3, 0);
+			term_reply(term, "\033/Z", 3);
 		    break;
 		  case '=':
 		    term->app_keypad_keys = TRUE;
@@ -4888,8 +6689,18 @@ static void term_out(Terminal *term)
     }
 
     term_print_flush(term);
+    term_reply_flush(term);
     if (term->logflush && term->logctx)
 	logflush(term->logctx);
+
+    /* Catch up with URL detection on whatever lines this output
+     * touched, once the event loop has a spare moment. */
+    term_schedule_urlscan(term);
+
+    /* Any output may have scrolled lines into the scrollback, shifting
+     * the coordinates of everything already there; the line cache's
+     * keys are scrollback coordinates, so it must go. */
+    line_cache_flush(term);
 }
 
 /*
@@ -4909,7 +6720,18 @@ static void parse_optionalrgb(optionalrgb *out, unsigned *values)
  * To prevent having to run the reasonably tricky bidi algorithm
  * too many times, we maintain a cache of the last lineful of data
  * fed to the algorithm on each line of the display.
+ *
+ * Reordering and shaping depend only on character content, never on
+ * display attributes, so the cache compares cells by chr and
+ * combining chain only. An attribute-only change (recolouring, say)
+ * therefore stays a cache hit; the caller refreshes the attributes
+ * in the cached output line through the stored permutation.
  */
+static int termchars_equal_for_bidi(termchar *a, termchar *b)
+{
+    return a->chr == b->chr && a->cc_next == b->cc_next;
+}
+
 static int term_bidi_cache_hit(Terminal *term, int line,
 			       termchar *lbefore, int width)
 {
@@ -4928,7 +6750,8 @@ static int term_bidi_cache_hit(Terminal *term, int line,
 	return FALSE;		       /* line is wrong width */
 
     for (i = 0; i < width; i++)
-	if (!termchars_equal(term->pre_bidi_cache[line].chars+i, lbefore+i))
+	if (!termchars_equal_for_bidi(term->pre_bidi_cache[line].chars+i,
+				      lbefore+i))
 	    return FALSE;	       /* line doesn't match cache */
 
     return TRUE;		       /* it didn't match. */
@@ -5005,47 +6828,67 @@ static termchar *term_bidi_line(Terminal *term, struct termline *ldata,
 
     /* Do Arabic shaping and bidi. */
     if(!term->bidi || !term->arabicshaping) {
+	int maybe_rtl = FALSE;
+
+	if (term->wcFromTo_size < term->cols) {
+	    term->wcFromTo_size = term->cols;
+	    term->wcFrom = sresize(term->wcFrom, term->wcFromTo_size,
+				   bidi_char);
+	    term->wcTo = sresize(term->wcTo, term->wcFromTo_size,
+				 bidi_char);
+	}
 
-	if (!term_bidi_cache_hit(term, scr_y, ldata->chars, term->cols)) {
+	for(it=0; it<term->cols ; it++)
+	{
+	    unsigned long uc = (ldata->chars[it].chr);
 
-	    if (term->wcFromTo_size < term->cols) {
-		term->wcFromTo_size = term->cols;
-		term->wcFrom = sresize(term->wcFrom, term->wcFromTo_size,
-				       bidi_char);
-		term->wcTo = sresize(term->wcTo, term->wcFromTo_size,
-				     bidi_char);
+	    switch (uc & CSET_MASK) {
+	      case CSET_LINEDRW:
+		if (!term->rawcnp) {
+		    uc = term->ucsdata->unitab_xterm[uc & 0xFF];
+		    break;
+		}
+	      case CSET_ASCII:
+		uc = term->ucsdata->unitab_line[uc & 0xFF];
+		break;
+	      case CSET_SCOACS:
+		uc = term->ucsdata->unitab_scoacs[uc&0xFF];
+		break;
+	    }
+	    switch (uc & CSET_MASK) {
+	      case CSET_ACP:
+		uc = term->ucsdata->unitab_font[uc & 0xFF];
+		break;
+	      case CSET_OEMCP:
+		uc = term->ucsdata->unitab_oemcp[uc & 0xFF];
+		break;
 	    }
 
-	    for(it=0; it<term->cols ; it++)
-	    {
-		unsigned long uc = (ldata->chars[it].chr);
+	    /*
+	     * Note whether this line can engage the bidi or shaping
+	     * algorithms at all. Everything they can reorder or
+	     * reshape -- RTL scripts and the directional control
+	     * characters -- lives at U+0590 and above, and any value
+	     * still carrying a CSET_* tag compares above that too,
+	     * which errs on the safe side.
+	     */
+	    if (uc >= 0x0590)
+		maybe_rtl = TRUE;
 
-		switch (uc & CSET_MASK) {
-		  case CSET_LINEDRW:
-		    if (!term->rawcnp) {
-			uc = term->ucsdata->unitab_xterm[uc & 0xFF];
-			break;
-		    }
-		  case CSET_ASCII:
-		    uc = term->ucsdata->unitab_line[uc & 0xFF];
-		    break;
-		  case CSET_SCOACS:
-		    uc = term->ucsdata->unitab_scoacs[uc&0xFF];
-		    break;
-		}
-		switch (uc & CSET_MASK) {
-		  case CSET_ACP:
-		    uc = term->ucsdata->unitab_font[uc & 0xFF];
-		    break;
-		  case CSET_OEMCP:
-		    uc = term->ucsdata->unitab_oemcp[uc & 0xFF];
-		    break;
-		}
+	    term->wcFrom[it].origwc = term->wcFrom[it].wc =
+		(unsigned int)uc;
+	    term->wcFrom[it].index = it;
+	}
 
-		term->wcFrom[it].origwc = term->wcFrom[it].wc =
-		    (unsigned int)uc;
-		term->wcFrom[it].index = it;
-	    }
+	/*
+	 * A line that can't possibly be affected needs no
+	 * transformation and no cache entry: return the identity
+	 * straight away, so purely LTR sessions pay only this scan.
+	 */
+	if (!maybe_rtl)
+	    return NULL;
+
+	if (!term_bidi_cache_hit(term, scr_y, ldata->chars, term->cols)) {
 
 	    if(!term->bidi)
 		do_bidi(term->wcFrom, term->cols);
@@ -5082,7 +6925,18 @@ static termchar *term_bidi_line(Terminal *term, struct termline *ldata,
 
 	    lchars = term->ltemp;
 	} else {
-	    lchars = term->post_bidi_cache[scr_y].chars;
+	    /*
+	     * Cache hit on character content; the attributes may
+	     * still have changed, so refresh them in the cached
+	     * output line through the stored permutation.
+	     */
+	    struct bidi_cache_entry *post = &term->post_bidi_cache[scr_y];
+	    for (it = 0; it < term->cols; it++) {
+		int p = post->backward[it];
+		post->chars[it].attr = ldata->chars[p].attr;
+		post->chars[it].truecolour = ldata->chars[p].truecolour;
+	    }
+	    lchars = post->chars;
 	}
     } else {
 	lchars = NULL;
@@ -5095,9 +6949,31 @@ static termchar *term_bidi_line(Terminal *term, struct termline *ldata,
  * Given a context, update the window. Out of paranoia, we don't
  * allow WM_PAINT responses to do scrolling optimisations.
  */
+/*
+ * Hash of everything in a termline that can influence how it is
+ * displayed, used by do_paint() to skip whole rows that provably
+ * haven't changed since the last paint. The hash covers the entire
+ * allocated termchar array (so combining characters, which live above
+ * ->cols, are included) plus the line attributes. A return value of 0
+ * is reserved to mean 'no valid hash', so we never generate it.
+ */
+static unsigned long dispstate_hash(termline *ldata)
+{
+    const unsigned int *p = (const unsigned int *)ldata->chars;
+    int n = ldata->size * TSIZE / sizeof(unsigned int);
+    unsigned long h = 2166136261UL;
+
+    while (n-- > 0)
+	h = (h ^ *p++) * 16777619UL;
+    h = (h ^ (unsigned long)ldata->lattr) * 16777619UL;
+    h = (h ^ (unsigned long)ldata->cols) * 16777619UL;
+    return h ? h : 1;
+}
+
 static void do_paint(Terminal *term, Context ctx, int may_optimise)
 {
     int i, j, our_curs_y, our_curs_x;
+    int may_skip_rows;
     int rv, cursor;
     pos scrpos;
     wchar_t *ch;
@@ -5150,6 +7026,18 @@ static void do_paint(Terminal *term, Context ctx, int may_optimise)
 
 	our_curs_x = term->curs.x;
 
+	/*
+	 * If we're displaying speculative local echo, the cursor sits
+	 * after the last predicted character rather than where the
+	 * server last left it.
+	 */
+	if (term->n_predictions && term->curs.y == term->prediction_row &&
+	    our_curs_x == term->prediction_col) {
+	    our_curs_x += term->n_predictions;
+	    if (our_curs_x > term->cols - 1)
+		our_curs_x = term->cols - 1;
+	}
+
 	if ( (lchars = term_bidi_line(term, ldata, our_curs_y)) != NULL) {
 	    our_curs_x = term->post_bidi_cache[our_curs_y].forward[our_curs_x];
 	} else
@@ -5179,6 +7067,8 @@ static void do_paint(Terminal *term, Context ctx, int may_optimise)
 	if (term->dispcursx < term->cols-1 && dispcurs[1].chr == UCSWIDE)
 	    dispcurs[1].attr |= ATTR_INVALID;
 	dispcurs->attr |= ATTR_INVALID;
+	if (term->disprowhash)
+	    term->disprowhash[term->dispcursy] = 0;
 
 	term->curstype = 0;
     }
@@ -5196,12 +7086,46 @@ static void do_paint(Terminal *term, Context ctx, int may_optimise)
     term->scrollhead = term->scrolltail = NULL;
 #endif /* OPTIMISE_SCROLL */
 
+    /*
+     * Decide whether it's safe to skip unchanged rows entirely: every
+     * piece of global state that feeds into the per-cell
+     * transformation below must be the same as at the last paint. The
+     * cursor position is deliberately left out of this hash; instead,
+     * the rows containing the old and new cursor are simply never
+     * skipped.
+     */
+    {
+	unsigned long e = 2166136261UL;
+#define EPOCH_MIX(x) (e = (e ^ (unsigned long)(x)) * 16777619UL)
+	EPOCH_MIX(rv);
+	EPOCH_MIX(term->disptop);
+	EPOCH_MIX(term->attr_mask);
+	EPOCH_MIX(term->ansi_colour);
+	EPOCH_MIX(term->xterm_256_colour);
+	EPOCH_MIX(term->true_colour);
+	EPOCH_MIX(term->blink_is_real && term->has_focus && term->tblinker);
+	EPOCH_MIX(term->selstate == DRAGGING || term->selstate == SELECTED);
+	EPOCH_MIX(term->selstart.x);
+	EPOCH_MIX(term->selstart.y);
+	EPOCH_MIX(term->selend.x);
+	EPOCH_MIX(term->selend.y);
+	EPOCH_MIX(term->seltype == LEXICOGRAPHIC);
+	EPOCH_MIX(term->cols);
+	EPOCH_MIX(term->rows);
+	EPOCH_MIX(term->ucsdata->dbcs_screenfont);
+#undef EPOCH_MIX
+	may_skip_rows = (may_optimise && term->disprowhash &&
+			 e == term->disp_epoch);
+	term->disp_epoch = e;
+    }
+
     /* The normal screen data */
     for (i = 0; i < term->rows; i++) {
 	termline *ldata;
 	termchar *lchars;
 	int dirty_line, dirty_run, selected;
 	unsigned long attr = 0, cset = 0;
+	unsigned long rowhash;
 	int start = 0;
 	int ccount = 0;
 	int last_run_dirty = 0;
@@ -5212,6 +7136,18 @@ static void do_paint(Terminal *term, Context ctx, int may_optimise)
 	scrpos.y = i + term->disptop;
 	ldata = lineptr(scrpos.y);
 
+	/*
+	 * If this row's source line hashes to the same value as when
+	 * it was last painted, and nothing global has changed, there
+	 * is nothing to do for it.
+	 */
+	rowhash = dispstate_hash(ldata);
+	if (may_skip_rows && i != our_curs_y &&
+	    term->disprowhash[i] == rowhash) {
+	    unlineptr(ldata);
+	    continue;
+	}
+
 	/* Do Arabic shaping and bidi. */
 	lchars = term_bidi_line(term, ldata, i);
 	if (lchars) {
@@ -5288,6 +7224,16 @@ static void do_paint(Terminal *term, Context ctx, int may_optimise)
 		tattr &= ~ATTR_BLINK;
 	    }
 
+	    /* Speculative local echo overlay. */
+	    if (term->n_predictions &&
+		i + term->disptop == term->prediction_row &&
+		j >= term->prediction_col &&
+		j < term->prediction_col + term->n_predictions) {
+		tchar = term->predictions[j - term->prediction_col];
+		tattr = (tattr &~ (ATTR_WIDE|ATTR_BOLD|ATTR_BLINK)) |
+		    ATTR_UNDER;
+	    }
+
 	    /*
 	     * Check the font we'll _probably_ be using to see if 
 	     * the character is wide when we don't want it to be.
@@ -5375,7 +7321,7 @@ static void do_paint(Terminal *term, Context ctx, int may_optimise)
 
 	    break_run = ((tattr ^ attr) & term->attr_mask) != 0;
 
-            if (!truecolour_equal(newline[j].truecolour, tc))
+            if (!truecolours_equal(newline[j].truecolour, tc))
                 break_run = TRUE;
 
 #ifdef USES_VTLINE_HACK
@@ -5514,9 +7460,16 @@ static void do_paint(Terminal *term, Context ctx, int may_optimise)
 		do_cursor(ctx, start, i, ch, ccount, attr, ldata->lattr, tc);
 	}
 
+	if (term->disprowhash)
+	    term->disprowhash[i] = rowhash;
+
 	unlineptr(ldata);
     }
 
+#ifdef INPUT_LATENCY_TRACE
+    term_latency_sample(term);
+#endif
+
     sfree(newline);
     sfree(ch);
 }
@@ -5528,9 +7481,14 @@ void term_invalidate(Terminal *term)
 {
     int i, j;
 
-    for (i = 0; i < term->rows; i++)
+    term_idle_wake(term);
+
+    for (i = 0; i < term->rows; i++) {
 	for (j = 0; j < term->cols; j++)
 	    term->disptext[i]->chars[j].attr |= ATTR_INVALID;
+	if (term->disprowhash)
+	    term->disprowhash[i] = 0;
+    }
 
     term_schedule_update(term);
 }
@@ -5542,6 +7500,9 @@ void term_paint(Terminal *term, Context ctx,
 		int left, int top, int right, int bottom, int immediately)
 {
     int i, j;
+
+    term_idle_wake(term);
+
     if (left < 0) left = 0;
     if (top < 0) top = 0;
     if (right >= term->cols) right = term->cols-1;
@@ -5554,6 +7515,8 @@ void term_paint(Terminal *term, Context ctx,
 	else
 	    for (j = left / 2; j <= right / 2 + 1 && j < term->cols; j++)
 		term->disptext[i]->chars[j].attr |= ATTR_INVALID;
+	if (term->disprowhash)
+	    term->disprowhash[i] = 0;
     }
 
     if (immediately) {
@@ -5578,6 +7541,8 @@ void term_scroll(Terminal *term, int rel, int where)
     int shift;
 #endif /* OPTIMISE_SCROLL */
 
+    term_idle_wake(term);
+
     term->disptop = (rel < 0 ? 0 : rel > 0 ? sbtop : term->disptop) + where;
     if (term->disptop < sbtop)
 	term->disptop = sbtop;
@@ -5592,6 +7557,143 @@ void term_scroll(Terminal *term, int rel, int where)
     term_update(term);
 }
 
+/*
+ * Search the scrollback and screen for a string. `start' is a line
+ * index counted downwards from the top of the scrollback (so 0 is the
+ * oldest line we still hold and sblines(term)+term->rows-1 is the
+ * bottom of the screen); the search runs from there towards the
+ * bottom, or towards the top if `backwards' is set. Returns the line
+ * index of the first line containing a match, or -1 if there is none.
+ *
+ * The match is case-insensitive in the ASCII range and will not span
+ * a wrapped line boundary. Lines already compressed into the
+ * scrollback carry a trigram signature (computed by termsearch_sig()
+ * as they are pushed), so most non-matching lines are rejected
+ * without being decompressed at all; only candidate lines are
+ * expanded and scanned in full.
+ */
+int term_search(Terminal *term, const char *needle, int start, int backwards)
+{
+    struct sigstate st;
+    unsigned *norm;
+    int nlen, total, step, v, i;
+
+    nlen = strlen(needle);
+    if (nlen == 0)
+	return -1;
+
+    /*
+     * Normalise the needle the same way termsearch_sig() normalises
+     * line contents, and compute its own trigram signature so we can
+     * screen compressed lines against it.
+     */
+    norm = snewn(nlen, unsigned);
+    st.sig = 0;
+    st.a = st.b = 0;
+    for (i = 0; i < nlen; i++) {
+	norm[i] = termsearch_norm((unsigned char)needle[i]);
+	termsearch_feed(&st, norm[i]);
+    }
+
+    total = sblines(term) + term->rows;
+    if (start < 0)
+	start = 0;
+    if (start >= total)
+	start = total - 1;
+    step = backwards ? -1 : +1;
+
+    for (v = start; v >= 0 && v < total; v += step) {
+	termline *line;
+	int c, found;
+
+	/*
+	 * If this line is in the spill tier or the compressed
+	 * scrollback ring, check its signature first: every trigram
+	 * of the needle must also appear in the line, so a signature
+	 * mismatch means the line cannot contain a match. (A needle
+	 * shorter than three non-blank characters has an empty
+	 * signature, which screens nothing out but is still correct.)
+	 */
+	if (v < term->sbspill.count) {
+	    unsigned long lsig =
+		term->sbspill.sigs[(term->sbspill.head + v) &
+				   (term->sbspill.size - 1)];
+	    if ((lsig & st.sig) != st.sig)
+		continue;
+	} else if (v - term->sbspill.count < term->scrollback.count) {
+	    unsigned long lsig =
+		term->scrollback.sigs[(term->scrollback.head + v -
+				       term->sbspill.count) &
+				      (term->scrollback.size - 1)];
+	    if ((lsig & st.sig) != st.sig)
+		continue;
+	}
+
+	line = lineptr(v - sblines(term));
+	found = FALSE;
+	for (c = 0; c + nlen <= line->cols && !found; c++) {
+	    for (i = 0; i < nlen; i++)
+		if (termsearch_norm(line->chars[c + i].chr) != norm[i])
+		    break;
+	    if (i == nlen)
+		found = TRUE;
+	}
+	unlineptr(line);
+	if (found) {
+	    sfree(norm);
+	    return v;
+	}
+    }
+
+    sfree(norm);
+    return -1;
+}
+
+/*
+ * Find the URL, if any, under the display position (x,y): x in
+ * columns and y in rows from the top of the window, the same
+ * coordinates term_mouse() receives. Returns the URL text as a
+ * dynamically allocated string (for the caller to free), or NULL if
+ * the position isn't on a URL; optionally also reports the columns
+ * the URL occupies on that line, for hover feedback. Screen lines
+ * use the ranges maintained by the incremental scanner (re-scanning
+ * at most the one line if it's still flagged dirty); scrollback
+ * lines are scanned on demand, so only an actual hover or click pays
+ * for them. A URL broken across wrapped lines is reported only up to
+ * the end of the line it starts on.
+ */
+char *term_url_at(Terminal *term, int x, int y, int *startx, int *endx)
+{
+    termline *line;
+    char *ret = NULL;
+    int i;
+
+    if (x < 0 || x >= term->cols || y < 0 || y >= term->rows)
+	return NULL;
+
+    line = lineptr(y + term->disptop);
+    if (line->url_dirty)
+	urlscan_line(line);
+    for (i = 0; i < line->nurls; i++) {
+	if (x >= line->urls[i].start && x < line->urls[i].end) {
+	    int len = line->urls[i].end - line->urls[i].start;
+	    int j;
+	    ret = snewn(len + 1, char);
+	    for (j = 0; j < len; j++)
+		ret[j] = (char)urlscan_char(
+		    line->chars[line->urls[i].start + j].chr);
+	    ret[len] = '\0';
+	    if (startx)
+		*startx = line->urls[i].start;
+	    if (endx)
+		*endx = line->urls[i].end;
+	    break;
+	}
+    }
+    unlineptr(line);
+    return ret;
+}
+
 /*
  * Scroll the scrollback to centre it on the beginning or end of the
  * current selection, if any.
@@ -5656,7 +7758,20 @@ static void clipme(Terminal *term, pos top, pos bottom, int rect, int desel,
     int attr;
     truecolour tc;
 
-    buf.buflen = 5120;			
+    /*
+     * Pre-size the buffer from the selection extent, so that copying
+     * a large scrollback region doesn't repeatedly realloc-and-copy
+     * three parallel arrays on the way up. The estimate is an upper
+     * bound for everything except combining characters and DBCS
+     * expansion, which clip_addchar's doubling still accommodates.
+     */
+    buf.buflen = 5120;
+    if (bottom.y >= top.y) {
+	int nlines = bottom.y - top.y + 1;
+	int perline = term->cols + sel_nl_sz + 2;
+	if (nlines < INT_MAX / perline - 1)
+	    buf.buflen += nlines * perline;
+    }
     buf.bufpos = 0;
     buf.textptr = buf.textbuf = snewn(buf.buflen, wchar_t);
     buf.attrptr = buf.attrbuf = snewn(buf.buflen, int);
@@ -6116,6 +8231,25 @@ static void sel_spread(Terminal *term)
     }
 }
 
+/*
+ * Paste backpressure: if the backend still has this much of our
+ * previous paste data buffered (e.g. because the SSH channel window
+ * is exhausted), stop feeding it more and poll again shortly, rather
+ * than dumping the entire clipboard into the send queue at once.
+ */
+#define PASTE_BACKLOG_LIMIT 16384
+#define PASTE_RETRY_DELAY (TICKSPERSEC / 20)
+#define PASTE_MAX_CHUNK 4096
+
+static void term_paste_callback(void *vterm);
+
+static void term_paste_timer(void *ctx, unsigned long now)
+{
+    Terminal *term = (Terminal *)ctx;
+    if (term->paste_buffer)
+	queue_toplevel_callback(term_paste_callback, term);
+}
+
 static void term_paste_callback(void *vterm)
 {
     Terminal *term = (Terminal *)vterm;
@@ -6123,11 +8257,37 @@ static void term_paste_callback(void *vterm)
     if (term->paste_len == 0)
 	return;
 
+    if (term->ldisc && ldisc_sendbuffer(term->ldisc) > PASTE_BACKLOG_LIMIT) {
+	schedule_timer(PASTE_RETRY_DELAY, term_paste_timer, term);
+	return;
+    }
+
     while (term->paste_pos < term->paste_len) {
 	int n = 0;
-	while (n + term->paste_pos < term->paste_len) {
-	    if (term->paste_buffer[term->paste_pos + n++] == '\015')
-		break;
+	if (term->paste_bracketed) {
+	    /*
+	     * In bracketed paste mode the application at the far end
+	     * has promised to treat the paste as a raw block, so
+	     * there's no local echo to keep up with; send good-sized
+	     * chunks instead of breaking at every newline.
+	     */
+	    n = term->paste_len - term->paste_pos;
+	    if (n > PASTE_MAX_CHUNK)
+		n = PASTE_MAX_CHUNK;
+	} else {
+	    /*
+	     * Send a line at a time, so that local echo and editing
+	     * stay in step - but cap the chunk length, because a
+	     * "line" in a pasted SQL dump can be megabytes long and
+	     * must not be converted and handed to the ldisc in one
+	     * piece (it would be allocated, converted and buffered
+	     * whole, and the window would freeze until it drained).
+	     */
+	    while (n + term->paste_pos < term->paste_len &&
+		   n < PASTE_MAX_CHUNK) {
+		if (term->paste_buffer[term->paste_pos + n++] == '\015')
+		    break;
+	    }
 	}
 	if (term->ldisc)
 	    luni_send(term->ldisc, term->paste_buffer + term->paste_pos, n, 0);
@@ -6160,6 +8320,7 @@ void term_do_paste(Terminal *term, const wchar_t *data, int len)
         sfree(term->paste_buffer);
     term->paste_pos = term->paste_len = 0;
     term->paste_buffer = snewn(len + 12, wchar_t);
+    term->paste_bracketed = term->bracketed_paste;
 
     if (term->bracketed_paste) {
         memcpy(term->paste_buffer, L"\033[200~", 6 * sizeof(wchar_t));
@@ -6573,6 +8734,12 @@ int term_ldisc(Terminal *term, int option)
 int term_data(Terminal *term, int is_stderr, const char *data, int len)
 {
     bufchain_add(&term->inbuf, data, len);
+    term->stat_bytes += len;
+    term_idle_wake(term);
+#ifdef INPUT_LATENCY_TRACE
+    if (term->lat_key_pending)
+	term->lat_echo_seen = TRUE;
+#endif
 
     if (!term->in_term_out) {
 	term->in_term_out = TRUE;
@@ -6582,8 +8749,11 @@ int term_data(Terminal *term, int is_stderr, const char *data, int len)
 	 * because the user will want the screen to hold still to
 	 * be selected.
 	 */
-	if (term->selstate != DRAGGING)
+	if (term->selstate != DRAGGING) {
+	    clock_t t0 = clock();
 	    term_out(term);
+	    term->stat_clocks += clock() - t0;
+	}
 	term->in_term_out = FALSE;
     }
 
@@ -6609,6 +8779,103 @@ int term_data(Terminal *term, int is_stderr, const char *data, int len)
     return 0;
 }
 
+/*
+ * Write the terminal's cumulative statistics to the Event Log. This
+ * is the terminal half of the session-statistics special: comparing
+ * the processor time reported here with the backend's decrypt and
+ * dispatch times shows whether a sluggish session is the terminal
+ * emulation's fault.
+ */
+void term_log_stats(Terminal *term)
+{
+    char *msg;
+
+    msg = dupprintf("Session statistics: terminal processed %lu bytes of "
+		    "output in %.3f s of processor time",
+		    term->stat_bytes,
+		    (double)term->stat_clocks / CLOCKS_PER_SEC);
+    logevent(term->frontend, msg);
+    sfree(msg);
+}
+
+#ifdef INPUT_LATENCY_TRACE
+/*
+ * Optional keystroke-to-paint latency tracing, compiled in with
+ * -DINPUT_LATENCY_TRACE. The line discipline stamps a keystroke as it
+ * passes through ldisc_send(); the first paint after host output has
+ * subsequently arrived is taken to include that keystroke's echo, and
+ * the elapsed GETTICKCOUNT time goes into a millisecond histogram.
+ * Percentiles are written to the Event Log every
+ * LATENCY_REPORT_INTERVAL keystrokes and when the terminal is freed.
+ *
+ * This is deliberately approximate: we only track one outstanding
+ * keystroke at a time (typing ahead of a slow link just measures the
+ * oldest one), and we can't prove the painted cells really were the
+ * echo rather than unrelated output. But it needs no protocol
+ * cooperation, works for both local echo and a server round trip,
+ * and costs one tick-count read per keystroke and per paint, so an
+ * instrumented build is usable as an everyday client.
+ */
+#define LATENCY_REPORT_INTERVAL 1000
+
+static unsigned long term_latency_percentile(Terminal *term, int pct)
+{
+    unsigned long target = (term->lat_samples * pct + 99) / 100, cum = 0;
+    int i;
+
+    for (i = 0; i < 255; i++) {
+	cum += term->lat_buckets[i];
+	if (cum >= target)
+	    return i;
+    }
+    return 255;
+}
+
+static void term_latency_report(Terminal *term)
+{
+    char *msg;
+
+    msg = dupprintf("Input latency: %lu keystrokes; key-to-paint "
+		    "p50 %lu ms, p90 %lu ms, p99 %lu ms%s",
+		    term->lat_samples,
+		    term_latency_percentile(term, 50),
+		    term_latency_percentile(term, 90),
+		    term_latency_percentile(term, 99),
+		    term->lat_buckets[255] ? " (top bucket is >=255ms)" : "");
+    logevent(term->frontend, msg);
+    sfree(msg);
+}
+
+/*
+ * Called from ldisc_send() when an interactive keystroke enters the
+ * input path, to stamp the time it was pressed.
+ */
+void term_latency_keystroke(Terminal *term)
+{
+    if (!term->lat_key_pending) {
+	term->lat_key_pending = TRUE;
+	term->lat_echo_seen = FALSE;
+	term->lat_key_time = GETTICKCOUNT();
+    }
+}
+
+/*
+ * Called at the end of do_paint(): if host output has arrived since
+ * the stamped keystroke, this paint is assumed to contain its echo.
+ */
+static void term_latency_sample(Terminal *term)
+{
+    if (term->lat_key_pending && term->lat_echo_seen) {
+	unsigned long ms = GETTICKCOUNT() - term->lat_key_time;
+
+	term->lat_buckets[ms < 255 ? ms : 255]++;
+	term->lat_key_pending = FALSE;
+	if (++term->lat_samples % LATENCY_REPORT_INTERVAL == 0)
+	    term_latency_report(term);
+    }
+}
+#endif /* INPUT_LATENCY_TRACE */
+
 /*
  * Write untrusted data to the terminal.
  * The only control character that should be honoured is \n (which
@@ -9,11 +9,14 @@
 #ifndef PUTTY_TERMINAL_H
 #define PUTTY_TERMINAL_H
 
+#include <time.h>		       /* for clock_t */
+
 #include "tree234.h"
 
 struct beeptime {
     struct beeptime *next;
     unsigned long ticks;
+    int count;			       /* BELs coalesced into this entry */
 };
 
 typedef struct {
@@ -37,9 +40,17 @@ struct termchar {
      * Any code in terminal.c which definitely needs to be changed
      * when extra fields are added here is labelled with a comment
      * saying FULL-TERMCHAR.
+     *
+     * chr and attr are deliberately 32-bit rather than unsigned
+     * long: every character code (Unicode plus the CSET_* direct
+     * ranges) and every attribute bit (ATTR_*, TATTR_*, DATTR_*)
+     * fits in 32 bits, and on LP64 platforms the narrower fields cut
+     * the size of every screen, alt-screen and display cell by more
+     * than a third. Code that manipulates these values still does so
+     * in unsigned long temporaries, which is harmless.
      */
-    unsigned long chr;
-    unsigned long attr;
+    unsigned int chr;
+    unsigned int attr;
     truecolour truecolour;
 
     /*
@@ -56,6 +67,10 @@ struct termchar {
     int cc_next;
 };
 
+struct urlrange {
+    int start, end;		       /* [start,end) columns of a URL */
+};
+
 struct termline {
     unsigned short lattr;
     int cols;			       /* number of real columns on the line */
@@ -64,27 +79,98 @@ struct termline {
     int temporary;		       /* TRUE if decompressed from scrollback */
     int cc_free;		       /* offset to first cc in free list */
     struct termchar *chars;
+    struct urlrange *urls;	       /* detected URLs, or NULL */
+    int nurls;			       /* number of entries in urls[] */
+    int url_dirty;		       /* modified since the last URL scan */
 };
 
+/*
+ * Size (a power of 2) of the direct-mapped cache of decompressed
+ * scrollback lines consulted by lineptr(); see line_cache_flush() in
+ * terminal.c. Consecutive scrollback coordinates occupy distinct
+ * slots, so as long as this is at least the window height a whole
+ * screenful of scrollback stays resident while the user pages
+ * through it.
+ */
+#define LINECACHE_SIZE 128
+
 struct bidi_cache_entry {
     int width;
     struct termchar *chars;
     int *forward, *backward;	       /* the permutations of line positions */
 };
 
+/*
+ * Circular buffer holding the compressed lines scrolled off the top
+ * of the screen. The scrollback is only ever appended to at one end
+ * and evicted from either end, so a ring of pointers gives us O(1)
+ * for every operation where a tree234 cost O(log n) plus a node
+ * allocation per line.
+ */
+struct scrollback_ring {
+    unsigned char **lines;	       /* circular buffer of compressed lines */
+    unsigned long *sigs;	       /* parallel ring of per-line trigram
+					* signatures, for term_search() */
+    int *lens;			       /* parallel ring of compressed lengths,
+					* so lines can be spilled to disk
+					* without re-parsing them */
+    int head;			       /* index of oldest line in lines[] */
+    int count;			       /* number of lines currently stored */
+    int size;			       /* allocated capacity (power of 2) */
+    size_t bytes;		       /* total compressed bytes held */
+};
+
+/*
+ * On-disk tier below the heap ring: once the ring holds more than a
+ * budgeted number of compressed bytes, the oldest lines are copied
+ * out to an anonymous memory-mapped file (see sbfile_new() et al in
+ * putty.h) and only their offsets and search signatures stay in the
+ * heap. Line data is appended at 'end'; evicting old lines just
+ * advances 'start', and the dead prefix is compacted away when it
+ * comes to dominate the file.
+ */
+struct scrollback_spill {
+    sbfile *file;		       /* NULL until the first spill */
+    unsigned char *data;	       /* current mapping of the file */
+    size_t mapsize;		       /* size of that mapping */
+    size_t start, end;		       /* live byte region within data[] */
+    size_t *offsets;		       /* ring of per-line offsets in data[] */
+    unsigned long *sigs;	       /* ring of per-line trigram signatures */
+    int head;			       /* index of oldest line in offsets[] */
+    int count;			       /* number of lines currently spilled */
+    int size;			       /* allocated capacity (power of 2) */
+    int broken;			       /* spill failed; stay heap-only */
+};
+
 struct terminal_tag {
 
     int compatibility_level;
 
-    tree234 *scrollback;	       /* lines scrolled off top of screen */
+    struct scrollback_ring scrollback; /* lines scrolled off top of screen */
+    struct scrollback_spill sbspill;   /* oldest scrollback, spilled to disk */
     tree234 *screen;		       /* lines on primary screen */
     tree234 *alt_screen;	       /* lines on alternate screen */
+    struct sbarena_block *sb_arena;    /* arena blocks holding compressed
+					  scrollback lines */
+    unsigned char *compbuf;	       /* reusable compressline scratch */
+    int compbuf_size;
+    termline **sbpending;	       /* evicted lines awaiting compression */
+    int sbpending_head;		       /* index of oldest pending line */
+    int sbpending_count, sbpending_size;
+    termline **sbfreelines;	       /* recycled line objects for scroll() */
+    int sbfreelines_count, sbfreelines_size;
+    int sbcompress_scheduled;	       /* callback already queued? */
+    int urlscan_scheduled;	       /* URL-scan callback already queued? */
     int disptop;		       /* distance scrolled back (0 or -ve) */
     int tempsblines;		       /* number of lines of .scrollback that
 					  can be retrieved onto the terminal
 					  ("temporary scrollback") */
 
     termline **disptext;	       /* buffer of text on real screen */
+    unsigned long *disprowhash;	       /* hash of each row's source line at
+					  last paint; 0 forces a repaint */
+    unsigned long disp_epoch;	       /* hash of global display state at
+					  last paint */
     int dispcursx, dispcursy;	       /* location of cursor on real screen */
     int curstype;		       /* type of cursor on real screen */
 
@@ -94,6 +180,7 @@ struct terminal_tag {
     int nbeeps;
     int beep_overloaded;
     long lastbeep;
+    int bell_frame_count;	       /* BELs seen since last paint frame */
 
 #define TTYPE termchar
 #define TSIZE (sizeof(TTYPE))
@@ -147,6 +234,8 @@ struct terminal_tag {
 
     int rows, cols, savelines;
     int has_focus;
+    int win_visible;		       /* window unminimised; when FALSE,
+					* term_update() skips painting */
     int in_vbell;
     long vbell_end;
     int app_cursor_keys, app_keypad_keys, vt52_mode;
@@ -184,6 +273,8 @@ struct terminal_tag {
 #define OSC_STR_MAX 2048
     int osc_strlen;
     char osc_string[OSC_STR_MAX + 1];
+    char *pending_title, *pending_icon; /* most recent OSC title/icon not
+					 * yet handed to the front end */
     int osc_w;
 
     char id_string[1024];
@@ -219,6 +310,15 @@ struct terminal_tag {
     } selmode;
     pos selstart, selend, selanchor;
 
+    /*
+     * Decompressed scrollback lines pinned by lineptr(), direct-mapped
+     * by line coordinate, so that repainting while scrolled back (or
+     * tracking the pointer during a selection drag) re-reads cached
+     * copies instead of decompressing the same lines once per access.
+     */
+    termline *linecache_line[LINECACHE_SIZE];
+    int linecache_y[LINECACHE_SIZE];
+
     short wordness[256];
 
     /* Mask of attributes to pay attention to when painting. */
@@ -226,12 +326,45 @@ struct terminal_tag {
 
     wchar_t *paste_buffer;
     int paste_len, paste_pos;
+    int paste_bracketed;	       /* was bracketed_paste set when this
+					* paste buffer was built? */
+
+    /*
+     * Speculative local echo overlay: printable keystrokes shown at
+     * the cursor position before the server has echoed them back.
+     * The overlay is applied at paint time only - the screen
+     * contents are never modified - and is discarded as soon as any
+     * real output arrives from the server.
+     */
+#define TERM_MAX_PREDICTIONS 64
+    int localecho_predict;	       /* is the feature configured on? */
+    int n_predictions;
+    int prediction_row;		       /* screen row (curs.y coordinates) */
+    int prediction_col;		       /* column of first predicted char */
+    wchar_t predictions[TERM_MAX_PREDICTIONS];
+    /*
+     * Confirmation gating: nothing is displayed until the server has
+     * been seen echoing back earlier keystrokes from the same burst,
+     * so input at a no-echo prompt (password entry) is never shown.
+     * Keystrokes typed while unconfirmed are remembered here and
+     * matched against subsequent server output.
+     */
+    int predict_confirmed;
+    int n_predict_pending;
+    char predict_pending[TERM_MAX_PREDICTIONS];
 
     void (*resize_fn)(void *, int, int);
     void *resize_ctx;
 
     void *ldisc;
 
+    /*
+     * Deferred query responses (DA, DSR, window reports), batched up
+     * during a term_out() run and sent in one ldisc_send at the end.
+     */
+    char *replybuf;
+    int replybuf_len, replybuf_size;
+
     void *frontend;
 
     void *logctx;
@@ -257,11 +390,46 @@ struct terminal_tag {
      */
     int in_term_out;
 
+    /*
+     * Cumulative session statistics, reported by term_log_stats():
+     * how much output the backend has sent us, and how much
+     * processor time we've spent turning it into screen contents.
+     */
+    unsigned long stat_bytes;
+    clock_t stat_clocks;
+
+#ifdef INPUT_LATENCY_TRACE
+    /*
+     * Keystroke-to-paint latency tracing; see the comment above
+     * term_latency_keystroke() in terminal.c.
+     */
+    int lat_key_pending, lat_echo_seen;
+    unsigned long lat_key_time;
+    unsigned long lat_samples;
+    unsigned long lat_buckets[256];
+#endif
+
+    /*
+     * Idle-session memory compaction. Once the terminal has seen no
+     * activity for a while we compress the saved alternate screen,
+     * flush the display-state lines and drop the recycled-line
+     * cache; the first sign of activity rebuilds them all before
+     * anything looks inside.
+     */
+    int idle_compact_pending;	       /* a compaction timer is armed */
+    long next_idle_compact;
+    unsigned long last_activity;
+    int idle_compacted;		       /* structures are currently compacted */
+    unsigned char **alt_compressed;    /* compressed alt screen, or NULL */
+    int alt_compressed_count;
+
     /*
      * We schedule a window update shortly after receiving terminal
      * data. This tracks whether one is currently pending.
      */
     int window_update_pending;
+    int key_update_pending;	       /* expedite next update for echo */
+    int update_delay;		       /* ticks between window updates */
     long next_update;
 
     /*
@@ -319,6 +487,7 @@ struct terminal_tag {
     int no_remote_resize;
     int no_remote_wintitle;
     int no_remote_clearscroll;
+    char *printer;
     int rawcnp;
     int rect_select;
     int remote_qtitle_action;
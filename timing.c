@@ -86,6 +86,17 @@ static int compare_timers(void *av, void *bv)
     return 0;
 }
 
+/*
+ * When scheduling a timer, if some other timer is already due to go
+ * off within this many ticks after the requested time, we snap the
+ * new timer to the same moment so that the two share one wakeup.
+ * Every use of this module is a delay-at-least, so going off a
+ * fraction late is harmless, and grouping wakeups this way keeps an
+ * idle PuTTY (cursor blink, keepalives, winadj probes across many
+ * channels) from waking the CPU separately for each timer.
+ */
+#define TIMER_SLACK (TICKSPERSEC / 50)	/* 20ms */
+
 static int compare_timer_contexts(void *av, void *bv)
 {
     char *a = (char *)av;
@@ -124,6 +135,22 @@ unsigned long schedule_timer(int ticks, timer_fn_t fn, void *ctx)
     if (when - now <= 0)
 	when = now + 1;
 
+    /*
+     * Coalesce with an existing timer due within TIMER_SLACK after
+     * the requested time, if there is one.
+     */
+    {
+	struct timer probe, *nearest;
+
+	probe.fn = NULL;
+	probe.ctx = NULL;
+	probe.now = when;
+	probe.when_set = now;
+	nearest = findrel234(timers, &probe, NULL, REL234_GE);
+	if (nearest && nearest->now - when <= TIMER_SLACK)
+	    when = nearest->now;
+    }
+
     t = snew(struct timer);
     t->fn = fn;
     t->ctx = ctx;
@@ -170,7 +197,14 @@ int run_timers(unsigned long anow, unsigned long *next)
 
     init_timers();
 
-    now = GETTICKCOUNT();
+    /*
+     * The coarse cached clock is good enough to decide which timers
+     * have expired: it was refreshed when the event loop woke up to
+     * call us, and every timer here is a delay-at-least anyway.
+     * schedule_timer still reads the real clock, so arming isn't
+     * affected.
+     */
+    now = GETTICKCOUNT_COARSE();
 
     while (1) {
 	first = (struct timer *)index234(timers, 0);
@@ -49,6 +49,8 @@ typedef struct node234_Tag node234;
 struct tree234_Tag {
     node234 *root;
     cmpfn234 cmp;
+    node234 *nodepool;		       /* spare nodes kept for reuse */
+    int poolsize;
 };
 
 struct node234_Tag {
@@ -58,6 +60,43 @@ struct node234_Tag {
     void *elems[3];
 };
 
+/*
+ * Maximum number of spare nodes kept on a tree's pool. Enough to
+ * absorb the split/merge churn of a busy tree without holding on to
+ * unbounded memory after a large deletion.
+ */
+#define MAXPOOL234 32
+
+/*
+ * Node allocation and freeing go through a small per-tree pool of
+ * spare nodes, so that a tree with heavy add/delete traffic (terminal
+ * scrollback, the SSH channel tree) doesn't go to the allocator for
+ * every node split and merge. Spare nodes are chained through their
+ * kids[0] pointers.
+ */
+static node234 *newnode234(tree234 * t)
+{
+    node234 *n;
+
+    if (t->nodepool) {
+	n = t->nodepool;
+	t->nodepool = n->kids[0];
+	t->poolsize--;
+    } else
+	n = snew(node234);
+    return n;
+}
+
+static void delnode234(tree234 * t, node234 * n)
+{
+    if (t->poolsize < MAXPOOL234) {
+	n->kids[0] = t->nodepool;
+	t->nodepool = n;
+	t->poolsize++;
+    } else
+	sfree(n);
+}
+
 /*
  * Create a 2-3-4 tree.
  */
@@ -67,6 +106,8 @@ tree234 *newtree234(cmpfn234 cmp)
     LOG(("created tree %p\n", ret));
     ret->root = NULL;
     ret->cmp = cmp;
+    ret->nodepool = NULL;
+    ret->poolsize = 0;
     return ret;
 }
 
@@ -86,7 +127,13 @@ static void freenode234(node234 * n)
 
 void freetree234(tree234 * t)
 {
+    node234 *n;
+
     freenode234(t->root);
+    while ((n = t->nodepool) != NULL) {
+	t->nodepool = n->kids[0];
+	sfree(n);
+    }
     sfree(t);
 }
 
@@ -130,7 +177,7 @@ static void *add234_internal(tree234 * t, void *e, int index)
 
     LOG(("adding node %p to tree %p\n", e, t));
     if (t->root == NULL) {
-	t->root = snew(node234);
+	t->root = newnode234(t);
 	t->root->elems[1] = t->root->elems[2] = NULL;
 	t->root->kids[0] = t->root->kids[1] = NULL;
 	t->root->kids[2] = t->root->kids[3] = NULL;
@@ -303,7 +350,7 @@ static void *add234_internal(tree234 * t, void *e, int index)
 	    LOG(("  done\n"));
 	    break;
 	} else {
-	    node234 *m = snew(node234);
+	    node234 *m = newnode234(t);
 	    m->parent = n->parent;
 	    LOG(("  splitting a 4-node; created new node %p\n", m));
 	    /*
@@ -426,7 +473,7 @@ static void *add234_internal(tree234 * t, void *e, int index)
 	}
     } else {
 	LOG(("  root is overloaded, split into two\n"));
-	t->root = snew(node234);
+	t->root = newnode234(t);
 	t->root->kids[0] = left;
 	t->root->counts[0] = lcount;
 	t->root->elems[0] = e;
@@ -801,7 +848,7 @@ static void *delpos234_internal(tree234 * t, int index)
 
 		    n->counts[ki + 1] = countnode234(sub);
 
-		    sfree(sib);
+		    delnode234(t, sib);
 
 		    /*
 		     * That's built the big node in sub. Now we
@@ -826,7 +873,7 @@ static void *delpos234_internal(tree234 * t, int index)
 			LOG(("  shifting root!\n"));
 			t->root = sub;
 			sub->parent = NULL;
-			sfree(n);
+			delnode234(t, n);
 		    }
 		}
 	    }
@@ -845,7 +892,7 @@ static void *delpos234_internal(tree234 * t, int index)
 	 */
 	if (!n->parent && !n->elems[1] && !n->kids[0]) {
 	    LOG(("  removed last element in tree\n"));
-	    sfree(n);
+	    delnode234(t, n);
 	    t->root = NULL;
 	    return retval;
 	}
@@ -940,7 +987,7 @@ static void *delpos234_internal(tree234 * t, int index)
 	    a->counts[3] = b->counts[1];
 	    if (a->kids[3])
 		a->kids[3]->parent = a;
-	    sfree(b);
+	    delnode234(t, b);
 	    n->counts[ei] = countnode234(a);
 	    /*
 	     * That's built the big node in a, and destroyed b. Now
@@ -963,7 +1010,7 @@ static void *delpos234_internal(tree234 * t, int index)
 		LOG(("  shifting root!\n"));
 		t->root = a;
 		a->parent = NULL;
-		sfree(n);
+		delnode234(t, n);
 	    }
 	    /*
 	     * Now go round the deletion process again, with n
@@ -988,6 +1035,92 @@ void *del234(tree234 * t, void *e)
     return delpos234_internal(t, index);	/* it's there; delete it. */
 }
 
+/*
+ * Iterators. The cursor records the path from the root to the
+ * current position: nodes[i] is a node and child[i] is a position
+ * within it. For forward iteration, child[i] is the index of the
+ * next element of that node still to be returned (the subtrees left
+ * of it are finished with); for backward iteration it's the index
+ * one beyond the next element to be returned. So a cursor started
+ * with first234 must be advanced only with next234, and one started
+ * with last234 only with prev234.
+ */
+
+/*
+ * Push n and then its leftmost descendants on to the cursor's path.
+ */
+static void iterdescendleft234(iter234 * it, node234 * n)
+{
+    while (n) {
+	assert(it->depth < (int)(sizeof(it->nodes) / sizeof(*it->nodes)));
+	it->nodes[it->depth] = n;
+	it->child[it->depth] = 0;
+	it->depth++;
+	n = n->kids[0];
+    }
+}
+
+/*
+ * Push n and then its rightmost descendants on to the cursor's path.
+ */
+static void iterdescendright234(iter234 * it, node234 * n)
+{
+    while (n) {
+	int ne = (n->elems[2] ? 3 : n->elems[1] ? 2 : 1);
+	assert(it->depth < (int)(sizeof(it->nodes) / sizeof(*it->nodes)));
+	it->nodes[it->depth] = n;
+	it->child[it->depth] = ne;
+	it->depth++;
+	n = n->kids[ne];
+    }
+}
+
+void *first234(tree234 * t, iter234 * it)
+{
+    it->depth = 0;
+    iterdescendleft234(it, t->root);
+    return next234(it);
+}
+
+void *next234(iter234 * it)
+{
+    while (it->depth > 0) {
+	node234 *n = it->nodes[it->depth - 1];
+	int ci = it->child[it->depth - 1];
+	if (ci < 3 && n->elems[ci]) {
+	    void *e = n->elems[ci];
+	    it->child[it->depth - 1] = ci + 1;
+	    iterdescendleft234(it, n->kids[ci + 1]);
+	    return e;
+	}
+	it->depth--;		       /* this node is finished with */
+    }
+    return NULL;
+}
+
+void *last234(tree234 * t, iter234 * it)
+{
+    it->depth = 0;
+    iterdescendright234(it, t->root);
+    return prev234(it);
+}
+
+void *prev234(iter234 * it)
+{
+    while (it->depth > 0) {
+	node234 *n = it->nodes[it->depth - 1];
+	int ci = it->child[it->depth - 1];
+	if (ci > 0) {
+	    void *e = n->elems[ci - 1];
+	    it->child[it->depth - 1] = ci - 1;
+	    iterdescendright234(it, n->kids[ci - 1]);
+	    return e;
+	}
+	it->depth--;		       /* this node is finished with */
+    }
+    return NULL;
+}
+
 #ifdef TEST
 
 /*
@@ -1193,6 +1326,33 @@ void verify(void)
 	error("tree really contains %d elements, count234 gave %d",
 	      ctx.elemcount, i);
     }
+    /*
+     * Enumerate the tree with a cursor, in both directions, and
+     * ensure that matches the array too.
+     */
+    {
+	iter234 it;
+	for (i = 0, p = first234(tree, &it); p; i++, p = next234(&it)) {
+	    if (i >= arraylen || array[i] != p)
+		error("forward cursor at position %d: array says %s,"
+		      " tree says %s", i,
+		      i >= arraylen ? "<none>" : array[i], p);
+	}
+	if (i != arraylen) {
+	    error("forward cursor gave only %d elements, array has %d",
+		  i, arraylen);
+	}
+	for (i = arraylen, p = last234(tree, &it); p; p = prev234(&it)) {
+	    i--;
+	    if (i < 0 || array[i] != p)
+		error("backward cursor at position %d: array says %s,"
+		      " tree says %s", i, i < 0 ? "<none>" : array[i], p);
+	}
+	if (i != 0) {
+	    error("backward cursor gave only %d elements, array has %d",
+		  arraylen - i, arraylen);
+	}
+    }
 }
 
 void internal_addtest(void *elem, int index, void *realret)
@@ -157,4 +157,35 @@ void *delpos234(tree234 * t, int index);
  */
 int count234(tree234 * t);
 
+/*
+ * Iterator ("cursor") for cheap sequential access to a tree. Each
+ * call to index234 re-descends from the root, so iterating a whole
+ * tree that way costs O(N log N); a cursor remembers its path down
+ * the tree and visits all N elements in O(N) total.
+ *
+ * Usage:
+ *
+ *   iter234 it;
+ *   for (p = first234(tree, &it); p != NULL; p = next234(&it))
+ *       consume(p);
+ *
+ * or last234/prev234 to iterate backwards. A cursor must be used in
+ * only one direction from where it was started, and is invalidated
+ * by any modification to the tree.
+ *
+ * The structure contents are private to tree234.c; it's defined here
+ * only so that iterators can live on the caller's stack. 32 levels
+ * is enough for any tree whose element count fits in an int.
+ */
+typedef struct {
+    void *nodes[32];		       /* path of nodes from the root */
+    int child[32];		       /* position within each node */
+    int depth;
+} iter234;
+
+void *first234(tree234 * t, iter234 * it);
+void *next234(iter234 * it);
+void *last234(tree234 * t, iter234 * it);
+void *prev234(iter234 * it);
+
 #endif				/* TREE234_H */
@@ -76,6 +76,7 @@ gboolean fd_input_func(GIOChannel *source, GIOCondition condition,
                        gpointer data)
 {
     int sourcefd = g_io_channel_unix_get_fd(source);
+    tickcount_cache_refresh();
     /*
      * We must process exceptional notifications before ordinary
      * readability ones, or we may go straight past the urgent
@@ -93,6 +94,7 @@ gboolean fd_input_func(GIOChannel *source, GIOCondition condition,
 #else
 void fd_input_func(gpointer data, gint sourcefd, GdkInputCondition condition)
 {
+    tickcount_cache_refresh();
     if (condition & GDK_INPUT_EXCEPTION)
         select_result(sourcefd, 4);
     if (condition & GDK_INPUT_READ)
@@ -148,6 +150,8 @@ static gint timer_trigger(gpointer data)
     unsigned long next, then;
     long ticks;
 
+    tickcount_cache_refresh();
+
     /*
      * Destroy the timer we got here on.
      */
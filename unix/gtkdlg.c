@@ -3776,8 +3776,7 @@ struct eventlog_stuff {
     struct Shortcuts scs;
     struct dlgparam dp;
     union control *listctrl;
-    char **events;
-    int nevents, negsize;
+    struct eventring *events;
     char *seldata;
     int sellen;
     int ignore_selchange;
@@ -3809,8 +3808,10 @@ static void eventlog_list_handler(union control *ctrl, void *dlg,
 
 	dlg_update_start(ctrl, dlg);
 	dlg_listbox_clear(ctrl, dlg);
-	for (i = 0; i < es->nevents; i++) {
-	    dlg_listbox_add(ctrl, dlg, es->events[i]);
+	if (es->events) {
+	    for (i = 0; i < eventring_count(es->events); i++) {
+		dlg_listbox_add(ctrl, dlg, eventring_get(es->events, i));
+	    }
 	}
 	dlg_update_done(ctrl, dlg);
     } else if (event == EVENT_SELCHANGE) {
@@ -3832,16 +3833,17 @@ static void eventlog_list_handler(union control *ctrl, void *dlg,
         sfree(es->seldata);
         es->seldata = NULL;
         es->sellen = 0;
-        for (i = 0; i < es->nevents; i++) {
+        for (i = 0; i < eventring_count(es->events); i++) {
             if (dlg_listbox_issel(ctrl, dlg, i)) {
-                int extralen = strlen(es->events[i]);
+                const char *event = eventring_get(es->events, i);
+                int extralen = strlen(event);
 
                 if (es->sellen + extralen + 2 > selsize) {
                     selsize = es->sellen + extralen + 512;
                     es->seldata = sresize(es->seldata, selsize, char);
                 }
 
-                strcpy(es->seldata + es->sellen, es->events[i]);
+                strcpy(es->seldata + es->sellen, event);
                 es->sellen += extralen;
                 es->seldata[es->sellen++] = '\n';
             }
@@ -3990,25 +3992,25 @@ void *eventlogstuff_new(void)
 void logevent_dlg(void *estuff, const char *string)
 {
     struct eventlog_stuff *es = (struct eventlog_stuff *)estuff;
+    int discarded;
 
-    char timebuf[40];
-    struct tm tm;
-
-    if (es->nevents >= es->negsize) {
-	es->negsize += 64;
-	es->events = sresize(es->events, es->negsize, char *);
-    }
+    if (!es->events)
+	es->events = eventring_new();
 
-    tm=ltime();
-    strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S\t", &tm);
+    discarded = eventring_discarded(es->events);
+    eventring_add(es->events, string);
 
-    es->events[es->nevents] = snewn(strlen(timebuf) + strlen(string) + 1, char);
-    strcpy(es->events[es->nevents], timebuf);
-    strcat(es->events[es->nevents], string);
     if (es->window) {
-	dlg_listbox_add(es->listctrl, &es->dp, es->events[es->nevents]);
+	/*
+	 * Keep the open dialog in step with the ring: if the new
+	 * entry pushed an old one out, drop the top listbox item too.
+	 */
+	if (eventring_discarded(es->events) > discarded)
+	    dlg_listbox_del(es->listctrl, &es->dp, 0);
+	dlg_listbox_add(es->listctrl, &es->dp,
+			eventring_get(es->events,
+				      eventring_count(es->events) - 1));
     }
-    es->nevents++;
 }
 
 int askappend(void *frontend, Filename *filename,
@@ -1312,6 +1312,18 @@ static char *pangofont_scale_fontname(GtkWidget *widget, const char *name,
 				      int size);
 static char *pangofont_size_increment(unifont *font, int increment);
 
+#ifdef DRAW_TEXT_CAIRO
+struct pango_cached_glyph {
+    cairo_surface_t *surface;          /* A8 alpha mask; NULL if blank */
+    int inkx, inky, inkw, inkh;        /* ink extents, relative to the
+                                        * layout origin */
+    int logwidth, logheight;           /* logical extents, for centring */
+    unsigned index;                    /* our slot in the cache array, so
+                                        * that eviction can clear it */
+    struct pango_cached_glyph *prev, *next;   /* LRU list links */
+};
+#endif
+
 struct pangofont {
     struct unifont u;
     /*
@@ -1334,6 +1346,23 @@ struct pangofont {
      */
     int *widthcache;
     unsigned nwidthcache;
+#ifdef DRAW_TEXT_CAIRO
+    /*
+     * Cache of rendered glyph images for the Cairo drawing path,
+     * indexed by (code point * 2 + boldness). Laying out even a
+     * single character through Pango means a full itemise-and-shape
+     * pass, which dominates the cost of a redraw; so once we've
+     * rendered a glyph we keep its alpha mask and just composite it
+     * thereafter, the same way the server-side font code keeps the
+     * bitmaps it downloads. Unlike that code we can't bound the
+     * index space at 2^16, so the entries also live on an LRU list
+     * and we evict the stalest once there are too many.
+     */
+    struct pango_cached_glyph **glyphcache;
+    unsigned nglyphcache;
+    struct pango_cached_glyph *glyph_lru_head, *glyph_lru_tail;
+    int nglyphs_cached;
+#endif
 };
 
 static const struct unifont_vtable pangofont_vtable = {
@@ -1461,6 +1490,12 @@ static unifont *pangofont_create_internal(GtkWidget *widget,
     pfont->shadowalways = shadowalways;
     pfont->widthcache = NULL;
     pfont->nwidthcache = 0;
+#ifdef DRAW_TEXT_CAIRO
+    pfont->glyphcache = NULL;
+    pfont->nglyphcache = 0;
+    pfont->glyph_lru_head = pfont->glyph_lru_tail = NULL;
+    pfont->nglyphs_cached = 0;
+#endif
 
     pango_font_metrics_unref(metrics);
 
@@ -1513,6 +1548,16 @@ static unifont *pangofont_create_fallback(GtkWidget *widget, int height,
 static void pangofont_destroy(unifont *font)
 {
     struct pangofont *pfont = (struct pangofont *)font;
+#ifdef DRAW_TEXT_CAIRO
+    while (pfont->glyph_lru_head) {
+        struct pango_cached_glyph *pcg = pfont->glyph_lru_head;
+        pfont->glyph_lru_head = pcg->next;
+        if (pcg->surface)
+            cairo_surface_destroy(pcg->surface);
+        sfree(pcg);
+    }
+    sfree(pfont->glyphcache);
+#endif
     pango_font_description_free(pfont->desc);
     sfree(pfont->widthcache);
     g_object_unref(pfont->fset);
@@ -1569,6 +1614,137 @@ static void pango_cairo_draw_layout(unifont_drawctx *ctx,
     cairo_move_to(ctx->u.cairo.cr, x, y);
     pango_cairo_show_layout(ctx->u.cairo.cr, layout);
 }
+
+/*
+ * Cap on the number of glyph images cached per pangofont. At a
+ * typical terminal font size each entry is a few hundred bytes of
+ * alpha mask, so this bounds the cache at a megabyte or two even if
+ * the session cycles through a lot of exotic Unicode.
+ */
+#define PANGO_GLYPH_CACHE_MAX 4096
+
+static void pangofont_cairo_glyph_used(struct pangofont *pfont,
+                                       struct pango_cached_glyph *pcg)
+{
+    if (pfont->glyph_lru_head == pcg)
+        return;
+
+    /* Unlink from wherever we currently are in the LRU list (which
+     * may be nowhere, if we've only just been created). */
+    if (pcg->prev)
+        pcg->prev->next = pcg->next;
+    if (pcg->next)
+        pcg->next->prev = pcg->prev;
+    else if (pfont->glyph_lru_tail == pcg)
+        pfont->glyph_lru_tail = pcg->prev;
+
+    /* Relink at the head. */
+    pcg->prev = NULL;
+    pcg->next = pfont->glyph_lru_head;
+    if (pcg->next)
+        pcg->next->prev = pcg;
+    pfont->glyph_lru_head = pcg;
+    if (!pfont->glyph_lru_tail)
+        pfont->glyph_lru_tail = pcg;
+}
+
+static void pangofont_cairo_glyph_evict(struct pangofont *pfont)
+{
+    struct pango_cached_glyph *pcg = pfont->glyph_lru_tail;
+
+    pfont->glyph_lru_tail = pcg->prev;
+    if (pcg->prev)
+        pcg->prev->next = NULL;
+    else
+        pfont->glyph_lru_head = NULL;
+
+    pfont->glyphcache[pcg->index] = NULL;
+    if (pcg->surface)
+        cairo_surface_destroy(pcg->surface);
+    sfree(pcg);
+    pfont->nglyphs_cached--;
+}
+
+static struct pango_cached_glyph *pangofont_cairo_cache_glyph(
+    struct pangofont *pfont, PangoLayout *layout,
+    const char *utfptr, int clen, unsigned glyphindex)
+{
+    struct pango_cached_glyph *pcg;
+    PangoRectangle ink, logical;
+
+    if (glyphindex >= pfont->nglyphcache) {
+        /* Round up to the next multiple of 256 on the general
+         * principle that Unicode characters come in contiguous blocks
+         * often used together */
+        unsigned newsize = (glyphindex + 0x100) & ~(unsigned)0xFF;
+        pfont->glyphcache = sresize(pfont->glyphcache, newsize,
+                                    struct pango_cached_glyph *);
+        while (pfont->nglyphcache < newsize)
+            pfont->glyphcache[pfont->nglyphcache++] = NULL;
+    }
+
+    if (pfont->nglyphs_cached >= PANGO_GLYPH_CACHE_MAX)
+        pangofont_cairo_glyph_evict(pfont);
+
+    pango_layout_set_text(layout, utfptr, clen);
+    pango_layout_get_pixel_extents(layout, &ink, &logical);
+
+    pcg = snew(struct pango_cached_glyph);
+    pcg->inkx = ink.x;
+    pcg->inky = ink.y;
+    pcg->inkw = ink.width;
+    pcg->inkh = ink.height;
+    pcg->logwidth = logical.width;
+    pcg->logheight = logical.height;
+    pcg->index = glyphindex;
+    pcg->prev = pcg->next = NULL;
+
+    if (ink.width > 0 && ink.height > 0) {
+        /* Render the glyph once, into an alpha-only image surface
+         * just big enough for its ink extents. */
+        cairo_t *cr;
+        pcg->surface = cairo_image_surface_create(CAIRO_FORMAT_A8,
+                                                  ink.width, ink.height);
+        cr = cairo_create(pcg->surface);
+        cairo_set_source_rgba(cr, 0, 0, 0, 1);
+        cairo_move_to(cr, -ink.x, -ink.y);
+        pango_cairo_show_layout(cr, layout);
+        cairo_destroy(cr);
+        cairo_surface_flush(pcg->surface);
+    } else {
+        /* Nothing visible (e.g. a space); cache that fact too, so we
+         * don't re-shape it every time. */
+        pcg->surface = NULL;
+    }
+
+    pfont->glyphcache[glyphindex] = pcg;
+    pfont->nglyphs_cached++;
+    pangofont_cairo_glyph_used(pfont, pcg);
+
+    return pcg;
+}
+
+static void pangofont_cairo_draw_glyph(unifont_drawctx *ctx,
+                                       struct pangofont *pfont,
+                                       struct pango_cached_glyph *pcg,
+                                       int x, int y, int cellwidth,
+                                       int shadowbold)
+{
+    int ox, oy;
+
+    if (!pcg->surface)
+        return;
+
+    /* Centre the logical rectangle in the cell, exactly as the
+     * uncached path below does, then offset to the ink origin. */
+    ox = x + (cellwidth - pcg->logwidth)/2 + pcg->inkx;
+    oy = y + (pfont->u.height - pcg->logheight)/2 + pcg->inky;
+
+    cairo_mask_surface(ctx->u.cairo.cr, pcg->surface, ox, oy);
+    if (shadowbold)
+        cairo_mask_surface(ctx->u.cairo.cr, pcg->surface,
+                           ox + pfont->shadowoffset, oy);
+}
 #endif
 
 static void pangofont_draw_internal(unifont_drawctx *ctx, unifont *font,
@@ -1671,6 +1847,42 @@ static void pangofont_draw_internal(unifont_drawctx *ctx, unifont *font,
                 clen++;
             n = 1;
 
+#ifdef DRAW_TEXT_CAIRO
+            if (ctx->type == DRAWTYPE_CAIRO &&
+                !is_rtl(string[0]) &&
+                pangofont_char_width(layout, pfont, string[0],
+                                     utfptr, clen) == desired) {
+                /*
+                 * In Cairo mode, the common case of a normal-width
+                 * left-to-right character comes out of the rendered
+                 * glyph cache: one composite per cell, and no
+                 * per-character round trip through Pango's shaping
+                 * machinery at all once the glyph has been seen.
+                 */
+                unsigned glyphindex = 2 * (unsigned)string[0] +
+                    (bold > pfont->bold && !shadowbold);
+                struct pango_cached_glyph *pcg;
+
+                if (glyphindex < pfont->nglyphcache &&
+                    pfont->glyphcache[glyphindex]) {
+                    pcg = pfont->glyphcache[glyphindex];
+                    pangofont_cairo_glyph_used(pfont, pcg);
+                } else {
+                    pcg = pangofont_cairo_cache_glyph(pfont, layout,
+                                                      utfptr, clen,
+                                                      glyphindex);
+                }
+                pangofont_cairo_draw_glyph(ctx, pfont, pcg, x, y,
+                                           cellwidth, shadowbold);
+
+                utflen -= clen;
+                utfptr += clen;
+                string++;
+                x += cellwidth;
+                continue;
+            }
+#endif
+
             if (is_rtl(string[0]) ||
                 pangofont_char_width(layout, pfont, string[n-1],
                                      utfptr, clen) != desired) {
@@ -2165,10 +2377,27 @@ static void multifont_draw_combining(unifont_drawctx *ctx, unifont *font,
 static void multifont_destroy(unifont *font);
 static char *multifont_size_increment(unifont *font, int increment);
 
+/*
+ * Cache of per-codepoint has_glyph() results, so that mixed-script
+ * output doesn't re-probe the main font (which for X11 fonts means a
+ * charset conversion and glyph table lookup per character) on every
+ * repaint. Direct-mapped by the low bits of the codepoint; terminal
+ * output tends to use a small working set of codepoints, so
+ * collisions are rare and just cost a re-probe.
+ */
+#define MULTIFONT_GLYPH_CACHE_SIZE 1024 /* must be a power of 2 */
+
+struct multifont_glyph_cache_entry {
+    wchar_t ch;
+    unsigned char ok;                  /* does the main font have it? */
+    unsigned char valid;
+};
+
 struct multifont {
     struct unifont u;
     unifont *main;
     unifont *fallback;
+    struct multifont_glyph_cache_entry glyphcache[MULTIFONT_GLYPH_CACHE_SIZE];
 };
 
 static const struct unifont_vtable multifont_vtable = {
@@ -2226,6 +2455,7 @@ unifont *multifont_create(GtkWidget *widget, const char *name,
     mfont->u.preferred_drawtype = font->preferred_drawtype;
     mfont->main = font;
     mfont->fallback = fallback;
+    memset(mfont->glyphcache, 0, sizeof(mfont->glyphcache));
 
     return (unifont *)mfont;
 }
@@ -2244,6 +2474,19 @@ typedef void (*unifont_draw_func_t)(unifont_drawctx *ctx, unifont *font,
                                     int len, int wide, int bold,
                                     int cellwidth);
 
+static int multifont_has_glyph_cached(struct multifont *mfont, wchar_t ch)
+{
+    struct multifont_glyph_cache_entry *ent =
+        &mfont->glyphcache[ch & (MULTIFONT_GLYPH_CACHE_SIZE - 1)];
+
+    if (!ent->valid || ent->ch != ch) {
+        ent->ch = ch;
+        ent->ok = mfont->main->vt->has_glyph(mfont->main, ch) ? 1 : 0;
+        ent->valid = 1;
+    }
+    return ent->ok;
+}
+
 static void multifont_draw_main(unifont_drawctx *ctx, unifont *font, int x,
                                 int y, const wchar_t *string, int len,
                                 int wide, int bold, int cellwidth,
@@ -2258,10 +2501,10 @@ static void multifont_draw_main(unifont_drawctx *ctx, unifont *font, int x,
          * Find a maximal sequence of characters which are, or are
          * not, supported by our main font.
          */
-        ok = mfont->main->vt->has_glyph(mfont->main, string[0]);
+        ok = multifont_has_glyph_cached(mfont, string[0]);
         for (i = 1;
              i < len &&
-             !mfont->main->vt->has_glyph(mfont->main, string[i]) == !ok;
+             !multifont_has_glyph_cached(mfont, string[i]) == !ok;
              i++);
 
         /*
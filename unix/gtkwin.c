@@ -190,9 +190,25 @@ static void cache_conf_values(struct gui_data *inst)
 #endif
 }
 
+/*
+ * Damage accumulated over the lifetime of one drawing context (i.e.
+ * one frame of terminal repainting). Rather than pushing every text
+ * run to the window as its own update rectangle, we collect the
+ * rectangles here - merging runs that extend the previous rectangle,
+ * which catches the common left-to-right sweep along a line - and
+ * submit the batch once when the context is freed.
+ */
+#define DRAW_DAMAGE_MAX 16
+
+struct draw_damage_rect {
+    int x, y, w, h;
+};
+
 struct draw_ctx {
     struct gui_data *inst;
     unifont_drawctx uctx;
+    struct draw_damage_rect damage[DRAW_DAMAGE_MAX];
+    int ndamage;
 };
 
 static int send_raw_mouse;
@@ -620,6 +636,7 @@ static void show_mouseptr(struct gui_data *inst, int show)
 }
 
 static void draw_backing_rect(struct gui_data *inst);
+static void draw_update_flush(struct draw_ctx *dctx);
 
 gint configure_area(GtkWidget *widget, GdkEventConfigure *event, gpointer data)
 {
@@ -2374,6 +2391,18 @@ gint focus_event(GtkWidget *widget, GdkEventFocus *event, gpointer data)
     return FALSE;
 }
 
+#if GTK_CHECK_VERSION(2,0,0)
+gint window_state_event(GtkWidget *widget, GdkEventWindowState *event,
+			gpointer data)
+{
+    struct gui_data *inst = (struct gui_data *)data;
+    if (event->changed_mask & GDK_WINDOW_STATE_ICONIFIED)
+	term_set_visible(inst->term, !(event->new_window_state &
+				       GDK_WINDOW_STATE_ICONIFIED));
+    return FALSE;
+}
+#endif
+
 void set_busy_status(void *frontend, int status)
 {
     struct gui_data *inst = (struct gui_data *)frontend;
@@ -2660,6 +2689,41 @@ static struct clipboard_state *clipboard_from_atom(
     return NULL;
 }
 
+/*
+ * Convert a wide string into a NUL-terminated UTF-8 paste buffer
+ * (the NUL is not counted in *outlen). We convert in fixed-size
+ * blocks, rather than allocating the worst-case len*6 bytes up
+ * front: for a multi-megabyte selection the worst case is vastly
+ * larger than the real output. charset_from_unicode stops cleanly at
+ * the last whole character that fits, so we just keep growing the
+ * buffer and resuming where it left off.
+ */
+static char *utf8_from_wide(const wchar_t *data, int len, int *outlen)
+{
+    const wchar_t *tmp = data;
+    int tmplen = len;
+    char *buf = NULL;
+    int buflen = 0, bufsize = 0;
+
+    while (tmplen > 0) {
+        int ret;
+        if (buflen + 65536 > bufsize) {
+            bufsize = (buflen + 65536) * 5 / 4;
+            buf = sresize(buf, bufsize, char);
+        }
+        ret = charset_from_unicode(&tmp, &tmplen, buf + buflen,
+                                   bufsize - buflen,
+                                   CS_UTF8, NULL, NULL, 0);
+        if (ret <= 0)
+            break;                     /* shouldn't happen, but be safe */
+        buflen += ret;
+    }
+    buf = sresize(buf, buflen + 1, char);
+    buf[buflen] = '\0';
+    *outlen = buflen;
+    return buf;
+}
+
 #ifdef JUST_USE_GTK_CLIPBOARD_UTF8
 
 /* ----------------------------------------------------------------------
@@ -2747,18 +2811,12 @@ void write_clip(void *frontend, int clipboard,
     cdi = snew(struct clipboard_data_instance);
     cdi->state = state;
     state->current_cdi = cdi;
-    cdi->pasteout_data_utf8 = snewn(len*6, char);
+    cdi->pasteout_data_utf8 =
+        utf8_from_wide(data, len, &cdi->pasteout_data_utf8_len);
     cdi->prev = inst->cdi_headtail.prev;
     cdi->next = &inst->cdi_headtail;
     cdi->next->prev = cdi;
     cdi->prev->next = cdi;
-    {
-        const wchar_t *tmp = data;
-        int tmplen = len;
-        cdi->pasteout_data_utf8_len =
-            charset_from_unicode(&tmp, &tmplen, cdi->pasteout_data_utf8,
-                                 len*6, CS_UTF8, NULL, NULL, 0);
-    }
 
     /*
      * It would be nice to just call gtk_clipboard_set_text() in place
@@ -2886,28 +2944,17 @@ void write_clip(void *frontend, int clipboard,
      * if we aren't in direct-to-font mode using the D800 hack.
      */
     if (!inst->direct_to_font) {
-	const wchar_t *tmp = data;
-	int tmplen = len;
 #ifndef NOT_X_WINDOWS
 	XTextProperty tp;
 	char *list[1];
         Display *disp = GDK_DISPLAY_XDISPLAY(gdk_display_get_default());
 #endif
 
-	state->pasteout_data_utf8 = snewn(len*6, char);
-	state->pasteout_data_utf8_len = len*6;
-	state->pasteout_data_utf8_len =
-	    charset_from_unicode(&tmp, &tmplen, state->pasteout_data_utf8,
-				 state->pasteout_data_utf8_len,
-				 CS_UTF8, NULL, NULL, 0);
+	state->pasteout_data_utf8 =
+	    utf8_from_wide(data, len, &state->pasteout_data_utf8_len);
 	if (state->pasteout_data_utf8_len == 0) {
 	    sfree(state->pasteout_data_utf8);
 	    state->pasteout_data_utf8 = NULL;
-	} else {
-	    state->pasteout_data_utf8 =
-		sresize(state->pasteout_data_utf8,
-			state->pasteout_data_utf8_len + 1, char);
-	    state->pasteout_data_utf8[state->pasteout_data_utf8_len] = '\0';
 	}
 
 	/*
@@ -3366,6 +3413,7 @@ Context get_ctx(void *frontend)
 
     dctx = snew(struct draw_ctx);
     dctx->inst = inst;
+    dctx->ndamage = 0;
     dctx->uctx.type = inst->drawtype;
 #ifdef DRAW_TEXT_GDK
     if (dctx->uctx.type == DRAWTYPE_GDK) {
@@ -3392,6 +3440,7 @@ void free_ctx(Context ctx)
 {
     struct draw_ctx *dctx = (struct draw_ctx *)ctx;
     /* struct gui_data *inst = dctx->inst; */
+    draw_update_flush(dctx);
 #ifdef DRAW_TEXT_GDK
     if (dctx->uctx.type == DRAWTYPE_GDK) {
         gdk_gc_unref(dctx->uctx.u.gdk.gc);
@@ -3406,8 +3455,13 @@ void free_ctx(Context ctx)
 }
 
 
-static void draw_update(struct draw_ctx *dctx, int x, int y, int w, int h)
+static void draw_update_flush(struct draw_ctx *dctx)
 {
+    int i;
+
+    if (dctx->ndamage == 0)
+        return;
+
 #if defined DRAW_TEXT_CAIRO && !defined NO_BACKING_PIXMAPS
     if (dctx->uctx.type == DRAWTYPE_CAIRO) {
         /*
@@ -3417,7 +3471,9 @@ static void draw_update(struct draw_ctx *dctx, int x, int y, int w, int h)
          */
         cairo_t *cr = gdk_cairo_create(dctx->inst->pixmap);
         cairo_set_source_surface(cr, dctx->inst->surface, 0, 0);
-        cairo_rectangle(cr, x, y, w, h);
+        for (i = 0; i < dctx->ndamage; i++)
+            cairo_rectangle(cr, dctx->damage[i].x, dctx->damage[i].y,
+                            dctx->damage[i].w, dctx->damage[i].h);
         cairo_fill(cr);
         cairo_destroy(cr);
     }
@@ -3432,9 +3488,115 @@ static void draw_update(struct draw_ctx *dctx, int x, int y, int w, int h)
      * Amazingly, this one API call is actually valid in all versions
      * of GTK :-)
      */
-    gtk_widget_queue_draw_area(dctx->inst->area, x, y, w, h);
+    for (i = 0; i < dctx->ndamage; i++)
+        gtk_widget_queue_draw_area(dctx->inst->area,
+                                   dctx->damage[i].x, dctx->damage[i].y,
+                                   dctx->damage[i].w, dctx->damage[i].h);
+
+    dctx->ndamage = 0;
 }
 
+static void draw_update(struct draw_ctx *dctx, int x, int y, int w, int h)
+{
+    struct draw_damage_rect *r;
+
+    if (w <= 0 || h <= 0)
+        return;
+
+    if (dctx->ndamage > 0) {
+        r = &dctx->damage[dctx->ndamage - 1];
+        /*
+         * Merge with the previous rectangle where this one simply
+         * extends it: successive runs along the same line, or
+         * successive whole lines of a full-height repaint.
+         */
+        if (y == r->y && h == r->h && x == r->x + r->w) {
+            r->w += w;
+            return;
+        }
+        if (x == r->x && w == r->w && y == r->y + r->h) {
+            r->h += h;
+            return;
+        }
+    }
+    if (dctx->ndamage == DRAW_DAMAGE_MAX)
+        draw_update_flush(dctx);
+    r = &dctx->damage[dctx->ndamage++];
+    r->x = x;
+    r->y = y;
+    r->w = w;
+    r->h = h;
+}
+
+#ifdef OPTIMISE_SCROLL
+/*
+ * Scroll a region of the backing store by a whole number of character
+ * rows. terminal.c only calls this (via its OPTIMISE_SCROLL
+ * machinery) for lines it knows are displayed correctly, so we can
+ * move the existing pixels rather than re-rendering every line
+ * through the font system; the lines exposed by the scroll are marked
+ * invalid and repainted by do_paint() in the usual way.
+ */
+void do_scroll(Context ctx, int topline, int botline, int lines)
+{
+    struct draw_ctx *dctx = (struct draw_ctx *)ctx;
+    struct gui_data *inst = dctx->inst;
+    int distance = lines > 0 ? lines : -lines;
+    int nlines = botline - topline + 1 - distance;
+    int x, w, h, srcy, dsty;
+
+    if (nlines <= 0)
+	return;
+
+    x = inst->window_border;
+    w = inst->width * inst->font_width;
+    h = nlines * inst->font_height;
+    if (lines > 0) {
+	srcy = inst->window_border + (topline + distance) * inst->font_height;
+	dsty = inst->window_border + topline * inst->font_height;
+    } else {
+	srcy = inst->window_border + topline * inst->font_height;
+	dsty = inst->window_border + (topline + distance) * inst->font_height;
+    }
+
+#ifdef DRAW_TEXT_GDK
+    if (dctx->uctx.type == DRAWTYPE_GDK) {
+	/* X's CopyArea is defined to cope with overlapping source
+	 * and destination, so we can copy within the pixmap. */
+	gdk_draw_pixmap(dctx->uctx.u.gdk.target, dctx->uctx.u.gdk.gc,
+			dctx->uctx.u.gdk.target,
+			x, srcy, x, dsty, w, h);
+    }
+#endif
+#ifdef DRAW_TEXT_CAIRO
+    if (dctx->uctx.type == DRAWTYPE_CAIRO) {
+	/*
+	 * Cairo makes no promises about overlapping self-copies, so
+	 * stage the moving band through a temporary surface.
+	 */
+	cairo_surface_t *tmp;
+	cairo_t *cr;
+
+	tmp = cairo_surface_create_similar(inst->surface,
+					   CAIRO_CONTENT_COLOR, w, h);
+	cr = cairo_create(tmp);
+	cairo_set_source_surface(cr, inst->surface, -x, -srcy);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+
+	cr = cairo_create(inst->surface);
+	cairo_set_source_surface(cr, tmp, x, dsty);
+	cairo_rectangle(cr, x, dsty, w, h);
+	cairo_fill(cr);
+	cairo_destroy(cr);
+	cairo_surface_destroy(tmp);
+    }
+#endif
+
+    draw_update(dctx, x, dsty, w, h);
+}
+#endif /* OPTIMISE_SCROLL */
+
 #ifdef DRAW_TEXT_CAIRO
 static void cairo_set_source_rgb_dim(cairo_t *cr, double r, double g, double b,
                                      int dim)
@@ -4316,6 +4478,8 @@ void special_menuitem(GtkMenuItem *item, gpointer data)
     int code = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(item),
                                                  "user-data"));
 
+    if (code == TS_STATS)
+	term_log_stats(inst->term);
     if (inst->back)
 	inst->back->special(inst->backhandle, code);
 }
@@ -5153,6 +5317,10 @@ void new_session_window(Conf *conf, const char *geometry_string)
                      G_CALLBACK(focus_event), inst);
     g_signal_connect(G_OBJECT(inst->window), "focus_out_event",
                      G_CALLBACK(focus_event), inst);
+#if GTK_CHECK_VERSION(2,0,0)
+    g_signal_connect(G_OBJECT(inst->window), "window_state_event",
+                     G_CALLBACK(window_state_event), inst);
+#endif
     g_signal_connect(G_OBJECT(inst->area), "configure_event",
                      G_CALLBACK(configure_area), inst);
 #if GTK_CHECK_VERSION(3,0,0)
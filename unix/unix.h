@@ -45,6 +45,15 @@
 
 #endif
 
+/*
+ * The Unix front ends can all implement do_scroll() by moving pixels
+ * within their backing stores, so enable terminal.c's scroll
+ * optimisation: continuous scrolling output then costs one area copy
+ * plus a repaint of the newly exposed lines, instead of re-rendering
+ * the whole scrolled region through the font system.
+ */
+#define OPTIMISE_SCROLL
+
 /* BUILDINFO_PLATFORM varies its expansion between the GTK and
  * pure-CLI utilities, so that Unix Plink, PSFTP etc don't announce
  * themselves incongruously as having something to do with GTK. */
@@ -268,6 +277,9 @@ void uxsel_del(int fd);
 void select_result(int fd, int event);
 int first_fd(int *state, int *rwx);
 int next_fd(int *state, int *rwx);
+#define UXSEL_MAXEXTRA 8
+int uxsel_wait(long timeout, const int *extra_fds, const int *extra_rwx,
+	       int *extra_ready, int nextra);
 /* The following are expected to be provided _to_ uxsel.c by the frontend */
 uxsel_id *uxsel_input_add(int fd, int rwx);  /* returns an id */
 void uxsel_input_remove(uxsel_id *id);
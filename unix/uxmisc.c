@@ -15,10 +15,62 @@
 #include <pwd.h>
 #include <ctype.h>
 
+#include <sys/mman.h>
+#include <pthread.h>
+
 #include "putty.h"
 
+/*
+ * Unix implementation of the secure-pool page-locking hook (see
+ * misc.c): best-effort mlock, ignoring failure (unprivileged
+ * processes commonly have a small RLIMIT_MEMLOCK).
+ */
+void platform_secure_pool_lock(void *b, size_t len)
+{
+    mlock(b, len);
+}
+
+/*
+ * Unix implementation of the secure-pool free-list mutex (see
+ * misc.c): the pool is shared between the main thread and
+ * uxoffload.c's worker pthread.
+ */
+static pthread_mutex_t secure_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void platform_secure_pool_mutex_lock(void)
+{
+    pthread_mutex_lock(&secure_pool_mutex);
+}
+
+void platform_secure_pool_mutex_unlock(void)
+{
+    pthread_mutex_unlock(&secure_pool_mutex);
+}
+
+#ifdef MALLOC_ACCOUNTING
+/*
+ * Separate mutex for the allocation-accounting site table (see
+ * misc.c), which the worker pthread also updates. It can't share the
+ * secure-pool mutex: secure_pool_alloc calls smalloc with that held.
+ */
+static pthread_mutex_t malloc_acct_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void platform_malloc_acct_mutex_lock(void)
+{
+    pthread_mutex_lock(&malloc_acct_mutex);
+}
+
+void platform_malloc_acct_mutex_unlock(void)
+{
+    pthread_mutex_unlock(&malloc_acct_mutex);
+}
+#endif
+
 unsigned long getticks(void)
 {
+#ifdef SYSCALL_AUDIT
+    syscall_audit_count(SCA_TIME);
+#endif
     /*
      * We want to use milliseconds rather than the microseconds or
      * nanoseconds given by the underlying clock functions, because we
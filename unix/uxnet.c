@@ -10,12 +10,15 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <sys/un.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <pwd.h>
 #include <grp.h>
 
@@ -99,6 +102,16 @@ struct Socket_tag {
      * track this link.
      */
     Actual_Socket parent, child;
+    /*
+     * Happy Eyeballs (RFC 8305): if the first connection attempt to a
+     * dual-stack host is still in flight after a short stagger, we
+     * start a second attempt in the other address family and keep
+     * whichever connects first. 'race_peer' links the two attempts;
+     * 'race_candidate' marks the secondary one, whose fd is adopted
+     * by the primary structure (the one the Plug holds) if it wins.
+     */
+    Actual_Socket race_peer;
+    int race_candidate;
 };
 
 struct SockAddr_tag {
@@ -107,6 +120,10 @@ struct SockAddr_tag {
     enum { UNRESOLVED, UNIX, IP } superfamily;
 #ifndef NO_IPV6
     struct addrinfo *ais;	       /* Addresses IPv6 style. */
+    int ais_unpacked;		       /* ais was built by hand from an
+					* async lookup result, not by
+					* getaddrinfo, so must be freed by
+					* hand too */
 #else
     unsigned long *addresses;	       /* Addresses IPv4 style. */
     int naddresses;
@@ -286,6 +303,282 @@ SockAddr sk_namelookup(const char *host, char **canonicalname, int address_famil
     return ret;
 }
 
+/*
+ * Asynchronous name lookup. getaddrinfo has no portable non-blocking
+ * form, so we fork a child process to do the lookup and send the
+ * result back up a pipe, which we watch through uxsel like any other
+ * fd. The child serialises the raw sockaddrs; we rebuild an addrinfo
+ * list from them on our side, flagged in the SockAddr (ais_unpacked)
+ * so that sk_addr_free knows to take it apart by hand rather than
+ * calling freeaddrinfo.
+ */
+
+struct sk_lookup_pending {
+    int fd;			       /* read end of the result pipe */
+    pid_t pid;
+    sk_namelookup_done_fn_t done;
+    void *ctx;
+    char *buf;			       /* accumulated result data */
+    int buflen, bufsize;
+    struct sk_lookup_pending *next;
+};
+static struct sk_lookup_pending *pending_lookups = NULL;
+
+#ifndef NO_IPV6
+
+static int sk_lookup_put(int fd, const void *data, int len)
+{
+    const char *p = (const char *)data;
+    while (len > 0) {
+	int ret = write(fd, p, len);
+	if (ret <= 0)
+	    return FALSE;
+	p += ret;
+	len -= ret;
+    }
+    return TRUE;
+}
+
+/*
+ * Runs in the forked child: do the lookup and write the result to the
+ * pipe. Wire format: int gai error code; on success, followed by the
+ * canonical name (int length + bytes), an address count, and for each
+ * address its family, sockaddr length and raw sockaddr bytes. The
+ * reader is our own parent process, so native ints are fine.
+ */
+static void sk_lookup_child(int wfd, const char *host, int address_family)
+{
+    struct addrinfo hints, *ais, *ai;
+    const char *canonname;
+    int err, canonlen, naddrs;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_CANONNAME;
+    hints.ai_family = (address_family == ADDRTYPE_IPV4 ? AF_INET :
+		       address_family == ADDRTYPE_IPV6 ? AF_INET6 :
+		       AF_UNSPEC);
+    hints.ai_socktype = SOCK_STREAM;
+    {
+	char *trimmed_host = host_strduptrim(host); /* strip [] on literals */
+	err = getaddrinfo(trimmed_host, NULL, &hints, &ais);
+	sfree(trimmed_host);
+    }
+
+    if (!sk_lookup_put(wfd, &err, sizeof(err)) || err != 0)
+	return;
+
+    canonname = ais->ai_canonname ? ais->ai_canonname : host;
+    canonlen = strlen(canonname);
+    if (!sk_lookup_put(wfd, &canonlen, sizeof(canonlen)) ||
+	!sk_lookup_put(wfd, canonname, canonlen))
+	return;
+
+    naddrs = 0;
+    for (ai = ais; ai; ai = ai->ai_next)
+	naddrs++;
+    if (!sk_lookup_put(wfd, &naddrs, sizeof(naddrs)))
+	return;
+    for (ai = ais; ai; ai = ai->ai_next) {
+	int family = ai->ai_family, addrlen = ai->ai_addrlen;
+	if (!sk_lookup_put(wfd, &family, sizeof(family)) ||
+	    !sk_lookup_put(wfd, &addrlen, sizeof(addrlen)) ||
+	    !sk_lookup_put(wfd, ai->ai_addr, addrlen))
+	    return;
+    }
+}
+
+static int sk_lookup_get(const char *buf, int buflen, int *pos,
+			 void *out, int len)
+{
+    if (len < 0 || len > buflen - *pos)
+	return FALSE;
+    memcpy(out, buf + *pos, len);
+    *pos += len;
+    return TRUE;
+}
+
+static SockAddr sk_lookup_unpack(const char *buf, int buflen,
+				 char **canonicalname)
+{
+    SockAddr ret = snew(struct SockAddr_tag);
+    struct addrinfo *head = NULL, *tail = NULL, *node;
+    int pos = 0, err, canonlen, naddrs, i;
+
+    memset(ret, 0, sizeof(struct SockAddr_tag));
+    ret->superfamily = UNRESOLVED;
+    ret->refcount = 1;
+    ret->error = NULL;
+    *canonicalname = NULL;
+
+    if (!sk_lookup_get(buf, buflen, &pos, &err, sizeof(err))) {
+	ret->error = "Name lookup failure";
+	goto out;
+    }
+    if (err != 0) {
+	ret->error = gai_strerror(err);
+	goto out;
+    }
+
+    if (!sk_lookup_get(buf, buflen, &pos, &canonlen, sizeof(canonlen)) ||
+	canonlen < 0 || canonlen > buflen - pos) {
+	ret->error = "Name lookup failure";
+	goto out;
+    }
+    *canonicalname = snewn(canonlen + 1, char);
+    sk_lookup_get(buf, buflen, &pos, *canonicalname, canonlen);
+    (*canonicalname)[canonlen] = '\0';
+
+    if (!sk_lookup_get(buf, buflen, &pos, &naddrs, sizeof(naddrs)))
+	naddrs = 0;
+    for (i = 0; i < naddrs; i++) {
+	int family, addrlen;
+	if (!sk_lookup_get(buf, buflen, &pos, &family, sizeof(family)) ||
+	    !sk_lookup_get(buf, buflen, &pos, &addrlen, sizeof(addrlen)) ||
+	    addrlen <= 0 || addrlen > buflen - pos)
+	    break;
+	node = snew(struct addrinfo);
+	memset(node, 0, sizeof(*node));
+	node->ai_family = family;
+	node->ai_socktype = SOCK_STREAM;
+	node->ai_addrlen = addrlen;
+	node->ai_addr = (struct sockaddr *)snewn(addrlen, char);
+	sk_lookup_get(buf, buflen, &pos, node->ai_addr, addrlen);
+	if (tail)
+	    tail->ai_next = node;
+	else
+	    head = node;
+	tail = node;
+    }
+
+    if (!head) {
+	ret->error = "Name lookup failure";
+	goto out;
+    }
+
+    ret->superfamily = IP;
+    ret->ais = head;
+    ret->ais_unpacked = TRUE;
+
+  out:
+    if (!*canonicalname)
+	*canonicalname = dupstr("");
+    return ret;
+}
+
+static void sk_lookup_result(int fd, int event)
+{
+    struct sk_lookup_pending *lu, **pp;
+    char readbuf[4096];
+    int ret;
+
+    for (pp = &pending_lookups; (lu = *pp) != NULL; pp = &lu->next)
+	if (lu->fd == fd)
+	    break;
+    if (!lu) {
+	uxsel_del(fd);
+	return;
+    }
+
+    while ((ret = read(fd, readbuf, sizeof(readbuf))) > 0) {
+	if (lu->buflen + ret > lu->bufsize) {
+	    lu->bufsize = (lu->buflen + ret) * 5 / 4 + 1024;
+	    lu->buf = sresize(lu->buf, lu->bufsize, char);
+	}
+	memcpy(lu->buf + lu->buflen, readbuf, ret);
+	lu->buflen += ret;
+    }
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+	return;			       /* more to come later */
+
+    /*
+     * EOF (or a read error, in which case the truncated buffer will
+     * unpack as a lookup failure): the child has finished. Deliver
+     * the result.
+     */
+    {
+	SockAddr addr;
+	char *canonicalname;
+	sk_namelookup_done_fn_t done = lu->done;
+	void *ctx = lu->ctx;
+
+	*pp = lu->next;
+	uxsel_del(fd);
+	close(fd);
+	waitpid(lu->pid, NULL, 0);
+	addr = sk_lookup_unpack(lu->buf, lu->buflen, &canonicalname);
+	sfree(lu->buf);
+	sfree(lu);
+	done(addr, canonicalname, ctx);
+    }
+}
+
+#endif /* NO_IPV6 */
+
+void *sk_namelookup_start(const char *host, int address_family,
+			  sk_namelookup_done_fn_t done, void *ctx)
+{
+#ifndef NO_IPV6
+    struct sk_lookup_pending *lu;
+    int pipefd[2];
+    pid_t pid;
+
+    if (pipe(pipefd) < 0)
+	return NULL;
+
+    pid = fork();
+    if (pid < 0) {
+	close(pipefd[0]);
+	close(pipefd[1]);
+	return NULL;
+    }
+    if (pid == 0) {
+	close(pipefd[0]);
+	sk_lookup_child(pipefd[1], host, address_family);
+	_exit(0);
+    }
+    close(pipefd[1]);
+    cloexec(pipefd[0]);
+    nonblock(pipefd[0]);
+
+    lu = snew(struct sk_lookup_pending);
+    lu->fd = pipefd[0];
+    lu->pid = pid;
+    lu->done = done;
+    lu->ctx = ctx;
+    lu->buf = NULL;
+    lu->buflen = lu->bufsize = 0;
+    lu->next = pending_lookups;
+    pending_lookups = lu;
+    uxsel_set(lu->fd, 1, sk_lookup_result);
+    return lu;
+#else
+    /*
+     * The serialisation above only covers the getaddrinfo world; in
+     * the legacy IPv4-only configuration callers just do the blocking
+     * lookup as before.
+     */
+    return NULL;
+#endif
+}
+
+void sk_namelookup_abort(void *handle)
+{
+    struct sk_lookup_pending *lu = (struct sk_lookup_pending *)handle, **pp;
+
+    for (pp = &pending_lookups; *pp; pp = &(*pp)->next) {
+	if (*pp == lu) {
+	    *pp = lu->next;
+	    uxsel_del(lu->fd);
+	    close(lu->fd);
+	    kill(lu->pid, SIGKILL);
+	    waitpid(lu->pid, NULL, 0);
+	    sfree(lu->buf);
+	    sfree(lu);
+	    return;
+	}
+    }
+}
+
 SockAddr sk_nonamelookup(const char *host)
 {
     SockAddr ret = snew(struct SockAddr_tag);
@@ -477,8 +770,17 @@ void sk_addr_free(SockAddr addr)
     if (--addr->refcount > 0)
 	return;
 #ifndef NO_IPV6
-    if (addr->ais != NULL)
-	freeaddrinfo(addr->ais);
+    if (addr->ais != NULL) {
+	if (addr->ais_unpacked) {
+	    struct addrinfo *ai, *next;
+	    for (ai = addr->ais; ai; ai = next) {
+		next = ai->ai_next;
+		sfree(ai->ai_addr);
+		sfree(ai);
+	    }
+	} else
+	    freeaddrinfo(addr->ais);
+    }
 #else
     sfree(addr->addresses);
 #endif
@@ -551,6 +853,8 @@ static Socket sk_tcp_accept(accept_ctx_t ctx, Plug plug)
     ret->incomingeof = FALSE;
     ret->listener = 0;
     ret->parent = ret->child = NULL;
+    ret->race_peer = NULL;
+    ret->race_candidate = FALSE;
     ret->addr = NULL;
     ret->connected = 1;
 
@@ -768,6 +1072,156 @@ static int try_connect(Actual_Socket sock)
     return err;
 }
 
+/*
+ * Stagger between starting the first connection attempt and racing a
+ * second one in the other address family, per RFC 8305's
+ * recommendation.
+ */
+#define RACE_STAGGER_TICKS (TICKSPERSEC / 4)
+
+/*
+ * Find the first remaining candidate address in a different address
+ * family from the one 'step' currently points at. Returns FALSE if
+ * there isn't one (including in non-IPv6 builds, where all addresses
+ * are the same family).
+ */
+static int sk_race_find_other_family(SockAddr addr, SockAddrStep *step,
+                                     SockAddrStep *newstep)
+{
+#ifndef NO_IPV6
+    struct addrinfo *ai;
+
+    if (addr->superfamily != IP || !step->ai)
+        return FALSE;
+    for (ai = step->ai->ai_next; ai; ai = ai->ai_next) {
+        if (ai->ai_family != step->ai->ai_family &&
+            (ai->ai_family == AF_INET || ai->ai_family == AF_INET6)) {
+            newstep->ai = ai;
+            newstep->curraddr = 0;
+            return TRUE;
+        }
+    }
+#endif
+    return FALSE;
+}
+
+/*
+ * Resolve a pair of racing connection attempts in favour of
+ * 'survivor' (either because it has connected, or because the other
+ * one's connect failed outright). The surviving fd is folded into the
+ * primary socket structure - the one the Plug and its owner hold a
+ * pointer to - and the candidate structure is freed. Returns the
+ * primary.
+ */
+static Actual_Socket sk_race_resolve(Actual_Socket survivor)
+{
+    Actual_Socket sock, cand;
+
+    if (survivor->race_candidate) {
+        cand = survivor;
+        sock = cand->race_peer;
+        del234(sktree, sock);
+        del234(sktree, cand);
+        if (sock->s >= 0) {
+            uxsel_del(sock->s);
+            close(sock->s);
+        }
+        sock->s = cand->s;
+        sock->step = cand->step;
+        sock->connected = cand->connected;
+        sock->writable = cand->writable;
+        add234(sktree, sock);
+        uxsel_tell(sock);
+    } else {
+        sock = survivor;
+        cand = sock->race_peer;
+        del234(sktree, cand);
+        if (cand->s >= 0) {
+            uxsel_del(cand->s);
+            close(cand->s);
+        }
+    }
+    sock->race_peer = NULL;
+    sk_addr_free(cand->addr);
+    sfree(cand);
+    return sock;
+}
+
+/*
+ * Timer callback: the first connection attempt has been in flight for
+ * RACE_STAGGER_TICKS without completing, so start a parallel attempt
+ * in the other address family.
+ */
+static void sk_connect_race_timer(void *ctx, unsigned long now)
+{
+    Actual_Socket s = (Actual_Socket) ctx;
+    Actual_Socket c;
+    SockAddrStep newstep;
+
+    /*
+     * If the first attempt has already resolved one way or another,
+     * there's nothing to race against.
+     */
+    if (s->connected || !s->addr || s->race_peer || s->s < 0)
+        return;
+    if (!sk_race_find_other_family(s->addr, &s->step, &newstep))
+        return;
+
+    c = snew(struct Socket_tag);
+    c->fn = &tcp_fn_table;
+    c->error = NULL;
+    c->plug = s->plug;
+    bufchain_init(&c->output_data);
+    c->connected = 0;
+    c->writable = 0;
+    c->sending_oob = 0;
+    c->frozen = 0;
+    c->localhost_only = 0;
+    c->pending_error = 0;
+    c->parent = c->child = NULL;
+    c->oobpending = FALSE;
+    c->outgoingeof = EOF_NO;
+    c->incomingeof = FALSE;
+    c->listener = 0;
+    c->addr = sk_addr_dup(s->addr);
+    c->step = newstep;
+    c->s = -1;
+    c->oobinline = s->oobinline;
+    c->nodelay = s->nodelay;
+    c->keepalive = s->keepalive;
+    c->privport = s->privport;
+    c->port = s->port;
+    c->race_peer = s;
+    c->race_candidate = TRUE;
+    s->race_peer = c;
+
+    if (try_connect(c)) {
+        /*
+         * Couldn't even start the second attempt; drop it and let the
+         * first one play out serially as before.
+         */
+        s->race_peer = NULL;
+        del234(sktree, c);
+        if (c->s >= 0) {
+            uxsel_del(c->s);
+            close(c->s);
+        }
+        sk_addr_free(c->addr);
+        sfree(c);
+        return;
+    }
+
+    if (c->connected) {
+        /* Connected instantly: adopt the winner straight away. */
+        s = sk_race_resolve(c);
+        if (s->addr) {
+            sk_addr_free(s->addr);
+            s->addr = NULL;
+        }
+        uxsel_tell(s);
+    }
+}
+
 Socket sk_new(SockAddr addr, int port, int privport, int oobinline,
 	      int nodelay, int keepalive, Plug plug)
 {
@@ -789,6 +1243,8 @@ Socket sk_new(SockAddr addr, int port, int privport, int oobinline,
     ret->localhost_only = 0;	       /* unused, but best init anyway */
     ret->pending_error = 0;
     ret->parent = ret->child = NULL;
+    ret->race_peer = NULL;
+    ret->race_candidate = FALSE;
     ret->oobpending = FALSE;
     ret->outgoingeof = EOF_NO;
     ret->incomingeof = FALSE;
@@ -807,8 +1263,20 @@ Socket sk_new(SockAddr addr, int port, int privport, int oobinline,
         err = try_connect(ret);
     } while (err && sk_nextaddr(ret->addr, &ret->step));
 
-    if (err)
+    if (err) {
         ret->error = strerror(err);
+    } else if (!ret->connected) {
+        /*
+         * The connect is still in flight. If the address list also
+         * has candidates in the other address family, schedule a
+         * parallel attempt, so that a host whose first-preference
+         * family is unreachable costs us the stagger interval rather
+         * than a full TCP timeout.
+         */
+        SockAddrStep otherstep;
+        if (sk_race_find_other_family(ret->addr, &ret->step, &otherstep))
+            schedule_timer(RACE_STAGGER_TICKS, sk_connect_race_timer, ret);
+    }
 
     return (Socket) ret;
 }
@@ -843,6 +1311,8 @@ Socket sk_newlistener(const char *srcaddr, int port, Plug plug,
     ret->localhost_only = local_host_only;
     ret->pending_error = 0;
     ret->parent = ret->child = NULL;
+    ret->race_peer = NULL;
+    ret->race_candidate = FALSE;
     ret->oobpending = FALSE;
     ret->outgoingeof = EOF_NO;
     ret->incomingeof = FALSE;
@@ -982,6 +1452,13 @@ Socket sk_newlistener(const char *srcaddr, int port, Plug plug,
 	return (Socket) ret;
     }
 
+    /*
+     * The accept loop in net_select_result drains the whole backlog
+     * in one go, so the listening socket must be non-blocking or the
+     * accept() after the last queued connection would hang.
+     */
+    nonblock(s);
+
 #ifndef NO_IPV6
     /*
      * If we were given ADDRTYPE_UNSPEC, we must also create an
@@ -1023,6 +1500,10 @@ static void sk_tcp_close(Socket sock)
     if (s->child)
         sk_tcp_close((Socket)s->child);
 
+    if (s->race_peer)
+        sk_race_resolve(s);            /* discard the racing candidate */
+    expire_timer_context(s);
+
     del234(sktree, s);
     if (s->s >= 0) {
         uxsel_del(s->s);
@@ -1109,23 +1590,44 @@ static void socket_error_callback(void *vs)
  * The function which tries to send on a socket once it's deemed
  * writable.
  */
+#define UXNET_MAXIOV 32
+
 void try_send(Actual_Socket s)
 {
     while (s->sending_oob || bufchain_size(&s->output_data) > 0) {
 	int nsent;
 	int err;
-	void *data;
-	int len, urgentflag;
+	int len;
 
 	if (s->sending_oob) {
-	    urgentflag = MSG_OOB;
 	    len = s->sending_oob;
-	    data = &s->oobdata;
+	    nsent = send(s->s, &s->oobdata, len, MSG_OOB);
 	} else {
-	    urgentflag = 0;
-	    bufchain_prefix(&s->output_data, &data, &len);
+	    /*
+	     * Gather as many segments of the output bufchain as we
+	     * can into one writev call, so that a backlog of small
+	     * packets goes to the kernel in a single syscall
+	     * instead of one per packet.
+	     */
+	    void *datas[UXNET_MAXIOV];
+	    int lens[UXNET_MAXIOV];
+	    struct iovec iov[UXNET_MAXIOV];
+	    int i, niov;
+
+	    niov = bufchain_prefix_vec(&s->output_data, datas, lens,
+				       UXNET_MAXIOV);
+	    len = 0;
+	    for (i = 0; i < niov; i++) {
+		iov[i].iov_base = datas[i];
+		iov[i].iov_len = lens[i];
+		len += lens[i];
+	    }
+	    nsent = writev(s->s, iov, niov);
 	}
-	nsent = send(s->s, data, len, urgentflag);
+#ifdef SYSCALL_AUDIT
+	syscall_audit_count(SCA_WRITE);
+	syscall_audit_data(nsent);
+#endif
 	noise_ultralight(nsent);
 	if (nsent <= 0) {
 	    err = (nsent < 0 ? errno : 0);
@@ -1323,28 +1825,37 @@ static void net_select_result(int fd, int event)
       case 1: 			       /* readable; also acceptance */
 	if (s->listener) {
 	    /*
-	     * On a listening socket, the readability event means a
-	     * connection is ready to be accepted.
+	     * On a listening socket, the readability event means at
+	     * least one connection is ready to be accepted. Drain
+	     * the whole backlog while we're here, rather than
+	     * accepting one connection per trip round the event
+	     * loop: under a connection storm that saves a full
+	     * event-loop iteration per connection. The cap stops a
+	     * busy listener starving the session's other sockets.
 	     */
-	    union sockaddr_union su;
-	    socklen_t addrlen = sizeof(su);
-            accept_ctx_t actx;
-	    int t;  /* socket of connection */
-
-	    memset(&su, 0, addrlen);
-	    t = accept(s->s, &su.sa, &addrlen);
-	    if (t < 0) {
-		break;
-	    }
+	    int accepted;
+
+	    for (accepted = 0; accepted < 32; accepted++) {
+		union sockaddr_union su;
+		socklen_t addrlen = sizeof(su);
+		accept_ctx_t actx;
+		int t;  /* socket of connection */
+
+		memset(&su, 0, addrlen);
+		t = accept(s->s, &su.sa, &addrlen);
+		if (t < 0) {
+		    break;	       /* backlog drained (EWOULDBLOCK) */
+		}
 
-            nonblock(t);
-            actx.i = t;
+		nonblock(t);
+		actx.i = t;
 
-	    if ((!s->addr || s->addr->superfamily != UNIX) &&
-                s->localhost_only && !sockaddr_is_loopback(&su.sa)) {
-		close(t);	       /* someone let nonlocal through?! */
-	    } else if (plug_accepting(s->plug, sk_tcp_accept, actx)) {
-		close(t);	       /* denied or error */
+		if ((!s->addr || s->addr->superfamily != UNIX) &&
+		    s->localhost_only && !sockaddr_is_loopback(&su.sa)) {
+		    close(t);	       /* someone let nonlocal through?! */
+		} else if (plug_accepting(s->plug, sk_tcp_accept, actx)) {
+		    close(t);	       /* denied or error */
+		}
 	    }
 	    break;
 	}
@@ -1372,6 +1883,10 @@ static void net_select_result(int fd, int event)
 	    atmark = 1;
 
 	ret = recv(s->s, buf, s->oobpending ? 1 : sizeof(buf), 0);
+#ifdef SYSCALL_AUDIT
+	syscall_audit_count(SCA_READ);
+	syscall_audit_data(ret);
+#endif
 	noise_ultralight(ret);
 	if (ret < 0) {
 	    if (errno == EWOULDBLOCK) {
@@ -1428,6 +1943,18 @@ static void net_select_result(int fd, int event)
                     thisaddr = sk_extractaddr_tmp(s->addr, &s->step);
                     plug_log(s->plug, 1, &thisaddr, s->port, errmsg, err);
 
+                    if (s->race_peer) {
+                        /*
+                         * The other racing attempt is still in
+                         * flight. Fold the pair back into a single
+                         * in-flight attempt and let that one play
+                         * out, rather than starting serial fallback
+                         * here.
+                         */
+                        sk_race_resolve(s->race_peer);
+                        return;
+                    }
+
                     while (err && s->addr && sk_nextaddr(s->addr, &s->step)) {
                         err = try_connect(s);
                     }
@@ -1441,8 +1968,12 @@ static void net_select_result(int fd, int event)
             }
 
             /*
-             * If we get here, we've managed to make a connection.
+             * If we get here, we've managed to make a connection. If
+             * we were racing two attempts, this one has won: discard
+             * the other and carry on with the primary structure.
              */
+            if (s->race_peer)
+                s = sk_race_resolve(s);
             if (s->addr) {
                 sk_addr_free(s->addr);
                 s->addr = NULL;
@@ -1659,6 +2190,8 @@ Socket new_unix_listener(SockAddr listenaddr, Plug plug)
     ret->localhost_only = TRUE;
     ret->pending_error = 0;
     ret->parent = ret->child = NULL;
+    ret->race_peer = NULL;
+    ret->race_candidate = FALSE;
     ret->oobpending = FALSE;
     ret->outgoingeof = EOF_NO;
     ret->incomingeof = FALSE;
@@ -41,24 +41,43 @@ static int read_dev_urandom(char *buf, int len)
 }
 
 /*
- * This function is called once, at PuTTY startup. It will do some
- * slightly silly things such as fetching an entire process listing
- * and scanning /tmp, load the saved random seed from disk, and
- * also read 32 bytes out of /dev/urandom.
+ * This function is called once, at PuTTY startup: it loads the saved
+ * random seed from disk and reads 32 bytes out of /dev/urandom,
+ * which between them are enough to get going. Returns TRUE if
+ * /dev/urandom was available.
  */
 
-void noise_get_heavy(void (*func) (void *, int))
+static int got_dev_urandom = 0;
+
+int noise_get_heavy(void (*func) (void *, int))
 {
-    char buf[512];
-    FILE *fp;
-    int ret;
-    int got_dev_urandom = 0;
+    char buf[32];
 
-    if (read_dev_urandom(buf, 32)) {
+    if (read_dev_urandom(buf, sizeof(buf))) {
 	got_dev_urandom = 1;
-	func(buf, 32);
+	func(buf, sizeof(buf));
     }
 
+    read_random_seed(func);
+    random_save_seed();
+
+    return got_dev_urandom;
+}
+
+/*
+ * The slower environmental entropy sources: fetch an entire process
+ * listing and scan /tmp. sshrand.c defers this until after startup
+ * when /dev/urandom worked, since it's then only defence in depth;
+ * if /dev/urandom was missing it's our primary entropy and is
+ * collected synchronously before anyone draws random bytes.
+ */
+
+void noise_get_background(void (*func) (void *, int))
+{
+    char buf[512];
+    FILE *fp;
+    int ret;
+
     fp = popen("ps -axu 2>/dev/null", "r");
     if (fp) {
 	while ( (ret = fread(buf, 1, sizeof(buf), fp)) > 0)
@@ -80,9 +99,6 @@ void noise_get_heavy(void (*func) (void *, int))
 		"Unable to access fallback entropy source\n", strerror(errno));
 	exit(1);
     }
-
-    read_random_seed(func);
-    random_save_seed();
 }
 
 void random_save_seed(void)
@@ -0,0 +1,108 @@
+/*
+ * uxoffload.c: the Unix implementation of the CPU-offload interface
+ * declared in putty.h. Work functions run on a pthread; completion
+ * is marshalled back to the main thread by writing the job pointer
+ * down a pipe whose read end is registered with uxsel, so the main
+ * event loop stays live while (for instance) a large key-exchange
+ * modexp is in progress.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "putty.h"
+
+struct offload_job {
+    offload_fn_t work;
+    toplevel_callback_fn_t done;
+    void *ctx;
+    pthread_t thread;
+    int joined;
+};
+
+/*
+ * Only one job may be outstanding at a time, per the interface spec,
+ * so a single static suffices.
+ */
+static struct offload_job *offload_current = NULL;
+
+static int offload_pipe[2] = { -1, -1 };
+
+static void offload_pipe_readable(int fd, int event)
+{
+    struct offload_job *job;
+
+    if (read(fd, &job, sizeof(job)) != sizeof(job))
+	return;			       /* spurious wakeup; nothing to do */
+
+    /*
+     * The worker writes the pipe as the very last thing it does, so
+     * this join won't detain us for long.
+     */
+    if (!job->joined)
+	pthread_join(job->thread, NULL);
+    if (job == offload_current)
+	offload_current = NULL;
+
+    queue_toplevel_callback(job->done, job->ctx);
+    sfree(job);
+}
+
+static void *offload_threadfunc(void *vjob)
+{
+    struct offload_job *job = (struct offload_job *)vjob;
+
+    job->work(job->ctx);
+
+    while (write(offload_pipe[1], &job, sizeof(job)) < 0 && errno == EINTR);
+
+    return NULL;
+}
+
+int offload_available(void)
+{
+    return TRUE;
+}
+
+void offload_run(offload_fn_t work, toplevel_callback_fn_t done, void *ctx)
+{
+    struct offload_job *job;
+
+    assert(!offload_current);
+
+    if (offload_pipe[0] < 0) {
+	if (pipe(offload_pipe) < 0)
+	    goto synchronous;
+	cloexec(offload_pipe[0]);
+	cloexec(offload_pipe[1]);
+	uxsel_set(offload_pipe[0], 1, offload_pipe_readable);
+    }
+
+    job = snew(struct offload_job);
+    job->work = work;
+    job->done = done;
+    job->ctx = ctx;
+    job->joined = FALSE;
+
+    if (pthread_create(&job->thread, NULL, offload_threadfunc, job)) {
+	sfree(job);
+	goto synchronous;
+    }
+
+    offload_current = job;
+    return;
+
+  synchronous:
+    work(ctx);
+    queue_toplevel_callback(done, ctx);
+}
+
+void offload_wait(void)
+{
+    if (offload_current && !offload_current->joined) {
+	pthread_join(offload_current->thread, NULL);
+	offload_current->joined = TRUE;
+    }
+}
@@ -699,17 +699,11 @@ void run_agent(void)
     struct pageant_listen_state *pl;
     Socket sock;
     unsigned long now;
-    int *fdlist;
-    int fd;
-    int i, fdcount, fdsize, fdstate;
     int termination_pid = -1;
     int errors = FALSE;
     Conf *conf;
     const struct cmdline_key_action *act;
 
-    fdlist = NULL;
-    fdcount = fdsize = 0;
-
     pageant_init();
 
     /*
@@ -836,57 +830,31 @@ void run_agent(void)
     now = GETTICKCOUNT();
 
     while (!time_to_die) {
-	fd_set rset, wset, xset;
-	int maxfd;
-	int rwx;
+	int extra_fds[1], extra_rwx[1], extra_ready[1];
+	int nextra, spipe_ix;
 	int ret;
         unsigned long next;
 
-	FD_ZERO(&rset);
-	FD_ZERO(&wset);
-	FD_ZERO(&xset);
-	maxfd = 0;
-
-        if (signalpipe[0] >= 0) {
-            FD_SET_MAX(signalpipe[0], maxfd, rset);
-        }
-
-	/* Count the currently active fds. */
-	i = 0;
-	for (fd = first_fd(&fdstate, &rwx); fd >= 0;
-	     fd = next_fd(&fdstate, &rwx)) i++;
-
-	/* Expand the fdlist buffer if necessary. */
-	if (i > fdsize) {
-	    fdsize = i + 16;
-	    fdlist = sresize(fdlist, fdsize, int);
-	}
-
 	/*
-	 * Add all currently open fds to the select sets, and store
-	 * them in fdlist as well.
+	 * The fds belonging to the listening socket and all the
+	 * client connections are registered through uxsel_set, so
+	 * uxsel_wait waits on them (and dispatches their callbacks)
+	 * itself; the signal pipe is the only fd this loop handles
+	 * by hand.
 	 */
-	fdcount = 0;
-	for (fd = first_fd(&fdstate, &rwx); fd >= 0;
-	     fd = next_fd(&fdstate, &rwx)) {
-	    fdlist[fdcount++] = fd;
-	    if (rwx & 1)
-		FD_SET_MAX(fd, maxfd, rset);
-	    if (rwx & 2)
-		FD_SET_MAX(fd, maxfd, wset);
-	    if (rwx & 4)
-		FD_SET_MAX(fd, maxfd, xset);
-	}
+	nextra = 0;
+	spipe_ix = -1;
+        if (signalpipe[0] >= 0) {
+	    spipe_ix = nextra;
+	    extra_fds[nextra] = signalpipe[0];
+	    extra_rwx[nextra++] = 1;
+        }
 
         if (toplevel_callback_pending()) {
-            struct timeval tv;
-            tv.tv_sec = 0;
-            tv.tv_usec = 0;
-            ret = select(maxfd, &rset, &wset, &xset, &tv);
+            ret = uxsel_wait(0, extra_fds, extra_rwx, extra_ready, nextra);
         } else if (run_timers(now, &next)) {
             unsigned long then;
             long ticks;
-            struct timeval tv;
 
             then = now;
             now = GETTICKCOUNT();
@@ -894,15 +862,14 @@ void run_agent(void)
                 ticks = 0;
             else
                 ticks = next - now;
-            tv.tv_sec = ticks / 1000;
-            tv.tv_usec = ticks % 1000 * 1000;
-            ret = select(maxfd, &rset, &wset, &xset, &tv);
+            ret = uxsel_wait(ticks, extra_fds, extra_rwx, extra_ready,
+                             nextra);
             if (ret == 0)
                 now = next;
             else
                 now = GETTICKCOUNT();
         } else {
-            ret = select(maxfd, &rset, &wset, &xset, NULL);
+            ret = uxsel_wait(-1, extra_fds, extra_rwx, extra_ready, nextra);
         }
 
         if (ret < 0 && errno == EINTR)
@@ -927,22 +894,7 @@ void run_agent(void)
             }
         }
 
-	for (i = 0; i < fdcount; i++) {
-	    fd = fdlist[i];
-            /*
-             * We must process exceptional notifications before
-             * ordinary readability ones, or we may go straight
-             * past the urgent marker.
-             */
-	    if (FD_ISSET(fd, &xset))
-		select_result(fd, 4);
-	    if (FD_ISSET(fd, &rset))
-		select_result(fd, 1);
-	    if (FD_ISSET(fd, &wset))
-		select_result(fd, 2);
-	}
-
-        if (signalpipe[0] >= 0 && FD_ISSET(signalpipe[0], &rset)) {
+        if (spipe_ix >= 0 && (extra_ready[spipe_ix] & 1)) {
             char c[1];
             if (read(signalpipe[0], c, 1) <= 0)
                 /* ignore error */;
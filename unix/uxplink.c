@@ -14,6 +14,7 @@
 #include <pwd.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #ifndef HAVE_NO_SYS_SELECT_H
 #include <sys/select.h>
 #endif
@@ -522,6 +523,114 @@ void sigwinch(int signum)
 uxsel_id *uxsel_input_add(int fd, int rwx) { return NULL; }
 void uxsel_input_remove(uxsel_id *id) { }
 
+/*
+ * Batch job mode. With -batchjobs, plink reads "host command" jobs
+ * from standard input (one per line; blank lines and lines starting
+ * with '#' are ignored) and runs each one in a forked child process,
+ * at most a given number at a time. The parent does all the one-off
+ * startup work - command-line and saved-session processing, and
+ * seeding the random pool from the seed file - exactly once, so the
+ * children inherit it for free; and because each child is a separate
+ * process running the ordinary single-session code, connection
+ * sharing between jobs to the same host works in the usual way, with
+ * the first child becoming the sharing upstream.
+ *
+ * This function returns only in a child, after configuring conf for
+ * its job, so that the child rejoins the ordinary code path in
+ * main(). The parent exits once every job has been dispatched and
+ * reaped, with a nonzero status if any job failed.
+ */
+static void batch_jobs_run(Conf *conf, int maxjobs)
+{
+    int running = 0, failures = 0;
+    char *line;
+
+    /*
+     * Read the seed file and stir the pool here in the parent. Each
+     * child perturbs its inherited copy of the pool below, so that
+     * no two children generate the same stream.
+     */
+    random_ref();
+
+    while ((line = fgetline(stdin)) != NULL) {
+	char *host, *command;
+	pid_t pid;
+	int status;
+
+	line[strcspn(line, "\r\n")] = '\0';
+	host = line + strspn(line, " \t");
+	if (!*host || *host == '#') {
+	    sfree(line);
+	    continue;
+	}
+	command = host + strcspn(host, " \t");
+	if (*command)
+	    *command++ = '\0';
+	command += strspn(command, " \t");
+
+	while (running >= maxjobs) {
+	    if (waitpid(-1, &status, 0) < 0) {
+		perror("plink: waitpid");
+		cleanup_exit(1);
+	    }
+	    running--;
+	    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		failures++;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+	    perror("plink: fork");
+	    failures++;
+	} else if (pid == 0) {
+	    /*
+	     * Child. Detach stdin from the job list, mix per-process
+	     * noise into the inherited random pool, and set up conf
+	     * for this job; main() takes it from there, exactly as
+	     * if the job had been a single plink invocation.
+	     */
+	    int nullfd = open("/dev/null", O_RDWR);
+	    struct timeval tv;
+
+	    if (nullfd >= 0) {
+		dup2(nullfd, STDIN_FILENO);
+		if (nullfd > STDERR_FILENO)
+		    close(nullfd);
+	    }
+
+	    noise_ultralight(getpid());
+	    gettimeofday(&tv, NULL);
+	    random_add_noise(&tv, sizeof(tv));
+
+	    /* prepare_session() splits any user@ prefix off the host. */
+	    conf_set_str(conf, CONF_host, host);
+	    conf_set_str(conf, CONF_remote_cmd, command);
+	    conf_set_str(conf, CONF_remote_cmd2, "");
+	    if (*command)
+		conf_set_int(conf, CONF_nopty, TRUE);
+	    sfree(line);
+	    return;
+	} else {
+	    running++;
+	}
+	sfree(line);
+    }
+
+    while (running > 0) {
+	int status;
+	if (waitpid(-1, &status, 0) < 0)
+	    break;
+	running--;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	    failures++;
+    }
+
+    if (failures)
+	fprintf(stderr, "plink: %d batch job%s failed\n",
+		failures, failures == 1 ? "" : "s");
+    cleanup_exit(failures ? 1 : 0);
+}
+
 /*
  * Short description of parameters.
  */
@@ -541,6 +650,8 @@ static void usage(void)
     printf("  -P port   connect to specified port\n");
     printf("  -l user   connect with specified username\n");
     printf("  -batch    disable all interactive prompts\n");
+    printf("  -batchjobs n\n");
+    printf("            read \"host command\" jobs from stdin, run n at a time\n");
     printf("  -proxycmd command\n");
     printf("            use 'command' as local proxy\n");
     printf("  -sercfg configuration-string (e.g. 19200,8,n,1,X)\n");
@@ -573,6 +684,7 @@ static void usage(void)
     printf("            open tunnel in place of session (SSH-2 only)\n");
     printf("  -sshlog file\n");
     printf("  -sshrawlog file\n");
+    printf("  -sshbinlog file\n");
     printf("            log protocol details to a file\n");
     printf("  -shareexists\n");
     printf("            test whether a connection-sharing upstream exists\n");
@@ -597,18 +709,14 @@ const int buildinfo_gtk_relevant = FALSE;
 int main(int argc, char **argv)
 {
     int sending;
-    int *fdlist;
-    int fd;
-    int i, fdcount, fdsize, fdstate;
     int exitcode;
     int errors;
     int use_subsystem = 0;
+    int batch_jobs = 0;
     int just_test_share_exists = FALSE;
     unsigned long now;
     struct winsize size;
 
-    fdlist = NULL;
-    fdcount = fdsize = 0;
     /*
      * Initialise port and protocol to sensible defaults. (These
      * will be overridden by more or less anything.)
@@ -666,6 +774,20 @@ int main(int argc, char **argv)
             continue;
         } else if (!strcmp(p, "-batch")) {
             console_batch_mode = 1;
+        } else if (!strcmp(p, "-batchjobs")) {
+            if (argc <= 1) {
+                fprintf(stderr,
+                        "plink: option \"-batchjobs\" requires an argument\n");
+                errors = 1;
+            } else {
+                --argc;
+                batch_jobs = atoi(*++argv);
+                if (batch_jobs <= 0) {
+                    fprintf(stderr, "plink: \"-batchjobs\" expects a "
+                            "positive number of parallel jobs\n");
+                    errors = 1;
+                }
+            }
         } else if (!strcmp(p, "-s")) {
             /* Save status to write to conf later. */
             use_subsystem = 1;
@@ -728,7 +850,22 @@ int main(int argc, char **argv)
     if (errors)
 	return 1;
 
-    if (!cmdline_host_ok(conf)) {
+    if (batch_jobs) {
+	/*
+	 * Batch mode: fork one child per job read from stdin; only
+	 * the children, each with conf set up for its own job,
+	 * continue past this point. Prompting is impossible with
+	 * several jobs sharing the terminal, so imply -batch.
+	 */
+	console_batch_mode = TRUE;
+	batch_jobs_run(conf, batch_jobs);
+    }
+
+    /*
+     * (In batch mode we've bypassed cmdline_host_ok's bookkeeping:
+     * each child's host came from its job line, not an argument.)
+     */
+    if (!batch_jobs && !cmdline_host_ok(conf)) {
 	usage();
     }
 
@@ -871,74 +1008,53 @@ int main(int argc, char **argv)
     now = GETTICKCOUNT();
 
     while (1) {
-	fd_set rset, wset, xset;
-	int maxfd;
-	int rwx;
+	int extra_fds[4], extra_rwx[4], extra_ready[4];
+	int nextra, spipe_ix, stdin_ix, stdout_ix, stderr_ix;
 	int ret;
         unsigned long next;
 
-	FD_ZERO(&rset);
-	FD_ZERO(&wset);
-	FD_ZERO(&xset);
-	maxfd = 0;
+	/*
+	 * The fds registered through uxsel_set are waited on (and
+	 * their callbacks dispatched) by uxsel_wait itself; we need
+	 * only supply the fds this loop handles by hand.
+	 */
+	nextra = 0;
+	spipe_ix = nextra;
+	extra_fds[nextra] = signalpipe[0];
+	extra_rwx[nextra++] = 1;
 
-	FD_SET_MAX(signalpipe[0], maxfd, rset);
+	stdin_ix = stdout_ix = stderr_ix = -1;
 
 	if (!sending &&
 	    back->connected(backhandle) &&
 	    back->sendok(backhandle) &&
 	    back->sendbuffer(backhandle) < MAX_STDIN_BACKLOG) {
 	    /* If we're OK to send, then try to read from stdin. */
-	    FD_SET_MAX(STDIN_FILENO, maxfd, rset);
+	    stdin_ix = nextra;
+	    extra_fds[nextra] = STDIN_FILENO;
+	    extra_rwx[nextra++] = 1;
 	}
 
 	if (bufchain_size(&stdout_data) > 0) {
 	    /* If we have data for stdout, try to write to stdout. */
-	    FD_SET_MAX(STDOUT_FILENO, maxfd, wset);
+	    stdout_ix = nextra;
+	    extra_fds[nextra] = STDOUT_FILENO;
+	    extra_rwx[nextra++] = 2;
 	}
 
 	if (bufchain_size(&stderr_data) > 0) {
 	    /* If we have data for stderr, try to write to stderr. */
-	    FD_SET_MAX(STDERR_FILENO, maxfd, wset);
-	}
-
-	/* Count the currently active fds. */
-	i = 0;
-	for (fd = first_fd(&fdstate, &rwx); fd >= 0;
-	     fd = next_fd(&fdstate, &rwx)) i++;
-
-	/* Expand the fdlist buffer if necessary. */
-	if (i > fdsize) {
-	    fdsize = i + 16;
-	    fdlist = sresize(fdlist, fdsize, int);
-	}
-
-	/*
-	 * Add all currently open fds to the select sets, and store
-	 * them in fdlist as well.
-	 */
-	fdcount = 0;
-	for (fd = first_fd(&fdstate, &rwx); fd >= 0;
-	     fd = next_fd(&fdstate, &rwx)) {
-	    fdlist[fdcount++] = fd;
-	    if (rwx & 1)
-		FD_SET_MAX(fd, maxfd, rset);
-	    if (rwx & 2)
-		FD_SET_MAX(fd, maxfd, wset);
-	    if (rwx & 4)
-		FD_SET_MAX(fd, maxfd, xset);
+	    stderr_ix = nextra;
+	    extra_fds[nextra] = STDERR_FILENO;
+	    extra_rwx[nextra++] = 2;
 	}
 
         if (toplevel_callback_pending()) {
-            struct timeval tv;
-            tv.tv_sec = 0;
-            tv.tv_usec = 0;
-            ret = select(maxfd, &rset, &wset, &xset, &tv);
+            ret = uxsel_wait(0, extra_fds, extra_rwx, extra_ready, nextra);
         } else if (run_timers(now, &next)) {
             do {
                 unsigned long then;
                 long ticks;
-                struct timeval tv;
 
 		then = now;
 		now = GETTICKCOUNT();
@@ -946,16 +1062,15 @@ int main(int argc, char **argv)
 		    ticks = 0;
 		else
 		    ticks = next - now;
-		tv.tv_sec = ticks / 1000;
-		tv.tv_usec = ticks % 1000 * 1000;
-                ret = select(maxfd, &rset, &wset, &xset, &tv);
+                ret = uxsel_wait(ticks, extra_fds, extra_rwx, extra_ready,
+                                 nextra);
                 if (ret == 0)
                     now = next;
                 else
                     now = GETTICKCOUNT();
             } while (ret < 0 && errno == EINTR);
         } else {
-            ret = select(maxfd, &rset, &wset, &xset, NULL);
+            ret = uxsel_wait(-1, extra_fds, extra_rwx, extra_ready, nextra);
         }
 
         if (ret < 0 && errno == EINTR)
@@ -966,22 +1081,7 @@ int main(int argc, char **argv)
 	    exit(1);
 	}
 
-	for (i = 0; i < fdcount; i++) {
-	    fd = fdlist[i];
-            /*
-             * We must process exceptional notifications before
-             * ordinary readability ones, or we may go straight
-             * past the urgent marker.
-             */
-	    if (FD_ISSET(fd, &xset))
-		select_result(fd, 4);
-	    if (FD_ISSET(fd, &rset))
-		select_result(fd, 1);
-	    if (FD_ISSET(fd, &wset))
-		select_result(fd, 2);
-	}
-
-	if (FD_ISSET(signalpipe[0], &rset)) {
+	if (extra_ready[spipe_ix] & 1) {
 	    char c[1];
 	    struct winsize size;
 	    if (read(signalpipe[0], c, 1) <= 0)
@@ -991,7 +1091,7 @@ int main(int argc, char **argv)
 		back->size(backhandle, size.ws_col, size.ws_row);
 	}
 
-	if (FD_ISSET(STDIN_FILENO, &rset)) {
+	if (stdin_ix >= 0 && (extra_ready[stdin_ix] & 1)) {
 	    char buf[4096];
 	    int ret;
 
@@ -1002,7 +1102,7 @@ int main(int argc, char **argv)
 		    exit(1);
 		} else if (ret == 0) {
 		    back->special(backhandle, TS_EOF);
-		    sending = FALSE;   /* send nothing further after this */
+		    sending = TRUE;    /* send nothing further after this */
 		} else {
 		    if (local_tty)
 			from_tty(buf, ret);
@@ -1012,11 +1112,11 @@ int main(int argc, char **argv)
 	    }
 	}
 
-	if (FD_ISSET(STDOUT_FILENO, &wset)) {
+	if (stdout_ix >= 0 && (extra_ready[stdout_ix] & 2)) {
 	    back->unthrottle(backhandle, try_output(FALSE));
 	}
 
-	if (FD_ISSET(STDERR_FILENO, &wset)) {
+	if (stderr_ix >= 0 && (extra_ready[stderr_ix] & 2)) {
 	    back->unthrottle(backhandle, try_output(TRUE));
 	}
 
@@ -4,12 +4,77 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 #include "putty.h"
 
+/*
+ * Print data is staged into a bufchain and drained by a background
+ * spool thread, so that a slow or wedged print command doesn't stall
+ * the terminal: printer_job_data is called inline from term_out's
+ * media-copy handling, and with the old synchronous fwrite a
+ * misdirected binary dump to a print-enabled session froze the whole
+ * connection for as long as the pipe stayed full. The staging buffer
+ * is bounded; once PRINT_SPOOL_LIMIT bytes are pending we block the
+ * producer rather than buffer without limit, which is no worse than
+ * the old behaviour and only happens when the spooler genuinely
+ * can't keep up.
+ */
+#define PRINT_SPOOL_LIMIT 1048576      /* 1MB of pending print data */
+#define PRINT_SPOOL_CHUNK 16384	       /* max bytes written per lock drop */
+
 struct printer_job_tag {
     FILE *fp;
+    int threaded;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t data_cond;	       /* signalled when data or finish */
+    pthread_cond_t drain_cond;	       /* signalled when spool has room */
+    bufchain spool;		       /* protected by mutex */
+    int finishing;
 };
 
+static void *printer_threadfunc(void *vpj)
+{
+    printer_job *pj = (printer_job *)vpj;
+    char chunk[PRINT_SPOOL_CHUNK];
+
+    pthread_mutex_lock(&pj->mutex);
+    while (1) {
+	void *data;
+	int len;
+
+	if (bufchain_size(&pj->spool) == 0) {
+	    if (pj->finishing)
+		break;
+	    pthread_cond_wait(&pj->data_cond, &pj->mutex);
+	    continue;
+	}
+
+	/*
+	 * Copy a chunk out under the lock, then do the possibly-slow
+	 * fwrite with the lock dropped so the producer isn't held up
+	 * by the spooler's pace.
+	 */
+	bufchain_prefix(&pj->spool, &data, &len);
+	if (len > PRINT_SPOOL_CHUNK)
+	    len = PRINT_SPOOL_CHUNK;
+	memcpy(chunk, data, len);
+	bufchain_consume(&pj->spool, len);
+	if (bufchain_size(&pj->spool) < PRINT_SPOOL_LIMIT)
+	    pthread_cond_signal(&pj->drain_cond);
+	pthread_mutex_unlock(&pj->mutex);
+
+	if (fwrite(chunk, 1, len, pj->fp) < len)
+	    /* ignore */;
+
+	pthread_mutex_lock(&pj->mutex);
+    }
+    pthread_mutex_unlock(&pj->mutex);
+
+    return NULL;
+}
+
 printer_job *printer_start_job(char *printer)
 {
     printer_job *ret = snew(printer_job);
@@ -20,7 +85,17 @@ printer_job *printer_start_job(char *printer)
     ret->fp = popen(printer, "w");
     if (!ret->fp) {
 	sfree(ret);
-	ret = NULL;
+	return NULL;
+    }
+
+    ret->threaded = FALSE;
+    ret->finishing = FALSE;
+    bufchain_init(&ret->spool);
+    if (pthread_mutex_init(&ret->mutex, NULL) == 0) {
+	pthread_cond_init(&ret->data_cond, NULL);
+	pthread_cond_init(&ret->drain_cond, NULL);
+	if (pthread_create(&ret->thread, NULL, printer_threadfunc, ret) == 0)
+	    ret->threaded = TRUE;      /* else fall back to synchronous */
     }
     return ret;
 }
@@ -30,8 +105,18 @@ void printer_job_data(printer_job *pj, void *data, int len)
     if (!pj)
 	return;
 
-    if (fwrite(data, 1, len, pj->fp) < len)
-	/* ignore */;
+    if (!pj->threaded) {
+	if (fwrite(data, 1, len, pj->fp) < len)
+	    /* ignore */;
+	return;
+    }
+
+    pthread_mutex_lock(&pj->mutex);
+    while (bufchain_size(&pj->spool) >= PRINT_SPOOL_LIMIT)
+	pthread_cond_wait(&pj->drain_cond, &pj->mutex);
+    bufchain_add(&pj->spool, data, len);
+    pthread_cond_signal(&pj->data_cond);
+    pthread_mutex_unlock(&pj->mutex);
 }
 
 void printer_finish_job(printer_job *pj)
@@ -39,6 +124,18 @@ void printer_finish_job(printer_job *pj)
     if (!pj)
 	return;
 
+    if (pj->threaded) {
+	pthread_mutex_lock(&pj->mutex);
+	pj->finishing = TRUE;
+	pthread_cond_signal(&pj->data_cond);
+	pthread_mutex_unlock(&pj->mutex);
+	pthread_join(pj->thread, NULL);
+	pthread_cond_destroy(&pj->drain_cond);
+	pthread_cond_destroy(&pj->data_cond);
+	pthread_mutex_destroy(&pj->mutex);
+	bufchain_clear(&pj->spool);
+    }
+
     pclose(pj->fp);
     sfree(pj);
 }
@@ -579,9 +579,19 @@ void pty_pre_init(void)
 
 }
 
+/*
+ * The pty master fd is nonblocking, so when it turns readable we can
+ * drain everything currently buffered (up to this budget) in one go
+ * and hand the frontend a single large batch, instead of doing one 4K
+ * read and one from_backend call per event-loop iteration. The budget
+ * stops a process generating output flat out from starving the rest
+ * of the event loop.
+ */
+#define PTY_READ_BUDGET 65536
+
 void pty_real_select_result(Pty pty, int event, int status)
 {
-    char buf[4096];
+    static char buf[PTY_READ_BUDGET];
     int ret;
     int finished = FALSE;
 
@@ -608,8 +618,13 @@ void pty_real_select_result(Pty pty, int event, int status)
 	}
     } else {
 	if (event == 1) {
+	    int got = 0;
 
-	    ret = read(pty->master_fd, buf, sizeof(buf));
+	    ret = 1;
+	    while (got < PTY_READ_BUDGET &&
+		   (ret = read(pty->master_fd, buf + got,
+			       PTY_READ_BUDGET - got)) > 0)
+		got += ret;
 
 	    /*
 	     * Clean termination condition is that either ret == 0, or ret
@@ -628,12 +643,17 @@ void pty_real_select_result(Pty pty, int event, int status)
 		finished = TRUE;
 		if (!pty->child_dead)
 		    pty->exit_code = 0;
-	    } else if (ret < 0) {
+	    } else if (ret < 0 && !(errno == EAGAIN || errno == EWOULDBLOCK)) {
 		perror("read pty master");
 		exit(1);
-	    } else if (ret > 0) {
-		from_backend(pty->frontend, 0, buf, ret);
 	    }
+	    /*
+	     * If we filled the whole budget, the fd is quite likely
+	     * still readable; uxsel will call us straight back for
+	     * the rest.
+	     */
+	    if (got > 0)
+		from_backend(pty->frontend, 0, buf, got);
 	} else if (event == 2) {
             /*
              * Attempt to send data down the pty.
@@ -0,0 +1,85 @@
+/*
+ * uxsbfile.c: Unix implementation of the scrollback spill file, an
+ * anonymous temporary file with a growable memory mapping that
+ * terminal.c uses to keep compressed scrollback out of the heap.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "putty.h"
+
+struct sbfile_tag {
+    int fd;
+    unsigned char *map;
+    size_t mapsize;
+};
+
+sbfile *sbfile_new(void)
+{
+    sbfile *f;
+    const char *dir;
+    int fd = -1;
+
+    dir = getenv("TMPDIR");
+    if (!dir)
+	dir = "/tmp";
+
+#ifdef O_TMPFILE
+    /*
+     * Where available, O_TMPFILE gives us a file with no name at all,
+     * which can't be raced against and needs no unlink.
+     */
+    fd = open(dir, O_TMPFILE | O_RDWR, 0600);
+#endif
+    if (fd < 0) {
+	/* Fall back to mkstemp and immediately unlinking the name. */
+	char *name = dupprintf("%s/putty-scrollback-XXXXXX", dir);
+	fd = mkstemp(name);
+	if (fd >= 0)
+	    unlink(name);
+	sfree(name);
+    }
+    if (fd < 0)
+	return NULL;
+    cloexec(fd);
+
+    f = snew(sbfile);
+    f->fd = fd;
+    f->map = NULL;
+    f->mapsize = 0;
+    return f;
+}
+
+unsigned char *sbfile_map(sbfile *f, size_t size)
+{
+    void *map;
+
+    if (ftruncate(f->fd, (off_t)size) < 0)
+	return NULL;
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+    if (map == MAP_FAILED)
+	return NULL;
+    /*
+     * Only discard the old mapping once the new one exists, so that a
+     * failure above leaves the already-spilled data still readable.
+     */
+    if (f->map)
+	munmap(f->map, f->mapsize);
+    f->map = map;
+    f->mapsize = size;
+    return f->map;
+}
+
+void sbfile_free(sbfile *f)
+{
+    if (!f)
+	return;
+    if (f->map)
+	munmap(f->map, f->mapsize);
+    close(f->fd);
+    sfree(f);
+}
@@ -11,10 +11,16 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
 
 #include "putty.h"
 #include "tree234.h"
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 struct fd {
     int fd;
     int rwx;			       /* 4=except 2=write 1=read */
@@ -45,9 +51,32 @@ static int uxsel_fd_findcmp(void *av, void *bv)
     return 0;
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+static int epfd = -1;
+
+static unsigned uxsel_epoll_events(int rwx)
+{
+    return ((rwx & 1 ? EPOLLIN : 0) |
+	    (rwx & 2 ? EPOLLOUT : 0) |
+	    (rwx & 4 ? EPOLLPRI : 0));
+}
+#endif
+
 void uxsel_init(void)
 {
     fds = newtree234(uxsel_fd_cmp);
+
+#ifdef HAVE_SYS_EPOLL_H
+    /*
+     * Try to set up an epoll instance, so that uxsel_wait needn't
+     * rebuild its interest set from the whole fd list on every call.
+     * If this fails (e.g. a kernel too old to have epoll), epfd
+     * stays at -1 and uxsel_wait falls back to select().
+     */
+    epfd = epoll_create(32);
+    if (epfd >= 0)
+	cloexec(epfd);
+#endif
 }
 
 /*
@@ -75,6 +104,16 @@ void uxsel_set(int fd, int rwx, uxsel_callback_fn callback)
 	newfd->callback = callback;
 	newfd->id = uxsel_input_add(fd, rwx);
 	add234(fds, newfd);
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (epfd >= 0) {
+	    struct epoll_event ev;
+	    memset(&ev, 0, sizeof(ev));
+	    ev.events = uxsel_epoll_events(rwx);
+	    ev.data.fd = fd;
+	    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	}
+#endif
     }
 }
 
@@ -84,6 +123,10 @@ void uxsel_del(int fd)
     if (oldfd) {
 	if (oldfd->id)
             uxsel_input_remove(oldfd->id);
+#ifdef HAVE_SYS_EPOLL_H
+	if (epfd >= 0)
+	    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
 	del234(fds, oldfd);
 	sfree(oldfd);
     }
@@ -122,3 +165,206 @@ void select_result(int fd, int event)
     if (fdstruct)
         fdstruct->callback(fd, event);
 }
+
+/*
+ * All-in-one wait function for the CLI tools' main loops: waits for
+ * activity on every fd registered through uxsel_set, dispatching
+ * their callbacks via select_result, plus up to UXSEL_MAXEXTRA
+ * caller-supplied fds (in the same rwx encoding) whose readiness is
+ * reported back in extra_ready[] instead. timeout is in
+ * milliseconds, or negative to block indefinitely; the return value
+ * is as for select(): negative on error with errno set, zero on
+ * timeout, positive if any fd was ready.
+ *
+ * Where epoll is available, this avoids rescanning the whole fd
+ * list on every call: the fds registered through uxsel_set are kept
+ * registered with the kernel, so each call costs O(fds ready)
+ * rather than O(fds watched).
+ */
+int uxsel_wait(long timeout, const int *extra_fds, const int *extra_rwx,
+	       int *extra_ready, int nextra)
+{
+    int i, ret;
+
+    assert(nextra <= UXSEL_MAXEXTRA);
+
+    for (i = 0; i < nextra; i++)
+	extra_ready[i] = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (epfd >= 0) {
+	static int prev_fds[UXSEL_MAXEXTRA], prev_rwx[UXSEL_MAXEXTRA];
+	static int prev_unpollable[UXSEL_MAXEXTRA];
+	static int nprev = 0;
+	struct epoll_event evs[64];
+	int changed, nready, epto;
+
+	/*
+	 * Bring the extra fds' registrations up to date. These
+	 * hardly ever change from one call to the next, so diffing
+	 * against the previous call's set avoids issuing epoll_ctl
+	 * syscalls in the common case.
+	 */
+	changed = (nextra != nprev);
+	for (i = 0; !changed && i < nextra; i++)
+	    if (prev_fds[i] != extra_fds[i] || prev_rwx[i] != extra_rwx[i])
+		changed = TRUE;
+	if (changed) {
+	    for (i = 0; i < nprev; i++)
+		if (!prev_unpollable[i])
+		    epoll_ctl(epfd, EPOLL_CTL_DEL, prev_fds[i], NULL);
+	    for (i = 0; i < nextra; i++) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = uxsel_epoll_events(extra_rwx[i]);
+		ev.data.fd = extra_fds[i];
+		prev_fds[i] = extra_fds[i];
+		prev_rwx[i] = extra_rwx[i];
+		/*
+		 * epoll refuses plain files (e.g. stdin redirected
+		 * from a regular file). Such fds are always ready,
+		 * so we just report them as such on every call.
+		 */
+		prev_unpollable[i] =
+		    (epoll_ctl(epfd, EPOLL_CTL_ADD, extra_fds[i], &ev) < 0);
+	    }
+	    nprev = nextra;
+	}
+
+	nready = 0;
+	for (i = 0; i < nextra; i++)
+	    if (prev_unpollable[i]) {
+		extra_ready[i] = extra_rwx[i];
+		nready++;
+	    }
+
+	epto = timeout < 0 ? -1 : (int)timeout;
+	if (nready > 0)
+	    epto = 0;
+
+#ifdef SYSCALL_AUDIT
+	syscall_audit_count(SCA_WAIT);
+#endif
+	ret = epoll_wait(epfd, evs, lenof(evs), epto);
+	tickcount_cache_refresh();
+	if (ret < 0)
+	    return ret;		       /* typically EINTR */
+
+	for (i = 0; i < ret; i++) {
+	    int fd = evs[i].data.fd;
+	    int j;
+
+	    for (j = 0; j < nextra; j++)
+		if (extra_fds[j] == fd)
+		    break;
+	    if (j < nextra) {
+		if (evs[i].events & EPOLLPRI)
+		    extra_ready[j] |= 4;
+		if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		    extra_ready[j] |= 1;
+		if (evs[i].events & EPOLLOUT)
+		    extra_ready[j] |= 2;
+		continue;
+	    }
+
+	    /*
+	     * As in the select-based loops, we must process
+	     * exceptional notifications before ordinary readability
+	     * ones, or we may go straight past the urgent marker.
+	     */
+	    if (evs[i].events & EPOLLPRI)
+		select_result(fd, 4);
+	    if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		select_result(fd, 1);
+	    if (evs[i].events & EPOLLOUT)
+		select_result(fd, 2);
+	}
+
+	return ret + nready;
+    }
+#endif
+
+    /*
+     * Fallback: do what the main loops always used to do, and build
+     * select sets by enumerating the fd list.
+     */
+    {
+	static int *fdlist = NULL;
+	static int fdsize = 0;
+	fd_set rset, wset, xset;
+	int fd, fdstate, rwx, fdcount, maxfd;
+	struct timeval tv, *ptv;
+
+	i = 0;
+	for (fd = first_fd(&fdstate, &rwx); fd >= 0;
+	     fd = next_fd(&fdstate, &rwx)) i++;
+
+	if (i > fdsize) {
+	    fdsize = i + 16;
+	    fdlist = sresize(fdlist, fdsize, int);
+	}
+
+	FD_ZERO(&rset);
+	FD_ZERO(&wset);
+	FD_ZERO(&xset);
+	maxfd = 0;
+
+	fdcount = 0;
+	for (fd = first_fd(&fdstate, &rwx); fd >= 0;
+	     fd = next_fd(&fdstate, &rwx)) {
+	    fdlist[fdcount++] = fd;
+	    if (rwx & 1)
+		FD_SET_MAX(fd, maxfd, rset);
+	    if (rwx & 2)
+		FD_SET_MAX(fd, maxfd, wset);
+	    if (rwx & 4)
+		FD_SET_MAX(fd, maxfd, xset);
+	}
+
+	for (i = 0; i < nextra; i++) {
+	    if (extra_rwx[i] & 1)
+		FD_SET_MAX(extra_fds[i], maxfd, rset);
+	    if (extra_rwx[i] & 2)
+		FD_SET_MAX(extra_fds[i], maxfd, wset);
+	    if (extra_rwx[i] & 4)
+		FD_SET_MAX(extra_fds[i], maxfd, xset);
+	}
+
+	if (timeout < 0) {
+	    ptv = NULL;
+	} else {
+	    tv.tv_sec = timeout / 1000;
+	    tv.tv_usec = timeout % 1000 * 1000;
+	    ptv = &tv;
+	}
+
+#ifdef SYSCALL_AUDIT
+	syscall_audit_count(SCA_WAIT);
+#endif
+	ret = select(maxfd, &rset, &wset, &xset, ptv);
+	tickcount_cache_refresh();
+	if (ret <= 0)
+	    return ret;
+
+	for (i = 0; i < fdcount; i++) {
+	    fd = fdlist[i];
+	    if (FD_ISSET(fd, &xset))
+		select_result(fd, 4);
+	    if (FD_ISSET(fd, &rset))
+		select_result(fd, 1);
+	    if (FD_ISSET(fd, &wset))
+		select_result(fd, 2);
+	}
+
+	for (i = 0; i < nextra; i++) {
+	    if (FD_ISSET(extra_fds[i], &rset))
+		extra_ready[i] |= 1;
+	    if (FD_ISSET(extra_fds[i], &wset))
+		extra_ready[i] |= 2;
+	    if (FD_ISSET(extra_fds[i], &xset))
+		extra_ready[i] |= 4;
+	}
+
+	return ret;
+    }
+}
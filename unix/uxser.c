@@ -11,11 +11,13 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <sys/uio.h>
 
 #include "putty.h"
 #include "tree234.h"
 
 #define SERIAL_MAX_BACKLOG 4096
+#define SERIAL_MAXIOV 16
 
 typedef struct serial_backend_data {
     void *frontend;
@@ -23,6 +25,7 @@ typedef struct serial_backend_data {
     int finished;
     int inbufsize;
     bufchain output_data;
+    unsigned long wr_bytes, wr_calls;  /* throughput counters, for the log */
 } *Serial;
 
 /*
@@ -302,6 +305,7 @@ static const char *serial_init(void *frontend_handle, void **backend_handle,
     serial->frontend = frontend_handle;
     serial->finished = FALSE;
     serial->inbufsize = 0;
+    serial->wr_bytes = serial->wr_calls = 0;
     bufchain_init(&serial->output_data);
 
     line = conf_get_str(conf, CONF_serline);
@@ -340,6 +344,13 @@ static const char *serial_init(void *frontend_handle, void **backend_handle,
 static void serial_close(Serial serial)
 {
     if (serial->fd >= 0) {
+	if (serial->wr_calls) {
+	    char *msg = dupprintf("Wrote %lu bytes to the serial port in %lu"
+				  " system calls", serial->wr_bytes,
+				  serial->wr_calls);
+	    logevent(serial->frontend, msg);
+	    sfree(msg);
+	}
 	close(serial->fd);
 	serial->fd = -1;
     }
@@ -432,14 +443,31 @@ static void serial_uxsel_setup(Serial serial)
 
 static void serial_try_write(Serial serial)
 {
-    void *data;
-    int len, ret;
+    int ret;
 
     assert(serial->fd >= 0);
 
     while (bufchain_size(&serial->output_data) > 0) {
-        bufchain_prefix(&serial->output_data, &data, &len);
-	ret = write(serial->fd, data, len);
+	/*
+	 * Gather as many segments of the output bufchain as we can
+	 * into one writev call. A burst of small ldisc sends (e.g. a
+	 * firmware upload pushing a line at a time) then reaches the
+	 * tty layer in a few large writes rather than one per chunk,
+	 * which in turn keeps USB serial adapters filling whole
+	 * transactions instead of sending a fragment in each.
+	 */
+	void *datas[SERIAL_MAXIOV];
+	int lens[SERIAL_MAXIOV];
+	struct iovec iov[SERIAL_MAXIOV];
+	int i, niov;
+
+	niov = bufchain_prefix_vec(&serial->output_data, datas, lens,
+				   SERIAL_MAXIOV);
+	for (i = 0; i < niov; i++) {
+	    iov[i].iov_base = datas[i];
+	    iov[i].iov_len = lens[i];
+	}
+	ret = writev(serial->fd, iov, niov);
 
         if (ret < 0 && (errno == EWOULDBLOCK)) {
             /*
@@ -451,6 +479,8 @@ static void serial_try_write(Serial serial)
 	    perror("write serial port");
 	    exit(1);
 	}
+	serial->wr_bytes += ret;
+	serial->wr_calls++;
 	bufchain_consume(&serial->output_data, ret);
     }
 
@@ -5,6 +5,7 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <dirent.h>
@@ -131,6 +132,18 @@ RFile *open_existing_file(const char *name, uint64 *size,
     if (fd < 0)
 	return NULL;
 
+#if defined(POSIX_FADV_SEQUENTIAL)
+    /*
+     * Advise the kernel that we'll be reading this file straight
+     * through, so it runs its read-ahead well in front of us. The
+     * transfer loops fetch each chunk from disk before blocking on
+     * the network, so with the kernel prefetching in parallel the
+     * read() calls nearly always hit the page cache and a disk
+     * stall doesn't freeze the transfer pipeline.
+     */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
     ret = snew(RFile);
     ret->fd = fd;
 
@@ -219,6 +232,38 @@ WFile *open_existing_wfile(const char *name, uint64 *size)
     return ret;
 }
 
+WFile *open_wfile_shard(const char *name, long perms, uint64 size,
+			uint64 offset)
+{
+    int fd;
+    WFile *ret;
+
+    fd = open(name, O_CREAT | O_WRONLY,
+	      (mode_t)(perms ? perms : 0666));
+    if (fd < 0)
+	return NULL;
+
+    /*
+     * Deliberately no O_TRUNC: other shards may already have written
+     * their parts of this file. Setting the length explicitly both
+     * clears any stale tail left by a previous file of the same name
+     * and is idempotent between shards, since all their writes land
+     * below it.
+     */
+    if (ftruncate(fd, (((off_t) size.hi << 16) << 16) + size.lo) < 0 ||
+	lseek(fd, (((off_t) offset.hi << 16) << 16) + offset.lo,
+	      SEEK_SET) < 0) {
+	close(fd);
+	return NULL;
+    }
+
+    ret = snew(WFile);
+    ret->fd = fd;
+    ret->name = dupstr(name);
+
+    return ret;
+}
+
 int write_to_file(WFile *f, void *buffer, int length)
 {
     char *p = (char *)buffer;
@@ -622,6 +667,50 @@ void frontend_net_error_pending(void) {}
 
 void platform_psftp_pre_conn_setup(void) {}
 
+/*
+ * Fork one process per shard for `pscp -shard'. Each child goes on
+ * to make its own SSH connection and transfer its own byte ranges;
+ * the parent just collects exit statuses. The children inherit the
+ * same on-disk random seed, so each one stirs in its pid and the
+ * clock before any session keys get generated.
+ */
+int shard_processes(int count)
+{
+    int i, status, failed = FALSE;
+    pid_t pid;
+    struct timeval tv;
+
+    for (i = 0; i < count; i++) {
+	pid = fork();
+	if (pid < 0) {
+	    /*
+	     * Shards we couldn't start leave their byte ranges
+	     * untransferred, so the best we can do is report overall
+	     * failure once the shards that did start are finished.
+	     */
+	    perror("pscp: fork");
+	    failed = TRUE;
+	    break;
+	}
+	if (pid == 0) {
+	    random_ref();
+	    noise_ultralight(getpid());
+	    gettimeofday(&tv, NULL);
+	    noise_ultralight(tv.tv_sec ^ tv.tv_usec);
+	    return i;
+	}
+    }
+
+    while (wait(&status) >= 0 || errno != ECHILD) {
+	if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+	    failed = TRUE;
+	else if (WIFSIGNALED(status))
+	    failed = TRUE;
+    }
+
+    exit(failed ? 1 : 0);
+}
+
 const int buildinfo_gtk_relevant = FALSE;
 
 /*
@@ -28,7 +28,8 @@
 
 enum {
     INDEX_DIR, INDEX_HOSTKEYS, INDEX_HOSTKEYS_TMP, INDEX_RANDSEED,
-    INDEX_SESSIONDIR, INDEX_SESSION,
+    INDEX_SESSIONDIR, INDEX_SESSION, INDEX_KEXCACHE, INDEX_KEXCACHE_TMP,
+    INDEX_AUTHCACHE, INDEX_AUTHCACHE_TMP,
 };
 
 static const char hex[16] = "0123456789ABCDEF";
@@ -203,6 +204,30 @@ static char *make_filename(int index, const char *subname)
 	sfree(tmp);
 	return ret;
     }
+    if (index == INDEX_KEXCACHE) {
+	tmp = make_filename(INDEX_DIR, NULL);
+	ret = dupprintf("%s/sshkexcache", tmp);
+	sfree(tmp);
+	return ret;
+    }
+    if (index == INDEX_KEXCACHE_TMP) {
+	tmp = make_filename(INDEX_KEXCACHE, NULL);
+	ret = dupprintf("%s.tmp", tmp);
+	sfree(tmp);
+	return ret;
+    }
+    if (index == INDEX_AUTHCACHE) {
+	tmp = make_filename(INDEX_DIR, NULL);
+	ret = dupprintf("%s/sshauthcache", tmp);
+	sfree(tmp);
+	return ret;
+    }
+    if (index == INDEX_AUTHCACHE_TMP) {
+	tmp = make_filename(INDEX_AUTHCACHE, NULL);
+	ret = dupprintf("%s.tmp", tmp);
+	sfree(tmp);
+	return ret;
+    }
     if (index == INDEX_RANDSEED) {
 	env = getenv("PUTTYRANDOMSEED");
 	if (env)
@@ -218,9 +243,24 @@ static char *make_filename(int index, const char *subname)
     return ret;
 }
 
+/*
+ * The handle returned by open_settings_w wraps the real session
+ * file name and a stdio handle on a temporary file next to it. All
+ * the write_setting_*() output goes to the temporary file, and
+ * close_settings_w() renames it over the real one, so a session
+ * save is atomic: a crash or full disk part way through a save
+ * leaves the previously saved settings intact rather than a
+ * truncated file.
+ */
+struct settings_w {
+    FILE *fp;
+    char *filename, *tmpname;
+};
+
 void *open_settings_w(const char *sessionname, char **errmsg)
 {
-    char *filename, *err;
+    struct settings_w *handle;
+    char *filename, *tmpname, *err;
     FILE *fp;
 
     *errmsg = NULL;
@@ -248,33 +288,56 @@ void *open_settings_w(const char *sessionname, char **errmsg)
     sfree(filename);
 
     filename = make_filename(INDEX_SESSION, sessionname);
-    fp = fopen(filename, "w");
+    tmpname = dupprintf("%s.tmp.%d", filename, (int)getpid());
+    fp = fopen(tmpname, "w");
     if (!fp) {
         *errmsg = dupprintf("Unable to save session: open(\"%s\") "
-                            "returned '%s'", filename, strerror(errno));
+                            "returned '%s'", tmpname, strerror(errno));
 	sfree(filename);
+	sfree(tmpname);
 	return NULL;                   /* can't open */
     }
-    sfree(filename);
-    return fp;
+
+    handle = snew(struct settings_w);
+    handle->fp = fp;
+    handle->filename = filename;
+    handle->tmpname = tmpname;
+    return handle;
 }
 
 void write_setting_s(void *handle, const char *key, const char *value)
 {
-    FILE *fp = (FILE *)handle;
+    FILE *fp = ((struct settings_w *)handle)->fp;
     fprintf(fp, "%s=%s\n", key, value);
 }
 
 void write_setting_i(void *handle, const char *key, int value)
 {
-    FILE *fp = (FILE *)handle;
+    FILE *fp = ((struct settings_w *)handle)->fp;
     fprintf(fp, "%s=%d\n", key, value);
 }
 
 void close_settings_w(void *handle)
 {
-    FILE *fp = (FILE *)handle;
-    fclose(fp);
+    struct settings_w *h = (struct settings_w *)handle;
+    int ok;
+
+    /*
+     * Only rename the temporary file into place if every write
+     * actually reached it; otherwise throw it away and leave any
+     * previous save of this session alone.
+     */
+    ok = !ferror(h->fp);
+    if (fclose(h->fp) < 0)
+        ok = FALSE;
+    if (ok)
+        ok = (rename(h->tmpname, h->filename) == 0);
+    if (!ok)
+        unlink(h->tmpname);
+
+    sfree(h->filename);
+    sfree(h->tmpname);
+    sfree(h);
 }
 
 /*
@@ -517,136 +580,190 @@ void del_settings(const char *sessionname)
     sfree(filename);
 }
 
+struct enum_settings_state {
+    DIR *dp;
+    char *dir;			       /* kept for the stat() fallback */
+};
+
 void *enum_settings_start(void)
 {
+    struct enum_settings_state *es;
     DIR *dp;
     char *filename;
 
     filename = make_filename(INDEX_SESSIONDIR, NULL);
     dp = opendir(filename);
-    sfree(filename);
+    if (!dp) {
+        sfree(filename);
+        return NULL;
+    }
 
-    return dp;
+    es = snew(struct enum_settings_state);
+    es->dp = dp;
+    es->dir = filename;
+    return es;
 }
 
 char *enum_settings_next(void *handle, char *buffer, int buflen)
 {
-    DIR *dp = (DIR *)handle;
+    struct enum_settings_state *es = (struct enum_settings_state *)handle;
     struct dirent *de;
     struct stat st;
-    char *fullpath;
-    int maxlen, thislen, len;
     char *unmunged;
 
-    fullpath = make_filename(INDEX_SESSIONDIR, NULL);
-    maxlen = len = strlen(fullpath);
-
-    while ( (de = readdir(dp)) != NULL ) {
-        thislen = len + 1 + strlen(de->d_name);
-	if (maxlen < thislen) {
-	    maxlen = thislen;
-	    fullpath = sresize(fullpath, maxlen+1, char);
-	}
-	fullpath[len] = '/';
-	strncpy(fullpath+len+1, de->d_name, thislen - (len+1));
-	fullpath[thislen] = '\0';
+    while ( (de = readdir(es->dp)) != NULL ) {
+        /*
+         * mungestr never emits a leading dot, so this cheaply skips
+         * "." and ".." (and dotfiles) without a stat each.
+         */
+        if (de->d_name[0] == '.')
+            continue;
 
-        if (stat(fullpath, &st) < 0 || !S_ISREG(st.st_mode))
-            continue;                  /* try another one */
+        /*
+         * Use d_type to identify regular files where the C library
+         * and filesystem provide it, so that enumerating a large
+         * session directory doesn't cost a stat() per entry; fall
+         * back to stat() where they don't.
+         */
+#if defined(_DIRENT_HAVE_D_TYPE)
+        if (de->d_type != DT_UNKNOWN) {
+            if (de->d_type != DT_REG)
+                continue;              /* try another one */
+        } else
+#endif
+        {
+            char *fullpath = dupcat(es->dir, "/", de->d_name, NULL);
+            int isreg = (stat(fullpath, &st) == 0 && S_ISREG(st.st_mode));
+            sfree(fullpath);
+            if (!isreg)
+                continue;              /* try another one */
+        }
 
         unmunged = unmungestr(de->d_name);
         strncpy(buffer, unmunged, buflen);
         buffer[buflen-1] = '\0';
         sfree(unmunged);
-	sfree(fullpath);
         return buffer;
     }
 
-    sfree(fullpath);
     return NULL;
 }
 
 void enum_settings_finish(void *handle)
 {
-    DIR *dp = (DIR *)handle;
-    closedir(dp);
+    struct enum_settings_state *es = (struct enum_settings_state *)handle;
+
+    closedir(es->dp);
+    sfree(es->dir);
+    sfree(es);
 }
 
 /*
  * Lines in the host keys file are of the form
- * 
+ *
  *   type@port:hostname keydata
- * 
+ *
  * e.g.
- * 
+ *
  *   rsa@22:foovax.example.org 0x23,0x293487364395345345....2343
+ *
+ * Rather than rescanning the whole file on every connection - with a
+ * large store, each session open paid a scan of every line - we
+ * parse it once into a tree234 indexed by the "type@port:hostname"
+ * identifier, and keep that for the lifetime of the process. The
+ * file's mtime is recorded at load time and checked on each lookup,
+ * so a store modified by another process (or by hand) is reloaded.
  */
-int verify_host_key(const char *hostname, int port,
-		    const char *keytype, const char *key)
+struct hostkey_index_entry {
+    char *id;			       /* "type@port:hostname" */
+    char *key;			       /* what comes after the space */
+};
+
+static tree234 *hostkey_index = NULL;
+static time_t hostkey_index_mtime;
+
+static int hostkey_index_cmp(void *av, void *bv)
+{
+    struct hostkey_index_entry *a = (struct hostkey_index_entry *)av;
+    struct hostkey_index_entry *b = (struct hostkey_index_entry *)bv;
+    return strcmp(a->id, b->id);
+}
+
+static void hostkey_index_load(void)
 {
     FILE *fp;
-    char *filename;
-    char *line;
-    int ret;
+    char *filename, *line;
+    struct hostkey_index_entry *entry;
+    struct stat st;
+    time_t mtime;
 
     filename = make_filename(INDEX_HOSTKEYS, NULL);
+    mtime = (stat(filename, &st) == 0 ? st.st_mtime : 0);
+
+    if (hostkey_index && mtime == hostkey_index_mtime) {
+	sfree(filename);
+	return;			       /* index is already up to date */
+    }
+
+    if (hostkey_index) {
+	while ((entry = delpos234(hostkey_index, 0)) != NULL) {
+	    sfree(entry->id);
+	    sfree(entry->key);
+	    sfree(entry);
+	}
+    } else {
+	hostkey_index = newtree234(hostkey_index_cmp);
+    }
+    hostkey_index_mtime = mtime;
+
     fp = fopen(filename, "r");
     sfree(filename);
     if (!fp)
-	return 1;		       /* key does not exist */
+	return;			       /* no file; index stays empty */
 
-    ret = 1;
     while ( (line = fgetline(fp)) ) {
-	int i;
-	char *p = line;
-	char porttext[20];
+	int idlen;
 
 	line[strcspn(line, "\n")] = '\0';   /* strip trailing newline */
 
-	i = strlen(keytype);
-	if (strncmp(p, keytype, i))
-	    goto done;
-	p += i;
-
-	if (*p != '@')
-	    goto done;
-	p++;
-
-	sprintf(porttext, "%d", port);
-	i = strlen(porttext);
-	if (strncmp(p, porttext, i))
-	    goto done;
-	p += i;
-
-	if (*p != ':')
-	    goto done;
-	p++;
-
-	i = strlen(hostname);
-	if (strncmp(p, hostname, i))
-	    goto done;
-	p += i;
-
-	if (*p != ' ')
-	    goto done;
-	p++;
-
-	/*
-	 * Found the key. Now just work out whether it's the right
-	 * one or not.
-	 */
-	if (!strcmp(p, key))
-	    ret = 0;		       /* key matched OK */
-	else
-	    ret = 2;		       /* key mismatch */
-
-	done:
+	idlen = strcspn(line, " ");
+	if (line[idlen] == ' ') {
+	    entry = snew(struct hostkey_index_entry);
+	    entry->id = dupprintf("%.*s", idlen, line);
+	    entry->key = dupstr(line + idlen + 1);
+	    if (add234(hostkey_index, entry) != entry) {
+		/* Duplicate identifier: the earliest line wins, as it
+		 * did when we scanned the file from the top. */
+		sfree(entry->id);
+		sfree(entry->key);
+		sfree(entry);
+	    }
+	}
 	sfree(line);
-	if (ret != 1)
-	    break;
     }
 
     fclose(fp);
+}
+
+int verify_host_key(const char *hostname, int port,
+		    const char *keytype, const char *key)
+{
+    struct hostkey_index_entry search, *entry;
+    int ret;
+
+    hostkey_index_load();
+
+    search.id = dupprintf("%s@%d:%s", keytype, port, hostname);
+    entry = find234(hostkey_index, &search, NULL);
+    sfree(search.id);
+
+    if (!entry)
+	ret = 1;		       /* key does not exist */
+    else if (!strcmp(entry->key, key))
+	ret = 0;		       /* key matched OK */
+    else
+	ret = 2;		       /* key mismatch */
+
     return ret;
 }
 
@@ -724,13 +841,155 @@ void store_host_key(const char *hostname, int port,
         nonfatal("Unable to store host key: rename(\"%s\",\"%s\")"
                  " returned '%s'", tmpfilename, filename,
                  strerror(errno));
+    } else if (hostkey_index) {
+        /*
+         * Keep the in-memory index in step with the file we just
+         * wrote, so the next lookup needn't reload it.
+         */
+        struct hostkey_index_entry search, *entry;
+        struct stat st;
+
+        search.id = dupprintf("%s@%d:%s", keytype, port, hostname);
+        entry = find234(hostkey_index, &search, NULL);
+        if (entry) {
+            sfree(search.id);
+            sfree(entry->key);
+            entry->key = dupstr(key);
+        } else {
+            entry = snew(struct hostkey_index_entry);
+            entry->id = search.id;
+            entry->key = dupstr(key);
+            add234(hostkey_index, entry);
+        }
+        if (stat(filename, &st) == 0)
+            hostkey_index_mtime = st.st_mtime;
+    }
+
+    sfree(tmpfilename);
+    sfree(filename);
+    sfree(newtext);
+}
+
+/*
+ * The per-host hint caches (learned kex algorithms, accepted auth
+ * keys) each live in their own file using the same line format as
+ * the host keys file, minus the key type:
+ *
+ *   port:hostname value
+ *
+ * They're hints rather than security records - a stale or missing
+ * entry just costs a guessed packet or a refused attempt - so no
+ * in-memory index is kept; each connection reads them at most once.
+ */
+static char *read_hint_cache(int index, const char *hostname, int port)
+{
+    FILE *fp;
+    char *filename, *line, *id, *ret;
+    int idlen;
+
+    filename = make_filename(index, NULL);
+    fp = fopen(filename, "r");
+    sfree(filename);
+    if (!fp)
+	return NULL;
+
+    id = dupprintf("%d:%s ", port, hostname);
+    idlen = strlen(id);
+
+    ret = NULL;
+    while ( (line = fgetline(fp)) ) {
+	line[strcspn(line, "\n")] = '\0';
+	if (!strncmp(line, id, idlen)) {
+	    ret = dupstr(line + idlen);
+	    sfree(line);
+	    break;
+	}
+	sfree(line);
+    }
+
+    sfree(id);
+    fclose(fp);
+    return ret;
+}
+
+static void store_hint_cache(int index, int tmpindex,
+			     const char *hostname, int port,
+			     const char *value)
+{
+    FILE *rfp, *wfp;
+    char *newtext, *line;
+    int headerlen;
+    char *filename, *tmpfilename;
+
+    tmpfilename = make_filename(tmpindex, NULL);
+    wfp = fopen(tmpfilename, "w");
+    if (!wfp && errno == ENOENT) {
+        char *dir, *errmsg;
+
+        dir = make_filename(INDEX_DIR, NULL);
+        if ((errmsg = make_dir_path(dir, 0700)) != NULL) {
+            sfree(errmsg);
+            sfree(dir);
+            sfree(tmpfilename);
+            return;		       /* a hint isn't worth a dialog box */
+        }
+	sfree(dir);
+
+        wfp = fopen(tmpfilename, "w");
+    }
+    if (!wfp) {
+        sfree(tmpfilename);
+        return;
+    }
+    filename = make_filename(index, NULL);
+    rfp = fopen(filename, "r");
+
+    newtext = dupprintf("%d:%s %s\n", port, hostname, value);
+    headerlen = 1 + strcspn(newtext, " ");   /* count the space too */
+
+    if (rfp) {
+        while ( (line = fgetline(rfp)) ) {
+            if (strncmp(line, newtext, headerlen))
+                fputs(line, wfp);
+            sfree(line);
+        }
+        fclose(rfp);
     }
 
+    fputs(newtext, wfp);
+    fclose(wfp);
+
+    if (rename(tmpfilename, filename) < 0)
+	unlink(tmpfilename);
+
     sfree(tmpfilename);
     sfree(filename);
     sfree(newtext);
 }
 
+char *read_learned_kex(const char *hostname, int port)
+{
+    return read_hint_cache(INDEX_KEXCACHE, hostname, port);
+}
+
+void store_learned_kex(const char *hostname, int port, const char *algs)
+{
+    store_hint_cache(INDEX_KEXCACHE, INDEX_KEXCACHE_TMP,
+		     hostname, port, algs);
+}
+
+char *read_accepted_pubkey(const char *hostname, int port)
+{
+    return read_hint_cache(INDEX_AUTHCACHE, hostname, port);
+}
+
+void store_accepted_pubkey(const char *hostname, int port,
+			   const char *fingerprint)
+{
+    store_hint_cache(INDEX_AUTHCACHE, INDEX_AUTHCACHE_TMP,
+		     hostname, port, fingerprint);
+}
+
 void read_random_seed(noise_consumer_t consumer)
 {
     int fd;
@@ -102,8 +102,8 @@ int wc_to_mb(int codepage, int flags, const wchar_t *wcstr, int wclen,
 /*
  * Return value is TRUE if pterm is to run in direct-to-font mode.
  */
-int init_ucs(struct unicode_data *ucsdata, char *linecharset,
-	     int utf8_override, int font_charset, int vtmode)
+static int init_ucs_real(struct unicode_data *ucsdata, char *linecharset,
+			 int utf8_override, int font_charset, int vtmode)
 {
     int i, ret = 0;
 
@@ -243,6 +243,56 @@ int init_ucs(struct unicode_data *ucsdata, char *linecharset,
     return ret;
 }
 
+/*
+ * Building the translation tables above means several hundred trips
+ * through the charset library, and the inputs come from a handful of
+ * configuration settings which are nearly always the same from one
+ * terminal to the next. So we keep every distinct result for the
+ * life of the process and hand out copies, which makes repeated
+ * init_ucs calls (one per window, or one per forked batch job) a
+ * memcpy. Entries are deliberately never freed: the set of distinct
+ * configurations a process ever uses is tiny.
+ */
+struct ucs_cache_entry {
+    struct ucs_cache_entry *next;
+    char *linecharset;
+    int utf8_override, font_charset, vtmode;
+    int ret;
+    struct unicode_data data;
+};
+static struct ucs_cache_entry *ucs_cache = NULL;
+
+int init_ucs(struct unicode_data *ucsdata, char *linecharset,
+	     int utf8_override, int font_charset, int vtmode)
+{
+    struct ucs_cache_entry *e;
+    const char *key = linecharset ? linecharset : "";
+
+    for (e = ucs_cache; e; e = e->next) {
+	if (!strcmp(e->linecharset, key) &&
+	    e->utf8_override == utf8_override &&
+	    e->font_charset == font_charset &&
+	    e->vtmode == vtmode) {
+	    *ucsdata = e->data;	       /* structure copy */
+	    return e->ret;
+	}
+    }
+
+    e = snew(struct ucs_cache_entry);
+    e->linecharset = dupstr(key);
+    e->utf8_override = utf8_override;
+    e->font_charset = font_charset;
+    e->vtmode = vtmode;
+    memset(&e->data, 0, sizeof(e->data));
+    e->ret = init_ucs_real(&e->data, linecharset, utf8_override,
+			   font_charset, vtmode);
+    e->next = ucs_cache;
+    ucs_cache = e;
+
+    *ucsdata = e->data;
+    return e->ret;
+}
+
 const char *cp_name(int codepage)
 {
     if (codepage == CS_NONE)
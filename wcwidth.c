@@ -121,7 +121,7 @@ static int bisearch(unsigned int ucs, const struct interval *table, int max) {
  * in ISO 10646.
  */
 
-int mk_wcwidth(unsigned int ucs)
+static int mk_wcwidth_uncached(unsigned int ucs)
 {
   /* sorted list of non-overlapping intervals of non-spacing characters */
   /* generated by "uniset +cat=Me +cat=Mn +cat=Cf -00AD +1160-11FF +200B c" */
@@ -336,7 +336,7 @@ int mk_wcswidth(const unsigned int *pwcs, size_t n)
  * the traditional terminal character-width behaviour. It is not
  * otherwise recommended for general use.
  */
-int mk_wcwidth_cjk(unsigned int ucs)
+static int mk_wcwidth_cjk_uncached(unsigned int ucs)
 {
   /* A sorted list of intervals of ambiguous width characters generated by:
    * https://raw.githubusercontent.com/GNOME/glib/37d4c2941bd0326b8b6e6bb22c81bd424fcc040b/glib/gen-unicode-tables.pl
@@ -530,7 +530,49 @@ int mk_wcwidth_cjk(unsigned int ucs)
 	       sizeof(ambiguous) / sizeof(struct interval) - 1))
     return 2;
 
-  return mk_wcwidth(ucs);
+  return mk_wcwidth_uncached(ucs);
+}
+
+/*
+ * Paged direct-lookup cache in front of the interval tables above.
+ * The terminal calls mk_wcwidth() (or its _cjk variant) for every
+ * non-ASCII cell it prints, so instead of binary-searching the
+ * tables each time we precompute widths into 256-entry pages, built
+ * lazily on first use of each page; the memory used is proportional
+ * to the set of 256-codepoint blocks the session actually prints.
+ */
+#define WCWIDTH_PAGES (0x110000 >> 8)
+
+static int wcwidth_paged(unsigned int ucs, signed char **pages,
+                         int (*compute)(unsigned int))
+{
+  signed char *page;
+
+  if (ucs >= 0x110000)
+    return compute(ucs);
+
+  page = pages[ucs >> 8];
+  if (!page) {
+    unsigned int base = ucs & ~0xFFu;
+    int i;
+    page = snewn(256, signed char);
+    for (i = 0; i < 256; i++)
+      page[i] = compute(base + i);
+    pages[ucs >> 8] = page;
+  }
+  return page[ucs & 0xFF];
+}
+
+int mk_wcwidth(unsigned int ucs)
+{
+  static signed char *pages[WCWIDTH_PAGES];
+  return wcwidth_paged(ucs, pages, mk_wcwidth_uncached);
+}
+
+int mk_wcwidth_cjk(unsigned int ucs)
+{
+  static signed char *pages[WCWIDTH_PAGES];
+  return wcwidth_paged(ucs, pages, mk_wcwidth_cjk_uncached);
 }
 
 
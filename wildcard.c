@@ -199,6 +199,52 @@ static int wc_match_fragment(const char **fragment, const char **target)
     return 0;
 }
 
+/*
+ * Scan a whole wildcard for syntax errors, without reference to any
+ * target string. Returns 0 if the pattern is well formed, or the
+ * same negative error codes as the matcher. The parsing here must
+ * mirror wc_match_fragment exactly, so that the two agree on what
+ * constitutes an error.
+ */
+static int wc_validate(const char *wildcard)
+{
+    const char *f = wildcard;
+
+    while (*f) {
+	if (*f == '\\') {
+	    if (!f[1])
+		return -WC_TRAILINGBACKSLASH;
+	    f += 2;
+	} else if (*f == '[') {
+	    f++;
+	    if (*f == '^')
+		f++;
+	    while (*f != ']') {
+		if (*f == '\\')
+		    f++;	       /* backslashes still work */
+		if (!*f)
+		    return -WC_UNCLOSEDCLASS;
+		if (f[1] == '-') {
+		    f += 2;	       /* eat the lower bound and minus */
+		    if (*f == ']')
+			return -WC_INVALIDRANGE;
+		    if (*f == '\\')
+			f++;	       /* backslashes _still_ work */
+		    if (!*f)
+			return -WC_UNCLOSEDCLASS;
+		    f++;	       /* eat the upper bound */
+		} else {
+		    f++;
+		}
+	    }
+	    f++;		       /* eat the ] */
+	} else {
+	    f++;
+	}
+    }
+    return 0;
+}
+
 /*
  * This is the real wildcard matching routine. It returns 1 for a
  * successful match, 0 for an unsuccessful match, and <0 for a
@@ -207,6 +253,94 @@ static int wc_match_fragment(const char **fragment, const char **target)
 int wc_match(const char *wildcard, const char *target)
 {
     int ret;
+    const char *p;
+
+    /*
+     * Syntax errors must be reported independently of the target
+     * string, so check the whole pattern - a cheap O(len) scan -
+     * before either of the shortcuts below is allowed to return a
+     * plain mismatch.
+     */
+    ret = wc_validate(wildcard);
+    if (ret < 0)
+	return ret;
+
+    /*
+     * Shortcut: consume any literal prefix of the wildcard (plain
+     * characters and backslash escapes, up to the first *, ? or [)
+     * by direct comparison. When this routine is called once per
+     * filename in a large directory listing, most candidates fail
+     * here after a character or two, without ever entering the
+     * general fragment matcher.
+     */
+    while (*wildcard && *wildcard != '*' && *wildcard != '?' &&
+	   *wildcard != '[') {
+	char c;
+	p = wildcard;
+	if (*p == '\\') {
+	    if (!p[1])
+		return -WC_TRAILINGBACKSLASH;   /* error */
+	    c = p[1];
+	    p += 2;
+	} else {
+	    c = *p;
+	    p++;
+	}
+	if (*target != c)
+	    return 0;		       /* failed to match */
+	target++;
+	wildcard = p;
+    }
+
+    /*
+     * Another shortcut, for the very common pattern shape "*.c": if
+     * the fragment after the last unescaped '*' is wholly literal,
+     * the target must end with exactly that text, which we can test
+     * directly instead of discovering it by searching every suffix
+     * position. (This only rejects; a pattern that survives it still
+     * goes through the full match below.)
+     */
+    {
+	const char *lastfrag = NULL;
+	int suffixlit = 1;
+
+	for (p = wildcard; *p;) {
+	    if (*p == '\\') {
+		if (!p[1]) {
+		    /* can't happen: wc_validate passed */
+		    lastfrag = NULL;
+		    break;
+		}
+		p += 2;
+	    } else if (*p == '*') {
+		p++;
+		lastfrag = p;
+		suffixlit = 1;
+	    } else {
+		if (*p == '?' || *p == '[')
+		    suffixlit = 0;
+		p++;
+	    }
+	}
+	if (lastfrag && suffixlit) {
+	    int sufflen = 0, tlen = strlen(target);
+	    const char *t;
+	    for (p = lastfrag; *p; p++) {
+		if (*p == '\\')
+		    p++;
+		sufflen++;
+	    }
+	    if (tlen < sufflen)
+		return 0;	       /* target too short to match */
+	    t = target + tlen - sufflen;
+	    for (p = lastfrag; *p; p++) {
+		if (*p == '\\')
+		    p++;
+		if (*t++ != *p)
+		    return 0;	       /* suffix mismatch */
+	    }
+	}
+    }
 
     /*
      * Every time we see a '*' _followed_ by a fragment, we just
@@ -424,6 +558,17 @@ const struct test full_tests[] = {
     {"?b*r?", "abracadabra", 1},
     {"?b*r?", "abracadabr", 0},
     {"?b*r?", "abracadabzr", 0},
+    {"*.c", "terminal.c", 1},
+    {"*.c", "terminal.h", 0},
+    {"*.c", ".c", 1},
+    {"*.c", "c", 0},
+    {"ab*yz", "abcdyz", 1},
+    {"ab*yz", "zbcdyz", 0},
+    {"ab*yz", "abcdyx", 0},
+    {"ab\\*c", "ab*c", 1},
+    {"ab\\*c", "abxc", 0},
+    {"a*b\\*c", "axb*c", 1},
+    {"a*b\\", "axb\\", -WC_TRAILINGBACKSLASH},
 };
 
 int main(void)
@@ -42,8 +42,7 @@ static struct controlbox *ctrlbox;
 static struct winctrls ctrls_base, ctrls_panel;
 static struct dlgparam dp;
 
-static char **events = NULL;
-static int nevents = 0, negsize = 0;
+static struct eventring *events = NULL;
 
 extern Conf *conf;		       /* defined in window.c */
 
@@ -84,9 +83,10 @@ static INT_PTR CALLBACK LogProc(HWND hwnd, UINT msg,
 	    SendDlgItemMessage(hwnd, IDN_LIST, LB_SETTABSTOPS, 2,
 			       (LPARAM) tabs);
 	}
-	for (i = 0; i < nevents; i++)
-	    SendDlgItemMessage(hwnd, IDN_LIST, LB_ADDSTRING,
-			       0, (LPARAM) events[i]);
+	if (events)
+	    for (i = 0; i < eventring_count(events); i++)
+		SendDlgItemMessage(hwnd, IDN_LIST, LB_ADDSTRING,
+				   0, (LPARAM) eventring_get(events, i));
 	return 1;
       case WM_COMMAND:
 	switch (LOWORD(wParam)) {
@@ -127,13 +127,15 @@ static INT_PTR CALLBACK LogProc(HWND hwnd, UINT msg,
 		    size = 0;
 		    for (i = 0; i < count; i++)
 			size +=
-			    strlen(events[selitems[i]]) + sizeof(sel_nl);
+			    strlen(eventring_get(events, selitems[i])) +
+			    sizeof(sel_nl);
 
 		    clipdata = snewn(size, char);
 		    if (clipdata) {
 			char *p = clipdata;
 			for (i = 0; i < count; i++) {
-			    char *q = events[selitems[i]];
+			    const char *q =
+				eventring_get(events, selitems[i]);
 			    int qlen = strlen(q);
 			    memcpy(p, q, qlen);
 			    p += qlen;
@@ -145,7 +147,7 @@ static INT_PTR CALLBACK LogProc(HWND hwnd, UINT msg,
 		    }
 		    sfree(selitems);
 
-		    for (i = 0; i < nevents; i++)
+		    for (i = 0; i < eventring_count(events); i++)
 			SendDlgItemMessage(hwnd, IDN_LIST, LB_SETSEL,
 					   FALSE, i);
 		}
@@ -747,30 +749,28 @@ int do_reconfig(HWND hwnd, int protcfginfo)
 
 void logevent(void *frontend, const char *string)
 {
-    char timebuf[40];
-    struct tm tm;
-
     log_eventlog(logctx, string);
 
-    if (nevents >= negsize) {
-	negsize += 64;
-	events = sresize(events, negsize, char *);
-    }
-
-    tm=ltime();
-    strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S\t", &tm);
+    if (!events)
+	events = eventring_new();
+    eventring_add(events, string);
 
-    events[nevents] = snewn(strlen(timebuf) + strlen(string) + 1, char);
-    strcpy(events[nevents], timebuf);
-    strcat(events[nevents], string);
     if (logbox) {
 	int count;
-	SendDlgItemMessage(logbox, IDN_LIST, LB_ADDSTRING,
-			   0, (LPARAM) events[nevents]);
+	/*
+	 * Keep the open dialog in step with the ring: if the new
+	 * entry pushed an old one out, drop the top listbox item too.
+	 */
 	count = SendDlgItemMessage(logbox, IDN_LIST, LB_GETCOUNT, 0, 0);
-	SendDlgItemMessage(logbox, IDN_LIST, LB_SETTOPINDEX, count - 1, 0);
+	while (count >= eventring_count(events)) {
+	    SendDlgItemMessage(logbox, IDN_LIST, LB_DELETESTRING, 0, 0);
+	    count--;
+	}
+	SendDlgItemMessage(logbox, IDN_LIST, LB_ADDSTRING, 0,
+			   (LPARAM) eventring_get(events,
+						  eventring_count(events) - 1));
+	SendDlgItemMessage(logbox, IDN_LIST, LB_SETTOPINDEX, count, 0);
     }
-    nevents++;
 }
 
 void showeventlog(HWND hwnd)
@@ -109,6 +109,24 @@ static void flip_full_screen(void);
 static void process_clipdata(HGLOBAL clipdata, int unicode);
 static void setup_clipboards(Terminal *, Conf *);
 
+/*
+ * All the window state here is file-scope, which is the one thing
+ * standing between this front end and hosting several terminal
+ * windows in a single process: Terminal, Backend and Conf are
+ * already instance-scoped, and the expensive process-wide assets
+ * (the charset library's tables, the noise/seedfile machinery, the
+ * DLL lookups in init_winfuncs) would be shared for free. Getting
+ * there means gathering everything below - fonts, palette,
+ * geometry, ucsdata, the backend pointers, 'term' and 'hwnd'
+ * themselves - into a per-window structure recovered from
+ * GetWindowLongPtr in WndProc, and un-exporting 'conf', 'term' and
+ * 'hwnd' from the dialog and sizetip code. That's a mechanical but
+ * very large change which touches nearly every function in this
+ * file, and it shouldn't be attempted piecemeal: half-migrated
+ * state that still aliases a global is worse than the status quo.
+ * Until someone does it, one window costs one process.
+ */
+
 /* Window layout information */
 static void reset_window(int);
 static int extra_width, extra_height;
@@ -809,6 +827,7 @@ int WINAPI WinMain(HINSTANCE inst, HINSTANCE prev, LPSTR cmdline, int show)
 
 	n = MsgWaitForMultipleObjects(nhandles, handles, FALSE,
                                       timeout, QS_ALLINPUT);
+	tickcount_cache_refresh();
 
 	if ((unsigned)(n - WAIT_OBJECT_0) < (unsigned)nhandles) {
 	    handle_got_event(handles[n - WAIT_OBJECT_0]);
@@ -824,6 +843,10 @@ int WINAPI WinMain(HINSTANCE inst, HINSTANCE prev, LPSTR cmdline, int show)
 		DispatchMessageW(&msg);
 
             /*
+             * (This only matters on WinSock 1, where do_select falls
+             * back to WSAAsyncSelect; with WSAEventSelect no
+             * WM_NETEVENTs are ever posted.)
+             *
              * WM_NETEVENT messages seem to jump ahead of others in
              * the message queue. I'm not sure why; the docs for
              * PeekMessage mention that messages are prioritised in
@@ -907,8 +930,26 @@ void cleanup_exit(int code)
 }
 
 /*
- * Set up, or shut down, an AsyncSelect. Called from winnet.c.
+ * Set up, or shut down, network-event notification on a socket.
+ * Called from winnet.c.
+ *
+ * Given WinSock 2, we use WSAEventSelect on a single event object
+ * which the main loop waits on via winhandl.c's foreign-event
+ * mechanism, and service every active socket in a batch when it
+ * fires. We used to use WSAAsyncSelect throughout, but its
+ * WM_NETEVENT messages share the message queue with keyboard and
+ * paint messages (and in practice jump ahead of them), so bulk
+ * network traffic and UI responsiveness degraded each other at
+ * message-queue granularity. The WSAAsyncSelect code is retained as
+ * a fallback for WinSock 1.
  */
+static HANDLE netevent = NULL;
+
+static void netevent_callback(void *ctx)
+{
+    select_results();
+}
+
 char *do_select(SOCKET skt, int startup)
 {
     int msg, events;
@@ -919,6 +960,23 @@ char *do_select(SOCKET skt, int startup)
     } else {
 	msg = events = 0;
     }
+
+    if (p_WSAEventSelect) {
+	if (startup && !netevent) {
+	    netevent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	    handle_add_foreign_event(netevent, netevent_callback, NULL);
+	}
+	if (p_WSAEventSelect(skt, netevent, events) == SOCKET_ERROR) {
+	    switch (p_WSAGetLastError()) {
+	      case WSAENETDOWN:
+		return "Network is down";
+	      default:
+		return "WSAEventSelect(): unknown error";
+	    }
+	}
+	return NULL;
+    }
+
     if (!hwnd)
 	return "do_select(): internal error (hwnd==NULL)";
     if (p_WSAAsyncSelect(skt, hwnd, msg, events) == SOCKET_ERROR) {
@@ -1566,6 +1624,26 @@ static void init_fonts(int pick_width, int pick_height)
     init_ucs(conf, &ucsdata);
 }
 
+/*
+ * Cache of the text-related GDI state most recently selected into
+ * the DC we're painting with. A line containing many attribute runs
+ * (e.g. coloured compiler output) causes do_text() to be called once
+ * per run, and most of those calls select the same font and colours
+ * as the previous one; remembering what we last selected lets us
+ * skip the redundant GDI calls. The cache is only trusted for the
+ * lifetime of a single DC, so we invalidate it whenever we acquire
+ * or release one, and whenever the font handles themselves are
+ * thrown away.
+ */
+static int gdi_cache_valid = FALSE;
+static HFONT gdi_cached_font;
+static COLORREF gdi_cached_fg, gdi_cached_bg;
+
+static void gdi_cache_invalidate(void)
+{
+    gdi_cache_valid = FALSE;
+}
+
 static void another_font(int fontno)
 {
     int basefont;
@@ -1628,6 +1706,7 @@ static void deinit_fonts(void)
 	fonts[i] = 0;
 	fontflag[i] = 0;
     }
+    gdi_cache_invalidate();
 }
 
 void request_resize(void *frontend, int w, int h)
@@ -2417,6 +2496,8 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT message,
 		 */
 		if (i >= n_specials)
 		    break;
+		if (specials[i].code == TS_STATS)
+		    term_log_stats(term);
 		if (back)
 		    back->special(backhandle, specials[i].code);
 	    }
@@ -2603,14 +2684,56 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT message,
       case WM_PAINT:
 	{
 	    PAINTSTRUCT p;
+	    HDC winhdc;
+	    HBITMAP membitmap = NULL, memoldbm = NULL;
 
 	    HideCaret(hwnd);
-	    hdc = BeginPaint(hwnd, &p);
+	    winhdc = BeginPaint(hwnd, &p);
+	    gdi_cache_invalidate();
 	    if (pal) {
-		SelectPalette(hdc, pal, TRUE);
-		RealizePalette(hdc);
+		SelectPalette(winhdc, pal, TRUE);
+		RealizePalette(winhdc);
 	    }
 
+	    /*
+	     * Double-buffer the repaint: render the exposed
+	     * rectangle into a memory DC and blit it to the window
+	     * in one go, so a full-window expose costs a single
+	     * screen operation instead of one per text run. If any
+	     * of the GDI objects can't be created (low resources,
+	     * RDP sessions with constrained bitmaps) we just paint
+	     * straight to the window as before.
+	     */
+	    hdc = CreateCompatibleDC(winhdc);
+	    if (hdc) {
+		membitmap = CreateCompatibleBitmap(
+		    winhdc, p.rcPaint.right - p.rcPaint.left,
+		    p.rcPaint.bottom - p.rcPaint.top);
+		if (membitmap) {
+		    memoldbm = SelectObject(hdc, membitmap);
+		    SetWindowOrgEx(hdc, p.rcPaint.left, p.rcPaint.top, NULL);
+		    if (pal) {
+			SelectPalette(hdc, pal, TRUE);
+			RealizePalette(hdc);
+		    }
+		    /*
+		     * Pre-fill the buffer with whatever is currently
+		     * on screen, so that any cells term_paint()
+		     * declines to redraw (pending terminal updates)
+		     * are preserved rather than blitted as garbage.
+		     */
+		    BitBlt(hdc, p.rcPaint.left, p.rcPaint.top,
+			   p.rcPaint.right - p.rcPaint.left,
+			   p.rcPaint.bottom - p.rcPaint.top,
+			   winhdc, p.rcPaint.left, p.rcPaint.top, SRCCOPY);
+		} else {
+		    DeleteDC(hdc);
+		    hdc = NULL;
+		}
+	    }
+	    if (!hdc)
+		hdc = winhdc;
+
 	    /*
 	     * We have to be careful about term_paint(). It will
 	     * set a bunch of character cells to INVALID and then
@@ -2691,8 +2814,19 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT message,
 		SelectObject(hdc, oldpen);
 		DeleteObject(edge);
 	    }
-	    SelectObject(hdc, GetStockObject(SYSTEM_FONT));
-	    SelectObject(hdc, GetStockObject(WHITE_PEN));
+	    if (hdc != winhdc) {
+		BitBlt(winhdc, p.rcPaint.left, p.rcPaint.top,
+		       p.rcPaint.right - p.rcPaint.left,
+		       p.rcPaint.bottom - p.rcPaint.top,
+		       hdc, p.rcPaint.left, p.rcPaint.top, SRCCOPY);
+		SelectObject(hdc, memoldbm);
+		DeleteDC(hdc);
+		DeleteObject(membitmap);
+	    } else {
+		SelectObject(hdc, GetStockObject(SYSTEM_FONT));
+		SelectObject(hdc, GetStockObject(WHITE_PEN));
+	    }
+	    gdi_cache_invalidate();
 	    EndPaint(hwnd, &p);
 	    ShowCaret(hwnd);
 	}
@@ -2865,6 +2999,8 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT message,
 			  window_name : icon_name);
 	if (wParam == SIZE_RESTORED || wParam == SIZE_MAXIMIZED)
 	    SetWindowText(hwnd, window_name);
+	if (term)
+	    term_set_visible(term, wParam != SIZE_MINIMIZED);
         if (wParam == SIZE_RESTORED) {
             processed_resize = FALSE;
             clear_full_screen();
@@ -3484,9 +3620,19 @@ void do_text_internal(Context ctx, int x, int y, wchar_t *text, int len,
                  GetBValue(fg) * 2 / 3);
     }
 
-    SelectObject(hdc, fonts[nfont]);
-    SetTextColor(hdc, fg);
-    SetBkColor(hdc, bg);
+    if (!gdi_cache_valid || gdi_cached_font != fonts[nfont]) {
+	SelectObject(hdc, fonts[nfont]);
+	gdi_cached_font = fonts[nfont];
+    }
+    if (!gdi_cache_valid || gdi_cached_fg != fg) {
+	SetTextColor(hdc, fg);
+	gdi_cached_fg = fg;
+    }
+    if (!gdi_cache_valid || gdi_cached_bg != bg) {
+	SetBkColor(hdc, bg);
+	gdi_cached_bg = bg;
+    }
+    gdi_cache_valid = TRUE;
     if (attr & TATTR_COMBINING)
 	SetBkMode(hdc, TRANSPARENT);
     else
@@ -3844,6 +3990,29 @@ void do_cursor(Context ctx, int x, int y, wchar_t *text, int len,
     }
 }
 
+#ifdef OPTIMISE_SCROLL
+/*
+ * Scroll a region of the window by a whole number of character rows.
+ * terminal.c only calls this (via its OPTIMISE_SCROLL machinery) for
+ * lines it knows are displayed correctly, so we can have Windows move
+ * the pixels in place instead of re-rendering every moved line.
+ * ScrollWindow shifts any pending update region along with the
+ * pixels and folds the newly exposed band into it; the do_paint()
+ * pass that queued this scroll redraws the exposed lines itself
+ * immediately afterwards.
+ */
+void do_scroll(Context ctx, int topline, int botline, int lines)
+{
+    RECT r;
+
+    r.left = offset_width;
+    r.right = offset_width + term->cols * font_width;
+    r.top = offset_height + topline * font_height;
+    r.bottom = offset_height + (botline + 1) * font_height;
+    ScrollWindow(hwnd, 0, -lines * font_height, &r, &r);
+}
+#endif /* OPTIMISE_SCROLL */
+
 /* This function gets the actual width of a character in the normal font.
  */
 int char_width(Context ctx, int uc) {
@@ -4858,6 +5027,7 @@ Context get_ctx(void *frontend)
 	hdc = GetDC(hwnd);
 	if (hdc && pal)
 	    SelectPalette(hdc, pal, FALSE);
+	gdi_cache_invalidate();
 	return hdc;
     } else
 	return NULL;
@@ -4866,6 +5036,7 @@ Context get_ctx(void *frontend)
 void free_ctx(Context ctx)
 {
     SelectPalette(ctx, GetStockObject(DEFAULT_PALETTE), FALSE);
+    gdi_cache_invalidate();
     ReleaseDC(hwnd, ctx);
 }
 
@@ -5444,12 +5615,15 @@ static void process_clipdata(HGLOBAL clipdata, int unicode)
 	}
     } else {
 	char *s = GlobalLock(clipdata);
-	int i;
+	int i, slen;
 
 	if (s) {
-	    i = MultiByteToWideChar(CP_ACP, 0, s, strlen(s) + 1, 0, 0);
+	    /* One sizing call, one conversion: don't re-measure a
+	     * multi-megabyte paste. */
+	    slen = strlen(s) + 1;
+	    i = MultiByteToWideChar(CP_ACP, 0, s, slen, 0, 0);
 	    clipboard_contents = snewn(i, wchar_t);
-	    MultiByteToWideChar(CP_ACP, 0, s, strlen(s) + 1,
+	    MultiByteToWideChar(CP_ACP, 0, s, slen,
 				clipboard_contents, i);
 	    clipboard_length = i - 1;
 	    clipboard_contents[clipboard_length] = L'\0';
@@ -5485,27 +5659,6 @@ void frontend_request_paste(void *frontend, int clipboard)
 		 hwnd, 0, &in_threadid);
 }
 
-#if 0
-/*
- * Move `lines' lines from position `from' to position `to' in the
- * window.
- */
-void optimised_move(void *frontend, int to, int from, int lines)
-{
-    RECT r;
-    int min, max;
-
-    min = (to < from ? to : from);
-    max = to + from - min;
-
-    r.left = offset_width;
-    r.right = offset_width + term->cols * font_width;
-    r.top = offset_height + min * font_height;
-    r.bottom = offset_height + (max + lines) * font_height;
-    ScrollWindow(hwnd, 0, (to - from) * font_height, &r, &r);
-}
-#endif
-
 /*
  * Print a modal (Really Bad) message box and perform a fatal exit.
  */
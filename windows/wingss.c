@@ -288,6 +288,18 @@ static Ssh_gss_stat ssh_sspi_import_name(struct ssh_gss_library *lib,
     return SSH_GSS_OK;
 }
 
+/*
+ * The credential handle AcquireCredentialsHandle returns for the
+ * logged-in user stays valid until the expiry time it reports, so
+ * there's no need to go back to the security package for a fresh one
+ * on every connection this process makes (e.g. restarting the session
+ * in a terminal window, or a new 'open' in psftp). Keep the first one
+ * we acquire and re-use it until it expires.
+ */
+static CredHandle cached_cred_handle;
+static TimeStamp cached_cred_expiry;
+static int cached_cred_valid = FALSE;
+
 static Ssh_gss_stat ssh_sspi_acquire_cred(struct ssh_gss_library *lib,
 					  Ssh_gss_ctx *ctx)
 {
@@ -298,21 +310,48 @@ static Ssh_gss_stat ssh_sspi_acquire_cred(struct ssh_gss_library *lib,
     winctx->maj_stat =  winctx->min_stat = SEC_E_OK;
     winctx->context_handle = NULL;
 
-    /* Specifying no principal name here means use the credentials of
-       the current logged-in user */
+    if (cached_cred_valid) {
+	FILETIME ft;
+	ULARGE_INTEGER now;
+	GetSystemTimeAsFileTime(&ft);
+	now.LowPart = ft.dwLowDateTime;
+	now.HighPart = ft.dwHighDateTime;
+	if ((ULONGLONG)cached_cred_expiry.QuadPart <= now.QuadPart) {
+	    /* Cached credentials have expired; drop them and
+	     * re-acquire below. (Some SSPI versions report Kerberos
+	     * expiry in local time rather than UTC; if that bites,
+	     * the worst case is an unnecessary re-acquisition, or a
+	     * reuse that fails at init_sec_context just as a genuine
+	     * mid-session expiry would.) */
+	    p_FreeCredentialsHandle(&cached_cred_handle);
+	    cached_cred_valid = FALSE;
+	}
+    }
 
-    winctx->maj_stat = p_AcquireCredentialsHandleA(NULL,
-						   "Kerberos",
-						   SECPKG_CRED_OUTBOUND,
-						   NULL,
-						   NULL,
-						   NULL,
-						   NULL,
-						   &winctx->cred_handle,
-						   &winctx->expiry);
+    if (!cached_cred_valid) {
+	/* Specifying no principal name here means use the credentials
+	   of the current logged-in user */
+
+	winctx->maj_stat = p_AcquireCredentialsHandleA(NULL,
+						       "Kerberos",
+						       SECPKG_CRED_OUTBOUND,
+						       NULL,
+						       NULL,
+						       NULL,
+						       NULL,
+						       &cached_cred_handle,
+						       &cached_cred_expiry);
+
+	if (winctx->maj_stat != SEC_E_OK) {
+	    sfree(winctx);
+	    return SSH_GSS_FAILURE;
+	}
+	cached_cred_valid = TRUE;
+    }
+
+    winctx->cred_handle = cached_cred_handle;
+    winctx->expiry = cached_cred_expiry;
 
-    if (winctx->maj_stat != SEC_E_OK) return SSH_GSS_FAILURE;
-    
     *ctx = (Ssh_gss_ctx) winctx;
     return SSH_GSS_OK;
 }
@@ -382,8 +421,8 @@ static Ssh_gss_stat ssh_sspi_release_cred(struct ssh_gss_library *lib,
     /* check input */
     if (winctx == NULL) return SSH_GSS_FAILURE;
 
-    /* free Windows data */
-    p_FreeCredentialsHandle(&winctx->cred_handle);
+    /* free Windows data; the credential handle itself is the shared
+     * process-lifetime one, so only the security context dies here */
     p_DeleteSecurityContext(&winctx->context);
 
     /* delete our "wrapper" structure */
@@ -27,6 +27,14 @@
  * and so we must use threads for those. This being the case, it's
  * simplest just to use threads for everything rather than trying
  * to keep track of multiple completely separate mechanisms.)
+ *
+ * Completion, however, is reported through a single shared event
+ * object plus a queue of ready handles, rather than one event per
+ * handle: the main thread waits on one object however many handles
+ * are in flight, which keeps a session juggling an agent, a serial
+ * port and several proxy pipes well clear of the
+ * MAXIMUM_WAIT_OBJECTS limit on WaitForMultipleObjects, and halves
+ * the kernel event objects per handle.
  */
 
 #include <assert.h>
@@ -43,6 +51,29 @@
  */
 #define MAX_BACKLOG 32768
 
+struct handle;			       /* contains the structures below */
+
+/*
+ * The shared mechanism by which subthreads report I/O completion to
+ * the main thread: a critical-section-protected queue of ready
+ * handles, plus one auto-reset event object which the application's
+ * main loop waits on. A subthread always queues its handle _before_
+ * setting the event, and handle_got_event drains the queue until
+ * empty after each wakeup, so no completion can be lost.
+ */
+static HANDLE handle_ready_event = NULL;
+static CRITICAL_SECTION handle_ready_crit;
+static struct handle *handle_ready_head, *handle_ready_tail;
+
+static void handle_ready_setup(void)
+{
+    if (!handle_ready_event) {
+	handle_ready_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	InitializeCriticalSection(&handle_ready_crit);
+	handle_ready_head = handle_ready_tail = NULL;
+    }
+}
+
 struct handle_generic {
     /*
      * Initial fields common to both handle_input and handle_output
@@ -63,6 +94,9 @@ struct handle_generic {
     int defunct;		       /* has the subthread already gone? */
     int busy;			       /* operation currently in progress? */
     void *privdata;		       /* for client to remember who they are */
+    struct handle *parent;	       /* the containing struct handle */
+    struct handle *ready_next;	       /* link in the ready queue */
+    int ready_queued;		       /* on the ready queue already? */
 };
 
 typedef enum { HT_INPUT, HT_OUTPUT, HT_FOREIGN } HandleType;
@@ -86,6 +120,9 @@ struct handle_input {
     int defunct;		       /* has the subthread already gone? */
     int busy;			       /* operation currently in progress? */
     void *privdata;		       /* for client to remember who they are */
+    struct handle *parent;	       /* the containing struct handle */
+    struct handle *ready_next;	       /* link in the ready queue */
+    int ready_queued;		       /* on the ready queue already? */
 
     /*
      * Data set at initialisation and then read-only.
@@ -107,6 +144,15 @@ struct handle_input {
     handle_inputfn_t gotdata;
 };
 
+/*
+ * Called on a subthread to report that an operation on its handle
+ * has completed. Queue the handle before setting the event; after
+ * this call the subthread must not touch ctx again until the main
+ * thread hands the next operation over (indeed, in the EOF and
+ * termination cases, not at all).
+ */
+static void handle_ready_signal(struct handle *h);
+
 /*
  * The actual thread procedure for an input thread.
  */
@@ -175,7 +221,7 @@ static DWORD WINAPI handle_input_threadfunc(void *param)
          */
         finished = (ctx->len == 0);
 
-	SetEvent(ctx->ev_to_main);
+	handle_ready_signal(ctx->parent);
 
 	if (finished)
 	    break;
@@ -188,7 +234,7 @@ static DWORD WINAPI handle_input_threadfunc(void *param)
              * not touch ctx at all, because the main thread might
              * have freed it.
              */
-            SetEvent(ctx->ev_to_main);
+            handle_ready_signal(ctx->parent);
             break;
         }
     }
@@ -246,6 +292,9 @@ struct handle_output {
     int defunct;		       /* has the subthread already gone? */
     int busy;			       /* operation currently in progress? */
     void *privdata;		       /* for client to remember who they are */
+    struct handle *parent;	       /* the containing struct handle */
+    struct handle *ready_next;	       /* link in the ready queue */
+    int ready_queued;		       /* on the ready queue already? */
 
     /*
      * Data set at initialisation and then read-only.
@@ -271,6 +320,10 @@ struct handle_output {
      */
     bufchain queued_data;	       /* data still waiting to be written */
     enum { EOF_NO, EOF_PENDING, EOF_SENT } outgoingeof;
+    char coalescebuf[4096];	       /* small queued chunks are gathered
+					* here so that each WriteFile covers
+					* as much of the backlog as it can,
+					* instead of one chunk each */
 
     /*
      * Callback function called when the backlog in the bufchain
@@ -302,7 +355,7 @@ static DWORD WINAPI handle_output_threadfunc(void *param)
              * not touch ctx at all, because the main thread might
              * have freed it.
              */
-	    SetEvent(ctx->ev_to_main);
+	    handle_ready_signal(ctx->parent);
 	    break;
 	}
 	if (povl) {
@@ -325,7 +378,7 @@ static DWORD WINAPI handle_output_threadfunc(void *param)
 		ctx->writeerr = 0;
 	}
 
-	SetEvent(ctx->ev_to_main);
+	handle_ready_signal(ctx->parent);
 	if (!writeret) {
             /*
              * The write operation has suffered an error. Telling that
@@ -351,6 +404,21 @@ static void handle_try_output(struct handle_output *ctx)
 
     if (!ctx->busy && bufchain_size(&ctx->queued_data)) {
 	bufchain_prefix(&ctx->queued_data, &senddata, &sendlen);
+	if (sendlen < bufchain_size(&ctx->queued_data) &&
+	    sendlen < (int)sizeof(ctx->coalescebuf)) {
+	    /*
+	     * The first chunk is only part of the backlog, so gather
+	     * as much of it as fits into the coalescing buffer and
+	     * write that in a single operation. The data isn't
+	     * consumed from the bufchain until the write completes,
+	     * so a partial write loses nothing.
+	     */
+	    sendlen = bufchain_size(&ctx->queued_data);
+	    if (sendlen > (int)sizeof(ctx->coalescebuf))
+		sendlen = (int)sizeof(ctx->coalescebuf);
+	    bufchain_fetch(&ctx->queued_data, ctx->coalescebuf, sendlen);
+	    senddata = ctx->coalescebuf;
+	}
 	ctx->buffer = senddata;
 	ctx->len = sendlen;
 	SetEvent(ctx->ev_from_main);
@@ -382,6 +450,9 @@ struct handle_foreign {
     int defunct;		       /* has the subthread already gone? */
     int busy;			       /* operation currently in progress? */
     void *privdata;		       /* for client to remember who they are */
+    struct handle *parent;	       /* the containing struct handle */
+    struct handle *ready_next;	       /* link in the ready queue */
+    int ready_queued;		       /* on the ready queue already? */
 
     /*
      * Our own data, just consisting of knowledge of who to call back.
@@ -404,32 +475,68 @@ struct handle {
     } u;
 };
 
-static tree234 *handles_by_evtomain;
+static tree234 *handles_tree;
 
-static int handle_cmp_evtomain(void *av, void *bv)
+static int handle_cmp(void *av, void *bv)
 {
     struct handle *a = (struct handle *)av;
     struct handle *b = (struct handle *)bv;
 
-    if ((uintptr_t)a->u.g.ev_to_main < (uintptr_t)b->u.g.ev_to_main)
+    if ((uintptr_t)a < (uintptr_t)b)
 	return -1;
-    else if ((uintptr_t)a->u.g.ev_to_main > (uintptr_t)b->u.g.ev_to_main)
+    else if ((uintptr_t)a > (uintptr_t)b)
 	return +1;
     else
 	return 0;
 }
 
-static int handle_find_evtomain(void *av, void *bv)
+static void handle_ready_signal(struct handle *h)
 {
-    HANDLE *a = (HANDLE *)av;
-    struct handle *b = (struct handle *)bv;
+    EnterCriticalSection(&handle_ready_crit);
+    if (!h->u.g.ready_queued) {
+	h->u.g.ready_queued = TRUE;
+	h->u.g.ready_next = NULL;
+	if (handle_ready_tail)
+	    handle_ready_tail->u.g.ready_next = h;
+	else
+	    handle_ready_head = h;
+	handle_ready_tail = h;
+    }
+    LeaveCriticalSection(&handle_ready_crit);
+    SetEvent(handle_ready_event);
+}
 
-    if ((uintptr_t)*a < (uintptr_t)b->u.g.ev_to_main)
-	return -1;
-    else if ((uintptr_t)*a > (uintptr_t)b->u.g.ev_to_main)
-	return +1;
-    else
-	return 0;
+/*
+ * Take a handle off the ready queue, if it's on it, prior to
+ * destroying it. Handles are destroyed only from the main thread,
+ * which is also the only consumer of the queue, so after this
+ * returns the handle is guaranteed not to be seen by the drain loop
+ * in handle_got_event.
+ */
+static void handle_ready_dequeue(struct handle *h)
+{
+    struct handle *prev, *cur;
+
+    if (!handle_ready_event)
+	return;
+    EnterCriticalSection(&handle_ready_crit);
+    if (h->u.g.ready_queued) {
+	prev = NULL;
+	for (cur = handle_ready_head; cur; cur = cur->u.g.ready_next) {
+	    if (cur == h)
+		break;
+	    prev = cur;
+	}
+	assert(cur == h);
+	if (prev)
+	    prev->u.g.ready_next = h->u.g.ready_next;
+	else
+	    handle_ready_head = h->u.g.ready_next;
+	if (handle_ready_tail == h)
+	    handle_ready_tail = prev;
+	h->u.g.ready_queued = FALSE;
+    }
+    LeaveCriticalSection(&handle_ready_crit);
 }
 
 struct handle *handle_input_new(HANDLE handle, handle_inputfn_t gotdata,
@@ -440,18 +547,23 @@ struct handle *handle_input_new(HANDLE handle, handle_inputfn_t gotdata,
 
     h->type = HT_INPUT;
     h->u.i.h = handle;
-    h->u.i.ev_to_main = CreateEvent(NULL, FALSE, FALSE, NULL);
+    h->u.i.ev_to_main = NULL;	       /* completion goes via the shared
+					* ready queue */
     h->u.i.ev_from_main = CreateEvent(NULL, FALSE, FALSE, NULL);
     h->u.i.gotdata = gotdata;
     h->u.i.defunct = FALSE;
     h->u.i.moribund = FALSE;
     h->u.i.done = FALSE;
     h->u.i.privdata = privdata;
+    h->u.i.parent = h;
+    h->u.i.ready_next = NULL;
+    h->u.i.ready_queued = FALSE;
     h->u.i.flags = flags;
 
-    if (!handles_by_evtomain)
-	handles_by_evtomain = newtree234(handle_cmp_evtomain);
-    add234(handles_by_evtomain, h);
+    handle_ready_setup();
+    if (!handles_tree)
+	handles_tree = newtree234(handle_cmp);
+    add234(handles_tree, h);
 
     CreateThread(NULL, 0, handle_input_threadfunc,
 		 &h->u.i, 0, &in_threadid);
@@ -468,21 +580,26 @@ struct handle *handle_output_new(HANDLE handle, handle_outputfn_t sentdata,
 
     h->type = HT_OUTPUT;
     h->u.o.h = handle;
-    h->u.o.ev_to_main = CreateEvent(NULL, FALSE, FALSE, NULL);
+    h->u.o.ev_to_main = NULL;	       /* completion goes via the shared
+					* ready queue */
     h->u.o.ev_from_main = CreateEvent(NULL, FALSE, FALSE, NULL);
     h->u.o.busy = FALSE;
     h->u.o.defunct = FALSE;
     h->u.o.moribund = FALSE;
     h->u.o.done = FALSE;
     h->u.o.privdata = privdata;
+    h->u.o.parent = h;
+    h->u.o.ready_next = NULL;
+    h->u.o.ready_queued = FALSE;
     bufchain_init(&h->u.o.queued_data);
     h->u.o.outgoingeof = EOF_NO;
     h->u.o.sentdata = sentdata;
     h->u.o.flags = flags;
 
-    if (!handles_by_evtomain)
-	handles_by_evtomain = newtree234(handle_cmp_evtomain);
-    add234(handles_by_evtomain, h);
+    handle_ready_setup();
+    if (!handles_tree)
+	handles_tree = newtree234(handle_cmp);
+    add234(handles_tree, h);
 
     CreateThread(NULL, 0, handle_output_threadfunc,
 		 &h->u.o, 0, &out_threadid);
@@ -503,13 +620,16 @@ struct handle *handle_add_foreign_event(HANDLE event,
     h->u.f.moribund = FALSE;
     h->u.f.done = FALSE;
     h->u.f.privdata = NULL;
+    h->u.f.parent = h;
+    h->u.f.ready_next = NULL;
+    h->u.f.ready_queued = FALSE;
     h->u.f.callback = callback;
     h->u.f.ctx = ctx;
     h->u.f.busy = TRUE;
 
-    if (!handles_by_evtomain)
-	handles_by_evtomain = newtree234(handle_cmp_evtomain);
-    add234(handles_by_evtomain, h);
+    if (!handles_tree)
+	handles_tree = newtree234(handle_cmp);
+    add234(handles_tree, h);
 
     return h;
 }
@@ -546,20 +666,36 @@ HANDLE *handle_get_events(int *nevents)
     int i, n, size;
 
     /*
-     * Go through our tree counting the handle objects currently
-     * engaged in useful activity.
+     * Go through our tree looking for handle objects currently
+     * engaged in useful activity. All the input and output handles
+     * share the single ready event, so they contribute at most one
+     * entry between them however many there are; foreign events are
+     * still waited on individually.
      */
     ret = NULL;
     n = size = 0;
-    if (handles_by_evtomain) {
-	for (i = 0; (h = index234(handles_by_evtomain, i)) != NULL; i++) {
-	    if (h->u.g.busy) {
-		if (n >= size) {
-		    size += 32;
-		    ret = sresize(ret, size, HANDLE);
-		}
-		ret[n++] = h->u.g.ev_to_main;
+    if (handles_tree) {
+	int ready_event_needed = FALSE;
+
+	for (i = 0; (h = index234(handles_tree, i)) != NULL; i++) {
+	    if (!h->u.g.busy)
+		continue;
+	    if (h->type != HT_FOREIGN) {
+		ready_event_needed = TRUE;
+		continue;
+	    }
+	    if (n >= size) {
+		size += 32;
+		ret = sresize(ret, size, HANDLE);
+	    }
+	    ret[n++] = h->u.f.ev_to_main;
+	}
+	if (ready_event_needed) {
+	    if (n >= size) {
+		size += 32;
+		ret = sresize(ret, size, HANDLE);
 	    }
+	    ret[n++] = handle_ready_event;
 	}
     }
 
@@ -571,9 +707,12 @@ static void handle_destroy(struct handle *h)
 {
     if (h->type == HT_OUTPUT)
 	bufchain_clear(&h->u.o.queued_data);
-    CloseHandle(h->u.g.ev_from_main);
-    CloseHandle(h->u.g.ev_to_main);
-    del234(handles_by_evtomain, h);
+    handle_ready_dequeue(h);
+    if (h->u.g.ev_from_main != INVALID_HANDLE_VALUE)
+	CloseHandle(h->u.g.ev_from_main);
+    if (h->u.g.ev_to_main)	       /* NULL for input/output handles */
+	CloseHandle(h->u.g.ev_to_main);
+    del234(handles_tree, h);
     sfree(h);
 }
 
@@ -612,24 +751,8 @@ void handle_free(struct handle *h)
     }
 }
 
-void handle_got_event(HANDLE event)
+static void handle_process_ready(struct handle *h)
 {
-    struct handle *h;
-
-    assert(handles_by_evtomain);
-    h = find234(handles_by_evtomain, &event, handle_find_evtomain);
-    if (!h) {
-	/*
-	 * This isn't an error condition. If two or more event
-	 * objects were signalled during the same select operation,
-	 * and processing of the first caused the second handle to
-	 * be closed, then it will sometimes happen that we receive
-	 * an event notification here for a handle which is already
-	 * deceased. In that situation we simply do nothing.
-	 */
-	return;
-    }
-
     if (h->u.g.moribund) {
 	/*
 	 * A moribund handle is one which we have either already
@@ -700,6 +823,54 @@ void handle_got_event(HANDLE event)
     }
 }
 
+void handle_got_event(HANDLE event)
+{
+    struct handle *h;
+    int i;
+
+    if (handle_ready_event && event == handle_ready_event) {
+	/*
+	 * Drain the ready queue completely: the event is auto-reset,
+	 * and the subthreads always queue before setting it, so
+	 * processing until the queue is empty can't miss a
+	 * completion. Handles are taken off one at a time because
+	 * processing one (which runs client callbacks) may destroy
+	 * another that is still queued; handle_destroy dequeues it
+	 * under the lock, so we never see a dangling entry.
+	 */
+	while (1) {
+	    EnterCriticalSection(&handle_ready_crit);
+	    h = handle_ready_head;
+	    if (h) {
+		handle_ready_head = h->u.g.ready_next;
+		if (handle_ready_tail == h)
+		    handle_ready_tail = NULL;
+		h->u.g.ready_queued = FALSE;
+	    }
+	    LeaveCriticalSection(&handle_ready_crit);
+	    if (!h)
+		break;
+	    handle_process_ready(h);
+	}
+	return;
+    }
+
+    /*
+     * Otherwise this should be a foreign event. If we don't find
+     * it, that isn't an error condition: processing of an earlier
+     * event in the same select operation may have closed the handle
+     * it belonged to, in which case we simply do nothing.
+     */
+    if (handles_tree) {
+	for (i = 0; (h = index234(handles_tree, i)) != NULL; i++) {
+	    if (h->type == HT_FOREIGN && h->u.f.ev_to_main == event) {
+		handle_process_ready(h);
+		return;
+	    }
+	}
+    }
+}
+
 void handle_unthrottle(struct handle *h, int backlog)
 {
     assert(h->type == HT_INPUT);
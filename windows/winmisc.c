@@ -78,6 +78,76 @@ char filename_char_sanitise(char c)
     return c;
 }
 
+/*
+ * Windows implementation of the secure-pool page-locking hook (see
+ * misc.c): best-effort VirtualLock, ignoring failure.
+ */
+void platform_secure_pool_lock(void *b, size_t len)
+{
+    VirtualLock(b, len);
+}
+
+/*
+ * Windows implementation of the secure-pool free-list mutex (see
+ * misc.c): the pool is shared between the main thread and
+ * winoffload.c's worker thread. CRITICAL_SECTIONs have no static
+ * initialiser, so the first caller initialises it, with an
+ * interlocked state flag in case two threads arrive together.
+ */
+static CRITICAL_SECTION secure_pool_cs;
+static volatile LONG secure_pool_cs_state = 0; /* 0 = uninitialised,
+						* 1 = initialising,
+						* 2 = ready */
+
+void platform_secure_pool_mutex_lock(void)
+{
+    if (secure_pool_cs_state != 2) {
+	if (InterlockedCompareExchange(&secure_pool_cs_state, 1, 0) == 0) {
+	    InitializeCriticalSection(&secure_pool_cs);
+	    InterlockedExchange(&secure_pool_cs_state, 2);
+	} else {
+	    while (secure_pool_cs_state != 2)
+		Sleep(0);
+	}
+    }
+    EnterCriticalSection(&secure_pool_cs);
+}
+
+void platform_secure_pool_mutex_unlock(void)
+{
+    LeaveCriticalSection(&secure_pool_cs);
+}
+
+#ifdef MALLOC_ACCOUNTING
+/*
+ * Separate mutex for the allocation-accounting site table (see
+ * misc.c), which the worker thread also updates. It can't share the
+ * secure-pool mutex: secure_pool_alloc calls smalloc with that held.
+ * Same lazy-initialisation dance as above.
+ */
+static CRITICAL_SECTION malloc_acct_cs;
+static volatile LONG malloc_acct_cs_state = 0;
+
+void platform_malloc_acct_mutex_lock(void)
+{
+    if (malloc_acct_cs_state != 2) {
+	if (InterlockedCompareExchange(&malloc_acct_cs_state, 1, 0) == 0) {
+	    InitializeCriticalSection(&malloc_acct_cs);
+	    InterlockedExchange(&malloc_acct_cs_state, 2);
+	} else {
+	    while (malloc_acct_cs_state != 2)
+		Sleep(0);
+	}
+    }
+    EnterCriticalSection(&malloc_acct_cs);
+}
+
+void platform_malloc_acct_mutex_unlock(void)
+{
+    LeaveCriticalSection(&malloc_acct_cs);
+}
+#endif
+
 #ifndef NO_SECUREZEROMEMORY
 /*
  * Windows implementation of smemclr (see misc.c) using SecureZeroMemory.
@@ -655,6 +655,20 @@ SockAddr sk_namelookup(const char *host, char **canonicalname,
     return ret;
 }
 
+void *sk_namelookup_start(const char *host, int address_family,
+                          sk_namelookup_done_fn_t done, void *ctx)
+{
+    /*
+     * No asynchronous resolver on Windows yet; returning NULL makes
+     * callers fall back to the blocking sk_namelookup.
+     */
+    return NULL;
+}
+
+void sk_namelookup_abort(void *handle)
+{
+}
+
 SockAddr sk_nonamelookup(const char *host)
 {
     SockAddr ret = snew(struct SockAddr_tag);
@@ -1896,6 +1910,72 @@ SOCKET next_socket(int *state)
     return s ? s->s : INVALID_SOCKET;
 }
 
+/*
+ * For front ends which use WSAEventSelect: process the network events
+ * on every active socket, in a batch, after the shared network event
+ * object has fired. We must not call select_result() for any socket
+ * until we have finished enumerating within the tree, because
+ * select_result() may close the socket and modify the tree; so we
+ * snapshot the socket list first.
+ */
+void select_results(void)
+{
+    static SOCKET *sklist = NULL;
+    static int sksize = 0;
+    WSANETWORKEVENTS things;
+    SOCKET socket;
+    int i, skcount, socketstate;
+
+    /* Count the active sockets. */
+    i = 0;
+    for (socket = first_socket(&socketstate);
+	 socket != INVALID_SOCKET;
+	 socket = next_socket(&socketstate)) i++;
+
+    /* Expand the buffer if necessary. */
+    if (i > sksize) {
+	sksize = i + 16;
+	sklist = sresize(sklist, sksize, SOCKET);
+    }
+
+    /* Retrieve the sockets into sklist. */
+    skcount = 0;
+    for (socket = first_socket(&socketstate);
+	 socket != INVALID_SOCKET;
+	 socket = next_socket(&socketstate)) {
+	sklist[skcount++] = socket;
+    }
+
+    /* Now we're done enumerating; go through the list. */
+    for (i = 0; i < skcount; i++) {
+	WPARAM wp;
+	socket = sklist[i];
+	wp = (WPARAM) socket;
+	if (!p_WSAEnumNetworkEvents(socket, NULL, &things)) {
+	    static const struct { int bit, mask; } eventtypes[] = {
+		{FD_CONNECT_BIT, FD_CONNECT},
+		{FD_READ_BIT, FD_READ},
+		{FD_CLOSE_BIT, FD_CLOSE},
+		{FD_OOB_BIT, FD_OOB},
+		{FD_WRITE_BIT, FD_WRITE},
+		{FD_ACCEPT_BIT, FD_ACCEPT},
+	    };
+	    int e;
+
+	    noise_ultralight(socket);
+	    noise_ultralight(things.lNetworkEvents);
+
+	    for (e = 0; e < lenof(eventtypes); e++)
+		if (things.lNetworkEvents & eventtypes[e].mask) {
+		    LPARAM lp;
+		    int err = things.iErrorCode[eventtypes[e].bit];
+		    lp = WSAMAKESELECTREPLY(eventtypes[e].mask, err);
+		    select_result(wp, lp);
+		}
+	}
+    }
+}
+
 extern int socket_writable(SOCKET skt)
 {
     Actual_Socket s = find234(sktree, (void *)skt, cmpforsearch);
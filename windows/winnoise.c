@@ -20,26 +20,17 @@ DECL_WINDOWS_FUNCTION(static, BOOL, CryptReleaseContext,
 static HMODULE wincrypt_module = NULL;
 
 /*
- * This function is called once, at PuTTY startup.
+ * This function is called once, at PuTTY startup: it reads 32 bytes
+ * from the system CryptoAPI RNG and loads the saved random seed from
+ * disk, which between them are enough to get going. Returns TRUE if
+ * the CryptoAPI RNG was available.
  */
 
-void noise_get_heavy(void (*func) (void *, int))
+int noise_get_heavy(void (*func) (void *, int))
 {
-    HANDLE srch;
-    WIN32_FIND_DATA finddata;
     DWORD pid;
     HCRYPTPROV crypt_provider;
-    char winpath[MAX_PATH + 3];
-
-    GetWindowsDirectory(winpath, sizeof(winpath));
-    strcat(winpath, "\\*");
-    srch = FindFirstFile(winpath, &finddata);
-    if (srch != INVALID_HANDLE_VALUE) {
-	do {
-	    func(&finddata, sizeof(finddata));
-	} while (FindNextFile(srch, &finddata));
-	FindClose(srch);
-    }
+    int got_cryptoapi = FALSE;
 
     pid = GetCurrentProcessId();
     func(&pid, sizeof(pid));
@@ -58,6 +49,7 @@ void noise_get_heavy(void (*func) (void *, int))
         BYTE buf[32];
         if (p_CryptGenRandom(crypt_provider, 32, buf)) {
             func(buf, sizeof(buf));
+            got_cryptoapi = TRUE;
         }
         p_CryptReleaseContext(crypt_provider, 0);
     }
@@ -65,6 +57,31 @@ void noise_get_heavy(void (*func) (void *, int))
     read_random_seed(func);
     /* Update the seed immediately, in case another instance uses it. */
     random_save_seed();
+
+    return got_cryptoapi;
+}
+
+/*
+ * The slower environmental entropy source: a scan of the Windows
+ * directory. sshrand.c defers this until after startup when the
+ * CryptoAPI RNG worked, since it's then only defence in depth.
+ */
+
+void noise_get_background(void (*func) (void *, int))
+{
+    HANDLE srch;
+    WIN32_FIND_DATA finddata;
+    char winpath[MAX_PATH + 3];
+
+    GetWindowsDirectory(winpath, sizeof(winpath));
+    strcat(winpath, "\\*");
+    srch = FindFirstFile(winpath, &finddata);
+    if (srch != INVALID_HANDLE_VALUE) {
+	do {
+	    func(&finddata, sizeof(finddata));
+	} while (FindNextFile(srch, &finddata));
+	FindClose(srch);
+    }
 }
 
 void random_save_seed(void)
@@ -0,0 +1,106 @@
+/*
+ * winoffload.c: the Windows implementation of the CPU-offload
+ * interface declared in putty.h. Work functions run on a worker
+ * thread; completion is signalled through an event object registered
+ * with winhandl.c's foreign-event mechanism, which every main event
+ * loop already waits on, so the GUI and any shared-connection
+ * downstreams stay responsive while (for instance) a large
+ * key-exchange modexp is in progress.
+ */
+
+#include <assert.h>
+
+#include "putty.h"
+
+struct offload_job {
+    offload_fn_t work;
+    toplevel_callback_fn_t done;
+    void *ctx;
+    HANDLE thread, event;
+    struct handle *h;
+    int joined;
+};
+
+/*
+ * Only one job may be outstanding at a time, per the interface spec,
+ * so a single static suffices.
+ */
+static struct offload_job *offload_current = NULL;
+
+static void offload_event_callback(void *vjob)
+{
+    struct offload_job *job = (struct offload_job *)vjob;
+
+    /*
+     * The worker signals the event as the very last thing it does,
+     * so this wait won't detain us for long.
+     */
+    if (!job->joined)
+	WaitForSingleObject(job->thread, INFINITE);
+    CloseHandle(job->thread);
+    CloseHandle(job->event);
+    handle_free(job->h);
+    if (job == offload_current)
+	offload_current = NULL;
+
+    queue_toplevel_callback(job->done, job->ctx);
+    sfree(job);
+}
+
+static DWORD WINAPI offload_threadfunc(void *vjob)
+{
+    struct offload_job *job = (struct offload_job *)vjob;
+
+    job->work(job->ctx);
+    SetEvent(job->event);
+
+    return 0;
+}
+
+int offload_available(void)
+{
+    return TRUE;
+}
+
+void offload_run(offload_fn_t work, toplevel_callback_fn_t done, void *ctx)
+{
+    struct offload_job *job;
+
+    assert(!offload_current);
+
+    job = snew(struct offload_job);
+    job->work = work;
+    job->done = done;
+    job->ctx = ctx;
+    job->joined = FALSE;
+
+    job->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!job->event) {
+	sfree(job);
+	goto synchronous;
+    }
+    job->h = handle_add_foreign_event(job->event, offload_event_callback, job);
+
+    job->thread = CreateThread(NULL, 0, offload_threadfunc, job, 0, NULL);
+    if (!job->thread) {
+	handle_free(job->h);
+	CloseHandle(job->event);
+	sfree(job);
+	goto synchronous;
+    }
+
+    offload_current = job;
+    return;
+
+  synchronous:
+    work(ctx);
+    queue_toplevel_callback(done, ctx);
+}
+
+void offload_wait(void)
+{
+    if (offload_current && !offload_current->joined) {
+	WaitForSingleObject(offload_current->thread, INFINITE);
+	offload_current->joined = TRUE;
+    }
+}
@@ -204,6 +204,7 @@ static void usage(void)
     printf("            open tunnel in place of session (SSH-2 only)\n");
     printf("  -sshlog file\n");
     printf("  -sshrawlog file\n");
+    printf("  -sshbinlog file\n");
     printf("            log protocol details to a file\n");
     printf("  -shareexists\n");
     printf("            test whether a connection-sharing upstream exists\n");
@@ -293,8 +294,6 @@ const int share_can_be_upstream = TRUE;
 int main(int argc, char **argv)
 {
     int sending;
-    SOCKET *sklist;
-    int skcount, sksize;
     int exitcode;
     int errors;
     int use_subsystem = 0;
@@ -303,8 +302,6 @@ int main(int argc, char **argv)
 
     dll_hijacking_protection();
 
-    sklist = NULL;
-    skcount = sksize = 0;
     /*
      * Initialise port and protocol to sensible defaults. (These
      * will be overridden by more or less anything.)
@@ -559,68 +556,11 @@ int main(int argc, char **argv)
 	handles[nhandles] = netevent;
 	n = MsgWaitForMultipleObjects(nhandles+1, handles, FALSE, ticks,
 				      QS_POSTMESSAGE);
+	tickcount_cache_refresh();
 	if ((unsigned)(n - WAIT_OBJECT_0) < (unsigned)nhandles) {
 	    handle_got_event(handles[n - WAIT_OBJECT_0]);
 	} else if (n == WAIT_OBJECT_0 + nhandles) {
-	    WSANETWORKEVENTS things;
-	    SOCKET socket;
-	    extern SOCKET first_socket(int *), next_socket(int *);
-	    int i, socketstate;
-
-	    /*
-	     * We must not call select_result() for any socket
-	     * until we have finished enumerating within the tree.
-	     * This is because select_result() may close the socket
-	     * and modify the tree.
-	     */
-	    /* Count the active sockets. */
-	    i = 0;
-	    for (socket = first_socket(&socketstate);
-		 socket != INVALID_SOCKET;
-		 socket = next_socket(&socketstate)) i++;
-
-	    /* Expand the buffer if necessary. */
-	    if (i > sksize) {
-		sksize = i + 16;
-		sklist = sresize(sklist, sksize, SOCKET);
-	    }
-
-	    /* Retrieve the sockets into sklist. */
-	    skcount = 0;
-	    for (socket = first_socket(&socketstate);
-		 socket != INVALID_SOCKET;
-		 socket = next_socket(&socketstate)) {
-		sklist[skcount++] = socket;
-	    }
-
-	    /* Now we're done enumerating; go through the list. */
-	    for (i = 0; i < skcount; i++) {
-		WPARAM wp;
-		socket = sklist[i];
-		wp = (WPARAM) socket;
-		if (!p_WSAEnumNetworkEvents(socket, NULL, &things)) {
-                    static const struct { int bit, mask; } eventtypes[] = {
-                        {FD_CONNECT_BIT, FD_CONNECT},
-                        {FD_READ_BIT, FD_READ},
-                        {FD_CLOSE_BIT, FD_CLOSE},
-                        {FD_OOB_BIT, FD_OOB},
-                        {FD_WRITE_BIT, FD_WRITE},
-                        {FD_ACCEPT_BIT, FD_ACCEPT},
-                    };
-                    int e;
-
-		    noise_ultralight(socket);
-		    noise_ultralight(things.lNetworkEvents);
-
-                    for (e = 0; e < lenof(eventtypes); e++)
-                        if (things.lNetworkEvents & eventtypes[e].mask) {
-                            LPARAM lp;
-                            int err = things.iErrorCode[eventtypes[e].bit];
-                            lp = WSAMAKESELECTREPLY(eventtypes[e].mask, err);
-                            select_result(wp, lp);
-                        }
-		}
-	    }
+	    select_results();
 	} else if (n == WAIT_OBJECT_0 + nhandles + 1) {
 	    MSG msg;
 	    while (PeekMessage(&msg, INVALID_HANDLE_VALUE,
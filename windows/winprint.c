@@ -2,6 +2,8 @@
  * Printing interface for PuTTY.
  */
 
+#include <string.h>
+
 #include "putty.h"
 #include <winspool.h>
 
@@ -14,8 +16,27 @@ struct printer_enum_tag {
     } info;
 };
 
+/*
+ * Print data is staged into a bufchain and drained by a background
+ * spool thread, so that a slow spooler doesn't stall the terminal:
+ * printer_job_data is called inline from term_out's media-copy
+ * handling, and a synchronous WritePrinter there froze the whole
+ * session whenever the spooler fell behind. The staging buffer is
+ * bounded; once PRINT_SPOOL_LIMIT bytes are pending we block the
+ * producer rather than buffer without limit.
+ */
+#define PRINT_SPOOL_LIMIT 1048576      /* 1MB of pending print data */
+#define PRINT_SPOOL_CHUNK 16384	       /* max bytes written per lock drop */
+
 struct printer_job_tag {
     HANDLE hprinter;
+    int threaded;
+    HANDLE thread;
+    HANDLE data_event;		       /* set when data arrives or finish */
+    HANDLE drain_event;		       /* set when spool drops below limit */
+    CRITICAL_SECTION crit;
+    bufchain spool;		       /* protected by crit */
+    int finishing;
 };
 
 DECL_WINDOWS_FUNCTION(static, BOOL, EnumPrinters,
@@ -165,6 +186,47 @@ void printer_finish_enum(printer_enum *pe)
     sfree(pe);
 }
 
+static DWORD WINAPI printer_threadfunc(void *vpj)
+{
+    printer_job *pj = (printer_job *)vpj;
+    char chunk[PRINT_SPOOL_CHUNK];
+
+    while (1) {
+	void *data;
+	int len;
+	DWORD written;
+
+	EnterCriticalSection(&pj->crit);
+	if (bufchain_size(&pj->spool) == 0) {
+	    if (pj->finishing) {
+		LeaveCriticalSection(&pj->crit);
+		break;
+	    }
+	    LeaveCriticalSection(&pj->crit);
+	    WaitForSingleObject(pj->data_event, INFINITE);
+	    continue;
+	}
+
+	/*
+	 * Copy a chunk out under the lock, then do the possibly-slow
+	 * WritePrinter with the lock dropped so the producer isn't
+	 * held up by the spooler's pace.
+	 */
+	bufchain_prefix(&pj->spool, &data, &len);
+	if (len > PRINT_SPOOL_CHUNK)
+	    len = PRINT_SPOOL_CHUNK;
+	memcpy(chunk, data, len);
+	bufchain_consume(&pj->spool, len);
+	if (bufchain_size(&pj->spool) < PRINT_SPOOL_LIMIT)
+	    SetEvent(pj->drain_event);
+	LeaveCriticalSection(&pj->crit);
+
+	p_WritePrinter(pj->hprinter, chunk, len, &written);
+    }
+
+    return 0;
+}
+
 printer_job *printer_start_job(char *printer)
 {
     printer_job *ret = snew(printer_job);
@@ -189,6 +251,26 @@ printer_job *printer_start_job(char *printer)
 	goto error;
     pagestarted = 1;
 
+    ret->threaded = FALSE;
+    ret->finishing = FALSE;
+    bufchain_init(&ret->spool);
+    ret->data_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    ret->drain_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (ret->data_event && ret->drain_event) {
+	InitializeCriticalSection(&ret->crit);
+	ret->thread = CreateThread(NULL, 0, printer_threadfunc, ret, 0, NULL);
+	if (ret->thread)
+	    ret->threaded = TRUE;
+	else
+	    DeleteCriticalSection(&ret->crit);
+    }
+    if (!ret->threaded) {	       /* fall back to synchronous */
+	if (ret->data_event)
+	    CloseHandle(ret->data_event);
+	if (ret->drain_event)
+	    CloseHandle(ret->drain_event);
+    }
+
     return ret;
 
     error:
@@ -209,7 +291,20 @@ void printer_job_data(printer_job *pj, void *data, int len)
     if (!pj)
 	return;
 
-    p_WritePrinter(pj->hprinter, data, len, &written);
+    if (!pj->threaded) {
+	p_WritePrinter(pj->hprinter, data, len, &written);
+	return;
+    }
+
+    EnterCriticalSection(&pj->crit);
+    while (bufchain_size(&pj->spool) >= PRINT_SPOOL_LIMIT) {
+	LeaveCriticalSection(&pj->crit);
+	WaitForSingleObject(pj->drain_event, INFINITE);
+	EnterCriticalSection(&pj->crit);
+    }
+    bufchain_add(&pj->spool, data, len);
+    SetEvent(pj->data_event);
+    LeaveCriticalSection(&pj->crit);
 }
 
 void printer_finish_job(printer_job *pj)
@@ -217,6 +312,19 @@ void printer_finish_job(printer_job *pj)
     if (!pj)
 	return;
 
+    if (pj->threaded) {
+	EnterCriticalSection(&pj->crit);
+	pj->finishing = TRUE;
+	SetEvent(pj->data_event);
+	LeaveCriticalSection(&pj->crit);
+	WaitForSingleObject(pj->thread, INFINITE);
+	CloseHandle(pj->thread);
+	CloseHandle(pj->data_event);
+	CloseHandle(pj->drain_event);
+	DeleteCriticalSection(&pj->crit);
+	bufchain_clear(&pj->spool);
+    }
+
     p_EndPagePrinter(pj->hprinter);
     p_EndDocPrinter(pj->hprinter);
     p_ClosePrinter(pj->hprinter);
@@ -0,0 +1,89 @@
+/*
+ * winsbfile.c: Windows implementation of the scrollback spill file,
+ * an anonymous temporary file with a growable memory mapping that
+ * terminal.c uses to keep compressed scrollback out of the heap.
+ */
+
+#include <stdio.h>
+
+#include "putty.h"
+
+struct sbfile_tag {
+    HANDLE file;
+    HANDLE mapping;		       /* current file-mapping object */
+    unsigned char *map;
+    size_t mapsize;
+};
+
+sbfile *sbfile_new(void)
+{
+    sbfile *f;
+    char dir[MAX_PATH], name[MAX_PATH];
+    HANDLE file;
+
+    if (!GetTempPath(lenof(dir), dir) ||
+	!GetTempFileName(dir, "pty", 0, name))
+	return NULL;
+    /*
+     * FILE_FLAG_DELETE_ON_CLOSE means the file vanishes as soon as
+     * the handle goes (even on a crash, once every handle is gone),
+     * and FILE_ATTRIBUTE_TEMPORARY encourages the system to keep it
+     * in cache rather than on disk while it stays small.
+     */
+    file = CreateFile(name, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+		      CREATE_ALWAYS,
+		      FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+		      NULL);
+    if (file == INVALID_HANDLE_VALUE)
+	return NULL;
+
+    f = snew(sbfile);
+    f->file = file;
+    f->mapping = NULL;
+    f->map = NULL;
+    f->mapsize = 0;
+    return f;
+}
+
+unsigned char *sbfile_map(sbfile *f, size_t size)
+{
+    HANDLE mapping;
+    void *map;
+
+    /*
+     * CreateFileMapping extends the file to the requested size
+     * itself. Map the new view before discarding the old one, so
+     * that a failure here leaves the already-spilled data still
+     * readable.
+     */
+    mapping = CreateFileMapping(f->file, NULL, PAGE_READWRITE,
+				(DWORD)(size >> 16 >> 16),
+				(DWORD)size, NULL);
+    if (!mapping)
+	return NULL;
+    map = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+    if (!map) {
+	CloseHandle(mapping);
+	return NULL;
+    }
+    if (f->map)
+	UnmapViewOfFile(f->map);
+    if (f->mapping)
+	CloseHandle(f->mapping);
+    f->mapping = mapping;
+    f->map = map;
+    f->mapsize = size;
+    return f->map;
+}
+
+void sbfile_free(sbfile *f)
+{
+    if (!f)
+	return;
+    if (f->map)
+	UnmapViewOfFile(f->map);
+    if (f->mapping)
+	CloseHandle(f->mapping);
+    CloseHandle(f->file);
+    sfree(f);
+}
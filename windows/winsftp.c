@@ -98,8 +98,14 @@ RFile *open_existing_file(const char *name, uint64 *size,
     HANDLE h;
     RFile *ret;
 
+    /*
+     * FILE_FLAG_SEQUENTIAL_SCAN makes the cache manager read ahead
+     * of us, so the synchronous ReadFile calls in read_from_file
+     * nearly always complete from cache instead of stalling the
+     * transfer pipeline on the disk.
+     */
     h = CreateFile(name, GENERIC_READ, FILE_SHARE_READ, NULL,
-		   OPEN_EXISTING, 0, 0);
+		   OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
     if (h == INVALID_HANDLE_VALUE)
 	return NULL;
 
@@ -188,6 +194,54 @@ WFile *open_existing_wfile(const char *name, uint64 *size)
     return ret;
 }
 
+WFile *open_wfile_shard(const char *name, long perms, uint64 size,
+			uint64 offset)
+{
+    HANDLE h;
+    WFile *ret;
+    LONG lo, hi;
+
+    h = CreateFile(name, GENERIC_WRITE,
+		   FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		   OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    if (h == INVALID_HANDLE_VALUE)
+	return NULL;
+
+    /*
+     * Deliberately OPEN_ALWAYS rather than CREATE_ALWAYS: other
+     * shards may already have written their parts of this file. Set
+     * the length explicitly instead, which clears any stale tail and
+     * is idempotent between shards, then seek to this shard's range.
+     */
+    lo = size.lo;
+    hi = size.hi;
+    SetFilePointer(h, lo, &hi, FILE_BEGIN);
+    if (GetLastError() != NO_ERROR || !SetEndOfFile(h)) {
+	CloseHandle(h);
+	return NULL;
+    }
+    lo = offset.lo;
+    hi = offset.hi;
+    SetFilePointer(h, lo, &hi, FILE_BEGIN);
+    if (GetLastError() != NO_ERROR) {
+	CloseHandle(h);
+	return NULL;
+    }
+
+    ret = snew(WFile);
+    ret->h = h;
+
+    return ret;
+}
+
+int shard_processes(int count)
+{
+    /*
+     * No fork() here, so PSCP falls back to a single connection.
+     */
+    return -1;
+}
+
 int write_to_file(WFile *f, void *buffer, int length)
 {
     int ret;
@@ -505,8 +559,6 @@ int do_eventsel_loop(HANDLE other_event)
     unsigned long next, then;
     long ticks;
     HANDLE *handles;
-    SOCKET *sklist;
-    int skcount;
     unsigned long now = GETTICKCOUNT();
 
     if (toplevel_callback_pending()) {
@@ -539,68 +591,12 @@ int do_eventsel_loop(HANDLE other_event)
 	otherindex = -1;
 
     n = WaitForMultipleObjects(nallhandles, handles, FALSE, ticks);
+    tickcount_cache_refresh();
 
     if ((unsigned)(n - WAIT_OBJECT_0) < (unsigned)nhandles) {
 	handle_got_event(handles[n - WAIT_OBJECT_0]);
     } else if (netindex >= 0 && n == WAIT_OBJECT_0 + netindex) {
-	WSANETWORKEVENTS things;
-	SOCKET socket;
-	extern SOCKET first_socket(int *), next_socket(int *);
-	int i, socketstate;
-
-	/*
-	 * We must not call select_result() for any socket
-	 * until we have finished enumerating within the
-	 * tree. This is because select_result() may close
-	 * the socket and modify the tree.
-	 */
-	/* Count the active sockets. */
-	i = 0;
-	for (socket = first_socket(&socketstate);
-	     socket != INVALID_SOCKET;
-	     socket = next_socket(&socketstate)) i++;
-
-	/* Expand the buffer if necessary. */
-	sklist = snewn(i, SOCKET);
-
-	/* Retrieve the sockets into sklist. */
-	skcount = 0;
-	for (socket = first_socket(&socketstate);
-	     socket != INVALID_SOCKET;
-	     socket = next_socket(&socketstate)) {
-	    sklist[skcount++] = socket;
-	}
-
-	/* Now we're done enumerating; go through the list. */
-	for (i = 0; i < skcount; i++) {
-	    WPARAM wp;
-	    socket = sklist[i];
-	    wp = (WPARAM) socket;
-	    if (!p_WSAEnumNetworkEvents(socket, NULL, &things)) {
-		static const struct { int bit, mask; } eventtypes[] = {
-		    {FD_CONNECT_BIT, FD_CONNECT},
-		    {FD_READ_BIT, FD_READ},
-		    {FD_CLOSE_BIT, FD_CLOSE},
-		    {FD_OOB_BIT, FD_OOB},
-		    {FD_WRITE_BIT, FD_WRITE},
-		    {FD_ACCEPT_BIT, FD_ACCEPT},
-		};
-		int e;
-
-		noise_ultralight(socket);
-		noise_ultralight(things.lNetworkEvents);
-
-		for (e = 0; e < lenof(eventtypes); e++)
-		    if (things.lNetworkEvents & eventtypes[e].mask) {
-			LPARAM lp;
-			int err = things.iErrorCode[eventtypes[e].bit];
-			lp = WSAMAKESELECTREPLY(eventtypes[e].mask, err);
-			select_result(wp, lp);
-		    }
-	    }
-	}
-
-	sfree(sklist);
+	select_results();
     }
 
     sfree(handles);
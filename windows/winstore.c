@@ -7,8 +7,10 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <assert.h>
+#include <ctype.h>
 #include "putty.h"
 #include "storage.h"
+#include "tree234.h"
 
 #include <shlobj.h>
 #ifndef CSIDL_APPDATA
@@ -74,8 +76,56 @@ static void unmungestr(const char *in, char *out, int outlen)
     return;
 }
 
+/*
+ * The handle returned by open_settings_w is one of these. Rather
+ * than pushing each write_setting_*() straight into the registry -
+ * a session save makes a couple of hundred of those calls, and a
+ * registry round trip per value dominates the cost of a save - we
+ * collect all the values in memory and apply the whole batch in
+ * close_settings_w(). Where the OS provides transacted registry
+ * operations (Vista onwards) the batch is committed atomically, so
+ * a crash mid-save can't leave a half-written session.
+ */
+struct regwrval {
+    char *name;
+    DWORD type;
+    void *data;
+    DWORD len;
+};
+
+struct settings_w {
+    char *munged;		       /* session key name under puttystr */
+    struct regwrval *vals;
+    int nvals, valsize;
+};
+
+DECL_WINDOWS_FUNCTION(static, HANDLE, CreateTransaction,
+		      (LPSECURITY_ATTRIBUTES, LPGUID, DWORD, DWORD,
+		       DWORD, DWORD, LPWSTR));
+DECL_WINDOWS_FUNCTION(static, BOOL, CommitTransaction, (HANDLE));
+DECL_WINDOWS_FUNCTION(static, LONG, RegCreateKeyTransactedA,
+		      (HKEY, LPCSTR, DWORD, LPSTR, DWORD, REGSAM,
+		       LPSECURITY_ATTRIBUTES, PHKEY, LPDWORD,
+		       HANDLE, PVOID));
+
+static int init_reg_transactions(void)
+{
+    static int initialised = FALSE;
+    if (!initialised) {
+	HMODULE ktmw32 = load_system32_dll("ktmw32.dll");
+	HMODULE advapi32 = load_system32_dll("advapi32.dll");
+	GET_WINDOWS_FUNCTION_NO_TYPECHECK(ktmw32, CreateTransaction);
+	GET_WINDOWS_FUNCTION_NO_TYPECHECK(ktmw32, CommitTransaction);
+	GET_WINDOWS_FUNCTION_NO_TYPECHECK(advapi32, RegCreateKeyTransactedA);
+	initialised = TRUE;
+    }
+    return p_CreateTransaction && p_CommitTransaction &&
+	p_RegCreateKeyTransactedA;
+}
+
 void *open_settings_w(const char *sessionname, char **errmsg)
 {
+    struct settings_w *h;
     HKEY subkey1, sesskey;
     int ret;
     char *p;
@@ -88,6 +138,11 @@ void *open_settings_w(const char *sessionname, char **errmsg)
     p = snewn(3 * strlen(sessionname) + 1, char);
     mungestr(sessionname, p);
 
+    /*
+     * Create the session key up front, so that an unwritable
+     * registry is reported now rather than after the caller has
+     * generated the entire batch of values.
+     */
     ret = RegCreateKey(HKEY_CURRENT_USER, puttystr, &subkey1);
     if (ret != ERROR_SUCCESS) {
 	sfree(p);
@@ -103,33 +158,149 @@ void *open_settings_w(const char *sessionname, char **errmsg)
 	sfree(p);
 	return NULL;
     }
-    sfree(p);
-    return (void *) sesskey;
+    RegCloseKey(sesskey);
+
+    h = snew(struct settings_w);
+    h->munged = p;
+    h->vals = NULL;
+    h->nvals = h->valsize = 0;
+    return h;
+}
+
+static void queue_setting(struct settings_w *h, const char *key,
+			  DWORD type, const void *data, DWORD len)
+{
+    struct regwrval *val;
+
+    if (h->nvals >= h->valsize) {
+	h->valsize = h->nvals * 5 / 4 + 64;
+	h->vals = sresize(h->vals, h->valsize, struct regwrval);
+    }
+    val = &h->vals[h->nvals++];
+    val->name = dupstr(key);
+    val->type = type;
+    val->data = snewn(len, char);
+    memcpy(val->data, data, len);
+    val->len = len;
 }
 
 void write_setting_s(void *handle, const char *key, const char *value)
 {
     if (handle)
-	RegSetValueEx((HKEY) handle, key, 0, REG_SZ, (CONST BYTE *)value,
-		      1 + strlen(value));
+	queue_setting((struct settings_w *)handle, key, REG_SZ,
+		      value, 1 + strlen(value));
 }
 
 void write_setting_i(void *handle, const char *key, int value)
 {
     if (handle)
-	RegSetValueEx((HKEY) handle, key, 0, REG_DWORD,
-		      (CONST BYTE *) &value, sizeof(value));
+	queue_setting((struct settings_w *)handle, key, REG_DWORD,
+		      &value, sizeof(value));
 }
 
 void close_settings_w(void *handle)
 {
-    RegCloseKey((HKEY) handle);
+    struct settings_w *h = (struct settings_w *)handle;
+    char *fullpath;
+    HANDLE trans = INVALID_HANDLE_VALUE;
+    HKEY sesskey = NULL;
+    int i;
+
+    fullpath = dupcat(puttystr, "\\", h->munged, NULL);
+
+    if (init_reg_transactions()) {
+	trans = p_CreateTransaction(NULL, NULL, 0, 0, 0, 0, NULL);
+	if (trans != INVALID_HANDLE_VALUE &&
+	    p_RegCreateKeyTransactedA(HKEY_CURRENT_USER, fullpath, 0,
+				      NULL, REG_OPTION_NON_VOLATILE,
+				      KEY_WRITE, NULL, &sesskey, NULL,
+				      trans, NULL) != ERROR_SUCCESS) {
+	    CloseHandle(trans);	       /* rolls the transaction back */
+	    trans = INVALID_HANDLE_VALUE;
+	    sesskey = NULL;
+	}
+    }
+    if (!sesskey) {
+	/*
+	 * No transaction support; fall back to writing the batch
+	 * directly. Still only one key open/close round trip.
+	 */
+	if (RegCreateKey(HKEY_CURRENT_USER, fullpath,
+			 &sesskey) != ERROR_SUCCESS)
+	    sesskey = NULL;
+    }
+
+    if (sesskey) {
+	for (i = 0; i < h->nvals; i++) {
+	    struct regwrval *val = &h->vals[i];
+	    RegSetValueEx(sesskey, val->name, 0, val->type,
+			  (CONST BYTE *)val->data, val->len);
+	}
+	RegCloseKey(sesskey);
+    }
+    if (trans != INVALID_HANDLE_VALUE) {
+	p_CommitTransaction(trans);
+	CloseHandle(trans);
+    }
+
+    for (i = 0; i < h->nvals; i++) {
+	sfree(h->vals[i].name);
+	sfree(h->vals[i].data);
+    }
+    sfree(h->vals);
+    sfree(h->munged);
+    sfree(fullpath);
+    sfree(h);
+}
+
+/*
+ * The handle returned by open_settings_r is a tree234 of these
+ * records, one per value in the session's registry key. We enumerate
+ * the whole key in one pass at open time, so that the couple of
+ * hundred read_setting_*() calls involved in loading a session are
+ * in-memory lookups rather than registry round trips each.
+ */
+struct regval {
+    char *name;
+    DWORD type;
+    union {
+	char *s;			       /* REG_SZ */
+	DWORD d;			       /* REG_DWORD */
+    } u;
+};
+
+static void free_regval(struct regval *rv)
+{
+    if (rv->type == REG_SZ)
+	sfree(rv->u.s);
+    sfree(rv->name);
+    sfree(rv);
+}
+
+static int regvalcmp(void *av, void *bv)
+{
+    const char *a = ((struct regval *)av)->name;
+    const char *b = ((struct regval *)bv)->name;
+
+    /* Registry value names compare case-insensitively. */
+    while (*a || *b) {
+	int ac = tolower((unsigned char) *a);
+	int bc = tolower((unsigned char) *b);
+	if (ac != bc)
+	    return ac < bc ? -1 : +1;
+	a++, b++;
+    }
+    return 0;
 }
 
 void *open_settings_r(const char *sessionname)
 {
     HKEY subkey1, sesskey;
     char *p;
+    tree234 *tree;
+    DWORD maxnamelen, maxdatalen, index, namelen, datalen, type;
+    char *name;
+    BYTE *data;
 
     if (!sessionname || !*sessionname)
 	sessionname = "Default Settings";
@@ -148,50 +319,84 @@ void *open_settings_r(const char *sessionname)
 
     sfree(p);
 
-    return (void *) sesskey;
+    if (!sesskey)
+	return NULL;
+
+    if (RegQueryInfoKey(sesskey, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+			&maxnamelen, &maxdatalen, NULL, NULL)
+	!= ERROR_SUCCESS) {
+	maxnamelen = 16383;	       /* documented maximum */
+	maxdatalen = 65536;
+    }
+    name = snewn(maxnamelen + 1, char);
+    data = snewn(maxdatalen + 1, BYTE);
+
+    tree = newtree234(regvalcmp);
+
+    for (index = 0;; index++) {
+	struct regval *rv;
+
+	namelen = maxnamelen + 1;
+	datalen = maxdatalen;
+	if (RegEnumValue(sesskey, index, name, &namelen, NULL,
+			 &type, data, &datalen) != ERROR_SUCCESS)
+	    break;
+
+	if (type == REG_SZ) {
+	    rv = snew(struct regval);
+	    rv->type = type;
+	    rv->u.s = snewn(datalen + 1, char);
+	    memcpy(rv->u.s, data, datalen);
+	    rv->u.s[datalen] = '\0';   /* in case the data had no NUL */
+	} else if (type == REG_DWORD && datalen == sizeof(DWORD)) {
+	    rv = snew(struct regval);
+	    rv->type = type;
+	    memcpy(&rv->u.d, data, sizeof(DWORD));
+	} else {
+	    continue;		       /* a type we don't use; ignore it */
+	}
+	rv->name = dupstr(name);
+	if (add234(tree, rv) != rv)
+	    free_regval(rv);	       /* duplicate name; shouldn't happen */
+    }
+
+    sfree(name);
+    sfree(data);
+    RegCloseKey(sesskey);
+
+    return tree;
 }
 
 char *read_setting_s(void *handle, const char *key)
 {
-    DWORD type, allocsize, size;
-    char *ret;
+    tree234 *tree = (tree234 *) handle;
+    struct regval tmp, *rv;
 
-    if (!handle)
+    if (!tree)
 	return NULL;
 
-    /* Find out the type and size of the data. */
-    if (RegQueryValueEx((HKEY) handle, key, 0,
-			&type, NULL, &size) != ERROR_SUCCESS ||
-	type != REG_SZ)
+    tmp.name = (char *) key;
+    rv = find234(tree, &tmp, NULL);
+    if (!rv || rv->type != REG_SZ)
 	return NULL;
 
-    allocsize = size+1;         /* allow for an extra NUL if needed */
-    ret = snewn(allocsize, char);
-    if (RegQueryValueEx((HKEY) handle, key, 0,
-			&type, (BYTE *)ret, &size) != ERROR_SUCCESS ||
-	type != REG_SZ) {
-        sfree(ret);
-        return NULL;
-    }
-    assert(size < allocsize);
-    ret[size] = '\0'; /* add an extra NUL in case RegQueryValueEx
-                       * didn't supply one */
-
-    return ret;
+    return dupstr(rv->u.s);
 }
 
 int read_setting_i(void *handle, const char *key, int defvalue)
 {
-    DWORD type, val, size;
-    size = sizeof(val);
+    tree234 *tree = (tree234 *) handle;
+    struct regval tmp, *rv;
 
-    if (!handle ||
-	RegQueryValueEx((HKEY) handle, key, 0, &type,
-			(BYTE *) &val, &size) != ERROR_SUCCESS ||
-	size != sizeof(val) || type != REG_DWORD)
+    if (!tree)
 	return defvalue;
-    else
-	return val;
+
+    tmp.name = (char *) key;
+    rv = find234(tree, &tmp, NULL);
+    if (!rv || rv->type != REG_DWORD)
+	return defvalue;
+
+    return rv->u.d;
 }
 
 FontSpec *read_setting_fontspec(void *handle, const char *name)
@@ -268,7 +473,15 @@ void write_setting_filename(void *handle, const char *name, Filename *result)
 
 void close_settings_r(void *handle)
 {
-    RegCloseKey((HKEY) handle);
+    tree234 *tree = (tree234 *) handle;
+    struct regval *rv;
+
+    if (!tree)
+	return;
+
+    while ((rv = delpos234(tree, 0)) != NULL)
+	free_regval(rv);
+    freetree234(tree);
 }
 
 void del_settings(const char *sessionname)
@@ -289,24 +502,81 @@ void del_settings(const char *sessionname)
     remove_session_from_jumplist(sessionname);
 }
 
+/*
+ * Enumerating saved sessions used to hit the registry once per entry
+ * every time anyone called get_sesslist() - and the Saved Sessions
+ * menu does that each time it pops up, which with hundreds of saved
+ * sessions made opening the menu lag. So we enumerate the Sessions
+ * key once, keep the (munged) subkey names for the lifetime of the
+ * process, and ask the registry to signal an event if the set of
+ * subkeys changes - whether by this process or any other - via
+ * RegNotifyChangeKeyValue. Each enumeration then starts with a
+ * zero-timeout check of that event, and only re-reads the registry
+ * if something has actually changed. (The notification request is
+ * one-shot, so it's re-armed after every refresh.)
+ */
+static HKEY sesscache_key = NULL;
+static HANDLE sesscache_event = NULL;
+static int sesscache_valid = FALSE;
+static char **sesscache_names = NULL;
+static int sesscache_nnames = 0, sesscache_namesize = 0;
+
+static void sesscache_refresh(void)
+{
+    char name[4096];
+    int i;
+
+    for (i = 0; i < sesscache_nnames; i++)
+	sfree(sesscache_names[i]);
+    sesscache_nnames = 0;
+    sesscache_valid = FALSE;
+
+    if (!sesscache_key &&
+	RegOpenKey(HKEY_CURRENT_USER, puttystr, &sesscache_key) !=
+	ERROR_SUCCESS) {
+	sesscache_key = NULL;	       /* no Sessions key (yet) */
+	return;
+    }
+
+    for (i = 0;
+	 RegEnumKey(sesscache_key, i, name, sizeof(name)) == ERROR_SUCCESS;
+	 i++) {
+	if (sesscache_nnames >= sesscache_namesize) {
+	    sesscache_namesize = sesscache_nnames * 3 / 2 + 16;
+	    sesscache_names = sresize(sesscache_names, sesscache_namesize,
+				      char *);
+	}
+	sesscache_names[sesscache_nnames++] = dupstr(name);
+    }
+
+    if (!sesscache_event)
+	sesscache_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (sesscache_event &&
+	RegNotifyChangeKeyValue(sesscache_key, TRUE,
+				REG_NOTIFY_CHANGE_NAME,
+				sesscache_event, TRUE) == ERROR_SUCCESS)
+	sesscache_valid = TRUE;
+    /* else: we can't watch for changes, so re-enumerate every time */
+}
+
 struct enumsettings {
-    HKEY key;
     int i;
 };
 
 void *enum_settings_start(void)
 {
     struct enumsettings *ret;
-    HKEY key;
 
-    if (RegOpenKey(HKEY_CURRENT_USER, puttystr, &key) != ERROR_SUCCESS)
+    if (!sesscache_valid ||
+	WaitForSingleObject(sesscache_event, 0) == WAIT_OBJECT_0)
+	sesscache_refresh();
+
+    if (!sesscache_key)
 	return NULL;
 
     ret = snew(struct enumsettings);
-    if (ret) {
-	ret->key = key;
+    if (ret)
 	ret->i = 0;
-    }
 
     return ret;
 }
@@ -314,14 +584,11 @@ void *enum_settings_start(void)
 char *enum_settings_next(void *handle, char *buffer, int buflen)
 {
     struct enumsettings *e = (struct enumsettings *) handle;
-    char *otherbuf;
-    otherbuf = snewn(3 * buflen, char);
-    if (RegEnumKey(e->key, e->i++, otherbuf, 3 * buflen) == ERROR_SUCCESS) {
-	unmungestr(otherbuf, buffer, buflen);
-	sfree(otherbuf);
+
+    if (e->i < sesscache_nnames) {
+	unmungestr(sesscache_names[e->i++], buffer, buflen);
 	return buffer;
     } else {
-	sfree(otherbuf);
 	return NULL;
     }
 }
@@ -329,7 +596,6 @@ char *enum_settings_next(void *handle, char *buffer, int buflen)
 void enum_settings_finish(void *handle)
 {
     struct enumsettings *e = (struct enumsettings *) handle;
-    RegCloseKey(e->key);
     sfree(e);
 }
 
@@ -484,6 +750,91 @@ void store_host_key(const char *hostname, int port,
     sfree(regname);
 }
 
+/*
+ * The per-host hint caches (learned kex algorithms, accepted auth
+ * keys) live beside the host key store, each in its own registry
+ * key, indexed by "port:hostname". They're hints rather than
+ * security records - a stale or missing entry just costs a guessed
+ * packet or a refused attempt - so failures here are silent.
+ */
+static char *hintcache_regname(const char *hostname, int port)
+{
+    char *regname = snewn(3 * strlen(hostname) + 15, char);
+    sprintf(regname, "%d:", port);
+    mungestr(hostname, regname + strlen(regname));
+    return regname;
+}
+
+static char *read_hint_cache(const char *regkey,
+			     const char *hostname, int port)
+{
+    char *regname, *value;
+    HKEY rkey;
+    DWORD type, size;
+
+    if (RegOpenKey(HKEY_CURRENT_USER, regkey, &rkey) != ERROR_SUCCESS)
+	return NULL;
+
+    regname = hintcache_regname(hostname, port);
+
+    value = NULL;
+    if (RegQueryValueEx(rkey, regname, NULL, &type, NULL, &size) ==
+	ERROR_SUCCESS && type == REG_SZ) {
+	value = snewn(size + 1, char);
+	if (RegQueryValueEx(rkey, regname, NULL, &type, (BYTE *)value,
+			    &size) == ERROR_SUCCESS && type == REG_SZ) {
+	    value[size] = '\0';
+	} else {
+	    sfree(value);
+	    value = NULL;
+	}
+    }
+
+    RegCloseKey(rkey);
+    sfree(regname);
+    return value;
+}
+
+static void store_hint_cache(const char *regkey,
+			     const char *hostname, int port,
+			     const char *value)
+{
+    char *regname;
+    HKEY rkey;
+
+    regname = hintcache_regname(hostname, port);
+
+    if (RegCreateKey(HKEY_CURRENT_USER, regkey, &rkey) == ERROR_SUCCESS) {
+	RegSetValueEx(rkey, regname, 0, REG_SZ, (CONST BYTE *)value,
+		      strlen(value) + 1);
+	RegCloseKey(rkey);
+    }
+
+    sfree(regname);
+}
+
+char *read_learned_kex(const char *hostname, int port)
+{
+    return read_hint_cache(PUTTY_REG_POS "\\SshKexCache", hostname, port);
+}
+
+void store_learned_kex(const char *hostname, int port, const char *algs)
+{
+    store_hint_cache(PUTTY_REG_POS "\\SshKexCache", hostname, port, algs);
+}
+
+char *read_accepted_pubkey(const char *hostname, int port)
+{
+    return read_hint_cache(PUTTY_REG_POS "\\SshAuthCache", hostname, port);
+}
+
+void store_accepted_pubkey(const char *hostname, int port,
+			   const char *fingerprint)
+{
+    store_hint_cache(PUTTY_REG_POS "\\SshAuthCache",
+		     hostname, port, fingerprint);
+}
+
 /*
  * Open (or delete) the random seed file.
  */
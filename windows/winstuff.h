@@ -29,6 +29,14 @@
 
 #define BUILDINFO_PLATFORM "Windows"
 
+/*
+ * The window can have its pixels moved in place by ScrollWindow, so
+ * enable terminal.c's scroll optimisation: window.c implements
+ * do_scroll() and only the lines a scroll exposes go back through
+ * ExtTextOut.
+ */
+#define OPTIMISE_SCROLL
+
 struct Filename {
     char *path;
 };
@@ -296,6 +304,7 @@ void write_aclip(void *frontend, int clipboard, char *, int, int);
  * Exports from winnet.c.
  */
 extern void select_result(WPARAM, LPARAM);
+extern void select_results(void);
 
 /*
  * winnet.c dynamically loads WinSock 2 or WinSock 1 depending on
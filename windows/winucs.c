@@ -437,7 +437,7 @@ static const struct cp_list_item cp_list[] = {
 
 static void link_font(WCHAR * line_tbl, WCHAR * font_tbl, WCHAR attr);
 
-void init_ucs(Conf *conf, struct unicode_data *ucsdata)
+static void init_ucs_real(Conf *conf, struct unicode_data *ucsdata)
 {
     int i, j;
     int used_dtf = 0;
@@ -600,13 +600,70 @@ void init_ucs(Conf *conf, struct unicode_data *ucsdata)
 	    if (!DIRECT_FONT(ucsdata->unitab_xterm[i]))
 		ucsdata->unitab_xterm[i] =
 	    (WCHAR) (CSET_ACP + poorman_vt100[i - 96]);
-	for(i=128;i<256;i++) 
+	for(i=128;i<256;i++)
 	    if (!DIRECT_FONT(ucsdata->unitab_scoacs[i]))
-		ucsdata->unitab_scoacs[i] = 
+		ucsdata->unitab_scoacs[i] =
 		    (WCHAR) (CSET_ACP + poorman_scoacs[i - 128]);
     }
 }
 
+/*
+ * Building the translation tables above means a lot of trips through
+ * MultiByteToWideChar and the charset library, and the inputs come
+ * from a handful of settings (the line codepage and VT mode from
+ * conf, plus the font codepage and DBCS flag the frontend filled in
+ * before calling us) which are nearly always the same from one
+ * window, or one reconfiguration, to the next. So we keep every
+ * distinct result for the life of the process and hand out copies,
+ * sharing the uni_tbl reverse-lookup allocations read-only between
+ * all the windows using them.
+ *
+ * Entries are deliberately never freed: the set of distinct
+ * configurations a process ever uses is tiny, and windows keep
+ * using their copies (including the shared uni_tbl pointer)
+ * indefinitely. For the same reason the wrapper, unlike the old
+ * code, never frees a caller's previous uni_tbl on reconfiguration:
+ * other windows may share it.
+ */
+struct ucs_cache_entry {
+    struct ucs_cache_entry *next;
+    char *line_codepage;
+    int vtmode, font_codepage, dbcs_screenfont;
+    struct unicode_data data;
+};
+static struct ucs_cache_entry *ucs_cache = NULL;
+
+void init_ucs(Conf *conf, struct unicode_data *ucsdata)
+{
+    char *line_codepage = conf_get_str(conf, CONF_line_codepage);
+    int vtmode = conf_get_int(conf, CONF_vtmode);
+    struct ucs_cache_entry *e;
+
+    for (e = ucs_cache; e; e = e->next) {
+	if (!strcmp(e->line_codepage, line_codepage) &&
+	    e->vtmode == vtmode &&
+	    e->font_codepage == ucsdata->font_codepage &&
+	    e->dbcs_screenfont == ucsdata->dbcs_screenfont) {
+	    *ucsdata = e->data;	       /* structure copy */
+	    return;
+	}
+    }
+
+    e = snew(struct ucs_cache_entry);
+    e->line_codepage = dupstr(line_codepage);
+    e->vtmode = vtmode;
+    e->font_codepage = ucsdata->font_codepage;
+    e->dbcs_screenfont = ucsdata->dbcs_screenfont;
+    memset(&e->data, 0, sizeof(e->data));
+    e->data.font_codepage = ucsdata->font_codepage;
+    e->data.dbcs_screenfont = ucsdata->dbcs_screenfont;
+    init_ucs_real(conf, &e->data);
+    e->next = ucs_cache;
+    ucs_cache = e;
+
+    *ucsdata = e->data;
+}
+
 static void link_font(WCHAR * line_tbl, WCHAR * font_tbl, WCHAR attr)
 {
     int font_index, line_index, i;
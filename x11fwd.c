@@ -4,8 +4,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <assert.h>
 #include <time.h>
+#include <sys/stat.h>
 
 #include "putty.h"
 #include "ssh.h"
@@ -68,6 +70,66 @@ static const struct plug_function_table dummy_plug = {
     dummy_plug_sent, dummy_plug_accepting
 };
 
+/*
+ * Plug that babysits a spare pre-opened connection to the real X
+ * server while it waits in the display's one-slot pool. The X server
+ * sends nothing until it has seen the client's greeting, so the only
+ * event we expect is the connection dying, which we note so that
+ * nobody adopts a dead socket.
+ */
+static void x11_spare_closing(Plug plug, const char *error_msg,
+			      int error_code, int calling_back)
+{
+    struct X11Display *disp = (struct X11Display *)
+	((char *)plug - offsetof(struct X11Display, sparefn));
+    disp->spare_dead = TRUE;
+}
+static const struct plug_function_table x11_spare_plug = {
+    dummy_plug_log, x11_spare_closing, dummy_plug_receive,
+    dummy_plug_sent, NULL
+};
+
+/*
+ * Open a replacement spare connection to the display, if its pool
+ * slot is empty. Failure is no worse than the next X client paying
+ * the connect latency itself, so it's silent.
+ */
+static void x11_open_spare(struct X11Display *disp, Conf *conf)
+{
+    Socket s;
+
+    if (disp->sparesock)
+	return;
+    s = new_connection(sk_addr_dup(disp->addr), disp->realhost, disp->port,
+		       0, 1, 0, 0, (Plug)&disp->sparefn, conf);
+    if (sk_socket_error(s) != NULL) {
+	sk_close(s);
+	return;
+    }
+    disp->spare_dead = FALSE;
+    disp->sparesock = s;
+}
+
+/*
+ * Adopt the display's spare connection, if there is one and it's
+ * still alive, re-pointing its plug at the new owner. Returns NULL
+ * if the caller must connect for itself.
+ */
+static Socket x11_take_spare(struct X11Display *disp, Plug plug)
+{
+    Socket s = disp->sparesock;
+
+    if (!s)
+	return NULL;
+    disp->sparesock = NULL;
+    if (disp->spare_dead || sk_socket_error(s) != NULL) {
+	sk_close(s);
+	return NULL;
+    }
+    sk_plug(s, plug);
+    return s;
+}
+
 struct X11FakeAuth *x11_invent_fake_auth(tree234 *authtree, int authtype)
 {
     struct X11FakeAuth *auth = snew(struct X11FakeAuth);
@@ -338,6 +400,11 @@ struct X11Display *x11_setup_display(const char *display, Conf *conf)
     disp->localauthproto = X11_NO_AUTH;
     disp->localauthdata = NULL;
     disp->localauthdatalen = 0;
+    disp->authfilename = NULL;
+    disp->authfile_mtime = 0;
+    disp->sparefn = &x11_spare_plug;
+    disp->sparesock = NULL;
+    disp->spare_dead = FALSE;
     platform_get_x11_auth(disp, conf);
 
     return disp;
@@ -345,6 +412,9 @@ struct X11Display *x11_setup_display(const char *display, Conf *conf)
 
 void x11_free_display(struct X11Display *disp)
 {
+    if (disp->sparesock)
+	sk_close(disp->sparesock);
+    sfree(disp->authfilename);
     sfree(disp->hostname);
     sfree(disp->unixsocketpath);
     if (disp->localauthdata)
@@ -455,6 +525,7 @@ void x11_get_auth_from_authfile(struct X11Display *disp,
     int family, protocol;
     int ideal_match = FALSE;
     char *ourhostname;
+    struct stat st;
 
     /*
      * Normally we should look for precisely the details specified in
@@ -483,6 +554,18 @@ void x11_get_auth_from_authfile(struct X11Display *disp,
     if (!authfp)
 	return;
 
+    /*
+     * Remember where these details came from, and the file's current
+     * modification time, so that x11_refresh_auth() can spot later
+     * changes and re-read it.
+     */
+    if (disp->authfilename != authfilename) {
+	sfree(disp->authfilename);
+	disp->authfilename = dupstr(authfilename);
+    }
+    disp->authfile_mtime =
+	stat(authfilename, &st) == 0 ? (unsigned long)st.st_mtime : 0;
+
     ourhostname = get_hostname();
 
     /* Records in .Xauthority contain four strings of up to 64K each */
@@ -605,6 +688,25 @@ void x11_get_auth_from_authfile(struct X11Display *disp,
     sfree(ourhostname);
 }
 
+/*
+ * Called for each new forwarded X connection: if the authority file
+ * we took the local display's credentials from has changed on disk
+ * since we read it (say the user re-ran xauth), re-read it, so that
+ * a long-lived session doesn't keep presenting a stale cookie. The
+ * common case is one cheap stat() per connection.
+ */
+static void x11_refresh_auth(struct X11Display *disp)
+{
+    struct stat st;
+
+    if (!disp->authfilename)
+	return;
+    if (stat(disp->authfilename, &st) == 0 &&
+	(unsigned long)st.st_mtime == disp->authfile_mtime)
+	return;
+    x11_get_auth_from_authfile(disp, disp->authfilename);
+}
+
 static void x11_log(Plug p, int type, SockAddr addr, int port,
 		    const char *error_msg, int error_code)
 {
@@ -819,6 +921,17 @@ int x11_send(struct X11Connection *xconn, char *data, int len)
     if (!xconn)
 	return 0;
 
+    /*
+     * Once the connection setup has been parsed and verified,
+     * everything further we receive is raw X protocol data to pass
+     * straight through to the X server. The channel layer batches the
+     * small writes in the other direction, and the socket buffers
+     * these ones, so all we need do here is hand the data on without
+     * re-walking the setup-parsing state machine below.
+     */
+    if (xconn->verified)
+        return sk_write(xconn->s, data, len);
+
     /*
      * Read the first packet.
      */
@@ -912,10 +1025,13 @@ int x11_send(struct X11Connection *xconn, char *data, int len)
          */
         sshfwd_x11_is_local(xconn->c);
         xconn->disp = auth_matched->disp;
-        xconn->s = new_connection(sk_addr_dup(xconn->disp->addr),
-                                  xconn->disp->realhost, xconn->disp->port, 
-                                  0, 1, 0, 0, (Plug) xconn,
-                                  sshfwd_get_conf(xconn->c));
+        x11_refresh_auth(xconn->disp);
+        xconn->s = x11_take_spare(xconn->disp, (Plug) xconn);
+        if (!xconn->s)
+            xconn->s = new_connection(sk_addr_dup(xconn->disp->addr),
+                                      xconn->disp->realhost, xconn->disp->port,
+                                      0, 1, 0, 0, (Plug) xconn,
+                                      sshfwd_get_conf(xconn->c));
         if ((err = sk_socket_error(xconn->s)) != NULL) {
             char *err_message = dupprintf("unable to connect to"
                                           " forwarded X server: %s", err);
@@ -924,6 +1040,12 @@ int x11_send(struct X11Connection *xconn, char *data, int len)
             return 0;
         }
 
+        /*
+         * Refill the pool in the background, so that the next X
+         * client to arrive skips the connect latency too.
+         */
+        x11_open_spare(xconn->disp, sshfwd_get_conf(xconn->c));
+
         /*
          * Write a new connection header containing our replacement
          * auth data.